@@ -20,6 +20,8 @@
 #include <linux/kvm.h>
 
 #include "qemu/atomic.h"
+#include "qemu/host-utils.h"
+#include "qemu/rcu.h"
 #include "qemu/option.h"
 #include "qemu/config-file.h"
 #include "qemu/error-report.h"
@@ -30,6 +32,7 @@
 #include "gdbstub/enums.h"
 #include "sysemu/kvm_int.h"
 #include "sysemu/runstate.h"
+#include "sysemu/sysemu.h"
 #include "sysemu/cpus.h"
 #include "sysemu/accel-blocker.h"
 #include "qemu/bswap.h"
@@ -487,6 +490,12 @@ int kvm_create_and_park_vcpu(CPUState *cpu)
     return ret;
 }
 
+static struct KVMDirtyRingReaper *kvm_dirty_ring_reaper_of(KVMState *s,
+                                                            CPUState *cpu)
+{
+    return &s->reapers[cpu->cpu_index % s->nr_reapers];
+}
+
 static int do_kvm_destroy_vcpu(CPUState *cpu)
 {
     KVMState *s = kvm_state;
@@ -513,7 +522,15 @@ static int do_kvm_destroy_vcpu(CPUState *cpu)
     }
 
     if (cpu->kvm_dirty_gfns) {
+        struct KVMDirtyRingReaper *r = kvm_dirty_ring_reaper_of(s, cpu);
+
+        /* The reapers walk the rings without the BQL */
+        qemu_mutex_lock(&r->lock);
         ret = munmap(cpu->kvm_dirty_gfns, s->kvm_dirty_ring_bytes);
+        if (!ret) {
+            cpu->kvm_dirty_gfns = NULL;
+        }
+        qemu_mutex_unlock(&r->lock);
         if (ret < 0) {
             goto err;
         }
@@ -788,6 +805,7 @@ static void kvm_dirty_ring_mark_page(KVMState *s, uint32_t as_id,
     }
 
     set_bit(offset, mem->dirty_bmap);
+    mem->dirty_pages++;
 }
 
 static bool dirty_gfn_is_dirtied(struct kvm_dirty_gfn *gfn)
@@ -821,10 +839,12 @@ static void dirty_gfn_set_collected(struct kvm_dirty_gfn *gfn)
 }
 
 /*
- * Should be with all slots_lock held for the address spaces.  It returns the
- * dirty page we've collected on this dirty ring.
+ * Move the dirty pages of this vCPU's dirty ring to @gfns and mark them
+ * collected.  Must be called with the lock of the vCPU's reaper held.  It
+ * returns the dirty page we've collected on this dirty ring.
  */
-static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
+static uint32_t kvm_dirty_ring_collect_one(KVMState *s, CPUState *cpu,
+                                           GArray *gfns)
 {
     struct kvm_dirty_gfn *dirty_gfns = cpu->kvm_dirty_gfns, *cur;
     uint32_t ring_size = s->kvm_dirty_ring_size;
@@ -833,13 +853,13 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     /*
      * It's possible that we race with vcpu creation code where the vcpu is
      * put onto the vcpus list but not yet initialized the dirty ring
-     * structures.  If so, skip it.
+     * structures, or that the vcpu is already gone.  If so, skip it.
      */
-    if (!cpu->created) {
+    if (!cpu->created || !dirty_gfns) {
         return 0;
     }
 
-    assert(dirty_gfns && ring_size);
+    assert(ring_size);
     trace_kvm_dirty_ring_reap_vcpu(cpu->cpu_index);
 
     while (true) {
@@ -847,8 +867,7 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
         if (!dirty_gfn_is_dirtied(cur)) {
             break;
         }
-        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
-                                 cur->offset);
+        g_array_append_val(gfns, *cur);
         dirty_gfn_set_collected(cur);
         trace_kvm_dirty_ring_page(cpu->cpu_index, fetch, cur->offset);
         fetch++;
@@ -860,44 +879,96 @@ static uint32_t kvm_dirty_ring_reap_one(KVMState *s, CPUState *cpu)
     return count;
 }
 
-/* Must be with slots_lock held */
-static uint64_t kvm_dirty_ring_reap_locked(KVMState *s, CPUState* cpu)
+/*
+ * Collect the rings of the vCPUs of @r, or only the one of @cpu, and
+ * return the number of pages collected from the fullest ring in
+ * @fullest.  Called with r->lock held.
+ */
+static void kvm_dirty_ring_collect(KVMState *s, struct KVMDirtyRingReaper *r,
+                                   CPUState *cpu, uint32_t *fullest)
 {
-    int ret;
-    uint64_t total = 0;
-    int64_t stamp;
-
-    stamp = get_clock();
+    uint32_t count, max = 0;
 
     if (cpu) {
-        total = kvm_dirty_ring_reap_one(s, cpu);
+        max = kvm_dirty_ring_collect_one(s, cpu, r->gfns);
     } else {
+        RCU_READ_LOCK_GUARD();
         CPU_FOREACH(cpu) {
-            total += kvm_dirty_ring_reap_one(s, cpu);
+            if (kvm_dirty_ring_reaper_of(s, cpu) == r) {
+                count = kvm_dirty_ring_collect_one(s, cpu, r->gfns);
+                max = MAX(max, count);
+            }
         }
     }
-
-    if (total) {
-        ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
-        assert(ret == total);
+    if (fullest) {
+        *fullest = max;
     }
+}
 
-    stamp = get_clock() - stamp;
+/*
+ * Re-protect the pages collected since the reset counter was @seq.
+ * KVM_RESET_DIRTY_RINGS resets the collected entries of every ring,
+ * so if another reaper started one since, it covered ours already.
+ * Should be with all slots_lock held for the address spaces.
+ */
+static void kvm_dirty_ring_reset(KVMState *s, uint64_t seq)
+{
+    int ret;
 
-    if (total) {
-        trace_kvm_dirty_ring_reap(total, stamp / 1000);
+    if (s->dirty_ring_reset_seq != seq) {
+        stat64_add(&s->dirty_ring_stats.resets_skipped, 1);
+        return;
     }
 
-    return total;
+    qatomic_set(&s->dirty_ring_reset_seq, seq + 1);
+    ret = kvm_vm_ioctl(s, KVM_RESET_DIRTY_RINGS);
+    assert(ret >= 0);
+    stat64_add(&s->dirty_ring_stats.resets, 1);
+}
+
+/* Should be with all slots_lock held for the address spaces. */
+static void kvm_dirty_ring_publish(KVMState *s, GArray *gfns)
+{
+    guint i;
+
+    for (i = 0; i < gfns->len; i++) {
+        struct kvm_dirty_gfn *cur = &g_array_index(gfns, struct kvm_dirty_gfn,
+                                                   i);
+
+        kvm_dirty_ring_mark_page(s, cur->slot >> 16, cur->slot & 0xffff,
+                                 cur->offset);
+    }
+    g_array_set_size(gfns, 0);
 }
 
 /*
- * Currently for simplicity, we must hold BQL before calling this.  We can
- * consider to drop the BQL if we're clear with all the race conditions.
+ * Reap the rings of the vCPUs of @r, or only the one of @cpu.  Reapers
+ * walk their rings in parallel, and only take the slots_lock to reset
+ * the rings and publish what they collected.
  */
-static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
+static uint64_t kvm_dirty_ring_reap_one(KVMState *s,
+                                        struct KVMDirtyRingReaper *r,
+                                        CPUState *cpu, uint32_t *fullest)
 {
-    uint64_t total;
+    uint64_t total, seq;
+    int64_t stamp;
+
+    stamp = get_clock();
+
+    QEMU_LOCK_GUARD(&r->lock);
+    kvm_dirty_ring_collect(s, r, cpu, fullest);
+    total = r->gfns->len;
+    if (!total) {
+        return 0;
+    }
+
+    /*
+     * Order the stores marking the entries collected before reading the
+     * counter; pairs with the ioctl in kvm_dirty_ring_reset(), which
+     * cannot miss them if its counter update is not visible here.
+     */
+    smp_mb();
+    seq = qatomic_read(&s->dirty_ring_reset_seq);
 
     /*
      * We need to lock all kvm slots for all address spaces here,
@@ -915,9 +986,57 @@ static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
      *     reset below.
      */
     kvm_slots_lock();
-    total = kvm_dirty_ring_reap_locked(s, cpu);
+    kvm_dirty_ring_reset(s, seq);
+    kvm_dirty_ring_publish(s, r->gfns);
     kvm_slots_unlock();
 
+    stamp = get_clock() - stamp;
+    stat64_add(&s->dirty_ring_stats.reaps, 1);
+    stat64_add(&s->dirty_ring_stats.reap_ns, stamp);
+    stat64_max(&s->dirty_ring_stats.reap_max_ns, stamp);
+    trace_kvm_dirty_ring_reap(total, stamp / 1000);
+
+    return total;
+}
+
+/*
+ * Must be with slots_lock held.  Reapers that are busy are skipped, as
+ * they take the locks in the opposite order; what they collected is
+ * published as soon as the caller drops the slots_lock.
+ */
+static void kvm_dirty_ring_reap_locked(KVMState *s)
+{
+    unsigned int i;
+
+    for (i = 0; i < s->nr_reapers; i++) {
+        struct KVMDirtyRingReaper *r = &s->reapers[i];
+
+        if (qemu_mutex_trylock(&r->lock)) {
+            continue;
+        }
+        kvm_dirty_ring_collect(s, r, NULL, NULL);
+        if (r->gfns->len) {
+            kvm_dirty_ring_reset(s, s->dirty_ring_reset_seq);
+            kvm_dirty_ring_publish(s, r->gfns);
+        }
+        qemu_mutex_unlock(&r->lock);
+    }
+}
+
+/* Reap the ring of @cpu, or the rings of all vCPUs if @cpu is NULL */
+static uint64_t kvm_dirty_ring_reap(KVMState *s, CPUState *cpu)
+{
+    uint64_t total = 0;
+    unsigned int i;
+
+    if (cpu) {
+        return kvm_dirty_ring_reap_one(s, kvm_dirty_ring_reaper_of(s, cpu),
+                                       cpu, NULL);
+    }
+    for (i = 0; i < s->nr_reapers; i++) {
+        total += kvm_dirty_ring_reap_one(s, &s->reapers[i], NULL, NULL);
+    }
+
     return total;
 }
 
@@ -1445,40 +1564,61 @@ int kvm_set_memory_attributes_shared(hwaddr start, uint64_t size)
     return kvm_set_memory_attributes(start, size, 0);
 }
 
-/* Called with KVMMemoryListener.slots_lock held */
-static void kvm_set_phys_mem(KVMMemoryListener *kml,
-                             MemoryRegionSection *section, bool add)
+/*
+ * Find out where the memslots of @section go in guest and host memory.
+ * Returns their total size, or 0 if the section has no memslots; @add
+ * is cleared if the section must be removed from KVM rather than added.
+ */
+static hwaddr kvm_section_mapping(MemoryRegionSection *section, bool *add,
+                                  hwaddr *start_addr, void **ram,
+                                  ram_addr_t *ram_start_offset)
 {
-    KVMSlot *mem;
-    int err;
     MemoryRegion *mr = section->mr;
     bool writable = !mr->readonly && !mr->rom_device;
-    hwaddr start_addr, size, slot_size, mr_offset;
-    ram_addr_t ram_start_offset;
-    void *ram;
+    hwaddr size, mr_offset;
 
     if (!memory_region_is_ram(mr)) {
         if (writable || !kvm_readonly_mem_allowed) {
-            return;
+            return 0;
         } else if (!mr->romd_mode) {
             /* If the memory device is not in romd_mode, then we actually want
              * to remove the kvm memory slot so all accesses will trap. */
-            add = false;
+            *add = false;
         }
     }
 
-    size = kvm_align_section(section, &start_addr);
+    size = kvm_align_section(section, start_addr);
     if (!size) {
-        return;
+        return 0;
     }
 
     /* The offset of the kvmslot within the memory region */
-    mr_offset = section->offset_within_region + start_addr -
+    mr_offset = section->offset_within_region + *start_addr -
         section->offset_within_address_space;
 
     /* use aligned delta to align the ram address and offset */
-    ram = memory_region_get_ram_ptr(mr) + mr_offset;
-    ram_start_offset = memory_region_get_ram_addr(mr) + mr_offset;
+    *ram = memory_region_get_ram_ptr(mr) + mr_offset;
+    *ram_start_offset = memory_region_get_ram_addr(mr) + mr_offset;
+
+    return size;
+}
+
+/* Called with KVMMemoryListener.slots_lock held */
+static void kvm_set_phys_mem(KVMMemoryListener *kml,
+                             MemoryRegionSection *section, bool add)
+{
+    KVMSlot *mem;
+    int err;
+    MemoryRegion *mr = section->mr;
+    hwaddr start_addr, size, slot_size;
+    ram_addr_t ram_start_offset;
+    void *ram;
+
+    size = kvm_section_mapping(section, &add, &start_addr, &ram,
+                               &ram_start_offset);
+    if (!size) {
+        return;
+    }
 
     if (!add) {
         do {
@@ -1502,7 +1642,7 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
                  * Not easy.  Let's cross the fingers until it's fixed.
                  */
                 if (kvm_state->kvm_dirty_ring_size) {
-                    kvm_dirty_ring_reap_locked(kvm_state, NULL);
+                    kvm_dirty_ring_reap_locked(kvm_state);
                     if (kvm_state->kvm_dirty_ring_with_bitmap) {
                         kvm_slot_sync_dirty_pages(mem);
                         kvm_slot_get_dirty_log(kvm_state, mem);
@@ -1569,10 +1709,269 @@ static void kvm_set_phys_mem(KVMMemoryListener *kml,
     } while (size);
 }
 
+/* Weight of the last interval in the estimated dirty rates, in eighths */
+#define KVM_DIRTY_RATE_WEIGHT 2
+
+static uint64_t kvm_dirty_rate_ewma(uint64_t rate, uint64_t pages,
+                                    int64_t elapsed)
+{
+    uint64_t sample = muldiv64(pages, NANOSECONDS_PER_SECOND, elapsed);
+
+    return (rate * (8 - KVM_DIRTY_RATE_WEIGHT) +
+            sample * KVM_DIRTY_RATE_WEIGHT) / 8;
+}
+
+/*
+ * Update the estimated dirty rates of the vCPUs and memory slots from the
+ * pages collected from the dirty rings since the last update, whoever
+ * collected them.  Must be called with the BQL held.
+ */
+static void kvm_dirty_rate_update(KVMState *s)
+{
+    int64_t now = get_clock();
+    int64_t elapsed = now - s->dirty_rate_stamp;
+    CPUState *cpu;
+    int i, j;
+
+    if (!s->dirty_rate_stamp || elapsed <= 0) {
+        s->dirty_rate_stamp = now;
+        return;
+    }
+    s->dirty_rate_stamp = now;
+
+    CPU_FOREACH(cpu) {
+        cpu->kvm_dirty_rate =
+            kvm_dirty_rate_ewma(cpu->kvm_dirty_rate,
+                                cpu->dirty_pages - cpu->kvm_dirty_pages_last,
+                                elapsed);
+        cpu->kvm_dirty_pages_last = cpu->dirty_pages;
+    }
+
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_as; i++) {
+        KVMMemoryListener *kml = s->as[i].ml;
+
+        if (!kml) {
+            continue;
+        }
+        for (j = 0; j < kml->nr_slots_allocated; j++) {
+            KVMSlot *mem = &kml->slots[j];
+
+            if (!mem->memory_size) {
+                continue;
+            }
+            mem->dirty_rate =
+                kvm_dirty_rate_ewma(mem->dirty_rate,
+                                    mem->dirty_pages - mem->dirty_pages_last,
+                                    elapsed);
+            mem->dirty_pages_last = mem->dirty_pages;
+        }
+    }
+    kvm_slots_unlock();
+}
+
+static StatsList *kvm_dirty_rate_add(StatsList *list, strList *names,
+                                     const char *name, uint64_t val)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = val;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+typedef struct {
+    RAMBlock *rb;
+    uint64_t dirty_rate;
+} KVMDirtyRateBlock;
+
+static void kvm_dirty_rate_ram_blocks(KVMState *s, StatsResultList **result,
+                                      strList *names)
+{
+    g_autoptr(GArray) blocks = g_array_new(false, false,
+                                           sizeof(KVMDirtyRateBlock));
+    int i, j;
+
+    RCU_READ_LOCK_GUARD();
+
+    /* A RAM block can be split over several slots, or mapped twice */
+    kvm_slots_lock();
+    for (i = 0; i < s->nr_as; i++) {
+        KVMMemoryListener *kml = s->as[i].ml;
+
+        if (!kml) {
+            continue;
+        }
+        for (j = 0; j < kml->nr_slots_allocated; j++) {
+            KVMSlot *mem = &kml->slots[j];
+            KVMDirtyRateBlock *block = NULL;
+            ram_addr_t offset;
+            RAMBlock *rb;
+
+            if (!mem->memory_size) {
+                continue;
+            }
+            rb = qemu_ram_block_from_host(mem->ram, false, &offset);
+            if (!rb) {
+                continue;
+            }
+            for (guint k = 0; k < blocks->len; k++) {
+                if (g_array_index(blocks, KVMDirtyRateBlock, k).rb == rb) {
+                    block = &g_array_index(blocks, KVMDirtyRateBlock, k);
+                    break;
+                }
+            }
+            if (!block) {
+                KVMDirtyRateBlock new_block = { .rb = rb };
+
+                g_array_append_val(blocks, new_block);
+                block = &g_array_index(blocks, KVMDirtyRateBlock,
+                                       blocks->len - 1);
+            }
+            block->dirty_rate += mem->dirty_rate;
+        }
+    }
+    kvm_slots_unlock();
+
+    for (guint k = 0; k < blocks->len; k++) {
+        KVMDirtyRateBlock *block = &g_array_index(blocks, KVMDirtyRateBlock,
+                                                  k);
+        StatsList *list = kvm_dirty_rate_add(NULL, names, "dirty-pages-rate",
+                                             block->dirty_rate);
+
+        if (list) {
+            add_stats_entry(result, STATS_PROVIDER_DIRTY_RING,
+                            qemu_ram_get_idstr(block->rb), list);
+        }
+    }
+}
+
+static void kvm_dirty_rate_stats_cb(StatsResultList **result,
+                                    StatsTarget target, strList *names,
+                                    strList *targets, Error **errp)
+{
+    CPUState *cpu;
+
+    switch (target) {
+    case STATS_TARGET_VCPU:
+        CPU_FOREACH(cpu) {
+            StatsList *list = NULL;
+
+            if (!apply_str_list_filter(cpu->parent_obj.canonical_path,
+                                       targets)) {
+                continue;
+            }
+            list = kvm_dirty_rate_add(list, names, "dirty-pages-rate",
+                                      cpu->kvm_dirty_rate);
+            list = kvm_dirty_rate_add(list, names, "dirty-pages",
+                                      cpu->dirty_pages);
+            list = kvm_dirty_rate_add(list, names, "ring-full-exits",
+                                      cpu->kvm_dirty_ring_full_exits);
+            if (list) {
+                add_stats_entry(result, STATS_PROVIDER_DIRTY_RING,
+                                cpu->parent_obj.canonical_path, list);
+            }
+        }
+        break;
+    case STATS_TARGET_RAM_BLOCK:
+        kvm_dirty_rate_ram_blocks(kvm_state, result, names);
+        break;
+    case STATS_TARGET_VM: {
+        KVMDirtyRingStats *stats = &kvm_state->dirty_ring_stats;
+        StatsList *list = NULL;
+
+        list = kvm_dirty_rate_add(list, names, "reaps",
+                                  stat64_get(&stats->reaps));
+        list = kvm_dirty_rate_add(list, names, "reap-latency-ns",
+                                  stat64_get(&stats->reap_ns));
+        list = kvm_dirty_rate_add(list, names, "reap-latency-max-ns",
+                                  stat64_get(&stats->reap_max_ns));
+        list = kvm_dirty_rate_add(list, names, "resets",
+                                  stat64_get(&stats->resets));
+        list = kvm_dirty_rate_add(list, names, "resets-skipped",
+                                  stat64_get(&stats->resets_skipped));
+        list = kvm_dirty_rate_add(list, names, "ring-full-exits",
+                                  stat64_get(&stats->full_exits));
+        if (list) {
+            add_stats_entry(result, STATS_PROVIDER_DIRTY_RING, NULL, list);
+        }
+        break;
+    }
+    default:
+        break;
+    }
+}
+
+static StatsSchemaValueList *kvm_dirty_rate_schema_add(
+    StatsSchemaValueList *list, const char *name, StatsType type)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void kvm_dirty_rate_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    list = kvm_dirty_rate_schema_add(list, "dirty-pages-rate",
+                                     STATS_TYPE_INSTANT);
+    list = kvm_dirty_rate_schema_add(list, "dirty-pages",
+                                     STATS_TYPE_CUMULATIVE);
+    list = kvm_dirty_rate_schema_add(list, "ring-full-exits",
+                                     STATS_TYPE_CUMULATIVE);
+    add_stats_schema(result, STATS_PROVIDER_DIRTY_RING, STATS_TARGET_VCPU,
+                     list);
+
+    list = kvm_dirty_rate_schema_add(NULL, "reaps", STATS_TYPE_CUMULATIVE);
+    list = kvm_dirty_rate_schema_add(list, "reap-latency-ns",
+                                     STATS_TYPE_CUMULATIVE);
+    list = kvm_dirty_rate_schema_add(list, "reap-latency-max-ns",
+                                     STATS_TYPE_PEAK);
+    list = kvm_dirty_rate_schema_add(list, "resets", STATS_TYPE_CUMULATIVE);
+    list = kvm_dirty_rate_schema_add(list, "resets-skipped",
+                                     STATS_TYPE_CUMULATIVE);
+    list = kvm_dirty_rate_schema_add(list, "ring-full-exits",
+                                     STATS_TYPE_CUMULATIVE);
+    add_stats_schema(result, STATS_PROVIDER_DIRTY_RING, STATS_TARGET_VM,
+                     list);
+
+    list = kvm_dirty_rate_schema_add(NULL, "dirty-pages-rate",
+                                     STATS_TYPE_INSTANT);
+    add_stats_schema(result, STATS_PROVIDER_DIRTY_RING,
+                     STATS_TARGET_RAM_BLOCK, list);
+}
+
+static void kvm_dirty_rate_machine_done(Notifier *notifier, void *data)
+{
+    Error *local_err = NULL;
+
+    if (!memory_global_dirty_log_start(GLOBAL_DIRTY_ESTIMATE, &local_err)) {
+        error_report_err(local_err);
+    }
+}
+
+/* Reaper threads when dirty-ring-reapers is not set: one per this many vCPUs */
+#define KVM_DIRTY_RING_REAPER_VCPUS     32
+/* Bounds of the sleep between two passes of a reaper thread */
+#define KVM_DIRTY_RING_REAPER_MIN_MS    10
+#define KVM_DIRTY_RING_REAPER_MAX_MS    1000
+
 static void *kvm_dirty_ring_reaper_thread(void *data)
 {
-    KVMState *s = data;
-    struct KVMDirtyRingReaper *r = &s->reaper;
+    struct KVMDirtyRingReaper *r = data;
+    KVMState *s = kvm_state;
+    uint32_t fullest;
 
     rcu_register_thread();
 
@@ -1581,22 +1980,41 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     while (true) {
         r->reaper_state = KVM_DIRTY_RING_REAPER_WAIT;
         trace_kvm_dirty_ring_reaper("wait");
-        /*
-         * TODO: provide a smarter timeout rather than a constant?
-         */
-        sleep(1);
+        g_usleep(r->interval_ms * 1000);
 
         /* keep sleeping so that dirtylimit not be interfered by reaper */
         if (dirtylimit_in_service()) {
+            r->interval_ms = KVM_DIRTY_RING_REAPER_MAX_MS;
+            if (r->index == 0) {
+                bql_lock();
+                kvm_dirty_rate_update(s);
+                bql_unlock();
+            }
             continue;
         }
 
         trace_kvm_dirty_ring_reaper("wakeup");
         r->reaper_state = KVM_DIRTY_RING_REAPER_REAPING;
 
-        bql_lock();
-        kvm_dirty_ring_reap(s, NULL);
-        bql_unlock();
+        kvm_dirty_ring_reap_one(s, r, NULL, &fullest);
+        if (r->index == 0) {
+            bql_lock();
+            kvm_dirty_rate_update(s);
+            bql_unlock();
+        }
+
+        /*
+         * Come back sooner while a ring fills up by more than half between
+         * two passes, so that vCPUs do not stop with a full ring, and back
+         * off while they stay almost empty.
+         */
+        if (fullest > s->kvm_dirty_ring_size / 2) {
+            r->interval_ms = MAX(r->interval_ms / 2,
+                                 KVM_DIRTY_RING_REAPER_MIN_MS);
+        } else if (fullest < s->kvm_dirty_ring_size / 8) {
+            r->interval_ms = MIN(r->interval_ms * 2,
+                                 KVM_DIRTY_RING_REAPER_MAX_MS);
+        }
 
         r->reaper_iteration++;
     }
@@ -1604,13 +2022,29 @@ static void *kvm_dirty_ring_reaper_thread(void *data)
     g_assert_not_reached();
 }
 
-static void kvm_dirty_ring_reaper_init(KVMState *s)
+static void kvm_dirty_ring_reaper_init(KVMState *s, MachineState *ms)
 {
-    struct KVMDirtyRingReaper *r = &s->reaper;
+    unsigned int i;
+
+    if (!s->nr_reapers) {
+        s->nr_reapers = DIV_ROUND_UP(ms->smp.max_cpus,
+                                     KVM_DIRTY_RING_REAPER_VCPUS);
+    }
+    s->reapers = g_new0(struct KVMDirtyRingReaper, s->nr_reapers);
+
+    for (i = 0; i < s->nr_reapers; i++) {
+        struct KVMDirtyRingReaper *r = &s->reapers[i];
+        g_autofree char *name = s->nr_reapers == 1 ?
+            g_strdup("kvm-reaper") : g_strdup_printf("kvm-reaper-%u", i);
 
-    qemu_thread_create(&r->reaper_thr, "kvm-reaper",
-                       kvm_dirty_ring_reaper_thread,
-                       s, QEMU_THREAD_JOINABLE);
+        r->index = i;
+        r->interval_ms = KVM_DIRTY_RING_REAPER_MAX_MS;
+        qemu_mutex_init(&r->lock);
+        r->gfns = g_array_new(false, false, sizeof(struct kvm_dirty_gfn));
+        qemu_thread_create(&r->reaper_thr, name,
+                           kvm_dirty_ring_reaper_thread,
+                           r, QEMU_THREAD_JOINABLE);
+    }
 }
 
 static int kvm_dirty_ring_init(KVMState *s)
@@ -1700,11 +2134,100 @@ static void kvm_region_del(MemoryListener *listener,
     QSIMPLEQ_INSERT_TAIL(&kml->transaction_del, update, next);
 }
 
+/*
+ * Does [@start, @start + @size) overlap a memslot other than @self?
+ * Called with KVMMemoryListener.slots_lock held.
+ */
+static bool kvm_range_has_slots(KVMMemoryListener *kml, KVMSlot *self,
+                                hwaddr start, hwaddr size)
+{
+    Range r1, r2;
+    int i;
+
+    range_init_nofail(&r1, start, size);
+    for (i = 0; i < kml->nr_slots_allocated; i++) {
+        KVMSlot *mem = &kml->slots[i];
+
+        if (mem == self || !mem->memory_size) {
+            continue;
+        }
+        range_init_nofail(&r2, mem->start_addr, mem->memory_size);
+        if (range_overlaps_range(&r1, &r2)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+ * A transaction often removes a section and adds one that ends up in the
+ * very same memslot (e.g. when an alias is replaced by another alias of
+ * the same RAM), or in a memslot that only moved in guest physical memory
+ * (e.g. a RAM BAR being reprogrammed).  Rather than deleting the memslot
+ * and creating it again, which needs ioctls inhibited when the ranges
+ * overlap and throws away the dirty bitmap, leave it alone or move it with
+ * a single KVM_SET_USER_MEMORY_REGION, which KVM does atomically.
+ *
+ * Only single memslots without dirty logging or guest_memfd are moved,
+ * and only to a range no other memslot overlaps, so that moves do not
+ * depend on each other or on the removals of the transaction.
+ *
+ * Returns true if @del and @add were applied.  Called with
+ * KVMMemoryListener.slots_lock held.
+ */
+static bool kvm_update_phys_mem(KVMMemoryListener *kml,
+                                MemoryRegionSection *del,
+                                MemoryRegionSection *add)
+{
+    hwaddr old_start, new_start, size;
+    ram_addr_t old_offset, new_offset;
+    void *old_ram, *new_ram;
+    bool adding = true, removing = false;
+    KVMSlot *mem;
+    int err;
+
+    if (memory_region_has_guest_memfd(del->mr) ||
+        memory_region_has_guest_memfd(add->mr)) {
+        return false;
+    }
+
+    size = kvm_section_mapping(add, &adding, &new_start, &new_ram,
+                               &new_offset);
+    if (!size || !adding || size > kvm_max_slot_size ||
+        kvm_section_mapping(del, &removing, &old_start, &old_ram,
+                            &old_offset) != size) {
+        return false;
+    }
+
+    mem = kvm_lookup_matching_slot(kml, old_start, size);
+    if (!mem || mem->ram != new_ram || mem->ram_start_offset != new_offset ||
+        mem->flags != kvm_mem_flags(add->mr)) {
+        return false;
+    }
+
+    if (old_start != new_start) {
+        if (mem->flags & KVM_MEM_LOG_DIRTY_PAGES ||
+            kvm_range_has_slots(kml, mem, new_start, size)) {
+            return false;
+        }
+        mem->start_addr = new_start;
+        err = kvm_set_user_memory_region(kml, mem, false);
+        if (err) {
+            fprintf(stderr, "%s: error moving slot: %s\n", __func__,
+                    strerror(-err));
+            abort();
+        }
+    }
+
+    trace_kvm_update_phys_mem(kml->as_id, old_start, new_start, size);
+    return true;
+}
+
 static void kvm_region_commit(MemoryListener *listener)
 {
     KVMMemoryListener *kml = container_of(listener, KVMMemoryListener,
                                           listener);
-    KVMMemoryUpdate *u1, *u2;
+    KVMMemoryUpdate *u1, *u2, *u_next;
     bool need_inhibit = false;
 
     if (QSIMPLEQ_EMPTY(&kml->transaction_add) &&
@@ -1712,6 +2235,27 @@ static void kvm_region_commit(MemoryListener *listener)
         return;
     }
 
+    kvm_slots_lock();
+
+    /* First update the memslots that only stay or move */
+    QSIMPLEQ_FOREACH_SAFE(u1, &kml->transaction_del, next, u_next) {
+        QSIMPLEQ_FOREACH(u2, &kml->transaction_add, next) {
+            if (kvm_update_phys_mem(kml, &u1->section, &u2->section)) {
+                break;
+            }
+        }
+        if (!u2) {
+            continue;
+        }
+
+        QSIMPLEQ_REMOVE(&kml->transaction_del, u1, KVMMemoryUpdate, next);
+        QSIMPLEQ_REMOVE(&kml->transaction_add, u2, KVMMemoryUpdate, next);
+        memory_region_ref(u2->section.mr);
+        memory_region_unref(u1->section.mr);
+        g_free(u1);
+        g_free(u2);
+    }
+
     /*
      * We have to be careful when regions to add overlap with ranges to remove.
      * We have to simulate atomic KVM memslot updates by making sure no ioctl()
@@ -1740,7 +2284,6 @@ static void kvm_region_commit(MemoryListener *listener)
         }
     }
 
-    kvm_slots_lock();
     if (need_inhibit) {
         accel_ioctl_inhibit_begin();
     }
@@ -2681,6 +3224,11 @@ static int kvm_init(MachineState *ms)
     if (ret < 0) {
         goto err;
     }
+    if (s->dirty_rate_estimate && !s->kvm_dirty_ring_size) {
+        error_report("dirty-rate-estimate requires the KVM dirty ring");
+        ret = -EINVAL;
+        goto err;
+    }
 
 #ifdef KVM_CAP_VCPU_EVENTS
     s->vcpu_events = kvm_check_extension(s, KVM_CAP_VCPU_EVENTS);
@@ -2761,7 +3309,13 @@ static int kvm_init(MachineState *ms)
     }
 
     if (s->kvm_dirty_ring_size) {
-        kvm_dirty_ring_reaper_init(s);
+        kvm_dirty_ring_reaper_init(s, ms);
+        add_stats_callbacks(STATS_PROVIDER_DIRTY_RING, kvm_dirty_rate_stats_cb,
+                            kvm_dirty_rate_schemas_cb);
+        if (s->dirty_rate_estimate) {
+            s->dirty_rate_notifier.notify = kvm_dirty_rate_machine_done;
+            qemu_add_machine_init_done_notifier(&s->dirty_rate_notifier);
+        }
     }
 
     if (kvm_check_extension(kvm_state, KVM_CAP_BINARY_STATS_FD)) {
@@ -3072,6 +3626,7 @@ int kvm_convert_memory(hwaddr start, hwaddr size, bool to_private)
 
     addr = memory_region_get_ram_ptr(mr) + section.offset_within_region;
     rb = qemu_ram_block_from_host(addr, false, &offset);
+    ram_block_set_private(rb, offset, size, to_private);
 
     if (to_private) {
         if (rb->page_size != qemu_real_host_page_size()) {
@@ -3220,19 +3775,24 @@ int kvm_cpu_exec(CPUState *cpu)
              * still full.  Got kicked by KVM_RESET_DIRTY_RINGS.
              */
             trace_kvm_dirty_ring_full(cpu->cpu_index);
-            bql_lock();
+            cpu->kvm_dirty_ring_full_exits++;
+            stat64_add(&kvm_state->dirty_ring_stats.full_exits, 1);
             /*
              * We throttle vCPU by making it sleep once it exit from kernel
              * due to dirty ring full. In the dirtylimit scenario, reaping
              * all vCPUs after a single vCPU dirty ring get full result in
              * the miss of sleep, so just reap the ring-fulled vCPU.
+             * Otherwise reap the vCPUs that share its reaper, which are
+             * likely to be just as busy; the other reapers run on their own.
              */
             if (dirtylimit_in_service()) {
                 kvm_dirty_ring_reap(kvm_state, cpu);
             } else {
-                kvm_dirty_ring_reap(kvm_state, NULL);
+                kvm_dirty_ring_reap_one(kvm_state,
+                                        kvm_dirty_ring_reaper_of(kvm_state,
+                                                                 cpu),
+                                        NULL, NULL);
             }
-            bql_unlock();
             dirtylimit_vcpu_execute(cpu);
             ret = 0;
             break;
@@ -3891,6 +4451,54 @@ static void kvm_set_dirty_ring_size(Object *obj, Visitor *v,
     s->kvm_dirty_ring_size = value;
 }
 
+static void kvm_get_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value = s->nr_reapers;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void kvm_set_dirty_ring_reapers(Object *obj, Visitor *v,
+                                       const char *name, void *opaque,
+                                       Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+    uint32_t value;
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+
+    s->nr_reapers = value;
+}
+
+static bool kvm_get_dirty_rate_estimate(Object *obj, Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    return s->dirty_rate_estimate;
+}
+
+static void kvm_set_dirty_rate_estimate(Object *obj, bool value,
+                                        Error **errp)
+{
+    KVMState *s = KVM_STATE(obj);
+
+    if (s->fd != -1) {
+        error_setg(errp, "Cannot set properties after the accelerator has been initialized");
+        return;
+    }
+    s->dirty_rate_estimate = value;
+}
+
 static char *kvm_get_device(Object *obj,
                             Error **errp G_GNUC_UNUSED)
 {
@@ -3984,6 +4592,20 @@ static void kvm_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "dirty-ring-size",
         "Size of KVM dirty page ring buffer (default: 0, i.e. use bitmap)");
 
+    object_class_property_add(oc, "dirty-ring-reapers", "uint32",
+        kvm_get_dirty_ring_reapers, kvm_set_dirty_ring_reapers,
+        NULL, NULL);
+    object_class_property_set_description(oc, "dirty-ring-reapers",
+        "Number of threads collecting the KVM dirty rings "
+        "(default: 0, i.e. one per 32 vCPUs)");
+
+    object_class_property_add_bool(oc, "dirty-rate-estimate",
+                                   kvm_get_dirty_rate_estimate,
+                                   kvm_set_dirty_rate_estimate);
+    object_class_property_set_description(oc, "dirty-rate-estimate",
+        "Keep dirty logging enabled so that the dirty ring always "
+        "estimates dirty rates (default: off)");
+
     object_class_property_add_str(oc, "device", kvm_get_device, kvm_set_device);
     object_class_property_set_description(oc, "device",
         "Path to the device node to use (default: /dev/kvm)");
@@ -157,14 +157,14 @@ static void tlb_window_reset(CPUTLBDesc *desc, int64_t ns,
 static void tb_jmp_cache_clear_page(CPUState *cpu, vaddr page_addr)
 {
     CPUJumpCache *jc = cpu->tb_jmp_cache;
-    int i, i0;
+    unsigned int i, i0;
 
     if (unlikely(!jc)) {
         return;
     }
 
-    i0 = tb_jmp_cache_hash_page(page_addr);
-    for (i = 0; i < TB_JMP_PAGE_SIZE; i++) {
+    i0 = tb_jmp_cache_hash_page(jc, page_addr);
+    for (i = 0; i < tb_jmp_cache_page_size(jc); i++) {
         qatomic_set(&jc->array[i0 + i].tb, NULL);
     }
 }
@@ -284,12 +284,39 @@ static void tlb_mmu_resize_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast,
     }
 }
 
+/**
+ * vtlb_mmu_resize_locked() - resize the victim TLB if necessary
+ * @desc: The CPUTLBDesc portion of the TLB
+ *
+ * Called at flush time, when the victim TLB is about to be emptied.
+ * Scanning the victim TLB is linear, so it only grows while lookups
+ * there hit often enough that a larger table is likely to turn tlb
+ * fills into hits: double its size when at least 1/4 of the victim
+ * lookups since the last flush hit, and halve it when fewer than 1/16
+ * did.  Windows with too few lookups to tell keep the current size.
+ */
+static void vtlb_mmu_resize_locked(CPUTLBDesc *desc)
+{
+    size_t lookups = desc->vtlb_hits + desc->vtlb_misses;
+
+    if (lookups >= desc->vtlb_size * 16) {
+        if (desc->vtlb_hits * 4 >= lookups) {
+            desc->vtlb_size = MIN(desc->vtlb_size * 2, CPU_VTLB_SIZE_MAX);
+        } else if (desc->vtlb_hits * 16 < lookups) {
+            desc->vtlb_size = MAX(desc->vtlb_size / 2, CPU_VTLB_SIZE);
+        }
+    }
+    desc->vtlb_hits = 0;
+    desc->vtlb_misses = 0;
+}
+
 static void tlb_mmu_flush_locked(CPUTLBDesc *desc, CPUTLBDescFast *fast)
 {
     desc->n_used_entries = 0;
     desc->large_page_addr = -1;
     desc->large_page_mask = -1;
     desc->vindex = 0;
+    desc->last_fill_page = -1;
     memset(fast->table, -1, sizeof_tlb(fast));
     memset(desc->vtable, -1, sizeof(desc->vtable));
 }
@@ -301,6 +328,7 @@ static void tlb_flush_one_mmuidx_locked(CPUState *cpu, int mmu_idx,
     CPUTLBDescFast *fast = &cpu->neg.tlb.f[mmu_idx];
 
     tlb_mmu_resize_locked(desc, fast, now);
+    vtlb_mmu_resize_locked(desc);
     tlb_mmu_flush_locked(desc, fast);
 }
 
@@ -310,6 +338,7 @@ static void tlb_mmu_init(CPUTLBDesc *desc, CPUTLBDescFast *fast, int64_t now)
 
     tlb_window_reset(desc, now, 0);
     desc->n_used_entries = 0;
+    desc->vtlb_size = CPU_VTLB_SIZE;
     fast->mask = (n_entries - 1) << CPU_TLB_ENTRY_BITS;
     fast->table = g_new(CPUTLBEntry, n_entries);
     desc->fulltlb = g_new(CPUTLBEntryFull, n_entries);
@@ -428,12 +457,37 @@ void tlb_flush(CPUState *cpu)
     tlb_flush_by_mmuidx(cpu, ALL_MMUIDX_BITS);
 }
 
+/*
+ * The synced flushes below use an exclusive section only to make sure
+ * that all other vCPUs have flushed before the source vCPU goes on.
+ * When the source is the only vCPU, and we are running on it, flush it
+ * right away instead of stopping at the end of the TB.
+ */
+static bool tlb_flush_synced_is_local(CPUState *src_cpu)
+{
+    CPUState *cpu;
+
+    if (src_cpu != current_cpu) {
+        return false;
+    }
+    CPU_FOREACH(cpu) {
+        if (cpu != src_cpu) {
+            return false;
+        }
+    }
+    return true;
+}
+
 void tlb_flush_by_mmuidx_all_cpus_synced(CPUState *src_cpu, uint16_t idxmap)
 {
     const run_on_cpu_func fn = tlb_flush_by_mmuidx_async_work;
 
     tlb_debug("mmu_idx: 0x%"PRIx16"\n", idxmap);
 
+    if (tlb_flush_synced_is_local(src_cpu)) {
+        tlb_flush_by_mmuidx(src_cpu, idxmap);
+        return;
+    }
     flush_all_helper(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
     async_safe_run_on_cpu(src_cpu, fn, RUN_ON_CPU_HOST_INT(idxmap));
 }
@@ -494,7 +548,7 @@ static void tlb_flush_vtlb_page_mask_locked(CPUState *cpu, int mmu_idx,
     int k;
 
     assert_cpu_is_self(cpu);
-    for (k = 0; k < CPU_VTLB_SIZE; k++) {
+    for (k = 0; k < d->vtlb_size; k++) {
         if (tlb_flush_entry_mask_locked(&d->vtable[k], page, mask)) {
             tlb_n_used_entries_dec(cpu, mmu_idx);
         }
@@ -631,6 +685,11 @@ void tlb_flush_page_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     /* This should already be page aligned */
     addr &= TARGET_PAGE_MASK;
 
+    if (tlb_flush_synced_is_local(src_cpu)) {
+        tlb_flush_page_by_mmuidx(src_cpu, addr, idxmap);
+        return;
+    }
+
     /*
      * Allocate memory to hold addr+idxmap only when needed.
      * See tlb_flush_page_by_mmuidx for details.
@@ -747,7 +806,8 @@ static void tlb_flush_range_by_mmuidx_async_0(CPUState *cpu,
      * If the length is larger than the jump cache size, then it will take
      * longer to clear each entry individually than it will to clear it all.
      */
-    if (d.len >= (TARGET_PAGE_SIZE * TB_JMP_CACHE_SIZE)) {
+    if (!cpu->tb_jmp_cache ||
+        d.len >= TARGET_PAGE_SIZE * tb_jmp_cache_size(cpu->tb_jmp_cache)) {
         tcg_flush_jmp_cache(cpu);
         return;
     }
@@ -837,6 +897,11 @@ void tlb_flush_range_by_mmuidx_all_cpus_synced(CPUState *src_cpu,
     d.idxmap = idxmap;
     d.bits = bits;
 
+    if (tlb_flush_synced_is_local(src_cpu)) {
+        tlb_flush_range_by_mmuidx_async_0(src_cpu, d);
+        return;
+    }
+
     /* Allocate a separate data block for each destination cpu.  */
     CPU_FOREACH(dst_cpu) {
         if (dst_cpu != src_cpu) {
@@ -945,7 +1010,7 @@ void tlb_reset_dirty(CPUState *cpu, ram_addr_t start1, ram_addr_t length)
                                          start1, length);
         }
 
-        for (i = 0; i < CPU_VTLB_SIZE; i++) {
+        for (i = 0; i < cpu->neg.tlb.d[mmu_idx].vtlb_size; i++) {
             tlb_reset_dirty_range_locked(&cpu->neg.tlb.d[mmu_idx].vtable[i],
                                          start1, length);
         }
@@ -978,7 +1043,7 @@ static void tlb_set_dirty(CPUState *cpu, vaddr addr)
 
     for (mmu_idx = 0; mmu_idx < NB_MMU_MODES; mmu_idx++) {
         int k;
-        for (k = 0; k < CPU_VTLB_SIZE; k++) {
+        for (k = 0; k < cpu->neg.tlb.d[mmu_idx].vtlb_size; k++) {
             tlb_set_dirty1_locked(&cpu->neg.tlb.d[mmu_idx].vtable[k], addr);
         }
     }
@@ -1142,7 +1207,7 @@ void tlb_set_page_full(CPUState *cpu, int mmu_idx,
      * different page; otherwise just overwrite the stale data.
      */
     if (!tlb_hit_page_anyprot(te, addr_page) && !tlb_entry_is_empty(te)) {
-        unsigned vidx = desc->vindex++ % CPU_VTLB_SIZE;
+        unsigned vidx = desc->vindex++ % desc->vtlb_size;
         CPUTLBEntry *tv = &desc->vtable[vidx];
 
         /* Evict the old entry into the victim tlb.  */
@@ -1233,6 +1298,7 @@ static bool tlb_fill_align(CPUState *cpu, vaddr addr, MMUAccessType type,
     const TCGCPUOps *ops = cpu->cc->tcg_ops;
     CPUTLBEntryFull full;
 
+    qatomic_set(&cpu->neg.tlb.c.fill_count, cpu->neg.tlb.c.fill_count + 1);
     if (ops->tlb_fill_align) {
         if (ops->tlb_fill_align(cpu, &full, addr, type, mmu_idx,
                                 memop, size, probe, ra)) {
@@ -1297,10 +1363,11 @@ static void io_failed(CPUState *cpu, CPUTLBEntryFull *full, vaddr addr,
 static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
                            MMUAccessType access_type, vaddr page)
 {
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
     size_t vidx;
 
     assert_cpu_is_self(cpu);
-    for (vidx = 0; vidx < CPU_VTLB_SIZE; ++vidx) {
+    for (vidx = 0; vidx < desc->vtlb_size; ++vidx) {
         CPUTLBEntry *vtlb = &cpu->neg.tlb.d[mmu_idx].vtable[vidx];
         uint64_t cmp = tlb_read_idx(vtlb, access_type);
 
@@ -1318,12 +1385,53 @@ static bool victim_tlb_hit(CPUState *cpu, size_t mmu_idx, size_t index,
             CPUTLBEntryFull *f2 = &cpu->neg.tlb.d[mmu_idx].vfulltlb[vidx];
             CPUTLBEntryFull tmpf;
             tmpf = *f1; *f1 = *f2; *f2 = tmpf;
+
+            desc->vtlb_hits++;
+            qatomic_set(&cpu->neg.tlb.c.victim_hit_count,
+                        cpu->neg.tlb.c.victim_hit_count + 1);
             return true;
         }
     }
+    desc->vtlb_misses++;
     return false;
 }
 
+/*
+ * With -accel tcg,tlb-prefetch=on, fill the entry of the next page when
+ * loads have missed the TLB on two consecutive pages in a row, as
+ * streaming copies do.  The next page is probed without raising any
+ * exception.  Only loads are prefetched: walking the page tables for a
+ * store could set dirty bits on pages the guest never writes.
+ *
+ * Like tlb_fill_align(), this can trigger a resize of the TLB.
+ */
+static void tlb_fill_prefetch(CPUState *cpu, int mmu_idx, vaddr addr,
+                              MMUAccessType access_type, uintptr_t ra)
+{
+    CPUTLBDesc *desc = &cpu->neg.tlb.d[mmu_idx];
+    vaddr page = addr & TARGET_PAGE_MASK;
+    vaddr next = page + TARGET_PAGE_SIZE;
+    bool sequential;
+
+    if (access_type != MMU_DATA_LOAD || !qatomic_read(&tlb_prefetch)) {
+        return;
+    }
+    sequential = page == desc->last_fill_page + TARGET_PAGE_SIZE;
+    desc->last_fill_page = page;
+    if (!sequential || next == 0) {
+        return;
+    }
+    if (tlb_hit_page(tlb_read_idx(tlb_entry(cpu, mmu_idx, next),
+                                  access_type), next)) {
+        return;
+    }
+    if (tlb_fill_align(cpu, next, access_type, mmu_idx, 0, 1, true, ra)) {
+        desc->last_fill_page = next;
+        qatomic_set(&cpu->neg.tlb.c.prefetch_count,
+                    cpu->neg.tlb.c.prefetch_count + 1);
+    }
+}
+
 static void notdirty_write(CPUState *cpu, vaddr mem_vaddr, unsigned size,
                            CPUTLBEntryFull *full, uintptr_t retaddr)
 {
@@ -1371,6 +1479,7 @@ static int probe_access_internal(CPUState *cpu, vaddr addr,
                 *pfull = NULL;
                 return TLB_INVALID_MASK;
             }
+            tlb_fill_prefetch(cpu, mmu_idx, addr, access_type, retaddr);
 
             /* TLB resize via tlb_fill_align may have moved the entry.  */
             index = tlb_index(cpu, mmu_idx, addr);
@@ -1647,6 +1756,7 @@ static bool mmu_lookup1(CPUState *cpu, MMULookupPageData *data, MemOp memop,
                             addr & TARGET_PAGE_MASK)) {
             tlb_fill_align(cpu, addr, access_type, mmu_idx,
                            memop, data->size, false, ra);
+            tlb_fill_prefetch(cpu, mmu_idx, addr, access_type, ra);
             maybe_resized = true;
             index = tlb_index(cpu, mmu_idx, addr);
             entry = tlb_entry(cpu, mmu_idx, addr);
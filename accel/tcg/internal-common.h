@@ -16,6 +16,8 @@ extern int64_t max_delay;
 extern int64_t max_advance;
 
 extern bool one_insn_per_tb;
+extern unsigned int tb_jmp_cache_bits;
+extern bool tlb_prefetch;
 
 /*
  * Return true if CS is not running in parallel with other cpus, either
@@ -19,6 +19,7 @@
 #include "tcg/tcg.h"
 #include "internal-common.h"
 #include "tb-context.h"
+#include "tb-jmp-cache.h"
 
 
 static void dump_drift_info(GString *buf)
@@ -91,6 +92,22 @@ static void print_qht_statistics(struct qht_stats hst, GString *buf)
                            "Histogram: %s\n",
                            qdist_avg(&hst.chain), hgram);
     g_free(hgram);
+
+    hgram_opts = QDIST_PR_BORDER | QDIST_PR_LABELS;
+    hgram_bins = qdist_xmax(&hst.chain_entries) -
+                 qdist_xmin(&hst.chain_entries);
+    if (hgram_bins > 10) {
+        hgram_bins = 10;
+    } else {
+        hgram_bins = 0;
+        hgram_opts |= QDIST_PR_NODECIMAL | QDIST_PR_NOBINRANGE;
+    }
+    hgram = qdist_pr(&hst.chain_entries, hgram_bins, hgram_opts);
+    g_string_append_printf(buf, "TB hash avg entries %0.3f per chain. "
+                           "Histogram: %s\n",
+                           qdist_avg(&hst.chain_entries), hgram);
+    g_free(hgram);
+    g_string_append_printf(buf, "TB hash resizes     %zu\n", hst.resizes);
 }
 
 struct tb_tree_stats {
@@ -126,6 +143,21 @@ static gboolean tb_tree_stats_iter(gpointer key, gpointer value, gpointer data)
     return false;
 }
 
+static void tlb_fill_counts(size_t *pfill, size_t *pvictim, size_t *pprefetch)
+{
+    CPUState *cpu;
+    size_t fill = 0, victim = 0, prefetch = 0;
+
+    CPU_FOREACH(cpu) {
+        fill += qatomic_read(&cpu->neg.tlb.c.fill_count);
+        victim += qatomic_read(&cpu->neg.tlb.c.victim_hit_count);
+        prefetch += qatomic_read(&cpu->neg.tlb.c.prefetch_count);
+    }
+    *pfill = fill;
+    *pvictim = victim;
+    *pprefetch = prefetch;
+}
+
 static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
 {
     CPUState *cpu;
@@ -141,6 +173,27 @@ static void tlb_flush_counts(size_t *pfull, size_t *ppart, size_t *pelide)
     *pelide = elide;
 }
 
+static void jmp_cache_counts(size_t *pentries, size_t *phits,
+                             size_t *pmisses)
+{
+    CPUState *cpu;
+    size_t entries = 0, hits = 0, misses = 0;
+
+    CPU_FOREACH(cpu) {
+        CPUJumpCache *jc = cpu->tb_jmp_cache;
+
+        if (!jc) {
+            continue;
+        }
+        entries = MAX(entries, tb_jmp_cache_size(jc));
+        hits += qatomic_read(&jc->hits);
+        misses += qatomic_read(&jc->misses);
+    }
+    *pentries = entries;
+    *phits = hits;
+    *pmisses = misses;
+}
+
 static void tcg_dump_info(GString *buf)
 {
     g_string_append_printf(buf, "[TCG profiler not compiled]\n");
@@ -151,6 +204,8 @@ static void dump_exec_info(GString *buf)
     struct tb_tree_stats tst = {};
     struct qht_stats hst;
     size_t nb_tbs, flush_full, flush_part, flush_elide;
+    size_t fill, victim_hit, prefetch;
+    size_t jc_entries, jc_hits, jc_misses;
 
     tcg_tb_foreach(tb_tree_stats_iter, &tst);
     nb_tbs = tst.nb_tbs;
@@ -196,6 +251,18 @@ static void dump_exec_info(GString *buf)
     g_string_append_printf(buf, "TLB full flushes    %zu\n", flush_full);
     g_string_append_printf(buf, "TLB partial flushes %zu\n", flush_part);
     g_string_append_printf(buf, "TLB elided flushes  %zu\n", flush_elide);
+    tlb_fill_counts(&fill, &victim_hit, &prefetch);
+    g_string_append_printf(buf, "TLB fills           %zu (prefetched %zu)\n",
+                           fill, prefetch);
+    g_string_append_printf(buf, "TLB victim hits     %zu\n", victim_hit);
+
+    jmp_cache_counts(&jc_entries, &jc_hits, &jc_misses);
+    g_string_append_printf(buf, "jmp cache entries   %zu per vCPU\n",
+                           jc_entries);
+    g_string_append_printf(buf, "jmp cache hits      %zu (%zu%%)\n", jc_hits,
+                           jc_hits + jc_misses ?
+                           (jc_hits * 100) / (jc_hits + jc_misses) : 0);
+    g_string_append_printf(buf, "jmp cache misses    %zu\n", jc_misses);
     tcg_dump_info(buf);
 }
 
@@ -12,8 +12,10 @@
 #include "qemu/rcu.h"
 #include "exec/cpu-common.h"
 
+/* Default and limits of log2 of the number of entries, see jmp-cache-bits */
 #define TB_JMP_CACHE_BITS 12
-#define TB_JMP_CACHE_SIZE (1 << TB_JMP_CACHE_BITS)
+#define TB_JMP_CACHE_BITS_MIN 8
+#define TB_JMP_CACHE_BITS_MAX 20
 
 /*
  * Invalidated in parallel; all accesses to 'tb' must be atomic.
@@ -21,13 +23,24 @@
  * no need for qatomic_rcu_read() and pc is always consistent with a
  * non-NULL value of 'tb'.  Strictly speaking pc is only needed for
  * CF_PCREL, but it's used always for simplicity.
+ *
+ * Each vCPU has its own cache, of 1 << bits entries.  The lookup
+ * counters are only written by the owning vCPU.
  */
 typedef struct CPUJumpCache {
     struct rcu_head rcu;
+    unsigned int bits;
+    size_t hits;
+    size_t misses;
     struct {
         TranslationBlock *tb;
         vaddr pc;
-    } array[TB_JMP_CACHE_SIZE];
+    } array[];
 } CPUJumpCache;
 
+static inline size_t tb_jmp_cache_size(const CPUJumpCache *jc)
+{
+    return (size_t)1 << jc->bits;
+}
+
 #endif /* ACCEL_TCG_TB_JMP_CACHE_H */
@@ -39,14 +39,17 @@
 #include "hw/boards.h"
 #endif
 #include "internal-common.h"
+#include "tb-jmp-cache.h"
 
 struct TCGState {
     AccelState parent_obj;
 
     bool mttcg_enabled;
     bool one_insn_per_tb;
+    bool tlb_prefetch;
     int splitwx_enabled;
     unsigned long tb_size;
+    uint32_t jmp_cache_bits;
 };
 typedef struct TCGState TCGState;
 
@@ -88,6 +91,7 @@ static void tcg_accel_instance_init(Object *obj)
     TCGState *s = TCG_STATE(obj);
 
     s->mttcg_enabled = default_mttcg_enabled();
+    s->jmp_cache_bits = TB_JMP_CACHE_BITS;
 
     /* If debugging enabled, default "auto on", otherwise off. */
 #if defined(CONFIG_DEBUG_TCG) && !defined(CONFIG_USER_ONLY)
@@ -99,6 +103,8 @@ static void tcg_accel_instance_init(Object *obj)
 
 bool mttcg_enabled;
 bool one_insn_per_tb;
+unsigned int tb_jmp_cache_bits = TB_JMP_CACHE_BITS;
+bool tlb_prefetch;
 
 static int tcg_init_machine(MachineState *ms)
 {
@@ -111,6 +117,7 @@ static int tcg_init_machine(MachineState *ms)
 
     tcg_allowed = true;
     mttcg_enabled = s->mttcg_enabled;
+    tb_jmp_cache_bits = s->jmp_cache_bits;
 
     page_init();
     tb_htable_init();
@@ -181,6 +188,35 @@ static void tcg_set_tb_size(Object *obj, Visitor *v,
     s->tb_size = value;
 }
 
+static void tcg_get_jmp_cache_bits(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value = s->jmp_cache_bits;
+
+    visit_type_uint32(v, name, &value, errp);
+}
+
+static void tcg_set_jmp_cache_bits(Object *obj, Visitor *v,
+                                   const char *name, void *opaque,
+                                   Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (value < TB_JMP_CACHE_BITS_MIN || value > TB_JMP_CACHE_BITS_MAX) {
+        error_setg(errp, "jmp-cache-bits must be between %d and %d",
+                   TB_JMP_CACHE_BITS_MIN, TB_JMP_CACHE_BITS_MAX);
+        return;
+    }
+
+    s->jmp_cache_bits = value;
+}
+
 static bool tcg_get_splitwx(Object *obj, Error **errp)
 {
     TCGState *s = TCG_STATE(obj);
@@ -207,6 +243,19 @@ static void tcg_set_one_insn_per_tb(Object *obj, bool value, Error **errp)
     qatomic_set(&one_insn_per_tb, value);
 }
 
+static bool tcg_get_tlb_prefetch(Object *obj, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    return s->tlb_prefetch;
+}
+
+static void tcg_set_tlb_prefetch(Object *obj, bool value, Error **errp)
+{
+    TCGState *s = TCG_STATE(obj);
+    s->tlb_prefetch = value;
+    qatomic_set(&tlb_prefetch, value);
+}
+
 static int tcg_gdbstub_supported_sstep_flags(void)
 {
     /*
@@ -242,6 +291,12 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
     object_class_property_set_description(oc, "tb-size",
         "TCG translation block cache size");
 
+    object_class_property_add(oc, "jmp-cache-bits", "uint32",
+        tcg_get_jmp_cache_bits, tcg_set_jmp_cache_bits,
+        NULL, NULL);
+    object_class_property_set_description(oc, "jmp-cache-bits",
+        "log2 of the number of entries of the per-vCPU TB jump cache");
+
     object_class_property_add_bool(oc, "split-wx",
         tcg_get_splitwx, tcg_set_splitwx);
     object_class_property_set_description(oc, "split-wx",
@@ -252,6 +307,12 @@ static void tcg_accel_class_init(ObjectClass *oc, void *data)
                                    tcg_set_one_insn_per_tb);
     object_class_property_set_description(oc, "one-insn-per-tb",
         "Only put one guest insn in each translation block");
+
+    object_class_property_add_bool(oc, "tlb-prefetch",
+                                   tcg_get_tlb_prefetch,
+                                   tcg_set_tlb_prefetch);
+    object_class_property_set_description(oc, "tlb-prefetch",
+        "Fill the softmmu TLB entry of the next page on streaming loads");
 }
 
 static const TypeInfo tcg_accel_type = {
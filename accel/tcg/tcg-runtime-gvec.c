@@ -22,6 +22,7 @@
 #include "cpu.h"
 #include "exec/helper-proto-common.h"
 #include "tcg/tcg-gvec-desc.h"
+#include "host/gvec-accel.h"
 
 
 static inline void clear_high(void *d, intptr_t oprsz, uint32_t desc)
@@ -408,7 +409,8 @@ void HELPER(gvec_dup64)(void *d, uint32_t desc, uint64_t c)
     if (c == 0) {
         oprsz = 0;
     } else {
-        for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+        i = gvec_dup64_accel(d, c, oprsz);
+        for (; i < oprsz; i += sizeof(uint64_t)) {
             *(uint64_t *)(d + i) = c;
         }
     }
@@ -423,7 +425,8 @@ void HELPER(gvec_dup32)(void *d, uint32_t desc, uint32_t c)
     if (c == 0) {
         oprsz = 0;
     } else {
-        for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+        i = gvec_dup32_accel(d, c, oprsz);
+        for (; i < oprsz; i += sizeof(uint32_t)) {
             *(uint32_t *)(d + i) = c;
         }
     }
@@ -589,7 +592,8 @@ void HELPER(gvec_shl8i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_shl8_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         *(uint8_t *)(d + i) = *(uint8_t *)(a + i) << shift;
     }
     clear_high(d, oprsz, desc);
@@ -601,7 +605,8 @@ void HELPER(gvec_shl16i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_shl16_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = *(uint16_t *)(a + i) << shift;
     }
     clear_high(d, oprsz, desc);
@@ -613,7 +618,8 @@ void HELPER(gvec_shl32i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_shl32_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = *(uint32_t *)(a + i) << shift;
     }
     clear_high(d, oprsz, desc);
@@ -625,7 +631,8 @@ void HELPER(gvec_shl64i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_shl64_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) << shift;
     }
     clear_high(d, oprsz, desc);
@@ -637,7 +644,8 @@ void HELPER(gvec_shr8i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_shr8_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         *(uint8_t *)(d + i) = *(uint8_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -649,7 +657,8 @@ void HELPER(gvec_shr16i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_shr16_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         *(uint16_t *)(d + i) = *(uint16_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -661,7 +670,8 @@ void HELPER(gvec_shr32i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_shr32_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         *(uint32_t *)(d + i) = *(uint32_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -673,7 +683,8 @@ void HELPER(gvec_shr64i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_shr64_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(uint64_t *)(d + i) = *(uint64_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -685,7 +696,8 @@ void HELPER(gvec_sar8i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_sar8_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         *(int8_t *)(d + i) = *(int8_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -697,7 +709,8 @@ void HELPER(gvec_sar16i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_sar16_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         *(int16_t *)(d + i) = *(int16_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -709,7 +722,8 @@ void HELPER(gvec_sar32i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_sar32_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         *(int32_t *)(d + i) = *(int32_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -721,7 +735,8 @@ void HELPER(gvec_sar64i)(void *d, void *a, uint32_t desc)
     int shift = simd_data(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_sar64_accel(d, a, shift, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         *(int64_t *)(d + i) = *(int64_t *)(a + i) >> shift;
     }
     clear_high(d, oprsz, desc);
@@ -1020,7 +1035,7 @@ void HELPER(NAME)(void *d, void *a, void *b, uint32_t desc)                \
 {                                                                          \
     intptr_t oprsz = simd_oprsz(desc);                                     \
     intptr_t i;                                                            \
-    for (i = 0; i < oprsz; i += sizeof(TYPE)) {                            \
+    for (i = NAME##_accel(d, a, b, oprsz); i < oprsz; i += sizeof(TYPE)) { \
         *(TYPE *)(d + i) = -(*(TYPE *)(a + i) OP *(TYPE *)(b + i));        \
     }                                                                      \
     clear_high(d, oprsz, desc);                                            \
@@ -1073,7 +1088,8 @@ void HELPER(gvec_ssadd8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int8_t)) {
+    i = gvec_ssadd8_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(int8_t)) {
         int r = *(int8_t *)(a + i) + *(int8_t *)(b + i);
         if (r > INT8_MAX) {
             r = INT8_MAX;
@@ -1090,7 +1106,8 @@ void HELPER(gvec_ssadd16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int16_t)) {
+    i = gvec_ssadd16_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(int16_t)) {
         int r = *(int16_t *)(a + i) + *(int16_t *)(b + i);
         if (r > INT16_MAX) {
             r = INT16_MAX;
@@ -1107,7 +1124,8 @@ void HELPER(gvec_ssadd32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int32_t)) {
+    i = gvec_ssadd32_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(int32_t)) {
         int32_t ai = *(int32_t *)(a + i);
         int32_t bi = *(int32_t *)(b + i);
         int32_t di;
@@ -1124,7 +1142,8 @@ void HELPER(gvec_ssadd64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int64_t)) {
+    i = gvec_ssadd64_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(int64_t)) {
         int64_t ai = *(int64_t *)(a + i);
         int64_t bi = *(int64_t *)(b + i);
         int64_t di;
@@ -1141,7 +1160,8 @@ void HELPER(gvec_sssub8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_sssub8_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         int r = *(int8_t *)(a + i) - *(int8_t *)(b + i);
         if (r > INT8_MAX) {
             r = INT8_MAX;
@@ -1158,7 +1178,8 @@ void HELPER(gvec_sssub16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int16_t)) {
+    i = gvec_sssub16_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(int16_t)) {
         int r = *(int16_t *)(a + i) - *(int16_t *)(b + i);
         if (r > INT16_MAX) {
             r = INT16_MAX;
@@ -1175,7 +1196,8 @@ void HELPER(gvec_sssub32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int32_t)) {
+    i = gvec_sssub32_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(int32_t)) {
         int32_t ai = *(int32_t *)(a + i);
         int32_t bi = *(int32_t *)(b + i);
         int32_t di;
@@ -1192,7 +1214,8 @@ void HELPER(gvec_sssub64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(int64_t)) {
+    i = gvec_sssub64_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(int64_t)) {
         int64_t ai = *(int64_t *)(a + i);
         int64_t bi = *(int64_t *)(b + i);
         int64_t di;
@@ -1209,7 +1232,8 @@ void HELPER(gvec_usadd8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_usadd8_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         unsigned r = *(uint8_t *)(a + i) + *(uint8_t *)(b + i);
         if (r > UINT8_MAX) {
             r = UINT8_MAX;
@@ -1224,7 +1248,8 @@ void HELPER(gvec_usadd16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_usadd16_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         unsigned r = *(uint16_t *)(a + i) + *(uint16_t *)(b + i);
         if (r > UINT16_MAX) {
             r = UINT16_MAX;
@@ -1239,7 +1264,8 @@ void HELPER(gvec_usadd32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_usadd32_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         uint32_t ai = *(uint32_t *)(a + i);
         uint32_t bi = *(uint32_t *)(b + i);
         uint32_t di;
@@ -1256,7 +1282,8 @@ void HELPER(gvec_usadd64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_usadd64_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         uint64_t ai = *(uint64_t *)(a + i);
         uint64_t bi = *(uint64_t *)(b + i);
         uint64_t di;
@@ -1273,7 +1300,8 @@ void HELPER(gvec_ussub8)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint8_t)) {
+    i = gvec_ussub8_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint8_t)) {
         int r = *(uint8_t *)(a + i) - *(uint8_t *)(b + i);
         if (r < 0) {
             r = 0;
@@ -1288,7 +1316,8 @@ void HELPER(gvec_ussub16)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint16_t)) {
+    i = gvec_ussub16_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint16_t)) {
         int r = *(uint16_t *)(a + i) - *(uint16_t *)(b + i);
         if (r < 0) {
             r = 0;
@@ -1303,7 +1332,8 @@ void HELPER(gvec_ussub32)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint32_t)) {
+    i = gvec_ussub32_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint32_t)) {
         uint32_t ai = *(uint32_t *)(a + i);
         uint32_t bi = *(uint32_t *)(b + i);
         uint32_t di;
@@ -1320,7 +1350,8 @@ void HELPER(gvec_ussub64)(void *d, void *a, void *b, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_ussub64_accel(d, a, b, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         uint64_t ai = *(uint64_t *)(a + i);
         uint64_t bi = *(uint64_t *)(b + i);
         uint64_t di;
@@ -1561,7 +1592,8 @@ void HELPER(gvec_bitsel)(void *d, void *a, void *b, void *c, uint32_t desc)
     intptr_t oprsz = simd_oprsz(desc);
     intptr_t i;
 
-    for (i = 0; i < oprsz; i += sizeof(uint64_t)) {
+    i = gvec_bitsel_accel(d, a, b, c, oprsz);
+    for (; i < oprsz; i += sizeof(uint64_t)) {
         uint64_t aa = *(uint64_t *)(a + i);
         uint64_t bb = *(uint64_t *)(b + i);
         uint64_t cc = *(uint64_t *)(c + i);
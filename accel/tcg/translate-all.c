@@ -65,6 +65,7 @@
 #include "internal-target.h"
 #include "tcg/perf.h"
 #include "tcg/insn-start-words.h"
+#include "exec/helper-proto-common.h"
 
 TBContext tb_ctx;
 
@@ -195,6 +196,45 @@ static int cpu_unwind_data_from_tb(TranslationBlock *tb, uintptr_t host_pc,
     return -1;
 }
 
+/*
+ * Called from the code of @tb when it has been executed as many times as
+ * the perf threshold asks for.  The unwind data after the code holds what
+ * perf_report_code() would have used at translation time.
+ */
+void HELPER(perf_hot_tb)(CPUArchState *env, void *ptr)
+{
+    TranslationBlock *tb = ptr;
+    CPUState *cpu = env_cpu(env);
+    const uint8_t *p = tb->tc.ptr + tb->tc.size;
+    uint64_t data[TARGET_INSN_START_WORDS] = { };
+    g_autofree uint64_t *insn_data = NULL;
+    g_autofree uint16_t *insn_end_off = NULL;
+    uint64_t pc = tb->pc;
+    uint16_t end_off = 0;
+    int i, j;
+
+    if (tb_cflags(tb) & CF_PCREL) {
+        /* Attribute the code to the mapping it was found hot in. */
+        pc = cpu->cc->get_pc(cpu);
+    } else {
+        data[0] = tb->pc;
+    }
+
+    insn_data = g_new(uint64_t, tb->icount * TARGET_INSN_START_WORDS);
+    insn_end_off = g_new(uint16_t, tb->icount);
+    for (i = 0; i < tb->icount; ++i) {
+        for (j = 0; j < TARGET_INSN_START_WORDS; ++j) {
+            data[j] += decode_sleb128(&p);
+            insn_data[i * TARGET_INSN_START_WORDS + j] = data[j];
+        }
+        end_off += decode_sleb128(&p);
+        insn_end_off[i] = end_off;
+    }
+
+    perf_report_hot_code(pc, tb, insn_data, insn_end_off,
+                         TARGET_INSN_START_WORDS);
+}
+
 /*
  * The cpu state corresponding to 'host_pc' is restored in
  * preparation for exiting the TB.
@@ -332,6 +372,7 @@ TranslationBlock *tb_gen_code(CPUState *cpu,
     tb->cs_base = cs_base;
     tb->flags = flags;
     tb->cflags = cflags;
+    tb->perf_count = 0;
     tb_set_page_addr0(tb, phys_pc);
     tb_set_page_addr1(tb, -1);
     if (phys_pc != -1) {
@@ -659,7 +700,7 @@ void tcg_flush_jmp_cache(CPUState *cpu)
         return;
     }
 
-    for (int i = 0; i < TB_JMP_CACHE_SIZE; i++) {
+    for (size_t i = 0; i < tb_jmp_cache_size(jc); i++) {
         qatomic_set(&jc->array[i].tb, NULL);
     }
 }
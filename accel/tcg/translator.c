@@ -18,6 +18,7 @@
 #include "tcg/tcg-op-common.h"
 #include "internal-target.h"
 #include "disas/disas.h"
+#include "tcg/perf.h"
 
 static void set_can_do_io(DisasContextBase *db, bool val)
 {
@@ -43,6 +44,7 @@ static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
 {
     TCGv_i32 count = NULL;
     TCGOp *icount_start_insn = NULL;
+    uint32_t threshold;
 
     if ((cflags & CF_USE_ICOUNT) || !(cflags & CF_NOIRQ)) {
         count = tcg_temp_new_i32();
@@ -81,6 +83,25 @@ static TCGOp *gen_tb_start(DisasContextBase *db, uint32_t cflags)
                          - offsetof(ArchCPU, env));
     }
 
+    /*
+     * Count executions of the TB and report it to perf when it reaches
+     * the threshold.  The count is racy with MTTCG, which at worst
+     * reports the TB twice.
+     */
+    threshold = perf_get_threshold();
+    if (threshold) {
+        TCGv_ptr tb = tcg_constant_ptr(db->tb);
+        TCGv_i32 hits = tcg_temp_new_i32();
+        TCGLabel *cold = gen_new_label();
+
+        tcg_gen_ld_i32(hits, tb, offsetof(TranslationBlock, perf_count));
+        tcg_gen_addi_i32(hits, hits, 1);
+        tcg_gen_st_i32(hits, tb, offsetof(TranslationBlock, perf_count));
+        tcg_gen_brcondi_i32(TCG_COND_NE, hits, threshold, cold);
+        gen_helper_perf_hot_tb(tcg_env, tb);
+        gen_set_label(cold);
+    }
+
     return icount_start_insn;
 }
 
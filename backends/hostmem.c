@@ -256,6 +256,27 @@ static void host_memory_backend_set_prealloc(Object *obj, bool value,
     }
 }
 
+static bool host_memory_backend_get_prealloc_background(Object *obj,
+                                                        Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    return backend->prealloc_background;
+}
+
+static void host_memory_backend_set_prealloc_background(Object *obj,
+                                                        bool value,
+                                                        Error **errp)
+{
+    HostMemoryBackend *backend = MEMORY_BACKEND(obj);
+
+    if (host_memory_backend_mr_inited(backend)) {
+        error_setg(errp, "cannot change property value");
+        return;
+    }
+    backend->prealloc_background = value;
+}
+
 static void host_memory_backend_get_prealloc_threads(Object *obj, Visitor *v,
     const char *name, void *opaque, Error **errp)
 {
@@ -339,6 +360,10 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
     size_t pagesize;
     bool async = !phase_check(PHASE_LATE_BACKENDS_CREATED);
 
+    if (backend->prealloc_background && !backend->prealloc) {
+        error_setg(errp, "'prealloc-background=on' requires 'prealloc=on'");
+        return;
+    }
     if (!bc->alloc) {
         return;
     }
@@ -422,6 +447,13 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
      * This is necessary to guarantee memory is allocated with
      * specified NUMA policy in place.
      */
+    if (backend->prealloc && backend->prealloc_background) {
+        backend->prealloc_job =
+            qemu_prealloc_mem_background(memory_region_get_fd(&backend->mr),
+                                         ptr, sz, backend->prealloc_threads,
+                                         backend->prealloc_context, errp);
+        return;
+    }
     if (backend->prealloc && !qemu_prealloc_mem(memory_region_get_fd(&backend->mr),
                                                 ptr, sz,
                                                 backend->prealloc_threads,
@@ -431,6 +463,19 @@ host_memory_backend_memory_complete(UserCreatable *uc, Error **errp)
     }
 }
 
+void host_memory_backend_stop_prealloc(HostMemoryBackend *backend)
+{
+    if (backend->prealloc_job) {
+        qemu_prealloc_mem_background_stop(backend->prealloc_job);
+        backend->prealloc_job = NULL;
+    }
+}
+
+static void host_memory_backend_unparent(Object *obj)
+{
+    host_memory_backend_stop_prealloc(MEMORY_BACKEND(obj));
+}
+
 static bool
 host_memory_backend_can_be_deleted(UserCreatable *uc)
 {
@@ -507,6 +552,7 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
 
     ucc->complete = host_memory_backend_memory_complete;
     ucc->can_be_deleted = host_memory_backend_can_be_deleted;
+    oc->unparent = host_memory_backend_unparent;
 
     object_class_property_add_bool(oc, "merge",
         host_memory_backend_get_merge,
@@ -523,6 +569,11 @@ host_memory_backend_class_init(ObjectClass *oc, void *data)
         host_memory_backend_set_prealloc);
     object_class_property_set_description(oc, "prealloc",
         "Preallocate memory");
+    object_class_property_add_bool(oc, "prealloc-background",
+        host_memory_backend_get_prealloc_background,
+        host_memory_backend_set_prealloc_background);
+    object_class_property_set_description(oc, "prealloc-background",
+        "Preallocate memory while the guest already runs");
     object_class_property_add(oc, "prealloc-threads", "int",
         host_memory_backend_get_prealloc_threads,
         host_memory_backend_set_prealloc_threads,
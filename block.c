@@ -422,6 +422,7 @@ BlockDriverState *bdrv_new(void)
     }
     qemu_mutex_init(&bs->reqs_lock);
     qemu_mutex_init(&bs->dirty_bitmap_mutex);
+    block_node_acct_init(&bs->node_stats);
     bs->refcnt = 1;
     bs->aio_context = qemu_get_aio_context();
 
@@ -5547,6 +5548,7 @@ static void bdrv_delete(BlockDriverState *bs)
     bdrv_close(bs);
 
     qemu_mutex_destroy(&bs->reqs_lock);
+    block_node_acct_cleanup(&bs->node_stats);
 
     g_free(bs);
 }
@@ -156,10 +156,9 @@ static void block_latency_histogram_account(BlockLatencyHistogram *hist,
     hist->bins[pos - hist->boundaries + 1]++;
 }
 
-int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
-                                uint64List *boundaries)
+static int block_latency_histogram_init(BlockLatencyHistogram *hist,
+                                        uint64List *boundaries)
 {
-    BlockLatencyHistogram *hist = &stats->latency_histogram[type];
     uint64List *entry;
     uint64_t *ptr;
     uint64_t prev = 0;
@@ -188,15 +187,26 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
     return 0;
 }
 
+static void block_latency_histogram_clear(BlockLatencyHistogram *hist)
+{
+    g_free(hist->bins);
+    g_free(hist->boundaries);
+    memset(hist, 0, sizeof(*hist));
+}
+
+int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
+                                uint64List *boundaries)
+{
+    return block_latency_histogram_init(&stats->latency_histogram[type],
+                                        boundaries);
+}
+
 void block_latency_histograms_clear(BlockAcctStats *stats)
 {
     int i;
 
     for (i = 0; i < BLOCK_MAX_IOTYPE; i++) {
-        BlockLatencyHistogram *hist = &stats->latency_histogram[i];
-        g_free(hist->bins);
-        g_free(hist->boundaries);
-        memset(hist, 0, sizeof(*hist));
+        block_latency_histogram_clear(&stats->latency_histogram[i]);
     }
 }
 
@@ -296,3 +306,135 @@ double block_acct_queue_depth(BlockAcctTimedStats *stats,
 
     return (double) sum / elapsed;
 }
+
+void block_node_acct_init(BlockNodeAcctStats *stats)
+{
+    qemu_mutex_init(&stats->lock);
+    if (qtest_enabled()) {
+        clock_type = QEMU_CLOCK_VIRTUAL;
+    }
+}
+
+static void block_node_acct_clear(BlockNodeAcctStats *stats)
+{
+    int i, j;
+
+    for (i = 0; i < BLOCK_NODE_ACCT_MAX; i++) {
+        for (j = 0; j < BLOCK_MAX_IOTYPE; j++) {
+            BlockNodeAcctPhaseStats *ps = &stats->phase[i][j];
+
+            block_latency_histogram_clear(&ps->latency_histogram);
+            ps->nr_ops = 0;
+            ps->total_time_ns = 0;
+        }
+    }
+}
+
+void block_node_acct_cleanup(BlockNodeAcctStats *stats)
+{
+    block_node_acct_clear(stats);
+    qemu_mutex_destroy(&stats->lock);
+}
+
+/*
+ * Enable or disable accounting for a node.  Either way the statistics start
+ * over; with @boundaries, every phase also gets a latency histogram.
+ */
+int block_node_acct_setup(BlockNodeAcctStats *stats, bool enable,
+                          uint64List *boundaries)
+{
+    int i, j, ret;
+
+    QEMU_LOCK_GUARD(&stats->lock);
+    block_node_acct_clear(stats);
+    qatomic_set(&stats->enabled, enable);
+
+    if (!enable || !boundaries) {
+        return 0;
+    }
+
+    for (i = 0; i < BLOCK_NODE_ACCT_MAX; i++) {
+        for (j = 0; j < BLOCK_MAX_IOTYPE; j++) {
+            ret = block_latency_histogram_init(
+                &stats->phase[i][j].latency_histogram, boundaries);
+            if (ret < 0) {
+                block_node_acct_clear(stats);
+                qatomic_set(&stats->enabled, false);
+                return ret;
+            }
+        }
+    }
+    return 0;
+}
+
+int64_t block_node_acct_start(BlockNodeAcctStats *stats)
+{
+    if (!block_node_acct_enabled(stats)) {
+        return 0;
+    }
+    return qemu_clock_get_ns(clock_type) ?: 1;
+}
+
+/* Called with stats->lock held */
+static void block_node_acct_phase(BlockNodeAcctStats *stats,
+                                  enum BlockNodeAcctPhase phase,
+                                  enum BlockAcctType type, int64_t latency_ns)
+{
+    BlockNodeAcctPhaseStats *ps = &stats->phase[phase][type];
+
+    ps->nr_ops++;
+    ps->total_time_ns += latency_ns;
+    block_latency_histogram_account(&ps->latency_histogram, latency_ns);
+}
+
+/*
+ * Account a request that started at @start_ns and was handed to the driver
+ * at @dispatch_ns, or failed before that if @dispatch_ns is 0.
+ */
+void block_node_acct_request(BlockNodeAcctStats *stats,
+                             enum BlockAcctType type,
+                             int64_t start_ns, int64_t dispatch_ns)
+{
+    int64_t now;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    if (!start_ns) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(clock_type);
+
+    QEMU_LOCK_GUARD(&stats->lock);
+    /* Accounting may have been disabled since the request started */
+    if (!stats->enabled) {
+        return;
+    }
+    block_node_acct_phase(stats, BLOCK_NODE_ACCT_QUEUE, type,
+                          (dispatch_ns ?: now) - start_ns);
+    if (dispatch_ns) {
+        block_node_acct_phase(stats, BLOCK_NODE_ACCT_IO, type,
+                              now - dispatch_ns);
+    }
+}
+
+void block_node_acct_metadata(BlockNodeAcctStats *stats,
+                              enum BlockAcctType type, int64_t start_ns)
+{
+    int64_t now;
+
+    assert(type < BLOCK_MAX_IOTYPE);
+
+    if (!start_ns) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(clock_type);
+
+    QEMU_LOCK_GUARD(&stats->lock);
+    if (!stats->enabled) {
+        return;
+    }
+    block_node_acct_phase(stats, BLOCK_NODE_ACCT_METADATA, type,
+                          now - start_ns);
+}
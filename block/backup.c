@@ -423,6 +423,11 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
         return NULL;
     }
 
+    if (perf->max_latency > INT64_MAX / SCALE_US) {
+        error_setg(errp, "max-latency is too large");
+        return NULL;
+    }
+
     if (sync_bitmap) {
         /* If we need to write to this bitmap, check that we can: */
         if (bitmap_mode != BITMAP_SYNC_MODE_NEVER &&
@@ -495,6 +500,7 @@ BlockJob *backup_job_create(const char *job_id, BlockDriverState *bs,
     block_copy_set_copy_opts(bcs, perf->use_copy_range, compress);
     block_copy_set_progress_meter(bcs, &job->common.job.progress);
     block_copy_set_speed(bcs, speed);
+    block_copy_set_max_latency(bcs, perf->max_latency * SCALE_US);
 
     /* Required permissions are taken by copy-before-write filter target */
     bdrv_graph_wrlock();
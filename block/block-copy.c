@@ -26,6 +26,7 @@
 #include "qemu/coroutine.h"
 #include "qemu/ratelimit.h"
 #include "block/aio_task.h"
+#include "block/copy-tuner.h"
 #include "qemu/error-report.h"
 #include "qemu/memalign.h"
 
@@ -54,6 +55,8 @@ typedef struct BlockCopyCallState {
     int max_workers;
     int64_t max_chunk;
     bool ignore_ratelimit;
+    /* Background copy sized by the tuner, as opposed to copy-before-write */
+    bool tuned;
     BlockCopyAsyncCallbackFunc cb;
     void *cb_opaque;
     /* Coroutine where async block-copy is running */
@@ -160,6 +163,7 @@ typedef struct BlockCopyState {
     ProgressMeter *progress;
     SharedResource *mem;
     RateLimit rate_limit;
+    CopyTuner tuner;
 } BlockCopyState;
 
 /* Called with lock held */
@@ -194,6 +198,9 @@ block_copy_task_create(BlockCopyState *s, BlockCopyCallState *call_state,
 
     QEMU_LOCK_GUARD(&s->lock);
     max_chunk = MIN_NON_ZERO(block_copy_chunk_size(s), call_state->max_chunk);
+    if (call_state->tuned) {
+        max_chunk = MIN(max_chunk, copy_tuner_chunk(&s->tuner));
+    }
     if (!bdrv_dirty_bitmap_next_dirty_area(s->copy_bitmap,
                                            offset, offset + bytes,
                                            max_chunk, &offset, &bytes))
@@ -270,6 +277,7 @@ void block_copy_state_free(BlockCopyState *s)
     }
 
     ratelimit_destroy(&s->rate_limit);
+    copy_tuner_destroy(&s->tuner);
     bdrv_release_dirty_bitmap(s->copy_bitmap);
     shres_destroy(s->mem);
     g_free(s);
@@ -440,6 +448,10 @@ BlockCopyState *block_copy_state_new(BdrvChild *source, BdrvChild *target,
     block_copy_set_copy_opts(s, false, false);
 
     ratelimit_init(&s->rate_limit);
+    copy_tuner_init(&s->tuner, 0, cluster_size,
+                    MAX(cluster_size, BLOCK_COPY_MAX_BUFFER),
+                    MAX(cluster_size, BLOCK_COPY_MAX_COPY_RANGE),
+                    BLOCK_COPY_MAX_WORKERS / 4, BLOCK_COPY_MAX_WORKERS);
     qemu_co_mutex_init(&s->lock);
     QLIST_INIT(&s->reqs);
     QLIST_INIT(&s->calls);
@@ -584,12 +596,16 @@ static coroutine_fn int block_copy_task_entry(AioTask *task)
     BlockCopyState *s = t->s;
     bool error_is_read = false;
     BlockCopyMethod method = t->method;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int ret = -1;
 
     WITH_GRAPH_RDLOCK_GUARD() {
         ret = block_copy_do_copy(s, t->req.offset, t->req.bytes, &method,
                                  &error_is_read);
     }
+    if (t->call_state->tuned) {
+        copy_tuner_op_done(&s->tuner, start_ns);
+    }
 
     WITH_QEMU_LOCK_GUARD(&s->lock) {
         if (s->method == t->method) {
@@ -824,6 +840,10 @@ block_copy_dirty_clusters(BlockCopyCallState *call_state)
         if (!aio && bytes) {
             aio = aio_task_pool_new(call_state->max_workers);
         }
+        if (aio && call_state->tuned) {
+            aio_task_pool_set_max_busy_tasks(aio,
+                MIN(call_state->max_workers, copy_tuner_workers(&s->tuner)));
+        }
 
         ret = block_copy_task_run(aio, task);
         if (ret < 0) {
@@ -942,6 +962,7 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
                             void *cb_opaque)
 {
     int ret;
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     BlockCopyCallState *call_state = g_new(BlockCopyCallState, 1);
 
     *call_state = (BlockCopyCallState) {
@@ -966,6 +987,9 @@ int coroutine_fn block_copy(BlockCopyState *s, int64_t start, int64_t bytes,
     ret = call_state->ret;
     g_free(call_state);
 
+    /* Guest writes wait for copy-before-write, that is their latency */
+    copy_tuner_guest_op_done(&s->tuner, start_ns);
+
     return ret;
 }
 
@@ -983,6 +1007,7 @@ BlockCopyCallState *block_copy_async(BlockCopyState *s,
         .bytes = bytes,
         .max_workers = max_workers,
         .max_chunk = max_chunk,
+        .tuned = copy_tuner_enabled(&s->tuner),
         .cb = cb,
         .cb_opaque = cb_opaque,
 
@@ -1062,6 +1087,11 @@ void block_copy_set_skip_unallocated(BlockCopyState *s, bool skip)
     qatomic_set(&s->skip_unallocated, skip);
 }
 
+void block_copy_set_max_latency(BlockCopyState *s, int64_t max_latency_ns)
+{
+    copy_tuner_set_max_latency(&s->tuner, max_latency_ns);
+}
+
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed)
 {
     ratelimit_set_speed(&s->rate_limit, speed, BLOCK_COPY_SLICE_TIME);
@@ -0,0 +1,120 @@
+/*
+ * Latency driven tuning of block copy jobs
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "block/copy-tuner.h"
+#include "qemu/lockable.h"
+#include "qemu/timer.h"
+#include "trace.h"
+
+/* How often the tuner decides, long enough to average over a few requests */
+#define COPY_TUNER_PERIOD_NS (100 * SCALE_MS)
+
+void copy_tuner_init(CopyTuner *t, int64_t max_latency_ns,
+                     int64_t min_chunk, int64_t chunk, int64_t max_chunk,
+                     int workers, int max_workers)
+{
+    assert(min_chunk > 0 && min_chunk <= chunk && chunk <= max_chunk);
+    assert(workers > 0 && workers <= max_workers);
+
+    *t = (CopyTuner) {
+        .min_chunk = min_chunk,
+        .max_chunk = max_chunk,
+        .max_workers = max_workers,
+        .enabled = max_latency_ns != 0,
+        .max_latency_ns = max_latency_ns,
+        .chunk = chunk,
+        .workers = workers,
+        .period_start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
+    };
+    qemu_mutex_init(&t->lock);
+}
+
+void copy_tuner_destroy(CopyTuner *t)
+{
+    qemu_mutex_destroy(&t->lock);
+}
+
+void copy_tuner_set_max_latency(CopyTuner *t, int64_t max_latency_ns)
+{
+    QEMU_LOCK_GUARD(&t->lock);
+    t->max_latency_ns = max_latency_ns;
+    qatomic_set(&t->enabled, max_latency_ns != 0);
+}
+
+int64_t copy_tuner_chunk(CopyTuner *t)
+{
+    QEMU_LOCK_GUARD(&t->lock);
+    return t->chunk;
+}
+
+int copy_tuner_workers(CopyTuner *t)
+{
+    QEMU_LOCK_GUARD(&t->lock);
+    return t->workers;
+}
+
+/* Called with t->lock held */
+static void copy_tuner_adjust(CopyTuner *t, int64_t now)
+{
+    int64_t latency = t->latency_ns / t->ops;
+    int64_t guest_latency = t->guest_ops ?
+                            t->guest_latency_ns / t->guest_ops : 0;
+    int64_t worst = MAX(latency, guest_latency);
+
+    if (worst > t->max_latency_ns) {
+        t->workers = MAX(t->workers / 2, 1);
+        t->chunk = MAX(QEMU_ALIGN_DOWN(t->chunk / 2, t->min_chunk),
+                       t->min_chunk);
+    } else if (worst < t->max_latency_ns / 2) {
+        if (t->workers < t->max_workers) {
+            t->workers = MIN(t->workers + MAX(t->workers / 4, 1),
+                             t->max_workers);
+        } else {
+            t->chunk = MIN(t->chunk * 2, t->max_chunk);
+        }
+    }
+    trace_copy_tuner_adjust(t, latency, guest_latency, t->workers, t->chunk);
+
+    t->period_start_ns = now;
+    t->ops = t->guest_ops = 0;
+    t->latency_ns = t->guest_latency_ns = 0;
+}
+
+void copy_tuner_op_done(CopyTuner *t, int64_t start_ns)
+{
+    int64_t now;
+
+    if (!copy_tuner_enabled(t)) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    QEMU_LOCK_GUARD(&t->lock);
+    t->ops++;
+    t->latency_ns += now - start_ns;
+    if (t->max_latency_ns &&
+        now - t->period_start_ns >= COPY_TUNER_PERIOD_NS) {
+        copy_tuner_adjust(t, now);
+    }
+}
+
+void copy_tuner_guest_op_done(CopyTuner *t, int64_t start_ns)
+{
+    int64_t now;
+
+    if (!copy_tuner_enabled(t)) {
+        return;
+    }
+
+    now = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+
+    QEMU_LOCK_GUARD(&t->lock);
+    t->guest_ops++;
+    t->guest_latency_ns += now - start_ns;
+}
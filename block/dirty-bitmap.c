@@ -53,6 +53,8 @@ struct BdrvDirtyBitmap {
     bool skip_store;            /* We are either migrating or deleting this
                                  * bitmap; it should not be stored on the next
                                  * inactivation. */
+    HBitmap *meta;              /* Tracks which parts of the bitmap changed,
+                                   if requested by the owner disk image */
     QLIST_ENTRY(BdrvDirtyBitmap) list;
 };
 
@@ -139,6 +141,65 @@ int64_t bdrv_dirty_bitmap_size(const BdrvDirtyBitmap *bitmap)
     return bitmap->size;
 }
 
+/*
+ * Track which parts of @bitmap change from now on, one bit of the meta
+ * bitmap covering @chunk_size bytes.  If changes were tracked already,
+ * start over.  Persistent bitmaps use this to store only what changed.
+ * Called with BQL taken.
+ */
+void bdrv_create_meta_dirty_bitmap(BdrvDirtyBitmap *bitmap,
+                                   uint64_t chunk_size)
+{
+    uint32_t granularity = bdrv_dirty_bitmap_granularity(bitmap);
+
+    assert(is_power_of_2(chunk_size) && chunk_size >= granularity);
+    assert(chunk_size / granularity <= INT_MAX);
+
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    if (bitmap->meta) {
+        hbitmap_free_meta(bitmap->bitmap);
+    }
+    bitmap->meta = hbitmap_create_meta(bitmap->bitmap,
+                                       chunk_size / granularity);
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+}
+
+/* Called with BQL taken. */
+void bdrv_release_meta_dirty_bitmap(BdrvDirtyBitmap *bitmap)
+{
+    bdrv_dirty_bitmaps_lock(bitmap->bs);
+    if (bitmap->meta) {
+        hbitmap_free_meta(bitmap->bitmap);
+        bitmap->meta = NULL;
+    }
+    bdrv_dirty_bitmaps_unlock(bitmap->bs);
+}
+
+/* Return the chunk size of the meta bitmap, or 0 if there is none */
+uint64_t bdrv_dirty_bitmap_meta_granularity(const BdrvDirtyBitmap *bitmap)
+{
+    return bitmap->meta ? 1ULL << hbitmap_granularity(bitmap->meta) : 0;
+}
+
+/*
+ * @hb replaces @old as the HBitmap of @bitmap.  What changed in between is
+ * not known, so if changes are tracked, consider everything changed.
+ */
+static void bdrv_dirty_bitmap_move_meta(BdrvDirtyBitmap *bitmap,
+                                        HBitmap *old, HBitmap *hb)
+{
+    int chunk_bits;
+
+    if (!bitmap->meta) {
+        return;
+    }
+
+    chunk_bits = hbitmap_granularity(bitmap->meta) - hbitmap_granularity(old);
+    hbitmap_free_meta(old);
+    bitmap->meta = hbitmap_create_meta(hb, 1 << chunk_bits);
+    hbitmap_set(bitmap->meta, 0, bitmap->size);
+}
+
 const char *bdrv_dirty_bitmap_name(const BdrvDirtyBitmap *bitmap)
 {
     return bitmap->name;
@@ -260,6 +321,9 @@ static void bdrv_release_dirty_bitmap_locked(BdrvDirtyBitmap *bitmap)
     assert(!bdrv_dirty_bitmap_busy(bitmap));
     assert(!bdrv_dirty_bitmap_has_successor(bitmap));
     QLIST_REMOVE(bitmap, list);
+    if (bitmap->meta) {
+        hbitmap_free_meta(bitmap->bitmap);
+    }
     hbitmap_free(bitmap->bitmap);
     g_free(bitmap->name);
     g_free(bitmap);
@@ -582,6 +646,7 @@ void bdrv_clear_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap **out)
         HBitmap *backup = bitmap->bitmap;
         bitmap->bitmap = hbitmap_alloc(bitmap->size,
                                        hbitmap_granularity(backup));
+        bdrv_dirty_bitmap_move_meta(bitmap, backup, bitmap->bitmap);
         *out = backup;
     }
     bdrv_dirty_bitmaps_unlock(bitmap->bs);
@@ -593,6 +658,7 @@ void bdrv_restore_dirty_bitmap(BdrvDirtyBitmap *bitmap, HBitmap *backup)
     assert(!bdrv_dirty_bitmap_readonly(bitmap));
     GLOBAL_STATE_CODE();
     bitmap->bitmap = backup;
+    bdrv_dirty_bitmap_move_meta(bitmap, tmp, backup);
     hbitmap_free(tmp);
 }
 
@@ -781,6 +847,14 @@ int64_t bdrv_dirty_bitmap_next_dirty(BdrvDirtyBitmap *bitmap, int64_t offset,
     return hbitmap_next_dirty(bitmap->bitmap, offset, bytes);
 }
 
+/* Return the first offset that changed, see bdrv_create_meta_dirty_bitmap() */
+int64_t bdrv_dirty_bitmap_next_meta_dirty(BdrvDirtyBitmap *bitmap,
+                                          int64_t offset, int64_t bytes)
+{
+    assert(bitmap->meta);
+    return hbitmap_next_dirty(bitmap->meta, offset, bytes);
+}
+
 int64_t bdrv_dirty_bitmap_next_zero(BdrvDirtyBitmap *bitmap, int64_t offset,
                                     int64_t bytes)
 {
@@ -876,6 +950,7 @@ void bdrv_dirty_bitmap_merge_internal(BdrvDirtyBitmap *dest,
     if (backup) {
         *backup = dest->bitmap;
         dest->bitmap = hbitmap_alloc(dest->size, hbitmap_granularity(*backup));
+        bdrv_dirty_bitmap_move_meta(dest, *backup, dest->bitmap);
         hbitmap_merge(*backup, src->bitmap, dest->bitmap);
     } else {
         hbitmap_merge(dest->bitmap, src->bitmap, dest->bitmap);
@@ -36,6 +36,7 @@
 #include "block/thread-pool.h"
 #include "qemu/iov.h"
 #include "block/raw-aio.h"
+#include "exec/memory.h" /* for ram_block_discard_disable() */
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qstring.h"
 
@@ -161,6 +162,9 @@ typedef struct BDRVRawState {
     bool use_linux_aio:1;
     bool has_laio_fdsync:1;
     bool use_linux_io_uring:1;
+    bool use_fixed_bufs:1;
+    unsigned luring_flags; /* AIO_IO_URING_* */
+    int fixed_file; /* io_uring fixed file slot of fd, or -1 */
     int page_cache_inconsistent; /* errno from fdatasync failure */
     bool has_fallocate;
     bool needs_alignment;
@@ -561,6 +565,23 @@ static QemuOptsList raw_runtime_opts = {
             .type = QEMU_OPT_NUMBER,
             .help = "AIO max batch size (0 = auto handled by AIO backend, default: 0)",
         },
+#ifdef CONFIG_LINUX_IO_URING
+        {
+            .name = "aio-fixed-buffers",
+            .type = QEMU_OPT_BOOL,
+            .help = "register guest RAM as io_uring fixed buffers (default: off)",
+        },
+        {
+            .name = "aio-iopoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "poll for io_uring completions (default: off)",
+        },
+        {
+            .name = "aio-sqpoll",
+            .type = QEMU_OPT_BOOL,
+            .help = "let a kernel thread poll for io_uring submissions (default: off)",
+        },
+#endif
         {
             .name = "locking",
             .type = QEMU_OPT_STRING,
@@ -638,6 +659,25 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     s->use_linux_aio = (aio == BLOCKDEV_AIO_OPTIONS_NATIVE);
 #ifdef CONFIG_LINUX_IO_URING
     s->use_linux_io_uring = (aio == BLOCKDEV_AIO_OPTIONS_IO_URING);
+    s->use_fixed_bufs = qemu_opt_get_bool(opts, "aio-fixed-buffers", false);
+    s->fixed_file = -1;
+    if (s->use_fixed_bufs && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-fixed-buffers requires aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
+    s->luring_flags = 0;
+    if (qemu_opt_get_bool(opts, "aio-iopoll", false)) {
+        s->luring_flags |= AIO_IO_URING_IOPOLL;
+    }
+    if (qemu_opt_get_bool(opts, "aio-sqpoll", false)) {
+        s->luring_flags |= AIO_IO_URING_SQPOLL;
+    }
+    if (s->luring_flags && !s->use_linux_io_uring) {
+        error_setg(errp, "aio-iopoll and aio-sqpoll require aio=io_uring");
+        ret = -EINVAL;
+        goto fail;
+    }
 #endif
 
     s->aio_max_batch = qemu_opt_get_number(opts, "aio-max-batch", 0);
@@ -731,6 +771,17 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
     }
 #endif /* !defined(CONFIG_LINUX_AIO) */
 
+#ifdef CONFIG_LINUX_IO_URING
+    /* Polled completions need I/O that bypasses the page cache */
+    if ((s->luring_flags & AIO_IO_URING_IOPOLL) &&
+        !(s->open_flags & O_DIRECT)) {
+        error_setg(errp, "aio-iopoll requires cache.direct=on, which was "
+                         "not specified.");
+        ret = -EINVAL;
+        goto fail;
+    }
+#endif
+
 #ifndef CONFIG_LINUX_IO_URING
     if (s->use_linux_io_uring) {
         error_setg(errp, "aio=io_uring was specified, but is not supported "
@@ -809,6 +860,20 @@ static int raw_open_common(BlockDriverState *bs, QDict *options,
         /* When extending regular files, we get zeros from the OS */
         bs->supported_truncate_flags = BDRV_REQ_ZERO_WRITE;
     }
+
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_fixed_bufs) {
+        /* Fixed buffers keep guest RAM pinned, it must not be discarded */
+        ret = ram_block_discard_disable(true);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "ram_block_discard_disable() failed");
+            goto fail;
+        }
+    }
+    if (s->use_linux_io_uring) {
+        s->fixed_file = luring_register_file(s->fd);
+    }
+#endif
     ret = 0;
 fail:
     if (ret < 0 && s->fd != -1) {
@@ -2435,7 +2500,7 @@ static bool bdrv_qiov_is_aligned(BlockDriverState *bs, QEMUIOVector *qiov)
 }
 
 #ifdef CONFIG_LINUX_IO_URING
-static inline bool raw_check_linux_io_uring(BDRVRawState *s)
+static inline bool raw_check_linux_io_uring(BDRVRawState *s, unsigned flags)
 {
     Error *local_err = NULL;
     AioContext *ctx;
@@ -2445,7 +2510,7 @@ static inline bool raw_check_linux_io_uring(BDRVRawState *s)
     }
 
     ctx = qemu_get_current_aio_context();
-    if (unlikely(!aio_setup_linux_io_uring(ctx, &local_err))) {
+    if (unlikely(!aio_setup_linux_io_uring(ctx, flags, &local_err))) {
         error_reportf_err(local_err, "Unable to use linux io_uring, "
                                      "falling back to thread pool: ");
         s->use_linux_io_uring = false;
@@ -2506,9 +2571,10 @@ static int coroutine_fn raw_co_prw(BlockDriverState *bs, int64_t *offset_ptr,
     if (s->needs_alignment && !bdrv_qiov_is_aligned(bs, qiov)) {
         type |= QEMU_AIO_MISALIGNED;
 #ifdef CONFIG_LINUX_IO_URING
-    } else if (raw_check_linux_io_uring(s)) {
+    } else if (raw_check_linux_io_uring(s, s->luring_flags)) {
         assert(qiov->size == bytes);
-        ret = luring_co_submit(bs, s->fd, offset, qiov, type);
+        ret = luring_co_submit(bs, s->luring_flags, s->fd, s->fixed_file,
+                               offset, qiov, type);
         goto out;
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2585,6 +2651,9 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
 {
     BDRVRawState *s = bs->opaque;
     RawPosixAIOData acb;
+#ifdef CONFIG_LINUX_IO_URING
+    unsigned luring_flags;
+#endif
     int ret;
 
     ret = fd_open(bs);
@@ -2599,8 +2668,11 @@ static int coroutine_fn raw_co_flush_to_disk(BlockDriverState *bs)
     };
 
 #ifdef CONFIG_LINUX_IO_URING
-    if (raw_check_linux_io_uring(s)) {
-        return luring_co_submit(bs, s->fd, 0, NULL, QEMU_AIO_FLUSH);
+    /* Rings with polled completions cannot fsync */
+    luring_flags = s->luring_flags & ~AIO_IO_URING_IOPOLL;
+    if (raw_check_linux_io_uring(s, luring_flags)) {
+        return luring_co_submit(bs, luring_flags, s->fd, s->fixed_file, 0,
+                                NULL, QEMU_AIO_FLUSH);
     }
 #endif
 #ifdef CONFIG_LINUX_AIO
@@ -2618,11 +2690,43 @@ static void raw_close(BlockDriverState *bs)
     if (s->fd >= 0) {
 #if defined(CONFIG_BLKZONED)
         g_free(bs->wps);
+#endif
+#ifdef CONFIG_LINUX_IO_URING
+        luring_unregister_file(s->fixed_file);
+        s->fixed_file = -1;
 #endif
         qemu_close(s->fd);
         s->fd = -1;
     }
+#ifdef CONFIG_LINUX_IO_URING
+    if (s->use_fixed_bufs) {
+        ram_block_discard_disable(false);
+    }
+#endif
+}
+
+#ifdef CONFIG_LINUX_IO_URING
+static bool raw_register_buf(BlockDriverState *bs, void *host, size_t size,
+                             Error **errp)
+{
+    BDRVRawState *s = bs->opaque;
+
+    /* Failing to register is harmless, requests then take the normal path */
+    if (s->use_fixed_bufs) {
+        luring_register_buf(host, size);
+    }
+    return true;
+}
+
+static void raw_unregister_buf(BlockDriverState *bs, void *host, size_t size)
+{
+    BDRVRawState *s = bs->opaque;
+
+    if (s->use_fixed_bufs) {
+        luring_unregister_buf(host, size);
+    }
 }
+#endif
 
 /**
  * Truncates the given regular file @fd to @offset and, when growing, fills the
@@ -3809,9 +3913,18 @@ static void raw_set_perm(BlockDriverState *bs, uint64_t perm, uint64_t shared)
     /* For reopen, we have already switched to the new fd (.bdrv_set_perm is
      * called after .bdrv_reopen_commit) */
     if (s->perm_change_fd && s->fd != s->perm_change_fd) {
+#ifdef CONFIG_LINUX_IO_URING
+        luring_unregister_file(s->fixed_file);
+        s->fixed_file = -1;
+#endif
         qemu_close(s->fd);
         s->fd = s->perm_change_fd;
         s->open_flags = s->perm_change_flags;
+#ifdef CONFIG_LINUX_IO_URING
+        if (s->use_linux_io_uring) {
+            s->fixed_file = luring_register_file(s->fd);
+        }
+#endif
     }
     s->perm_change_fd = 0;
 
@@ -3906,6 +4019,10 @@ BlockDriver bdrv_file = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
@@ -4270,6 +4387,10 @@ static BlockDriver bdrv_host_device = {
     .bdrv_co_copy_range_from = raw_co_copy_range_from,
     .bdrv_co_copy_range_to  = raw_co_copy_range_to,
     .bdrv_refresh_limits = raw_refresh_limits,
+#ifdef CONFIG_LINUX_IO_URING
+    .bdrv_register_buf      = raw_register_buf,
+    .bdrv_unregister_buf    = raw_unregister_buf,
+#endif
 
     .bdrv_co_truncate                   = raw_co_truncate,
     .bdrv_co_getlength                  = raw_co_getlength,
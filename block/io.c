@@ -603,6 +603,21 @@ static void coroutine_fn tracked_request_end(BdrvTrackedRequest *req)
 /**
  * Add an active request to the tracked requests list
  */
+/* The request is done waiting and handed to the driver */
+static void bdrv_node_acct_dispatch(BdrvTrackedRequest *req)
+{
+    if (req->acct_start_ns && !req->acct_dispatch_ns) {
+        req->acct_dispatch_ns = block_node_acct_start(&req->bs->node_stats);
+    }
+}
+
+static void bdrv_node_acct_done(BdrvTrackedRequest *req,
+                                enum BlockAcctType type)
+{
+    block_node_acct_request(&req->bs->node_stats, type,
+                            req->acct_start_ns, req->acct_dispatch_ns);
+}
+
 static void coroutine_fn tracked_request_begin(BdrvTrackedRequest *req,
                                                BlockDriverState *bs,
                                                int64_t offset,
@@ -1360,6 +1375,7 @@ bdrv_aligned_preadv(BdrvChild *child, BdrvTrackedRequest *req,
     } else {
         bdrv_wait_serialising_requests(req);
     }
+    bdrv_node_acct_dispatch(req);
 
     if (flags & BDRV_REQ_COPY_ON_READ) {
         int64_t pnum;
@@ -1776,6 +1792,7 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     BlockDriverState *bs = child->bs;
     BdrvTrackedRequest req;
     BdrvRequestPadding pad;
+    int64_t acct_start_ns = block_node_acct_start(&bs->node_stats);
     int ret;
     IO_CODE();
 
@@ -1816,9 +1833,11 @@ int coroutine_fn bdrv_co_preadv_part(BdrvChild *child,
     }
 
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_READ);
+    req.acct_start_ns = acct_start_ns;
     ret = bdrv_aligned_preadv(child, &req, offset, bytes,
                               bs->bl.request_alignment,
                               qiov, qiov_offset, flags);
+    bdrv_node_acct_done(&req, BLOCK_ACCT_READ);
     tracked_request_end(&req);
     bdrv_padding_finalize(&pad);
 
@@ -2085,6 +2104,9 @@ bdrv_aligned_pwritev(BdrvChild *child, BdrvTrackedRequest *req,
                                    align);
 
     ret = bdrv_co_write_req_prepare(child, offset, bytes, req, flags);
+    if (!ret) {
+        bdrv_node_acct_dispatch(req);
+    }
 
     if (!ret && bs->detect_zeroes != BLOCKDEV_DETECT_ZEROES_OPTIONS_OFF &&
         !(flags & BDRV_REQ_ZERO_WRITE) && drv->bdrv_co_pwrite_zeroes &&
@@ -2229,6 +2251,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     BdrvTrackedRequest req;
     uint64_t align = bs->bl.request_alignment;
     BdrvRequestPadding pad;
+    int64_t acct_start_ns = block_node_acct_start(&bs->node_stats);
     int ret;
     bool padded = false;
     IO_CODE();
@@ -2282,6 +2305,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
 
     bdrv_inc_in_flight(bs);
     tracked_request_begin(&req, bs, offset, bytes, BDRV_TRACKED_WRITE);
+    req.acct_start_ns = acct_start_ns;
 
     if (flags & BDRV_REQ_ZERO_WRITE) {
         assert(!padded);
@@ -2307,6 +2331,7 @@ int coroutine_fn bdrv_co_pwritev_part(BdrvChild *child,
     bdrv_padding_finalize(&pad);
 
 out:
+    bdrv_node_acct_done(&req, BLOCK_ACCT_WRITE);
     tracked_request_end(&req);
     bdrv_dec_in_flight(bs);
 
@@ -12,6 +12,9 @@
 #include <liburing.h>
 #include "block/aio.h"
 #include "qemu/queue.h"
+#include "qemu/bitmap.h"
+#include "qemu/lockable.h"
+#include "qemu/units.h"
 #include "block/block.h"
 #include "block/raw-aio.h"
 #include "qemu/coroutine.h"
@@ -26,6 +29,26 @@
 /* io_uring ring size */
 #define MAX_ENTRIES 128
 
+/* Milliseconds without submissions before the SQPOLL thread goes to sleep */
+#define SQ_THREAD_IDLE_MS 10
+
+/* Slots in the fixed buffer and fixed file tables of each ring */
+#define MAX_FIXED_BUFS 1024
+#define MAX_FIXED_FILES 1024
+
+/* The kernel limits each fixed buffer to this size */
+#define FIXED_BUF_SIZE (1 * GiB)
+
+/* Registered memory is cut into FIXED_BUF_SIZE pieces, in adjacent slots */
+#define MAX_BUF_REGIONS 32
+
+typedef struct LuringBufRegion {
+    void *host;
+    size_t size;
+    unsigned int first_slot;
+    unsigned int refcnt;
+} LuringBufRegion;
+
 typedef struct LuringAIOCB {
     Coroutine *co;
     struct io_uring_sqe sqeq;
@@ -53,13 +76,41 @@ struct LuringState {
     AioContext *aio_context;
 
     struct io_uring ring;
+    unsigned flags; /* AIO_IO_URING_* */
 
     /* No locking required, only accessed from AioContext home thread */
     LuringQueue io_q;
 
     QEMUBH *completion_bh;
+
+    /* Which fixed buffer and fixed file slots are usable in this ring */
+    bool has_fixed_bufs;
+    bool has_fixed_files;
+    DECLARE_BITMAP(fixed_bufs, MAX_FIXED_BUFS);
+    DECLARE_BITMAP(fixed_files, MAX_FIXED_FILES);
+    QLIST_ENTRY(LuringState) next;
 };
 
+/*
+ * Fixed buffers and fixed files use the same slots in every ring, so that
+ * a request can use them whatever AioContext it is submitted in.  Slots
+ * are filled and emptied from the main loop, while no request uses them;
+ * submission looks them up from any thread.
+ */
+static QemuMutex luring_fixed_lock;
+static QLIST_HEAD(, LuringState) luring_states =
+    QLIST_HEAD_INITIALIZER(luring_states);
+static LuringBufRegion luring_buf_regions[MAX_BUF_REGIONS];
+static unsigned int luring_nr_buf_regions;
+static DECLARE_BITMAP(luring_buf_slots, MAX_FIXED_BUFS);
+static int luring_files[MAX_FIXED_FILES];
+static DECLARE_BITMAP(luring_file_slots, MAX_FIXED_FILES);
+
+static void __attribute__((constructor)) luring_fixed_init(void)
+{
+    qemu_mutex_init(&luring_fixed_lock);
+}
+
 /**
  * luring_resubmit:
  *
@@ -90,6 +141,15 @@ static void luring_resubmit_short_read(LuringState *s, LuringAIOCB *luringcb,
     luringcb->total_read += nread;
     remaining = luringcb->qiov->size - luringcb->total_read;
 
+    /* Fixed buffers are contiguous, just skip what has been read */
+    if (luringcb->sqeq.opcode == IORING_OP_READ_FIXED) {
+        luringcb->sqeq.off += nread;
+        luringcb->sqeq.addr += nread;
+        luringcb->sqeq.len = remaining;
+        luring_resubmit(s, luringcb);
+        return;
+    }
+
     /* Shorten qiov */
     resubmit_qiov = &luringcb->resubmit_qiov;
     if (resubmit_qiov->iov == NULL) {
@@ -221,7 +281,13 @@ end:
         }
     }
 
-    qemu_bh_cancel(s->completion_bh);
+    /*
+     * Nothing signals the completion of polled requests, so keep reaping
+     * them from the BH for as long as some are in flight.
+     */
+    if (!(s->flags & AIO_IO_URING_IOPOLL) || !s->io_q.in_flight) {
+        qemu_bh_cancel(s->completion_bh);
+    }
 
     defer_call_end();
 }
@@ -294,7 +360,12 @@ static void qemu_luring_completion_cb(void *opaque)
 static bool qemu_luring_poll_cb(void *opaque)
 {
     LuringState *s = opaque;
+    struct io_uring_cqe *cqe;
 
+    /* Peeking polls the device for completions of polled requests */
+    if ((s->flags & AIO_IO_URING_IOPOLL) && s->io_q.in_flight) {
+        return io_uring_peek_cqe(&s->ring, &cqe) == 0;
+    }
     return io_uring_cq_ready(&s->ring);
 }
 
@@ -323,9 +394,199 @@ static void luring_deferred_fn(void *opaque)
     }
 }
 
+/* Fill or empty the slots of @r in the fixed buffer table of @s */
+static void luring_update_buf_region(LuringState *s, LuringBufRegion *r,
+                                     bool add)
+{
+    unsigned int i, nr = DIV_ROUND_UP(r->size, FIXED_BUF_SIZE);
+
+    if (!s->has_fixed_bufs) {
+        return;
+    }
+    for (i = 0; i < nr; i++) {
+        unsigned int slot = r->first_slot + i;
+        struct iovec iov = {};
+        int ret;
+
+        if (add) {
+            iov.iov_base = r->host + (size_t)i * FIXED_BUF_SIZE;
+            iov.iov_len = MIN(r->size - (size_t)i * FIXED_BUF_SIZE,
+                              FIXED_BUF_SIZE);
+        }
+        ret = io_uring_register_buffers_update_tag(&s->ring, slot, &iov,
+                                                   NULL, 1);
+        trace_luring_update_buf(s, slot, iov.iov_base, iov.iov_len, ret);
+        if (add && ret > 0) {
+            set_bit(slot, s->fixed_bufs);
+        } else {
+            clear_bit(slot, s->fixed_bufs);
+        }
+    }
+}
+
+/* Fill slot @slot of the fixed file table of @s with @fd, or empty it */
+static void luring_update_file(LuringState *s, unsigned int slot, int fd)
+{
+    int ret;
+
+    if (!s->has_fixed_files) {
+        return;
+    }
+    ret = io_uring_register_files_update(&s->ring, slot, &fd, 1);
+    trace_luring_update_file(s, slot, fd, ret);
+    if (fd >= 0 && ret > 0) {
+        set_bit(slot, s->fixed_files);
+    } else {
+        clear_bit(slot, s->fixed_files);
+    }
+}
+
+/**
+ * luring_register_buf:
+ * @host: start of the memory
+ * @size: size of the memory
+ *
+ * Registers memory as fixed buffers in all rings, including those created
+ * later.  Requests into that memory that are made of a single iovec no
+ * longer need the kernel to pin their pages.  Failure is not fatal, the
+ * memory then keeps going through the normal path.
+ */
+void luring_register_buf(void *host, size_t size)
+{
+    unsigned int i, nr = DIV_ROUND_UP(size, FIXED_BUF_SIZE);
+    LuringBufRegion *r;
+    LuringState *s;
+    unsigned long slot;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+    for (i = 0; i < luring_nr_buf_regions; i++) {
+        r = &luring_buf_regions[i];
+        if (r->host == host && r->size == size) {
+            r->refcnt++;
+            return;
+        }
+    }
+    if (luring_nr_buf_regions == MAX_BUF_REGIONS) {
+        return;
+    }
+    slot = bitmap_find_next_zero_area(luring_buf_slots, MAX_FIXED_BUFS,
+                                      0, nr, 0);
+    if (slot >= MAX_FIXED_BUFS) {
+        return;
+    }
+    bitmap_set(luring_buf_slots, slot, nr);
+
+    r = &luring_buf_regions[luring_nr_buf_regions++];
+    *r = (LuringBufRegion) {
+        .host = host,
+        .size = size,
+        .first_slot = slot,
+        .refcnt = 1,
+    };
+    QLIST_FOREACH(s, &luring_states, next) {
+        luring_update_buf_region(s, r, true);
+    }
+}
+
+/* Undoes luring_register_buf() */
+void luring_unregister_buf(void *host, size_t size)
+{
+    LuringBufRegion *r;
+    LuringState *s;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+    for (i = 0; i < luring_nr_buf_regions; i++) {
+        r = &luring_buf_regions[i];
+        if (r->host == host && r->size == size) {
+            break;
+        }
+    }
+    if (i == luring_nr_buf_regions || --r->refcnt) {
+        return;
+    }
+    QLIST_FOREACH(s, &luring_states, next) {
+        luring_update_buf_region(s, r, false);
+    }
+    bitmap_clear(luring_buf_slots, r->first_slot,
+                 DIV_ROUND_UP(r->size, FIXED_BUF_SIZE));
+    *r = luring_buf_regions[--luring_nr_buf_regions];
+}
+
+/**
+ * luring_register_file:
+ * @fd: file descriptor
+ *
+ * Registers @fd as a fixed file in all rings, including those created
+ * later, which saves looking it up for each request.
+ *
+ * Returns: the slot to pass to luring_co_submit(), or -1 if there is none
+ * left.
+ */
+int luring_register_file(int fd)
+{
+    LuringState *s;
+    unsigned long slot;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+    slot = find_first_zero_bit(luring_file_slots, MAX_FIXED_FILES);
+    if (slot >= MAX_FIXED_FILES) {
+        return -1;
+    }
+    set_bit(slot, luring_file_slots);
+    luring_files[slot] = fd;
+    QLIST_FOREACH(s, &luring_states, next) {
+        luring_update_file(s, slot, fd);
+    }
+    return slot;
+}
+
+/*
+ * Undoes luring_register_file(); must be called before the file descriptor
+ * is closed, or the rings keep the file open.
+ */
+void luring_unregister_file(int slot)
+{
+    LuringState *s;
+
+    if (slot < 0) {
+        return;
+    }
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+    QLIST_FOREACH(s, &luring_states, next) {
+        luring_update_file(s, slot, -1);
+    }
+    clear_bit(slot, luring_file_slots);
+}
+
+/* Returns the fixed buffer slot of @s that holds all of @iov, or -1 */
+static int luring_find_fixed_buf(LuringState *s, struct iovec *iov)
+{
+    unsigned int i;
+
+    for (i = 0; i < luring_nr_buf_regions; i++) {
+        LuringBufRegion *r = &luring_buf_regions[i];
+        uintptr_t start = (uintptr_t)iov->iov_base - (uintptr_t)r->host;
+        unsigned int slot;
+
+        if ((uintptr_t)iov->iov_base < (uintptr_t)r->host ||
+            start >= r->size || iov->iov_len > r->size - start) {
+            continue;
+        }
+        if (start / FIXED_BUF_SIZE !=
+            (start + iov->iov_len - 1) / FIXED_BUF_SIZE) {
+            return -1;
+        }
+        slot = r->first_slot + start / FIXED_BUF_SIZE;
+        return test_bit(slot, s->fixed_bufs) ? slot : -1;
+    }
+    return -1;
+}
+
 /**
  * luring_do_submit:
  * @fd: file descriptor for I/O
+ * @fixed_file: fixed file slot of @fd, or -1
  * @luringcb: AIO control block
  * @s: AIO state
  * @offset: offset for request
@@ -334,24 +595,45 @@ static void luring_deferred_fn(void *opaque)
  * Fetches sqes from ring, adds to pending queue and preps them
  *
  */
-static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
-                            uint64_t offset, int type)
+static int luring_do_submit(int fd, int fixed_file, LuringAIOCB *luringcb,
+                            LuringState *s, uint64_t offset, int type)
 {
     int ret;
     struct io_uring_sqe *sqes = &luringcb->sqeq;
+    struct iovec *iov = luringcb->qiov ? luringcb->qiov->iov : NULL;
+    int fixed_buf = -1;
+
+    if (s->has_fixed_bufs || s->has_fixed_files) {
+        QEMU_LOCK_GUARD(&luring_fixed_lock);
+        if (iov && luringcb->qiov->niov == 1 && s->has_fixed_bufs) {
+            fixed_buf = luring_find_fixed_buf(s, iov);
+        }
+        if (fixed_file >= 0 && !test_bit(fixed_file, s->fixed_files)) {
+            fixed_file = -1;
+        }
+    } else {
+        fixed_file = -1;
+    }
 
     switch (type) {
     case QEMU_AIO_WRITE:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
-        break;
     case QEMU_AIO_ZONE_APPEND:
-        io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
-                             luringcb->qiov->niov, offset);
+        if (fixed_buf >= 0) {
+            io_uring_prep_write_fixed(sqes, fd, iov->iov_base, iov->iov_len,
+                                      offset, fixed_buf);
+        } else {
+            io_uring_prep_writev(sqes, fd, luringcb->qiov->iov,
+                                 luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_READ:
-        io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
-                            luringcb->qiov->niov, offset);
+        if (fixed_buf >= 0) {
+            io_uring_prep_read_fixed(sqes, fd, iov->iov_base, iov->iov_len,
+                                     offset, fixed_buf);
+        } else {
+            io_uring_prep_readv(sqes, fd, luringcb->qiov->iov,
+                                luringcb->qiov->niov, offset);
+        }
         break;
     case QEMU_AIO_FLUSH:
         io_uring_prep_fsync(sqes, fd, IORING_FSYNC_DATASYNC);
@@ -361,6 +643,10 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
                         __func__, type);
         abort();
     }
+    if (fixed_file >= 0) {
+        sqes->fd = fixed_file;
+        sqes->flags |= IOSQE_FIXED_FILE;
+    }
     io_uring_sqe_set_data(sqes, luringcb);
 
     QSIMPLEQ_INSERT_TAIL(&s->io_q.submit_queue, luringcb, next);
@@ -379,12 +665,13 @@ static int luring_do_submit(int fd, LuringAIOCB *luringcb, LuringState *s,
     return 0;
 }
 
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+int coroutine_fn luring_co_submit(BlockDriverState *bs, unsigned flags, int fd,
+                                  int fixed_file, uint64_t offset,
                                   QEMUIOVector *qiov, int type)
 {
     int ret;
     AioContext *ctx = qemu_get_current_aio_context();
-    LuringState *s = aio_get_linux_io_uring(ctx);
+    LuringState *s = aio_get_linux_io_uring(ctx, flags);
     LuringAIOCB luringcb = {
         .co         = qemu_coroutine_self(),
         .ret        = -EINPROGRESS,
@@ -393,7 +680,7 @@ int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
     };
     trace_luring_co_submit(bs, s, &luringcb, fd, offset, qiov ? qiov->size : 0,
                            type);
-    ret = luring_do_submit(fd, &luringcb, s, offset, type);
+    ret = luring_do_submit(fd, fixed_file, &luringcb, s, offset, type);
 
     if (ret < 0) {
         return ret;
@@ -422,28 +709,66 @@ void luring_attach_aio_context(LuringState *s, AioContext *new_context)
                        qemu_luring_poll_cb, qemu_luring_poll_ready, s);
 }
 
-LuringState *luring_init(Error **errp)
+/* Sets up the fixed buffer and fixed file tables of a new ring */
+static void luring_init_fixed(LuringState *s)
+{
+    unsigned long slot;
+    unsigned int i;
+
+    QEMU_LOCK_GUARD(&luring_fixed_lock);
+
+    /* Older kernels lack sparse tables; requests then use the normal path */
+    s->has_fixed_bufs =
+        io_uring_register_buffers_sparse(&s->ring, MAX_FIXED_BUFS) == 0;
+    s->has_fixed_files =
+        io_uring_register_files_sparse(&s->ring, MAX_FIXED_FILES) == 0;
+
+    for (i = 0; i < luring_nr_buf_regions; i++) {
+        luring_update_buf_region(s, &luring_buf_regions[i], true);
+    }
+    for (slot = find_first_bit(luring_file_slots, MAX_FIXED_FILES);
+         slot < MAX_FIXED_FILES;
+         slot = find_next_bit(luring_file_slots, MAX_FIXED_FILES, slot + 1)) {
+        luring_update_file(s, slot, luring_files[slot]);
+    }
+    QLIST_INSERT_HEAD(&luring_states, s, next);
+}
+
+LuringState *luring_init(unsigned flags, Error **errp)
 {
     int rc;
     LuringState *s = g_new0(LuringState, 1);
     struct io_uring *ring = &s->ring;
+    struct io_uring_params params = {};
 
     trace_luring_init_state(s, sizeof(*s));
 
-    rc = io_uring_queue_init(MAX_ENTRIES, ring, 0);
+    if (flags & AIO_IO_URING_IOPOLL) {
+        params.flags |= IORING_SETUP_IOPOLL;
+    }
+    if (flags & AIO_IO_URING_SQPOLL) {
+        params.flags |= IORING_SETUP_SQPOLL;
+        params.sq_thread_idle = SQ_THREAD_IDLE_MS;
+    }
+    rc = io_uring_queue_init_params(MAX_ENTRIES, ring, &params);
     if (rc < 0) {
         error_setg_errno(errp, -rc, "failed to init linux io_uring ring");
         g_free(s);
         return NULL;
     }
+    s->flags = flags;
 
     ioq_init(&s->io_q);
+    luring_init_fixed(s);
     return s;
 
 }
 
 void luring_cleanup(LuringState *s)
 {
+    WITH_QEMU_LOCK_GUARD(&luring_fixed_lock) {
+        QLIST_REMOVE(s, next);
+    }
     io_uring_queue_exit(&s->ring);
     trace_luring_cleanup_state(s);
     g_free(s);
@@ -18,6 +18,7 @@
 #include "trace.h"
 #include "block/blockjob_int.h"
 #include "block/block_int.h"
+#include "block/copy-tuner.h"
 #include "block/dirty-bitmap.h"
 #include "sysemu/block-backend.h"
 #include "qapi/error.h"
@@ -29,6 +30,9 @@
 #define MAX_IO_BYTES (1 << 20) /* 1 Mb */
 #define DEFAULT_MIRROR_BUF_SIZE (MAX_IN_FLIGHT * MAX_IO_BYTES)
 
+/* How far the latency tuner may go beyond the defaults above */
+#define MIRROR_TUNER_SCALE 4
+
 /* The mirroring buffer is a list of granularity-sized chunks.
  * Free chunks are organized in a list.
  */
@@ -94,6 +98,8 @@ typedef struct MirrorBlockJob {
     bool prepared;
     bool in_drain;
     bool base_ro;
+    /* Number and size of background copy requests, if max-latency is set */
+    CopyTuner tuner;
 } MirrorBlockJob;
 
 typedef struct MirrorBDSOpaque {
@@ -118,6 +124,7 @@ struct MirrorOp {
     CoQueue waiting_requests;
     Coroutine *co;
     MirrorOp *waiting_for_op;
+    int64_t start_ns;
 
     QTAILQ_ENTRY(MirrorOp) next;
 };
@@ -203,6 +210,10 @@ static void coroutine_fn mirror_iteration_done(MirrorOp *op, int ret)
 
     trace_mirror_iteration_done(s, op->offset, op->bytes, ret);
 
+    if (ret >= 0) {
+        copy_tuner_op_done(&s->tuner, op->start_ns);
+    }
+
     s->in_flight--;
     s->bytes_in_flight -= op->bytes;
     iov = op->qiov.iov;
@@ -447,6 +458,7 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
         .offset         = offset,
         .bytes          = bytes,
         .bytes_handled  = &bytes_handled,
+        .start_ns       = qemu_clock_get_ns(QEMU_CLOCK_REALTIME),
     };
     qemu_co_queue_init(&op->waiting_requests);
 
@@ -480,6 +492,22 @@ static unsigned mirror_perform(MirrorBlockJob *s, int64_t offset,
     return bytes_handled;
 }
 
+static unsigned mirror_max_in_flight(MirrorBlockJob *s)
+{
+    if (copy_tuner_enabled(&s->tuner)) {
+        return copy_tuner_workers(&s->tuner);
+    }
+    return MAX_IN_FLIGHT;
+}
+
+static int mirror_max_io_bytes(MirrorBlockJob *s)
+{
+    if (copy_tuner_enabled(&s->tuner)) {
+        return MIN(copy_tuner_chunk(&s->tuner), s->buf_size);
+    }
+    return MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+}
+
 static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
 {
     BlockDriverState *source;
@@ -488,7 +516,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
     /* At least the first dirty chunk is mirrored in one iteration. */
     int nb_chunks = 1;
     bool write_zeroes_ok = bdrv_can_write_zeroes_with_unmap(blk_bs(s->target));
-    int max_io_bytes = MAX(s->buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES);
+    int max_io_bytes = mirror_max_io_bytes(s);
 
     bdrv_graph_co_rdlock();
     source = s->mirror_top_bs->backing->bs;
@@ -600,7 +628,7 @@ static void coroutine_fn GRAPH_UNLOCKED mirror_iteration(MirrorBlockJob *s)
             }
         }
 
-        while (s->in_flight >= MAX_IN_FLIGHT) {
+        while (s->in_flight >= mirror_max_in_flight(s)) {
             trace_mirror_yield_in_flight(s, offset, s->in_flight);
             mirror_wait_for_free_in_flight_slot(s);
         }
@@ -866,7 +894,7 @@ static int coroutine_fn GRAPH_UNLOCKED mirror_dirty_init(MirrorBlockJob *s)
                 return 0;
             }
 
-            if (s->in_flight >= MAX_IN_FLIGHT) {
+            if (s->in_flight >= mirror_max_in_flight(s)) {
                 trace_mirror_yield(s, UINT64_MAX, s->buf_free_count,
                                    s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1069,7 +1097,8 @@ static int coroutine_fn mirror_run(Job *job, Error **errp)
         }
         if (delta < BLOCK_JOB_SLICE_TIME &&
             iostatus == BLOCK_DEVICE_IO_STATUS_OK) {
-            if (s->in_flight >= MAX_IN_FLIGHT || s->buf_free_count == 0 ||
+            if (s->in_flight >= mirror_max_in_flight(s) ||
+                s->buf_free_count == 0 ||
                 (cnt == 0 && s->in_flight > 0)) {
                 trace_mirror_yield(s, cnt, s->buf_free_count, s->in_flight);
                 mirror_wait_for_free_in_flight_slot(s);
@@ -1300,11 +1329,22 @@ static void mirror_query(BlockJob *job, BlockJobInfo *info)
     };
 }
 
+static void mirror_free(Job *job)
+{
+    MirrorBlockJob *s = container_of(job, MirrorBlockJob, common.job);
+
+    /* block_job_create() may fail before mirror_start_job() sets it up */
+    if (s->tuner.max_workers) {
+        copy_tuner_destroy(&s->tuner);
+    }
+    block_job_free(job);
+}
+
 static const BlockJobDriver mirror_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(MirrorBlockJob),
         .job_type               = JOB_TYPE_MIRROR,
-        .free                   = block_job_free,
+        .free                   = mirror_free,
         .user_resume            = block_job_user_resume,
         .run                    = mirror_run,
         .prepare                = mirror_prepare,
@@ -1322,7 +1362,7 @@ static const BlockJobDriver commit_active_job_driver = {
     .job_driver = {
         .instance_size          = sizeof(MirrorBlockJob),
         .job_type               = JOB_TYPE_COMMIT,
-        .free                   = block_job_free,
+        .free                   = mirror_free,
         .user_resume            = block_job_user_resume,
         .run                    = mirror_run,
         .prepare                = mirror_prepare,
@@ -1513,11 +1553,36 @@ static void coroutine_fn GRAPH_RDLOCK active_write_settle(MirrorOp *op)
     g_free(op);
 }
 
+/*
+ * Guest requests are timed for the latency tuner only while it is enabled;
+ * 0 means that the request is not timed.
+ */
+static int64_t mirror_top_guest_op_start(MirrorBDSOpaque *s)
+{
+    if (!s->job || !copy_tuner_enabled(&s->job->tuner)) {
+        return 0;
+    }
+    return qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+}
+
+static void mirror_top_guest_op_done(MirrorBDSOpaque *s, int64_t start_ns)
+{
+    /* The job may have gone away while the request was running */
+    if (start_ns && s->job) {
+        copy_tuner_guest_op_done(&s->job->tuner, start_ns);
+    }
+}
+
 static int coroutine_fn GRAPH_RDLOCK
 bdrv_mirror_top_preadv(BlockDriverState *bs, int64_t offset, int64_t bytes,
                        QEMUIOVector *qiov, BdrvRequestFlags flags)
 {
-    return bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
+    int64_t start_ns = mirror_top_guest_op_start(bs->opaque);
+    int ret;
+
+    ret = bdrv_co_preadv(bs->backing, offset, bytes, qiov, flags);
+    mirror_top_guest_op_done(bs->opaque, start_ns);
+    return ret;
 }
 
 static bool should_copy_to_target(MirrorBDSOpaque *s)
@@ -1534,6 +1599,7 @@ bdrv_mirror_top_do_write(BlockDriverState *bs, MirrorMethod method,
 {
     MirrorOp *op = NULL;
     MirrorBDSOpaque *s = bs->opaque;
+    int64_t start_ns = mirror_top_guest_op_start(s);
     int ret = 0;
 
     if (copy_to_target) {
@@ -1574,6 +1640,7 @@ out:
     if (copy_to_target) {
         active_write_settle(op);
     }
+    mirror_top_guest_op_done(s, start_ns);
     return ret;
 }
 
@@ -1706,11 +1773,28 @@ static BlockDriver bdrv_mirror_top = {
     .filtered_child_is_backing  = true,
 };
 
+static void mirror_tuner_init(MirrorBlockJob *s, int64_t max_latency_ns,
+                              int64_t granularity, int64_t buf_size)
+{
+    int64_t chunk, max_chunk;
+
+    /* Start from what an untuned job does, see mirror_max_io_bytes() */
+    chunk = ROUND_UP(MAX(buf_size / MAX_IN_FLIGHT, MAX_IO_BYTES), granularity);
+    chunk = MIN(chunk, buf_size);
+    max_chunk = MIN(chunk * MIRROR_TUNER_SCALE, buf_size);
+    max_chunk = MAX(MIN(max_chunk, QEMU_ALIGN_DOWN(INT_MAX, granularity)),
+                    chunk);
+
+    copy_tuner_init(&s->tuner, max_latency_ns, granularity, chunk, max_chunk,
+                    MAX_IN_FLIGHT, MAX_IN_FLIGHT * MIRROR_TUNER_SCALE);
+}
+
 static BlockJob *mirror_start_job(
                              const char *job_id, BlockDriverState *bs,
                              int creation_flags, BlockDriverState *target,
                              const char *replaces, int64_t speed,
                              uint32_t granularity, int64_t buf_size,
+                             int64_t max_latency_ns,
                              BlockMirrorBackingMode backing_mode,
                              bool zero_target,
                              BlockdevOnError on_source_error,
@@ -1801,6 +1885,8 @@ static BlockJob *mirror_start_job(
     if (!s) {
         goto fail;
     }
+    mirror_tuner_init(s, max_latency_ns, granularity,
+                      ROUND_UP(buf_size, granularity));
 
     /* The block job now has a reference to this node */
     bdrv_unref(mirror_top_bs);
@@ -2008,6 +2094,7 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
                   BlockDriverState *target, const char *replaces,
                   int creation_flags, int64_t speed,
                   uint32_t granularity, int64_t buf_size,
+                  int64_t max_latency_ns,
                   MirrorSyncMode mode, BlockMirrorBackingMode backing_mode,
                   bool zero_target,
                   BlockdevOnError on_source_error,
@@ -2033,7 +2120,8 @@ void mirror_start(const char *job_id, BlockDriverState *bs,
     bdrv_graph_rdunlock_main_loop();
 
     mirror_start_job(job_id, bs, creation_flags, target, replaces,
-                     speed, granularity, buf_size, backing_mode, zero_target,
+                     speed, granularity, buf_size, max_latency_ns,
+                     backing_mode, zero_target,
                      on_source_error, on_target_error, unmap, NULL, NULL,
                      &mirror_job_driver, is_none_mode, base, false,
                      filter_node_name, true, copy_mode, false, errp);
@@ -2060,7 +2148,7 @@ BlockJob *commit_active_start(const char *job_id, BlockDriverState *bs,
     }
 
     job = mirror_start_job(
-                     job_id, bs, creation_flags, base, NULL, speed, 0, 0,
+                     job_id, bs, creation_flags, base, NULL, speed, 0, 0, 0,
                      MIRROR_LEAVE_BACKING_CHAIN, false,
                      on_error, on_error, true, cb, opaque,
                      &commit_active_job_driver, false, base, auto_complete,
@@ -572,3 +572,23 @@ void qmp_block_latency_histogram_set(
         }
     }
 }
+
+void qmp_block_node_latency_set(const char *node_name, bool enable,
+                                bool has_boundaries, uint64List *boundaries,
+                                Error **errp)
+{
+    BlockDriverState *bs;
+
+    GRAPH_RDLOCK_GUARD_MAINLOOP();
+
+    bs = bdrv_find_node(node_name);
+    if (!bs) {
+        error_setg(errp, "Node '%s' not found", node_name);
+        return;
+    }
+
+    if (block_node_acct_setup(&bs->node_stats, enable,
+                              has_boundaries ? boundaries : NULL) < 0) {
+        error_setg(errp, "Node '%s' set boundaries fail", node_name);
+    }
+}
@@ -588,6 +588,45 @@ static void bdrv_query_blk_stats(BlockDeviceStats *ds, BlockBackend *blk)
         = bdrv_latency_histogram_stats(&hgram[BLOCK_ACCT_FLUSH]);
 }
 
+static BlockNodeLatency *
+bdrv_node_latency_phase(BlockNodeAcctStats *stats,
+                        enum BlockNodeAcctPhase phase, enum BlockAcctType type)
+{
+    BlockNodeAcctPhaseStats *ps = &stats->phase[phase][type];
+    BlockNodeLatency *info = g_new0(BlockNodeLatency, 1);
+
+    info->operations = ps->nr_ops;
+    info->total_time_ns = ps->total_time_ns;
+    info->histogram = bdrv_latency_histogram_stats(&ps->latency_histogram);
+    return info;
+}
+
+static BlockNodeLatencyStats *bdrv_query_node_latency(BlockDriverState *bs)
+{
+    BlockNodeAcctStats *stats = &bs->node_stats;
+    BlockNodeLatencyStats *nl;
+
+    QEMU_LOCK_GUARD(&stats->lock);
+    if (!stats->enabled) {
+        return NULL;
+    }
+
+    nl = g_new0(BlockNodeLatencyStats, 1);
+    nl->rd_queue = bdrv_node_latency_phase(stats, BLOCK_NODE_ACCT_QUEUE,
+                                           BLOCK_ACCT_READ);
+    nl->rd_io = bdrv_node_latency_phase(stats, BLOCK_NODE_ACCT_IO,
+                                        BLOCK_ACCT_READ);
+    nl->rd_metadata = bdrv_node_latency_phase(stats, BLOCK_NODE_ACCT_METADATA,
+                                              BLOCK_ACCT_READ);
+    nl->wr_queue = bdrv_node_latency_phase(stats, BLOCK_NODE_ACCT_QUEUE,
+                                           BLOCK_ACCT_WRITE);
+    nl->wr_io = bdrv_node_latency_phase(stats, BLOCK_NODE_ACCT_IO,
+                                        BLOCK_ACCT_WRITE);
+    nl->wr_metadata = bdrv_node_latency_phase(stats, BLOCK_NODE_ACCT_METADATA,
+                                              BLOCK_ACCT_WRITE);
+    return nl;
+}
+
 static BlockStats * GRAPH_RDLOCK
 bdrv_query_bds_stats(BlockDriverState *bs, bool blk_level)
 {
@@ -616,6 +655,7 @@ bdrv_query_bds_stats(BlockDriverState *bs, bool blk_level)
     s->stats->wr_highest_offset = stat64_get(&bs->wr_highest_offset);
 
     s->driver_specific = bdrv_get_specific_stats(bs);
+    s->node_latency = bdrv_query_node_latency(bs);
 
     parent_child = bdrv_primary_child(bs);
     if (!parent_child ||
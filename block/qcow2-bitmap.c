@@ -47,6 +47,9 @@
 /* Size of bitmap table entries */
 #define BME_TABLE_ENTRY_SIZE (sizeof(uint64_t))
 
+/* Bitmap data clusters that are contiguous in the file are read at once */
+#define BME_MAX_READ_SIZE (1 * MiB)
+
 QEMU_BUILD_BUG_ON(BME_MAX_NAME_SIZE != BDRV_BITMAP_MAX_NAME_SIZE);
 
 #if BME_MAX_TABLE_SIZE * 8ULL > INT_MAX
@@ -91,6 +94,7 @@ typedef struct Qcow2Bitmap {
     char *name;
 
     BdrvDirtyBitmap *dirty_bitmap;
+    bool store_in_place;    /* see store_bitmap_in_place() */
 
     QSIMPLEQ_ENTRY(Qcow2Bitmap) entry;
 } Qcow2Bitmap;
@@ -282,6 +286,19 @@ free_bitmap_clusters(BlockDriverState *bs, Qcow2BitmapTable *tb)
     return 0;
 }
 
+/*
+ * Track which clusters of bitmap data change in @bitmap from now on, so
+ * that only those need to be written when it is stored over its current
+ * version in the image.
+ */
+static void bitmap_track_changes(BlockDriverState *bs, BdrvDirtyBitmap *bitmap)
+{
+    BDRVQcow2State *s = bs->opaque;
+
+    bdrv_create_meta_dirty_bitmap(bitmap,
+        bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap));
+}
+
 /* load_bitmap_data
  * @bitmap_table entries must satisfy specification constraints.
  * @bitmap must be cleared */
@@ -294,7 +311,7 @@ load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
     uint64_t offset, limit;
     uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
     uint8_t *buf = NULL;
-    uint64_t i, tab_size =
+    uint64_t i, j, n, max_clusters, tab_size =
             size_to_clusters(s,
                 bdrv_dirty_bitmap_serialization_size(bitmap, 0, bm_size));
 
@@ -302,15 +319,17 @@ load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
         return -EINVAL;
     }
 
-    buf = g_malloc(s->cluster_size);
+    max_clusters = MAX(BME_MAX_READ_SIZE / s->cluster_size, 1);
+    buf = g_malloc(max_clusters * s->cluster_size);
     limit = bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
-    for (i = 0, offset = 0; i < tab_size; ++i, offset += limit) {
+    for (i = 0, offset = 0; i < tab_size; i += n, offset += n * limit) {
         uint64_t count = MIN(bm_size - offset, limit);
         uint64_t entry = bitmap_table[i];
         uint64_t data_offset = entry & BME_TABLE_ENTRY_OFFSET_MASK;
 
         assert(check_table_entry(entry, s->cluster_size) == 0);
 
+        n = 1;
         if (data_offset == 0) {
             if (entry & BME_TABLE_ENTRY_FLAG_ALL_ONES) {
                 bdrv_dirty_bitmap_deserialize_ones(bitmap, offset, count,
@@ -319,12 +338,26 @@ load_bitmap_data(BlockDriverState *bs, const uint64_t *bitmap_table,
                 /* No need to deserialize zeros because the dirty bitmap is
                  * already cleared */
             }
-        } else {
-            ret = bdrv_co_pread(bs->file, data_offset, s->cluster_size, buf, 0);
-            if (ret < 0) {
-                goto finish;
-            }
-            bdrv_dirty_bitmap_deserialize_part(bitmap, buf, offset, count,
+            continue;
+        }
+
+        while (i + n < tab_size && n < max_clusters &&
+               (bitmap_table[i + n] & BME_TABLE_ENTRY_OFFSET_MASK) ==
+               data_offset + n * s->cluster_size) {
+            n++;
+        }
+
+        ret = bdrv_co_pread(bs->file, data_offset, n * s->cluster_size, buf,
+                            0);
+        if (ret < 0) {
+            goto finish;
+        }
+        for (j = 0; j < n; j++) {
+            uint64_t part = offset + j * limit;
+
+            bdrv_dirty_bitmap_deserialize_part(bitmap,
+                                               buf + j * s->cluster_size,
+                                               part, MIN(bm_size - part, limit),
                                                false);
         }
     }
@@ -989,11 +1022,9 @@ qcow2_load_dirty_bitmaps(BlockDriverState *bs,
     }
 
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
-        BdrvDirtyBitmap *bitmap;
+        BdrvDirtyBitmap *bitmap = bdrv_find_dirty_bitmap(bs, bm->name);
 
-        if ((bm->flags & BME_FLAG_IN_USE) &&
-            bdrv_find_dirty_bitmap(bs, bm->name))
-        {
+        if ((bm->flags & BME_FLAG_IN_USE) && bitmap) {
             /*
              * We already have corresponding BdrvDirtyBitmap, and bitmap in the
              * image is marked IN_USE. Firstly, this state is valid, no reason
@@ -1004,7 +1035,11 @@ qcow2_load_dirty_bitmaps(BlockDriverState *bs,
              * of-course contain IN_USE outdated version of the bitmap, and we
              * should not load it on migration target, as we already have this
              * bitmap, being migrated.
+             *
+             * The version in the image may have been written by someone else
+             * in the meantime, so the bitmap must be stored in full.
              */
+            bdrv_release_meta_dirty_bitmap(bitmap);
             continue;
         }
 
@@ -1020,6 +1055,7 @@ qcow2_load_dirty_bitmaps(BlockDriverState *bs,
             /* NB: updated flags only get written if can_write(bs) is true. */
             bm->flags |= BME_FLAG_IN_USE;
             needs_update = true;
+            bitmap_track_changes(bs, bitmap);
         }
         if (!(bm->flags & BME_FLAG_AUTO)) {
             bdrv_disable_dirty_bitmap(bitmap);
@@ -1371,6 +1407,169 @@ fail:
     return NULL;
 }
 
+/*
+ * Whether @bitmap can be stored over the version of it that @bm describes,
+ * i.e. the one it was loaded from or last stored to, and whose changes
+ * since then are known.
+ */
+static bool GRAPH_RDLOCK
+bitmap_can_store_in_place(BlockDriverState *bs, Qcow2Bitmap *bm,
+                          BdrvDirtyBitmap *bitmap)
+{
+    BDRVQcow2State *s = bs->opaque;
+    uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
+
+    return bm->table.offset &&
+        bm->granularity_bits == ctz32(bdrv_dirty_bitmap_granularity(bitmap)) &&
+        bm->table.size ==
+            size_to_clusters(s, bdrv_dirty_bitmap_serialization_size(
+                                    bitmap, 0, bm_size)) &&
+        bdrv_dirty_bitmap_meta_granularity(bitmap) ==
+            bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
+}
+
+/* store_bitmap_in_place()
+ * Update the bitmap data clusters and the bitmap table of @bm for the
+ * parts of bm->dirty_bitmap that changed since it was loaded or last stored.
+ * The bitmap is marked IN_USE in the image until the bitmap directory is
+ * updated, so the data may be overwritten in place: if we fail in between,
+ * it is not trusted anyway.
+ */
+static int GRAPH_RDLOCK
+store_bitmap_in_place(BlockDriverState *bs, Qcow2Bitmap *bm, Error **errp)
+{
+    int ret;
+    BDRVQcow2State *s = bs->opaque;
+    BdrvDirtyBitmap *bitmap = bm->dirty_bitmap;
+    const char *bm_name = bdrv_dirty_bitmap_name(bitmap);
+    uint64_t bm_size = bdrv_dirty_bitmap_size(bitmap);
+    uint32_t tb_size = bm->table.size;
+    uint64_t *tb, *old_tb;
+    uint64_t limit, i;
+    uint8_t *buf;
+    int64_t offset;
+
+    ret = bitmap_table_load(bs, &bm->table, &tb);
+    if (ret < 0) {
+        error_setg_errno(errp, -ret,
+                         "Could not read bitmap_table table from image for "
+                         "bitmap '%s'", bm_name);
+        return ret;
+    }
+    old_tb = g_memdup2(tb, tb_size * sizeof(tb[0]));
+
+    buf = g_malloc(s->cluster_size);
+    limit = bdrv_dirty_bitmap_serialization_coverage(s->cluster_size, bitmap);
+
+    offset = 0;
+    while ((offset = bdrv_dirty_bitmap_next_meta_dirty(bitmap, offset,
+                                                       INT64_MAX)) >= 0)
+    {
+        uint64_t cluster = offset / limit;
+        uint64_t end, write_size, data_offset;
+
+        offset = QEMU_ALIGN_DOWN(offset, limit);
+        end = MIN(bm_size, offset + limit);
+        data_offset = tb[cluster] & BME_TABLE_ENTRY_OFFSET_MASK;
+
+        if (bdrv_dirty_bitmap_next_dirty(bitmap, offset, end - offset) < 0) {
+            /* Freed below, once the table no longer refers to it */
+            tb[cluster] = 0;
+            offset = end;
+            continue;
+        }
+
+        if (!data_offset) {
+            int64_t off = qcow2_alloc_clusters(bs, s->cluster_size);
+            if (off < 0) {
+                ret = off;
+                error_setg_errno(errp, -ret,
+                                 "Failed to allocate clusters for bitmap '%s'",
+                                 bm_name);
+                goto fail;
+            }
+            data_offset = off;
+        }
+        tb[cluster] = data_offset;
+
+        write_size = bdrv_dirty_bitmap_serialization_size(bitmap, offset,
+                                                          end - offset);
+        assert(write_size <= s->cluster_size);
+        bdrv_dirty_bitmap_serialize_part(bitmap, buf, offset, end - offset);
+        if (write_size < s->cluster_size) {
+            memset(buf + write_size, 0, s->cluster_size - write_size);
+        }
+
+        ret = qcow2_pre_write_overlap_check(bs, 0, data_offset,
+                                            s->cluster_size, false);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
+            goto fail;
+        }
+
+        ret = bdrv_pwrite(bs->file, data_offset, s->cluster_size, buf, 0);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to file",
+                             bm_name);
+            goto fail;
+        }
+
+        offset = end;
+    }
+
+    if (memcmp(tb, old_tb, tb_size * sizeof(tb[0]))) {
+        ret = qcow2_pre_write_overlap_check(bs, 0, bm->table.offset,
+                                            tb_size * sizeof(tb[0]), false);
+        if (ret < 0) {
+            error_setg_errno(errp, -ret, "Qcow2 overlap check failed");
+            goto fail;
+        }
+
+        bitmap_table_bswap_be(tb, tb_size);
+        ret = bdrv_pwrite(bs->file, bm->table.offset, tb_size * sizeof(tb[0]),
+                          tb, 0);
+        bitmap_table_bswap_be(tb, tb_size);
+        if (ret < 0) {
+            /*
+             * The table in the image may refer to the new clusters already,
+             * leak them rather than risk freeing clusters that are in use.
+             */
+            error_setg_errno(errp, -ret, "Failed to write bitmap '%s' to file",
+                             bm_name);
+            goto out;
+        }
+    }
+
+    for (i = 0; i < tb_size; i++) {
+        uint64_t addr = old_tb[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+
+        if (addr && !(tb[i] & BME_TABLE_ENTRY_OFFSET_MASK)) {
+            qcow2_free_clusters(bs, addr, s->cluster_size,
+                                QCOW2_DISCARD_ALWAYS);
+        }
+    }
+    ret = 0;
+    goto out;
+
+fail:
+    /* Drop the clusters that were allocated for the new data */
+    for (i = 0; i < tb_size; i++) {
+        uint64_t addr = tb[i] & BME_TABLE_ENTRY_OFFSET_MASK;
+
+        if (addr && !(old_tb[i] & BME_TABLE_ENTRY_OFFSET_MASK)) {
+            qcow2_free_clusters(bs, addr, s->cluster_size,
+                                QCOW2_DISCARD_ALWAYS);
+        }
+    }
+
+out:
+    g_free(buf);
+    g_free(old_tb);
+    g_free(tb);
+
+    return ret;
+}
+
 /* store_bitmap()
  * Store bm->dirty_bitmap to qcow2.
  * Set bm->table_offset and bm->table_size accordingly.
@@ -1387,6 +1586,10 @@ store_bitmap(BlockDriverState *bs, Qcow2Bitmap *bm, Error **errp)
 
     assert(bitmap != NULL);
 
+    if (bm->store_in_place) {
+        return store_bitmap_in_place(bs, bm, errp);
+    }
+
     bm_name = bdrv_dirty_bitmap_name(bitmap);
 
     tb = store_bitmap_data(bs, bitmap, &tb_size, errp);
@@ -1609,10 +1812,14 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
                            name);
                 goto fail;
             }
-            tb = g_memdup2(&bm->table, sizeof(bm->table));
-            bm->table.offset = 0;
-            bm->table.size = 0;
-            QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            if (bitmap_can_store_in_place(bs, bm, bitmap)) {
+                bm->store_in_place = true;
+            } else {
+                tb = g_memdup2(&bm->table, sizeof(bm->table));
+                bm->table.offset = 0;
+                bm->table.size = 0;
+                QSIMPLEQ_INSERT_TAIL(&drop_tables, tb, entry);
+            }
         }
         bm->flags = bdrv_dirty_bitmap_enabled(bitmap) ? BME_FLAG_AUTO : 0;
         bm->granularity_bits = ctz32(bdrv_dirty_bitmap_granularity(bitmap));
@@ -1655,6 +1862,17 @@ bool qcow2_store_persistent_dirty_bitmaps(BlockDriverState *bs,
         g_free(tb);
     }
 
+    if (!release_stored) {
+        /* The image now holds what the bitmaps contain */
+        QSIMPLEQ_FOREACH(bm, bm_list, entry) {
+            bitmap = bm->dirty_bitmap;
+
+            if (bitmap && !bdrv_dirty_bitmap_readonly(bitmap)) {
+                bitmap_track_changes(bs, bitmap);
+            }
+        }
+    }
+
 success:
     if (release_stored) {
         QSIMPLEQ_FOREACH(bm, bm_list, entry) {
@@ -1672,6 +1890,7 @@ success:
 fail:
     QSIMPLEQ_FOREACH(bm, bm_list, entry) {
         if (bm->dirty_bitmap == NULL || bm->table.offset == 0 ||
+            bm->store_in_place ||
             bdrv_dirty_bitmap_readonly(bm->dirty_bitmap))
         {
             continue;
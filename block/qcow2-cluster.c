@@ -70,6 +70,7 @@ int coroutine_fn qcow2_shrink_l1_table(BlockDriverState *bs,
                             s->cluster_size, QCOW2_DISCARD_ALWAYS);
         s->l1_table[i] = 0;
     }
+    qcow2_map_cache_invalidate(s);
     return 0;
 
 fail:
@@ -80,6 +81,7 @@ fail:
      */
     memset(s->l1_table + new_l1_size, 0,
            (s->l1_size - new_l1_size) * L1E_SIZE);
+    qcow2_map_cache_invalidate(s);
     return ret;
 }
 
@@ -563,6 +565,93 @@ do_perform_cow_write(BlockDriverState *bs, uint64_t cluster_offset,
 }
 
 
+/*
+ * Look up the host offset of @offset in the map cache, without s->lock.
+ * Succeeds only if [@offset, @offset + @bytes) lies in a single, fully
+ * allocated data cluster whose mapping is cached for the current
+ * generation.
+ */
+bool qcow2_map_cache_lookup(BDRVQcow2State *s, uint64_t offset,
+                            unsigned int bytes, uint64_t *host_offset)
+{
+#ifdef CONFIG_ATOMIC64
+    Qcow2MapCacheEntry *map_cache = qatomic_load_acquire(&s->map_cache);
+    uint64_t offset_in_cluster = offset_into_cluster(s, offset);
+    uint64_t key = (offset >> s->cluster_bits) + 1;
+    uint64_t generation, cluster_offset;
+    Qcow2MapCacheEntry *e;
+
+    if (!map_cache || offset_in_cluster + bytes > s->cluster_size) {
+        return false;
+    }
+
+    /* Pairs with the smp_wmb() calls in qcow2_map_cache_insert() */
+    e = &map_cache[key % QCOW2_MAP_CACHE_SIZE];
+    if (qatomic_load_acquire(&e->key) != key) {
+        return false;
+    }
+    generation = qatomic_load_acquire(&e->generation);
+    cluster_offset = qatomic_load_acquire(&e->host_offset);
+    smp_rmb();
+    if (qatomic_read(&e->key) != key ||
+        generation != stat64_get(&s->map_generation)) {
+        return false;
+    }
+
+    *host_offset = cluster_offset + offset_in_cluster;
+    return true;
+#else
+    return false;
+#endif
+}
+
+/*
+ * Remember that @offset is stored at @host_offset, in a fully allocated
+ * data cluster.  Called with s->lock held, right after the L2 lookup.
+ */
+void qcow2_map_cache_insert(BDRVQcow2State *s, uint64_t offset,
+                            uint64_t host_offset)
+{
+#ifdef CONFIG_ATOMIC64
+    uint64_t key = (offset >> s->cluster_bits) + 1;
+    Qcow2MapCacheEntry *e;
+
+    /* The type of a subcluster says nothing about its neighbours */
+    if (has_subclusters(s)) {
+        return;
+    }
+    if (!s->map_cache) {
+        qatomic_store_release(&s->map_cache,
+                              g_new0(Qcow2MapCacheEntry,
+                                     QCOW2_MAP_CACHE_SIZE));
+    }
+
+    e = &s->map_cache[key % QCOW2_MAP_CACHE_SIZE];
+    qatomic_set(&e->key, 0);
+    smp_wmb();
+    qatomic_set(&e->host_offset, start_of_cluster(s, host_offset));
+    smp_wmb();
+    qatomic_set(&e->generation, stat64_get(&s->map_generation));
+    smp_wmb();
+    qatomic_set(&e->key, key);
+#endif
+}
+
+/*
+ * Stale all entries of the map cache.  L2 table changes do this through
+ * the L2 table cache; changes to the L1 table must call it directly.
+ */
+void qcow2_map_cache_invalidate(BDRVQcow2State *s)
+{
+    stat64_add(&s->map_generation, 1);
+}
+
+void qcow2_map_cache_free(BDRVQcow2State *s)
+{
+    g_free(s->map_cache);
+    s->map_cache = NULL;
+}
+
 /*
  * get_host_offset
  *
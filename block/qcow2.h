@@ -28,6 +28,7 @@
 #include "crypto/block.h"
 #include "qemu/coroutine.h"
 #include "qemu/units.h"
+#include "qemu/stats64.h"
 #include "block/block_int.h"
 
 //#define DEBUG_ALLOC
@@ -324,6 +325,20 @@ typedef struct Qcow2BitmapHeaderExt {
 
 #define QCOW2_MAX_THREADS 4
 
+/*
+ * Host offsets of fully allocated data clusters, for reads that can then
+ * skip s->lock.  Entries are filled under s->lock and belong to the
+ * generation of the L2 tables they were read from; any change to an L2
+ * or L1 table starts a new generation, which stales every entry at once.
+ */
+#define QCOW2_MAP_CACHE_SIZE 4096
+
+typedef struct Qcow2MapCacheEntry {
+    uint64_t key;               /* guest cluster index + 1, 0 if unused */
+    uint64_t generation;        /* s->map_generation when filled */
+    uint64_t host_offset;       /* host offset of the cluster */
+} Qcow2MapCacheEntry;
+
 typedef struct BDRVQcow2State {
     int cluster_bits;
     int cluster_size;
@@ -345,6 +360,8 @@ typedef struct BDRVQcow2State {
 
     Qcow2Cache *l2_table_cache;
     Qcow2Cache *refcount_block_cache;
+    Qcow2MapCacheEntry *map_cache;
+    Stat64 map_generation;
     QEMUTimer *cache_clean_timer;
     unsigned cache_clean_interval;
 
@@ -932,6 +949,13 @@ qcow2_get_host_offset(BlockDriverState *bs, uint64_t offset,
                       unsigned int *bytes, uint64_t *host_offset,
                       QCow2SubclusterType *subcluster_type);
 
+bool qcow2_map_cache_lookup(BDRVQcow2State *s, uint64_t offset,
+                            unsigned int bytes, uint64_t *host_offset);
+void qcow2_map_cache_insert(BDRVQcow2State *s, uint64_t offset,
+                            uint64_t host_offset);
+void qcow2_map_cache_invalidate(BDRVQcow2State *s);
+void qcow2_map_cache_free(BDRVQcow2State *s);
+
 int coroutine_fn GRAPH_RDLOCK
 qcow2_alloc_host_offset(BlockDriverState *bs, uint64_t offset,
                         unsigned int *bytes, uint64_t *host_offset,
@@ -1021,6 +1045,7 @@ qcow2_cache_get_empty(BlockDriverState *bs, Qcow2Cache *c, uint64_t offset,
 void qcow2_cache_put(Qcow2Cache *c, void **table);
 void *qcow2_cache_is_table_offset(Qcow2Cache *c, uint64_t offset);
 void qcow2_cache_discard(Qcow2Cache *c, void *table);
+void qcow2_cache_set_generation(Qcow2Cache *c, Stat64 *generation);
 
 /* qcow2-bitmap.c functions */
 int coroutine_fn GRAPH_RDLOCK
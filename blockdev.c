@@ -2658,6 +2658,9 @@ static BlockJob *do_backup_common(BackupCommon *backup,
         if (backup->x_perf->has_min_cluster_size) {
             perf.min_cluster_size = backup->x_perf->min_cluster_size;
         }
+        if (backup->x_perf->has_max_latency) {
+            perf.max_latency = backup->x_perf->max_latency;
+        }
     }
 
     if ((backup->sync == MIRROR_SYNC_MODE_BITMAP) ||
@@ -2786,6 +2789,7 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                                    bool has_speed, int64_t speed,
                                    bool has_granularity, uint32_t granularity,
                                    bool has_buf_size, int64_t buf_size,
+                                   bool has_max_latency, uint64_t max_latency,
                                    bool has_on_source_error,
                                    BlockdevOnError on_source_error,
                                    bool has_on_target_error,
@@ -2818,6 +2822,9 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
     if (!has_buf_size) {
         buf_size = 0;
     }
+    if (!has_max_latency) {
+        max_latency = 0;
+    }
     if (!has_unmap) {
         unmap = true;
     }
@@ -2841,6 +2848,11 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
                    "a power of 2");
         return;
     }
+    if (max_latency > INT64_MAX / SCALE_US) {
+        error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "max-latency",
+                   "a smaller value");
+        return;
+    }
 
     if (bdrv_op_is_blocked(bs, BLOCK_OP_TYPE_MIRROR_SOURCE, errp)) {
         return;
@@ -2895,7 +2907,8 @@ static void blockdev_mirror_common(const char *job_id, BlockDriverState *bs,
      */
     mirror_start(job_id, bs, target,
                  replaces, job_flags,
-                 speed, granularity, buf_size, sync, backing_mode, zero_target,
+                 speed, granularity, buf_size, max_latency * SCALE_US,
+                 sync, backing_mode, zero_target,
                  on_source_error, on_target_error, unmap, filter_node_name,
                  copy_mode, errp);
 }
@@ -3043,6 +3056,7 @@ void qmp_drive_mirror(DriveMirror *arg, Error **errp)
                            arg->has_speed, arg->speed,
                            arg->has_granularity, arg->granularity,
                            arg->has_buf_size, arg->buf_size,
+                           arg->has_max_latency, arg->max_latency,
                            arg->has_on_source_error, arg->on_source_error,
                            arg->has_on_target_error, arg->on_target_error,
                            arg->has_unmap, arg->unmap,
@@ -3061,6 +3075,7 @@ void qmp_blockdev_mirror(const char *job_id,
                          bool has_speed, int64_t speed,
                          bool has_granularity, uint32_t granularity,
                          bool has_buf_size, int64_t buf_size,
+                         bool has_max_latency, uint64_t max_latency,
                          bool has_on_source_error,
                          BlockdevOnError on_source_error,
                          bool has_on_target_error,
@@ -3102,6 +3117,7 @@ void qmp_blockdev_mirror(const char *job_id,
                            zero_target, has_speed, speed,
                            has_granularity, granularity,
                            has_buf_size, buf_size,
+                           has_max_latency, max_latency,
                            has_on_source_error, on_source_error,
                            has_on_target_error, on_target_error,
                            true, true, filter_node_name,
@@ -23,6 +23,7 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
+#include "qemu/iov.h"
 #include "qapi/error.h"
 #include "sysemu/replay.h"
 
@@ -52,6 +53,151 @@ int qemu_chr_fe_write_all(CharBackend *be, const uint8_t *buf, int len)
     return qemu_chr_write(s, buf, len, true);
 }
 
+int qemu_chr_fe_writev_all(CharBackend *be, const struct iovec *iov,
+                           int iovcnt)
+{
+    Chardev *s = be->chr;
+
+    if (!s) {
+        return 0;
+    }
+
+    return qemu_chr_writev(s, iov, iovcnt, true);
+}
+
+typedef struct CharBackendWrite {
+    uint8_t *data;
+    size_t len;
+    size_t offset;
+    FEWriteDoneFunc *cb;
+    void *opaque;
+} CharBackendWrite;
+
+static void qemu_chr_fe_write_complete(CharBackend *be, int ret)
+{
+    CharBackendWrite *w = g_queue_pop_head(&be->write_queue);
+
+    be->write_queued -= w->len - w->offset;
+    if (w->cb) {
+        w->cb(w->opaque, ret);
+    }
+    g_free(w->data);
+    g_free(w);
+}
+
+static void qemu_chr_fe_write_cancel(CharBackend *be, int ret)
+{
+    if (be->write_watch) {
+        g_source_remove(be->write_watch);
+        be->write_watch = 0;
+    }
+    while (!g_queue_is_empty(&be->write_queue)) {
+        qemu_chr_fe_write_complete(be, ret);
+    }
+}
+
+static gboolean qemu_chr_fe_write_ready(void *do_not_use, GIOCondition cond,
+                                        void *opaque);
+
+static void qemu_chr_fe_write_flush(CharBackend *be)
+{
+    CharBackendWrite *w;
+
+    while ((w = g_queue_peek_head(&be->write_queue))) {
+        int ret = qemu_chr_fe_write(be, w->data + w->offset,
+                                    w->len - w->offset);
+
+        if (ret < 0 && errno != EAGAIN) {
+            qemu_chr_fe_write_cancel(be, -EIO);
+            return;
+        }
+        if (ret <= 0) {
+            break;
+        }
+        w->offset += ret;
+        be->write_queued -= ret;
+        if (w->offset == w->len) {
+            qemu_chr_fe_write_complete(be, 0);
+        }
+    }
+
+    if (g_queue_is_empty(&be->write_queue) || be->write_watch) {
+        return;
+    }
+    be->write_watch = qemu_chr_fe_add_watch(be, G_IO_OUT | G_IO_HUP,
+                                            qemu_chr_fe_write_ready, be);
+    if (!be->write_watch) {
+        /* Without watches, the remainder can only be written blocking. */
+        while ((w = g_queue_peek_head(&be->write_queue))) {
+            int ret = qemu_chr_fe_write_all(be, w->data + w->offset,
+                                            w->len - w->offset);
+
+            qemu_chr_fe_write_complete(be, ret < 0 ? -EIO : 0);
+        }
+    }
+}
+
+static gboolean qemu_chr_fe_write_ready(void *do_not_use, GIOCondition cond,
+                                        void *opaque)
+{
+    CharBackend *be = opaque;
+
+    be->write_watch = 0;
+    qemu_chr_fe_write_flush(be);
+    return G_SOURCE_REMOVE;
+}
+
+int qemu_chr_fe_write_async(CharBackend *be, const struct iovec *iov,
+                            int iovcnt, FEWriteDoneFunc *cb, void *opaque)
+{
+    const size_t len = iov_size(iov, iovcnt);
+    const size_t limit = be->write_limit ?: CHR_FE_WRITE_QUEUE_LIMIT;
+    CharBackendWrite *w;
+    int ret = 0;
+
+    if (!be->chr) {
+        return 1;
+    }
+
+    if (g_queue_is_empty(&be->write_queue)) {
+        ret = qemu_chr_writev(be->chr, iov, iovcnt, false);
+        if (ret < 0 && errno != EAGAIN) {
+            return -EIO;
+        }
+        ret = MAX(ret, 0);
+        if (ret == len) {
+            return 1;
+        }
+    } else if (be->write_queued + len > limit) {
+        return -EAGAIN;
+    }
+
+    w = g_new(CharBackendWrite, 1);
+    w->len = len - ret;
+    w->data = g_malloc(w->len);
+    iov_to_buf(iov, iovcnt, ret, w->data, w->len);
+    w->offset = 0;
+    w->cb = cb;
+    w->opaque = opaque;
+    g_queue_push_tail(&be->write_queue, w);
+    be->write_queued += w->len;
+
+    if (!be->write_watch) {
+        qemu_chr_fe_write_flush(be);
+    }
+    return 0;
+}
+
+void qemu_chr_fe_set_write_limit(CharBackend *be, size_t limit)
+{
+    be->write_limit = limit;
+}
+
+size_t qemu_chr_fe_write_pending(CharBackend *be)
+{
+    return be->write_queued;
+}
+
 int qemu_chr_fe_read_all(CharBackend *be, uint8_t *buf, int len)
 {
     Chardev *s = be->chr;
@@ -219,6 +365,7 @@ void qemu_chr_fe_deinit(CharBackend *b, bool del)
     assert(b);
 
     if (b->chr) {
+        qemu_chr_fe_write_cancel(b, -ECANCELED);
         qemu_chr_fe_set_handlers(b, NULL, NULL, NULL, NULL, NULL, NULL, true);
         if (b->chr->be == b) {
             b->chr->be = NULL;
@@ -265,6 +412,7 @@ void qemu_chr_fe_set_handlers_full(CharBackend *b,
     }
     b->chr_can_read = fd_can_read;
     b->chr_read = fd_read;
+    b->chr_read_msg = NULL;
     b->chr_event = fd_event;
     b->chr_be_change = be_change;
     b->opaque = opaque;
@@ -346,6 +494,16 @@ void qemu_chr_fe_set_open(CharBackend *be, bool is_open)
     }
 }
 
+IOThread *qemu_chr_fe_get_iothread(CharBackend *be)
+{
+    return be->chr ? be->chr->iothread : NULL;
+}
+
+void qemu_chr_fe_set_msg_handler(CharBackend *b, IOReadHandler *fd_read_msg)
+{
+    b->chr_read_msg = fd_read_msg;
+}
+
 guint qemu_chr_fe_add_watch(CharBackend *be, GIOCondition cond,
                             FEWatchFunc func, void *user_data)
 {
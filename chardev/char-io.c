@@ -182,3 +182,28 @@ int io_channel_send(QIOChannel *ioc, const void *buf, size_t len)
 {
     return io_channel_send_full(ioc, buf, len, NULL, 0);
 }
+
+/*
+ * Unlike io_channel_send_full, this makes a single attempt and may
+ * return a short count; the caller resumes from there.
+ */
+int io_channel_sendv_full(QIOChannel *ioc, const struct iovec *iov,
+                          size_t niov, int *fds, size_t nfds)
+{
+    ssize_t ret = qio_channel_writev_full(ioc, iov, niov, fds, nfds, 0, NULL);
+
+    if (ret == QIO_CHANNEL_ERR_BLOCK) {
+        errno = EAGAIN;
+        return -1;
+    } else if (ret < 0) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    return ret;
+}
+
+int io_channel_sendv(QIOChannel *ioc, const struct iovec *iov, size_t niov)
+{
+    return io_channel_sendv_full(ioc, iov, niov, NULL, 0);
+}
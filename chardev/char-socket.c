@@ -29,6 +29,7 @@
 #include "qemu/error-report.h"
 #include "qemu/module.h"
 #include "qemu/option.h"
+#include "qemu/units.h"
 #include "qapi/error.h"
 #include "qapi/clone-visitor.h"
 #include "qapi/qapi-visit-sockets.h"
@@ -38,6 +39,11 @@
 #include "chardev/char-io.h"
 #include "chardev/char-socket.h"
 
+/* Bound of the recv-buffer option */
+#define CHR_SOCKET_RECV_BUF_MAX (64 * MiB)
+/* Default largest message on SOCK_SEQPACKET sockets */
+#define CHR_SOCKET_MSG_BUF_LEN (64 * KiB)
+
 static gboolean socket_reconnect_timeout(gpointer opaque);
 static void tcp_chr_telnet_init(Chardev *chr);
 
@@ -104,6 +110,35 @@ static void tcp_chr_accept(QIONetListener *listener,
 static int tcp_chr_read_poll(void *opaque);
 static void tcp_chr_disconnect_locked(Chardev *chr);
 
+/*
+ * Called with chr_write_lock held after sending on a connected socket.
+ * Returns @ret.
+ */
+static int tcp_chr_write_done(Chardev *chr, int ret)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
+
+    /* free the written msgfds in any cases
+     * other than ret < 0 && errno == EAGAIN
+     */
+    if (!(ret < 0 && EAGAIN == errno)
+        && s->write_msgfds_num) {
+        g_free(s->write_msgfds);
+        s->write_msgfds = 0;
+        s->write_msgfds_num = 0;
+    }
+
+    if (ret < 0 && errno != EAGAIN) {
+        if (tcp_chr_read_poll(chr) <= 0) {
+            /* Perform disconnect and return error. */
+            trace_chr_socket_poll_err(chr, chr->label);
+            tcp_chr_disconnect_locked(chr);
+        } /* else let the read handler finish it properly */
+    }
+
+    return ret;
+}
+
 /* Called with chr_write_lock held.  */
 static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
 {
@@ -114,25 +149,25 @@ static int tcp_chr_write(Chardev *chr, const uint8_t *buf, int len)
                                         s->write_msgfds,
                                         s->write_msgfds_num);
 
-        /* free the written msgfds in any cases
-         * other than ret < 0 && errno == EAGAIN
-         */
-        if (!(ret < 0 && EAGAIN == errno)
-            && s->write_msgfds_num) {
-            g_free(s->write_msgfds);
-            s->write_msgfds = 0;
-            s->write_msgfds_num = 0;
-        }
+        return tcp_chr_write_done(chr, ret);
+    } else {
+        /* Indicate an error. */
+        errno = EIO;
+        return -1;
+    }
+}
 
-        if (ret < 0 && errno != EAGAIN) {
-            if (tcp_chr_read_poll(chr) <= 0) {
-                /* Perform disconnect and return error. */
-                trace_chr_socket_poll_err(chr, chr->label);
-                tcp_chr_disconnect_locked(chr);
-            } /* else let the read handler finish it properly */
-        }
+/* Called with chr_write_lock held.  */
+static int tcp_chr_writev(Chardev *chr, const struct iovec *iov, int iovcnt)
+{
+    SocketChardev *s = SOCKET_CHARDEV(chr);
 
-        return ret;
+    if (s->state == TCP_CHARDEV_STATE_CONNECTED) {
+        int ret = io_channel_sendv_full(s->ioc, iov, iovcnt,
+                                        s->write_msgfds,
+                                        s->write_msgfds_num);
+
+        return tcp_chr_write_done(chr, ret);
     } else {
         /* Indicate an error. */
         errno = EIO;
@@ -497,28 +532,44 @@ static gboolean tcp_chr_read(QIOChannel *chan, GIOCondition cond, void *opaque)
 {
     Chardev *chr = CHARDEV(opaque);
     SocketChardev *s = SOCKET_CHARDEV(opaque);
-    uint8_t buf[CHR_READ_BUF_LEN];
+    uint8_t *buf = s->read_buf;
     int len, size;
 
     if ((s->state != TCP_CHARDEV_STATE_CONNECTED) ||
         s->max_size <= 0) {
         return TRUE;
     }
-    len = sizeof(buf);
-    if (len > s->max_size) {
-        len = s->max_size;
+    if (s->is_seqpacket) {
+        /* A short read would truncate the message; read it whole. */
+        size = tcp_chr_recv(chr, (void *)buf, s->read_buf_len);
+        if (size == 0 || (size == -1 && errno != EAGAIN)) {
+            tcp_chr_disconnect(chr);
+        } else if (size > 0) {
+            qemu_chr_be_write_msg(chr, buf, size);
+        }
+        return TRUE;
     }
+    len = MIN(s->read_buf_len, s->max_size);
     size = tcp_chr_recv(chr, (void *)buf, len);
     if (size == 0 || (size == -1 && errno != EAGAIN)) {
         /* connection closed */
         tcp_chr_disconnect(chr);
     } else if (size > 0) {
+        /* A full buffer suggests more is waiting; take it in larger reads. */
+        bool grow = size == s->read_buf_len &&
+                    s->read_buf_len < s->read_buf_max;
+
         if (s->do_telnetopt) {
             tcp_chr_process_IAC_bytes(chr, s, buf, &size);
         }
         if (size > 0) {
             qemu_chr_be_write(chr, buf, size);
         }
+        if (grow) {
+            s->read_buf_len = MIN(s->read_buf_len * 2, s->read_buf_max);
+            g_free(s->read_buf);
+            s->read_buf = g_malloc(s->read_buf_len);
+        }
     }
 
     return TRUE;
@@ -1114,6 +1165,7 @@ static void char_socket_finalize(Object *obj)
         object_unref(OBJECT(s->tls_creds));
     }
     g_free(s->tls_authz);
+    g_free(s->read_buf);
     if (s->registered_yank) {
         /*
          * In the chardev-change special-case, we shouldn't unregister the yank
@@ -1282,6 +1334,18 @@ static int qmp_chardev_open_socket_client(Chardev *chr,
 }
 
 
+static bool socket_address_is_seqpacket(SocketAddress *addr)
+{
+    switch (addr->type) {
+    case SOCKET_ADDRESS_TYPE_UNIX:
+        return addr->u.q_unix.has_seqpacket && addr->u.q_unix.seqpacket;
+    case SOCKET_ADDRESS_TYPE_VSOCK:
+        return addr->u.vsock.has_seqpacket && addr->u.vsock.seqpacket;
+    default:
+        return false;
+    }
+}
+
 static bool qmp_chardev_validate_socket(ChardevSocket *sock,
                                         SocketAddress *addr,
                                         Error **errp)
@@ -1360,6 +1424,22 @@ static bool qmp_chardev_validate_socket(ChardevSocket *sock,
         return false;
     }
 
+    if (socket_address_is_seqpacket(addr) &&
+        ((sock->has_telnet && sock->telnet) ||
+         (sock->has_tn3270 && sock->tn3270) ||
+         (sock->has_websocket && sock->websocket))) {
+        error_setg(errp, "'seqpacket' is incompatible with telnet, tn3270 "
+                   "and websocket");
+        return false;
+    }
+
+    if (sock->has_recv_buffer &&
+        (!sock->recv_buffer || sock->recv_buffer > CHR_SOCKET_RECV_BUF_MAX)) {
+        error_setg(errp, "'recv-buffer' must be between 1 and %" PRId64
+                   " bytes", CHR_SOCKET_RECV_BUF_MAX);
+        return false;
+    }
+
     return true;
 }
 
@@ -1419,6 +1499,26 @@ static void qmp_chardev_open_socket(Chardev *chr,
         return;
     }
 
+    /* The websocket handshake and flushes run in the default context. */
+    if (chr->iothread && is_websock) {
+        error_setg(errp, "'iothread' is incompatible with websocket");
+        return;
+    }
+
+    s->is_seqpacket = socket_address_is_seqpacket(addr);
+    if (s->is_seqpacket) {
+        /* Messages are read whole, so the buffer is never grown. */
+        s->read_buf_max = sock->has_recv_buffer ? sock->recv_buffer
+                                                : CHR_SOCKET_MSG_BUF_LEN;
+        s->read_buf_len = s->read_buf_max;
+        qemu_chr_set_feature(chr, QEMU_CHAR_FEATURE_SEQPACKET);
+    } else {
+        s->read_buf_max = sock->has_recv_buffer ? sock->recv_buffer
+                                                : CHR_READ_BUF_LEN;
+        s->read_buf_len = MIN(CHR_READ_BUF_LEN, s->read_buf_max);
+    }
+    s->read_buf = g_malloc(s->read_buf_len);
+
     qemu_chr_set_feature(chr, QEMU_CHAR_FEATURE_RECONNECTABLE);
 #ifndef _WIN32
     /* TODO SOCKET_ADDRESS_FD where fd has AF_UNIX */
@@ -1468,6 +1568,8 @@ static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
     const char *host = qemu_opt_get(opts, "host");
     const char *port = qemu_opt_get(opts, "port");
     const char *fd = qemu_opt_get(opts, "fd");
+    const char *cid = qemu_opt_get(opts, "cid");
+    bool seqpacket = qemu_opt_get_bool(opts, "seqpacket", false);
 #ifdef CONFIG_LINUX
     bool tight = qemu_opt_get_bool(opts, "tight", true);
     bool abstract = qemu_opt_get_bool(opts, "abstract", false);
@@ -1475,17 +1577,23 @@ static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
     SocketAddressLegacy *addr;
     ChardevSocket *sock;
 
-    if ((!!path + !!fd + !!host) > 1) {
+    if ((!!path + !!fd + !!host + !!cid) > 1) {
         error_setg(errp,
-                   "None or one of 'path', 'fd' or 'host' option required.");
+                   "None or one of 'path', 'fd', 'host' or 'cid' option "
+                   "required.");
         return;
     }
 
-    if (host && !port) {
+    if ((host || cid) && !port) {
         error_setg(errp, "chardev: socket: no port given");
         return;
     }
 
+    if (seqpacket && !path && !cid) {
+        error_setg(errp, "'seqpacket' requires 'path' or 'cid'");
+        return;
+    }
+
     backend->type = CHARDEV_BACKEND_KIND_SOCKET;
     sock = backend->u.socket.data = g_new0(ChardevSocket, 1);
     qemu_chr_parse_common(opts, qapi_ChardevSocket_base(sock));
@@ -1523,6 +1631,8 @@ static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
     sock->reconnect = qemu_opt_get_number(opts, "reconnect", 0);
     sock->has_reconnect_ms = qemu_opt_find(opts, "reconnect-ms");
     sock->reconnect_ms = qemu_opt_get_number(opts, "reconnect-ms", 0);
+    sock->has_recv_buffer = qemu_opt_find(opts, "recv-buffer");
+    sock->recv_buffer = qemu_opt_get_size(opts, "recv-buffer", 0);
 
     sock->tls_creds = g_strdup(qemu_opt_get(opts, "tls-creds"));
     sock->tls_authz = g_strdup(qemu_opt_get(opts, "tls-authz"));
@@ -1533,6 +1643,8 @@ static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
         addr->type = SOCKET_ADDRESS_TYPE_UNIX;
         q_unix = addr->u.q_unix.data = g_new0(UnixSocketAddress, 1);
         q_unix->path = g_strdup(path);
+        q_unix->has_seqpacket = seqpacket;
+        q_unix->seqpacket = seqpacket;
 #ifdef CONFIG_LINUX
         q_unix->has_tight = true;
         q_unix->tight = tight;
@@ -1552,6 +1664,15 @@ static void qemu_chr_parse_socket(QemuOpts *opts, ChardevBackend *backend,
             .has_ipv6 = qemu_opt_get(opts, "ipv6"),
             .ipv6 = qemu_opt_get_bool(opts, "ipv6", 0),
         };
+    } else if (cid) {
+        addr->type = SOCKET_ADDRESS_TYPE_VSOCK;
+        addr->u.vsock.data = g_new(VsockSocketAddress, 1);
+        *addr->u.vsock.data = (VsockSocketAddress) {
+            .cid = g_strdup(cid),
+            .port = g_strdup(port),
+            .has_seqpacket = seqpacket,
+            .seqpacket = seqpacket,
+        };
     } else {
         addr->type = SOCKET_ADDRESS_TYPE_FD;
         addr->u.fd.data = g_new(FdSocketAddress, 1);
@@ -1587,6 +1708,7 @@ static void char_socket_class_init(ObjectClass *oc, void *data)
     cc->open = qmp_chardev_open_socket;
     cc->chr_wait_connected = tcp_chr_wait_connected;
     cc->chr_write = tcp_chr_write;
+    cc->chr_writev = tcp_chr_writev;
     cc->chr_sync_read = tcp_chr_sync_read;
     cc->chr_disconnect = tcp_chr_disconnect;
     cc->get_msgfds = tcp_get_msgfds;
@@ -39,7 +39,9 @@
 #include "qemu/option.h"
 #include "qemu/id.h"
 #include "qemu/coroutine.h"
+#include "qemu/iov.h"
 #include "qemu/yank.h"
+#include "sysemu/iothread.h"
 
 #include "chardev-internal.h"
 
@@ -108,18 +110,48 @@ static void qemu_chr_write_log(Chardev *s, const uint8_t *buf, size_t len)
     }
 }
 
-static int qemu_chr_write_buffer(Chardev *s,
-                                 const uint8_t *buf, int len,
-                                 int *offset, bool write_all)
+static void qemu_chr_writev_log(Chardev *s, const struct iovec *iov,
+                                int iovcnt, size_t len)
+{
+    for (int i = 0; i < iovcnt && len; i++) {
+        size_t seg = MIN(iov[i].iov_len, len);
+
+        qemu_chr_write_log(s, iov[i].iov_base, seg);
+        len -= seg;
+    }
+}
+
+static int qemu_chr_writev_buffer(Chardev *s,
+                                  const struct iovec *iov, int iovcnt,
+                                  int *offset, bool write_all)
 {
     ChardevClass *cc = CHARDEV_GET_CLASS(s);
+    const size_t len = iov_size(iov, iovcnt);
+    struct iovec stack[4];
+    g_autofree struct iovec *heap = NULL;
+    struct iovec *cur = stack;
+    unsigned int cnt = iovcnt;
     int res = 0;
     *offset = 0;
 
+    if (iovcnt > ARRAY_SIZE(stack)) {
+        cur = heap = g_new(struct iovec, iovcnt);
+    }
+    memcpy(cur, iov, iovcnt * sizeof(*iov));
+
     qemu_mutex_lock(&s->chr_write_lock);
     while (*offset < len) {
+        while (!cur->iov_len) {
+            cur++;
+            cnt--;
+        }
     retry:
-        res = cc->chr_write(s, buf + *offset, len - *offset);
+        /* Backends without chr_writev take one segment at a time. */
+        if (cc->chr_writev) {
+            res = cc->chr_writev(s, cur, cnt);
+        } else {
+            res = cc->chr_write(s, cur->iov_base, cur->iov_len);
+        }
         if (res < 0 && errno == EAGAIN && write_all) {
             if (qemu_in_coroutine()) {
                 qemu_co_sleep_ns(QEMU_CLOCK_REALTIME, 100000);
@@ -134,6 +166,7 @@ static int qemu_chr_write_buffer(Chardev *s,
         }
 
         *offset += res;
+        iov_discard_front(&cur, &cnt, res);
         if (!write_all) {
             break;
         }
@@ -145,29 +178,34 @@ static int qemu_chr_write_buffer(Chardev *s,
          * may be invoked again to write the remaining
          * method, thus we'll log the remainder at that time.
          */
-        qemu_chr_write_log(s, buf, *offset);
+        qemu_chr_writev_log(s, iov, iovcnt, *offset);
     } else if (res < 0) {
         /*
          * If a fatal error was reported by the backend,
          * assume this method won't be invoked again with
          * this buffer, so log it all right away.
          */
-        qemu_chr_write_log(s, buf, len);
+        qemu_chr_writev_log(s, iov, iovcnt, len);
     }
     qemu_mutex_unlock(&s->chr_write_lock);
 
     return res;
 }
 
-int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt,
+                    bool write_all)
 {
     int offset = 0;
     int res;
 
     if (qemu_chr_replay(s) && replay_mode == REPLAY_MODE_PLAY) {
+        g_autofree struct iovec *head = g_new(struct iovec, iovcnt);
+        unsigned int n;
+
         replay_char_write_event_load(&res, &offset);
-        assert(offset <= len);
-        qemu_chr_write_buffer(s, buf, offset, &offset, true);
+        assert(offset <= iov_size(iov, iovcnt));
+        n = iov_copy(head, iovcnt, iov, iovcnt, 0, offset);
+        qemu_chr_writev_buffer(s, head, n, &offset, true);
         return res;
     }
 
@@ -183,7 +221,7 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
         write_all = true;
     }
 
-    res = qemu_chr_write_buffer(s, buf, len, &offset, write_all);
+    res = qemu_chr_writev_buffer(s, iov, iovcnt, &offset, write_all);
 
     if (qemu_chr_replay(s) && replay_mode == REPLAY_MODE_RECORD) {
         replay_char_write_event_save(res, offset);
@@ -195,6 +233,13 @@ int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
     return offset;
 }
 
+int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all)
+{
+    const struct iovec iov = { .iov_base = (void *)buf, .iov_len = len };
+
+    return qemu_chr_writev(s, &iov, 1, write_all);
+}
+
 int qemu_chr_be_can_write(Chardev *s)
 {
     CharBackend *be = s->be;
@@ -227,6 +272,17 @@ void qemu_chr_be_write(Chardev *s, const uint8_t *buf, int len)
     }
 }
 
+void qemu_chr_be_write_msg(Chardev *s, const uint8_t *buf, int len)
+{
+    CharBackend *be = s->be;
+
+    if (!qemu_chr_replay(s) && be && be->chr_read_msg) {
+        be->chr_read_msg(be->opaque, buf, len);
+        return;
+    }
+    qemu_chr_be_write(s, buf, len);
+}
+
 void qemu_chr_be_update_read_handlers(Chardev *s,
                                       GMainContext *context)
 {
@@ -253,6 +309,22 @@ static void qemu_char_open(Chardev *chr, ChardevBackend *backend,
     /* Any ChardevCommon member would work */
     ChardevCommon *common = backend ? backend->u.null.data : NULL;
 
+    if (common && common->iothread) {
+        Object *obj = object_resolve_path_type(common->iothread,
+                                               TYPE_IOTHREAD, NULL);
+
+        if (!obj) {
+            error_setg(errp, "iothread '%s' not found", common->iothread);
+            return;
+        }
+        if (!qemu_chr_has_feature(chr, QEMU_CHAR_FEATURE_GCONTEXT)) {
+            error_setg(errp, "chardev backend '%s' cannot run in an iothread",
+                       object_get_typename(OBJECT(chr)));
+            return;
+        }
+        chr->iothread = IOTHREAD(object_ref(obj));
+    }
+
     if (common && common->logfile) {
         int flags = O_WRONLY;
         if (common->has_logappend &&
@@ -315,6 +387,9 @@ static void char_finalize(Object *obj)
     if (chr->logfd != -1) {
         close(chr->logfd);
     }
+    if (chr->iothread) {
+        object_unref(OBJECT(chr->iothread));
+    }
     qemu_mutex_destroy(&chr->chr_write_lock);
 }
 
@@ -517,6 +592,7 @@ void qemu_chr_parse_common(QemuOpts *opts, ChardevCommon *backend)
     backend->logfile = g_strdup(logfile);
     backend->has_logappend = true;
     backend->logappend = qemu_opt_get_bool(opts, "logappend", false);
+    backend->iothread = g_strdup(qemu_opt_get(opts, "iothread"));
 }
 
 static const ChardevClass *char_get_class(const char *driver, Error **errp)
@@ -898,6 +974,15 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "reconnect-ms",
             .type = QEMU_OPT_NUMBER,
+        },{
+            .name = "recv-buffer",
+            .type = QEMU_OPT_SIZE,
+        },{
+            .name = "seqpacket",
+            .type = QEMU_OPT_BOOL,
+        },{
+            .name = "cid",
+            .type = QEMU_OPT_STRING,
         },{
             .name = "telnet",
             .type = QEMU_OPT_BOOL,
@@ -946,6 +1031,9 @@ QemuOptsList qemu_chardev_opts = {
         },{
             .name = "append",
             .type = QEMU_OPT_BOOL,
+        },{
+            .name = "iothread",
+            .type = QEMU_OPT_STRING,
         },{
             .name = "logfile",
             .type = QEMU_OPT_STRING,
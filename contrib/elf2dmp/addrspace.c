@@ -6,31 +6,120 @@
  */
 
 #include "qemu/osdep.h"
+#include "err.h"
 #include "addrspace.h"
+#include "pcileech.h"
+
+static bool pa_block_contains(struct pa_block *b, uint64_t pa)
+{
+    return b->paddr <= pa && pa - b->paddr < b->size;
+}
 
 static struct pa_block *pa_space_find_block(struct pa_space *ps, uint64_t pa)
 {
-    size_t i;
+    size_t lo = 0, hi = ps->block_nr;
+
+    /* Page table walks and scans mostly stay within one block */
+    if (ps->last && pa_block_contains(ps->last, pa)) {
+        return ps->last;
+    }
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
 
-    for (i = 0; i < ps->block_nr; i++) {
-        if (ps->block[i].paddr <= pa &&
-                pa < ps->block[i].paddr + ps->block[i].size) {
-            return ps->block + i;
+        if (pa < ps->block[mid].paddr) {
+            hi = mid;
+        } else if (pa_block_contains(&ps->block[mid], pa)) {
+            ps->last = &ps->block[mid];
+            return ps->last;
+        } else {
+            lo = mid + 1;
         }
     }
 
     return NULL;
 }
 
+static int pa_block_cmp(const void *a, const void *b)
+{
+    const struct pa_block *x = a, *y = b;
+
+    return x->paddr < y->paddr ? -1 : x->paddr > y->paddr;
+}
+
+/*
+ * Remote pages are read once and kept, so that the changes made to them
+ * end up in the dump as well.
+ */
+static uint8_t *pa_space_get_page(struct pa_space *ps, uint64_t pfn)
+{
+    uint8_t *page = g_hash_table_lookup(ps->pages, &pfn);
+    uint64_t *key;
+
+    if (page) {
+        return page;
+    }
+
+    page = g_malloc(ELF2DMP_PAGE_SIZE);
+    if (!pcileech_read(ps->pcileech, pfn << ELF2DMP_PAGE_BITS, page,
+                       ELF2DMP_PAGE_SIZE)) {
+        g_free(page);
+        return NULL;
+    }
+    key = g_memdup2(&pfn, sizeof(pfn));
+    g_hash_table_insert(ps->pages, key, page);
+
+    return page;
+}
+
 static void *pa_space_resolve(struct pa_space *ps, uint64_t pa)
 {
     struct pa_block *block = pa_space_find_block(ps, pa);
+    uint8_t *page;
 
     if (!block) {
         return NULL;
     }
 
-    return block->addr + (pa - block->paddr);
+    if (block->addr) {
+        return block->addr + (pa - block->paddr);
+    }
+
+    page = pa_space_get_page(ps, pa >> ELF2DMP_PAGE_BITS);
+    if (!page) {
+        return NULL;
+    }
+
+    return page + (pa & ELF2DMP_PAGE_MASK);
+}
+
+bool pa_space_read(struct pa_space *ps, struct pa_block *b, uint64_t offset,
+                   void *buf, size_t size)
+{
+    uint64_t pa = b->paddr + offset;
+    uint64_t pfn;
+
+    if (b->addr) {
+        memcpy(buf, b->addr + offset, size);
+        return true;
+    }
+
+    if (!pcileech_read(ps->pcileech, pa, buf, size)) {
+        return false;
+    }
+
+    /* Blocks are page aligned, so @pa is whenever @offset is. */
+    for (pfn = pa >> ELF2DMP_PAGE_BITS;
+         pfn < (pa + size) >> ELF2DMP_PAGE_BITS; pfn++) {
+        uint8_t *page = g_hash_table_lookup(ps->pages, &pfn);
+
+        if (page) {
+            memcpy((uint8_t *)buf + (pfn << ELF2DMP_PAGE_BITS) - pa, page,
+                   ELF2DMP_PAGE_SIZE);
+        }
+    }
+
+    return true;
 }
 
 static bool pa_space_read64(struct pa_space *ps, uint64_t pa, uint64_t *value)
@@ -66,18 +155,63 @@ static void pa_block_align(struct pa_block *b)
         b->size = 0;
     }
 
-    b->addr += low_align;
+    if (b->addr) {
+        b->addr += low_align;
+    }
     b->paddr += low_align;
 }
 
+static void pa_space_create_pcileech(struct pa_space *ps,
+                                     struct pcileech_conn *conn)
+{
+    g_autofree struct pcileech_range *ranges = NULL;
+    size_t block_i = 0;
+    size_t i, count;
+
+    ps->pcileech = conn;
+    ps->pages = g_hash_table_new_full(g_int64_hash, g_int64_equal,
+                                      g_free, g_free);
+
+    ranges = pcileech_memory_map(conn, &count);
+    if (!ranges) {
+        eprintf("Failed to get guest RAM from pcileech device\n");
+        count = 0;
+    }
+
+    ps->block = g_new(struct pa_block, count);
+
+    for (i = 0; i < count; i++) {
+        ps->block[block_i] = (struct pa_block) {
+            .paddr = ranges[i].address,
+            .size = ranges[i].length,
+        };
+        pa_block_align(&ps->block[block_i]);
+        block_i = ps->block[block_i].size ? (block_i + 1) : block_i;
+    }
+
+    ps->block_nr = block_i;
+}
+
 void pa_space_create(struct pa_space *ps, QEMU_Elf *qemu_elf)
 {
-    Elf64_Half phdr_nr = elf_getphdrnum(qemu_elf->map);
-    Elf64_Phdr *phdr = elf64_getphdr(qemu_elf->map);
+    Elf64_Half phdr_nr;
+    Elf64_Phdr *phdr;
     size_t block_i = 0;
     size_t i;
 
     ps->block_nr = 0;
+    ps->last = NULL;
+    ps->pcileech = NULL;
+    ps->pages = NULL;
+    ps->written = g_array_new(false, false, sizeof(uint64_t));
+
+    if (qemu_elf->pcileech) {
+        pa_space_create_pcileech(ps, qemu_elf->pcileech);
+        return;
+    }
+
+    phdr_nr = elf_getphdrnum(qemu_elf->map);
+    phdr = elf64_getphdr(qemu_elf->map);
 
     for (i = 0; i < phdr_nr; i++) {
         if (phdr[i].p_type == PT_LOAD) {
@@ -101,17 +235,23 @@ void pa_space_create(struct pa_space *ps, QEMU_Elf *qemu_elf)
     }
 
     ps->block_nr = block_i;
+    qsort(ps->block, ps->block_nr, sizeof(*ps->block), pa_block_cmp);
 }
 
 void pa_space_destroy(struct pa_space *ps)
 {
     ps->block_nr = 0;
     g_free(ps->block);
+    if (ps->pages) {
+        g_hash_table_destroy(ps->pages);
+    }
+    g_array_free(ps->written, true);
 }
 
 void va_space_set_dtb(struct va_space *vs, uint64_t dtb)
 {
     vs->dtb = dtb & 0x00ffffffffff000;
+    memset(vs->tlb, 0xff, sizeof(vs->tlb));
 }
 
 void va_space_create(struct va_space *vs, struct pa_space *ps, uint64_t dtb)
@@ -197,7 +337,7 @@ static uint64_t get_2MB_paddr(uint64_t va, uint64_t pgd_entry)
     return (pgd_entry & 0xfffffffe00000) | (va & 0x00000001fffff);
 }
 
-static uint64_t va_space_va2pa(struct va_space *vs, uint64_t va)
+static uint64_t va_space_walk(struct va_space *vs, uint64_t va)
 {
     uint64_t pml4e, pdpe, pgd, pte;
 
@@ -228,6 +368,30 @@ static uint64_t va_space_va2pa(struct va_space *vs, uint64_t va)
     return get_paddr(va, pte);
 }
 
+/*
+ * elf2dmp never changes the page tables it walks, so translations stay
+ * valid until the DTB changes.
+ */
+static uint64_t va_space_va2pa(struct va_space *vs, uint64_t va)
+{
+    uint64_t page = va & ELF2DMP_PFN_MASK;
+    struct va_tlb_entry *e =
+        &vs->tlb[(va >> ELF2DMP_PAGE_BITS) % ELF2DMP_TLB_SIZE];
+    uint64_t pa;
+
+    if (e->va == page) {
+        return e->pa | (va & ELF2DMP_PAGE_MASK);
+    }
+
+    pa = va_space_walk(vs, va);
+    if (pa != INVALID_PA) {
+        e->va = page;
+        e->pa = pa & ELF2DMP_PFN_MASK;
+    }
+
+    return pa;
+}
+
 void *va_space_resolve(struct va_space *vs, uint64_t va)
 {
     uint64_t pa = va_space_va2pa(vs, va);
@@ -255,7 +419,10 @@ bool va_space_rw(struct va_space *vs, uint64_t addr,
         }
 
         if (is_write) {
+            uint64_t pa = va_space_va2pa(vs, addr) & ELF2DMP_PFN_MASK;
+
             memcpy(ptr, buf, s);
+            g_array_append_val(vs->ps->written, pa);
         } else {
             memcpy(buf, ptr, s);
         }
@@ -17,24 +17,39 @@
 
 #define INVALID_PA  UINT64_MAX
 
+/* Recent page translations of a va_space, indexed by virtual page number */
+#define ELF2DMP_TLB_SIZE 256
+
 struct pa_block {
-    uint8_t *addr;
+    uint8_t *addr;          /* NULL if the block is read from pcileech */
     uint64_t paddr;
     uint64_t size;
 };
 
 struct pa_space {
     size_t block_nr;
-    struct pa_block *block;
+    struct pa_block *block;     /* Sorted by paddr */
+    struct pa_block *last;      /* Where the last lookup hit */
+    struct pcileech_conn *pcileech;
+    GHashTable *pages;      /* Pages read from pcileech, by PFN */
+    GArray *written;        /* Pages changed through va_space_rw() */
+};
+
+struct va_tlb_entry {
+    uint64_t va;                /* Page address, or INVALID_PA */
+    uint64_t pa;
 };
 
 struct va_space {
     uint64_t dtb;
     struct pa_space *ps;
+    struct va_tlb_entry tlb[ELF2DMP_TLB_SIZE];
 };
 
 void pa_space_create(struct pa_space *ps, QEMU_Elf *qemu_elf);
 void pa_space_destroy(struct pa_space *ps);
+bool pa_space_read(struct pa_space *ps, struct pa_block *b, uint64_t offset,
+                   void *buf, size_t size);
 
 void va_space_create(struct va_space *vs, struct pa_space *ps, uint64_t dtb);
 void va_space_set_dtb(struct va_space *vs, uint64_t dtb);
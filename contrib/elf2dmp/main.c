@@ -22,6 +22,7 @@
 
 #define INITIAL_MXCSR   0x1f80
 #define MAX_NUMBER_OF_RUNS  42
+#define PCILEECH_INPUT  "pcileech:"
 
 typedef struct idt_desc {
     uint16_t offset1;   /* offset bits 0..15 */
@@ -413,6 +414,32 @@ static bool pe_get_data_dir_entry(uint64_t base, void *start_addr, int idx,
     return true;
 }
 
+/* Blocks read from pcileech are streamed to the dump in pieces this large */
+#define PCILEECH_STREAM_SIZE (4 * 1024 * 1024)
+
+static bool write_block(struct pa_space *ps, struct pa_block *b,
+                        FILE *dmp_file)
+{
+    g_autofree uint8_t *buf = NULL;
+    uint64_t offset;
+
+    if (b->addr) {
+        return fwrite(b->addr, b->size, 1, dmp_file) == 1;
+    }
+
+    buf = g_malloc(MIN(b->size, PCILEECH_STREAM_SIZE));
+    for (offset = 0; offset < b->size; offset += PCILEECH_STREAM_SIZE) {
+        size_t size = MIN(b->size - offset, PCILEECH_STREAM_SIZE);
+
+        if (!pa_space_read(ps, b, offset, buf, size) ||
+            fwrite(buf, size, 1, dmp_file) != 1) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
 static bool write_dump(struct pa_space *ps,
                        WinDumpHeader64 *hdr, const char *name)
 {
@@ -437,7 +464,7 @@ static bool write_dump(struct pa_space *ps,
 
         printf("Writing block #%zu/%zu of %"PRIu64" bytes to file...\n", i,
                 ps->block_nr, b->size);
-        if (fwrite(b->addr, b->size, 1, dmp_file) != 1) {
+        if (!write_block(ps, b, dmp_file)) {
             eprintf("Failed to write block\n");
             fclose(dmp_file);
             return false;
@@ -447,6 +474,185 @@ static bool write_dump(struct pa_space *ps,
     return !fclose(dmp_file);
 }
 
+/* Mapped blocks are copied to the dump by worker threads, this much at once */
+#define DUMP_PIECE_SIZE (64 * 1024 * 1024)
+
+/*
+ * Copying the RAM starts as soon as the input is mapped, because it does not
+ * depend on the kernel or its symbols. The pages that get patched later, such
+ * as the CPU contexts, are written once more by dump_finish().
+ */
+struct dump_writer {
+    const char *name;
+    int fd;
+    GThreadPool *pool;
+    int failed;
+    uint64_t *offsets;      /* File offset of each block */
+};
+
+#ifndef _WIN32
+struct dump_piece {
+    const uint8_t *addr;
+    uint64_t offset;
+    uint64_t size;
+};
+
+static bool pwrite_all(int fd, const void *buf, uint64_t size,
+                       uint64_t offset)
+{
+    while (size) {
+        ssize_t n = pwrite(fd, buf, MIN(size, SSIZE_MAX), offset);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            return false;
+        }
+        buf = (const uint8_t *)buf + n;
+        size -= n;
+        offset += n;
+    }
+
+    return true;
+}
+
+static void dump_write_piece(gpointer data, gpointer opaque)
+{
+    g_autofree struct dump_piece *piece = data;
+    struct dump_writer *w = opaque;
+
+    if (!g_atomic_int_get(&w->failed) &&
+        !pwrite_all(w->fd, piece->addr, piece->size, piece->offset)) {
+        g_atomic_int_set(&w->failed, true);
+    }
+}
+
+/*
+ * Start writing the blocks of @ps to @name in the background. Returns false
+ * if the dump has to be written sequentially by write_dump() instead, as for
+ * pipes or blocks read from pcileech.
+ */
+static bool dump_start(struct dump_writer *w, struct pa_space *ps,
+                       const char *name)
+{
+    uint64_t offset = sizeof(WinDumpHeader64);
+    struct stat st;
+    size_t i;
+
+    if (ps->pcileech || (!stat(name, &st) && !S_ISREG(st.st_mode))) {
+        return false;
+    }
+
+    w->fd = open(name, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        return false;
+    }
+
+    w->name = name;
+    w->failed = false;
+    w->offsets = g_new(uint64_t, ps->block_nr);
+    for (i = 0; i < ps->block_nr; i++) {
+        w->offsets[i] = offset;
+        offset += ps->block[i].size;
+    }
+    if (ftruncate(w->fd, offset)) {
+        eprintf("Failed to size output file \'%s\'\n", name);
+        close(w->fd);
+        unlink(name);
+        g_free(w->offsets);
+        return false;
+    }
+
+    w->pool = g_thread_pool_new(dump_write_piece, w, g_get_num_processors(),
+                                TRUE, NULL);
+    printf("Writing %zu blocks to file in the background...\n", ps->block_nr);
+    for (i = 0; i < ps->block_nr; i++) {
+        struct pa_block *b = &ps->block[i];
+        uint64_t done;
+
+        for (done = 0; done < b->size; done += DUMP_PIECE_SIZE) {
+            struct dump_piece *piece = g_new(struct dump_piece, 1);
+
+            piece->addr = b->addr + done;
+            piece->offset = w->offsets[i] + done;
+            piece->size = MIN(b->size - done, DUMP_PIECE_SIZE);
+            g_thread_pool_push(w->pool, piece, NULL);
+        }
+    }
+
+    return true;
+}
+
+static bool dump_finish(struct dump_writer *w, struct pa_space *ps,
+                        WinDumpHeader64 *hdr)
+{
+    bool ok;
+    guint i;
+
+    g_thread_pool_free(w->pool, FALSE, TRUE);
+    w->pool = NULL;
+    ok = !w->failed;
+
+    for (i = 0; ok && i < ps->written->len; i++) {
+        uint64_t pa = g_array_index(ps->written, uint64_t, i);
+        size_t j;
+
+        for (j = 0; j < ps->block_nr; j++) {
+            struct pa_block *b = &ps->block[j];
+
+            if (b->paddr <= pa && pa < b->paddr + b->size) {
+                ok = pwrite_all(w->fd, b->addr + (pa - b->paddr),
+                                ELF2DMP_PAGE_SIZE,
+                                w->offsets[j] + (pa - b->paddr));
+                break;
+            }
+        }
+    }
+
+    printf("Writing header to file...\n");
+    ok = ok && pwrite_all(w->fd, hdr, sizeof(*hdr), 0);
+    ok = !close(w->fd) && ok;
+    g_free(w->offsets);
+    if (!ok) {
+        unlink(w->name);
+    }
+
+    return ok;
+}
+
+/* Stop the background writes after an error, and drop the partial dump */
+static void dump_cancel(struct dump_writer *w)
+{
+    if (!w->pool) {
+        return;
+    }
+
+    g_thread_pool_free(w->pool, TRUE, TRUE);
+    w->pool = NULL;
+    close(w->fd);
+    unlink(w->name);
+    g_free(w->offsets);
+}
+#else
+/* Without pwrite(), write_dump() writes everything at the end. */
+static bool dump_start(struct dump_writer *w, struct pa_space *ps,
+                       const char *name)
+{
+    return false;
+}
+
+static bool dump_finish(struct dump_writer *w, struct pa_space *ps,
+                        WinDumpHeader64 *hdr)
+{
+    g_assert_not_reached();
+}
+
+static void dump_cancel(struct dump_writer *w)
+{
+}
+#endif
+
 static bool pe_check_pdb_name(uint64_t base, void *start_addr,
         struct va_space *vs, OMFSignatureRSDS *rsds)
 {
@@ -526,18 +732,29 @@ int main(int argc, char *argv[])
     uint64_t KdVersionBlock;
     bool kernel_found = false;
     OMFSignatureRSDS rsds;
+    struct dump_writer writer = {};
+    bool parallel;
 
     if (argc != 3) {
-        eprintf("usage:\n\t%s elf_file dmp_file\n", argv[0]);
+        eprintf("usage:\n\t%s elf_file dmp_file\n"
+                "\t%s " PCILEECH_INPUT "host:port dmp_file\n",
+                argv[0], argv[0]);
         return 1;
     }
 
-    if (!QEMU_Elf_init(&qemu_elf, argv[1])) {
+    if (g_str_has_prefix(argv[1], PCILEECH_INPUT)) {
+        if (!QEMU_Elf_init_pcileech(&qemu_elf,
+                                    argv[1] + strlen(PCILEECH_INPUT))) {
+            eprintf("Failed to read guest from pcileech device\n");
+            return 1;
+        }
+    } else if (!QEMU_Elf_init(&qemu_elf, argv[1])) {
         eprintf("Failed to initialize QEMU ELF dump\n");
         return 1;
     }
 
     pa_space_create(&ps, &qemu_elf);
+    parallel = dump_start(&writer, &ps, argv[2]);
 
     state = qemu_elf.state[0];
     printf("CPU #0 CR3 is 0x%016"PRIx64"\n", state->cr[3]);
@@ -615,7 +832,8 @@ int main(int argc, char *argv[])
 
     fill_context(kdbg, &vs, &qemu_elf);
 
-    if (!write_dump(&ps, &header, argv[2])) {
+    if (parallel ? !dump_finish(&writer, &ps, &header) :
+                   !write_dump(&ps, &header, argv[2])) {
         eprintf("Failed to save dump\n");
         goto out_kdbg;
     }
@@ -629,6 +847,7 @@ out_pdb:
 out_pdb_file:
     unlink(PDB_NAME);
 out_ps:
+    dump_cancel(&writer);
     pa_space_destroy(&ps);
     QEMU_Elf_exit(&qemu_elf);
 
@@ -0,0 +1,286 @@
+/*
+ * Read guest memory and vCPU states from a running pcileech device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#ifndef _WIN32
+#include <netdb.h>
+#endif
+#include "err.h"
+#include "pcileech.h"
+
+#define PCILEECH_REQUEST_READ       0
+#define PCILEECH_REQUEST_NEGOTIATE  2
+#define PCILEECH_REQUEST_MEMORY_MAP 4
+#define PCILEECH_REQUEST_CPU_STATE  14
+
+#define LEECH_FEATURE_MEMORY_MAP    (1ULL << 4)
+#define LEECH_FEATURE_CPU_STATE     (1ULL << 17)
+
+/* Largest response accepted for the memory map and the notes */
+#define PCILEECH_MAX_REPLY          (16 * 1024 * 1024)
+#define PCILEECH_CHUNK_SIZE         (1024 * 1024)
+
+struct LeechRequestHeader {
+    uint8_t command;
+    uint8_t flags;
+    uint8_t reserved[2];
+    /* Little-Endian */
+    uint32_t tag;
+    uint64_t address;
+    uint64_t length;
+};
+
+struct LeechResponseHeader {
+    /* Little-Endian */
+    uint32_t result;
+    uint32_t tag;
+    uint64_t length;
+};
+
+struct LeechCapabilities {
+    /* Little-Endian */
+    uint32_t version;
+    uint32_t chunk_size;
+    uint32_t max_chunk_size;
+    uint32_t page_size;
+    uint64_t features;
+};
+
+static bool pcileech_recv(struct pcileech_conn *conn, void *buf, size_t size)
+{
+    while (size) {
+        ssize_t n = recv(conn->fd, buf, size, 0);
+
+        if (n <= 0) {
+            if (n < 0 && errno == EINTR) {
+                continue;
+            }
+            eprintf("Failed to receive from pcileech device\n");
+            return false;
+        }
+        buf = (uint8_t *)buf + n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool pcileech_request(struct pcileech_conn *conn, uint8_t command,
+                             uint64_t address, uint64_t length)
+{
+    struct LeechRequestHeader req = {
+        .command = command,
+        .tag = cpu_to_le32(conn->tag++),
+        .address = cpu_to_le64(address),
+        .length = cpu_to_le64(length),
+    };
+    const uint8_t *p = (const uint8_t *)&req;
+    size_t size = sizeof(req);
+
+    while (size) {
+        ssize_t n = send(conn->fd, p, size, 0);
+
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        if (n <= 0) {
+            eprintf("Failed to send to pcileech device\n");
+            return false;
+        }
+        p += n;
+        size -= n;
+    }
+
+    return true;
+}
+
+static bool pcileech_response(struct pcileech_conn *conn,
+                              struct LeechResponseHeader *rsp)
+{
+    if (!pcileech_recv(conn, rsp, sizeof(*rsp))) {
+        return false;
+    }
+    rsp->result = le32_to_cpu(rsp->result);
+    rsp->tag = le32_to_cpu(rsp->tag);
+    rsp->length = le64_to_cpu(rsp->length);
+
+    return true;
+}
+
+/* Send a request whose response is a single reply; returns its data. */
+static void *pcileech_call(struct pcileech_conn *conn, uint8_t command,
+                           size_t *size)
+{
+    struct LeechResponseHeader rsp;
+    void *data;
+
+    if (!pcileech_request(conn, command, 0, 0) ||
+        !pcileech_response(conn, &rsp)) {
+        return NULL;
+    }
+    if (rsp.result || rsp.length > PCILEECH_MAX_REPLY) {
+        eprintf("pcileech request %u failed with result 0x%x\n", command,
+                rsp.result);
+        return NULL;
+    }
+    data = g_malloc(rsp.length);
+    if (!pcileech_recv(conn, data, rsp.length)) {
+        g_free(data);
+        return NULL;
+    }
+    *size = rsp.length;
+
+    return data;
+}
+
+static bool pcileech_negotiate(struct pcileech_conn *conn)
+{
+    struct LeechResponseHeader rsp;
+    struct LeechCapabilities caps;
+    uint64_t features;
+
+    if (!pcileech_request(conn, PCILEECH_REQUEST_NEGOTIATE, 0,
+                          PCILEECH_CHUNK_SIZE) ||
+        !pcileech_response(conn, &rsp)) {
+        return false;
+    }
+    if (rsp.result || rsp.length != sizeof(caps)) {
+        eprintf("pcileech device does not support negotiation\n");
+        return false;
+    }
+    if (!pcileech_recv(conn, &caps, sizeof(caps))) {
+        return false;
+    }
+    conn->chunk_size = le32_to_cpu(caps.chunk_size);
+    features = le64_to_cpu(caps.features);
+    if (!(features & LEECH_FEATURE_MEMORY_MAP) ||
+        !(features & LEECH_FEATURE_CPU_STATE)) {
+        eprintf("pcileech device cannot report RAM and vCPU states\n");
+        return false;
+    }
+
+    return true;
+}
+
+#ifdef _WIN32
+struct pcileech_conn *pcileech_connect(const char *address)
+{
+    eprintf("pcileech input is not supported on this host\n");
+    return NULL;
+}
+#else
+struct pcileech_conn *pcileech_connect(const char *address)
+{
+    g_autofree char *host = g_strdup(address);
+    char *port = strrchr(host, ':');
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM,
+    };
+    struct addrinfo *res, *ai;
+    struct pcileech_conn *conn;
+    int fd = -1;
+
+    if (!port) {
+        eprintf("pcileech address must be HOST:PORT\n");
+        return NULL;
+    }
+    *port++ = '\0';
+    if (getaddrinfo(host, port, &hints, &res)) {
+        eprintf("Failed to resolve \'%s\'\n", address);
+        return NULL;
+    }
+    for (ai = res; ai; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (fd >= 0 && !connect(fd, ai->ai_addr, ai->ai_addrlen)) {
+            break;
+        }
+        if (fd >= 0) {
+            close(fd);
+            fd = -1;
+        }
+    }
+    freeaddrinfo(res);
+    if (fd < 0) {
+        eprintf("Failed to connect to pcileech device at \'%s\'\n", address);
+        return NULL;
+    }
+
+    conn = g_new0(struct pcileech_conn, 1);
+    conn->fd = fd;
+    if (!pcileech_negotiate(conn)) {
+        pcileech_close(conn);
+        return NULL;
+    }
+    printf("Connected to pcileech device, %u bytes per frame\n",
+           conn->chunk_size);
+
+    return conn;
+}
+#endif
+
+void pcileech_close(struct pcileech_conn *conn)
+{
+    close(conn->fd);
+    g_free(conn);
+}
+
+bool pcileech_read(struct pcileech_conn *conn, uint64_t address,
+                   void *buf, size_t size)
+{
+    struct LeechResponseHeader rsp;
+    uint8_t *p = buf;
+    size_t done = 0;
+    bool ok = true;
+
+    if (!pcileech_request(conn, PCILEECH_REQUEST_READ, address, size)) {
+        return false;
+    }
+    /* Every frame stands for the next chunk; take them all to stay in sync. */
+    while (done < size) {
+        const size_t frame = MIN(size - done, conn->chunk_size);
+
+        if (!pcileech_response(conn, &rsp) || rsp.length > frame ||
+            !pcileech_recv(conn, p + done, rsp.length)) {
+            return false;
+        }
+        memset(p + done + rsp.length, 0, frame - rsp.length);
+        ok &= !rsp.result;
+        done += frame;
+    }
+    if (!ok) {
+        eprintf("Failed to read 0x%zx bytes at 0x%016"PRIx64"\n", size,
+                address);
+    }
+
+    return ok;
+}
+
+struct pcileech_range *pcileech_memory_map(struct pcileech_conn *conn,
+                                           size_t *count)
+{
+    struct pcileech_range *ranges;
+    size_t size;
+
+    ranges = pcileech_call(conn, PCILEECH_REQUEST_MEMORY_MAP, &size);
+    if (!ranges) {
+        return NULL;
+    }
+    *count = size / sizeof(*ranges);
+    for (size_t i = 0; i < *count; i++) {
+        ranges[i].address = le64_to_cpu(ranges[i].address);
+        ranges[i].length = le64_to_cpu(ranges[i].length);
+    }
+
+    return ranges;
+}
+
+void *pcileech_cpu_notes(struct pcileech_conn *conn, size_t *size)
+{
+    return pcileech_call(conn, PCILEECH_REQUEST_CPU_STATE, size);
+}
@@ -0,0 +1,34 @@
+/*
+ * Read guest memory and vCPU states from a running pcileech device
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef ELF2DMP_PCILEECH_H
+#define ELF2DMP_PCILEECH_H
+
+struct pcileech_range {
+    uint64_t address;
+    uint64_t length;
+};
+
+struct pcileech_conn {
+    int fd;
+    uint32_t chunk_size;
+    uint32_t tag;
+};
+
+/* @address is HOST:PORT of the pcileech chardev. */
+struct pcileech_conn *pcileech_connect(const char *address);
+void pcileech_close(struct pcileech_conn *conn);
+
+bool pcileech_read(struct pcileech_conn *conn, uint64_t address,
+                   void *buf, size_t size);
+/* The guest RAM, in ascending order */
+struct pcileech_range *pcileech_memory_map(struct pcileech_conn *conn,
+                                           size_t *count);
+/* The ELF notes of the vCPUs, as in a dump-guest-memory core file */
+void *pcileech_cpu_notes(struct pcileech_conn *conn, size_t *size);
+
+#endif /* ELF2DMP_PCILEECH_H */
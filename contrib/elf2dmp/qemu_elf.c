@@ -9,6 +9,7 @@
 #include "qemu/host-utils.h"
 #include "err.h"
 #include "qemu_elf.h"
+#include "pcileech.h"
 
 #define QEMU_NOTE_NAME "QEMU"
 
@@ -55,45 +56,33 @@ static bool advance_note_offset(uint64_t *offsetp, uint64_t size, uint64_t end)
     return true;
 }
 
-static bool init_states(QEMU_Elf *qe)
+/* Collect the QEMU CPU states of the notes between @offset and @end_offset */
+static void parse_notes(QEMU_Elf *qe, void *base, uint64_t offset,
+                        uint64_t end_offset)
 {
-    Elf64_Phdr *phdr = elf64_getphdr(qe->map);
     Elf64_Nhdr *nhdr;
     GPtrArray *states;
     QEMUCPUState *state;
     uint32_t state_size;
-    uint64_t offset;
-    uint64_t end_offset;
     char *name;
 
-    if (phdr[0].p_type != PT_NOTE) {
-        eprintf("Failed to find PT_NOTE\n");
-        return false;
-    }
-
     qe->has_kernel_gs_base = 1;
-    offset = phdr[0].p_offset;
     states = g_ptr_array_new();
 
-    if (uadd64_overflow(offset, phdr[0].p_memsz, &end_offset) ||
-        end_offset > qe->size) {
-        end_offset = qe->size;
-    }
-
     while (offset < end_offset) {
-        nhdr = (void *)((uint8_t *)qe->map + offset);
+        nhdr = (void *)((uint8_t *)base + offset);
 
         if (!advance_note_offset(&offset, sizeof(*nhdr), end_offset)) {
             break;
         }
 
-        name = (char *)qe->map + offset;
+        name = (char *)base + offset;
 
         if (!advance_note_offset(&offset, nhdr->n_namesz, end_offset)) {
             break;
         }
 
-        state = (void *)((uint8_t *)qe->map + offset);
+        state = (void *)((uint8_t *)base + offset);
 
         if (!advance_note_offset(&offset, nhdr->n_descsz, end_offset)) {
             break;
@@ -120,6 +109,24 @@ static bool init_states(QEMU_Elf *qe)
 
     qe->state_nr = states->len;
     qe->state = (void *)g_ptr_array_free(states, FALSE);
+}
+
+static bool init_states(QEMU_Elf *qe)
+{
+    Elf64_Phdr *phdr = elf64_getphdr(qe->map);
+    uint64_t end_offset;
+
+    if (phdr[0].p_type != PT_NOTE) {
+        eprintf("Failed to find PT_NOTE\n");
+        return false;
+    }
+
+    if (uadd64_overflow(phdr[0].p_offset, phdr[0].p_memsz, &end_offset) ||
+        end_offset > qe->size) {
+        end_offset = qe->size;
+    }
+
+    parse_notes(qe, qe->map, phdr[0].p_offset, end_offset);
 
     return true;
 }
@@ -244,6 +251,8 @@ static void QEMU_Elf_unmap(QEMU_Elf *qe)
 
 bool QEMU_Elf_init(QEMU_Elf *qe, const char *filename)
 {
+    memset(qe, 0, sizeof(*qe));
+
     if (!QEMU_Elf_map(qe, filename)) {
         return false;
     }
@@ -263,8 +272,41 @@ bool QEMU_Elf_init(QEMU_Elf *qe, const char *filename)
     return true;
 }
 
+bool QEMU_Elf_init_pcileech(QEMU_Elf *qe, const char *address)
+{
+    size_t size;
+
+    memset(qe, 0, sizeof(*qe));
+
+    qe->pcileech = pcileech_connect(address);
+    if (!qe->pcileech) {
+        return false;
+    }
+
+    qe->notes = pcileech_cpu_notes(qe->pcileech, &size);
+    if (!qe->notes) {
+        eprintf("Failed to get vCPU states from pcileech device\n");
+        pcileech_close(qe->pcileech);
+        return false;
+    }
+
+    parse_notes(qe, qe->notes, 0, size);
+    if (!qe->state_nr) {
+        eprintf("Failed to extract QEMU CPU states\n");
+        QEMU_Elf_exit(qe);
+        return false;
+    }
+
+    return true;
+}
+
 void QEMU_Elf_exit(QEMU_Elf *qe)
 {
     exit_states(qe);
-    QEMU_Elf_unmap(qe);
+    if (qe->pcileech) {
+        g_free(qe->notes);
+        pcileech_close(qe->pcileech);
+    } else {
+        QEMU_Elf_unmap(qe);
+    }
 }
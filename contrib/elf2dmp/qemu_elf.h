@@ -40,9 +40,13 @@ typedef struct QEMU_Elf {
     QEMUCPUState **state;
     size_t state_nr;
     int has_kernel_gs_base;
+    /* Set when the guest is read from a running pcileech device */
+    struct pcileech_conn *pcileech;
+    void *notes;
 } QEMU_Elf;
 
 bool QEMU_Elf_init(QEMU_Elf *qe, const char *filename);
+bool QEMU_Elf_init_pcileech(QEMU_Elf *qe, const char *address);
 void QEMU_Elf_exit(QEMU_Elf *qe);
 
 Elf64_Phdr *elf64_getphdr(void *map);
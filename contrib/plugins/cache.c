@@ -105,6 +105,27 @@ static GMutex *l1_dcache_locks;
 static GMutex *l1_icache_locks;
 static GMutex *l2_ucache_locks;
 
+/*
+ * With one model per vCPU, each model is only touched by its vCPU's
+ * thread and the locks can be skipped.
+ */
+static bool sharded;
+
+/*
+ * With sample=N, only every Nth TB that a vCPU executes goes through
+ * the models. The TB entry clears @active, counts the TB and, once the
+ * count reaches N, calls back to set @active for the rest of the TB.
+ */
+typedef struct {
+    uint64_t tb_count;
+    uint64_t active;
+} SampleState;
+
+static uint64_t sample = 1;
+static struct qemu_plugin_scoreboard *sample_state;
+static qemu_plugin_u64 sample_tb_count;
+static qemu_plugin_u64 sample_active;
+
 static uint64_t l1_dmem_accesses;
 static uint64_t l1_imem_accesses;
 static uint64_t l1_imisses;
@@ -385,6 +406,26 @@ static bool access_cache(Cache *cache, uint64_t addr)
     return false;
 }
 
+static inline void cache_lock(GMutex *locks, int cache_idx)
+{
+    if (!sharded) {
+        g_mutex_lock(&locks[cache_idx]);
+    }
+}
+
+static inline void cache_unlock(GMutex *locks, int cache_idx)
+{
+    if (!sharded) {
+        g_mutex_unlock(&locks[cache_idx]);
+    }
+}
+
+static void vcpu_tb_sample(unsigned int vcpu_index, void *userdata)
+{
+    qemu_plugin_u64_set(sample_tb_count, vcpu_index, 0);
+    qemu_plugin_u64_set(sample_active, vcpu_index, 1);
+}
+
 static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
                             uint64_t vaddr, void *userdata)
 {
@@ -394,6 +435,10 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     InsnData *insn;
     bool hit_in_l1;
 
+    if (sample_state && !qemu_plugin_u64_get(sample_active, vcpu_index)) {
+        return;
+    }
+
     hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
     if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
         return;
@@ -402,7 +447,7 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
     effective_addr = hwaddr ? qemu_plugin_hwaddr_phys_addr(hwaddr) : vaddr;
     cache_idx = vcpu_index % cores;
 
-    g_mutex_lock(&l1_dcache_locks[cache_idx]);
+    cache_lock(l1_dcache_locks, cache_idx);
     hit_in_l1 = access_cache(l1_dcaches[cache_idx], effective_addr);
     if (!hit_in_l1) {
         insn = userdata;
@@ -410,21 +455,21 @@ static void vcpu_mem_access(unsigned int vcpu_index, qemu_plugin_meminfo_t info,
         l1_dcaches[cache_idx]->misses++;
     }
     l1_dcaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_dcache_locks[cache_idx]);
+    cache_unlock(l1_dcache_locks, cache_idx);
 
     if (hit_in_l1 || !use_l2) {
         /* No need to access L2 */
         return;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
+    cache_lock(l2_ucache_locks, cache_idx);
     if (!access_cache(l2_ucaches[cache_idx], effective_addr)) {
         insn = userdata;
         __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
         l2_ucaches[cache_idx]->misses++;
     }
     l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    cache_unlock(l2_ucache_locks, cache_idx);
 }
 
 static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
@@ -437,7 +482,7 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
     insn_addr = ((InsnData *) userdata)->addr;
 
     cache_idx = vcpu_index % cores;
-    g_mutex_lock(&l1_icache_locks[cache_idx]);
+    cache_lock(l1_icache_locks, cache_idx);
     hit_in_l1 = access_cache(l1_icaches[cache_idx], insn_addr);
     if (!hit_in_l1) {
         insn = userdata;
@@ -445,21 +490,21 @@ static void vcpu_insn_exec(unsigned int vcpu_index, void *userdata)
         l1_icaches[cache_idx]->misses++;
     }
     l1_icaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l1_icache_locks[cache_idx]);
+    cache_unlock(l1_icache_locks, cache_idx);
 
     if (hit_in_l1 || !use_l2) {
         /* No need to access L2 */
         return;
     }
 
-    g_mutex_lock(&l2_ucache_locks[cache_idx]);
+    cache_lock(l2_ucache_locks, cache_idx);
     if (!access_cache(l2_ucaches[cache_idx], insn_addr)) {
         insn = userdata;
         __atomic_fetch_add(&insn->l2_misses, 1, __ATOMIC_SEQ_CST);
         l2_ucaches[cache_idx]->misses++;
     }
     l2_ucaches[cache_idx]->accesses++;
-    g_mutex_unlock(&l2_ucache_locks[cache_idx]);
+    cache_unlock(l2_ucache_locks, cache_idx);
 }
 
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
@@ -468,6 +513,16 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
     size_t i;
     InsnData *data;
 
+    if (sample_state) {
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_STORE_U64, sample_active, 0);
+        qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
+            tb, QEMU_PLUGIN_INLINE_ADD_U64, sample_tb_count, 1);
+        qemu_plugin_register_vcpu_tb_exec_cond_cb(
+            tb, vcpu_tb_sample, QEMU_PLUGIN_CB_NO_REGS,
+            QEMU_PLUGIN_COND_GE, sample_tb_count, sample, NULL);
+    }
+
     n_insns = qemu_plugin_tb_n_insns(tb);
     for (i = 0; i < n_insns; i++) {
         struct qemu_plugin_insn *insn = qemu_plugin_tb_get_insn(tb, i);
@@ -500,8 +555,16 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                          QEMU_PLUGIN_CB_NO_REGS,
                                          rw, data);
 
-        qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
-                                               QEMU_PLUGIN_CB_NO_REGS, data);
+        if (sample_state) {
+            /* Unsampled TBs skip the call with an inline check. */
+            qemu_plugin_register_vcpu_insn_exec_cond_cb(
+                insn, vcpu_insn_exec, QEMU_PLUGIN_CB_NO_REGS,
+                QEMU_PLUGIN_COND_NE, sample_active, 0, data);
+        } else {
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec,
+                                                   QEMU_PLUGIN_CB_NO_REGS,
+                                                   data);
+        }
     }
 }
 
@@ -611,9 +674,14 @@ static void log_stats(void)
     int i;
     Cache *icache, *dcache, *l2_cache;
 
-    g_autoptr(GString) rep = g_string_new("core #, data accesses, data misses,"
-                                          " dmiss rate, insn accesses,"
-                                          " insn misses, imiss rate");
+    g_autoptr(GString) rep = g_string_new("");
+
+    if (sample > 1) {
+        g_string_append_printf(rep, "sampled 1 in %" PRIu64 " TBs\n", sample);
+    }
+    g_string_append(rep, "core #, data accesses, data misses,"
+                         " dmiss rate, insn accesses,"
+                         " insn misses, imiss rate");
 
     if (use_l2) {
         g_string_append(rep, ", l2 accesses, l2 misses, l2 miss rate");
@@ -717,6 +785,10 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
     }
 
     g_hash_table_destroy(miss_ht);
+
+    if (sample_state) {
+        qemu_plugin_scoreboard_free(sample_state);
+    }
 }
 
 static void policy_init(void)
@@ -789,6 +861,12 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
             limit = STRTOLL(tokens[1]);
         } else if (g_strcmp0(tokens[0], "cores") == 0) {
             cores = STRTOLL(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "sample") == 0) {
+            sample = g_ascii_strtoull(tokens[1], NULL, 10);
+            if (!sample) {
+                fprintf(stderr, "sample must be at least 1\n");
+                return -1;
+            }
         } else if (g_strcmp0(tokens[0], "l2cachesize") == 0) {
             use_l2 = true;
             l2_cachesize = STRTOLL(tokens[1]);
@@ -846,6 +924,16 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
         return -1;
     }
 
+    /* A vCPU beyond the models would share the model of another one. */
+    sharded = sys && cores >= info->system.max_vcpus;
+    if (sample > 1) {
+        sample_state = qemu_plugin_scoreboard_new(sizeof(SampleState));
+        sample_tb_count = qemu_plugin_scoreboard_u64_in_struct(
+            sample_state, SampleState, tb_count);
+        sample_active = qemu_plugin_scoreboard_u64_in_struct(
+            sample_state, SampleState, active);
+    }
+
     l1_dcache_locks = g_new0(GMutex, cores);
     l1_icache_locks = g_new0(GMutex, cores);
     l2_ucache_locks = use_l2 ? g_new0(GMutex, cores) : NULL;
@@ -0,0 +1,142 @@
+/*
+ * DMA watch - count device DMA per requester and log accesses to
+ * watched ranges of guest memory.
+ *
+ * License: GNU GPL, version 2 or later.
+ *   See the COPYING file in the top-level directory.
+ */
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <qemu-plugin.h>
+
+QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
+
+typedef struct {
+    uint16_t requester_id;
+    uint64_t reads;
+    uint64_t writes;
+    uint64_t read_bytes;
+    uint64_t write_bytes;
+} DMACounters;
+
+typedef struct {
+    uint64_t addr;
+    uint64_t len;
+} WatchRange;
+
+/* DMA callbacks never run concurrently, so no locking is needed. */
+static GHashTable *requesters;
+static GArray *watches;
+static uint64_t dropped;
+
+static void log_access(const struct qemu_plugin_dma_access *access)
+{
+    g_autofree char *msg = g_strdup_printf(
+        "dma %02x:%02x.%x %s 0x%" PRIx64 "+0x%" PRIx64 "\n",
+        access->requester_id >> 8, (access->requester_id >> 3) & 0x1f,
+        access->requester_id & 7, access->is_write ? "write" : "read",
+        access->addr, access->len);
+
+    qemu_plugin_outs(msg);
+}
+
+static void dma_access(qemu_plugin_id_t id,
+                       const struct qemu_plugin_dma_access *accesses,
+                       size_t n, uint64_t lost, void *udata)
+{
+    dropped += lost;
+    for (size_t i = 0; i < n; i++) {
+        const struct qemu_plugin_dma_access *access = &accesses[i];
+        gpointer key = GUINT_TO_POINTER(access->requester_id);
+        DMACounters *count = g_hash_table_lookup(requesters, key);
+
+        if (!count) {
+            count = g_new0(DMACounters, 1);
+            count->requester_id = access->requester_id;
+            g_hash_table_insert(requesters, key, count);
+        }
+        if (access->is_write) {
+            count->writes++;
+            count->write_bytes += access->len;
+        } else {
+            count->reads++;
+            count->read_bytes += access->len;
+        }
+
+        for (guint j = 0; j < watches->len; j++) {
+            WatchRange *w = &g_array_index(watches, WatchRange, j);
+
+            if (access->addr < w->addr + w->len &&
+                w->addr < access->addr + access->len) {
+                log_access(access);
+                break;
+            }
+        }
+    }
+}
+
+static void plugin_exit(qemu_plugin_id_t id, void *p)
+{
+    g_autoptr(GString) report = g_string_new(
+        "Requester, Reads, Read bytes, Writes, Write bytes\n");
+    GList *counts = g_hash_table_get_values(requesters);
+
+    for (GList *it = counts; it; it = it->next) {
+        DMACounters *rec = it->data;
+
+        g_string_append_printf(report,
+                               "%02x:%02x.%x, %" PRId64 ", %" PRId64
+                               ", %" PRId64 ", %" PRId64 "\n",
+                               rec->requester_id >> 8,
+                               (rec->requester_id >> 3) & 0x1f,
+                               rec->requester_id & 7,
+                               rec->reads, rec->read_bytes,
+                               rec->writes, rec->write_bytes);
+    }
+    if (dropped) {
+        g_string_append_printf(report, "dropped, %" PRId64 "\n", dropped);
+    }
+    g_list_free(counts);
+    qemu_plugin_outs(report->str);
+}
+
+QEMU_PLUGIN_EXPORT
+int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
+                        int argc, char **argv)
+{
+    if (!info->system_emulation) {
+        fprintf(stderr, "dmawatch: only system emulation has devices\n");
+        return -1;
+    }
+
+    watches = g_array_new(false, false, sizeof(WatchRange));
+    for (int i = 0; i < argc; i++) {
+        char *opt = argv[i];
+        g_auto(GStrv) tokens = g_strsplit(opt, "=", 2);
+
+        if (g_strcmp0(tokens[0], "watch") == 0 && tokens[1]) {
+            g_auto(GStrv) range = g_strsplit(tokens[1], ":", 2);
+            WatchRange w;
+
+            if (!range[1]) {
+                fprintf(stderr, "watch expects ADDR:LEN: %s\n", tokens[1]);
+                return -1;
+            }
+            w.addr = g_ascii_strtoull(range[0], NULL, 0);
+            w.len = g_ascii_strtoull(range[1], NULL, 0);
+            g_array_append_val(watches, w);
+        } else {
+            fprintf(stderr, "option parsing failed: %s\n", opt);
+            return -1;
+        }
+    }
+
+    requesters = g_hash_table_new_full(NULL, g_direct_equal, NULL, g_free);
+    qemu_plugin_register_dma_cb(id, dma_access, NULL);
+    qemu_plugin_register_atexit_cb(id, plugin_exit, NULL);
+    return 0;
+}
@@ -38,10 +38,26 @@ typedef struct {
     bool     exec;
 } bb_entry_t;
 
-/* Translated blocks */
-static GPtrArray *blocks;
+/*
+ * Blocks are written as they first execute, so the count in the header
+ * is a fixed-width placeholder that is filled in at exit.
+ */
+#define BB_BUFFER_ENTRIES 4096
 
-static void printf_header(unsigned long count)
+typedef struct {
+    unsigned len;
+    bb_entry_t *entries[BB_BUFFER_ENTRIES];
+} bb_buffer_t;
+
+/* Translated blocks, one entry per start and size; protected by lock */
+static GHashTable *blocks;
+/* Per-thread buffers of newly executed blocks; protected by lock */
+static GPtrArray *buffers;
+static __thread bb_buffer_t *buffer;
+static long count_offset;
+static unsigned long count;
+
+static void printf_header(void)
 {
     fprintf(fp, "%s", header);
     const char *path = qemu_plugin_path_to_binary();
@@ -50,7 +66,9 @@ static void printf_header(unsigned long count)
     uint64_t entry = qemu_plugin_entry_code();
     fprintf(fp, "0, 0x%" PRIx64 ", 0x%" PRIx64 ", 0x%" PRIx64 ", %s\n",
             start_code, end_code, entry, path);
-    fprintf(fp, "BB Table: %ld bbs\n", count);
+    fprintf(fp, "BB Table: ");
+    count_offset = ftell(fp);
+    fprintf(fp, "%010lu bbs\n", 0UL);
 }
 
 static void printf_char_array32(uint32_t data)
@@ -66,38 +84,37 @@ static void printf_char_array16(uint16_t data)
 }
 
 
-static void printf_el(gpointer data, gpointer user_data)
+static void printf_el(bb_entry_t *bb)
 {
-    bb_entry_t *bb = (bb_entry_t *)data;
-    if (bb->exec) {
-        printf_char_array32(bb->start);
-        printf_char_array16(bb->size);
-        printf_char_array16(bb->mod_id);
-    }
-    g_free(bb);
+    printf_char_array32(bb->start);
+    printf_char_array16(bb->size);
+    printf_char_array16(bb->mod_id);
 }
 
-static void count_block(gpointer data, gpointer user_data)
+/* Called with lock held */
+static void flush_buffer(bb_buffer_t *buf)
 {
-    unsigned long *count = (unsigned long *) user_data;
-    bb_entry_t *bb = (bb_entry_t *)data;
-    if (bb->exec) {
-        *count = *count + 1;
+    for (unsigned i = 0; i < buf->len; i++) {
+        printf_el(buf->entries[i]);
     }
+    count += buf->len;
+    buf->len = 0;
 }
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
-    unsigned long count = 0;
     g_mutex_lock(&lock);
-    g_ptr_array_foreach(blocks, count_block, &count);
+    for (guint i = 0; i < buffers->len; i++) {
+        flush_buffer(g_ptr_array_index(buffers, i));
+    }
 
-    /* Print function */
-    printf_header(count);
-    g_ptr_array_foreach(blocks, printf_el, NULL);
+    /* Fill in the number of blocks */
+    fseek(fp, count_offset, SEEK_SET);
+    fprintf(fp, "%010lu", count);
 
     /* Clear */
-    g_ptr_array_free(blocks, true);
+    g_ptr_array_free(buffers, true);
+    g_hash_table_destroy(blocks);
 
     fclose(fp);
 
@@ -107,35 +124,63 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 static void plugin_init(void)
 {
     fp = fopen(file_name, "wb");
-    blocks = g_ptr_array_sized_new(128);
+    blocks = g_hash_table_new_full(g_int64_hash, g_int64_equal, g_free,
+                                   g_free);
+    buffers = g_ptr_array_new_with_free_func(g_free);
+    printf_header();
 }
 
 static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
 {
     bb_entry_t *bb = (bb_entry_t *) udata;
 
-    g_mutex_lock(&lock);
-    bb->exec = true;
-    g_mutex_unlock(&lock);
+    /* Only the first execution of a block records it, without the lock */
+    if (__atomic_load_n(&bb->exec, __ATOMIC_RELAXED) ||
+        __atomic_exchange_n(&bb->exec, true, __ATOMIC_RELAXED)) {
+        return;
+    }
+
+    if (!buffer) {
+        buffer = g_new0(bb_buffer_t, 1);
+        g_mutex_lock(&lock);
+        g_ptr_array_add(buffers, buffer);
+        g_mutex_unlock(&lock);
+    }
+    buffer->entries[buffer->len++] = bb;
+    if (buffer->len == BB_BUFFER_ENTRIES) {
+        g_mutex_lock(&lock);
+        flush_buffer(buffer);
+        g_mutex_unlock(&lock);
+    }
 }
 
 static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
 {
     uint64_t pc = qemu_plugin_tb_vaddr(tb);
     size_t n = qemu_plugin_tb_n_insns(tb);
+    uint16_t size = 0;
+    uint64_t key;
+    bb_entry_t *bb;
 
-    g_mutex_lock(&lock);
-
-    bb_entry_t *bb = g_new0(bb_entry_t, 1);
     for (int i = 0; i < n; i++) {
-        bb->size += qemu_plugin_insn_size(qemu_plugin_tb_get_insn(tb, i));
+        size += qemu_plugin_insn_size(qemu_plugin_tb_get_insn(tb, i));
     }
+    key = (uint32_t) pc | (uint64_t) size << 32;
 
-    bb->start = pc;
-    bb->mod_id = 0;
-    bb->exec = false;
-    g_ptr_array_add(blocks, bb);
-
+    /* Retranslations of a block share its entry */
+    g_mutex_lock(&lock);
+    bb = g_hash_table_lookup(blocks, &key);
+    if (!bb) {
+        uint64_t *k = g_new(uint64_t, 1);
+
+        *k = key;
+        bb = g_new0(bb_entry_t, 1);
+        bb->start = pc;
+        bb->size = size;
+        bb->mod_id = 0;
+        bb->exec = false;
+        g_hash_table_insert(blocks, k, bb);
+    }
     g_mutex_unlock(&lock);
     qemu_plugin_register_vcpu_tb_exec_cb(tb, vcpu_tb_exec,
                                          QEMU_PLUGIN_CB_NO_REGS,
@@ -22,11 +22,52 @@ typedef struct {
     const char *name;
 } Register;
 
+/*
+ * Binary trace: a header, then fixed-size records. Each instruction is
+ * named once in the "<file>.insns" table at translation time; records
+ * only carry its index. A vCPU fills a buffer without locking and hands
+ * it to the writer thread when it is full.
+ */
+#define EXECLOG_MAGIC "EXECLOG"
+#define EXECLOG_VERSION 1
+#define EXECLOG_BUFFER_RECORDS 65536
+
+enum {
+    EXECLOG_INSN = 1,
+    EXECLOG_LOAD = 2,
+    EXECLOG_STORE = 3,
+};
+
+#define EXECLOG_PADDR (1 << 0)  /* @paddr is valid */
+#define EXECLOG_IO    (1 << 1)  /* the access went to a device */
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+} ExeclogHeader;
+
+typedef struct {
+    uint8_t type;
+    uint8_t flags;
+    uint16_t vcpu;
+    uint32_t insn;      /* index in the instruction table */
+    uint64_t vaddr;     /* of the memory access */
+    uint64_t paddr;
+} ExeclogRecord;
+
+typedef struct {
+    size_t len;
+    ExeclogRecord records[EXECLOG_BUFFER_RECORDS];
+} ExeclogBuffer;
+
 typedef struct CPU {
     /* Store last executed instruction on each vCPU as a GString */
     GString *last_exec;
     /* Ptr array of Register */
     GPtrArray *registers;
+    /* Buffer being filled in binary mode */
+    ExeclogBuffer *buffer;
 } CPU;
 
 QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
@@ -41,6 +82,16 @@ static bool disas_assist;
 static GMutex add_reg_name_lock;
 static GPtrArray *all_reg_names;
 
+static char *binary_path;
+static FILE *binary_file;
+static FILE *insn_table;
+static GMutex insn_table_lock;
+static uint32_t insn_count;
+static GAsyncQueue *full_buffers;
+static GAsyncQueue *free_buffers;
+static GThread *writer;
+static int writer_stop;  /* queued to stop the writer */
+
 static CPU *get_cpu(int vcpu_index)
 {
     CPU *c;
@@ -51,6 +102,113 @@ static CPU *get_cpu(int vcpu_index)
     return c;
 }
 
+static gpointer binary_writer(gpointer data)
+{
+    ExeclogBuffer *buf;
+
+    while ((buf = g_async_queue_pop(full_buffers)) != (gpointer) &writer_stop) {
+        if (fwrite(buf->records, sizeof(ExeclogRecord), buf->len,
+                   binary_file) != buf->len) {
+            fprintf(stderr, "execlog: cannot write %s\n", binary_path);
+        }
+        buf->len = 0;
+        g_async_queue_push(free_buffers, buf);
+    }
+    return NULL;
+}
+
+static ExeclogRecord *binary_record(unsigned int cpu_index)
+{
+    CPU *c = get_cpu(cpu_index);
+
+    if (c->buffer->len == EXECLOG_BUFFER_RECORDS) {
+        /* Blocks the vCPU while the writer is behind */
+        g_async_queue_push(full_buffers, c->buffer);
+        c->buffer = g_async_queue_pop(free_buffers);
+    }
+    return &c->buffer->records[c->buffer->len++];
+}
+
+static void vcpu_insn_exec_binary(unsigned int cpu_index, void *udata)
+{
+    *binary_record(cpu_index) = (ExeclogRecord) {
+        .type = EXECLOG_INSN,
+        .vcpu = cpu_index,
+        .insn = GPOINTER_TO_UINT(udata),
+    };
+}
+
+static void vcpu_mem_binary(unsigned int cpu_index, qemu_plugin_meminfo_t info,
+                            uint64_t vaddr, void *udata)
+{
+    struct qemu_plugin_hwaddr *hwaddr = qemu_plugin_get_hwaddr(info, vaddr);
+    ExeclogRecord *r = binary_record(cpu_index);
+
+    *r = (ExeclogRecord) {
+        .type = qemu_plugin_mem_is_store(info) ? EXECLOG_STORE : EXECLOG_LOAD,
+        .vcpu = cpu_index,
+        .insn = GPOINTER_TO_UINT(udata),
+        .vaddr = vaddr,
+    };
+    if (hwaddr) {
+        r->flags = EXECLOG_PADDR |
+                   (qemu_plugin_hwaddr_is_io(hwaddr) ? EXECLOG_IO : 0);
+        r->paddr = qemu_plugin_hwaddr_phys_addr(hwaddr);
+    }
+}
+
+/* Name an instruction in the table and return its index. */
+static uint32_t binary_add_insn(uint64_t vaddr, uint32_t opcode,
+                                const char *disas)
+{
+    uint32_t index;
+
+    g_mutex_lock(&insn_table_lock);
+    index = insn_count++;
+    fprintf(insn_table, "%" PRIu32 " 0x%" PRIx64 " 0x%" PRIx32 " %s\n",
+            index, vaddr, opcode, disas);
+    g_mutex_unlock(&insn_table_lock);
+    return index;
+}
+
+static bool binary_init(void)
+{
+    ExeclogHeader header = {
+        .magic = EXECLOG_MAGIC,
+        .version = EXECLOG_VERSION,
+        .record_size = sizeof(ExeclogRecord),
+    };
+    g_autofree char *table_path = g_strdup_printf("%s.insns", binary_path);
+
+    binary_file = fopen(binary_path, "wb");
+    insn_table = fopen(table_path, "w");
+    if (!binary_file || !insn_table ||
+        fwrite(&header, sizeof(header), 1, binary_file) != 1) {
+        fprintf(stderr, "execlog: cannot create %s and %s\n", binary_path,
+                table_path);
+        return false;
+    }
+    full_buffers = g_async_queue_new();
+    free_buffers = g_async_queue_new();
+    writer = g_thread_new("execlog-writer", binary_writer, NULL);
+    return true;
+}
+
+static void binary_exit(void)
+{
+    for (guint i = 0; i < cpus->len; i++) {
+        CPU *c = get_cpu(i);
+        if (c->buffer && c->buffer->len) {
+            g_async_queue_push(full_buffers, c->buffer);
+            c->buffer = NULL;
+        }
+    }
+    g_async_queue_push(full_buffers, &writer_stop);
+    g_thread_join(writer);
+    fclose(binary_file);
+    fclose(insn_table);
+}
+
 /**
  * Add memory read or write information to current instruction log
  */
@@ -257,6 +415,20 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
                                                        QEMU_PLUGIN_CB_R_REGS,
                                                        NULL);
             }
+        } else if (binary_path) {
+            uint32_t insn_opcode = 0;
+            gpointer index;
+
+            qemu_plugin_insn_data(insn, &insn_opcode, sizeof(insn_opcode));
+            index = GUINT_TO_POINTER(binary_add_insn(insn_vaddr, insn_opcode,
+                                                     insn_disas));
+            qemu_plugin_register_vcpu_mem_cb(insn, vcpu_mem_binary,
+                                             QEMU_PLUGIN_CB_NO_REGS,
+                                             QEMU_PLUGIN_MEM_RW, index);
+            qemu_plugin_register_vcpu_insn_exec_cb(insn, vcpu_insn_exec_binary,
+                                                   QEMU_PLUGIN_CB_NO_REGS,
+                                                   index);
+            skip = (imatches || amatches);
         } else {
             uint32_t insn_opcode = 0;
             qemu_plugin_insn_data(insn, &insn_opcode, sizeof(insn_opcode));
@@ -389,6 +561,11 @@ static void vcpu_init(qemu_plugin_id_t id, unsigned int vcpu_index)
     c = get_cpu(vcpu_index);
     c->last_exec = g_string_new(NULL);
     c->registers = registers_init(vcpu_index);
+    if (binary_path) {
+        /* A spare buffer lets the vCPU go on while one is written */
+        g_async_queue_push(free_buffers, g_new0(ExeclogBuffer, 1));
+        c->buffer = g_new0(ExeclogBuffer, 1);
+    }
 }
 
 /**
@@ -397,6 +574,12 @@ static void vcpu_init(qemu_plugin_id_t id, unsigned int vcpu_index)
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     guint i;
+
+    if (binary_path) {
+        binary_exit();
+        return;
+    }
+
     g_rw_lock_reader_lock(&expand_array_lock);
     for (i = 0; i < cpus->len; i++) {
         CPU *c = get_cpu(i);
@@ -468,12 +651,25 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_install(qemu_plugin_id_t id,
                 return -1;
             }
             all_reg_names = g_ptr_array_new();
+        } else if (g_strcmp0(tokens[0], "binary") == 0) {
+            g_free(binary_path);
+            binary_path = g_strdup(tokens[1]);
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
         }
     }
 
+    if (binary_path) {
+        if (rmatches) {
+            fprintf(stderr, "execlog: binary traces do not track registers\n");
+            return -1;
+        }
+        if (!binary_init()) {
+            return -1;
+        }
+    }
+
     /* Register init, translation block and exit callbacks */
     qemu_plugin_register_vcpu_init_cb(id, vcpu_init);
     qemu_plugin_register_vcpu_tb_trans_cb(id, vcpu_tb_trans);
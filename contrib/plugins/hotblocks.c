@@ -19,9 +19,15 @@ QEMU_PLUGIN_EXPORT int qemu_plugin_version = QEMU_PLUGIN_VERSION;
 
 static bool do_inline;
 
-/* Plugins need to take care of their own locking */
+/*
+ * Each translating thread records its blocks in its own table, so
+ * translation only takes the lock when a thread starts; the tables are
+ * merged at exit. A block can be executed by any vCPU, so its execution
+ * count is a scoreboard.
+ */
 static GMutex lock;
-static GHashTable *hotblocks;
+static GPtrArray *tables;
+static __thread GHashTable *hotblocks;
 static guint64 limit = 20;
 
 /*
@@ -37,34 +43,61 @@ typedef struct {
     struct qemu_plugin_scoreboard *exec_count;
     int trans_count;
     unsigned long insns;
+    uint64_t execs;     /* summed at exit */
 } ExecCount;
 
 static gint cmp_exec_count(gconstpointer a, gconstpointer b)
 {
     ExecCount *ea = (ExecCount *) a;
     ExecCount *eb = (ExecCount *) b;
-    uint64_t count_a =
-        qemu_plugin_u64_sum(qemu_plugin_scoreboard_u64(ea->exec_count));
-    uint64_t count_b =
-        qemu_plugin_u64_sum(qemu_plugin_scoreboard_u64(eb->exec_count));
-    return count_a > count_b ? -1 : 1;
+    return ea->execs > eb->execs ? -1 : 1;
 }
 
-static void exec_count_free(gpointer key, gpointer value, gpointer user_data)
+static void exec_count_free(gpointer data)
 {
+    ExecCount *cnt = data;
+    if (cnt->exec_count) {
+        qemu_plugin_scoreboard_free(cnt->exec_count);
+    }
+    g_free(cnt);
+}
+
+/* Fold the block of one thread into the merged entry of the same hash. */
+static void merge_block(gpointer key, gpointer value, gpointer user_data)
+{
+    GHashTable *merged = user_data;
     ExecCount *cnt = value;
-    qemu_plugin_scoreboard_free(cnt->exec_count);
+    ExecCount *total = g_hash_table_lookup(merged, key);
+
+    if (!total) {
+        total = g_new0(ExecCount, 1);
+        total->start_addr = cnt->start_addr;
+        total->insns = cnt->insns;
+        g_hash_table_insert(merged, key, total);
+    }
+    total->trans_count += cnt->trans_count;
+    total->execs +=
+        qemu_plugin_u64_sum(qemu_plugin_scoreboard_u64(cnt->exec_count));
 }
 
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) report = g_string_new("collected ");
+    g_autoptr(GHashTable) merged =
+        g_hash_table_new_full(NULL, g_direct_equal, NULL, exec_count_free);
     GList *counts, *it;
     int i;
 
+    g_mutex_lock(&lock);
+    for (i = 0; i < tables->len; i++) {
+        g_hash_table_foreach(g_ptr_array_index(tables, i), merge_block,
+                             merged);
+    }
+    g_mutex_unlock(&lock);
+
     g_string_append_printf(report, "%d entries in the hash table\n",
-                           g_hash_table_size(hotblocks));
-    counts = g_hash_table_get_values(hotblocks);
+                           g_hash_table_size(merged));
+    counts = g_hash_table_get_values(merged);
     it = g_list_sort(counts, cmp_exec_count);
 
     if (it) {
@@ -75,9 +108,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
             g_string_append_printf(
                 report, "0x%016"PRIx64", %d, %ld, %"PRId64"\n",
                 rec->start_addr, rec->trans_count,
-                rec->insns,
-                qemu_plugin_u64_sum(
-                    qemu_plugin_scoreboard_u64(rec->exec_count)));
+                rec->insns, rec->execs);
         }
 
         g_list_free(it);
@@ -85,13 +116,16 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 
     qemu_plugin_outs(report->str);
 
-    g_hash_table_foreach(hotblocks, exec_count_free, NULL);
-    g_hash_table_destroy(hotblocks);
+    g_mutex_lock(&lock);
+    g_ptr_array_free(tables, true);
+    tables = NULL;
+    g_mutex_unlock(&lock);
 }
 
 static void plugin_init(void)
 {
-    hotblocks = g_hash_table_new(NULL, g_direct_equal);
+    tables = g_ptr_array_new_with_free_func(
+        (GDestroyNotify) g_hash_table_destroy);
 }
 
 static void vcpu_tb_exec(unsigned int cpu_index, void *udata)
@@ -113,7 +147,13 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
     size_t insns = qemu_plugin_tb_n_insns(tb);
     uint64_t hash = pc ^ insns;
 
-    g_mutex_lock(&lock);
+    if (!hotblocks) {
+        hotblocks = g_hash_table_new_full(NULL, g_direct_equal, NULL,
+                                          exec_count_free);
+        g_mutex_lock(&lock);
+        g_ptr_array_add(tables, hotblocks);
+        g_mutex_unlock(&lock);
+    }
     cnt = (ExecCount *) g_hash_table_lookup(hotblocks, (gconstpointer) hash);
     if (cnt) {
         cnt->trans_count++;
@@ -126,8 +166,6 @@ static void vcpu_tb_trans(qemu_plugin_id_t id, struct qemu_plugin_tb *tb)
         g_hash_table_insert(hotblocks, (gpointer) hash, (gpointer) cnt);
     }
 
-    g_mutex_unlock(&lock);
-
     if (do_inline) {
         qemu_plugin_register_vcpu_tb_exec_inline_per_vcpu(
             tb, QEMU_PLUGIN_INLINE_ADD_U64,
@@ -3,6 +3,15 @@
  *
  * Hot Pages - show which pages saw the most memory accesses.
  *
+ * With publish=FILE, the hottest pages are also written to FILE every
+ * interval=MS milliseconds while the guest runs, so that tools such as
+ * pcileech clients can prefetch them. Each snapshot is written to a
+ * temporary file and renamed, so readers always see a whole one; put
+ * FILE on a tmpfs such as /dev/shm to share it through memory. It is a
+ * HotPagesHeader followed by HotPagesHeader.count HotPagesEntry records,
+ * all in host byte order. Counts are halved after each snapshot, so the
+ * set follows what the guest touches now.
+ *
  * License: GNU GPL, version 2 or later.
  *   See the COPYING file in the top-level directory.
  */
@@ -27,6 +36,25 @@ static uint64_t page_mask;
 static int limit = 50;
 static enum qemu_plugin_mem_rw rw = QEMU_PLUGIN_MEM_RW;
 static bool track_io;
+static uint64_t sample = 1;
+static char *publish_path;
+static uint64_t publish_interval = 100;
+
+#define HOTPAGES_MAGIC 0x5345474150544f48ULL /* "HOTPAGES" */
+
+typedef struct {
+    uint64_t magic;
+    uint64_t page_size;
+    uint64_t sample;        /* one access in this many is counted */
+    uint64_t seq;           /* incremented with each snapshot */
+    uint64_t count;
+} HotPagesHeader;
+
+typedef struct {
+    uint64_t page_address;
+    uint64_t reads;
+    uint64_t writes;
+} HotPagesEntry;
 
 enum sort_type {
     SORT_RW = 0,
@@ -47,6 +75,12 @@ typedef struct {
 
 static GMutex lock;
 static GHashTable *pages;
+static struct qemu_plugin_scoreboard *skipped;
+
+static GThread *publisher;
+static GMutex publish_lock;
+static GCond publish_cond;
+static bool publish_stop;
 
 static gint cmp_access_count(gconstpointer a, gconstpointer b)
 {
@@ -73,12 +107,92 @@ static gint cmp_access_count(gconstpointer a, gconstpointer b)
 }
 
 
+static gboolean decay_counts(gpointer key, gpointer value, gpointer udata)
+{
+    PageCounters *rec = (PageCounters *) value;
+
+    rec->reads /= 2;
+    rec->writes /= 2;
+    return !rec->reads && !rec->writes;
+}
+
+static void publish(uint64_t seq)
+{
+    g_autoptr(GByteArray) snapshot = g_byte_array_new();
+    g_autoptr(GError) err = NULL;
+    HotPagesHeader header = {
+        .magic = HOTPAGES_MAGIC,
+        .page_size = page_size,
+        .sample = sample,
+        .seq = seq,
+    };
+    GList *counts, *it;
+
+    g_byte_array_append(snapshot, (guint8 *) &header, sizeof(header));
+
+    g_mutex_lock(&lock);
+    counts = g_list_sort(g_hash_table_get_values(pages), cmp_access_count);
+    for (it = counts; it && header.count < (uint64_t) limit; it = it->next) {
+        PageCounters *rec = (PageCounters *) it->data;
+        HotPagesEntry entry = {
+            .page_address = rec->page_address,
+            .reads = rec->reads,
+            .writes = rec->writes,
+        };
+        g_byte_array_append(snapshot, (guint8 *) &entry, sizeof(entry));
+        header.count++;
+    }
+    g_list_free(counts);
+    g_hash_table_foreach_remove(pages, decay_counts, NULL);
+    g_mutex_unlock(&lock);
+
+    memcpy(snapshot->data, &header, sizeof(header));
+    if (!g_file_set_contents(publish_path, (gchar *) snapshot->data,
+                             snapshot->len, &err)) {
+        fprintf(stderr, "hotpages: cannot publish to %s: %s\n",
+                publish_path, err->message);
+    }
+}
+
+static gpointer publish_thread(gpointer data)
+{
+    uint64_t seq = 0;
+
+    g_mutex_lock(&publish_lock);
+    while (!publish_stop) {
+        gint64 deadline = g_get_monotonic_time() +
+                          publish_interval * G_TIME_SPAN_MILLISECOND;
+
+        while (!publish_stop &&
+               g_cond_wait_until(&publish_cond, &publish_lock, deadline)) {
+            /* woken early, but not told to stop */
+        }
+        if (publish_stop) {
+            break;
+        }
+        g_mutex_unlock(&publish_lock);
+        publish(++seq);
+        g_mutex_lock(&publish_lock);
+    }
+    g_mutex_unlock(&publish_lock);
+    return NULL;
+}
+
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) report = g_string_new("Addr, RCPUs, Reads, WCPUs, Writes\n");
     int i;
     GList *counts;
 
+    if (publisher) {
+        g_mutex_lock(&publish_lock);
+        publish_stop = true;
+        g_cond_signal(&publish_cond);
+        g_mutex_unlock(&publish_lock);
+        g_thread_join(publisher);
+        publisher = NULL;
+    }
+
     counts = g_hash_table_get_values(pages);
     if (counts && g_list_next(counts)) {
         GList *it;
@@ -103,7 +217,13 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
 static void plugin_init(void)
 {
     page_mask = (page_size - 1);
-    pages = g_hash_table_new(NULL, g_direct_equal);
+    pages = g_hash_table_new_full(NULL, g_direct_equal, NULL, g_free);
+    if (sample > 1) {
+        skipped = qemu_plugin_scoreboard_new(sizeof(uint64_t));
+    }
+    if (publish_path) {
+        publisher = g_thread_new("hotpages-publish", publish_thread, NULL);
+    }
 }
 
 static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
@@ -113,6 +233,16 @@ static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
     uint64_t page;
     PageCounters *count;
 
+    /* Sampling keeps the common path free of the lock */
+    if (skipped) {
+        uint64_t *n = qemu_plugin_scoreboard_find(skipped, cpu_index);
+
+        if (++*n < sample) {
+            return;
+        }
+        *n = 0;
+    }
+
     /* We only get a hwaddr for system emulation */
     if (track_io) {
         if (hwaddr && qemu_plugin_hwaddr_is_io(hwaddr)) {
@@ -189,6 +319,23 @@ int qemu_plugin_install(qemu_plugin_id_t id, const qemu_info_t *info,
             }
         } else if (g_strcmp0(tokens[0], "pagesize") == 0) {
             page_size = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else if (g_strcmp0(tokens[0], "limit") == 0) {
+            limit = g_ascii_strtoull(tokens[1], NULL, 10);
+        } else if (g_strcmp0(tokens[0], "sample") == 0) {
+            sample = g_ascii_strtoull(tokens[1], NULL, 10);
+            if (!sample) {
+                fprintf(stderr, "sample must be at least 1\n");
+                return -1;
+            }
+        } else if (g_strcmp0(tokens[0], "publish") == 0) {
+            g_free(publish_path);
+            publish_path = g_strdup(tokens[1]);
+        } else if (g_strcmp0(tokens[0], "interval") == 0) {
+            publish_interval = g_ascii_strtoull(tokens[1], NULL, 10);
+            if (!publish_interval) {
+                fprintf(stderr, "interval must be at least 1 ms\n");
+                return -1;
+            }
         } else {
             fprintf(stderr, "option parsing failed: %s\n", opt);
             return -1;
@@ -41,8 +41,13 @@ typedef struct {
     GHashTable *detail;
 } DeviceCounts;
 
+/*
+ * Each vCPU thread counts in its own table, so accesses take no lock;
+ * the tables are merged at exit.
+ */
 static GMutex lock;
-static GHashTable *devices;
+static GPtrArray *tables;
+static __thread GHashTable *devices;
 
 /* track the access pattern to a piece of HW */
 static bool pattern;
@@ -66,7 +71,7 @@ static inline bool track_writes(void)
 
 static void plugin_init(void)
 {
-    devices = g_hash_table_new(NULL, NULL);
+    tables = g_ptr_array_new();
 }
 
 static gint sort_cmp(gconstpointer a, gconstpointer b)
@@ -104,11 +109,62 @@ static void fmt_dev_record(GString *s, DeviceCounts *rec)
     g_string_append_c(s, '\n');
 }
 
+static void merge_iocounts(IOCounts *total, IOCounts *count)
+{
+    total->cpu_read |= count->cpu_read;
+    total->cpu_write |= count->cpu_write;
+    total->reads += count->reads;
+    total->writes += count->writes;
+}
+
+static void merge_location(gpointer key, gpointer value, gpointer user_data)
+{
+    GHashTable *detail = user_data;
+    IOLocationCounts *loc = value;
+    IOLocationCounts *total = g_hash_table_lookup(detail, key);
+
+    if (!total) {
+        total = g_new0(IOLocationCounts, 1);
+        total->off_or_pc = loc->off_or_pc;
+        g_hash_table_insert(detail, key, total);
+    }
+    merge_iocounts(&total->counts, &loc->counts);
+}
+
+static void merge_device(gpointer key, gpointer value, gpointer user_data)
+{
+    GHashTable *merged = user_data;
+    DeviceCounts *rec = value;
+    DeviceCounts *total = g_hash_table_lookup(merged, key);
+
+    if (!total) {
+        total = g_new0(DeviceCounts, 1);
+        total->name = rec->name;
+        total->base = rec->base;
+        if (rec->detail) {
+            total->detail = g_hash_table_new(NULL, NULL);
+        }
+        g_hash_table_insert(merged, key, total);
+    }
+    merge_iocounts(&total->totals, &rec->totals);
+    if (rec->detail) {
+        g_hash_table_foreach(rec->detail, merge_location, total->detail);
+    }
+}
+
 static void plugin_exit(qemu_plugin_id_t id, void *p)
 {
     g_autoptr(GString) report = g_string_new("");
+    GHashTable *merged = g_hash_table_new(NULL, NULL);
     GList *counts;
 
+    g_mutex_lock(&lock);
+    for (guint i = 0; i < tables->len; i++) {
+        g_hash_table_foreach(g_ptr_array_index(tables, i), merge_device,
+                             merged);
+    }
+    g_mutex_unlock(&lock);
+
     if (!(pattern || source)) {
         g_string_printf(report, "Device, Address");
         if (track_reads()) {
@@ -120,7 +176,7 @@ static void plugin_exit(qemu_plugin_id_t id, void *p)
         g_string_append_c(report, '\n');
     }
 
-    counts = g_hash_table_get_values(devices);
+    counts = g_hash_table_get_values(merged);
     if (counts && g_list_next(counts)) {
         GList *it;
 
@@ -205,7 +261,12 @@ static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
         bool is_write = qemu_plugin_mem_is_store(meminfo);
         DeviceCounts *counts;
 
-        g_mutex_lock(&lock);
+        if (!devices) {
+            devices = g_hash_table_new(NULL, NULL);
+            g_mutex_lock(&lock);
+            g_ptr_array_add(tables, devices);
+            g_mutex_unlock(&lock);
+        }
         counts = (DeviceCounts *) g_hash_table_lookup(devices, name);
 
         if (!counts) {
@@ -235,8 +296,6 @@ static void vcpu_haddr(unsigned int cpu_index, qemu_plugin_meminfo_t meminfo,
             }
             inc_count(&io_count->counts, is_write, cpu_index);
         }
-
-        g_mutex_unlock(&lock);
     }
 }
 
@@ -33,6 +33,18 @@
 
 #include <gnutls/x509.h>
 
+#ifdef CONFIG_LINUX_TLS_H
+#include <linux/tls.h>
+#include <netinet/tcp.h>
+
+#ifndef SOL_TLS
+#define SOL_TLS 282
+#endif
+#ifndef TCP_ULP
+#define TCP_ULP 31
+#endif
+#endif
+
 
 struct QCryptoTLSSession {
     QCryptoTLSCreds *creds;
@@ -44,6 +56,7 @@ struct QCryptoTLSSession {
     QCryptoTLSSessionReadFunc readFunc;
     void *opaque;
     char *peername;
+    bool ktlsTx;
 
     /*
      * Allow concurrent reads and writes, so track
@@ -84,6 +97,12 @@ qcrypto_tls_session_push(void *opaque, const void *buf, size_t len)
         return -1;
     };
 
+    /* The kernel now owns the sending side of the TLS state */
+    if (session->ktlsTx) {
+        errno = EIO;
+        return -1;
+    }
+
     error_free(session->werr);
     session->werr = NULL;
 
@@ -613,6 +632,104 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *session)
 }
 
 
+#ifdef CONFIG_LINUX_TLS_H
+#define KTLS_AES_GCM_INFO(info, CIPHER)                                 \
+    do {                                                                \
+        if (key.size != TLS_CIPHER_##CIPHER##_KEY_SIZE ||               \
+            iv.size < TLS_CIPHER_##CIPHER##_SALT_SIZE +                 \
+                      (tls13 ? TLS_CIPHER_##CIPHER##_IV_SIZE : 0)) {    \
+            goto unsupported;                                           \
+        }                                                               \
+        memcpy((info).salt, iv.data, TLS_CIPHER_##CIPHER##_SALT_SIZE);  \
+        /* TLS 1.2 uses the sequence number as explicit nonce */        \
+        memcpy((info).iv,                                               \
+               tls13 ? iv.data + TLS_CIPHER_##CIPHER##_SALT_SIZE : seq, \
+               TLS_CIPHER_##CIPHER##_IV_SIZE);                          \
+        memcpy((info).rec_seq, seq, TLS_CIPHER_##CIPHER##_REC_SEQ_SIZE); \
+        memcpy((info).key, key.data, TLS_CIPHER_##CIPHER##_KEY_SIZE);   \
+        len = sizeof(info);                                             \
+    } while (0)
+#endif
+
+bool
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *session,
+                                   int fd,
+                                   Error **errp)
+{
+#ifdef CONFIG_LINUX_TLS_H
+    union {
+        struct tls_crypto_info info;
+        struct tls12_crypto_info_aes_gcm_128 aes128;
+        struct tls12_crypto_info_aes_gcm_256 aes256;
+    } crypto;
+    gnutls_protocol_t version;
+    gnutls_datum_t iv, key;
+    unsigned char seq[8];
+    socklen_t len;
+    bool tls13;
+    int ret;
+
+    if (!session->creds->ktls) {
+        return false;
+    }
+    assert(session->handshakeComplete);
+
+    version = gnutls_protocol_get_version(session->handle);
+    if (version != GNUTLS_TLS1_2 && version != GNUTLS_TLS1_3) {
+        error_setg(errp, "Kernel TLS does not support %s",
+                   gnutls_protocol_get_name(version));
+        return false;
+    }
+    tls13 = version == GNUTLS_TLS1_3;
+
+    ret = gnutls_record_get_state(session->handle, 0, NULL, &iv, &key, seq);
+    if (ret < 0) {
+        error_setg(errp, "Cannot get TLS session keys: %s",
+                   gnutls_strerror(ret));
+        return false;
+    }
+
+    memset(&crypto, 0, sizeof(crypto));
+    crypto.info.version = tls13 ? TLS_1_3_VERSION : TLS_1_2_VERSION;
+    switch (gnutls_cipher_get(session->handle)) {
+    case GNUTLS_CIPHER_AES_128_GCM:
+        crypto.info.cipher_type = TLS_CIPHER_AES_GCM_128;
+        KTLS_AES_GCM_INFO(crypto.aes128, AES_GCM_128);
+        break;
+    case GNUTLS_CIPHER_AES_256_GCM:
+        crypto.info.cipher_type = TLS_CIPHER_AES_GCM_256;
+        KTLS_AES_GCM_INFO(crypto.aes256, AES_GCM_256);
+        break;
+    default:
+        goto unsupported;
+    }
+
+    if (setsockopt(fd, IPPROTO_TCP, TCP_ULP, "tls", sizeof("tls")) < 0) {
+        error_setg_errno(errp, errno, "Cannot enable kernel TLS");
+        goto out;
+    }
+    if (setsockopt(fd, SOL_TLS, TLS_TX, &crypto, len) < 0) {
+        error_setg_errno(errp, errno, "Cannot set kernel TLS keys");
+        goto out;
+    }
+    session->ktlsTx = true;
+    goto out;
+
+ unsupported:
+    error_setg(errp, "Kernel TLS does not support cipher %s",
+               gnutls_cipher_get_name(gnutls_cipher_get(session->handle)));
+ out:
+    memset(&crypto, 0, sizeof(crypto));
+    return session->ktlsTx;
+#else
+    if (session->creds->ktls) {
+        error_setg(errp, "Kernel TLS is not supported on this host");
+    }
+    return false;
+#endif
+}
+
+
 #else /* ! CONFIG_GNUTLS */
 
 
@@ -714,4 +831,13 @@ qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess)
     return NULL;
 }
 
+
+bool
+qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess G_GNUC_UNUSED,
+                                   int fd G_GNUC_UNUSED,
+                                   Error **errp G_GNUC_UNUSED)
+{
+    return false;
+}
+
 #endif
@@ -99,6 +99,62 @@ static inline void xts_tweak_encdec(const void *ctx,
 }
 
 
+/*
+ * Number of blocks encrypted or decrypted with a single call of the
+ * cipher function, so that it can pipeline them.  A 512 byte sector
+ * is one batch.
+ */
+#define XTS_BATCH_BLOCKS 32
+
+/**
+ * xts_encdec_blocks:
+ * @ctx: the cipher context
+ * @func: the cipher function
+ * @T: the tweak of the first block, updated to the tweak of the block
+ *     after the last one
+ * @nblocks: the number of XTS_BLOCK_SIZE blocks to process
+ * @dst: buffer to output the output text of @nblocks blocks
+ * @src: buffer providing the input text of @nblocks blocks
+ *
+ * Encrypt/decrypt consecutive blocks, computing the tweaks of a whole
+ * batch first and passing the batch to @func at once.
+ */
+static void xts_encdec_blocks(const void *ctx,
+                              xts_cipher_func *func,
+                              xts_uint128 *T,
+                              size_t nblocks,
+                              uint8_t *dst,
+                              const uint8_t *src)
+{
+    xts_uint128 tweak[XTS_BATCH_BLOCKS], buf[XTS_BATCH_BLOCKS];
+
+    while (nblocks) {
+        size_t n = MIN(nblocks, XTS_BATCH_BLOCKS);
+        size_t len = n * XTS_BLOCK_SIZE;
+        size_t i;
+
+        /* the copy also takes care of unaligned @src and @dst */
+        memcpy(buf, src, len);
+        for (i = 0; i < n; i++) {
+            tweak[i] = *T;
+            xts_uint128_xor(&buf[i], &buf[i], T);
+            xts_mult_x(T);
+        }
+
+        func(ctx, len, buf[0].b, buf[0].b);
+
+        for (i = 0; i < n; i++) {
+            xts_uint128_xor(&buf[i], &buf[i], &tweak[i]);
+        }
+        memcpy(dst, buf, len);
+
+        nblocks -= n;
+        src += len;
+        dst += len;
+    }
+}
+
+
 void xts_decrypt(const void *datactx,
                  const void *tweakctx,
                  xts_cipher_func *encfunc,
@@ -127,24 +183,9 @@ void xts_decrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, decfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, decfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-            src += XTS_BLOCK_SIZE;
-            dst += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_encdec_blocks(datactx, decfunc, &T, lim, dst, src);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
@@ -203,25 +244,9 @@ void xts_encrypt(const void *datactx,
     /* encrypt the iv */
     encfunc(tweakctx, XTS_BLOCK_SIZE, T.b, iv);
 
-    if (QEMU_PTR_IS_ALIGNED(src, sizeof(uint64_t)) &&
-        QEMU_PTR_IS_ALIGNED(dst, sizeof(uint64_t))) {
-        xts_uint128 *S = (xts_uint128 *)src;
-        xts_uint128 *D = (xts_uint128 *)dst;
-        for (i = 0; i < lim; i++, S++, D++) {
-            xts_tweak_encdec(datactx, encfunc, S, D, &T);
-        }
-    } else {
-        xts_uint128 D;
-
-        for (i = 0; i < lim; i++) {
-            memcpy(&D, src, XTS_BLOCK_SIZE);
-            xts_tweak_encdec(datactx, encfunc, &D, &D, &T);
-            memcpy(dst, &D, XTS_BLOCK_SIZE);
-
-            dst += XTS_BLOCK_SIZE;
-            src += XTS_BLOCK_SIZE;
-        }
-    }
+    xts_encdec_blocks(datactx, encfunc, &T, lim, dst, src);
+    src += lim * XTS_BLOCK_SIZE;
+    dst += lim * XTS_BLOCK_SIZE;
 
     /* if length is not a multiple of XTS_BLOCK_SIZE then */
     if (mo > 0) {
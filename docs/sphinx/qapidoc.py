@@ -342,7 +342,7 @@ def visit_alternate_type(self, name, info, ifcond, features,
 
     def visit_command(self, name, info, ifcond, features, arg_type,
                       ret_type, gen, success_response, boxed, allow_oob,
-                      allow_preconfig, coroutine):
+                      allow_preconfig, coroutine, json_output):
         doc = self._cur_doc
         self._add_doc('Command',
                       self._nodes_for_arguments(doc, arg_type)
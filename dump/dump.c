@@ -13,6 +13,9 @@
 
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
+#include "qemu/units.h"
+#include "qemu/memalign.h"
+#include "qemu/thread.h"
 #include "elf.h"
 #include "qemu/bswap.h"
 #include "exec/target_page.h"
@@ -31,6 +34,8 @@
 #include "hw/core/cpu.h"
 #include "win_dump.h"
 #include "qemu/range.h"
+#include "exec/memory.h"
+#include "exec/ramlist.h"
 
 #include <zlib.h>
 #ifdef CONFIG_LZO
@@ -39,6 +44,9 @@
 #ifdef CONFIG_SNAPPY
 #include <snappy-c.h>
 #endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #ifndef ELF_MACHINE_UNAME
 #define ELF_MACHINE_UNAME "Unknown"
 #endif
@@ -47,6 +55,16 @@
 
 static Error *dump_migration_blocker;
 
+/*
+ * While an incremental dump chain is open, the dirty log belongs to it;
+ * migration would clear it behind our back and lose pages.
+ */
+static Error *dump_incremental_blocker;
+static uint64_t dump_incremental_chain;    /* 0 if no chain is open */
+static uint64_t dump_incremental_seq;      /* Of the next dump of the chain */
+
+#define DUMP_INCREMENTAL_NOTE_NAME "QEMU-INCR"
+
 #define ELF_NOTE_SIZE(hdr_size, name_size, desc_size)   \
     ((DIV_ROUND_UP((hdr_size), 4) +                     \
       DIV_ROUND_UP((name_size), 4) +                    \
@@ -95,6 +113,8 @@ uint64_t cpu_to_dump64(DumpState *s, uint64_t val)
     return val;
 }
 
+static void dump_incremental_end(void);
+
 static int dump_cleanup(DumpState *s)
 {
     if (s->dump_info.arch_cleanup_fn) {
@@ -105,27 +125,255 @@ static int dump_cleanup(DumpState *s)
     memory_mapping_list_free(&s->list);
     close(s->fd);
     g_free(s->guest_note);
+    g_clear_pointer(&s->incremental_note, g_free);
     g_clear_pointer(&s->string_table_buf, g_array_unref);
     s->guest_note = NULL;
+    if (s->detached) {
+        bql_lock();
+    }
+    if (s->incremental && qatomic_read(&s->status) != DUMP_STATUS_COMPLETED) {
+        /*
+         * The pages of this dump are gone from the dirty log, so the next
+         * dump could not build on it; start over with a full one.
+         */
+        dump_incremental_end();
+    }
     if (s->resume) {
-        if (s->detached) {
-            bql_lock();
-        }
         vm_start();
-        if (s->detached) {
-            bql_unlock();
-        }
+    }
+    if (s->detached) {
+        bql_unlock();
     }
     migrate_del_blocker(&dump_migration_blocker);
 
     return 0;
 }
 
+/*
+ * ELF dumps are written sequentially through a pipeline of large aligned
+ * buffers. While the dump thread fills one of them, worker threads write
+ * the others, several at once with pwrite() if the file is seekable, or
+ * in order with write() for pipes and sockets.
+ */
+#define DUMP_WRITE_BUF_SIZE     (8 * MiB)
+#define DUMP_WRITE_BUFS         4
+/* Alignment of buffers, file offsets and lengths with O_DIRECT */
+#define DUMP_WRITE_ALIGN        4096
+
+typedef struct DumpWriteBuf {
+    uint8_t *data;
+    size_t len;
+    off_t offset;               /* Of data[0] in the file */
+    bool queued;                /* Waiting for or being written */
+} DumpWriteBuf;
+
+struct DumpWriter {
+    int fd;
+    bool seekable;
+    bool regular;
+    bool direct;
+    unsigned nr_threads;
+    QemuThread threads[DUMP_WRITE_BUFS - 1];
+    QemuMutex lock;
+    QemuCond cond;
+    DumpWriteBuf bufs[DUMP_WRITE_BUFS];
+    unsigned cur;               /* Being filled by the dump thread */
+    unsigned next_write;        /* Next buffer to be written, in order */
+    off_t pos;                  /* Where the next byte goes */
+    int error;                  /* errno of the first failed write */
+    bool quit;
+};
+
+static int dump_writer_pwrite(DumpWriter *w, DumpWriteBuf *buf)
+{
+    size_t done = 0;
+    ssize_t ret;
+
+    if (!w->seekable) {
+        /* There is a single writer, so the stream stays in order. */
+        return qemu_write_full(w->fd, buf->data, buf->len) == buf->len ?
+               0 : -errno;
+    }
+
+    while (done < buf->len) {
+        ret = pwrite(w->fd, buf->data + done, buf->len - done,
+                     buf->offset + done);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        if (ret <= 0) {
+            return ret ? -errno : -EIO;
+        }
+        done += ret;
+    }
+
+    return 0;
+}
+
+static void *dump_writer_thread(void *opaque)
+{
+    DumpWriter *w = opaque;
+    DumpWriteBuf *buf;
+    int ret;
+
+    qemu_mutex_lock(&w->lock);
+    for (;;) {
+        buf = &w->bufs[w->next_write % DUMP_WRITE_BUFS];
+        if (!buf->queued) {
+            if (w->quit) {
+                break;
+            }
+            qemu_cond_wait(&w->cond, &w->lock);
+            continue;
+        }
+        w->next_write++;
+        qemu_mutex_unlock(&w->lock);
+        ret = dump_writer_pwrite(w, buf);
+        qemu_mutex_lock(&w->lock);
+        if (ret < 0 && !w->error) {
+            w->error = -ret;
+        }
+        buf->queued = false;
+        qemu_cond_broadcast(&w->cond);
+    }
+    qemu_mutex_unlock(&w->lock);
+
+    return NULL;
+}
+
+static void dump_writer_start(DumpState *s)
+{
+    DumpWriter *w = g_new0(DumpWriter, 1);
+    struct stat st;
+    unsigned i;
+
+    w->fd = s->fd;
+    w->regular = !fstat(s->fd, &st) && S_ISREG(st.st_mode);
+    w->direct = s->direct;
+    w->pos = lseek(s->fd, 0, SEEK_CUR);
+    w->seekable = w->pos != (off_t)-1;
+    if (!w->seekable) {
+        w->pos = 0;
+    }
+    w->nr_threads = w->seekable ? DUMP_WRITE_BUFS - 1 : 1;
+    qemu_mutex_init(&w->lock);
+    qemu_cond_init(&w->cond);
+    for (i = 0; i < DUMP_WRITE_BUFS; i++) {
+        w->bufs[i].data = qemu_memalign(DUMP_WRITE_ALIGN, DUMP_WRITE_BUF_SIZE);
+    }
+    w->bufs[0].offset = w->pos;
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_thread_create(&w->threads[i], "dump_write", dump_writer_thread, w,
+                           QEMU_THREAD_JOINABLE);
+    }
+    s->writer = w;
+}
+
+/* Hand the current buffer over to the writers and wait for a free one. */
+static void dump_writer_submit(DumpWriter *w)
+{
+    DumpWriteBuf *buf;
+
+    QEMU_LOCK_GUARD(&w->lock);
+    w->bufs[w->cur].queued = true;
+    qemu_cond_broadcast(&w->cond);
+
+    w->cur = (w->cur + 1) % DUMP_WRITE_BUFS;
+    buf = &w->bufs[w->cur];
+    while (buf->queued) {
+        qemu_cond_wait(&w->cond, &w->lock);
+    }
+    buf->len = 0;
+    buf->offset = w->pos;
+}
+
+static int dump_writer_write(DumpWriter *w, const void *data, size_t size)
+{
+    while (size) {
+        DumpWriteBuf *buf = &w->bufs[w->cur];
+        size_t n = MIN(size, DUMP_WRITE_BUF_SIZE - buf->len);
+
+        if (qatomic_read(&w->error)) {
+            return -qatomic_read(&w->error);
+        }
+        memcpy(buf->data + buf->len, data, n);
+        buf->len += n;
+        w->pos += n;
+        data = (const uint8_t *)data + n;
+        size -= n;
+        if (buf->len == DUMP_WRITE_BUF_SIZE) {
+            dump_writer_submit(w);
+        }
+    }
+
+    return 0;
+}
+
+/* Leave a hole of @size bytes; only for seekable files without O_DIRECT. */
+static int dump_writer_skip(DumpWriter *w, size_t size)
+{
+    assert(w->seekable && !w->direct);
+    if (w->bufs[w->cur].len) {
+        dump_writer_submit(w);
+    }
+    w->pos += size;
+    w->bufs[w->cur].offset = w->pos;
+
+    return -qatomic_read(&w->error);
+}
+
+/* Write out what is left and stop the writers. */
+static void dump_writer_finish(DumpState *s, Error **errp)
+{
+    DumpWriter *w = s->writer;
+    DumpWriteBuf *buf = &w->bufs[w->cur];
+    off_t end = w->pos;
+    unsigned i;
+
+    if (buf->len) {
+        if (w->direct) {
+            /* Pad to the alignment; the padding is truncated away below. */
+            size_t len = ROUND_UP(buf->len, DUMP_WRITE_ALIGN);
+
+            memset(buf->data + buf->len, 0, len - buf->len);
+            buf->len = len;
+        }
+        dump_writer_submit(w);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&w->lock) {
+        w->quit = true;
+        qemu_cond_broadcast(&w->cond);
+    }
+    for (i = 0; i < w->nr_threads; i++) {
+        qemu_thread_join(&w->threads[i]);
+    }
+
+    if (!w->error && w->direct && w->regular && ftruncate(w->fd, end) < 0) {
+        w->error = errno;
+    }
+    if (w->error && errp && !*errp) {
+        error_setg_errno(errp, w->error, "dump: failed to write vmcore");
+    }
+
+    for (i = 0; i < DUMP_WRITE_BUFS; i++) {
+        qemu_vfree(w->bufs[i].data);
+    }
+    qemu_cond_destroy(&w->cond);
+    qemu_mutex_destroy(&w->lock);
+    g_free(w);
+    s->writer = NULL;
+}
+
 static int fd_write_vmcore(const void *buf, size_t size, void *opaque)
 {
     DumpState *s = opaque;
     size_t written_size;
 
+    if (s->writer) {
+        return dump_writer_write(s->writer, buf, size);
+    }
+
     written_size = qemu_write_full(s->fd, buf, size);
     if (written_size != size) {
         return -errno;
@@ -292,9 +540,23 @@ static void write_guest_note(WriteCoreDumpFunction f, DumpState *s,
     }
 }
 
+static void write_incremental_note(WriteCoreDumpFunction f, DumpState *s,
+                                   Error **errp)
+{
+    int ret;
+
+    if (s->incremental_note) {
+        ret = f(s->incremental_note, s->incremental_note_size, s);
+        if (ret < 0) {
+            error_setg(errp, "dump: failed to write incremental dump note");
+        }
+    }
+}
+
 static void write_elf64_notes(WriteCoreDumpFunction f, DumpState *s,
                               Error **errp)
 {
+    ERRP_GUARD();
     CPUState *cpu;
     int ret;
     int id;
@@ -317,6 +579,11 @@ static void write_elf64_notes(WriteCoreDumpFunction f, DumpState *s,
     }
 
     write_guest_note(f, s, errp);
+    if (*errp) {
+        return;
+    }
+
+    write_incremental_note(f, s, errp);
 }
 
 static void prepare_elf32_phdr_note(DumpState *s, Elf32_Phdr *phdr)
@@ -333,6 +600,7 @@ static void prepare_elf32_phdr_note(DumpState *s, Elf32_Phdr *phdr)
 static void write_elf32_notes(WriteCoreDumpFunction f, DumpState *s,
                               Error **errp)
 {
+    ERRP_GUARD();
     CPUState *cpu;
     int ret;
     int id;
@@ -355,6 +623,11 @@ static void write_elf32_notes(WriteCoreDumpFunction f, DumpState *s,
     }
 
     write_guest_note(f, s, errp);
+    if (*errp) {
+        return;
+    }
+
+    write_incremental_note(f, s, errp);
 }
 
 static void write_elf_phdr_note(DumpState *s, Error **errp)
@@ -527,27 +800,50 @@ static void write_data(DumpState *s, void *buf, int length, Error **errp)
     }
 }
 
-/* write the memory to vmcore. 1 page per I/O. */
+/* Longest run of pages written or skipped at once */
+#define DUMP_MAX_RUN (1 * MiB)
+
+/*
+ * write the memory to vmcore, in runs of whole pages. For sparse dumps,
+ * runs of zero pages are skipped and left as holes in the file; the string
+ * table written last makes sure a hole at the end still counts.
+ */
 static void write_memory(DumpState *s, GuestPhysBlock *block, ram_addr_t start,
                          int64_t size, Error **errp)
 {
     ERRP_GUARD();
-    int64_t i;
-
-    for (i = 0; i < size / s->dump_info.page_size; i++) {
-        write_data(s, block->host_addr + start + i * s->dump_info.page_size,
-                   s->dump_info.page_size, errp);
-        if (*errp) {
-            return;
+    const int64_t page_size = s->dump_info.page_size;
+    uint8_t *buf = block->host_addr + start;
+    int64_t done = 0;
+
+    while (done < size) {
+        int64_t len = MIN(page_size, size - done);
+        bool zero = s->sparse && buffer_is_zero(buf + done, len);
+        int64_t run = len;
+
+        while (done + run < size && run < DUMP_MAX_RUN) {
+            len = MIN(page_size, size - done - run);
+            if (s->sparse && buffer_is_zero(buf + done + run, len) != zero) {
+                break;
+            }
+            run += len;
         }
-    }
 
-    if ((size % s->dump_info.page_size) != 0) {
-        write_data(s, block->host_addr + start + i * s->dump_info.page_size,
-                   size % s->dump_info.page_size, errp);
-        if (*errp) {
-            return;
+        if (zero) {
+            int ret = dump_writer_skip(s->writer, run);
+
+            if (ret < 0) {
+                error_setg_errno(errp, -ret, "dump: failed to save memory");
+                return;
+            }
+            s->written_size += run;
+        } else {
+            write_data(s, buf + done, run, errp);
+            if (*errp) {
+                return;
+            }
         }
+        done += run;
     }
 }
 
@@ -802,19 +1098,21 @@ static void create_vmcore(DumpState *s, Error **errp)
 {
     ERRP_GUARD();
 
+    dump_writer_start(s);
+
     dump_begin(s, errp);
-    if (*errp) {
-        return;
-    }
 
     /* Iterate over memory and dump it to file */
-    dump_iterate(s, errp);
-    if (*errp) {
-        return;
+    if (!*errp) {
+        dump_iterate(s, errp);
     }
 
     /* Write the section data */
-    dump_end(s, errp);
+    if (!*errp) {
+        dump_end(s, errp);
+    }
+
+    dump_writer_finish(s, errp);
 }
 
 static int write_start_flat_header(DumpState *s)
@@ -1003,6 +1301,11 @@ static void create_header32(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1114,6 +1417,11 @@ static void create_header64(DumpState *s, Error **errp)
     if (s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) {
         status |= DUMP_DH_COMPRESSED_SNAPPY;
     }
+#endif
+#ifdef CONFIG_ZSTD
+    if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        status |= DUMP_DH_COMPRESSED_ZSTD;
+    }
 #endif
     dh->status = cpu_to_dump32(s, status);
 
@@ -1466,7 +1774,227 @@ static size_t get_len_buf_out(size_t page_size, uint32_t flag_compress)
     case DUMP_DH_COMPRESSED_SNAPPY:
         return snappy_max_compressed_length(page_size);
 #endif
+
+#ifdef CONFIG_ZSTD
+    case DUMP_DH_COMPRESSED_ZSTD:
+        return ZSTD_compressBound(page_size);
+#endif
+    }
+    return 0;
+}
+
+/* Pages handed to the compression workers at once, in pfn order */
+#define DUMP_COMPRESS_BATCH 1024
+
+typedef struct DumpPage {
+    uint8_t *buf;               /* The page, in guest RAM or in @scratch */
+    uint8_t *scratch;           /* For pages that span memory blocks */
+    uint8_t *out;               /* Compressed data */
+    size_t size_out;            /* 0 for a zero page */
+    uint32_t flags;             /* DUMP_DH_COMPRESSED_* used, 0 if none */
+} DumpPage;
+
+typedef struct DumpCompressor {
+    DumpState *s;
+    size_t len_buf_out;
+    unsigned nr_threads;
+    QemuThread *threads;
+    QemuSemaphore work_sem;     /* Posted once per worker for each batch */
+    QemuSemaphore done_sem;     /* Posted by each worker when it is done */
+    bool quit;
+    unsigned nr_pages;          /* Of the current batch */
+    unsigned next;              /* Next page of the batch to compress */
+    DumpPage pages[DUMP_COMPRESS_BATCH];
+} DumpCompressor;
+
+/*
+ * Compress @page with the format of @s. It is left uncompressed if that
+ * fails or does not save anything.
+ */
+static void dump_compress_page(DumpState *s, DumpPage *page,
+                               size_t len_buf_out, void *wrkmem, void *zctx)
+{
+    const size_t page_size = s->dump_info.page_size;
+    size_t size_out = len_buf_out;
+
+    page->flags = 0;
+    if (buffer_is_zero(page->buf, page_size)) {
+        page->size_out = 0;
+        return;
+    }
+
+    if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
+        (compress2(page->out, (uLongf *)&size_out, page->buf, page_size,
+                   Z_BEST_SPEED) == Z_OK)) {
+        page->flags = DUMP_DH_COMPRESSED_ZLIB;
+#ifdef CONFIG_LZO
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
+               (lzo1x_1_compress(page->buf, page_size, page->out,
+                                 (lzo_uint *)&size_out, wrkmem) == LZO_E_OK)) {
+        page->flags = DUMP_DH_COMPRESSED_LZO;
+#endif
+#ifdef CONFIG_SNAPPY
+    } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
+               (snappy_compress((char *)page->buf, page_size,
+                                (char *)page->out, &size_out) == SNAPPY_OK)) {
+        page->flags = DUMP_DH_COMPRESSED_SNAPPY;
+#endif
+#ifdef CONFIG_ZSTD
+    } else if (s->flag_compress & DUMP_DH_COMPRESSED_ZSTD) {
+        size_out = ZSTD_compressCCtx(zctx, page->out, len_buf_out, page->buf,
+                                     page_size, 1);
+        if (!ZSTD_isError(size_out)) {
+            page->flags = DUMP_DH_COMPRESSED_ZSTD;
+        }
+#endif
+    }
+
+    if (!page->flags || size_out >= page_size) {
+        /* fall back to save in plaintext */
+        page->flags = 0;
+        size_out = page_size;
+    }
+    page->size_out = size_out;
+}
+
+/* Compress pages of the current batch until there are none left */
+static void dump_compress_run(DumpCompressor *c, void *wrkmem, void *zctx)
+{
+    unsigned i;
+
+    while ((i = qatomic_fetch_inc(&c->next)) < c->nr_pages) {
+        dump_compress_page(c->s, &c->pages[i], c->len_buf_out, wrkmem, zctx);
+    }
+}
+
+static void *dump_compress_thread(void *opaque)
+{
+    DumpCompressor *c = opaque;
+    void *wrkmem = NULL, *zctx = NULL;
+
+#ifdef CONFIG_LZO
+    wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
+#endif
+#ifdef CONFIG_ZSTD
+    zctx = ZSTD_createCCtx();
+#endif
+
+    for (;;) {
+        qemu_sem_wait(&c->work_sem);
+        if (qatomic_read(&c->quit)) {
+            break;
+        }
+        dump_compress_run(c, wrkmem, zctx);
+        qemu_sem_post(&c->done_sem);
     }
+
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(zctx);
+#endif
+    g_free(wrkmem);
+    return NULL;
+}
+
+static void dump_compressor_init(DumpCompressor *c, DumpState *s,
+                                 size_t len_buf_out)
+{
+    unsigned i;
+
+    c->s = s;
+    c->len_buf_out = len_buf_out;
+    for (i = 0; i < DUMP_COMPRESS_BATCH; i++) {
+        c->pages[i].scratch = g_malloc(s->dump_info.page_size);
+        c->pages[i].out = g_malloc(len_buf_out);
+    }
+
+    /* The dump thread compresses as well. */
+    c->nr_threads = MAX(g_get_num_processors(), 1) - 1;
+    c->threads = g_new(QemuThread, c->nr_threads);
+    qemu_sem_init(&c->work_sem, 0);
+    qemu_sem_init(&c->done_sem, 0);
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_thread_create(&c->threads[i], "dump_compress",
+                           dump_compress_thread, c, QEMU_THREAD_JOINABLE);
+    }
+}
+
+static void dump_compressor_destroy(DumpCompressor *c)
+{
+    unsigned i;
+
+    qatomic_set(&c->quit, true);
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_sem_post(&c->work_sem);
+    }
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_thread_join(&c->threads[i]);
+    }
+    qemu_sem_destroy(&c->work_sem);
+    qemu_sem_destroy(&c->done_sem);
+    g_free(c->threads);
+
+    for (i = 0; i < DUMP_COMPRESS_BATCH; i++) {
+        g_free(c->pages[i].scratch);
+        g_free(c->pages[i].out);
+    }
+}
+
+/* Compress the pages of the batch, using every worker and this thread */
+static void dump_compress_batch(DumpCompressor *c, void *wrkmem, void *zctx)
+{
+    unsigned i;
+
+    qatomic_set(&c->next, 0);
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_sem_post(&c->work_sem);
+    }
+    dump_compress_run(c, wrkmem, zctx);
+    for (i = 0; i < c->nr_threads; i++) {
+        qemu_sem_wait(&c->done_sem);
+    }
+}
+
+/* Write the compressed pages of the batch and their descriptors, in order */
+static int write_dump_batch(DumpState *s, DumpCompressor *c,
+                            DataCache *page_desc, DataCache *page_data,
+                            const PageDescriptor *pd_zero, off_t *offset_data,
+                            Error **errp)
+{
+    PageDescriptor pd;
+    unsigned i;
+
+    for (i = 0; i < c->nr_pages; i++) {
+        DumpPage *page = &c->pages[i];
+
+        if (!page->size_out) {
+            if (write_cache(page_desc, pd_zero, sizeof(PageDescriptor),
+                            false) < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return -1;
+            }
+        } else {
+            if (write_cache(page_data, page->flags ? page->out : page->buf,
+                            page->size_out, false) < 0) {
+                error_setg(errp, "dump: failed to write page data");
+                return -1;
+            }
+
+            pd.flags = cpu_to_dump32(s, page->flags);
+            pd.size = cpu_to_dump32(s, page->size_out);
+            pd.page_flags = cpu_to_dump64(s, 0);
+            pd.offset = cpu_to_dump64(s, *offset_data);
+            *offset_data += page->size_out;
+
+            if (write_cache(page_desc, &pd, sizeof(PageDescriptor),
+                            false) < 0) {
+                error_setg(errp, "dump: failed to write page desc");
+                return -1;
+            }
+        }
+        s->written_size += s->dump_info.page_size;
+    }
+    c->nr_pages = 0;
+
     return 0;
 }
 
@@ -1474,17 +2002,14 @@ static void write_dump_pages(DumpState *s, Error **errp)
 {
     int ret = 0;
     DataCache page_desc, page_data;
-    size_t len_buf_out, size_out;
-#ifdef CONFIG_LZO
-    lzo_bytep wrkmem = NULL;
-#endif
-    uint8_t *buf_out = NULL;
+    size_t len_buf_out;
+    void *wrkmem = NULL, *zctx = NULL;
     off_t offset_desc, offset_data;
-    PageDescriptor pd, pd_zero;
+    PageDescriptor pd_zero;
     uint8_t *buf;
     GuestPhysBlock *block_iter = NULL;
     uint64_t pfn_iter;
-    g_autofree uint8_t *page = NULL;
+    g_autofree DumpCompressor *c = g_new0(DumpCompressor, 1);
 
     /* get offset of page_desc and page_data in dump file */
     offset_desc = s->offset_page;
@@ -1500,8 +2025,9 @@ static void write_dump_pages(DumpState *s, Error **errp)
 #ifdef CONFIG_LZO
     wrkmem = g_malloc(LZO1X_1_MEM_COMPRESS);
 #endif
-
-    buf_out = g_malloc(len_buf_out);
+#ifdef CONFIG_ZSTD
+    zctx = ZSTD_createCCtx();
+#endif
 
     /*
      * init zero page's page_desc and page_data, because every zero page
@@ -1520,125 +2046,62 @@ static void write_dump_pages(DumpState *s, Error **errp)
     }
 
     offset_data += s->dump_info.page_size;
-    page = g_malloc(s->dump_info.page_size);
+    dump_compressor_init(c, s, len_buf_out);
 
     /*
-     * dump memory to vmcore page by page. zero page will all be resided in the
-     * first page of page section
+     * dump memory to vmcore batch by batch. zero page will all be resided in
+     * the first page of page section. Only one compression format will be
+     * used, for s->flag_compress is set. But when compression fails to work,
+     * we fall back to save in plaintext.
      */
-    for (buf = page; get_next_page(&block_iter, &pfn_iter, &buf, s); buf = page) {
-        /* check zero page */
-        if (buffer_is_zero(buf, s->dump_info.page_size)) {
-            ret = write_cache(&page_desc, &pd_zero, sizeof(PageDescriptor),
-                              false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
-        } else {
-            /*
-             * not zero page, then:
-             * 1. compress the page
-             * 2. write the compressed page into the cache of page_data
-             * 3. get page desc of the compressed page and write it into the
-             *    cache of page_desc
-             *
-             * only one compression format will be used here, for
-             * s->flag_compress is set. But when compression fails to work,
-             * we fall back to save in plaintext.
-             */
-             size_out = len_buf_out;
-             if ((s->flag_compress & DUMP_DH_COMPRESSED_ZLIB) &&
-                    (compress2(buf_out, (uLongf *)&size_out, buf,
-                               s->dump_info.page_size, Z_BEST_SPEED) == Z_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_ZLIB);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#ifdef CONFIG_LZO
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_LZO) &&
-                    (lzo1x_1_compress(buf, s->dump_info.page_size, buf_out,
-                    (lzo_uint *)&size_out, wrkmem) == LZO_E_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_LZO);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-#ifdef CONFIG_SNAPPY
-            } else if ((s->flag_compress & DUMP_DH_COMPRESSED_SNAPPY) &&
-                    (snappy_compress((char *)buf, s->dump_info.page_size,
-                    (char *)buf_out, &size_out) == SNAPPY_OK) &&
-                    (size_out < s->dump_info.page_size)) {
-                pd.flags = cpu_to_dump32(s, DUMP_DH_COMPRESSED_SNAPPY);
-                pd.size  = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf_out, size_out, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-#endif
-            } else {
-                /*
-                 * fall back to save in plaintext, size_out should be
-                 * assigned the target's page size
-                 */
-                pd.flags = cpu_to_dump32(s, 0);
-                size_out = s->dump_info.page_size;
-                pd.size = cpu_to_dump32(s, size_out);
-
-                ret = write_cache(&page_data, buf,
-                                  s->dump_info.page_size, false);
-                if (ret < 0) {
-                    error_setg(errp, "dump: failed to write page data");
-                    goto out;
-                }
-            }
+    for (;;) {
+        DumpPage *page = &c->pages[c->nr_pages];
 
-            /* get and write page desc here */
-            pd.page_flags = cpu_to_dump64(s, 0);
-            pd.offset = cpu_to_dump64(s, offset_data);
-            offset_data += size_out;
+        buf = page->scratch;
+        if (!get_next_page(&block_iter, &pfn_iter, &buf, s)) {
+            break;
+        }
+        page->buf = buf;
+        if (++c->nr_pages < DUMP_COMPRESS_BATCH) {
+            continue;
+        }
 
-            ret = write_cache(&page_desc, &pd, sizeof(PageDescriptor), false);
-            if (ret < 0) {
-                error_setg(errp, "dump: failed to write page desc");
-                goto out;
-            }
+        dump_compress_batch(c, wrkmem, zctx);
+        ret = write_dump_batch(s, c, &page_desc, &page_data, &pd_zero,
+                               &offset_data, errp);
+        if (ret < 0) {
+            goto out_compressor;
         }
-        s->written_size += s->dump_info.page_size;
+    }
+
+    dump_compress_batch(c, wrkmem, zctx);
+    ret = write_dump_batch(s, c, &page_desc, &page_data, &pd_zero,
+                           &offset_data, errp);
+    if (ret < 0) {
+        goto out_compressor;
     }
 
     ret = write_cache(&page_desc, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_desc");
-        goto out;
+        goto out_compressor;
     }
     ret = write_cache(&page_data, NULL, 0, true);
     if (ret < 0) {
         error_setg(errp, "dump: failed to sync cache for page_data");
-        goto out;
+        goto out_compressor;
     }
 
+out_compressor:
+    dump_compressor_destroy(c);
 out:
     free_data_cache(&page_desc);
     free_data_cache(&page_data);
 
-#ifdef CONFIG_LZO
-    g_free(wrkmem);
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(zctx);
 #endif
-
-    g_free(buf_out);
+    g_free(wrkmem);
 }
 
 static void create_kdump_vmcore(DumpState *s, Error **errp)
@@ -1701,7 +2164,9 @@ static void get_max_mapnr(DumpState *s)
     GuestPhysBlock *last_block;
 
     last_block = QTAILQ_LAST(&s->guest_phys_blocks.head);
-    s->max_mapnr = dump_paddr_to_pfn(s, last_block->target_end);
+    /* An incremental dump may have no memory at all */
+    s->max_mapnr = last_block ? dump_paddr_to_pfn(s, last_block->target_end)
+                              : 0;
 }
 
 static DumpState dump_state_global = { .status = DUMP_STATUS_NONE };
@@ -1777,14 +2242,146 @@ static void vmcoreinfo_update_phys_base(DumpState *s)
     g_strfreev(lines);
 }
 
+/* Called with the BQL held. */
+static void dump_incremental_end(void)
+{
+    if (dump_incremental_chain) {
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_DUMP);
+        migrate_del_blocker(&dump_incremental_blocker);
+        dump_incremental_chain = 0;
+    }
+}
+
+/*
+ * Take the pages written since the previous dump of the chain out of the
+ * dirty log. Unless @full, also replace the blocks of @s by the runs of
+ * those pages.
+ */
+static void dump_incremental_filter(DumpState *s, bool full)
+{
+    const uint64_t page_size = qemu_target_page_size();
+    GuestPhysBlockList dirty;
+    GuestPhysBlock *block;
+
+    guest_phys_blocks_init(&dirty);
+    memory_global_dirty_log_sync(false);
+
+    QTAILQ_FOREACH(block, &s->guest_phys_blocks.head, next) {
+        const hwaddr size = block->target_end - block->target_start;
+        const ram_addr_t offset = block->host_addr -
+            (uint8_t *)memory_region_get_ram_ptr(block->mr);
+        DirtyBitmapSnapshot *snap;
+        hwaddr run = 0, addr, end;
+
+        snap = memory_region_snapshot_and_clear_dirty(block->mr, offset, size,
+                                                      DIRTY_MEMORY_MIGRATION);
+        for (addr = 0; !full && run < size; addr += page_size) {
+            GuestPhysBlock *r;
+
+            if (addr < size &&
+                memory_region_snapshot_get_dirty(block->mr, snap,
+                                                 offset + addr, page_size)) {
+                continue;
+            }
+            end = MIN(addr, size);
+            if (end > run) {
+                r = g_new0(GuestPhysBlock, 1);
+                r->target_start = block->target_start + run;
+                r->target_end = block->target_start + end;
+                r->host_addr = block->host_addr + run;
+                r->mr = block->mr;
+                memory_region_ref(r->mr);
+                QTAILQ_INSERT_TAIL(&dirty.head, r, next);
+                dirty.num++;
+            }
+            run = addr + page_size;
+        }
+        g_free(snap);
+    }
+
+    if (!full) {
+        guest_phys_blocks_free(&s->guest_phys_blocks);
+        while ((block = QTAILQ_FIRST(&dirty.head))) {
+            QTAILQ_REMOVE(&dirty.head, block, next);
+            QTAILQ_INSERT_TAIL(&s->guest_phys_blocks.head, block, next);
+        }
+        s->guest_phys_blocks.num = dirty.num;
+    }
+}
+
+static void dump_prepare_incremental_note(DumpState *s)
+{
+    const size_t name_size = sizeof(DUMP_INCREMENTAL_NOTE_NAME);
+    DumpIncrementalNote *desc;
+    Elf64_Nhdr *nhdr;           /* Same layout as Elf32_Nhdr */
+
+    s->incremental_note_size = ELF_NOTE_SIZE(sizeof(*nhdr), name_size,
+                                             sizeof(*desc));
+    s->incremental_note = g_malloc0(s->incremental_note_size);
+
+    nhdr = (Elf64_Nhdr *)s->incremental_note;
+    nhdr->n_namesz = cpu_to_dump32(s, name_size);
+    nhdr->n_descsz = cpu_to_dump32(s, sizeof(*desc));
+    memcpy(s->incremental_note + sizeof(*nhdr), DUMP_INCREMENTAL_NOTE_NAME,
+           name_size);
+
+    desc = (void *)(s->incremental_note + sizeof(*nhdr) +
+                    ROUND_UP(name_size, 4));
+    desc->chain = cpu_to_dump64(s, dump_incremental_chain);
+    desc->seq = cpu_to_dump64(s, dump_incremental_seq);
+
+    s->note_size += s->incremental_note_size;
+}
+
+/*
+ * Open a chain with a full dump, or add a dump of the pages written since
+ * the previous one. Called with the BQL held and the VM stopped.
+ */
+static bool dump_incremental_begin(DumpState *s, Error **errp)
+{
+    bool full = !dump_incremental_chain;
+
+    if (full) {
+        /* Others would clear the dirty log for their own purposes. */
+        if (global_dirty_tracking &
+            (GLOBAL_DIRTY_MIGRATION | GLOBAL_DIRTY_PCILEECH)) {
+            error_setg(errp, "dump: the dirty log is in use");
+            return false;
+        }
+        error_setg(&dump_incremental_blocker, "Live migration disabled: "
+                   "incremental dump-guest-memory chain open");
+        if (migrate_add_blocker_internal(&dump_incremental_blocker, errp)) {
+            return false;
+        }
+        if (!memory_global_dirty_log_start(GLOBAL_DIRTY_DUMP, errp)) {
+            migrate_del_blocker(&dump_incremental_blocker);
+            return false;
+        }
+        do {
+            dump_incremental_chain = (uint64_t)g_random_int() << 32 |
+                                     g_random_int();
+        } while (!dump_incremental_chain);
+        dump_incremental_seq = 0;
+    }
+
+    dump_incremental_filter(s, full);
+    s->total_size = dump_calculate_size(s);
+    s->incremental = true;
+    dump_prepare_incremental_note(s);
+    dump_incremental_seq++;
+
+    return true;
+}
+
 static void dump_init(DumpState *s, int fd, bool has_format,
                       DumpGuestMemoryFormat format, bool paging, bool has_filter,
                       int64_t begin, int64_t length, bool kdump_raw,
-                      Error **errp)
+                      bool incremental, bool direct, Error **errp)
 {
     ERRP_GUARD();
     VMCoreInfoState *vmci = vmcoreinfo_find();
     CPUState *cpu;
+    struct stat st;
     int nr_cpus;
     int ret;
 
@@ -1815,6 +2412,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
     }
 
     s->fd = fd;
+    /* Zero pages of ELF dumps can be skipped by seeking in a regular file. */
+    s->direct = direct;
+    s->sparse = (!has_format || format == DUMP_GUEST_MEMORY_FORMAT_ELF) &&
+                !direct && !fstat(fd, &st) && S_ISREG(st.st_mode);
     if (has_filter && !length) {
         error_setg(errp, "parameter 'length' expects a non-zero size");
         goto cleanup;
@@ -1906,6 +2507,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
         }
     }
 
+    if (incremental && !dump_incremental_begin(s, errp)) {
+        goto cleanup;
+    }
+
     /* get memory mapping */
     if (paging) {
         qemu_get_guest_memory_mapping(&s->list, &s->guest_phys_blocks, errp);
@@ -1946,6 +2551,10 @@ static void dump_init(DumpState *s, int fd, bool has_format,
             s->flag_compress = DUMP_DH_COMPRESSED_SNAPPY;
             break;
 
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD:
+            s->flag_compress = DUMP_DH_COMPRESSED_ZSTD;
+            break;
+
         default:
             s->flag_compress = 0;
         }
@@ -2066,6 +2675,8 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
                            bool has_begin, int64_t begin,
                            bool has_length, int64_t length,
                            bool has_format, DumpGuestMemoryFormat format,
+                           bool has_incremental, bool incremental,
+                           bool has_direct, bool direct,
                            Error **errp)
 {
     ERRP_GUARD();
@@ -2105,6 +2716,10 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
             format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_SNAPPY;
             kdump_raw = true;
             break;
+        case DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_ZSTD:
+            format = DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD;
+            kdump_raw = true;
+            break;
         default:
             break;
         }
@@ -2131,6 +2746,25 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
     if (has_detach) {
         detach_p = detach;
     }
+    if (incremental &&
+        ((has_format && format != DUMP_GUEST_MEMORY_FORMAT_ELF) ||
+         paging || has_begin)) {
+        error_setg(errp, "incremental dumps must be ELF, without paging or "
+                         "filter");
+        return;
+    }
+    if (direct && has_format && format != DUMP_GUEST_MEMORY_FORMAT_ELF) {
+        error_setg(errp, "O_DIRECT is only supported for ELF dumps");
+        return;
+    }
+    if (direct && !qemu_has_direct_io()) {
+        error_setg(errp, "O_DIRECT is not supported on this host");
+        return;
+    }
+    if (direct && !strstart(protocol, "file:", NULL)) {
+        error_setg(errp, "O_DIRECT dumps need the 'file:' protocol");
+        return;
+    }
 
     /* check whether lzo/snappy is supported */
 #ifndef CONFIG_LZO
@@ -2147,6 +2781,13 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
     }
 #endif
 
+#ifndef CONFIG_ZSTD
+    if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD) {
+        error_setg(errp, "kdump-zstd is not available now");
+        return;
+    }
+#endif
+
     if (has_format && format == DUMP_GUEST_MEMORY_FORMAT_WIN_DMP
         && !win_dump_available(errp)) {
         return;
@@ -2158,7 +2799,14 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
             return;
         }
     } else if  (strstart(protocol, "file:", &p)) {
-        fd = qemu_create(p, O_WRONLY | O_TRUNC | O_BINARY, S_IRUSR, errp);
+        int flags = O_WRONLY | O_TRUNC | O_BINARY;
+
+#ifdef O_DIRECT
+        if (direct) {
+            flags |= O_DIRECT;
+        }
+#endif
+        fd = qemu_create(p, flags, S_IRUSR, errp);
         if (fd < 0) {
             return;
         }
@@ -2191,8 +2839,13 @@ void qmp_dump_guest_memory(bool paging, const char *protocol,
     s = &dump_state_global;
     dump_state_prepare(s);
 
+    if (!incremental) {
+        /* A regular dump closes the chain. */
+        dump_incremental_end();
+    }
+
     dump_init(s, fd, has_format, format, paging, has_begin,
-              begin, length, kdump_raw, errp);
+              begin, length, kdump_raw, incremental, direct, errp);
     if (*errp) {
         qatomic_set(&s->status, DUMP_STATUS_FAILED);
         return;
@@ -2234,6 +2887,12 @@ DumpGuestMemoryCapability *qmp_query_dump_guest_memory_capability(Error **errp)
     QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_SNAPPY);
 #endif
 
+    /* add new item if kdump-zstd is available */
+#ifdef CONFIG_ZSTD
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_ZSTD);
+    QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_KDUMP_RAW_ZSTD);
+#endif
+
     if (win_dump_available(NULL)) {
         QAPI_LIST_APPEND(tail, DUMP_GUEST_MEMORY_FORMAT_WIN_DMP);
     }
@@ -42,6 +42,22 @@ bool ebpf_rss_set_all(struct EBPFRSSContext *ctx, struct EBPFRSSConfig *config,
     return false;
 }
 
+bool ebpf_rss_has_flow_table(struct EBPFRSSContext *ctx)
+{
+    return false;
+}
+
+void ebpf_rss_set_flow(struct EBPFRSSContext *ctx,
+                       const struct EBPFRSSFlowKey *key, uint16_t queue)
+{
+
+}
+
+void ebpf_rss_clear_flows(struct EBPFRSSContext *ctx)
+{
+
+}
+
 void ebpf_rss_unload(struct EBPFRSSContext *ctx)
 {
 
@@ -12,6 +12,8 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/atomic.h"
+#include "qemu/crc32c.h"
 #include "qemu/error-report.h"
 #include "qapi/qapi-types-misc.h"
 #include "qapi/qapi-commands-ebpf.h"
@@ -35,10 +37,12 @@ void ebpf_rss_init(struct EBPFRSSContext *ctx)
         ctx->map_configuration = -1;
         ctx->map_toeplitz_key = -1;
         ctx->map_indirections_table = -1;
+        ctx->map_flow_table = -1;
 
         ctx->mmap_configuration = NULL;
         ctx->mmap_toeplitz_key = NULL;
         ctx->mmap_indirections_table = NULL;
+        ctx->flow_cache = NULL;
     }
 }
 
@@ -105,6 +109,7 @@ static void ebpf_rss_munmap(struct EBPFRSSContext *ctx)
 bool ebpf_rss_load(struct EBPFRSSContext *ctx, Error **errp)
 {
     struct rss_bpf *rss_bpf_ctx;
+    struct bpf_map *flow_table;
 
     if (ebpf_rss_is_loaded(ctx)) {
         return false;
@@ -135,6 +140,17 @@ bool ebpf_rss_load(struct EBPFRSSContext *ctx, Error **errp)
     ctx->map_toeplitz_key = bpf_map__fd(
             rss_bpf_ctx->maps.tap_rss_map_toeplitz_key);
 
+    /*
+     * The flow table is optional, look it up by name so that a skeleton
+     * generated without it still loads.
+     */
+    flow_table = bpf_object__find_map_by_name(rss_bpf_ctx->obj,
+                                              "tap_rss_map_flow_table");
+    if (flow_table) {
+        ctx->map_flow_table = bpf_map__fd(flow_table);
+        ctx->flow_cache = g_new0(uint32_t, EBPF_RSS_FLOW_CACHE_SIZE);
+    }
+
     trace_ebpf_rss_load(ctx,
                         ctx->program_fd,
                         ctx->map_configuration,
@@ -152,6 +168,9 @@ error:
     ctx->map_configuration = -1;
     ctx->map_toeplitz_key = -1;
     ctx->map_indirections_table = -1;
+    ctx->map_flow_table = -1;
+    g_free(ctx->flow_cache);
+    ctx->flow_cache = NULL;
 
     return false;
 }
@@ -279,6 +298,57 @@ bool ebpf_rss_set_all(struct EBPFRSSContext *ctx, struct EBPFRSSConfig *config,
     return true;
 }
 
+bool ebpf_rss_has_flow_table(struct EBPFRSSContext *ctx)
+{
+    return ebpf_rss_is_loaded(ctx) && ctx->map_flow_table != -1;
+}
+
+/*
+ * Steer received packets of the flow @key to @queue.  This is called
+ * for transmitted packets, possibly from several threads at once, so
+ * the map is only updated when the flow is new or moved to another
+ * queue.  The cache is just a hint: a lost race or a collision costs at
+ * most an extra or a delayed update.
+ */
+void ebpf_rss_set_flow(struct EBPFRSSContext *ctx,
+                       const struct EBPFRSSFlowKey *key, uint16_t queue)
+{
+    uint32_t hash = crc32c(0xffffffff, (const uint8_t *)key, sizeof(*key));
+    uint32_t *slot = &ctx->flow_cache[hash % EBPF_RSS_FLOW_CACHE_SIZE];
+    /* the low bits of the hash select the slot, the high ones tag it */
+    uint32_t entry = (hash & 0xffff0000) | (uint16_t)(queue + 1);
+
+    if (qatomic_read(slot) == entry) {
+        return;
+    }
+
+    if (bpf_map_update_elem(ctx->map_flow_table, key, &queue, BPF_ANY)) {
+        trace_ebpf_rss_set_flow_error(ctx, errno);
+        return;
+    }
+    qatomic_set(slot, entry);
+    trace_ebpf_rss_set_flow(ctx, hash, queue);
+}
+
+/* Forget all flows, e.g. because the queues they point to went away */
+void ebpf_rss_clear_flows(struct EBPFRSSContext *ctx)
+{
+    struct EBPFRSSFlowKey key;
+
+    if (!ebpf_rss_has_flow_table(ctx)) {
+        return;
+    }
+
+    while (!bpf_map_get_next_key(ctx->map_flow_table, NULL, &key)) {
+        if (bpf_map_delete_elem(ctx->map_flow_table, &key)) {
+            break;
+        }
+    }
+    for (int i = 0; i < EBPF_RSS_FLOW_CACHE_SIZE; i++) {
+        qatomic_set(&ctx->flow_cache[i], 0);
+    }
+}
+
 void ebpf_rss_unload(struct EBPFRSSContext *ctx)
 {
     if (!ebpf_rss_is_loaded(ctx)) {
@@ -297,12 +367,15 @@ void ebpf_rss_unload(struct EBPFRSSContext *ctx)
         close(ctx->map_toeplitz_key);
         close(ctx->map_indirections_table);
     }
+    g_free(ctx->flow_cache);
 
     ctx->obj = NULL;
     ctx->program_fd = -1;
     ctx->map_configuration = -1;
     ctx->map_toeplitz_key = -1;
     ctx->map_indirections_table = -1;
+    ctx->map_flow_table = -1;
+    ctx->flow_cache = NULL;
 }
 
 ebpf_binary_init(EBPF_PROGRAM_ID_RSS, rss_bpf__elf_bytes)
@@ -17,6 +17,7 @@
 #include "qapi/error.h"
 
 #define EBPF_RSS_MAX_FDS 4
+#define EBPF_RSS_FLOW_CACHE_SIZE 1024
 
 struct EBPFRSSContext {
     void *obj;
@@ -24,11 +25,15 @@ struct EBPFRSSContext {
     int map_configuration;
     int map_toeplitz_key;
     int map_indirections_table;
+    int map_flow_table;     /* -1 if flow steering is not available */
 
     /* mapped eBPF maps for direct access to omit bpf_map_update_elem() */
     void *mmap_configuration;
     void *mmap_toeplitz_key;
     void *mmap_indirections_table;
+
+    /* recently updated flows, see ebpf_rss_set_flow() */
+    uint32_t *flow_cache;
 };
 
 struct EBPFRSSConfig {
@@ -37,8 +42,24 @@ struct EBPFRSSConfig {
     uint32_t hash_types;
     uint16_t indirections_len;
     uint16_t default_queue;
+    uint8_t flow_steering;
 } __attribute__((packed));
 
+/*
+ * A TCP or UDP flow, with source and destination as seen by received
+ * packets.  Ports and addresses are in network byte order, IPv4
+ * addresses take the first 4 bytes of @src and @dst.
+ */
+struct EBPFRSSFlowKey {
+    uint8_t is_ipv6;
+    uint8_t is_tcp;
+    uint16_t src_port;
+    uint16_t dst_port;
+    uint16_t reserved;
+    uint8_t src[16];
+    uint8_t dst[16];
+};
+
 void ebpf_rss_init(struct EBPFRSSContext *ctx);
 
 bool ebpf_rss_is_loaded(struct EBPFRSSContext *ctx);
@@ -53,6 +74,13 @@ bool ebpf_rss_set_all(struct EBPFRSSContext *ctx, struct EBPFRSSConfig *config,
                       uint16_t *indirections_table, uint8_t *toeplitz_key,
                       Error **errp);
 
+bool ebpf_rss_has_flow_table(struct EBPFRSSContext *ctx);
+
+void ebpf_rss_set_flow(struct EBPFRSSContext *ctx,
+                       const struct EBPFRSSFlowKey *key, uint16_t queue);
+
+void ebpf_rss_clear_flows(struct EBPFRSSContext *ctx);
+
 void ebpf_rss_unload(struct EBPFRSSContext *ctx);
 
 #endif /* QEMU_EBPF_RSS_H */
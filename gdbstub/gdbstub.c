@@ -45,6 +45,7 @@
 #include "sysemu/runstate.h"
 #include "exec/replay-core.h"
 #include "exec/hwaddr.h"
+#include "exec/target_page.h"
 
 #include "internals.h"
 
@@ -1238,6 +1239,40 @@ static void handle_get_reg(GArray *params, void *user_ctx)
     gdb_put_strbuf();
 }
 
+/*
+ * Read up to @len bytes at @addr into gdbserver_state.mem_buf.  If the
+ * whole range cannot be read, read as many pages from its start as
+ * possible: the 'm' and 'x' replies may be shorter than requested, and
+ * the client asks again for the rest.  Returns false if nothing at all
+ * could be read.
+ */
+static bool gdb_read_memory(hwaddr addr, size_t len)
+{
+    GByteArray *buf = gdbserver_state.mem_buf;
+    size_t page_size = qemu_target_page_size();
+    size_t done = 0;
+
+    g_byte_array_set_size(buf, len);
+    if (!gdb_target_memory_rw_debug(gdbserver_state.g_cpu, addr,
+                                    buf->data, len, false)) {
+        return true;
+    }
+
+    while (done < len) {
+        size_t chunk = MIN(len - done,
+                           page_size - ((addr + done) & (page_size - 1)));
+
+        if (gdb_target_memory_rw_debug(gdbserver_state.g_cpu, addr + done,
+                                       buf->data + done, chunk, false)) {
+            break;
+        }
+        done += chunk;
+    }
+    g_byte_array_set_size(buf, done);
+
+    return done > 0;
+}
+
 static void handle_write_mem(GArray *params, void *user_ctx)
 {
     if (params->len != 3) {
@@ -1278,13 +1313,8 @@ static void handle_read_mem(GArray *params, void *user_ctx)
         return;
     }
 
-    g_byte_array_set_size(gdbserver_state.mem_buf,
-                          gdb_get_cmd_param(params, 1)->val_ull);
-
-    if (gdb_target_memory_rw_debug(gdbserver_state.g_cpu,
-                                   gdb_get_cmd_param(params, 0)->val_ull,
-                                   gdbserver_state.mem_buf->data,
-                                   gdbserver_state.mem_buf->len, false)) {
+    if (!gdb_read_memory(gdb_get_cmd_param(params, 0)->val_ull,
+                         gdb_get_cmd_param(params, 1)->val_ull)) {
         gdb_put_packet("E14");
         return;
     }
@@ -1294,6 +1324,61 @@ static void handle_read_mem(GArray *params, void *user_ctx)
     gdb_put_strbuf();
 }
 
+static void handle_bin_write_mem(GArray *params, void *user_ctx)
+{
+    char *line_end = gdbserver_state.line_buf + gdbserver_state.line_buf_index;
+    uint64_t len;
+    char *data;
+
+    if (params->len != 2) {
+        gdb_put_packet("E22");
+        return;
+    }
+
+    /* The data can contain NULs, so it is not part of the parameters */
+    data = memchr(gdbserver_state.line_buf, ':',
+                  gdbserver_state.line_buf_index);
+    len = gdb_get_cmd_param(params, 1)->val_ull;
+    if (!data || len > line_end - (data + 1)) {
+        gdb_put_packet("E22");
+        return;
+    }
+    data++;
+
+    if (gdb_target_memory_rw_debug(gdbserver_state.g_cpu,
+                                   gdb_get_cmd_param(params, 0)->val_ull,
+                                   (uint8_t *)data, len, true)) {
+        gdb_put_packet("E14");
+        return;
+    }
+
+    gdb_put_packet("OK");
+}
+
+static void handle_bin_read_mem(GArray *params, void *user_ctx)
+{
+    uint64_t len;
+
+    if (params->len != 2) {
+        gdb_put_packet("E22");
+        return;
+    }
+
+    /* Escaping can double the size, but the client accepts long replies */
+    len = MIN(gdb_get_cmd_param(params, 1)->val_ull, MAX_PACKET_LENGTH);
+    if (!gdb_read_memory(gdb_get_cmd_param(params, 0)->val_ull, len)) {
+        gdb_put_packet("E14");
+        return;
+    }
+
+    g_string_assign(gdbserver_state.str_buf, "b");
+    gdb_memtox(gdbserver_state.str_buf,
+               (const char *)gdbserver_state.mem_buf->data,
+               gdbserver_state.mem_buf->len);
+    gdb_put_packet_binary(gdbserver_state.str_buf->str,
+                          gdbserver_state.str_buf->len, true);
+}
+
 static void handle_write_all_regs(GArray *params, void *user_ctx)
 {
     int reg_id;
@@ -1649,6 +1734,7 @@ static void handle_query_supported(GArray *params, void *user_ctx)
     CPUClass *cc;
 
     g_string_printf(gdbserver_state.str_buf, "PacketSize=%x", MAX_PACKET_LENGTH);
+    g_string_append(gdbserver_state.str_buf, ";binary-upload+");
     cc = CPU_GET_CLASS(first_cpu);
     if (cc->gdb_core_xml_file) {
         g_string_append(gdbserver_state.str_buf, ";qXfer:features:read+");
@@ -2182,6 +2268,28 @@ static int gdb_handle_packet(const char *line_buf)
             cmd_parser = &write_mem_cmd_desc;
         }
         break;
+    case 'x':
+        {
+            static const GdbCmdParseEntry bin_read_mem_cmd_desc = {
+                .handler = handle_bin_read_mem,
+                .cmd = "x",
+                .cmd_startswith = true,
+                .schema = "L,L0"
+            };
+            cmd_parser = &bin_read_mem_cmd_desc;
+        }
+        break;
+    case 'X':
+        {
+            static const GdbCmdParseEntry bin_write_mem_cmd_desc = {
+                .handler = handle_bin_write_mem,
+                .cmd = "X",
+                .cmd_startswith = true,
+                .schema = "L,L:"
+            };
+            cmd_parser = &bin_write_mem_cmd_desc;
+        }
+        break;
     case 'p':
         {
             static const GdbCmdParseEntry get_reg_cmd_desc = {
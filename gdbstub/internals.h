@@ -11,7 +11,11 @@
 
 #include "exec/cpu-common.h"
 
-#define MAX_PACKET_LENGTH 4096
+/*
+ * Also the PacketSize we advertise: large enough for memory transfers
+ * of a few hundred kilobytes per round trip.
+ */
+#define MAX_PACKET_LENGTH (128 * 1024)
 
 /*
  * Shared structures and definitions
@@ -296,6 +296,20 @@ SRST
     being coalesced.
 ERST
 
+    {
+        .name       = "rcu",
+        .args_type  = "",
+        .params     = "",
+        .help       = "show RCU callback backlog and grace period statistics",
+        .cmd        = hmp_info_rcu,
+    },
+
+SRST
+  ``info rcu``
+    Show how many RCU callbacks wait for a grace period, the largest batch
+    seen so far, and how many grace periods were expedited.
+ERST
+
     {
         .name       = "kvm",
         .args_type  = "",
@@ -0,0 +1,129 @@
+/*
+ * AArch64 specific acceleration of the out-of-line gvec helpers.
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Each NAME_accel() function processes the leading part of a vector
+ * operation with host vector instructions and returns the number of
+ * bytes it handled; the caller's C loop does the rest.  Only whole
+ * 16-byte vectors are handled here, since oprsz may be 8.
+ */
+
+#ifndef AARCH64_HOST_GVEC_ACCEL_H
+#define AARCH64_HOST_GVEC_ACCEL_H
+
+#ifdef __ARM_NEON
+#include <arm_neon.h>
+
+#define GVEC_ACCEL_3(NAME, LD, ST, OP)                                  \
+static inline intptr_t NAME##_accel(void *d, void *a, void *b,          \
+                                    intptr_t oprsz)                     \
+{                                                                       \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i + 16 <= oprsz; i += 16) {                             \
+        ST(d + i, OP(LD(a + i), LD(b + i)));                            \
+    }                                                                   \
+    return i;                                                           \
+}
+
+/* Right shifts are left shifts by a negative count.  */
+#define GVEC_ACCEL_SHIFT(NAME, LD, ST, SHL, DUP, SIGN)                  \
+static inline intptr_t NAME##_accel(void *d, void *a, int shift,        \
+                                    intptr_t oprsz)                     \
+{                                                                       \
+    intptr_t i;                                                         \
+                                                                        \
+    for (i = 0; i + 16 <= oprsz; i += 16) {                             \
+        ST(d + i, SHL(LD(a + i), DUP(SIGN shift)));                     \
+    }                                                                   \
+    return i;                                                           \
+}
+
+#define GVEC_ACCEL_INT(SZ)                                              \
+GVEC_ACCEL_3(gvec_ssadd##SZ, vld1q_s##SZ, vst1q_s##SZ, vqaddq_s##SZ)    \
+GVEC_ACCEL_3(gvec_sssub##SZ, vld1q_s##SZ, vst1q_s##SZ, vqsubq_s##SZ)    \
+GVEC_ACCEL_3(gvec_usadd##SZ, vld1q_u##SZ, vst1q_u##SZ, vqaddq_u##SZ)    \
+GVEC_ACCEL_3(gvec_ussub##SZ, vld1q_u##SZ, vst1q_u##SZ, vqsubq_u##SZ)    \
+GVEC_ACCEL_3(gvec_eq##SZ, vld1q_u##SZ, vst1q_u##SZ, vceqq_u##SZ)        \
+GVEC_ACCEL_3(gvec_ne##SZ, vld1q_u##SZ, vst1q_u##SZ, gvec_vneq_u##SZ)    \
+GVEC_ACCEL_3(gvec_lt##SZ, vld1q_s##SZ, vst1q_u##SZ, vcltq_s##SZ)        \
+GVEC_ACCEL_3(gvec_le##SZ, vld1q_s##SZ, vst1q_u##SZ, vcleq_s##SZ)        \
+GVEC_ACCEL_3(gvec_ltu##SZ, vld1q_u##SZ, vst1q_u##SZ, vcltq_u##SZ)       \
+GVEC_ACCEL_3(gvec_leu##SZ, vld1q_u##SZ, vst1q_u##SZ, vcleq_u##SZ)       \
+GVEC_ACCEL_SHIFT(gvec_shl##SZ, vld1q_u##SZ, vst1q_u##SZ,                \
+                 vshlq_u##SZ, vdupq_n_s##SZ, )                          \
+GVEC_ACCEL_SHIFT(gvec_shr##SZ, vld1q_u##SZ, vst1q_u##SZ,                \
+                 vshlq_u##SZ, vdupq_n_s##SZ, -)                         \
+GVEC_ACCEL_SHIFT(gvec_sar##SZ, vld1q_s##SZ, vst1q_s##SZ,                \
+                 vshlq_s##SZ, vdupq_n_s##SZ, -)
+
+/* There is no vector "not equal"; invert the result of vceq.  */
+static inline uint8x16_t gvec_vneq_u8(uint8x16_t a, uint8x16_t b)
+{
+    return vmvnq_u8(vceqq_u8(a, b));
+}
+
+static inline uint16x8_t gvec_vneq_u16(uint16x8_t a, uint16x8_t b)
+{
+    return vmvnq_u16(vceqq_u16(a, b));
+}
+
+static inline uint32x4_t gvec_vneq_u32(uint32x4_t a, uint32x4_t b)
+{
+    return vmvnq_u32(vceqq_u32(a, b));
+}
+
+static inline uint64x2_t gvec_vneq_u64(uint64x2_t a, uint64x2_t b)
+{
+    return vreinterpretq_u64_u32(vmvnq_u32(vreinterpretq_u32_u64(
+                                               vceqq_u64(a, b))));
+}
+
+GVEC_ACCEL_INT(8)
+GVEC_ACCEL_INT(16)
+GVEC_ACCEL_INT(32)
+GVEC_ACCEL_INT(64)
+
+static inline intptr_t gvec_bitsel_accel(void *d, void *a, void *b, void *c,
+                                         intptr_t oprsz)
+{
+    intptr_t i;
+
+    for (i = 0; i + 16 <= oprsz; i += 16) {
+        vst1q_u64(d + i, vbslq_u64(vld1q_u64(a + i), vld1q_u64(b + i),
+                                   vld1q_u64(c + i)));
+    }
+    return i;
+}
+
+static inline intptr_t gvec_dup32_accel(void *d, uint32_t c, intptr_t oprsz)
+{
+    uint32x4_t v = vdupq_n_u32(c);
+    intptr_t i;
+
+    for (i = 0; i + 16 <= oprsz; i += 16) {
+        vst1q_u32(d + i, v);
+    }
+    return i;
+}
+
+static inline intptr_t gvec_dup64_accel(void *d, uint64_t c, intptr_t oprsz)
+{
+    uint64x2_t v = vdupq_n_u64(c);
+    intptr_t i;
+
+    for (i = 0; i + 16 <= oprsz; i += 16) {
+        vst1q_u64(d + i, v);
+    }
+    return i;
+}
+
+#undef GVEC_ACCEL_3
+#undef GVEC_ACCEL_SHIFT
+#undef GVEC_ACCEL_INT
+
+#else
+# include "host/include/generic/host/gvec-accel.h"
+#endif
+
+#endif /* AARCH64_HOST_GVEC_ACCEL_H */
@@ -0,0 +1,64 @@
+/*
+ * No host specific acceleration of the out-of-line gvec helpers.
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ *
+ * Each NAME_accel() function processes the leading part of a vector
+ * operation with host vector instructions and returns the number of
+ * bytes it handled; the caller's C loop does the rest.
+ */
+
+#ifndef GENERIC_HOST_GVEC_ACCEL_H
+#define GENERIC_HOST_GVEC_ACCEL_H
+
+#define GVEC_NO_ACCEL_3(NAME)                                           \
+static inline intptr_t NAME##_accel(void *d, void *a, void *b,          \
+                                    intptr_t oprsz)                     \
+{                                                                       \
+    return 0;                                                           \
+}
+
+#define GVEC_NO_ACCEL_SHIFT(NAME)                                       \
+static inline intptr_t NAME##_accel(void *d, void *a, int shift,        \
+                                    intptr_t oprsz)                     \
+{                                                                       \
+    return 0;                                                           \
+}
+
+#define GVEC_NO_ACCEL_SIZES(NAME, MACRO) \
+    MACRO(NAME##8) MACRO(NAME##16) MACRO(NAME##32) MACRO(NAME##64)
+
+GVEC_NO_ACCEL_SIZES(gvec_ssadd, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_sssub, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_usadd, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_ussub, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_eq, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_ne, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_lt, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_le, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_ltu, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_leu, GVEC_NO_ACCEL_3)
+GVEC_NO_ACCEL_SIZES(gvec_shl, GVEC_NO_ACCEL_SHIFT)
+GVEC_NO_ACCEL_SIZES(gvec_shr, GVEC_NO_ACCEL_SHIFT)
+GVEC_NO_ACCEL_SIZES(gvec_sar, GVEC_NO_ACCEL_SHIFT)
+
+static inline intptr_t gvec_bitsel_accel(void *d, void *a, void *b, void *c,
+                                         intptr_t oprsz)
+{
+    return 0;
+}
+
+static inline intptr_t gvec_dup32_accel(void *d, uint32_t c, intptr_t oprsz)
+{
+    return 0;
+}
+
+static inline intptr_t gvec_dup64_accel(void *d, uint64_t c, intptr_t oprsz)
+{
+    return 0;
+}
+
+#undef GVEC_NO_ACCEL_3
+#undef GVEC_NO_ACCEL_SHIFT
+#undef GVEC_NO_ACCEL_SIZES
+
+#endif /* GENERIC_HOST_GVEC_ACCEL_H */
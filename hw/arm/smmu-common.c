@@ -137,10 +137,109 @@ SMMUTLBEntry *smmu_iotlb_lookup(SMMUState *bs, SMMUTransCfg *cfg,
     return entry;
 }
 
+/*
+ * Besides the hash table, the IOTLB keeps an index of its entries for
+ * invalidation: one tag for each ASID/VMID pair in use, holding a tree
+ * of the keys of the pair's entries ordered by IOVA.  The hash table
+ * owns the keys and entries.
+ */
+typedef struct SMMUIOTLBTag {
+    int asid;
+    int vmid;
+    GTree *keys;
+} SMMUIOTLBTag;
+
+static guint smmu_iotlb_tag_hash(gconstpointer v)
+{
+    const SMMUIOTLBTag *tag = v;
+
+    return tag->asid * 65537 + tag->vmid;
+}
+
+static gboolean smmu_iotlb_tag_equal(gconstpointer v1, gconstpointer v2)
+{
+    const SMMUIOTLBTag *t1 = v1, *t2 = v2;
+
+    return t1->asid == t2->asid && t1->vmid == t2->vmid;
+}
+
+static void smmu_iotlb_tag_free(gpointer data)
+{
+    SMMUIOTLBTag *tag = data;
+
+    g_tree_destroy(tag->keys);
+    g_free(tag);
+}
+
+static gint smmu_iotlb_key_compare(gconstpointer a, gconstpointer b)
+{
+    const SMMUIOTLBKey *k1 = a, *k2 = b;
+
+    if (k1->iova != k2->iova) {
+        return k1->iova < k2->iova ? -1 : 1;
+    }
+    if (k1->tg != k2->tg) {
+        return k1->tg - k2->tg;
+    }
+    return k1->level - k2->level;
+}
+
+/* Find any key of the tree whose IOVA is within @info's range */
+static gint smmu_iotlb_key_in_range(gconstpointer a, gconstpointer b)
+{
+    const SMMUIOTLBKey *key = a;
+    const SMMUIOTLBPageInvInfo *info = b;
+
+    if (key->iova < info->iova) {
+        return 1;
+    }
+    if (key->iova - info->iova > info->mask) {
+        return -1;
+    }
+    return 0;
+}
+
+static SMMUIOTLBTag *smmu_iotlb_get_tag(SMMUState *bs, int asid, int vmid,
+                                        bool create)
+{
+    SMMUIOTLBTag lookup = { .asid = asid, .vmid = vmid };
+    SMMUIOTLBTag *tag = g_hash_table_lookup(bs->iotlb_tags, &lookup);
+
+    if (!tag && create) {
+        tag = g_new(SMMUIOTLBTag, 1);
+        *tag = lookup;
+        tag->keys = g_tree_new(smmu_iotlb_key_compare);
+        g_hash_table_add(bs->iotlb_tags, tag);
+    }
+    return tag;
+}
+
+/*
+ * Drop the entry of @key, which may be a copy of the key in the tables.
+ * Returns whether there was one.  The caller drops @tag once empty.
+ */
+static bool smmu_iotlb_remove(SMMUState *bs, SMMUIOTLBTag *tag,
+                              const SMMUIOTLBKey *key)
+{
+    if (!g_tree_remove(tag->keys, key)) {
+        return false;
+    }
+    g_hash_table_remove(bs->iotlb, key);
+    return true;
+}
+
+static void smmu_iotlb_put_tag(SMMUState *bs, SMMUIOTLBTag *tag)
+{
+    if (!g_tree_nnodes(tag->keys)) {
+        g_hash_table_remove(bs->iotlb_tags, tag);
+    }
+}
+
 void smmu_iotlb_insert(SMMUState *bs, SMMUTransCfg *cfg, SMMUTLBEntry *new)
 {
     SMMUIOTLBKey *key = g_new0(SMMUIOTLBKey, 1);
     uint8_t tg = (new->granule - 10) / 2;
+    SMMUIOTLBTag *tag;
 
     if (g_hash_table_size(bs->iotlb) >= SMMU_IOTLB_MAX_SIZE) {
         smmu_iotlb_inv_all(bs);
@@ -150,79 +249,122 @@ void smmu_iotlb_insert(SMMUState *bs, SMMUTransCfg *cfg, SMMUTLBEntry *new)
                               tg, new->level);
     trace_smmu_iotlb_insert(cfg->asid, cfg->s2cfg.vmid, new->entry.iova,
                             tg, new->level);
+    tag = smmu_iotlb_get_tag(bs, cfg->asid, cfg->s2cfg.vmid, true);
+    /* The tree must not keep pointing to the key that is replaced. */
+    smmu_iotlb_remove(bs, tag, key);
     g_hash_table_insert(bs->iotlb, key, new);
+    g_tree_insert(tag->keys, key, key);
 }
 
 void smmu_iotlb_inv_all(SMMUState *s)
 {
     trace_smmu_iotlb_inv_all();
+    g_hash_table_remove_all(s->iotlb_tags);
     g_hash_table_remove_all(s->iotlb);
 }
 
-static gboolean smmu_hash_remove_by_asid_vmid(gpointer key, gpointer value,
-                                              gpointer user_data)
+/* An invalidation walking the tags */
+typedef struct SMMUIOTLBInv {
+    SMMUState *s;
+    SMMUIOTLBPageInvInfo info;
+} SMMUIOTLBInv;
+
+static gboolean smmu_iotlb_remove_key(gpointer key, gpointer value,
+                                      gpointer user_data)
 {
-    SMMUIOTLBPageInvInfo *info = (SMMUIOTLBPageInvInfo *)user_data;
-    SMMUIOTLBKey *iotlb_key = (SMMUIOTLBKey *)key;
+    SMMUState *s = user_data;
 
-    return (SMMU_IOTLB_ASID(*iotlb_key) == info->asid) &&
-           (SMMU_IOTLB_VMID(*iotlb_key) == info->vmid);
+    g_hash_table_remove(s->iotlb, key);
+    return false;
+}
+
+/* Drop all the entries of @tag; the caller drops @tag itself */
+static void smmu_iotlb_remove_tag(SMMUState *s, SMMUIOTLBTag *tag)
+{
+    g_tree_foreach(tag->keys, smmu_iotlb_remove_key, s);
 }
 
 static gboolean smmu_hash_remove_by_vmid(gpointer key, gpointer value,
                                          gpointer user_data)
 {
-    int vmid = *(int *)user_data;
-    SMMUIOTLBKey *iotlb_key = (SMMUIOTLBKey *)key;
+    SMMUIOTLBInv *inv = user_data;
+    SMMUIOTLBTag *tag = key;
 
-    return SMMU_IOTLB_VMID(*iotlb_key) == vmid;
+    if (tag->vmid != inv->info.vmid) {
+        return false;
+    }
+    smmu_iotlb_remove_tag(inv->s, tag);
+    return true;
 }
 
 static gboolean smmu_hash_remove_by_vmid_s1(gpointer key, gpointer value,
                                             gpointer user_data)
 {
-    int vmid = *(int *)user_data;
-    SMMUIOTLBKey *iotlb_key = (SMMUIOTLBKey *)key;
+    SMMUIOTLBInv *inv = user_data;
+    SMMUIOTLBTag *tag = key;
 
-    return (SMMU_IOTLB_VMID(*iotlb_key) == vmid) &&
-           (SMMU_IOTLB_ASID(*iotlb_key) >= 0);
+    if (tag->vmid != inv->info.vmid || tag->asid < 0) {
+        return false;
+    }
+    smmu_iotlb_remove_tag(inv->s, tag);
+    return true;
+}
+
+/*
+ * Drop the entries of @tag that overlap @info's range: those that
+ * start in the range, found in the tree, and those that contain its
+ * start, found by the IOVA of each size of entry there is.
+ */
+static void smmu_iotlb_tag_inv_range(SMMUState *s, SMMUIOTLBTag *tag,
+                                     SMMUIOTLBPageInvInfo *info)
+{
+    SMMUIOTLBKey *key;
+
+    for (uint8_t tg = 1; tg <= 3; tg++) {
+        for (uint8_t level = 0; level <= 3; level++) {
+            SMMUIOTLBKey k = smmu_get_iotlb_key(tag->asid, tag->vmid,
+                info->iova & level_page_mask(level, tg * 2 + 10), tg, level);
+
+            smmu_iotlb_remove(s, tag, &k);
+        }
+    }
+    while ((key = g_tree_search(tag->keys, smmu_iotlb_key_in_range, info))) {
+        smmu_iotlb_remove(s, tag, key);
+    }
 }
 
 static gboolean smmu_hash_remove_by_asid_vmid_iova(gpointer key, gpointer value,
                                               gpointer user_data)
 {
-    SMMUTLBEntry *iter = (SMMUTLBEntry *)value;
-    IOMMUTLBEntry *entry = &iter->entry;
-    SMMUIOTLBPageInvInfo *info = (SMMUIOTLBPageInvInfo *)user_data;
-    SMMUIOTLBKey iotlb_key = *(SMMUIOTLBKey *)key;
+    SMMUIOTLBTag *tag = key;
+    SMMUIOTLBInv *inv = user_data;
 
-    if (info->asid >= 0 && info->asid != SMMU_IOTLB_ASID(iotlb_key)) {
+    if (inv->info.asid >= 0 && inv->info.asid != tag->asid) {
         return false;
     }
-    if (info->vmid >= 0 && info->vmid != SMMU_IOTLB_VMID(iotlb_key)) {
+    if (inv->info.vmid >= 0 && inv->info.vmid != tag->vmid) {
         return false;
     }
-    return ((info->iova & ~entry->addr_mask) == entry->iova) ||
-           ((entry->iova & ~info->mask) == info->iova);
+    smmu_iotlb_tag_inv_range(inv->s, tag, &inv->info);
+    return !g_tree_nnodes(tag->keys);
 }
 
-static gboolean smmu_hash_remove_by_vmid_ipa(gpointer key, gpointer value,
-                                             gpointer user_data)
+static void smmu_iotlb_inv_range(SMMUState *s, SMMUIOTLBPageInvInfo *info)
 {
-    SMMUTLBEntry *iter = (SMMUTLBEntry *)value;
-    IOMMUTLBEntry *entry = &iter->entry;
-    SMMUIOTLBPageInvInfo *info = (SMMUIOTLBPageInvInfo *)user_data;
-    SMMUIOTLBKey iotlb_key = *(SMMUIOTLBKey *)key;
+    SMMUIOTLBTag *tag;
 
-    if (SMMU_IOTLB_ASID(iotlb_key) >= 0) {
-        /* This is a stage-1 address. */
-        return false;
+    if (info->asid < 0 || info->vmid < 0) {
+        SMMUIOTLBInv inv = { .s = s, .info = *info };
+
+        g_hash_table_foreach_remove(s->iotlb_tags,
+                                    smmu_hash_remove_by_asid_vmid_iova, &inv);
+        return;
     }
-    if (info->vmid != SMMU_IOTLB_VMID(iotlb_key)) {
-        return false;
+    tag = smmu_iotlb_get_tag(s, info->asid, info->vmid, false);
+    if (tag) {
+        smmu_iotlb_tag_inv_range(s, tag, info);
+        smmu_iotlb_put_tag(s, tag);
     }
-    return ((info->iova & ~entry->addr_mask) == entry->iova) ||
-           ((entry->iova & ~info->mask) == info->iova);
 }
 
 void smmu_iotlb_inv_iova(SMMUState *s, int asid, int vmid, dma_addr_t iova,
@@ -233,8 +375,10 @@ void smmu_iotlb_inv_iova(SMMUState *s, int asid, int vmid, dma_addr_t iova,
 
     if (ttl && (num_pages == 1) && (asid >= 0)) {
         SMMUIOTLBKey key = smmu_get_iotlb_key(asid, vmid, iova, tg, ttl);
+        SMMUIOTLBTag *tag = smmu_iotlb_get_tag(s, asid, vmid, false);
 
-        if (g_hash_table_remove(s->iotlb, &key)) {
+        if (tag && smmu_iotlb_remove(s, tag, &key)) {
+            smmu_iotlb_put_tag(s, tag);
             return;
         }
         /*
@@ -248,9 +392,7 @@ void smmu_iotlb_inv_iova(SMMUState *s, int asid, int vmid, dma_addr_t iova,
         .vmid = vmid,
         .mask = (num_pages * 1 << granule) - 1};
 
-    g_hash_table_foreach_remove(s->iotlb,
-                                smmu_hash_remove_by_asid_vmid_iova,
-                                &info);
+    smmu_iotlb_inv_range(s, &info);
 }
 
 /*
@@ -262,11 +404,17 @@ void smmu_iotlb_inv_ipa(SMMUState *s, int vmid, dma_addr_t ipa, uint8_t tg,
 {
     uint8_t granule = tg ? tg * 2 + 10 : 12;
     int asid = -1;
+    SMMUIOTLBTag *tag = smmu_iotlb_get_tag(s, asid, vmid, false);
+
+    if (!tag) {
+        return;
+    }
 
    if (ttl && (num_pages == 1)) {
         SMMUIOTLBKey key = smmu_get_iotlb_key(asid, vmid, ipa, tg, ttl);
 
-        if (g_hash_table_remove(s->iotlb, &key)) {
+        if (smmu_iotlb_remove(s, tag, &key)) {
+            smmu_iotlb_put_tag(s, tag);
             return;
         }
     }
@@ -276,32 +424,36 @@ void smmu_iotlb_inv_ipa(SMMUState *s, int vmid, dma_addr_t ipa, uint8_t tg,
         .vmid = vmid,
         .mask = (num_pages << granule) - 1};
 
-    g_hash_table_foreach_remove(s->iotlb,
-                                smmu_hash_remove_by_vmid_ipa,
-                                &info);
+    smmu_iotlb_tag_inv_range(s, tag, &info);
+    smmu_iotlb_put_tag(s, tag);
 }
 
 void smmu_iotlb_inv_asid_vmid(SMMUState *s, int asid, int vmid)
 {
-    SMMUIOTLBPageInvInfo info = {
-        .asid = asid,
-        .vmid = vmid,
-    };
+    SMMUIOTLBTag *tag = smmu_iotlb_get_tag(s, asid, vmid, false);
 
     trace_smmu_iotlb_inv_asid_vmid(asid, vmid);
-    g_hash_table_foreach_remove(s->iotlb, smmu_hash_remove_by_asid_vmid, &info);
+    if (tag) {
+        smmu_iotlb_remove_tag(s, tag);
+        g_hash_table_remove(s->iotlb_tags, tag);
+    }
 }
 
 void smmu_iotlb_inv_vmid(SMMUState *s, int vmid)
 {
+    SMMUIOTLBInv inv = { .s = s, .info.vmid = vmid };
+
     trace_smmu_iotlb_inv_vmid(vmid);
-    g_hash_table_foreach_remove(s->iotlb, smmu_hash_remove_by_vmid, &vmid);
+    g_hash_table_foreach_remove(s->iotlb_tags, smmu_hash_remove_by_vmid, &inv);
 }
 
 inline void smmu_iotlb_inv_vmid_s1(SMMUState *s, int vmid)
 {
+    SMMUIOTLBInv inv = { .s = s, .info.vmid = vmid };
+
     trace_smmu_iotlb_inv_vmid_s1(vmid);
-    g_hash_table_foreach_remove(s->iotlb, smmu_hash_remove_by_vmid_s1, &vmid);
+    g_hash_table_foreach_remove(s->iotlb_tags, smmu_hash_remove_by_vmid_s1,
+                                &inv);
 }
 
 /* VMSAv8-64 Translation */
@@ -915,6 +1067,9 @@ static void smmu_base_realize(DeviceState *dev, Error **errp)
     s->configs = g_hash_table_new_full(NULL, NULL, NULL, g_free);
     s->iotlb = g_hash_table_new_full(smmu_iotlb_key_hash, smmu_iotlb_key_equal,
                                      g_free, g_free);
+    s->iotlb_tags = g_hash_table_new_full(smmu_iotlb_tag_hash,
+                                          smmu_iotlb_tag_equal,
+                                          smmu_iotlb_tag_free, NULL);
     s->smmu_pcibus_by_busptr = g_hash_table_new(NULL, NULL);
 
     if (s->primary_bus) {
@@ -931,6 +1086,7 @@ static void smmu_base_reset_hold(Object *obj, ResetType type)
     memset(s->smmu_pcibus_by_bus_num, 0, sizeof(s->smmu_pcibus_by_bus_num));
 
     g_hash_table_remove_all(s->configs);
+    g_hash_table_remove_all(s->iotlb_tags);
     g_hash_table_remove_all(s->iotlb);
 }
 
@@ -518,8 +518,24 @@ static void virtio_gpu_resource_flush(VirtIOGPU *g,
                 within_bounds = true;
 
                 if (console_has_gl(scanout->con)) {
-                    dpy_gl_update(scanout->con, 0, 0, scanout->width,
-                                  scanout->height);
+                    QemuRect rect;
+
+                    /*
+                     * Pass the damage on, so that the UI only reads back
+                     * or forwards what the guest changed.
+                     */
+                    qemu_rect_init(&flush_rect, rf.r.x, rf.r.y,
+                                   rf.r.width, rf.r.height);
+                    qemu_rect_init(&rect, scanout->x, scanout->y,
+                                   scanout->width, scanout->height);
+                    if (qemu_rect_intersect(&flush_rect, &rect, &rect)) {
+                        qemu_rect_translate(&rect, -scanout->x, -scanout->y);
+                    } else {
+                        qemu_rect_init(&rect, 0, 0, scanout->width,
+                                       scanout->height);
+                    }
+                    dpy_gl_update(scanout->con, rect.x, rect.y, rect.width,
+                                  rect.height);
                     update_submitted = true;
                 }
             }
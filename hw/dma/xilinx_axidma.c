@@ -318,13 +318,24 @@ static void stream_process_mem2s(struct Stream *s, StreamSink *tx_data_dev,
         eop = stream_desc_eof(&s->desc);
         addr = s->desc.buffer_address;
         while (txlen) {
-            unsigned int len;
-
-            len = txlen > sizeof s->txbuf ? sizeof s->txbuf : txlen;
-            address_space_read(&s->dma->as, addr,
-                               MEMTXATTRS_UNSPECIFIED,
-                               s->txbuf, len);
-            stream_push(tx_data_dev, s->txbuf, len, eop && len == txlen);
+            dma_addr_t len = txlen;
+            void *p;
+
+            /* Push RAM as is, only MMIO goes through txbuf */
+            p = dma_memory_map_direct(&s->dma->as, addr, &len,
+                                      DMA_DIRECTION_TO_DEVICE,
+                                      MEMTXATTRS_UNSPECIFIED);
+            if (p) {
+                stream_push(tx_data_dev, p, len, eop && len == txlen);
+                dma_memory_unmap(&s->dma->as, p, len,
+                                 DMA_DIRECTION_TO_DEVICE, len);
+            } else {
+                len = txlen > sizeof s->txbuf ? sizeof s->txbuf : txlen;
+                address_space_read(&s->dma->as, addr,
+                                   MEMTXATTRS_UNSPECIFIED,
+                                   s->txbuf, len);
+                stream_push(tx_data_dev, s->txbuf, len, eop && len == txlen);
+            }
             txlen -= len;
             addr += len;
         }
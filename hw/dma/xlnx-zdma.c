@@ -382,7 +382,12 @@ static void zdma_load_dst_descriptor(XlnxZDMA *s)
     zdma_update_descr_addr(s, dst_type, R_ZDMA_CH_DST_CUR_DSCR_LSB);
 }
 
-static void zdma_write_dst(XlnxZDMA *s, uint8_t *buf, uint32_t len)
+/*
+ * Write @len bytes to the destination, taken from @buf or, if it is NULL,
+ * copied from guest memory at @src_addr.
+ */
+static void zdma_write_dst(XlnxZDMA *s, uint8_t *buf, uint64_t src_addr,
+                           uint32_t len)
 {
     uint32_t dst_size, dlen;
     bool dst_intr;
@@ -421,12 +426,19 @@ static void zdma_write_dst(XlnxZDMA *s, uint8_t *buf, uint32_t len)
             }
         }
 
-        address_space_write(&s->dma_as, s->dsc_dst.addr, s->attr, buf, dlen);
+        if (buf) {
+            address_space_write(&s->dma_as, s->dsc_dst.addr, s->attr, buf,
+                                dlen);
+            buf += dlen;
+        } else {
+            address_space_memcpy(&s->dma_as, s->dsc_dst.addr, src_addr,
+                                 s->attr, dlen, ARRAY_SIZE(s->buf));
+            src_addr += dlen;
+        }
         if (burst_type == AXI_BURST_INCR) {
             s->dsc_dst.addr += dlen;
         }
         dst_size -= dlen;
-        buf += dlen;
         len -= dlen;
 
         if (dst_size == 0 && dst_intr) {
@@ -485,6 +497,19 @@ static void zdma_process_descr(XlnxZDMA *s)
     }
 
     while (src_size) {
+        /*
+         * A plain copy goes straight from source to destination, so that
+         * RAM to RAM transfers are a memmove() rather than many bursts.
+         */
+        if (rw_mode == RW_MODE_RW && burst_type == AXI_BURST_INCR) {
+            len = src_size;
+            zdma_write_dst(s, NULL, src_addr, len);
+            src_addr += len;
+            s->regs[R_ZDMA_CH_TOTAL_BYTE] += len;
+            src_size -= len;
+            continue;
+        }
+
         len = src_size > ARRAY_SIZE(s->buf) ? ARRAY_SIZE(s->buf) : src_size;
         if (burst_type == AXI_BURST_FIXED) {
             if (len > (s->cfg.bus_width / 8)) {
@@ -504,7 +529,7 @@ static void zdma_process_descr(XlnxZDMA *s)
         }
 
         if (rw_mode != RW_MODE_RO) {
-            zdma_write_dst(s, s->buf, len);
+            zdma_write_dst(s, s->buf, 0, len);
         }
 
         s->regs[R_ZDMA_CH_TOTAL_BYTE] += len;
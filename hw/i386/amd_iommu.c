@@ -28,6 +28,7 @@
 #include "amd_iommu.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
+#include "qemu/timer.h"
 #include "hw/i386/apic_internal.h"
 #include "trace.h"
 #include "hw/i386/apic-msidef.h"
@@ -66,8 +67,15 @@ struct AMDVIAddressSpace {
     MemoryRegion iommu_nodma;   /* Alias of shared nodma memory region  */
     MemoryRegion iommu_ir;      /* Device's interrupt remapping region  */
     AddressSpace as;            /* device's corresponding address space */
+    IOMMUStats stats;           /* Requests of this device              */
 };
 
+/* Count a translation event in both @as and its IOMMU. */
+#define AMDVI_STAT_INC(as, field) do {                              \
+        stat64_add(&(as)->stats.field, 1);                          \
+        stat64_add(&(as)->iommu_state->stats.field, 1);             \
+    } while (0)
+
 /* AMDVI cache entry */
 typedef struct AMDVIIOTLBEntry {
     uint16_t domid;             /* assigned domain id  */
@@ -527,8 +535,15 @@ static void iommu_inval_iotlb(AMDVIState *s, uint64_t *cmd)
 }
 
 /* not honouring reserved bits is regarded as an illegal command */
+static void amdvi_account_invalidation(AMDVIState *s, int64_t start)
+{
+    stat64_add(&s->stats.invalidations, 1);
+    stat64_add(&s->stats.invalidation_time, get_clock() - start);
+}
+
 static void amdvi_cmdbuf_exec(AMDVIState *s)
 {
+    int64_t start = get_clock();
     uint64_t cmd[2];
 
     if (dma_memory_read(&address_space_memory, s->cmdbuf + s->cmdbuf_head,
@@ -544,15 +559,19 @@ static void amdvi_cmdbuf_exec(AMDVIState *s)
         break;
     case AMDVI_CMD_INVAL_DEVTAB_ENTRY:
         amdvi_inval_devtab_entry(s, cmd);
+        amdvi_account_invalidation(s, start);
         break;
     case AMDVI_CMD_INVAL_AMDVI_PAGES:
         amdvi_inval_pages(s, cmd);
+        amdvi_account_invalidation(s, start);
         break;
     case AMDVI_CMD_INVAL_IOTLB_PAGES:
         iommu_inval_iotlb(s, cmd);
+        amdvi_account_invalidation(s, start);
         break;
     case AMDVI_CMD_INVAL_INTR_TABLE:
         amdvi_inval_inttable(s, cmd);
+        amdvi_account_invalidation(s, start);
         break;
     case AMDVI_CMD_PREFETCH_AMDVI_PAGES:
         amdvi_prefetch_pages(s, cmd);
@@ -562,6 +581,7 @@ static void amdvi_cmdbuf_exec(AMDVIState *s)
         break;
     case AMDVI_CMD_INVAL_AMDVI_ALL:
         amdvi_inval_all(s, cmd);
+        amdvi_account_invalidation(s, start);
         break;
     default:
         trace_amdvi_unhandled_command(extract64(cmd[1], 60, 4));
@@ -991,7 +1011,9 @@ static void amdvi_do_translate(AMDVIAddressSpace *as, hwaddr addr,
     AMDVIIOTLBEntry *iotlb_entry = amdvi_iotlb_lookup(s, addr, devid);
     uint64_t entry[4];
 
+    AMDVI_STAT_INC(as, translations);
     if (iotlb_entry) {
+        AMDVI_STAT_INC(as, iotlb_hits);
         trace_amdvi_iotlb_hit(PCI_BUS_NUM(devid), PCI_SLOT(devid),
                 PCI_FUNC(devid), addr, iotlb_entry->translated_addr);
         ret->iova = addr & ~iotlb_entry->page_mask;
@@ -1001,7 +1023,9 @@ static void amdvi_do_translate(AMDVIAddressSpace *as, hwaddr addr,
         return;
     }
 
+    AMDVI_STAT_INC(as, context_misses);
     if (!amdvi_get_dte(s, devid, entry)) {
+        AMDVI_STAT_INC(as, faults);
         return;
     }
 
@@ -1010,8 +1034,12 @@ static void amdvi_do_translate(AMDVIAddressSpace *as, hwaddr addr,
         goto out;
     }
 
+    AMDVI_STAT_INC(as, page_walks);
     amdvi_page_walk(as, entry, ret,
                     is_write ? AMDVI_PERM_WRITE : AMDVI_PERM_READ, addr);
+    if (ret->perm == IOMMU_NONE) {
+        AMDVI_STAT_INC(as, faults);
+    }
 
     amdvi_update_iotlb(s, devid, addr, *ret,
                        entry[1] & AMDVI_DEV_DOMID_ID_MASK);
@@ -1444,6 +1472,7 @@ static AddressSpace *amdvi_host_dma_iommu(PCIBus *bus, void *opaque, int devfn)
         iommu_as[devfn]->bus_num = (uint8_t)bus_num;
         iommu_as[devfn]->devfn = (uint8_t)devfn;
         iommu_as[devfn]->iommu_state = s;
+        iommu_stats_register(&iommu_as[devfn]->stats, OBJECT(s), bus, devfn);
 
         amdvi_dev_as = iommu_as[devfn];
 
@@ -1621,6 +1650,7 @@ static void amdvi_sysbus_realize(DeviceState *dev, Error **errp)
 
     s->iotlb = g_hash_table_new_full(amdvi_uint64_hash,
                                      amdvi_uint64_equal, g_free, g_free);
+    iommu_stats_register(&s->stats, OBJECT(s), NULL, 0);
 
     /* This device should take care of IOMMU PCI properties */
     if (!qdev_realize(DEVICE(&s->pci), &bus->qbus, errp)) {
@@ -22,6 +22,7 @@
 #define AMD_IOMMU_H
 
 #include "hw/pci/pci.h"
+#include "hw/pci/iommu-stats.h"
 #include "hw/i386/x86-iommu.h"
 #include "qom/object.h"
 
@@ -368,6 +369,8 @@ struct AMDVIState {
     /* IOTLB */
     GHashTable *iotlb;
 
+    IOMMUStats stats;           /* Requests of all served devices */
+
     /* Interrupt remapping */
     bool ga_enabled;
     bool xtsup;
@@ -22,6 +22,8 @@
 #include "qemu/osdep.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/timer.h"
+#include "qemu/xxhash.h"
 #include "qapi/error.h"
 #include "hw/sysbus.h"
 #include "intel_iommu_internal.h"
@@ -74,9 +76,26 @@ struct vtd_iotlb_key {
     uint8_t level;
 };
 
+/* The IOTLB entries of one domain, for domain and page invalidations */
+typedef struct VTDIOTLBDomain {
+    QLIST_HEAD(, VTDIOTLBEntry) entries;
+} VTDIOTLBDomain;
+
 static void vtd_address_space_refresh_all(IntelIOMMUState *s);
 static void vtd_address_space_unmap(VTDAddressSpace *as, IOMMUNotifier *n);
 
+/* Count a translation event in both @vtd_as and its IOMMU. */
+#define VTD_STAT_INC(vtd_as, field) do {                            \
+        stat64_add(&(vtd_as)->stats.field, 1);                      \
+        stat64_add(&(vtd_as)->iommu_state->stats.field, 1);         \
+    } while (0)
+
+static void vtd_account_invalidation(IntelIOMMUState *s, int64_t start)
+{
+    stat64_add(&s->stats.invalidations, 1);
+    stat64_add(&s->stats.invalidation_time, get_clock() - start);
+}
+
 static void vtd_panic_require_caching_mode(void)
 {
     error_report("We need to set caching-mode=on for intel-iommu to enable "
@@ -212,28 +231,37 @@ static inline gboolean vtd_as_has_map_notifier(VTDAddressSpace *as)
     return as->notifier_flags & IOMMU_NOTIFIER_MAP;
 }
 
-/* GHashTable functions */
-static gboolean vtd_iotlb_equal(gconstpointer v1, gconstpointer v2)
+/* QHT functions */
+static uint32_t vtd_iotlb_hash(uint64_t gfn, uint16_t sid, uint8_t level,
+                               uint32_t pasid)
+{
+    return qemu_xxhash4(gfn, (uint64_t)pasid << 32 | sid << 8 | level);
+}
+
+static bool vtd_iotlb_lookup_cmp(const void *obj, const void *userp)
 {
-    const struct vtd_iotlb_key *key1 = v1;
-    const struct vtd_iotlb_key *key2 = v2;
+    const VTDIOTLBEntry *entry = obj;
+    const struct vtd_iotlb_key *key = userp;
 
-    return key1->sid == key2->sid &&
-           key1->pasid == key2->pasid &&
-           key1->level == key2->level &&
-           key1->gfn == key2->gfn;
+    return entry->sid == key->sid &&
+           entry->pasid == key->pasid &&
+           entry->level == key->level &&
+           entry->gfn == key->gfn;
 }
 
-static guint vtd_iotlb_hash(gconstpointer v)
+static bool vtd_iotlb_cmp(const void *a, const void *b)
 {
-    const struct vtd_iotlb_key *key = v;
-    uint64_t hash64 = key->gfn | ((uint64_t)(key->sid) << VTD_IOTLB_SID_SHIFT) |
-        (uint64_t)(key->level - 1) << VTD_IOTLB_LVL_SHIFT |
-        (uint64_t)(key->pasid) << VTD_IOTLB_PASID_SHIFT;
+    const VTDIOTLBEntry *entry1 = a;
+    const VTDIOTLBEntry *entry2 = b;
 
-    return (guint)((hash64 >> 32) ^ (hash64 & 0xffffffffU));
+    return entry1->sid == entry2->sid &&
+           entry1->pasid == entry2->pasid &&
+           entry1->level == entry2->level &&
+           entry1->gfn == entry2->gfn;
 }
 
+/* GHashTable functions */
+
 static gboolean vtd_as_equal(gconstpointer v1, gconstpointer v2)
 {
     const struct vtd_as_key *key1 = v1;
@@ -275,14 +303,6 @@ static void vtd_hiod_destroy(gpointer v)
     object_unref(v);
 }
 
-static gboolean vtd_hash_remove_by_domain(gpointer key, gpointer value,
-                                          gpointer user_data)
-{
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    uint16_t domain_id = *(uint16_t *)user_data;
-    return entry->domain_id == domain_id;
-}
-
 /* The shift of an addr for a certain level of paging structure */
 static inline uint32_t vtd_slpt_level_shift(uint32_t level)
 {
@@ -295,11 +315,9 @@ static inline uint64_t vtd_slpt_level_page_mask(uint32_t level)
     return ~((1ULL << vtd_slpt_level_shift(level)) - 1);
 }
 
-static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
-                                        gpointer user_data)
+static bool vtd_iotlb_page_match(VTDIOTLBEntry *entry,
+                                 VTDIOTLBPageInvInfo *info)
 {
-    VTDIOTLBEntry *entry = (VTDIOTLBEntry *)value;
-    VTDIOTLBPageInvInfo *info = (VTDIOTLBPageInvInfo *)user_data;
     uint64_t gfn = (info->addr >> VTD_PAGE_SHIFT_4K) & info->mask;
     uint64_t gfn_tlb = (info->addr & entry->mask) >> VTD_PAGE_SHIFT_4K;
     return (entry->domain_id == info->domain_id) &&
@@ -307,6 +325,45 @@ static gboolean vtd_hash_remove_by_page(gpointer key, gpointer value,
              (entry->gfn == gfn_tlb));
 }
 
+/* Drop one IOTLB entry.  Must be called with IOMMU lock held. */
+static void vtd_iotlb_remove_locked(IntelIOMMUState *s, VTDIOTLBEntry *entry)
+{
+    gpointer domain_key = GUINT_TO_POINTER(entry->domain_id);
+
+    QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+    QLIST_REMOVE(entry, domain_link);
+    if (QLIST_EMPTY(&((VTDIOTLBDomain *)g_hash_table_lookup(
+                          s->iotlb_domains, domain_key))->entries)) {
+        g_hash_table_remove(s->iotlb_domains, domain_key);
+    }
+    qht_remove(&s->iotlb, entry, vtd_iotlb_hash(entry->gfn, entry->sid,
+                                                entry->level, entry->pasid));
+    s->iotlb_nr--;
+    /* Lookups may still be reading it */
+    g_free_rcu(entry, rcu);
+}
+
+/*
+ * Evict the oldest entry that was not hit since it was last aged, moving
+ * the ones that were to the tail.  Must be called with IOMMU lock held.
+ */
+static void vtd_iotlb_evict_locked(IntelIOMMUState *s)
+{
+    VTDIOTLBEntry *entry;
+    uint32_t i;
+
+    for (i = 0; i < s->iotlb_nr; i++) {
+        entry = QTAILQ_FIRST(&s->iotlb_lru);
+        if (!qatomic_read(&entry->referenced)) {
+            break;
+        }
+        qatomic_set(&entry->referenced, false);
+        QTAILQ_REMOVE(&s->iotlb_lru, entry, lru);
+        QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+    }
+    vtd_iotlb_remove_locked(s, QTAILQ_FIRST(&s->iotlb_lru));
+}
+
 /* Reset all the gen of VTDAddressSpace to zero and set the gen of
  * IntelIOMMUState to 1.  Must be called with IOMMU lock held.
  */
@@ -325,11 +382,110 @@ static void vtd_reset_context_cache_locked(IntelIOMMUState *s)
     s->context_cache_gen = 1;
 }
 
+static VTDIOTLBRuns *vtd_iotlb_runs_new(uint16_t domain_id, uint32_t nr)
+{
+    VTDIOTLBRuns *runs = g_malloc(sizeof(*runs) + nr * sizeof(runs->runs[0]));
+
+    runs->domain_id = domain_id;
+    runs->nr = nr;
+    return runs;
+}
+
+/*
+ * Replace the runs of @vtd_as with @runs, which may be NULL.  Must be
+ * called with IOMMU lock held.
+ */
+static void vtd_iotlb_runs_set_locked(VTDAddressSpace *vtd_as,
+                                      VTDIOTLBRuns *runs)
+{
+    VTDIOTLBRuns *old = vtd_as->iotlb_runs;
+
+    qatomic_rcu_set(&vtd_as->iotlb_runs, runs);
+    if (old) {
+        g_free_rcu(old, rcu);
+    }
+}
+
+/* Must be called with IOMMU lock held. */
+static void vtd_iotlb_runs_reset_locked(VTDAddressSpace *vtd_as)
+{
+    vtd_iotlb_runs_set_locked(vtd_as, NULL);
+}
+
+/* Index of the first run of @runs that ends at or after @iova */
+static uint32_t vtd_iotlb_runs_find(const VTDIOTLBRuns *runs, hwaddr iova)
+{
+    uint32_t lo = 0, hi = runs->nr;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (runs->runs[mid].iova + runs->runs[mid].size < iova) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Drop the runs of @domain_id that overlap @size bytes at @addr, or all
+ * of them if @size is 0.  Must be called with IOMMU lock held.
+ */
+static void vtd_iotlb_runs_invalidate_locked(IntelIOMMUState *s,
+                                             uint16_t domain_id,
+                                             hwaddr addr, hwaddr size)
+{
+    VTDAddressSpace *vtd_as;
+    GHashTableIter as_it;
+
+    g_hash_table_iter_init(&as_it, s->vtd_address_spaces);
+    while (g_hash_table_iter_next(&as_it, NULL, (void **)&vtd_as)) {
+        VTDIOTLBRuns *runs = vtd_as->iotlb_runs, *left;
+        uint32_t first, last;
+
+        if (!runs || runs->domain_id != domain_id) {
+            continue;
+        }
+        first = size ? vtd_iotlb_runs_find(runs, addr) : 0;
+        last = size ? first : runs->nr;
+        while (last < runs->nr && runs->runs[last].iova <= addr + size - 1) {
+            last++;
+        }
+        if (first == last) {
+            continue;
+        }
+        if (last - first == runs->nr) {
+            vtd_iotlb_runs_reset_locked(vtd_as);
+            continue;
+        }
+        left = vtd_iotlb_runs_new(domain_id, runs->nr - (last - first));
+        memcpy(left->runs, runs->runs, first * sizeof(DMAMap));
+        memcpy(left->runs + first, runs->runs + last,
+               (runs->nr - last) * sizeof(DMAMap));
+        vtd_iotlb_runs_set_locked(vtd_as, left);
+    }
+}
+
 /* Must be called with IOMMU lock held. */
 static void vtd_reset_iotlb_locked(IntelIOMMUState *s)
 {
-    assert(s->iotlb);
-    g_hash_table_remove_all(s->iotlb);
+    VTDAddressSpace *vtd_as;
+    VTDIOTLBEntry *entry, *next;
+    GHashTableIter as_it;
+
+    qht_reset(&s->iotlb);
+    QTAILQ_FOREACH_SAFE(entry, &s->iotlb_lru, lru, next) {
+        g_free_rcu(entry, rcu);
+    }
+    s->iotlb_nr = 0;
+    g_hash_table_iter_init(&as_it, s->vtd_address_spaces);
+    while (g_hash_table_iter_next(&as_it, NULL, (void **)&vtd_as)) {
+        vtd_iotlb_runs_reset_locked(vtd_as);
+    }
+    g_hash_table_remove_all(s->iotlb_domains);
+    QTAILQ_INIT(&s->iotlb_lru);
 }
 
 static void vtd_reset_iotlb(IntelIOMMUState *s)
@@ -352,7 +508,7 @@ static uint64_t vtd_get_iotlb_gfn(hwaddr addr, uint32_t level)
     return (addr & vtd_slpt_level_page_mask(level)) >> VTD_PAGE_SHIFT_4K;
 }
 
-/* Must be called with IOMMU lock held */
+/* Must be called under RCU */
 static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
                                        uint32_t pasid, hwaddr addr)
 {
@@ -365,8 +521,15 @@ static VTDIOTLBEntry *vtd_lookup_iotlb(IntelIOMMUState *s, uint16_t source_id,
         key.level = level;
         key.sid = source_id;
         key.pasid = pasid;
-        entry = g_hash_table_lookup(s->iotlb, &key);
+        entry = qht_lookup_custom(&s->iotlb, &key,
+                                  vtd_iotlb_hash(key.gfn, source_id, level,
+                                                 pasid),
+                                  vtd_iotlb_lookup_cmp);
         if (entry) {
+            /* Keep recently used translations away from eviction */
+            if (!qatomic_read(&entry->referenced)) {
+                qatomic_set(&entry->referenced, true);
+            }
             goto out;
         }
     }
@@ -381,29 +544,48 @@ static void vtd_update_iotlb(IntelIOMMUState *s, uint16_t source_id,
                              uint8_t access_flags, uint32_t level,
                              uint32_t pasid)
 {
-    VTDIOTLBEntry *entry = g_malloc(sizeof(*entry));
-    struct vtd_iotlb_key *key = g_malloc(sizeof(*key));
+    VTDIOTLBEntry *entry;
+    VTDIOTLBDomain *domain;
     uint64_t gfn = vtd_get_iotlb_gfn(addr, level);
+    struct vtd_iotlb_key key = {
+        .gfn = gfn,
+        .pasid = pasid,
+        .sid = source_id,
+        .level = level,
+    };
+    uint32_t hash = vtd_iotlb_hash(gfn, source_id, level, pasid);
 
     trace_vtd_iotlb_page_update(source_id, addr, slpte, domain_id);
-    if (g_hash_table_size(s->iotlb) >= VTD_IOTLB_MAX_SIZE) {
-        trace_vtd_iotlb_reset("iotlb exceeds size limit");
-        vtd_reset_iotlb_locked(s);
+
+    RCU_READ_LOCK_GUARD();
+    entry = qht_lookup_custom(&s->iotlb, &key, hash, vtd_iotlb_lookup_cmp);
+    if (entry) {
+        vtd_iotlb_remove_locked(s, entry);
+    } else if (s->iotlb_nr >= s->iotlb_size) {
+        vtd_iotlb_evict_locked(s);
     }
 
+    entry = g_new0(VTDIOTLBEntry, 1);
     entry->gfn = gfn;
     entry->domain_id = domain_id;
+    entry->sid = source_id;
     entry->slpte = slpte;
     entry->access_flags = access_flags;
     entry->mask = vtd_slpt_level_page_mask(level);
     entry->pasid = pasid;
+    entry->level = level;
 
-    key->gfn = gfn;
-    key->sid = source_id;
-    key->level = level;
-    key->pasid = pasid;
-
-    g_hash_table_replace(s->iotlb, key, entry);
+    domain = g_hash_table_lookup(s->iotlb_domains,
+                                 GUINT_TO_POINTER(domain_id));
+    if (!domain) {
+        domain = g_new0(VTDIOTLBDomain, 1);
+        g_hash_table_insert(s->iotlb_domains, GUINT_TO_POINTER(domain_id),
+                            domain);
+    }
+    QLIST_INSERT_HEAD(&domain->entries, entry, domain_link);
+    QTAILQ_INSERT_TAIL(&s->iotlb_lru, entry, lru);
+    s->iotlb_nr++;
+    qht_insert(&s->iotlb, entry, hash, NULL);
 }
 
 /* Given the reg addr of both the message data and address, generate an
@@ -1110,6 +1292,7 @@ static bool vtd_slpte_nonzero_rsvd(uint64_t slpte, uint32_t level)
 static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
                              uint64_t iova, bool is_write,
                              uint64_t *slptep, uint32_t *slpte_level,
+                             dma_addr_t *slpt_base,
                              bool *reads, bool *writes, uint8_t aw_bits,
                              uint32_t pasid)
 {
@@ -1165,6 +1348,7 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
         if (vtd_is_last_slpte(slpte, level)) {
             *slptep = slpte;
             *slpte_level = level;
+            *slpt_base = addr;
             break;
         }
         addr = vtd_get_slpte_addr(slpte, aw_bits);
@@ -1195,6 +1379,201 @@ static int vtd_iova_to_slpte(IntelIOMMUState *s, VTDContextEntry *ce,
     }
 }
 
+/*
+ * Whether @pte, which follows @slpte in the same last level page table,
+ * maps a page with the same permissions that can be cached as is.
+ */
+static bool vtd_slpte_is_neighbor(IntelIOMMUState *s, uint64_t pte,
+                                  uint64_t slpte)
+{
+    hwaddr xlat = vtd_get_slpte_addr(pte, s->aw_bits);
+
+    return (pte & (VTD_SL_R | VTD_SL_W)) == (slpte & (VTD_SL_R | VTD_SL_W)) &&
+           !vtd_slpte_nonzero_rsvd(pte, VTD_SL_PT_LEVEL) &&
+           (xlat > VTD_INTERRUPT_ADDR_LAST ||
+            xlat + VTD_PAGE_SIZE - 1 < VTD_INTERRUPT_ADDR_FIRST);
+}
+
+/*
+ * Cache the translation of @addr that was just walked as a run: a whole
+ * superpage, or the 4K page together with the first @nr @ptes that follow
+ * it in its page table if they map contiguously with the same
+ * permissions.  Returns how many of @ptes the run covers.  Must be
+ * called with IOMMU lock held.
+ */
+static uint32_t vtd_iotlb_run_update(VTDAddressSpace *vtd_as,
+                                     uint16_t domain_id, hwaddr addr,
+                                     uint64_t slpte, uint32_t level,
+                                     uint8_t access_flags,
+                                     const uint64_t *ptes, uint32_t nr)
+{
+    IntelIOMMUState *s = vtd_as->iommu_state;
+    uint64_t page_mask = vtd_slpt_level_page_mask(level);
+    DMAMap map = {
+        .iova = addr & page_mask,
+        .translated_addr = vtd_get_slpte_addr(slpte, s->aw_bits) & page_mask,
+        .size = ~page_mask,
+        .perm = access_flags,
+    };
+    VTDIOTLBRuns *runs, *added;
+    uint32_t pos, covered = 0;
+
+    if (level == VTD_SL_PT_LEVEL) {
+        while (covered < nr) {
+            uint64_t pte = ptes[covered];
+
+            if (!vtd_slpte_is_neighbor(s, pte, slpte) ||
+                vtd_get_slpte_addr(pte, s->aw_bits) !=
+                map.translated_addr + map.size + 1) {
+                break;
+            }
+            map.size += VTD_PAGE_SIZE;
+            covered++;
+        }
+        if (!covered) {
+            /* A single page is no better than its IOTLB entry */
+            return 0;
+        }
+    }
+
+    /* Start over rather than mix domains or grow without bound */
+    runs = vtd_as->iotlb_runs;
+    if (runs && (runs->domain_id != domain_id ||
+                 runs->nr >= VTD_IOTLB_RUNS_MAX)) {
+        runs = NULL;
+    }
+    nr = runs ? runs->nr : 0;
+    pos = runs ? vtd_iotlb_runs_find(runs, map.iova) : 0;
+    /* A run that overlaps an older one is simply not cached */
+    if (pos < nr && runs->runs[pos].iova <= map.iova + map.size) {
+        return 0;
+    }
+
+    /* Readers may be walking the old set, so update a copy */
+    added = vtd_iotlb_runs_new(domain_id, nr + 1);
+    if (nr) {
+        memcpy(added->runs, runs->runs, pos * sizeof(DMAMap));
+        memcpy(added->runs + pos + 1, runs->runs + pos,
+               (nr - pos) * sizeof(DMAMap));
+    }
+    added->runs[pos] = map;
+    vtd_iotlb_runs_set_locked(vtd_as, added);
+    trace_vtd_iotlb_run_update(PCI_BUILD_BDF(pci_bus_num(vtd_as->bus),
+                                             vtd_as->devfn),
+                               map.iova, map.size + 1, domain_id);
+    return covered;
+}
+
+/*
+ * Cache the translation of @addr that was just walked, and what the walk
+ * can get for the price of one more read: the entries that follow @slpte
+ * in its page table are fetched together, the contiguous ones become a
+ * run and the next scattered ones are put in the IOTLB, so that
+ * streaming DMA walks once every VTD_IOTLB_PREFETCH_PAGES pages at most.
+ * Must be called with IOMMU lock held.
+ */
+static void vtd_iotlb_fill(VTDAddressSpace *vtd_as, uint16_t source_id,
+                           uint16_t domain_id, hwaddr addr,
+                           dma_addr_t slpt_base, uint64_t slpte,
+                           uint32_t level, uint8_t access_flags,
+                           uint32_t pasid)
+{
+    IntelIOMMUState *s = vtd_as->iommu_state;
+    uint64_t ptes[VTD_IOTLB_RUN_PAGES - 1];
+    uint32_t index = vtd_iova_level_offset(addr, level) + 1;
+    uint32_t nr = 0, i;
+
+    vtd_update_iotlb(s, source_id, domain_id, addr, slpte, access_flags,
+                     level, pasid);
+    if (level == VTD_SL_PT_LEVEL) {
+        nr = MIN(VTD_IOTLB_RUN_PAGES - 1, VTD_SL_PT_ENTRY_NR - index);
+        if (nr && dma_memory_read(&address_space_memory,
+                                  slpt_base + index * sizeof(ptes[0]),
+                                  ptes, nr * sizeof(ptes[0]),
+                                  MEMTXATTRS_UNSPECIFIED)) {
+            nr = 0;
+        }
+        for (i = 0; i < nr; i++) {
+            ptes[i] = le64_to_cpu(ptes[i]);
+        }
+    }
+
+    i = vtd_iotlb_run_update(vtd_as, domain_id, addr, slpte, level,
+                             access_flags, ptes, nr);
+    for (nr = MIN(nr, VTD_IOTLB_PREFETCH_PAGES - 1); i < nr; i++) {
+        if (vtd_slpte_is_neighbor(s, ptes[i], slpte)) {
+            vtd_update_iotlb(s, source_id, domain_id,
+                             addr + (i + 1) * VTD_PAGE_SIZE, ptes[i],
+                             access_flags, level, pasid);
+        }
+    }
+}
+
+/*
+ * Translate @addr from the runs of @vtd_as into @entry.  Must be called
+ * under RCU.
+ */
+static bool vtd_iotlb_run_lookup(VTDAddressSpace *vtd_as, hwaddr addr,
+                                 IOMMUTLBEntry *entry)
+{
+    VTDIOTLBRuns *runs = qatomic_rcu_read(&vtd_as->iotlb_runs);
+    const DMAMap *run;
+    hwaddr mask = VTD_PAGE_SIZE - 1;
+    uint32_t i;
+
+    if (!runs) {
+        return false;
+    }
+    i = vtd_iotlb_runs_find(runs, addr);
+    if (i == runs->nr || runs->runs[i].iova > addr) {
+        return false;
+    }
+    run = &runs->runs[i];
+    trace_vtd_iotlb_run_hit(PCI_BUILD_BDF(pci_bus_num(vtd_as->bus),
+                                          vtd_as->devfn),
+                            addr, run->iova, run->size + 1);
+    /* A run that is one naturally aligned block is returned whole */
+    if (is_power_of_2(run->size + 1) && !(run->iova & run->size) &&
+        !(run->translated_addr & run->size)) {
+        mask = run->size;
+    }
+    entry->iova = addr & ~mask;
+    entry->translated_addr = run->translated_addr + (entry->iova - run->iova);
+    entry->addr_mask = mask;
+    entry->perm = run->perm;
+    return true;
+}
+
+/*
+ * Translate @addr from the runs of @vtd_as or the IOTLB into @entry.
+ * Lookups only need RCU, so hits never wait for the IOMMU lock.
+ */
+static bool vtd_iotlb_translate(VTDAddressSpace *vtd_as, uint16_t source_id,
+                                uint32_t pasid, hwaddr addr,
+                                IOMMUTLBEntry *entry)
+{
+    IntelIOMMUState *s = vtd_as->iommu_state;
+    VTDIOTLBEntry *iotlb_entry;
+
+    RCU_READ_LOCK_GUARD();
+    if (vtd_iotlb_run_lookup(vtd_as, addr, entry)) {
+        return true;
+    }
+    iotlb_entry = vtd_lookup_iotlb(s, source_id, pasid, addr);
+    if (!iotlb_entry) {
+        return false;
+    }
+    trace_vtd_iotlb_page_hit(source_id, addr, iotlb_entry->slpte,
+                             iotlb_entry->domain_id);
+    entry->iova = addr & iotlb_entry->mask;
+    entry->translated_addr = vtd_get_slpte_addr(iotlb_entry->slpte,
+                                                s->aw_bits) &
+                             iotlb_entry->mask;
+    entry->addr_mask = ~iotlb_entry->mask;
+    entry->perm = iotlb_entry->access_flags;
+    return true;
+}
+
 typedef int (*vtd_page_walk_hook)(const IOMMUTLBEvent *event, void *private);
 
 /**
@@ -1895,6 +2274,7 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     uint8_t bus_num = pci_bus_num(bus);
     VTDContextCacheEntry *cc_entry;
     uint64_t slpte, page_mask;
+    dma_addr_t slpt_base;
     uint32_t level, pasid = vtd_as->pasid;
     uint16_t source_id = PCI_BUILD_BDF(bus_num, devfn);
     int ret_fr;
@@ -1903,7 +2283,6 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     bool writes = true;
     uint8_t access_flags;
     bool rid2pasid = (pasid == PCI_NO_PASID) && s->root_scalable;
-    VTDIOTLBEntry *iotlb_entry;
 
     /*
      * We have standalone memory region for interrupt addresses, we
@@ -1911,23 +2290,19 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
      */
     assert(!vtd_is_interrupt_addr(addr));
 
-    vtd_iommu_lock(s);
-
-    cc_entry = &vtd_as->context_cache_entry;
+    VTD_STAT_INC(vtd_as, translations);
 
     /* Try to fetch slpte form IOTLB, we don't need RID2PASID logic */
-    if (!rid2pasid) {
-        iotlb_entry = vtd_lookup_iotlb(s, source_id, pasid, addr);
-        if (iotlb_entry) {
-            trace_vtd_iotlb_page_hit(source_id, addr, iotlb_entry->slpte,
-                                     iotlb_entry->domain_id);
-            slpte = iotlb_entry->slpte;
-            access_flags = iotlb_entry->access_flags;
-            page_mask = iotlb_entry->mask;
-            goto out;
-        }
+    if (!rid2pasid &&
+        vtd_iotlb_translate(vtd_as, source_id, pasid, addr, entry)) {
+        VTD_STAT_INC(vtd_as, iotlb_hits);
+        return true;
     }
 
+    vtd_iommu_lock(s);
+
+    cc_entry = &vtd_as->context_cache_entry;
+
     /* Try to fetch context-entry from cache first */
     if (cc_entry->context_cache_gen == s->context_cache_gen) {
         trace_vtd_iotlb_cc_hit(bus_num, devfn, cc_entry->context_entry.hi,
@@ -1945,6 +2320,7 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
             }
         }
     } else {
+        VTD_STAT_INC(vtd_as, context_misses);
         ret_fr = vtd_dev_to_context_entry(s, bus_num, devfn, &ce);
         is_fpd_set = ce.lo & VTD_CONTEXT_ENTRY_FPD;
         if (!ret_fr && !is_fpd_set && s->root_scalable) {
@@ -1994,20 +2370,16 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
     }
 
     /* Try to fetch slpte form IOTLB for RID2PASID slow path */
-    if (rid2pasid) {
-        iotlb_entry = vtd_lookup_iotlb(s, source_id, pasid, addr);
-        if (iotlb_entry) {
-            trace_vtd_iotlb_page_hit(source_id, addr, iotlb_entry->slpte,
-                                     iotlb_entry->domain_id);
-            slpte = iotlb_entry->slpte;
-            access_flags = iotlb_entry->access_flags;
-            page_mask = iotlb_entry->mask;
-            goto out;
-        }
+    if (rid2pasid &&
+        vtd_iotlb_translate(vtd_as, source_id, pasid, addr, entry)) {
+        vtd_iommu_unlock(s);
+        VTD_STAT_INC(vtd_as, iotlb_hits);
+        return true;
     }
 
+    VTD_STAT_INC(vtd_as, page_walks);
     ret_fr = vtd_iova_to_slpte(s, &ce, addr, is_write, &slpte, &level,
-                               &reads, &writes, s->aw_bits, pasid);
+                               &slpt_base, &reads, &writes, s->aw_bits, pasid);
     if (ret_fr) {
         vtd_report_fault(s, -ret_fr, is_fpd_set, source_id,
                          addr, is_write, pasid != PCI_NO_PASID, pasid);
@@ -2016,9 +2388,8 @@ static bool vtd_do_iommu_translate(VTDAddressSpace *vtd_as, PCIBus *bus,
 
     page_mask = vtd_slpt_level_page_mask(level);
     access_flags = IOMMU_ACCESS_FLAG(reads, writes);
-    vtd_update_iotlb(s, source_id, vtd_get_domain_id(s, &ce, pasid),
-                     addr, slpte, access_flags, level, pasid);
-out:
+    vtd_iotlb_fill(vtd_as, source_id, vtd_get_domain_id(s, &ce, pasid),
+                   addr, slpt_base, slpte, level, access_flags, pasid);
     vtd_iommu_unlock(s);
     entry->iova = addr & page_mask;
     entry->translated_addr = vtd_get_slpte_addr(slpte, s->aw_bits) & page_mask;
@@ -2028,6 +2399,7 @@ out:
 
 error:
     vtd_iommu_unlock(s);
+    VTD_STAT_INC(vtd_as, faults);
     entry->iova = 0;
     entry->translated_addr = 0;
     entry->addr_mask = 0;
@@ -2198,12 +2570,21 @@ static void vtd_iotlb_domain_invalidate(IntelIOMMUState *s, uint16_t domain_id)
 {
     VTDContextEntry ce;
     VTDAddressSpace *vtd_as;
+    VTDIOTLBDomain *domain;
+    VTDIOTLBEntry *entry, *next;
 
     trace_vtd_inv_desc_iotlb_domain(domain_id);
 
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_domain,
-                                &domain_id);
+    domain = g_hash_table_lookup(s->iotlb_domains,
+                                 GUINT_TO_POINTER(domain_id));
+    if (domain) {
+        /* The domain goes away with its last entry, ending the loop */
+        QLIST_FOREACH_SAFE(entry, &domain->entries, domain_link, next) {
+            vtd_iotlb_remove_locked(s, entry);
+        }
+    }
+    vtd_iotlb_runs_invalidate_locked(s, domain_id, 0, 0);
     vtd_iommu_unlock(s);
 
     QLIST_FOREACH(vtd_as, &s->vtd_as_with_notifiers, next) {
@@ -2264,6 +2645,7 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
                                       hwaddr addr, uint8_t am)
 {
     VTDIOTLBPageInvInfo info;
+    VTDIOTLBDomain *domain;
 
     trace_vtd_inv_desc_iotlb_pages(domain_id, addr, am);
 
@@ -2272,7 +2654,24 @@ static void vtd_iotlb_page_invalidate(IntelIOMMUState *s, uint16_t domain_id,
     info.addr = addr;
     info.mask = ~((1 << am) - 1);
     vtd_iommu_lock(s);
-    g_hash_table_foreach_remove(s->iotlb, vtd_hash_remove_by_page, &info);
+    domain = g_hash_table_lookup(s->iotlb_domains,
+                                 GUINT_TO_POINTER(domain_id));
+    if (domain) {
+        VTDIOTLBEntry *entry, *next;
+
+        /*
+         * Only the entries of the domain can match.  The domain goes away
+         * with its last entry, which also ends the loop.
+         */
+        QLIST_FOREACH_SAFE(entry, &domain->entries, domain_link, next) {
+            if (vtd_iotlb_page_match(entry, &info)) {
+                vtd_iotlb_remove_locked(s, entry);
+            }
+        }
+    }
+    vtd_iotlb_runs_invalidate_locked(s, domain_id,
+                                     addr & ~((VTD_PAGE_SIZE << am) - 1),
+                                     VTD_PAGE_SIZE << am);
     vtd_iommu_unlock(s);
     vtd_iotlb_page_invalidate_notify(s, domain_id, addr, am, PCI_NO_PASID);
 }
@@ -2475,12 +2874,15 @@ static void vtd_handle_ccmd_write(IntelIOMMUState *s)
 
     /* Context-cache invalidation request */
     if (val & VTD_CCMD_ICC) {
+        int64_t start = get_clock();
+
         if (s->qi_enabled) {
             error_report_once("Queued Invalidation enabled, "
                               "should not use register-based invalidation");
             return;
         }
         ret = vtd_context_cache_invalidate(s, val);
+        vtd_account_invalidation(s, start);
         /* Invalidation completed. Change something to show */
         vtd_set_clear_mask_quad(s, DMAR_CCMD_REG, VTD_CCMD_ICC, 0ULL);
         ret = vtd_set_clear_mask_quad(s, DMAR_CCMD_REG, VTD_CCMD_CAIG_MASK,
@@ -2496,12 +2898,15 @@ static void vtd_handle_iotlb_write(IntelIOMMUState *s)
 
     /* IOTLB invalidation request */
     if (val & VTD_TLB_IVT) {
+        int64_t start = get_clock();
+
         if (s->qi_enabled) {
             error_report_once("Queued Invalidation enabled, "
                               "should not use register-based invalidation");
             return;
         }
         ret = vtd_iotlb_flush(s, val);
+        vtd_account_invalidation(s, start);
         /* Invalidation completed. Change something to show */
         vtd_set_clear_mask_quad(s, DMAR_IOTLB_REG, VTD_TLB_IVT, 0ULL);
         ret = vtd_set_clear_mask_quad(s, DMAR_IOTLB_REG,
@@ -2781,6 +3186,7 @@ static bool vtd_process_inv_desc(IntelIOMMUState *s)
 {
     VTDInvDesc inv_desc;
     uint8_t desc_type;
+    int64_t start = get_clock();
 
     trace_vtd_inv_qi_head(s->iq_head);
     if (!vtd_get_inv_desc(s, &inv_desc)) {
@@ -2845,6 +3251,9 @@ static bool vtd_process_inv_desc(IntelIOMMUState *s)
                           inv_desc.lo);
         return false;
     }
+    if (desc_type != VTD_INV_DESC_WAIT) {
+        vtd_account_invalidation(s, start);
+    }
     s->iq_head++;
     if (s->iq_head == s->iq_size) {
         s->iq_head = 0;
@@ -3418,6 +3827,8 @@ static Property vtd_properties[] = {
     DEFINE_PROP_BOOL("dma-drain", IntelIOMMUState, dma_drain, true),
     DEFINE_PROP_BOOL("dma-translation", IntelIOMMUState, dma_translation, true),
     DEFINE_PROP_BOOL("stale-tm", IntelIOMMUState, stale_tm, false),
+    DEFINE_PROP_UINT32("iotlb-size", IntelIOMMUState, iotlb_size,
+                       VTD_IOTLB_MAX_SIZE),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -3821,6 +4232,9 @@ VTDAddressSpace *vtd_find_add_as(IntelIOMMUState *s, PCIBus *bus,
         vtd_dev_as->iommu_state = s;
         vtd_dev_as->context_cache_entry.context_cache_gen = 0;
         vtd_dev_as->iova_tree = iova_tree_new();
+        if (pasid == PCI_NO_PASID) {
+            iommu_stats_register(&vtd_dev_as->stats, OBJECT(s), bus, devfn);
+        }
 
         memory_region_init(&vtd_dev_as->root, OBJECT(s), name, UINT64_MAX);
         address_space_init(&vtd_dev_as->as, &vtd_dev_as->root, "vtd-root");
@@ -4277,8 +4691,23 @@ static AddressSpace *vtd_host_dma_iommu(PCIBus *bus, void *opaque, int devfn)
     return &vtd_as->as;
 }
 
+static AddressSpace *vtd_host_dma_iommu_pasid(PCIBus *bus, void *opaque,
+                                              int devfn, uint32_t pasid)
+{
+    IntelIOMMUState *s = opaque;
+
+    assert(0 <= devfn && devfn < PCI_DEVFN_MAX);
+
+    /* Requests with PASID are only translated in scalable mode */
+    if (!s->pasid || pasid > VTD_PASID_ID_MASK) {
+        return NULL;
+    }
+    return &vtd_find_add_as(s, bus, devfn, pasid)->as;
+}
+
 static PCIIOMMUOps vtd_iommu_ops = {
     .get_address_space = vtd_host_dma_iommu,
+    .get_address_space_pasid = vtd_host_dma_iommu_pasid,
     .set_iommu_device = vtd_dev_set_iommu_device,
     .unset_iommu_device = vtd_dev_unset_iommu_device,
 };
@@ -4305,6 +4734,11 @@ static bool vtd_decide_config(IntelIOMMUState *s, Error **errp)
         }
     }
 
+    if (!s->iotlb_size) {
+        error_setg(errp, "iotlb-size must be at least 1");
+        return false;
+    }
+
     /* Currently only address widths supported are 39 and 48 bits */
     if ((s->aw_bits != VTD_HOST_AW_39BIT) &&
         (s->aw_bits != VTD_HOST_AW_48BIT)) {
@@ -4377,6 +4811,7 @@ static void vtd_realize(DeviceState *dev, Error **errp)
 
     QLIST_INIT(&s->vtd_as_with_notifiers);
     qemu_mutex_init(&s->iommu_lock);
+    iommu_stats_register(&s->stats, OBJECT(s), NULL, 0);
     memory_region_init_io(&s->csrmem, OBJECT(s), &vtd_mem_ops, s,
                           "intel_iommu", DMAR_REG_SIZE);
     memory_region_add_subregion(get_system_memory(),
@@ -4396,8 +4831,9 @@ static void vtd_realize(DeviceState *dev, Error **errp)
                                         VTD_INTERRUPT_ADDR_FIRST,
                                         &s->mr_ir, 1);
     /* No corresponding destroy */
-    s->iotlb = g_hash_table_new_full(vtd_iotlb_hash, vtd_iotlb_equal,
-                                     g_free, g_free);
+    qht_init(&s->iotlb, vtd_iotlb_cmp, s->iotlb_size, QHT_MODE_AUTO_RESIZE);
+    s->iotlb_domains = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    QTAILQ_INIT(&s->iotlb_lru);
     s->vtd_address_spaces = g_hash_table_new_full(vtd_as_hash, vtd_as_equal,
                                       g_free, g_free);
     s->vtd_host_iommu_dev = g_hash_table_new_full(vtd_hiod_hash, vtd_hiod_equal,
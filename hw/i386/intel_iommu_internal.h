@@ -113,11 +113,10 @@
 #define VTD_INTERRUPT_ADDR_SIZE     (VTD_INTERRUPT_ADDR_LAST - \
                                      VTD_INTERRUPT_ADDR_FIRST + 1)
 
-/* The shift of source_id in the key of IOTLB hash table */
-#define VTD_IOTLB_SID_SHIFT         26
-#define VTD_IOTLB_LVL_SHIFT         42
-#define VTD_IOTLB_PASID_SHIFT       44
-#define VTD_IOTLB_MAX_SIZE          1024    /* Max size of the hash table */
+#define VTD_IOTLB_MAX_SIZE          1024    /* Default IOTLB capacity */
+#define VTD_IOTLB_RUN_PAGES         64      /* Max 4K pages looked ahead */
+#define VTD_IOTLB_PREFETCH_PAGES    8       /* Pages per IOTLB prefetch */
+#define VTD_IOTLB_RUNS_MAX          256     /* Max runs per address space */
 
 /* IOTLB_REG */
 #define VTD_TLB_GLOBAL_FLUSH        (1ULL << 60) /* Global invalidation */
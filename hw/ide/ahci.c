@@ -920,6 +920,26 @@ static int prdt_tbl_entry_size(const AHCI_SG *tbl)
     return (le32_to_cpu(tbl->flags_size) & AHCI_PRDT_SIZE_MASK) + 1;
 }
 
+/*
+ * Add a PRD to @sglist. Guests commonly describe one buffer with a PRD
+ * per page; merging the PRDs that continue the previous one lets
+ * dma_blk_io() map the buffer at once and submit it with fewer iovecs.
+ */
+static void ahci_sglist_add(QEMUSGList *sglist, dma_addr_t base,
+                            dma_addr_t len)
+{
+    if (sglist->nsg) {
+        ScatterGatherEntry *last = &sglist->sg[sglist->nsg - 1];
+
+        if (last->base + last->len == base) {
+            last->len += len;
+            sglist->size += len;
+            return;
+        }
+    }
+    qemu_sglist_add(sglist, base, len);
+}
+
 /**
  * Fetch entries in a guest-provided PRDT and convert it into a QEMU SGlist.
  * @ad: The AHCIDevice for whom we are building the SGList.
@@ -942,7 +962,9 @@ static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
     uint64_t prdt_addr = cfis_addr + 0x80;
     dma_addr_t prdt_len = (prdtl * sizeof(AHCI_SG));
     dma_addr_t real_prdt_len = prdt_len;
+    g_autofree AHCI_SG *bounce = NULL;
     uint8_t *prdt;
+    AHCI_SG *tbl;
     int i;
     int r = 0;
     uint64_t sum = 0;
@@ -959,22 +981,32 @@ static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
     }
 
     /* map PRDT */
-    if (!(prdt = dma_memory_map(ad->hba->as, prdt_addr, &prdt_len,
-                                DMA_DIRECTION_TO_DEVICE,
-                                MEMTXATTRS_UNSPECIFIED))){
-        trace_ahci_populate_sglist_no_map(ad->hba, ad->port_no);
-        return -1;
-    }
-
-    if (prdt_len < real_prdt_len) {
+    prdt = dma_memory_map(ad->hba->as, prdt_addr, &prdt_len,
+                          DMA_DIRECTION_TO_DEVICE, MEMTXATTRS_UNSPECIFIED);
+    if (prdt && prdt_len < real_prdt_len) {
+        dma_memory_unmap(ad->hba->as, prdt, prdt_len,
+                         DMA_DIRECTION_TO_DEVICE, 0);
+        prdt = NULL;
+    }
+    if (prdt) {
+        tbl = (AHCI_SG *)prdt;
+    } else {
+        /*
+         * The table is not in one piece of RAM, e.g. behind an IOMMU or
+         * across a memory region boundary: read all of it in one go.
+         */
         trace_ahci_populate_sglist_short_map(ad->hba, ad->port_no);
-        r = -1;
-        goto out;
+        bounce = g_malloc(real_prdt_len);
+        if (dma_memory_read(ad->hba->as, prdt_addr, bounce, real_prdt_len,
+                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+            trace_ahci_populate_sglist_no_map(ad->hba, ad->port_no);
+            return -1;
+        }
+        tbl = bounce;
     }
 
     /* Get entries in the PRDT, init a qemu sglist accordingly */
     if (prdtl > 0) {
-        AHCI_SG *tbl = (AHCI_SG *)prdt;
         int tbl_entry_size = 0;
 
         sum = 0;
@@ -996,20 +1028,22 @@ static int ahci_populate_sglist(AHCIDevice *ad, QEMUSGList *sglist,
 
         qemu_sglist_init(sglist, qbus->parent, (prdtl - off_idx),
                          ad->hba->as);
-        qemu_sglist_add(sglist, le64_to_cpu(tbl[off_idx].addr) + off_pos,
+        ahci_sglist_add(sglist, le64_to_cpu(tbl[off_idx].addr) + off_pos,
                         MIN(prdt_tbl_entry_size(&tbl[off_idx]) - off_pos,
                             limit));
 
         for (i = off_idx + 1; i < prdtl && sglist->size < limit; i++) {
-            qemu_sglist_add(sglist, le64_to_cpu(tbl[i].addr),
+            ahci_sglist_add(sglist, le64_to_cpu(tbl[i].addr),
                             MIN(prdt_tbl_entry_size(&tbl[i]),
                                 limit - sglist->size));
         }
     }
 
 out:
-    dma_memory_unmap(ad->hba->as, prdt, prdt_len,
-                     DMA_DIRECTION_TO_DEVICE, prdt_len);
+    if (prdt) {
+        dma_memory_unmap(ad->hba->as, prdt, prdt_len,
+                         DMA_DIRECTION_TO_DEVICE, prdt_len);
+    }
     return r;
 }
 
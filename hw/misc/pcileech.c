@@ -27,62 +27,992 @@
 #include "hw/pci/pci.h"
 #include "hw/hw.h"
 #include "hw/pci/msi.h"
+#include "hw/pci/msix.h"
+#include "hw/pci/pcie.h"
+#include "hw/core/cpu.h"
 #include "qemu/timer.h"
 #include "hw/qdev-properties.h"
 #include "hw/qdev-properties-system.h"
 #include "qom/object.h"
 #include "qemu/main-loop.h" /* iothread mutex */
 #include "qemu/module.h"
+#include "qemu/error-report.h"
+#include "qemu/log.h"
+#include "qemu/cutils.h"
+#include "qemu/event_notifier.h"
+#include "qemu/stats64.h"
+#include "qemu/lockable.h"
+#include "qemu/bitmap.h"
+#include "qemu/range.h"
+#include "qemu/crc32c.h"
+#include "qemu/throttle.h"
+#include "qemu/thread-context.h"
+#include "qemu/sockets.h"
+#include "exec/target_page.h"
+#include "elf.h"
+#ifdef CONFIG_POSIX
+#include "qemu/memfd.h"
+#endif
+#ifdef CONFIG_LINUX
+#include "qemu/userfaultfd.h"
+#endif
+#ifdef CONFIG_ZSTD
+#include <zstd.h>
+#endif
 #include "chardev/char-fe.h"
+#include "io/net-listener.h"
+#include "block/aio-wait.h"
+#include "block/thread-pool.h"
+#include "sysemu/iothread.h"
+#include "sysemu/hostmem.h"
+#include "sysemu/stats.h"
+#include "sysemu/qtest.h"
+#include "sysemu/cpus.h"
+#include "sysemu/runstate.h"
+#include "sysemu/replay.h"
+#include "exec/ramblock.h"
+#include "migration/blocker.h"
+#include "qapi/error.h"
 #include "qapi/visitor.h"
+#include "qapi/qapi-visit-block-core.h"
+#include "trace.h"
 
+#define TYPE_PCILEECH_BASE "pcileech-base"
 #define TYPE_PCILEECH_DEVICE "pcileech"
+#define TYPE_PCILEECH_PCIE_DEVICE "pcileech-pcie"
 
-#define PCILEECH_REQUEST_READ   0
-#define PCILEECH_REQUEST_WRITE  1
+#define PCILEECH_REQUEST_READ       0
+#define PCILEECH_REQUEST_WRITE      1
+#define PCILEECH_REQUEST_NEGOTIATE  2
+#define PCILEECH_REQUEST_READ_SCATTER   3
+#define PCILEECH_REQUEST_MEMORY_MAP     4
+#define PCILEECH_REQUEST_DIRTY_LOG      5
+#define PCILEECH_REQUEST_READ_HASH      6
+#define PCILEECH_REQUEST_SEARCH         7
+#define PCILEECH_REQUEST_FLUSH          8
+#define PCILEECH_REQUEST_READ_VIRT      9
+#define PCILEECH_REQUEST_SNAPSHOT       10
+#define PCILEECH_REQUEST_MAILBOX        11
+#define PCILEECH_REQUEST_WATCH          12
+#define PCILEECH_REQUEST_WRITE_SCATTER  13
+#define PCILEECH_REQUEST_CPU_STATE      14
+#define PCILEECH_REQUEST_PAGE_MAP       15
 
+/* Clients that never negotiate transfer in frames of this length. */
 #define PCILEECH_BUFFER_SIZE    1024
+#define PCILEECH_DEFAULT_CHUNK_SIZE (1 * MiB)
+#define PCILEECH_MAX_CHUNK_SIZE (16 * MiB)
+
+#define PCILEECH_DEFAULT_QUEUE_DEPTH    16
+#define PCILEECH_MAX_QUEUE_DEPTH    1024
+
+/* Input that arrives while the device cannot take it is staged here. */
+#define PCILEECH_RX_SIZE    (64 * KiB)
+
+/* Bytes of queued reads sent before yielding to the event loop. */
+#define PCILEECH_BH_BUDGET  (1 * MiB)
+
+#define PCILEECH_PROTOCOL_VERSION   1
+
+#define PCILEECH_DEFAULT_ZSTD_LEVEL 1
+#define PCILEECH_MAX_ZSTD_LEVEL     19
+
+/* Read frames encoded in parallel with compress-threads. */
+#define PCILEECH_MAX_COMPRESS_THREADS   THREAD_POOL_MAX_THREADS_DEFAULT
+
+/* Read frames that are not directly mapped in flight on dma-threads. */
+#define PCILEECH_MAX_DMA_THREADS    THREAD_POOL_MAX_THREADS_DEFAULT
+
+/* Client connections served by one device, including chardev. */
+#define PCILEECH_MAX_CHANNELS   16
+
+/* Connections taken at once on the listen socket, by default. */
+#define PCILEECH_DEFAULT_MAX_CLIENTS    4
+
+/* Worker threads of each host node listed in node-contexts, by default. */
+#define PCILEECH_DEFAULT_NODE_THREADS   1
+
+/*
+ * Reads up to PCILEECH_CACHE_MAX_READ bytes are served from a per-channel
+ * cache of PCILEECH_CACHE_ENTRIES guest RAM mappings, each covering an
+ * aligned PCILEECH_CACHE_WINDOW of the DMA address space.
+ */
+#define PCILEECH_CACHE_ENTRIES  64
+#define PCILEECH_CACHE_WINDOW   (64 * KiB)
+#define PCILEECH_CACHE_MAX_READ (4 * KiB)
+
+/*
+ * Behind a vIOMMU, a read frame is translated in one call into at most
+ * this many contiguous runs; more fragmented frames take the slow path.
+ */
+#define PCILEECH_IOMMU_RUNS     64
+
+/*
+ * With read-ahead, a client that reads behind a vIOMMU at the same stride
+ * PCILEECH_RA_STREAK times in a row gets the next window read at once
+ * into one of PCILEECH_RA_ENTRIES windows shared by all channels. The
+ * window must translate into PCILEECH_IOMMU_RUNS runs even if the pages
+ * are scattered.
+ */
+#define PCILEECH_RA_ENTRIES         8
+#define PCILEECH_RA_STREAK          2
+#define PCILEECH_MIN_READ_AHEAD     (2 * PCILEECH_CACHE_MAX_READ)
+#define PCILEECH_MAX_READ_AHEAD     (PCILEECH_IOMMU_RUNS * 4 * KiB)
+#define PCILEECH_DEFAULT_RA_TTL     1000    /* Microseconds */
+
+/*
+ * With ats, the PCIe variant caches the translations of its ATS requests
+ * in PCILEECH_ATC_ENTRIES direct-mapped entries, indexed by 4K page, and
+ * asks for up to PCILEECH_ATC_FILL of them at once when it misses.
+ */
+#define PCILEECH_ATC_ENTRIES    256
+#define PCILEECH_ATC_FILL       16
+#define PCILEECH_ATS_OFFSET     0x100
+
+/* With pasid, the PCIe variant tags READ_VIRT requests with 20-bit PASIDs. */
+#define PCILEECH_PASID_WIDTH    20
+
+/*
+ * With tlp-pacing, read frames go out at the pace of a PCIe link. Every
+ * TLP carries this many bytes of framing, sequence number, header and
+ * LCRC on top of its payload.
+ */
+#define PCILEECH_TLP_OVERHEAD   20
+#define PCILEECH_MIN_TLP_SIZE   128
+#define PCILEECH_MAX_TLP_SIZE   4096
+#define PCILEECH_MAX_TAGS       256
+/* Without Extended Tag Field Enable, only 5-bit tags are available. */
+#define PCILEECH_SHORT_TAGS     32
+
+/*
+ * With LEECH_FEATURE_WRITE_COMBINE, single-frame writes of up to
+ * PCILEECH_WC_SIZE bytes that touch or overlap each other are merged
+ * and written to guest memory together, at the latest after
+ * PCILEECH_WC_TIMEOUT nanoseconds.
+ */
+#define PCILEECH_WC_SIZE        (4 * KiB)
+#define PCILEECH_WC_TIMEOUT     (1 * SCALE_MS)
+
+/*
+ * Optional features, advertised in LeechCapabilities.features.
+ * Commands are always available; modes must be requested by the client
+ * in the address field of PCILEECH_REQUEST_NEGOTIATE.
+ */
+#define LEECH_FEATURE_READ_SCATTER  (1ULL << 0)
+#define LEECH_FEATURE_OUT_OF_ORDER  (1ULL << 1)
+#define LEECH_FEATURE_ZERO_FRAMES   (1ULL << 2)
+#define LEECH_FEATURE_ZSTD          (1ULL << 3)
+#define LEECH_FEATURE_MEMORY_MAP    (1ULL << 4)
+#define LEECH_FEATURE_DIRTY_LOG     (1ULL << 5)
+#define LEECH_FEATURE_READ_HASH     (1ULL << 6)
+#define LEECH_FEATURE_SEARCH        (1ULL << 7)
+#define LEECH_FEATURE_WRITE_ACK_ONCE    (1ULL << 8)
+#define LEECH_FEATURE_WRITE_COMBINE     (1ULL << 9)
+#define LEECH_FEATURE_FLUSH         (1ULL << 10)
+#define LEECH_FEATURE_READ_VIRT     (1ULL << 11)
+#define LEECH_FEATURE_SNAPSHOT      (1ULL << 12)
+#define LEECH_FEATURE_MAILBOX       (1ULL << 13)
+#define LEECH_FEATURE_MAILBOX_PUSH  (1ULL << 14)
+#define LEECH_FEATURE_WATCH         (1ULL << 15)
+#define LEECH_FEATURE_WRITE_SCATTER (1ULL << 16)
+#define LEECH_FEATURE_CPU_STATE     (1ULL << 17)
+#define LEECH_FEATURE_PAGE_MAP      (1ULL << 18)
+#define LEECH_FEATURE_PASID         (1ULL << 19)
+#define LEECH_FEATURE_PRIORITY      (1ULL << 20)
+
+#define LEECH_FEATURE_COMMANDS      (LEECH_FEATURE_READ_SCATTER | \
+                                     LEECH_FEATURE_MEMORY_MAP | \
+                                     LEECH_FEATURE_DIRTY_LOG | \
+                                     LEECH_FEATURE_READ_HASH | \
+                                     LEECH_FEATURE_SEARCH | \
+                                     LEECH_FEATURE_FLUSH | \
+                                     LEECH_FEATURE_READ_VIRT | \
+                                     LEECH_FEATURE_SNAPSHOT | \
+                                     LEECH_FEATURE_MAILBOX | \
+                                     LEECH_FEATURE_WATCH | \
+                                     LEECH_FEATURE_WRITE_SCATTER | \
+                                     LEECH_FEATURE_CPU_STATE | \
+                                     LEECH_FEATURE_PAGE_MAP | \
+                                     LEECH_FEATURE_PASID | \
+                                     LEECH_FEATURE_PRIORITY)
+#define LEECH_FEATURE_ENCODINGS     (LEECH_FEATURE_ZERO_FRAMES | \
+                                     LEECH_FEATURE_ZSTD)
+#ifdef CONFIG_ZSTD
+#define LEECH_FEATURE_MODES         (LEECH_FEATURE_OUT_OF_ORDER | \
+                                     LEECH_FEATURE_ZERO_FRAMES | \
+                                     LEECH_FEATURE_ZSTD | \
+                                     LEECH_FEATURE_WRITE_ACK_ONCE | \
+                                     LEECH_FEATURE_WRITE_COMBINE | \
+                                     LEECH_FEATURE_MAILBOX_PUSH)
+#else
+#define LEECH_FEATURE_MODES         (LEECH_FEATURE_OUT_OF_ORDER | \
+                                     LEECH_FEATURE_ZERO_FRAMES | \
+                                     LEECH_FEATURE_WRITE_ACK_ONCE | \
+                                     LEECH_FEATURE_WRITE_COMBINE | \
+                                     LEECH_FEATURE_MAILBOX_PUSH)
+#endif
 
 struct LeechRequestHeader {
     uint8_t command;    /* 0 - Read, 1 - Write */
-    uint8_t reserved[7];
+    uint8_t flags;      /* LEECH_REQUEST_* */
+    uint8_t reserved[2];
     /* Little-Endian */
+    uint32_t tag;       /* Echoed in every response to this request */
     uint64_t address;
     uint64_t length;
 };
 
+/*
+ * Flags of a write request. LEECH_REQUEST_SUMMARY replaces the per-frame
+ * responses with one response after the last frame, whose result is the
+ * OR of all frames and whose data is the little-endian 64-bit offset of
+ * the first failing frame, or the request length if none failed.
+ * LEECH_REQUEST_NO_ACK suppresses the responses altogether.
+ *
+ * With LEECH_FEATURE_PRIORITY and LEECH_FEATURE_OUT_OF_ORDER, the frames
+ * of a read request with LEECH_REQUEST_PRIORITY go out before those of
+ * the reads without, even if these were queued first: a bulk transfer
+ * yields to interactive reads at the next frame. Priority reads share
+ * the frames among each other as usual and count against the queue
+ * depth like the others.
+ */
+#define LEECH_REQUEST_SUMMARY   (1U << 0)
+#define LEECH_REQUEST_NO_ACK    (1U << 1)
+#define LEECH_REQUEST_PRIORITY  (1U << 2)
+
 #define LEECH_RESULT_OK     0
 #define LEECH_DEVICE_ERROR  (1U << 0)
 #define LEECH_DECODE_ERROR  (1U << 1)
 #define LEECH_ACCESS_ERROR  (1U << 2)
+/*
+ * Encoding of a read frame. A frame always stands for the next
+ * MIN(remaining, chunk size) bytes of the request; length only counts
+ * the bytes actually sent.
+ */
+#define LEECH_RESULT_ZERO   (1U << 8)   /* All zero, no data follow */
+#define LEECH_RESULT_ZSTD   (1U << 9)   /* One zstd frame follows */
 
 struct LeechResponseHeader {
     /* Little-Endian */
     uint32_t result;
-    uint8_t reserved[4];
+    uint32_t tag;
     uint64_t length;    /* Indicates length of data followed by header */
 };
 
+/*
+ * Payload of the response to PCILEECH_REQUEST_NEGOTIATE.
+ * The request carries the desired chunk size in its length field.
+ */
+struct LeechCapabilities {
+    /* Little-Endian */
+    uint32_t version;
+    uint32_t chunk_size;        /* Negotiated frame length */
+    uint32_t max_chunk_size;    /* Largest frame length the device accepts */
+    uint32_t page_size;         /* Granularity of PCILEECH_REQUEST_DIRTY_LOG */
+    uint64_t features;          /* LEECH_FEATURE_* in effect */
+};
+
+/*
+ * PCILEECH_REQUEST_READ_SCATTER carries the number of entries in the
+ * length field of its header. The entries follow the header. The
+ * response is a single header whose length covers the whole reply:
+ * for each entry, a LeechScatterResult followed by its data.
+ */
+struct LeechScatterEntry {
+    /* Little-Endian */
+    uint64_t address;
+    uint32_t length;
+    uint8_t reserved[4];
+};
+
+struct LeechScatterResult {
+    /* Little-Endian */
+    uint32_t result;
+    uint32_t length;    /* Length of data following this result */
+};
+
+/*
+ * PCILEECH_REQUEST_WRITE_SCATTER carries the number of entries in the
+ * address field and the length of everything that follows the header,
+ * at most a frame, in the length field: the LeechScatterEntry array,
+ * then the data of each entry in turn. The response holds one
+ * LeechScatterResult per entry, whose length is the number of bytes
+ * written. Together with PCILEECH_REQUEST_READ_SCATTER, this matches
+ * the ReadScatter and WriteScatter calls of a LeechCore device.
+ */
+
+/*
+ * The response to PCILEECH_REQUEST_MEMORY_MAP is an array of the RAM
+ * ranges reachable by DMA, in ascending order, so that clients can skip
+ * the holes. The address and length fields of the request are reserved.
+ */
+struct LeechMemoryRange {
+    /* Little-Endian */
+    uint64_t address;
+    uint64_t length;
+};
+
+/*
+ * PCILEECH_REQUEST_PAGE_MAP covers length bytes from address, both
+ * multiples of the page size, and at most a frame of pages. The response
+ * holds one LEECH_PAGE_* byte per page, so that a dump can skip what
+ * would not read back as guest data without a failing request for each
+ * page: holes and MMIO, the private memory of a confidential guest,
+ * and memory that is not plugged in (virtio-mem).
+ */
+#define LEECH_PAGE_RAM          0
+#define LEECH_PAGE_NONE         1
+#define LEECH_PAGE_PRIVATE      2
+#define LEECH_PAGE_DISCARDED    3
+
+/*
+ * PCILEECH_REQUEST_DIRTY_LOG with zero length (re)starts dirty tracking
+ * of the guest RAM; the client then reads everything once. Afterwards,
+ * a request for length bytes from address returns a bitmap with one bit
+ * per page, least significant bit first, of the RAM pages written since
+ * the previous request for them. Address and length must be multiples
+ * of LEECH_DIRTY_LOG_ALIGN pages. Tracking ends when the client goes
+ * away and is refused while the VM is being migrated.
+ */
+#define LEECH_DIRTY_LOG_ALIGN   64
+
+/*
+ * PCILEECH_REQUEST_WATCH with a non-zero length watches length bytes from
+ * address, both multiples of the page size, for writes. The device checks
+ * the watched ranges every PCILEECH_WATCH_INTERVAL milliseconds and sends
+ * the written pages as responses with tag LEECH_WATCH_TAG, holding an
+ * array of LeechWatchEvent. A zero length stops the watch that starts at
+ * address. Watches use the dirty page log of the channel; pages that one
+ * of them reports are clean for the other. They end with the client.
+ */
+#define LEECH_WATCH_TAG             0xfffffffeU
+#define PCILEECH_WATCH_INTERVAL     10
+#define PCILEECH_MAX_WATCHES        64
+/* Events queued for a client that does not keep up */
+#define PCILEECH_MAX_WATCH_EVENTS   4096
+
+struct LeechWatchEvent {
+    /* Little-Endian */
+    uint64_t address;
+    uint64_t length;
+};
+
+/*
+ * PCILEECH_REQUEST_SNAPSHOT with a non-zero address freezes the guest
+ * RAM: until the same request with a zero address, or until the client
+ * goes away, reads of all channels return its contents at that moment.
+ * Pages the guest writes in the meantime are copied first. Taking a new
+ * snapshot replaces the previous one.
+ */
+
+/*
+ * The response to PCILEECH_REQUEST_CPU_STATE holds the "QEMU" ELF notes
+ * that dump-guest-memory would write for the vCPUs, with the registers
+ * a crash dump converter needs, such as CR3 and the IDT base. In replay
+ * mode, they are the notes of the dump. The address and length fields
+ * of the request are reserved.
+ */
+
+/*
+ * PCILEECH_REQUEST_READ_HASH covers length bytes from address, both
+ * multiples of the page size. The response holds one LeechHashEntry per
+ * page, so at most one 8th of the chunk size in pages can be hashed at
+ * once. The digest is the CRC-32C of the page, or zero if it could not
+ * be read.
+ */
+struct LeechHashEntry {
+    /* Little-Endian */
+    uint32_t result;
+    uint32_t digest;
+};
+
+/*
+ * PCILEECH_REQUEST_SEARCH scans length bytes from address for a pattern.
+ * A LeechSearchRequest follows the header. The response is an array of
+ * the guest-physical addresses of the matches, in ascending order; its
+ * result collects the LEECH_* flags of the parts that could not be read.
+ * The scan stops after max_matches matches, or as many as fit in a
+ * frame, so that the client can continue after the last one.
+ */
+#define LEECH_SEARCH_MAX_PATTERN    240
+
+struct LeechSearchRequest {
+    /* Little-Endian */
+    uint32_t pattern_length;
+    uint32_t align;             /* Matches start at multiples; 0 for any */
+    uint32_t max_matches;       /* 0 for as many as fit in a frame */
+    uint8_t reserved[4];
+    uint8_t pattern[LEECH_SEARCH_MAX_PATTERN];
+};
+
+/*
+ * PCILEECH_REQUEST_READ_VIRT reads length bytes, at most a frame, from
+ * the guest-virtual address in address. A LeechVirtRequest follows the
+ * header; the device walks the x86-64 page tables rooted at dtb itself.
+ * The response holds the data, with pages that are not present or not
+ * readable zeroed, and with LEECH_VIRT_PTES the leaf page-table entry of
+ * every 4 KiB page touched, or zero.
+ *
+ * With LEECH_FEATURE_PASID, LEECH_VIRT_PASID instead sends the reads
+ * tagged with pasid, so that the IOMMU translates address in the shared
+ * virtual memory that the guest bound to it, and dtb is ignored. The
+ * guest must enable the PASID capability; LEECH_VIRT_PTES and
+ * LEECH_VIRT_LA57 cannot be combined with it.
+ */
+#define LEECH_VIRT_PTES     (1U << 0)   /* Append the leaf entries */
+#define LEECH_VIRT_LA57     (1U << 1)   /* 5-level paging */
+#define LEECH_VIRT_PASID    (1U << 2)   /* Translated by the IOMMU */
+
+struct LeechVirtRequest {
+    /* Little-Endian */
+    uint64_t dtb;               /* CR3; the low 12 bits are ignored */
+    uint32_t flags;             /* LEECH_VIRT_* */
+    uint32_t pasid;             /* With LEECH_VIRT_PASID */
+};
+
+/*
+ * PCILEECH_REQUEST_MAILBOX exchanges messages with a driver in the guest,
+ * if the device has mailbox=on. With a non-zero length, that many bytes
+ * of data, at most a frame, follow the header and go into the next buffer
+ * the guest posted; the request fails if there is none or it is too small.
+ * With a zero length, the response holds the next message the guest
+ * posted, or no data if there is none. With LEECH_FEATURE_MAILBOX_PUSH,
+ * the messages of the guest are instead sent as they arrive, as responses
+ * with tag LEECH_MAILBOX_TAG. Only the first channel can use the mailbox.
+ */
+#define LEECH_MAILBOX_TAG   0xffffffffU
+
+/*
+ * With mailbox=on or events=on, BAR 0 holds 32-bit little-endian
+ * registers. For the mailbox, the guest driver
+ * posts messages for the client on the TX ring and buffers for messages
+ * of the client on the RX ring, both arrays of LeechMailboxDesc in guest
+ * memory. It writes the producer index of a ring to its tail doorbell;
+ * the device moves the head on as it completes descriptors and then
+ * raises an interrupt. Indices are free running; the slot of an index
+ * is the index modulo the ring size.
+ */
+#define PCILEECH_MBOX_BAR_SIZE      0x1000
+#define PCILEECH_MBOX_MAGIC         0x00    /* RO, "PLMB" */
+#define PCILEECH_MBOX_STATUS        0x04    /* RO, PCILEECH_MBOX_CONNECTED */
+#define PCILEECH_MBOX_IRQ_STATUS    0x08    /* RO, PCILEECH_MBOX_IRQ_* */
+#define PCILEECH_MBOX_IRQ_ACK       0x0c    /* WO, write 1 to clear */
+#define PCILEECH_MBOX_IRQ_MASK      0x10    /* RW, 1 enables */
+#define PCILEECH_MBOX_TX            0x20    /* Ring registers of TX */
+#define PCILEECH_MBOX_RX            0x40    /* Ring registers of RX */
+#define PCILEECH_MBOX_RING_REGS     0x20
+/*
+ * Events: requests that accessed guest memory, and writes that touched
+ * the watched range. Their interrupts are coalesced: the device waits
+ * for COALESCE_COUNT events, or at most COALESCE_TIME microseconds after
+ * the first one.
+ */
+#define PCILEECH_MBOX_DONE_COUNT    0x60    /* RO, requests completed */
+#define PCILEECH_MBOX_WATCH_COUNT   0x64    /* RO, writes to the range */
+#define PCILEECH_MBOX_WATCH_BASE_LO 0x68    /* RW */
+#define PCILEECH_MBOX_WATCH_BASE_HI 0x6c    /* RW */
+#define PCILEECH_MBOX_WATCH_SIZE_LO 0x70    /* RW, 0 disables */
+#define PCILEECH_MBOX_WATCH_SIZE_HI 0x74    /* RW */
+#define PCILEECH_MBOX_WATCH_HIT_LO  0x78    /* RO, latest written address */
+#define PCILEECH_MBOX_WATCH_HIT_HI  0x7c    /* RO */
+#define PCILEECH_MBOX_COALESCE_COUNT    0x80    /* RW, 0 is 1 */
+#define PCILEECH_MBOX_COALESCE_TIME     0x84    /* RW, 0 waits for count */
+
+/* Offsets in the ring registers */
+#define PCILEECH_RING_BASE_LO       0x00    /* RW */
+#define PCILEECH_RING_BASE_HI       0x04    /* RW */
+#define PCILEECH_RING_SIZE          0x08    /* RW, entries; resets indices */
+#define PCILEECH_RING_TAIL          0x0c    /* RW, doorbell */
+#define PCILEECH_RING_HEAD          0x10    /* RO */
+
+#define PCILEECH_MBOX_MAGIC_VALUE   0x424d4c50
+#define PCILEECH_MBOX_CONNECTED     (1U << 0)   /* A client is attached */
+#define PCILEECH_MBOX_IRQ_TX        (1U << 0)   /* TX descriptors done */
+#define PCILEECH_MBOX_IRQ_RX        (1U << 1)   /* RX descriptors done */
+#define PCILEECH_MBOX_IRQ_LINK      (1U << 2)   /* STATUS changed */
+#define PCILEECH_MBOX_IRQ_DONE      (1U << 3)   /* Requests completed */
+#define PCILEECH_MBOX_IRQ_WATCH     (1U << 4)   /* Watched range written */
+/*
+ * With msix-vectors, vector 0 signals the mailbox, 1 completed requests
+ * and 2 the watched range; with fewer vectors, they share.
+ */
+#define PCILEECH_MAX_VECTORS        3
+/* Ring sizes are powers of two up to this, or 0 to stop the ring */
+#define PCILEECH_MBOX_MAX_RING      1024
+
+struct LeechMailboxDesc {
+    /* Little-Endian */
+    uint64_t address;
+    uint32_t length;    /* Of the buffer; of the message once done on RX */
+    uint32_t flags;     /* LEECH_DESC_*, set by the device */
+};
+
+#define LEECH_DESC_DONE     (1U << 0)
+#define LEECH_DESC_ERROR    (1U << 1)
+
+/*
+ * Shared-memory transport (transport=shm).
+ *
+ * On connection the device sends a LeechShmHello over the chardev, which
+ * must be a UNIX socket, carrying three file descriptors: the memfd, an
+ * eventfd the client signals after submitting descriptors, and an eventfd
+ * the device signals after completing them. Everything in the shared
+ * memory is in host byte order.
+ *
+ * The memory starts with a LeechShmHeader, followed by a ring of
+ * LeechShmDescriptor at ring_offset and the data area at data_offset.
+ * Descriptors point at client-managed buffers in the data area. The
+ * client fills ring[submitted % ring_entries] and then increments
+ * submitted; the device processes descriptors in order, fills in their
+ * result and increments completed.
+ */
+#define LEECH_SHM_MAGIC     0x4345454cU    /* "LEEC" */
+#define PCILEECH_SHM_RING_OFFSET    (4 * KiB)
+#define PCILEECH_SHM_RING_ENTRIES   1024
+#define PCILEECH_SHM_DATA_OFFSET    (64 * KiB)
+#define PCILEECH_DEFAULT_SHM_SIZE   (64 * MiB)
+
+struct LeechShmHello {
+    uint32_t magic;
+    uint32_t version;
+    uint64_t size;          /* Size of the shared memory */
+};
+
+struct LeechShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t ring_entries;
+    uint8_t reserved[4];
+    uint64_t ring_offset;
+    uint64_t data_offset;
+    uint64_t data_size;
+    /* Free-running indices */
+    uint32_t submitted;     /* Written by the client */
+    uint32_t completed;     /* Written by the device */
+};
+
+struct LeechShmDescriptor {
+    uint8_t command;        /* PCILEECH_REQUEST_READ or _WRITE */
+    uint8_t reserved[3];
+    uint32_t tag;
+    uint64_t address;
+    uint64_t length;
+    uint64_t data;          /* Offset of the buffer in the data area */
+    uint32_t result;        /* Written by the device */
+    uint8_t reserved2[4];
+};
+
 /* Verify the header length */
 QEMU_BUILD_BUG_ON(sizeof(struct LeechRequestHeader) != 24);
 QEMU_BUILD_BUG_ON(sizeof(struct LeechResponseHeader) != 16);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechCapabilities) != 24);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechScatterEntry) != 16);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechScatterResult) != 8);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechMemoryRange) != 16);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechHashEntry) != 8);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechSearchRequest) != 256);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechSearchRequest) > PCILEECH_BUFFER_SIZE);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechVirtRequest) != 16);
+QEMU_BUILD_BUG_ON(sizeof(struct LeechShmDescriptor) != 40);
+QEMU_BUILD_BUG_ON(PCILEECH_SHM_RING_OFFSET + PCILEECH_SHM_RING_ENTRIES *
+                  sizeof(struct LeechShmDescriptor) > PCILEECH_SHM_DATA_OFFSET);
 
-struct PciLeechState {
+/*
+ * Log2 histograms of latencies in nanoseconds: bucket 0 counts zero,
+ * bucket i counts [2^(i-1), 2^i) and the last one everything above.
+ */
+#define PCILEECH_STATS_BUCKETS  32
+
+#define PCILEECH_STAT_REQUESTS      "requests"
+#define PCILEECH_STAT_READ_BYTES    "read-bytes"
+#define PCILEECH_STAT_WRITE_BYTES   "write-bytes"
+#define PCILEECH_STAT_DMA_ERRORS    "dma-errors"
+#define PCILEECH_STAT_DMA_TIME      "dma-time"
+#define PCILEECH_STAT_SEND_TIME     "send-time"
+#define PCILEECH_STAT_DMA_LATENCY   "dma-latency"
+#define PCILEECH_STAT_SEND_LATENCY  "send-latency"
+#define PCILEECH_STAT_BOUNCE_EXHAUSTED  "bounce-exhausted"
+#define PCILEECH_STAT_THROTTLED     "throttled"
+#define PCILEECH_STAT_READ_AHEAD_HITS   "read-ahead-hits"
+#define PCILEECH_STAT_ATC_HITS      "atc-hits"
+
+/* Updated by the device's AioContext, read by query-stats. */
+typedef struct PciLeechStats {
+    Stat64 requests;
+    Stat64 read_bytes;
+    Stat64 write_bytes;
+    Stat64 dma_errors;
+    /* Guest memory access, including IOMMU translation and mapping */
+    Stat64 dma_time;
+    Stat64 dma_latency[PCILEECH_STATS_BUCKETS];
+    /* Writing responses and data to the chardev */
+    Stat64 send_time;
+    Stat64 send_latency[PCILEECH_STATS_BUCKETS];
+    /* Frames that waited for a bounce buffer */
+    Stat64 bounce_exhausted;
+    /* Frames that waited for the I/O limits */
+    Stat64 throttled;
+    /* Reads copied from a window that was read ahead */
+    Stat64 read_ahead_hits;
+    /* Pages translated from the device's own ATC */
+    Stat64 atc_hits;
+} PciLeechStats;
+
+/* Compresses read frames; used by one thread at a time. */
+typedef struct PciLeechEncoder {
+#ifdef CONFIG_ZSTD
+    ZSTD_CCtx *zstd;
+    uint8_t *zbuf;
+    size_t zbuf_size;
+#endif
+    uint32_t level;
+    uint32_t max_length;
+} PciLeechEncoder;
+
+/* A range of guest memory made available for sending. */
+typedef struct PciLeechChunk {
+    void *ptr;
+    dma_addr_t maplen;
+    bool mapped;
+    MemoryRegion *ram;          /* Referenced RAM, from the RAM map */
+    MemTxResult result;
+} PciLeechChunk;
+
+/*
+ * A read frame handed to a worker thread, which reads it via DMA if it
+ * could not be mapped, and encodes it. Frames are sent in the order they
+ * were submitted, as soon as all frames before them are done.
+ */
+typedef struct PciLeechFrame {
+    struct PciLeechChannel *channel;
+    PciLeechEncoder encoder;
+    uint8_t *buffer;            /* Bounce buffer, chunk_size bytes long */
+    int buffer_node;            /* Host node the buffer is on, or -1 */
+    bool buffer_fresh;          /* Not touched yet */
+    PciLeechChunk data;
+    uint64_t features;
+    uint32_t tag;
+    uint64_t address;
+    uint64_t length;            /* Guest memory covered by the frame */
+    bool dma;                   /* The worker reads the frame */
+    int64_t start;
+    const void *payload;
+    uint64_t sendlen;
+    uint32_t result;
+    bool done;
+    bool stale;                 /* The client went away, do not send */
+    AioContext *ctx;            /* Completes a frame of a node worker */
+    QTAILQ_ENTRY(PciLeechFrame) next;
+    QSIMPLEQ_ENTRY(PciLeechFrame) node_next;
+} PciLeechFrame;
+
+/*
+ * Worker threads created in the thread context of a host NUMA node, for
+ * the frames that read guest RAM bound to that node. The bounce buffers
+ * they touch first are kept apart so that they stay on the node.
+ */
+typedef struct PciLeechNode {
+    ThreadContext *tc;          /* NULL if the node has no workers */
+    QemuThread *threads;
+    uint32_t num_threads;
+    QemuMutex lock;
+    QemuCond cond;
+    QSIMPLEQ_HEAD(, PciLeechFrame) queue;
+    bool stop;
+    /* Free bounce buffers on the node, bounce_lock */
+    uint8_t **bounce_free;
+    uint32_t bounce_num_free;
+} PciLeechNode;
+
+/*
+ * Direct-mapped cache of guest RAM mappings. It is replaced as a whole
+ * when the memory map changes; readers hold the RCU read lock.
+ */
+typedef struct PciLeechCacheEntry {
+    uint64_t base;
+    bool valid;
+    MemoryRegionCache mrc;
+} PciLeechCacheEntry;
+
+typedef struct PciLeechCache {
+    struct rcu_head rcu;
+    PciLeechCacheEntry entries[PCILEECH_CACHE_ENTRIES];
+} PciLeechCache;
+
+/*
+ * Snapshot of the RAM in the DMA address space, sorted by address and
+ * rebuilt by the memory listener. Readers hold the RCU read lock.
+ */
+typedef struct PciLeechRamRange {
+    uint64_t start;
+    uint64_t size;
+    uint8_t *host;
+    MemoryRegion *mr;
+    int node;                   /* Host node the backend binds, or -1 */
+} PciLeechRamRange;
+
+typedef struct PciLeechRamMap {
+    struct rcu_head rcu;
+    GArray *ranges;
+} PciLeechRamMap;
+
+/* A window read ahead, protected by ra_lock. */
+typedef struct PciLeechReadAhead {
+    uint64_t base;
+    uint32_t length;            /* 0 if unused */
+    int64_t expires;            /* get_clock() */
+    uint8_t *data;
+} PciLeechReadAhead;
+
+/* A translation cached by the ATC; perm is IOMMU_NONE if unused. */
+typedef IOMMUTLBEntry PciLeechAtcEntry;
+
+/* A descriptor ring of the mailbox, protected by mbox_lock. */
+typedef struct PciLeechRing {
+    uint64_t base;
+    uint32_t size;
+    uint32_t head;
+    uint32_t tail;
+    uint32_t generation;        /* Counts the resets by the guest */
+} PciLeechRing;
+
+/* A read request that is queued or being sent. */
+typedef struct PciLeechRequest {
+    struct LeechRequestHeader header;
+    uint64_t done;
+    QTAILQ_ENTRY(PciLeechRequest) next;
+} PciLeechRequest;
+
+/*
+ * One connection to a client. Every channel speaks the whole protocol on
+ * its own; a client may spread its requests over channels as it likes.
+ */
+typedef struct PciLeechChannel {
+    struct PciLeechState *state;
+    unsigned index;
     /* Internal State */
-    PCIDevice device;
     struct LeechRequestHeader request;
+    QTAILQ_HEAD(, PciLeechRequest) reads;
+    uint32_t queued;
+    QEMUBH *bh;
+    QEMUBH *watch_bh;           /* Sends the writes to watched ranges */
+    uint64_t features;
     bool write_pending;
+    bool scatter_pending;
+    bool write_scatter_pending;
+    bool search_pending;
+    bool virt_pending;
+    bool mbox_pending;
+    bool deferred;
     uint64_t written_length;
+    uint32_t write_result;
+    uint64_t write_error;       /* Offset of the first failing frame */
+    PciLeechChunk write_chunk;  /* Guest RAM the write frame goes to */
+    uint64_t discard;
     int pos;
+    /* Staged input */
+    uint8_t *rx;
+    uint32_t rx_len;
+    /* Transfer buffer, chunk_size bytes long */
+    uint8_t *buffer;
+    uint32_t buffered;
+    uint32_t xfer_size;
+    /* Encoding of read frames */
+    PciLeechEncoder encoder;
+    struct PciLeechFrame *workers;
+    QTAILQ_HEAD(, PciLeechFrame) frames;
+    QTAILQ_HEAD(, PciLeechFrame) idle;
+    uint32_t encoding;          /* Frames in the thread pool */
+    uint32_t bounces;           /* Bounce buffers held, bounce_lock */
+    /* Filled by the channel, replaced by the memory listener */
+    PciLeechCache *cache;
+    /* Detects strided reads for read-ahead */
+    uint64_t ra_last;
+    uint64_t ra_stride;
+    uint32_t ra_streak;
+    /* Write combining */
+    uint8_t *wc_buffer;         /* PCILEECH_WC_SIZE bytes */
+    uint64_t wc_address;
+    uint32_t wc_length;
+    MemTxResult wc_result;      /* Of the flushes since the last FLUSH */
+    QEMUTimer *wc_timer;
+    /* TLP pacing, in QEMU_CLOCK_VIRTUAL nanoseconds */
+    QEMUTimer *pace_timer;
+    /* Wake-ups for when the I/O limits allow the next frame */
+    ThrottleTimers throttle_timers;
+    bool throttled;
+    int64_t pace_deadline;      /* The next frame may go out, or 0 */
+    int64_t link_free;          /* The link carried the previous frame */
+    /* Communication */
+    IOThread *iothread;
+    CharBackend *chr;
+    CharBackend backend;    /* Unused by the first channel */
+    bool connected;
+    /* Accepted on the listen socket, which owns the chardev */
+    bool client;
+    QEMUBH *release_bh;     /* Gives the slot back once the client left */
+    /* Client input under record/replay, see pci_leech_channel_start() */
+    ReplayCharFe *rr;
+    uint32_t rr_pending;    /* Bytes recorded but not yet passed on */
+} PciLeechChannel;
+
+struct PciLeechState {
+    /* Internal State */
+    PCIDevice device;
+    PciLeechChannel *channels;
+    uint32_t num_channels;
+    /* Configuration */
+    uint32_t chunk_size;
+    uint32_t queue_depth;
+    char *transport;
+    uint64_t shm_size;
+    IOThread *iothread;
+    uint32_t zstd_level;
+    uint32_t compress_threads;
+    uint32_t dma_threads;
+    uint32_t num_workers;       /* Frames per channel in the thread pool */
+    uint32_t bounce_buffers;
+    uint32_t num_channel_ids;
+    char **channel_ids;
+    uint32_t num_channel_iothreads;
+    char **channel_iothreads;
+    uint32_t num_node_contexts;
+    char **node_contexts;
+    uint32_t node_threads;
+    PciLeechNode *nodes;        /* One per entry of node_contexts */
+    char *listen;
+    uint32_t max_clients;
+    bool tlp_pacing;
+    PCIExpLinkSpeed link_speed;
+    PCIExpLinkWidth link_width;
+    uint32_t mps;
+    uint32_t mrrs;
+    uint32_t tags;
+    uint32_t completion_latency;
+    /* Shared-memory transport */
+    bool shm;
+    uint8_t *shm_ptr;
+    int shm_fd;
+    uint32_t shm_consumed;
+    EventNotifier shm_kick;
+    EventNotifier shm_done;
+    PciLeechStats stats;
+    /* Channel that started dirty tracking, protected by the BQL */
+    PciLeechChannel *dirty_log;
+    /* Its watched ranges, struct LeechMemoryRange, also under the BQL */
+    GArray *watches;
+    QEMUTimer *watch_timer;
+    QemuMutex watch_lock;
+    GArray *watch_events;       /* struct LeechWatchEvent, watch_lock */
+    /* Frozen view of the guest RAM; the owner is protected by the BQL */
+    struct PciLeechSnapshot *snapshot;
+    PciLeechChannel *snapshot_owner;
+    /* Invalidates the channels' caches and rebuilds the RAM map */
+    MemoryListener cache_listener;
+    bool cache_stale;
+    PciLeechRamMap *ram_map;
+    /* DMA goes through a vIOMMU */
+    bool iommu;
+    uint32_t read_ahead;        /* Window size, or 0 */
+    uint32_t read_ahead_ttl;    /* Microseconds */
+    QemuMutex ra_lock;
+    PciLeechReadAhead ra[PCILEECH_RA_ENTRIES];
+    uint32_t ra_next;           /* Window replaced next */
+    uint32_t ra_generation;     /* Counts the invalidations */
+    /* Address Translation Cache of the PCIe variant */
+    bool ats;
+    bool pasid;                 /* The PCIe variant has a PASID capability */
+    bool atc_registered;        /* atc_notifier is set up */
+    IOMMUNotifier atc_notifier;
+    QemuMutex atc_lock;
+    PciLeechAtcEntry atc[PCILEECH_ATC_ENTRIES];
+    uint32_t atc_generation;    /* Counts the invalidations, atc_lock */
+    /* Dump that is served instead of guest memory */
+    char *replay;
+    char *replay_map;               /* .memmap of a mapped-ram migration */
+    GMappedFile *replay_file;
+    const uint8_t *replay_notes;    /* PT_NOTE of an ELF dump */
+    uint64_t replay_notes_size;
+    /* Registers in BAR 0; the mailbox is served by the first channel */
+    bool mailbox;
+    MemoryRegion mbox_mmio;
+    QemuMutex mbox_lock;
+    PciLeechRing mbox_tx;
+    PciLeechRing mbox_rx;
+    uint32_t mbox_irq_status;
+    uint32_t mbox_irq_mask;
+    bool mbox_connected;
+    QEMUBH *mbox_bh;            /* Pushes guest messages to the client */
+    QEMUBH *mbox_irq_bh;        /* Updates the interrupt under the BQL */
+    uint32_t msix_vectors;      /* MSI-X instead of MSI, BAR 1 */
+    /* Events for guest agents, protected by mbox_lock */
+    bool events;
+    uint32_t done_count;
+    uint32_t watch_count;
+    uint64_t watch_base;
+    uint64_t watch_size;
+    uint64_t watch_hit;
+    uint32_t coalesce_count;
+    uint32_t coalesce_time;     /* Microseconds */
+    uint32_t event_irqs;        /* Held back by coalescing */
+    uint32_t event_batch;
+    QEMUTimer *event_timer;
+    /*
+     * Bounce buffers of the frames, chunk_size bytes each, shared by all
+     * channels and allocated on first use up to bounce_limit.
+     */
+    QemuMutex bounce_lock;
+    uint8_t **bounce_free;
+    uint32_t bounce_num_free;
+    uint32_t bounce_allocated;
+    uint32_t bounce_limit;
+    uint32_t bounce_waiters;    /* Channels waiting, one bit by index */
+    uint32_t num_connected;     /* Channels sharing the pool */
+    /* Token buckets of the limits property, shared by all channels */
+    QemuMutex throttle_lock;
+    ThrottleState throttle;
+    QEMUClockType throttle_clock;
     /* Communication */
     CharBackend chardev;
+    QIONetListener *listener;
+    uint32_t first_client;      /* Channels from here on are the listen's */
 };
 
 typedef struct LeechRequestHeader LeechRequestHeader;
 typedef struct LeechResponseHeader LeechResponseHeader;
+typedef struct LeechCapabilities LeechCapabilities;
+typedef struct LeechScatterEntry LeechScatterEntry;
+typedef struct LeechScatterResult LeechScatterResult;
+typedef struct LeechShmHello LeechShmHello;
+typedef struct LeechShmHeader LeechShmHeader;
+typedef struct LeechShmDescriptor LeechShmDescriptor;
 typedef struct PciLeechState PciLeechState;
 
-DECLARE_INSTANCE_CHECKER(PciLeechState, PCILEECH, TYPE_PCILEECH_DEVICE)
+DECLARE_INSTANCE_CHECKER(PciLeechState, PCILEECH, TYPE_PCILEECH_BASE)
+
+static void pci_leech_account_time(Stat64 *total, Stat64 *histogram,
+                                   int64_t start)
+{
+    const uint64_t ns = get_clock() - start;
+    stat64_add(total, ns);
+    stat64_add(&histogram[MIN(64 - clz64(ns), PCILEECH_STATS_BUCKETS - 1)], 1);
+}
+
+static void pci_leech_account_dma(PciLeechState *state, MemTxResult result,
+                                  int64_t start)
+{
+    pci_leech_account_time(&state->stats.dma_time, state->stats.dma_latency,
+                           start);
+    if (result != MEMTX_OK) {
+        stat64_add(&state->stats.dma_errors, 1);
+    }
+}
+
+static void pci_leech_account_send(PciLeechState *state, int64_t start)
+{
+    pci_leech_account_time(&state->stats.send_time, state->stats.send_latency,
+                           start);
+}
 
 static uint32_t pci_leech_convert_result(MemTxResult result)
 {
@@ -103,145 +1033,5156 @@ static uint32_t pci_leech_convert_result(MemTxResult result)
     }
 }
 
-static void pci_leech_process_write_request(PciLeechState *state,
-                                            const uint8_t *buf, int size)
+/*
+ * Send a response header followed by @length bytes of @payload, in one
+ * write. A NULL @payload leaves the data to the caller.
+ */
+static void pci_leech_send_reply(PciLeechChannel *ch, uint32_t tag,
+                                 uint32_t result, const void *payload,
+                                 uint64_t length)
 {
-    const uint64_t address = state->request.address + state->written_length;
     struct LeechResponseHeader response = { 0 };
-    /* Write memory via DMA. */
-    MemTxResult result = pci_dma_write(&state->device, address, buf, size);
-    /* Send a response. */
-    response.result = cpu_to_le32(pci_leech_convert_result(result));
-    response.length = 0;
-    qemu_chr_fe_write_all(&state->chardev, (uint8_t *)&response,
-                            sizeof(response));
-    /* Increment written length counter. */
-    state->written_length += size;
-    /* Check if write-operation is fulfilled. */
-    if (state->written_length == state->request.length) {
-        state->written_length = 0;
-        state->write_pending = false;
+    struct iovec iov[2] = {
+        { .iov_base = &response, .iov_len = sizeof(response) },
+        { .iov_base = (void *)payload, .iov_len = length },
+    };
+    trace_pcileech_send_response(ch->state, tag, result, length);
+    /* Flip byte-order to little-endian. */
+    response.result = cpu_to_le32(result);
+    response.tag = cpu_to_le32(tag);
+    response.length = cpu_to_le64(length);
+    qemu_chr_fe_writev_all(ch->chr, iov, payload ? 2 : 1);
+}
+
+static void pci_leech_send_response(PciLeechChannel *ch, uint32_t tag,
+                                    uint32_t result, uint64_t length)
+{
+    pci_leech_send_reply(ch, tag, result, NULL, length);
+}
+
+/*
+ * Map a chunk of plain guest RAM, saving the copy through the transfer
+ * buffer. Returns false without touching guest memory if the range is
+ * MMIO, unassigned, read-only for a write or cannot be mapped whole.
+ */
+static bool pci_leech_chunk_map(PciLeechState *state, uint64_t address,
+                                uint64_t length, DMADirection dir,
+                                PciLeechChunk *chunk)
+{
+    const bool is_write = dir == DMA_DIRECTION_FROM_DEVICE;
+    if (state->replay_file) {
+        return false;
+    }
+    chunk->maplen = length;
+    WITH_RCU_READ_LOCK_GUARD() {
+        AddressSpace *as = pci_get_address_space(&state->device);
+        hwaddr xlat, len = length;
+        MemoryRegion *mr = address_space_translate(as, address, &xlat, &len,
+                                                   is_write,
+                                                   MEMTXATTRS_UNSPECIFIED);
+        /* Mapping MMIO would go through a bounce buffer; avoid that. */
+        if (len < length || !memory_access_is_direct(mr, is_write)) {
+            return false;
+        }
+        chunk->ptr = pci_dma_map(&state->device, address, &chunk->maplen,
+                                 dir);
+    }
+    if (!chunk->ptr) {
+        return false;
     }
+    if (chunk->maplen < length) {
+        pci_dma_unmap(&state->device, chunk->ptr, chunk->maplen, dir, 0);
+        return false;
+    }
+    chunk->mapped = true;
+    chunk->result = MEMTX_OK;
+    return true;
 }
 
-static void pci_leech_process_read_request(PciLeechState *state)
+/* Called within call_rcu(). */
+static void pci_leech_cache_free(PciLeechCache *cache)
 {
-    uint8_t buff[PCILEECH_BUFFER_SIZE];
-    struct LeechRequestHeader *request = &state->request;
-    for (uint64_t i = 0; i < request->length; i += sizeof(buff)) {
-        struct LeechResponseHeader response = { 0 };
-        const uint64_t readlen = (request->length - i) <= sizeof(buff) ?
-                                    (request->length - i) : sizeof(buff);
-        /* Read memory via DMA. */
-        MemTxResult result = pci_dma_read(&state->device, request->address + i,
-                                                            buff, readlen);
-        /* Flip byte-order to little-endian. */
-        response.result = cpu_to_le32(pci_leech_convert_result(result));
-        response.length = cpu_to_le64(readlen);
-        /* Send a header. The data follow after it. */
-        qemu_chr_fe_write_all(&state->chardev, (uint8_t *)&response,
-                            sizeof(struct LeechResponseHeader));
-        qemu_chr_fe_write_all(&state->chardev, buff, readlen);
+    for (int i = 0; i < PCILEECH_CACHE_ENTRIES; i++) {
+        if (cache->entries[i].valid) {
+            address_space_cache_destroy(&cache->entries[i].mrc);
+        }
     }
+    g_free(cache);
 }
 
-static void pci_leech_chardev_read_handler(void *opaque, const uint8_t *buf,
-                                            int size)
-{
-    PciLeechState *state = PCILEECH(opaque);
-    uint8_t* req_buff = (uint8_t *)&state->request;
-    if (state->write_pending) {
-        /* Complete pending write operation.*/
-        /* puts("PCILeech: Dispatching to pending-write handler..."); */
-        pci_leech_process_write_request(state, buf, size);
-    } else {
-        /* Copy request to internal state. */
-        /* puts("PCILeech: Dispatching to general handler..."); */
-        memcpy(&req_buff[state->pos], buf, sizeof(struct LeechRequestHeader) -
-                                                                state->pos);
-        /* Flip byte-order to little-endian. */
-        state->request.address = le64_to_cpu(state->request.address);
-        state->request.length = le64_to_cpu(state->request.length);
-        state->pos = 0;
-        /* Dispatch command. */
-        switch (state->request.command) {
-        case PCILEECH_REQUEST_READ:
-            /* Dispatch the read-request immediately. */
-            pci_leech_process_read_request(state);
-            break;
-        case PCILEECH_REQUEST_WRITE:
-            /* In this context, we don't have data right now. */
-            /* Set to write-pending state */
-            state->write_pending = true;
-            state->written_length = 0;
-            break;
-        default:
-            printf("PCILeech: unknown request command (%u) is received!\n",
-                                                state->request.command);
-            break;
+/*
+ * Copy a small read out of the channel's cache, setting up the entry
+ * for its window on a miss. Returns false if the range is not plain RAM.
+ */
+static bool pci_leech_cache_read(PciLeechChannel *ch, uint64_t address,
+                                 uint8_t *buf, uint64_t length)
+{
+    const uint64_t base = QEMU_ALIGN_DOWN(address, PCILEECH_CACHE_WINDOW);
+    PciLeechCacheEntry *entry;
+    PciLeechCache *cache;
+    if (length > PCILEECH_CACHE_MAX_READ ||
+        address - base + length > PCILEECH_CACHE_WINDOW) {
+        return false;
+    }
+    RCU_READ_LOCK_GUARD();
+    cache = qatomic_rcu_read(&ch->cache);
+    entry = &cache->entries[(base / PCILEECH_CACHE_WINDOW) %
+                            PCILEECH_CACHE_ENTRIES];
+    if (!entry->valid || entry->base != base) {
+        if (entry->valid) {
+            address_space_cache_destroy(&entry->mrc);
+            entry->valid = false;
         }
+        if (address_space_cache_init(&entry->mrc,
+                                     pci_get_address_space(&ch->state->device),
+                                     base, PCILEECH_CACHE_WINDOW,
+                                     false) < 0) {
+            return false;
+        }
+        entry->base = base;
+        entry->valid = true;
+        trace_pcileech_cache_fill(ch->state, ch->index, base,
+                                  entry->mrc.ptr ? entry->mrc.len : 0);
+    }
+    /* MMIO is left to the slow path, as are the ends of RAM sections. */
+    if (!entry->mrc.ptr || address - base + length > entry->mrc.len) {
+        return false;
     }
+    memcpy(buf, (uint8_t *)entry->mrc.ptr + (address - base), length);
+    return true;
 }
 
-static int pci_leech_chardev_can_read_handler(void *opaque)
+/* Called within call_rcu(). */
+static void pci_leech_ram_map_free(PciLeechRamMap *map)
 {
-    PciLeechState *state = PCILEECH(opaque);
-    if (state->write_pending) {
-        /* Calculate the remaining pending length to write. */
-        const uint64_t remainder = state->request.length -
-                                    state->written_length;
-        /* Limit receiving buffer to PCILEECH_BUFFER_SIZE. */
-        return (remainder > PCILEECH_BUFFER_SIZE) ? PCILEECH_BUFFER_SIZE :
-                                                        (int)remainder;
-    } else {
-        /* No pending operations, so let's just receive a request header. */
-        return sizeof(struct LeechRequestHeader);
+    for (guint i = 0; i < map->ranges->len; i++) {
+        memory_region_unref(g_array_index(map->ranges, PciLeechRamRange,
+                                          i).mr);
     }
+    g_array_unref(map->ranges);
+    g_free(map);
 }
 
-static void pci_leech_realize(PCIDevice *pdev, Error **errp)
+/* The host node a memory backend binds its RAM to, or -1. */
+static int pci_leech_mr_node(const MemoryRegion *mr)
 {
-    PciLeechState *state = PCILEECH(pdev);
-    qemu_chr_fe_set_handlers(&state->chardev,
-                            pci_leech_chardev_can_read_handler,
-                            pci_leech_chardev_read_handler,
-                            NULL, NULL, state, NULL, true);
+    HostMemoryBackend *backend = (HostMemoryBackend *)
+        object_dynamic_cast(mr->owner, TYPE_MEMORY_BACKEND);
+    if (!backend || (backend->policy != HOST_MEM_POLICY_BIND &&
+                     backend->policy != HOST_MEM_POLICY_PREFERRED) ||
+        bitmap_count_one(backend->host_nodes, MAX_NODES) != 1) {
+        return -1;
+    }
+    return find_first_bit(backend->host_nodes, MAX_NODES);
 }
 
-static Property leech_properties[] = {
-    DEFINE_PROP_CHR("chardev", PciLeechState, chardev),
-    DEFINE_PROP_END_OF_LIST(),
-};
+static bool pci_leech_ram_map_cb(Int128 start, Int128 len,
+                                 const MemoryRegion *mr,
+                                 hwaddr offset_in_region, void *opaque)
+{
+    GArray *ranges = opaque;
+    PciLeechRamRange range;
+    if (!mr->ram || mr->ram_device) {
+        return false;
+    }
+    range.start = int128_get64(start);
+    range.size = int128_get64(len);
+    range.mr = (MemoryRegion *)mr;
+    range.host = (uint8_t *)memory_region_get_ram_ptr(range.mr) +
+                 offset_in_region;
+    range.node = pci_leech_mr_node(mr);
+    memory_region_ref(range.mr);
+    g_array_append_val(ranges, range);
+    return false;
+}
 
-static void pci_leech_class_init(ObjectClass *class, void *data)
+/* Called with the BQL held, from the memory listener. */
+static void pci_leech_ram_map_update(PciLeechState *state)
 {
-    DeviceClass *dc = DEVICE_CLASS(class);
-    PCIDeviceClass *k = PCI_DEVICE_CLASS(class);
-    k->realize = pci_leech_realize;
-    /* Change the Vendor/Device ID to your favor. */
-    /* These are the default values from PCILeech-FPGA. */
-    k->vendor_id = PCI_VENDOR_ID_XILINX;
-    k->device_id = 0x0666;
-    k->revision = 0;
-    k->class_id = PCI_CLASS_NETWORK_ETHERNET;
-    device_class_set_props(dc, leech_properties);
-    set_bit(DEVICE_CATEGORY_MISC, dc->categories);
+    PciLeechRamMap *old = state->ram_map;
+    PciLeechRamMap *map = g_new0(PciLeechRamMap, 1);
+    AddressSpace *as = pci_get_address_space(&state->device);
+    map->ranges = g_array_new(false, false, sizeof(PciLeechRamRange));
+    WITH_RCU_READ_LOCK_GUARD() {
+        flatview_for_each_range(address_space_to_flatview(as),
+                                pci_leech_ram_map_cb, map->ranges);
+    }
+    qatomic_rcu_set(&state->ram_map, map);
+    if (old) {
+        call_rcu(old, pci_leech_ram_map_free, rcu);
+    }
 }
 
-static void pci_leech_register_types(void)
+/* The range of @map that holds @address, or NULL. */
+static PciLeechRamRange *pci_leech_ram_find(PciLeechRamMap *map,
+                                            uint64_t address)
 {
-    static InterfaceInfo interfaces[] = {
-        {INTERFACE_CONVENTIONAL_PCI_DEVICE},
-        {},
-    };
-    static const TypeInfo leech_info = {
-        .name = TYPE_PCILEECH_DEVICE,
-        .parent = TYPE_PCI_DEVICE,
-        .instance_size = sizeof(PciLeechState),
-        .class_init = pci_leech_class_init,
-        .interfaces = interfaces,
+    PciLeechRamRange *range;
+    guint lo = 0, hi;
+    if (!map || !map->ranges->len) {
+        return NULL;
+    }
+    /* Find the last range that starts at or below @address. */
+    hi = map->ranges->len;
+    while (hi - lo > 1) {
+        guint mid = lo + (hi - lo) / 2;
+        if (g_array_index(map->ranges, PciLeechRamRange, mid).start <=
+            address) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+    range = &g_array_index(map->ranges, PciLeechRamRange, lo);
+    if (address < range->start || address - range->start >= range->size) {
+        return NULL;
+    }
+    return range;
+}
+
+/*
+ * Point @chunk at guest RAM without translating, if the whole range is
+ * within one RAM section. The section stays referenced until it is put.
+ */
+static bool pci_leech_ram_get(PciLeechState *state, uint64_t address,
+                              uint64_t length, PciLeechChunk *chunk)
+{
+    PciLeechRamRange *range;
+    RCU_READ_LOCK_GUARD();
+    range = pci_leech_ram_find(qatomic_rcu_read(&state->ram_map), address);
+    if (!range || length > range->size - (address - range->start)) {
+        return false;
+    }
+    memory_region_ref(range->mr);
+    chunk->ptr = range->host + (address - range->start);
+    chunk->ram = range->mr;
+    chunk->mapped = false;
+    chunk->result = MEMTX_OK;
+    return true;
+}
+
+/*
+ * Read-only guest memory from a dump: an ELF core from dump-guest-memory,
+ * whose PT_LOAD segments give the physical layout, or a raw image of
+ * physical memory from address 0. The dump is the RAM map, never rebuilt.
+ */
+static int pci_leech_replay_compare(gconstpointer a, gconstpointer b)
+{
+    const PciLeechRamRange *x = a, *y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static bool pci_leech_replay_sort(PciLeechState *state, GArray *ranges,
+                                  Error **errp)
+{
+    g_array_sort(ranges, pci_leech_replay_compare);
+    for (guint i = 1; i < ranges->len; i++) {
+        PciLeechRamRange *prev = &g_array_index(ranges, PciLeechRamRange,
+                                                i - 1);
+        if (prev->start + prev->size >
+            g_array_index(ranges, PciLeechRamRange, i).start) {
+            error_setg(errp, "segments of replay file '%s' overlap",
+                       state->replay);
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool pci_leech_replay_parse(PciLeechState *state, GArray *ranges,
+                                   Error **errp)
+{
+    uint8_t *map = (uint8_t *)g_mapped_file_get_contents(state->replay_file);
+    const uint64_t size = g_mapped_file_get_length(state->replay_file);
+    PciLeechRamRange range = { .node = -1 };
+    uint64_t phoff, phend;
+    uint16_t phnum;
+    Elf64_Ehdr ehdr;
+    if (size < SELFMAG || memcmp(map, ELFMAG, SELFMAG)) {
+        range.size = size;
+        range.host = map;
+        if (size) {
+            g_array_append_val(ranges, range);
+        }
+        return true;
+    }
+    memcpy(&ehdr, map, MIN(size, sizeof(ehdr)));
+    if (size < sizeof(ehdr) || ehdr.e_ident[EI_CLASS] != ELFCLASS64 ||
+        ehdr.e_ident[EI_DATA] != ELFDATA2LSB ||
+        le16_to_cpu(ehdr.e_type) != ET_CORE) {
+        error_setg(errp, "replay file '%s' is not a little-endian 64-bit "
+                   "ELF core dump", state->replay);
+        return false;
+    }
+    phoff = le64_to_cpu(ehdr.e_phoff);
+    phnum = le16_to_cpu(ehdr.e_phnum);
+    if (umul64_overflow(phnum, sizeof(Elf64_Phdr), &phend) ||
+        uadd64_overflow(phend, phoff, &phend) || phend > size) {
+        error_setg(errp, "program headers of replay file '%s' do not fit "
+                   "in the file", state->replay);
+        return false;
+    }
+    for (uint16_t i = 0; i < phnum; i++) {
+        uint64_t offset, end;
+        Elf64_Phdr phdr;
+        memcpy(&phdr, map + phoff + i * sizeof(phdr), sizeof(phdr));
+        offset = le64_to_cpu(phdr.p_offset);
+        if (le32_to_cpu(phdr.p_type) == PT_NOTE && !state->replay_notes &&
+            !uadd64_overflow(offset, le64_to_cpu(phdr.p_filesz), &end) &&
+            end <= size) {
+            /* The vCPU states of the dump, for PCILEECH_REQUEST_CPU_STATE */
+            state->replay_notes = map + offset;
+            state->replay_notes_size = le64_to_cpu(phdr.p_filesz);
+        }
+        if (le32_to_cpu(phdr.p_type) != PT_LOAD || !phdr.p_filesz) {
+            continue;
+        }
+        range.size = le64_to_cpu(phdr.p_filesz);
+        range.start = le64_to_cpu(phdr.p_paddr);
+        if (uadd64_overflow(offset, range.size, &end) || end > size ||
+            uadd64_overflow(range.start, range.size, &end)) {
+            error_setg(errp, "segment %u of replay file '%s' is truncated",
+                       i, state->replay);
+            return false;
+        }
+        range.host = map + offset;
+        g_array_append_val(ranges, range);
+    }
+    return pci_leech_replay_sort(state, ranges, errp);
+}
+
+/*
+ * A migration file written with the mapped-ram capability keeps every
+ * RAM block at a fixed offset; the "gpa length offset" lines of the
+ * .memmap written next to it place those blocks in physical memory.
+ */
+static bool pci_leech_replay_parse_map(PciLeechState *state, GArray *ranges,
+                                       Error **errp)
+{
+    uint8_t *map = (uint8_t *)g_mapped_file_get_contents(state->replay_file);
+    const uint64_t size = g_mapped_file_get_length(state->replay_file);
+    g_autoptr(GError) gerr = NULL;
+    g_autofree char *contents = NULL;
+    g_auto(GStrv) lines = NULL;
+    if (!g_file_get_contents(state->replay_map, &contents, NULL, &gerr)) {
+        error_setg(errp, "cannot read replay map '%s': %s", state->replay_map,
+                   gerr->message);
+        return false;
+    }
+    lines = g_strsplit(contents, "\n", -1);
+    for (guint i = 0; lines[i]; i++) {
+        g_auto(GStrv) fields = g_strsplit_set(g_strstrip(lines[i]), " \t", 3);
+        PciLeechRamRange range = { .node = -1 };
+        uint64_t offset, end;
+        if (!lines[i][0] || lines[i][0] == '#') {
+            continue;
+        }
+        if (g_strv_length(fields) != 3 ||
+            qemu_strtou64(fields[0], NULL, 0, &range.start) ||
+            qemu_strtou64(fields[1], NULL, 0, &range.size) ||
+            qemu_strtou64(fields[2], NULL, 0, &offset)) {
+            error_setg(errp, "line %u of replay map '%s' is not "
+                       "'gpa length offset'", i + 1, state->replay_map);
+            return false;
+        }
+        if (uadd64_overflow(offset, range.size, &end) || end > size ||
+            uadd64_overflow(range.start, range.size, &end)) {
+            error_setg(errp, "line %u of replay map '%s' is outside of "
+                       "replay file '%s'", i + 1, state->replay_map,
+                       state->replay);
+            return false;
+        }
+        if (range.size) {
+            range.host = map + offset;
+            g_array_append_val(ranges, range);
+        }
+    }
+    return pci_leech_replay_sort(state, ranges, errp);
+}
+
+static bool pci_leech_replay_init(PciLeechState *state, Error **errp)
+{
+    g_autoptr(GError) gerr = NULL;
+    state->replay_file = g_mapped_file_new(state->replay, FALSE, &gerr);
+    if (!state->replay_file) {
+        error_setg(errp, "cannot map replay file '%s': %s", state->replay,
+                   gerr->message);
+        return false;
+    }
+    state->ram_map = g_new0(PciLeechRamMap, 1);
+    state->ram_map->ranges = g_array_new(false, false,
+                                         sizeof(PciLeechRamRange));
+    if (state->replay_map) {
+        return pci_leech_replay_parse_map(state, state->ram_map->ranges,
+                                          errp);
+    }
+    return pci_leech_replay_parse(state, state->ram_map->ranges, errp);
+}
+
+static void pci_leech_replay_cleanup(PciLeechState *state)
+{
+    if (state->ram_map) {
+        pci_leech_ram_map_free(state->ram_map);
+        state->ram_map = NULL;
+    }
+    if (state->replay_file) {
+        g_mapped_file_unref(state->replay_file);
+        state->replay_file = NULL;
+        state->replay_notes = NULL;
+        state->replay_notes_size = 0;
+    }
+}
+
+/* Copy from the dump; holes read as zeros and fail the access. */
+static MemTxResult pci_leech_replay_read(PciLeechState *state,
+                                         uint64_t address, uint8_t *buf,
+                                         uint64_t length)
+{
+    GArray *ranges = state->ram_map->ranges;
+    uint64_t copied = 0;
+    memset(buf, 0, length);
+    for (guint i = 0; i < ranges->len; i++) {
+        PciLeechRamRange *range = &g_array_index(ranges, PciLeechRamRange, i);
+        const uint64_t first = MAX(address, range->start);
+        const uint64_t last = MIN(address + length,
+                                  range->start + range->size);
+        if (first < last) {
+            memcpy(buf + (first - address),
+                   range->host + (first - range->start), last - first);
+            copied += last - first;
+        }
+    }
+    return copied == length ? MEMTX_OK : MEMTX_DECODE_ERROR;
+}
+
+/*
+ * A snapshot write-protects the guest RAM with userfaultfd. The first
+ * write to a page faults; the fault thread saves the page's contents
+ * and lifts the protection so that the write goes ahead. Readers copy
+ * the live RAM and then overlay the saved pages, as a page is saved
+ * before it may change.
+ */
+typedef struct PciLeechSnapshotRange {
+    void *host;
+    uint64_t length;
+} PciLeechSnapshotRange;
+
+typedef struct PciLeechSnapshot {
+    struct rcu_head rcu;
+    int uffd;
+    QemuThread thread;
+    EventNotifier quit;
+    GArray *ranges;             /* Registered with the userfaultfd */
+    Error *blocker;
+    QemuMutex lock;
+    GHashTable *pages;          /* Host page address to saved copy */
+} PciLeechSnapshot;
+
+/* Replace what @buf has of the live @host with the saved pages. */
+static void pci_leech_snapshot_overlay(PciLeechSnapshot *snap,
+                                       uint8_t *host, uint8_t *buf,
+                                       uint64_t length)
+{
+    ram_addr_t offset;
+    RAMBlock *block = qemu_ram_block_from_host(host, false, &offset);
+    const uintptr_t start = (uintptr_t)host, end = start + length;
+    size_t page_size;
+    if (!block) {
+        return;
+    }
+    page_size = qemu_ram_pagesize(block);
+    /* The live data must be read before looking for saved pages. */
+    smp_mb();
+    QEMU_LOCK_GUARD(&snap->lock);
+    if (!g_hash_table_size(snap->pages)) {
+        return;
+    }
+    for (uintptr_t page = QEMU_ALIGN_DOWN(start, page_size); page < end;
+         page += page_size) {
+        const uint8_t *copy = g_hash_table_lookup(snap->pages,
+                                                  (gpointer)page);
+        if (copy) {
+            const uintptr_t first = MAX(page, start);
+            const uintptr_t last = MIN(page + page_size, end);
+            memcpy(buf + (first - start), copy + (first - page),
+                   last - first);
+        }
+    }
+}
+
+/*
+ * Read @length bytes at @address from the snapshot. Returns false if
+ * there is none or the range is not all RAM.
+ */
+static bool pci_leech_snapshot_read(PciLeechState *state, uint64_t address,
+                                    uint8_t *buf, uint64_t length)
+{
+    PciLeechSnapshot *snap;
+    PciLeechRamMap *map;
+    uint64_t copied = 0;
+    RCU_READ_LOCK_GUARD();
+    snap = qatomic_rcu_read(&state->snapshot);
+    map = qatomic_rcu_read(&state->ram_map);
+    if (!snap || !map) {
+        return false;
+    }
+    for (guint i = 0; i < map->ranges->len && copied < length; i++) {
+        PciLeechRamRange *range = &g_array_index(map->ranges,
+                                                 PciLeechRamRange, i);
+        const uint64_t first = MAX(address, range->start);
+        const uint64_t last = MIN(address + length,
+                                  range->start + range->size);
+        if (first < last) {
+            uint8_t *host = range->host + (first - range->start);
+            memcpy(buf + (first - address), host, last - first);
+            pci_leech_snapshot_overlay(snap, host, buf + (first - address),
+                                       last - first);
+            copied += last - first;
+        }
+    }
+    if (copied != length) {
+        return false;
+    }
+    pci_dma_plugin_cb(&state->device, address, length,
+                      DMA_DIRECTION_TO_DEVICE);
+    return true;
+}
+
+/* DMA to and from the device's address space, or the dump. */
+static MemTxResult pci_leech_dma_read(PciLeechState *state, uint64_t address,
+                                      void *buf, uint64_t length)
+{
+    if (state->replay_file) {
+        return pci_leech_replay_read(state, address, buf, length);
+    }
+    if (!state->iommu && pci_leech_snapshot_read(state, address, buf,
+                                                 length)) {
+        return MEMTX_OK;
+    }
+    return pci_dma_read(&state->device, address, buf, length);
+}
+
+/* Drop the windows read ahead that overlap a range about to change. */
+static void pci_leech_read_ahead_invalidate(PciLeechState *state,
+                                            uint64_t address,
+                                            uint64_t length)
+{
+    if (!state->read_ahead) {
+        return;
+    }
+    QEMU_LOCK_GUARD(&state->ra_lock);
+    state->ra_generation++;
+    for (int i = 0; i < PCILEECH_RA_ENTRIES; i++) {
+        PciLeechReadAhead *ra = &state->ra[i];
+        if (ra->length && ranges_overlap(ra->base, ra->length,
+                                         address, length)) {
+            ra->length = 0;
+        }
+    }
+}
+
+static MemTxResult pci_leech_dma_write(PciLeechState *state,
+                                       uint64_t address, const void *buf,
+                                       uint64_t length)
+{
+    if (state->replay_file) {
+        return MEMTX_ACCESS_ERROR;
+    }
+    pci_leech_read_ahead_invalidate(state, address, length);
+    return pci_dma_write(&state->device, address, buf, length);
+}
+
+static void pci_leech_cache_region_changed(MemoryListener *listener,
+                                           MemoryRegionSection *section)
+{
+    PciLeechState *state = container_of(listener, PciLeechState,
+                                        cache_listener);
+    state->cache_stale = true;
+}
+
+static void pci_leech_cache_commit(MemoryListener *listener)
+{
+    PciLeechState *state = container_of(listener, PciLeechState,
+                                        cache_listener);
+    if (!state->cache_stale) {
+        return;
+    }
+    state->cache_stale = false;
+    pci_leech_ram_map_update(state);
+    pci_leech_read_ahead_invalidate(state, 0, UINT64_MAX);
+    for (uint32_t i = 0; i < state->num_channels; i++) {
+        PciLeechChannel *ch = &state->channels[i];
+        PciLeechCache *old = ch->cache;
+        qatomic_rcu_set(&ch->cache, g_new0(PciLeechCache, 1));
+        call_rcu(old, pci_leech_cache_free, rcu);
+    }
+}
+
+/* Drop the cached translations that overlap @first..@last. */
+static void pci_leech_atc_invalidate(PciLeechState *state, hwaddr first,
+                                     hwaddr last)
+{
+    QEMU_LOCK_GUARD(&state->atc_lock);
+    state->atc_generation++;
+    for (uint32_t i = 0; i < PCILEECH_ATC_ENTRIES; i++) {
+        PciLeechAtcEntry *entry = &state->atc[i];
+        if (entry->perm != IOMMU_NONE && entry->iova <= last &&
+            (entry->iova | entry->addr_mask) >= first) {
+            entry->perm = IOMMU_NONE;
+        }
+    }
+}
+
+/* Device-IOTLB invalidations of the IOMMU reach the ATC here. */
+static void pci_leech_atc_notify(IOMMUNotifier *n, IOMMUTLBEntry *iotlb)
+{
+    PciLeechState *state = container_of(n, PciLeechState, atc_notifier);
+    trace_pcileech_atc_invalidate(state, iotlb->iova, iotlb->addr_mask);
+    pci_leech_atc_invalidate(state, iotlb->iova,
+                             iotlb->iova | iotlb->addr_mask);
+}
+
+static PciLeechAtcEntry *pci_leech_atc_slot(PciLeechState *state,
+                                            hwaddr iova)
+{
+    return &state->atc[(iova >> 12) % PCILEECH_ATC_ENTRIES];
+}
+
+/* Append @len bytes at @iova, translated by @entry, to @runs. */
+static bool pci_leech_atc_add_run(const PciLeechAtcEntry *entry, hwaddr iova,
+                                  hwaddr len, IOMMUTLBRun *runs,
+                                  int *nr_runs)
+{
+    hwaddr translated = (entry->translated_addr & ~entry->addr_mask) |
+                        (iova & entry->addr_mask);
+    IOMMUTLBRun *prev = *nr_runs ? &runs[*nr_runs - 1] : NULL;
+    if (prev && prev->target_as == entry->target_as &&
+        prev->translated_addr + prev->len == translated) {
+        prev->len += len;
+        return true;
+    }
+    if (*nr_runs == PCILEECH_IOMMU_RUNS) {
+        return false;
+    }
+    runs[(*nr_runs)++] = (IOMMUTLBRun) {
+        .target_as = entry->target_as,
+        .iova = iova,
+        .translated_addr = translated,
+        .len = len,
+        .perm = entry->perm,
+    };
+    return true;
+}
+
+/*
+ * Like pci_leech_iommu_translate(), but from the ATC: pages that miss
+ * are translated with ATS requests and cached until the IOMMU
+ * invalidates them. Called with the RCU read lock held.
+ */
+static bool pci_leech_atc_translate(PciLeechState *state, uint64_t address,
+                                    uint64_t length, IOMMUTLBRun *runs,
+                                    int *nr_runs)
+{
+    uint64_t done = 0, hits = 0;
+    *nr_runs = 0;
+    while (done < length) {
+        IOMMUTLBEntry result[PCILEECH_ATC_FILL];
+        const hwaddr iova = address + done;
+        PciLeechAtcEntry entry;
+        uint32_t generation;
+        hwaddr len;
+        ssize_t n;
+        WITH_QEMU_LOCK_GUARD(&state->atc_lock) {
+            entry = *pci_leech_atc_slot(state, iova);
+            generation = state->atc_generation;
+        }
+        if ((entry.perm & IOMMU_RO) && iova >= entry.iova &&
+            iova <= (entry.iova | entry.addr_mask)) {
+            hits++;
+        } else {
+            n = pci_ats_request_translation(&state->device, iova,
+                                            length - done, true, result,
+                                            ARRAY_SIZE(result));
+            trace_pcileech_ats_request(state, iova, length - done, n);
+            if (n <= 0 || !(result[0].perm & IOMMU_RO)) {
+                return false;
+            }
+            WITH_QEMU_LOCK_GUARD(&state->atc_lock) {
+                /* Unless an invalidation raced with the request */
+                for (ssize_t i = 0; i < n &&
+                     generation == state->atc_generation; i++) {
+                    /* Blocks are looked up by the page first missed */
+                    if (result[i].perm & IOMMU_RO) {
+                        *pci_leech_atc_slot(state,
+                                            i ? result[i].iova : iova) =
+                            result[i];
+                    }
+                }
+            }
+            entry = result[0];
+        }
+        len = MIN((entry.iova | entry.addr_mask) - iova + 1, length - done);
+        if (!pci_leech_atc_add_run(&entry, iova, len, runs, nr_runs)) {
+            return false;
+        }
+        done += len;
+    }
+    stat64_add(&state->stats.atc_hits, hits);
+    return true;
+}
+
+/*
+ * Translate @length bytes at IOVA @address into at most
+ * PCILEECH_IOMMU_RUNS contiguous @runs. Returns false if the range does
+ * not fully translate. Called with the RCU read lock held.
+ */
+static bool pci_leech_iommu_translate(PciLeechState *state, uint64_t address,
+                                      uint64_t length, IOMMUTLBRun *runs,
+                                      int *nr_runs)
+{
+    AddressSpace *as = pci_get_address_space(&state->device);
+    MemoryRegionSection section;
+    IOMMUMemoryRegion *iommu_mr;
+    hwaddr done;
+    if (state->atc_registered && pcie_ats_enabled(&state->device)) {
+        return pci_leech_atc_translate(state, address, length, runs,
+                                       nr_runs);
+    }
+    section = memory_region_find(as->root, address, length);
+    if (!section.mr) {
+        return false;
+    }
+    iommu_mr = memory_region_get_iommu(section.mr);
+    if (!iommu_mr || int128_lt(section.size, int128_make64(length))) {
+        memory_region_unref(section.mr);
+        return false;
+    }
+    done = memory_region_iommu_translate_range(
+        iommu_mr, section.offset_within_region, length, IOMMU_RO,
+        memory_region_iommu_attrs_to_index(iommu_mr, MEMTXATTRS_UNSPECIFIED),
+        runs, PCILEECH_IOMMU_RUNS, nr_runs);
+    memory_region_unref(section.mr);
+    return done >= length;
+}
+
+/*
+ * Read @length bytes at IOVA @address into @buf by translating the whole
+ * range up front and reading each run from its target address space.
+ * Returns false if the range does not fully translate, leaving the slow
+ * path to report the fault.
+ */
+static bool pci_leech_iommu_read(PciLeechState *state, uint64_t address,
+                                 uint64_t length, uint8_t *buf,
+                                 MemTxResult *result)
+{
+    IOMMUTLBRun runs[PCILEECH_IOMMU_RUNS];
+    int nr_runs;
+    RCU_READ_LOCK_GUARD();
+    if (!pci_leech_iommu_translate(state, address, length, runs, &nr_runs)) {
+        return false;
+    }
+    *result = MEMTX_OK;
+    for (int i = 0; i < nr_runs; i++) {
+        *result |= address_space_read(runs[i].target_as,
+                                      runs[i].translated_addr,
+                                      MEMTXATTRS_UNSPECIFIED, buf,
+                                      runs[i].len);
+        buf += runs[i].len;
+    }
+    pci_dma_plugin_cb(&state->device, address, length,
+                      DMA_DIRECTION_TO_DEVICE);
+    return true;
+}
+
+/* Read translated @runs into @buf, if they are all RAM. */
+static bool pci_leech_runs_read_ram(const IOMMUTLBRun *runs, int nr_runs,
+                                    uint8_t *buf)
+{
+    for (int i = 0; i < nr_runs; i++) {
+        MemoryRegionSection section;
+        bool ram;
+        section = memory_region_find(runs[i].target_as->root,
+                                     runs[i].translated_addr, runs[i].len);
+        if (!section.mr) {
+            return false;
+        }
+        ram = memory_region_is_ram(section.mr) &&
+              !memory_region_is_ram_device(section.mr) &&
+              int128_ge(section.size, int128_make64(runs[i].len));
+        memory_region_unref(section.mr);
+        if (!ram || address_space_read(runs[i].target_as,
+                                       runs[i].translated_addr,
+                                       MEMTXATTRS_UNSPECIFIED, buf,
+                                       runs[i].len) != MEMTX_OK) {
+            return false;
+        }
+        buf += runs[i].len;
+    }
+    return true;
+}
+
+/*
+ * Serve a small read behind a vIOMMU from the windows read ahead, or
+ * read the next window when the client walks memory at a steady stride,
+ * such as page by page through a structure. Windows expire after
+ * read-ahead-ttl and are dropped when the device writes to them or the
+ * memory map changes; the guest's own writes are not tracked, the TTL
+ * bounds how stale they can be. Returns false if the slow path is needed.
+ */
+static bool pci_leech_read_ahead(PciLeechChannel *ch, uint64_t address,
+                                 uint64_t length, uint8_t *buf)
+{
+    PciLeechState *state = ch->state;
+    const uint32_t window = state->read_ahead;
+    const uint64_t stride = address - ch->ra_last;
+    const int64_t now = get_clock();
+    IOMMUTLBRun runs[PCILEECH_IOMMU_RUNS];
+    PciLeechReadAhead *ra;
+    uint32_t generation;
+    uint8_t *data;
+    int nr_runs;
+    bool ok;
+
+    if (!window || length > window / 2) {
+        return false;
+    }
+    if (stride && stride <= window / 2 && stride == ch->ra_stride) {
+        ch->ra_streak++;
+    } else {
+        ch->ra_streak = 0;
+    }
+    ch->ra_stride = stride;
+    ch->ra_last = address;
+
+    WITH_QEMU_LOCK_GUARD(&state->ra_lock) {
+        for (int i = 0; i < PCILEECH_RA_ENTRIES; i++) {
+            ra = &state->ra[i];
+            if (ra->length && now < ra->expires && address >= ra->base &&
+                address - ra->base + length <= ra->length) {
+                memcpy(buf, ra->data + (address - ra->base), length);
+                stat64_add(&state->stats.read_ahead_hits, 1);
+                return true;
+            }
+        }
+        generation = state->ra_generation;
+    }
+    if (ch->ra_streak < PCILEECH_RA_STREAK) {
+        return false;
+    }
+
+    /* MMIO is never read ahead, reads could have side effects. */
+    data = g_malloc(window);
+    WITH_RCU_READ_LOCK_GUARD() {
+        ok = pci_leech_iommu_translate(state, address, window, runs,
+                                       &nr_runs) &&
+             pci_leech_runs_read_ram(runs, nr_runs, data);
+    }
+    if (!ok) {
+        g_free(data);
+        return false;
+    }
+    memcpy(buf, data, length);
+    trace_pcileech_read_ahead(state, ch->index, address, window);
+
+    WITH_QEMU_LOCK_GUARD(&state->ra_lock) {
+        /* A write that came meanwhile may have missed the new window. */
+        if (generation == state->ra_generation) {
+            ra = &state->ra[state->ra_next++ % PCILEECH_RA_ENTRIES];
+            g_free(ra->data);
+            ra->data = g_steal_pointer(&data);
+            ra->base = address;
+            ra->length = window;
+            ra->expires = now + state->read_ahead_ttl * SCALE_US;
+        }
+    }
+    g_free(data);
+    return true;
+}
+
+static void pci_leech_read_ahead_cleanup(PciLeechState *state)
+{
+    for (int i = 0; i < PCILEECH_RA_ENTRIES; i++) {
+        g_free(state->ra[i].data);
+        state->ra[i].data = NULL;
+        state->ra[i].length = 0;
+    }
+    qemu_mutex_destroy(&state->ra_lock);
+}
+
+/* The IRQ_STATUS bits that vector @vector of @vectors signals. */
+static uint32_t pci_leech_vector_irqs(uint32_t vectors, uint32_t vector)
+{
+    static const uint32_t irqs[PCILEECH_MAX_VECTORS] = {
+        PCILEECH_MBOX_IRQ_TX | PCILEECH_MBOX_IRQ_RX | PCILEECH_MBOX_IRQ_LINK,
+        PCILEECH_MBOX_IRQ_DONE,
+        PCILEECH_MBOX_IRQ_WATCH,
+    };
+    uint32_t mask = 0;
+    /* With fewer vectors, the causes wrap around. */
+    for (uint32_t i = vector; i < PCILEECH_MAX_VECTORS; i += vectors) {
+        mask |= irqs[i];
+    }
+    return mask;
+}
+
+/* Take the interrupt line or send a message for the pending interrupts. */
+static void pci_leech_mbox_update_irq(PciLeechState *state)
+{
+    PCIDevice *pdev = &state->device;
+    uint32_t pending;
+    WITH_QEMU_LOCK_GUARD(&state->mbox_lock) {
+        pending = state->mbox_irq_status & state->mbox_irq_mask;
+    }
+    if (msix_enabled(pdev)) {
+        for (uint32_t v = 0; v < state->msix_vectors; v++) {
+            if (pending & pci_leech_vector_irqs(state->msix_vectors, v)) {
+                msix_notify(pdev, v);
+            }
+        }
+    } else if (msi_enabled(pdev)) {
+        if (pending) {
+            msi_notify(pdev, 0);
+        }
+    } else {
+        pci_set_irq(pdev, !!pending);
+    }
+}
+
+static void pci_leech_mbox_irq_bh(void *opaque)
+{
+    pci_leech_mbox_update_irq(opaque);
+}
+
+/* Called with mbox_lock held; the interrupt follows from the main loop. */
+static void pci_leech_mbox_raise(PciLeechState *state, uint32_t irq)
+{
+    state->mbox_irq_status |= irq;
+    replay_bh_schedule_event(state->mbox_irq_bh);
+}
+
+/* Called with mbox_lock held. */
+static void pci_leech_event_flush(PciLeechState *state)
+{
+    if (state->event_irqs) {
+        pci_leech_mbox_raise(state, state->event_irqs);
+        state->event_irqs = 0;
+        state->event_batch = 0;
+        timer_del(state->event_timer);
+    }
+}
+
+static void pci_leech_event_timer(void *opaque)
+{
+    PciLeechState *state = opaque;
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    pci_leech_event_flush(state);
+}
+
+/*
+ * Called with mbox_lock held. Interrupt once coalesce_count events
+ * came together, or coalesce_time after the first of them.
+ */
+static void pci_leech_event_raise(PciLeechState *state, uint32_t irq)
+{
+    state->event_irqs |= irq;
+    if (++state->event_batch >= MAX(state->coalesce_count, 1)) {
+        pci_leech_event_flush(state);
+    } else if (state->coalesce_time && !timer_pending(state->event_timer)) {
+        timer_mod(state->event_timer,
+                  qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL) +
+                  state->coalesce_time * SCALE_US);
+    }
+}
+
+/* A request that accesses guest memory is complete. */
+static void pci_leech_event_done(PciLeechState *state)
+{
+    if (!state->events) {
+        return;
+    }
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    state->done_count++;
+    pci_leech_event_raise(state, PCILEECH_MBOX_IRQ_DONE);
+}
+
+/* The device wrote @length bytes to guest memory at @address. */
+static void pci_leech_event_write(PciLeechState *state, uint64_t address,
+                                  uint64_t length)
+{
+    if (!state->events) {
+        return;
+    }
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    if (state->watch_size &&
+        ranges_overlap(address, length, state->watch_base,
+                       state->watch_size)) {
+        state->watch_count++;
+        state->watch_hit = MAX(address, state->watch_base);
+        pci_leech_event_raise(state, PCILEECH_MBOX_IRQ_WATCH);
+    }
+}
+
+/* Write the combined writes to guest memory. */
+static void pci_leech_wc_flush(PciLeechChannel *ch)
+{
+    PciLeechState *state = ch->state;
+    MemTxResult result;
+    int64_t start;
+    if (!ch->wc_length) {
+        return;
+    }
+    timer_del(ch->wc_timer);
+    trace_pcileech_dma_write(state, ch->wc_address, ch->wc_length);
+    start = get_clock();
+    result = pci_leech_dma_write(state, ch->wc_address, ch->wc_buffer,
+                                 ch->wc_length);
+    pci_leech_account_dma(state, result, start);
+    trace_pcileech_dma_done(state, ch->wc_address, ch->wc_length, false,
+                            result);
+    pci_leech_event_write(state, ch->wc_address, ch->wc_length);
+    ch->wc_result |= result;
+    ch->wc_length = 0;
+}
+
+/* Reads must see the combined writes that they overlap. */
+static void pci_leech_wc_flush_overlap(PciLeechChannel *ch,
+                                       uint64_t address, uint64_t length)
+{
+    if (ch->wc_length && address < ch->wc_address + ch->wc_length &&
+        ch->wc_address < address + length) {
+        pci_leech_wc_flush(ch);
+    }
+}
+
+static void pci_leech_wc_timer(void *opaque)
+{
+    pci_leech_wc_flush(opaque);
+}
+
+/*
+ * Flushing the combined writes changes guest memory, so under
+ * record/replay it must happen at the same point of the guest's time.
+ */
+static QEMUClockType pci_leech_wc_clock(void)
+{
+    return replay_mode == REPLAY_MODE_NONE ? QEMU_CLOCK_REALTIME :
+                                             QEMU_CLOCK_VIRTUAL;
+}
+
+/*
+ * Merge a write into the combined writes. Returns false if it neither
+ * overlaps nor touches them, or the result would not fit.
+ */
+static bool pci_leech_wc_merge(PciLeechChannel *ch, uint64_t address,
+                               const uint8_t *data, uint32_t length)
+{
+    uint64_t start, end;
+    if (!ch->wc_length) {
+        ch->wc_address = address;
+        ch->wc_length = length;
+        memcpy(ch->wc_buffer, data, length);
+        timer_mod(ch->wc_timer,
+                  qemu_clock_get_ns(pci_leech_wc_clock()) +
+                  PCILEECH_WC_TIMEOUT);
+        return true;
+    }
+    if (address > ch->wc_address + ch->wc_length ||
+        address + length < ch->wc_address) {
+        return false;
+    }
+    start = MIN(address, ch->wc_address);
+    end = MAX(address + length, ch->wc_address + ch->wc_length);
+    if (end - start > PCILEECH_WC_SIZE) {
+        return false;
+    }
+    /* Later writes win where they overlap. */
+    memmove(ch->wc_buffer + (ch->wc_address - start), ch->wc_buffer,
+            ch->wc_length);
+    memcpy(ch->wc_buffer + (address - start), data, length);
+    ch->wc_address = start;
+    ch->wc_length = end - start;
+    return true;
+}
+
+/*
+ * Try to make @length bytes at @address available in chunk->ptr without
+ * dispatching to MMIO or an IOMMU: from the cache, from the RAM map or
+ * by mapping guest RAM. Returns false if the slow path is needed.
+ */
+static bool pci_leech_chunk_get_direct(PciLeechChannel *ch, uint64_t address,
+                                       uint64_t length, uint8_t *bounce,
+                                       PciLeechChunk *chunk)
+{
+    PciLeechState *state = ch->state;
+    pci_leech_wc_flush_overlap(ch, address, length);
+    trace_pcileech_dma_read(state, address, length);
+    stat64_add(&state->stats.read_bytes, length);
+    chunk->ram = NULL;
+    chunk->mapped = false;
+    chunk->result = MEMTX_OK;
+    if (state->replay_file) {
+        /* Dumps never change, so there is nothing to cache. */
+        if (!pci_leech_ram_get(state, address, length, chunk)) {
+            chunk->ptr = bounce;
+            chunk->result = pci_leech_replay_read(state, address, bounce,
+                                                  length);
+        }
+        return true;
+    }
+    if (!state->iommu && qatomic_read(&state->snapshot)) {
+        /* Mapped RAM would bypass the saved pages. */
+        chunk->ptr = bounce;
+        return pci_leech_snapshot_read(state, address, bounce, length);
+    }
+    if (pci_leech_cache_read(ch, address, bounce, length)) {
+        /* Hot small structures skip the dispatch and the mapping. */
+        chunk->ptr = bounce;
+        pci_dma_plugin_cb(&state->device, address, length,
+                          DMA_DIRECTION_TO_DEVICE);
+        return true;
+    }
+    /* Behind an IOMMU, the slow path translates the frame at once. */
+    if (state->iommu) {
+        if (!pci_leech_read_ahead(ch, address, length, bounce)) {
+            return false;
+        }
+        chunk->ptr = bounce;
+        pci_dma_plugin_cb(&state->device, address, length,
+                          DMA_DIRECTION_TO_DEVICE);
+        return true;
+    }
+    if (pci_leech_ram_get(state, address, length, chunk)) {
+        pci_dma_plugin_cb(&state->device, address, length,
+                          DMA_DIRECTION_TO_DEVICE);
+        return true;
+    }
+    return pci_leech_chunk_map(state, address, length,
+                               DMA_DIRECTION_TO_DEVICE, chunk);
+}
+
+/*
+ * Read @length bytes at @address into @bounce via DMA. This may block on
+ * MMIO; it is safe to call from a worker thread.
+ */
+static void pci_leech_chunk_read(PciLeechState *state, uint64_t address,
+                                 uint64_t length, uint8_t *bounce,
+                                 PciLeechChunk *chunk)
+{
+    chunk->ptr = bounce;
+    if (!state->iommu ||
+        !pci_leech_iommu_read(state, address, length, bounce,
+                              &chunk->result)) {
+        chunk->result = pci_dma_read(&state->device, address, bounce,
+                                     length);
+    }
+}
+
+static void pci_leech_chunk_done(PciLeechState *state, uint64_t address,
+                                 uint64_t length, PciLeechChunk *chunk,
+                                 int64_t start)
+{
+    pci_leech_account_dma(state, chunk->result, start);
+    trace_pcileech_dma_done(state, address, length,
+                            chunk->mapped || chunk->ram, chunk->result);
+}
+
+/*
+ * Make @length bytes at @address available in chunk->ptr, either mapped
+ * or read via DMA into @bounce.
+ */
+static void pci_leech_chunk_get(PciLeechChannel *ch, uint64_t address,
+                                uint64_t length, uint8_t *bounce,
+                                PciLeechChunk *chunk)
+{
+    const int64_t start = get_clock();
+    if (!pci_leech_chunk_get_direct(ch, address, length, bounce, chunk)) {
+        pci_leech_chunk_read(ch->state, address, length, bounce, chunk);
+    }
+    pci_leech_chunk_done(ch->state, address, length, chunk, start);
+}
+
+static void pci_leech_chunk_put(PciLeechState *state, PciLeechChunk *chunk,
+                                uint64_t length)
+{
+    if (chunk->mapped) {
+        pci_dma_unmap(&state->device, chunk->ptr, chunk->maplen,
+                      DMA_DIRECTION_TO_DEVICE, length);
+    } else if (chunk->ram) {
+        memory_region_unref(chunk->ram);
+        chunk->ram = NULL;
+    }
+}
+
+/*
+ * Whether the limits allow another frame in @direction now. If not, the
+ * channel's throttle timer schedules the bottom half when they do.
+ */
+static bool pci_leech_throttle_check(PciLeechChannel *ch,
+                                     ThrottleDirection direction)
+{
+    PciLeechState *state = ch->state;
+    QEMU_LOCK_GUARD(&state->throttle_lock);
+    if (!throttle_enabled(&state->throttle.cfg)) {
+        ch->throttled = false;
+    } else if (throttle_schedule_timer(&state->throttle,
+                                       &ch->throttle_timers, direction)) {
+        if (!ch->throttled) {
+            stat64_add(&state->stats.throttled, 1);
+            trace_pcileech_throttle(state, ch->index,
+                                    direction == THROTTLE_WRITE);
+        }
+        ch->throttled = true;
+    } else {
+        ch->throttled = false;
+    }
+    return !ch->throttled;
+}
+
+static void pci_leech_throttle_account(PciLeechChannel *ch,
+                                       ThrottleDirection direction,
+                                       uint64_t length)
+{
+    PciLeechState *state = ch->state;
+    QEMU_LOCK_GUARD(&state->throttle_lock);
+    if (throttle_enabled(&state->throttle.cfg)) {
+        throttle_account(&state->throttle, direction, length);
+    }
+}
+
+static uint32_t pci_leech_write_frame_length(PciLeechChannel *ch)
+{
+    const uint64_t remainder = ch->request.length - ch->written_length;
+    return MIN(remainder, ch->xfer_size);
+}
+
+/*
+ * Drop the mapping of a write frame, keeping the first @length bytes.
+ * Like pci_leech_dma_write(), this drops the read ahead they overwrote.
+ */
+static void pci_leech_write_unmap(PciLeechChannel *ch, uint64_t length)
+{
+    if (ch->write_chunk.mapped) {
+        pci_dma_unmap(&ch->state->device, ch->write_chunk.ptr,
+                      ch->write_chunk.maplen, DMA_DIRECTION_FROM_DEVICE,
+                      length);
+        ch->write_chunk.mapped = false;
+        if (length) {
+            pci_leech_read_ahead_invalidate(ch->state, ch->request.address +
+                                            ch->written_length, length);
+        }
+    }
+}
+
+static void pci_leech_process_write_request(PciLeechChannel *ch,
+                                            const uint8_t *buf, int size)
+{
+    const uint64_t address = ch->request.address + ch->written_length;
+    const uint32_t frame = pci_leech_write_frame_length(ch);
+    const uint8_t *data = buf;
+    const bool combine = (ch->features & LEECH_FEATURE_WRITE_COMBINE) &&
+                         ch->request.length <= MIN(ch->xfer_size,
+                                                   PCILEECH_WC_SIZE);
+    MemTxResult result;
+    int64_t start;
+    if (!combine) {
+        /* Keep the order of the writes. */
+        pci_leech_wc_flush(ch);
+    }
+    if (!combine && !ch->buffered && size < frame) {
+        /* Receive the frame straight into guest RAM if possible. */
+        pci_leech_chunk_map(ch->state, address, frame,
+                            DMA_DIRECTION_FROM_DEVICE, &ch->write_chunk);
+    }
+    if (ch->write_chunk.mapped) {
+        memcpy((uint8_t *)ch->write_chunk.ptr + ch->buffered, buf, size);
+        ch->buffered += size;
+        if (ch->buffered < frame) {
+            return;
+        }
+        trace_pcileech_dma_write(ch->state, address, frame);
+        start = get_clock();
+        pci_leech_write_unmap(ch, frame);
+        result = MEMTX_OK;
+        pci_leech_account_dma(ch->state, result, start);
+        trace_pcileech_dma_done(ch->state, address, frame, true, result);
+    } else if (combine) {
+        if (ch->buffered || size < frame) {
+            memcpy(&ch->buffer[ch->buffered], buf, size);
+            ch->buffered += size;
+            if (ch->buffered < frame) {
+                return;
+            }
+            data = ch->buffer;
+        }
+        if (!pci_leech_wc_merge(ch, address, data, frame)) {
+            pci_leech_wc_flush(ch);
+            pci_leech_wc_merge(ch, address, data, frame);
+        }
+        if (ch->wc_length == PCILEECH_WC_SIZE) {
+            pci_leech_wc_flush(ch);
+        }
+        /* Errors are reported by PCILEECH_REQUEST_FLUSH. */
+        result = MEMTX_OK;
+    } else {
+        if (ch->buffered || size < frame) {
+            /* Collect a whole frame before touching guest memory. */
+            memcpy(&ch->buffer[ch->buffered], buf, size);
+            ch->buffered += size;
+            if (ch->buffered < frame) {
+                return;
+            }
+            data = ch->buffer;
+        }
+        /* Write memory via DMA. */
+        trace_pcileech_dma_write(ch->state, address, frame);
+        start = get_clock();
+        result = pci_leech_dma_write(ch->state, address, data, frame);
+        pci_leech_account_dma(ch->state, result, start);
+        trace_pcileech_dma_done(ch->state, address, frame, false, result);
+    }
+    stat64_add(&ch->state->stats.write_bytes, frame);
+    pci_leech_throttle_account(ch, THROTTLE_WRITE, frame);
+    if (!combine) {
+        pci_leech_event_write(ch->state, address, frame);
+    }
+    /* Increment written length counter. */
+    ch->written_length += frame;
+    ch->buffered = 0;
+    if (result != MEMTX_OK && ch->write_error == ch->request.length) {
+        ch->write_error = ch->written_length - frame;
+    }
+    ch->write_result |= pci_leech_convert_result(result);
+    trace_pcileech_write_chunk_done(ch->state, ch->request.tag,
+                                    ch->written_length,
+                                    ch->request.length);
+    if (ch->request.flags & LEECH_REQUEST_NO_ACK) {
+        /* Fire and forget. */
+    } else if (ch->request.flags & LEECH_REQUEST_SUMMARY) {
+        if (ch->written_length == ch->request.length) {
+            const uint64_t offset = cpu_to_le64(ch->write_error);
+            start = get_clock();
+            pci_leech_send_reply(ch, ch->request.tag, ch->write_result,
+                                 &offset, sizeof(offset));
+            pci_leech_account_send(ch->state, start);
+        }
+    } else if (!(ch->features & LEECH_FEATURE_WRITE_ACK_ONCE) ||
+               ch->written_length == ch->request.length) {
+        /* In ack-once mode, only the last frame is acknowledged. */
+        start = get_clock();
+        pci_leech_send_response(ch, ch->request.tag, ch->write_result, 0);
+        pci_leech_account_send(ch->state, start);
+        ch->write_result = LEECH_RESULT_OK;
+    }
+    /* Check if write-operation is fulfilled. */
+    if (ch->written_length == ch->request.length) {
+        ch->written_length = 0;
+        ch->write_pending = false;
+        pci_leech_event_done(ch->state);
+    }
+}
+
+static bool pci_leech_encoder_init(PciLeechEncoder *enc, uint32_t level,
+                                   uint32_t max_length, Error **errp)
+{
+    enc->level = level;
+    enc->max_length = max_length;
+#ifdef CONFIG_ZSTD
+    enc->zstd = ZSTD_createCCtx();
+    if (!enc->zstd) {
+        error_setg(errp, "failed to create zstd context");
+        return false;
+    }
+#endif
+    return true;
+}
+
+static void pci_leech_encoder_cleanup(PciLeechEncoder *enc)
+{
+#ifdef CONFIG_ZSTD
+    ZSTD_freeCCtx(enc->zstd);
+    g_free(enc->zbuf);
+#endif
+}
+
+/*
+ * Encode a read frame as selected by @features. Points @payload and
+ * @length at the bytes to send and returns the LEECH_RESULT_* encoding
+ * flag.
+ */
+static uint32_t pci_leech_encode_frame(PciLeechEncoder *enc,
+                                       uint64_t features,
+                                       const void **payload,
+                                       uint64_t *length)
+{
+    if ((features & LEECH_FEATURE_ZERO_FRAMES) &&
+        buffer_is_zero(*payload, *length)) {
+        *length = 0;
+        return LEECH_RESULT_ZERO;
+    }
+#ifdef CONFIG_ZSTD
+    if (features & LEECH_FEATURE_ZSTD) {
+        size_t ret;
+        if (!enc->zbuf) {
+            enc->zbuf_size = ZSTD_compressBound(enc->max_length);
+            enc->zbuf = g_malloc(enc->zbuf_size);
+        }
+        ret = ZSTD_compressCCtx(enc->zstd, enc->zbuf, enc->zbuf_size,
+                                *payload, *length, enc->level);
+        /* Incompressible frames are sent as they are. */
+        if (!ZSTD_isError(ret) && ret < *length) {
+            *payload = enc->zbuf;
+            *length = ret;
+            return LEECH_RESULT_ZSTD;
+        }
+    }
+#endif
+    return 0;
+}
+
+/* Send the next frame of @req. Returns the number of bytes read. */
+static uint64_t pci_leech_send_read_frame(PciLeechChannel *ch,
+                                          PciLeechRequest *req)
+{
+    const uint64_t remainder = req->header.length - req->done;
+    const uint64_t readlen = MIN(remainder, ch->xfer_size);
+    PciLeechChunk data;
+    const void *payload;
+    uint64_t sendlen = readlen;
+    uint32_t result;
+    int64_t start;
+    pci_leech_chunk_get(ch, req->header.address + req->done, readlen,
+                        ch->buffer, &data);
+    payload = data.ptr;
+    result = pci_leech_convert_result(data.result);
+    if (result == LEECH_RESULT_OK) {
+        result = pci_leech_encode_frame(&ch->encoder, ch->features,
+                                        &payload, &sendlen);
+        trace_pcileech_encode_frame(ch->state, req->header.tag, readlen,
+                                    sendlen, result);
+    }
+    /* Send a header. The data follow after it. */
+    start = get_clock();
+    pci_leech_send_reply(ch, req->header.tag, result, payload, sendlen);
+    pci_leech_account_send(ch->state, start);
+    pci_leech_chunk_put(ch->state, &data, readlen);
+    req->done += readlen;
+    return readlen;
+}
+
+/* Called with bounce_lock held. */
+static void pci_leech_bounce_free_push(PciLeechState *state,
+                                       uint8_t *buffer, int node)
+{
+    if (node >= 0) {
+        PciLeechNode *n = &state->nodes[node];
+        n->bounce_free[n->bounce_num_free++] = buffer;
+    } else {
+        state->bounce_free[state->bounce_num_free++] = buffer;
+    }
+}
+
+/*
+ * Give @frame a bounce buffer from the pool. If it is exhausted, returns
+ * false and kicks @ch when a buffer is put back. Each connected client
+ * gets an equal share of the pool, so that one streaming large reads
+ * cannot starve the others. Buffers that are not on a node go first.
+ */
+static bool pci_leech_bounce_get(PciLeechChannel *ch, PciLeechFrame *frame)
+{
+    PciLeechState *state = ch->state;
+    const uint32_t share = DIV_ROUND_UP(state->bounce_limit,
+        MAX(qatomic_read(&state->num_connected), 1));
+    QEMU_LOCK_GUARD(&state->bounce_lock);
+    if (ch->bounces < share) {
+        frame->buffer_node = -1;
+        frame->buffer_fresh = false;
+        if (state->bounce_num_free) {
+            ch->bounces++;
+            frame->buffer = state->bounce_free[--state->bounce_num_free];
+            return true;
+        }
+        for (uint32_t i = 0; i < state->num_node_contexts; i++) {
+            PciLeechNode *n = &state->nodes[i];
+            if (n->bounce_num_free) {
+                ch->bounces++;
+                frame->buffer = n->bounce_free[--n->bounce_num_free];
+                frame->buffer_node = i;
+                return true;
+            }
+        }
+        if (state->bounce_allocated < state->bounce_limit) {
+            state->bounce_allocated++;
+            ch->bounces++;
+            frame->buffer = g_malloc(state->chunk_size);
+            frame->buffer_fresh = true;
+            return true;
+        }
+    }
+    state->bounce_waiters |= 1U << ch->index;
+    stat64_add(&state->stats.bounce_exhausted, 1);
+    return false;
+}
+
+static void pci_leech_bounce_put(PciLeechChannel *ch, PciLeechFrame *frame)
+{
+    PciLeechState *state = ch->state;
+    uint32_t waiters;
+    WITH_QEMU_LOCK_GUARD(&state->bounce_lock) {
+        ch->bounces--;
+        pci_leech_bounce_free_push(state, frame->buffer, frame->buffer_node);
+        waiters = state->bounce_waiters;
+        state->bounce_waiters = 0;
+    }
+    frame->buffer = NULL;
+    while (waiters) {
+        replay_bh_schedule_event(state->channels[ctz32(waiters)].bh);
+        waiters &= waiters - 1;
+    }
+}
+
+/*
+ * Trade the bounce buffer of @frame for a free one on @node, where its
+ * worker reads the frame. A buffer not touched yet just moves there.
+ */
+static void pci_leech_bounce_rebind(PciLeechState *state,
+                                    PciLeechFrame *frame, int node)
+{
+    PciLeechNode *n = &state->nodes[node];
+    if (frame->buffer_node == node) {
+        return;
+    }
+    if (frame->buffer_fresh) {
+        frame->buffer_node = node;
+        return;
+    }
+    QEMU_LOCK_GUARD(&state->bounce_lock);
+    if (n->bounce_num_free) {
+        uint8_t *buffer = n->bounce_free[--n->bounce_num_free];
+        pci_leech_bounce_free_push(state, frame->buffer, frame->buffer_node);
+        frame->buffer = buffer;
+        frame->buffer_node = node;
+    }
+}
+
+/* The node whose workers should read @address, or -1. */
+static int pci_leech_frame_node(PciLeechState *state, uint64_t address)
+{
+    PciLeechRamRange *range;
+    int node;
+    if (!state->nodes) {
+        return -1;
+    }
+    WITH_RCU_READ_LOCK_GUARD() {
+        range = pci_leech_ram_find(qatomic_rcu_read(&state->ram_map),
+                                   address);
+        node = range ? range->node : -1;
+    }
+    if (node < 0 || node >= state->num_node_contexts ||
+        !state->nodes[node].tc) {
+        return -1;
+    }
+    return node;
+}
+
+/* Send the encoded frames at the head of the queue, in order. */
+static void pci_leech_flush_frames(PciLeechChannel *ch)
+{
+    PciLeechFrame *frame;
+    while ((frame = QTAILQ_FIRST(&ch->frames)) && frame->done) {
+        QTAILQ_REMOVE(&ch->frames, frame, next);
+        if (!frame->stale) {
+            const int64_t start = get_clock();
+            trace_pcileech_encode_frame(ch->state, frame->tag, frame->length,
+                                        frame->sendlen, frame->result);
+            pci_leech_send_reply(ch, frame->tag, frame->result,
+                                 frame->payload, frame->sendlen);
+            pci_leech_account_send(ch->state, start);
+        }
+        pci_leech_chunk_put(ch->state, &frame->data, frame->length);
+        if (frame->buffer) {
+            pci_leech_bounce_put(ch, frame);
+        }
+        QTAILQ_INSERT_TAIL(&ch->idle, frame, next);
+    }
+}
+
+/* Runs in a worker thread. */
+static int pci_leech_frame_worker(void *opaque)
+{
+    PciLeechFrame *frame = opaque;
+    if (frame->dma) {
+        PciLeechState *state = frame->channel->state;
+        pci_leech_chunk_read(state, frame->address, frame->length,
+                             frame->buffer, &frame->data);
+        pci_leech_chunk_done(state, frame->address, frame->length,
+                             &frame->data, frame->start);
+        frame->payload = frame->data.ptr;
+        frame->result = pci_leech_convert_result(frame->data.result);
+    }
+    if (frame->result == LEECH_RESULT_OK &&
+        (frame->features & LEECH_FEATURE_ENCODINGS)) {
+        frame->result = pci_leech_encode_frame(&frame->encoder,
+                                               frame->features,
+                                               &frame->payload,
+                                               &frame->sendlen);
+    }
+    return 0;
+}
+
+static void pci_leech_frame_complete(void *opaque, int ret)
+{
+    PciLeechFrame *frame = opaque;
+    PciLeechChannel *ch = frame->channel;
+    frame->done = true;
+    pci_leech_flush_frames(ch);
+    qatomic_dec(&ch->encoding);
+    aio_wait_kick();
+    /* A worker is free again; resume the reads and the input behind them. */
+    if (!QTAILQ_EMPTY(&ch->reads) || ch->deferred || ch->rx_len) {
+        replay_bh_schedule_event(ch->bh);
+    }
+}
+
+static void pci_leech_node_complete(void *opaque)
+{
+    pci_leech_frame_complete(opaque, 0);
+}
+
+/* A worker thread of a host node. */
+static void *pci_leech_node_thread(void *opaque)
+{
+    PciLeechNode *n = opaque;
+    rcu_register_thread();
+    qemu_mutex_lock(&n->lock);
+    while (!n->stop) {
+        PciLeechFrame *frame = QSIMPLEQ_FIRST(&n->queue);
+        if (!frame) {
+            qemu_cond_wait(&n->cond, &n->lock);
+            continue;
+        }
+        QSIMPLEQ_REMOVE_HEAD(&n->queue, node_next);
+        qemu_mutex_unlock(&n->lock);
+        pci_leech_frame_worker(frame);
+        aio_bh_schedule_oneshot(frame->ctx, pci_leech_node_complete, frame);
+        qemu_mutex_lock(&n->lock);
+    }
+    qemu_mutex_unlock(&n->lock);
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Like thread_pool_submit_aio(), on the workers of @n. */
+static void pci_leech_node_submit(PciLeechNode *n, PciLeechFrame *frame)
+{
+    frame->ctx = qemu_get_current_aio_context();
+    WITH_QEMU_LOCK_GUARD(&n->lock) {
+        QSIMPLEQ_INSERT_TAIL(&n->queue, frame, node_next);
+        qemu_cond_signal(&n->cond);
+    }
+}
+
+/* Whether an idle frame with a bounce buffer is ready for the next read. */
+static bool pci_leech_frame_ready(PciLeechChannel *ch)
+{
+    PciLeechFrame *frame = QTAILQ_FIRST(&ch->idle);
+    if (!frame) {
+        return false;
+    }
+    return frame->buffer || pci_leech_bounce_get(ch, frame);
+}
+
+/*
+ * Map the next frame of @req and hand it to a worker thread for DMA and
+ * encoding; the channel goes on with the next frame meanwhile.
+ * The caller makes sure that pci_leech_frame_ready().
+ * Returns the number of bytes submitted.
+ */
+static uint64_t pci_leech_submit_read_frame(PciLeechChannel *ch,
+                                            PciLeechRequest *req)
+{
+    const uint64_t remainder = req->header.length - req->done;
+    const uint64_t readlen = MIN(remainder, ch->xfer_size);
+    PciLeechFrame *frame = QTAILQ_FIRST(&ch->idle);
+    int node;
+    QTAILQ_REMOVE(&ch->idle, frame, next);
+    frame->address = req->header.address + req->done;
+    frame->start = get_clock();
+    node = pci_leech_frame_node(ch->state, frame->address);
+    if (node >= 0) {
+        pci_leech_bounce_rebind(ch->state, frame, node);
+    }
+    frame->buffer_fresh = false;
+    frame->dma = !pci_leech_chunk_get_direct(ch, frame->address, readlen,
+                                             frame->buffer, &frame->data);
+    if (!frame->dma) {
+        pci_leech_chunk_done(ch->state, frame->address, readlen,
+                             &frame->data, frame->start);
+        if (frame->data.ptr != frame->buffer) {
+            /* Mapped; let another frame bounce meanwhile. */
+            pci_leech_bounce_put(ch, frame);
+        }
+    }
+    frame->features = ch->features;
+    frame->tag = req->header.tag;
+    frame->length = readlen;
+    frame->payload = frame->data.ptr;
+    frame->sendlen = readlen;
+    frame->result = pci_leech_convert_result(frame->data.result);
+    frame->done = false;
+    frame->stale = false;
+    QTAILQ_INSERT_TAIL(&ch->frames, frame, next);
+    req->done += readlen;
+    if (!frame->dma && (frame->result != LEECH_RESULT_OK ||
+                        !(frame->features & LEECH_FEATURE_ENCODINGS))) {
+        /* Nothing to encode, but keep the order of frames. */
+        frame->done = true;
+        pci_leech_flush_frames(ch);
+    } else {
+        qatomic_inc(&ch->encoding);
+        if (node >= 0) {
+            pci_leech_node_submit(&ch->state->nodes[node], frame);
+        } else {
+            thread_pool_submit_aio(pci_leech_frame_worker, frame,
+                                   pci_leech_frame_complete, frame);
+        }
+    }
+    return readlen;
+}
+
+/* Whether read frames go through the worker threads. */
+static bool pci_leech_use_workers(PciLeechChannel *ch)
+{
+    return (ch->state->compress_threads &&
+            (ch->features & LEECH_FEATURE_ENCODINGS)) ||
+           ch->state->dma_threads || ch->state->nodes ||
+           !QTAILQ_EMPTY(&ch->frames);
+}
+
+/* Drop frames of a client that went away. */
+static void pci_leech_clear_frames(PciLeechChannel *ch)
+{
+    PciLeechFrame *frame;
+    QTAILQ_FOREACH(frame, &ch->frames, next) {
+        frame->stale = true;
+    }
+    pci_leech_flush_frames(ch);
+}
+
+/* Whether reads are still waiting to be sent. */
+static bool pci_leech_reads_pending(PciLeechChannel *ch)
+{
+    return !QTAILQ_EMPTY(&ch->reads) || !QTAILQ_EMPTY(&ch->frames);
+}
+
+/* Payload bandwidth of one lane in MB/s, after line encoding. */
+static const uint32_t pci_leech_lane_mbps[] = {
+    [QEMU_PCI_EXP_LNK_2_5GT] = 250,
+    [QEMU_PCI_EXP_LNK_5GT] = 500,
+    [QEMU_PCI_EXP_LNK_8GT] = 985,
+    [QEMU_PCI_EXP_LNK_16GT] = 1969,
+    [QEMU_PCI_EXP_LNK_32GT] = 3938,
+    [QEMU_PCI_EXP_LNK_64GT] = 7877,
+};
+
+/*
+ * Time for a read of @length bytes: it is split into MRRS-sized read
+ * requests, at most tags of them in flight, each answered after the
+ * completion latency by MPS-sized completions that share the link.
+ */
+static int64_t pci_leech_tlp_read_ns(PciLeechState *state, uint64_t length)
+{
+    uint32_t mps = state->mps, mrrs = state->mrrs, tags = state->tags;
+    uint64_t requests, completions, wire_bytes;
+    int64_t wire, rounds;
+    if (pci_is_express(&state->device)) {
+        /* Follow what the guest programmed into Device Control. */
+        const uint16_t devctl = pci_get_word(state->device.config +
+                                             state->device.exp.exp_cap +
+                                             PCI_EXP_DEVCTL);
+        mps = MIN(mps, 128 << ((devctl & PCI_EXP_DEVCTL_PAYLOAD) >> 5));
+        mrrs = MIN(mrrs, 128 << ((devctl & PCI_EXP_DEVCTL_READRQ) >> 12));
+        if (!(devctl & PCI_EXP_DEVCTL_EXT_TAG)) {
+            tags = MIN(tags, PCILEECH_SHORT_TAGS);
+        }
+    }
+    requests = DIV_ROUND_UP(length, mrrs);
+    completions = DIV_ROUND_UP(length, MIN(mps, mrrs));
+    wire_bytes = length + completions * PCILEECH_TLP_OVERHEAD;
+    wire = wire_bytes * 1000 /
+           (pci_leech_lane_mbps[state->link_speed] * state->link_width);
+    rounds = DIV_ROUND_UP(requests, tags);
+    return MAX(state->completion_latency + wire,
+               rounds * state->completion_latency);
+}
+
+/*
+ * Whether a read frame of @length bytes may go out now. If not, the
+ * pacing timer fires when the link has carried it.
+ */
+static bool pci_leech_pace_read(PciLeechChannel *ch, uint64_t length)
+{
+    int64_t now;
+    if (!ch->pace_timer) {
+        return true;
+    }
+    now = qemu_clock_get_ns(QEMU_CLOCK_VIRTUAL);
+    if (!ch->pace_deadline) {
+        ch->pace_deadline = MAX(now, ch->link_free) +
+                            pci_leech_tlp_read_ns(ch->state, length);
+        trace_pcileech_tlp_pace(ch->state, ch->index, length,
+                                ch->pace_deadline - now);
+    }
+    if (now < ch->pace_deadline) {
+        timer_mod(ch->pace_timer, ch->pace_deadline);
+        return false;
+    }
+    ch->link_free = ch->pace_deadline;
+    ch->pace_deadline = 0;
+    return true;
+}
+
+static void pci_leech_pace_timer(void *opaque)
+{
+    PciLeechChannel *ch = opaque;
+    replay_bh_schedule_event(ch->bh);
+}
+
+/* Whether @req goes before the reads without LEECH_REQUEST_PRIORITY. */
+static bool pci_leech_read_priority(PciLeechChannel *ch,
+                                    const PciLeechRequest *req)
+{
+    return (ch->features & LEECH_FEATURE_OUT_OF_ORDER) &&
+           (req->header.flags & LEECH_REQUEST_PRIORITY);
+}
+
+/* Queue @req behind the reads of its class, ahead of the lower class. */
+static void pci_leech_insert_read(PciLeechChannel *ch, PciLeechRequest *req)
+{
+    PciLeechRequest *other;
+    if (!pci_leech_read_priority(ch, req)) {
+        QTAILQ_INSERT_TAIL(&ch->reads, req, next);
+        return;
+    }
+    QTAILQ_FOREACH(other, &ch->reads, next) {
+        if (!pci_leech_read_priority(ch, other)) {
+            QTAILQ_INSERT_BEFORE(other, req, next);
+            return;
+        }
+    }
+    QTAILQ_INSERT_TAIL(&ch->reads, req, next);
+}
+
+static void pci_leech_queue_read_request(PciLeechChannel *ch)
+{
+    PciLeechRequest *req;
+    if (ch->request.length == 0) {
+        return;
+    }
+    req = g_new0(PciLeechRequest, 1);
+    req->header = ch->request;
+    pci_leech_insert_read(ch, req);
+    ch->queued++;
+    trace_pcileech_read_queued(ch->state, req->header.tag, ch->queued);
+    replay_bh_schedule_event(ch->bh);
+}
+
+static void pci_leech_clear_read_requests(PciLeechChannel *ch)
+{
+    PciLeechRequest *req, *next_req;
+    QTAILQ_FOREACH_SAFE(req, &ch->reads, next, next_req) {
+        QTAILQ_REMOVE(&ch->reads, req, next);
+        g_free(req);
+    }
+    ch->queued = 0;
+}
+
+static uint32_t pci_leech_scatter_max_entries(PciLeechChannel *ch)
+{
+    return ch->xfer_size / sizeof(struct LeechScatterEntry);
+}
+
+static void pci_leech_process_scatter_request(PciLeechChannel *ch,
+                                              const uint8_t *buf, int size)
+{
+    const uint32_t count = ch->request.length;
+    const uint32_t total = count * sizeof(struct LeechScatterEntry);
+    g_autofree struct LeechScatterEntry *entries = NULL;
+    uint64_t reply_length = 0;
+    /* Collect the whole entry vector first. */
+    memcpy(&ch->buffer[ch->buffered], buf, size);
+    ch->buffered += size;
+    if (ch->buffered < total) {
+        return;
+    }
+    ch->scatter_pending = false;
+    ch->buffered = 0;
+    /* The transfer buffer is needed for bounced reads, so move them out. */
+    entries = g_memdup2(ch->buffer, total);
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].address = le64_to_cpu(entries[i].address);
+        entries[i].length = le32_to_cpu(entries[i].length);
+        reply_length += sizeof(struct LeechScatterResult);
+        /* Entries longer than a frame are refused without data. */
+        if (entries[i].length <= ch->xfer_size) {
+            reply_length += entries[i].length;
+        }
+    }
+    pci_leech_send_response(ch, ch->request.tag, LEECH_RESULT_OK,
+                            reply_length);
+    for (uint32_t i = 0; i < count; i++) {
+        struct LeechScatterResult result = { 0 };
+        const uint32_t length = entries[i].length;
+        PciLeechChunk data;
+        struct iovec iov[2] = {
+            { .iov_base = &result, .iov_len = sizeof(result) },
+        };
+        int64_t start;
+        if (length > ch->xfer_size) {
+            result.result = cpu_to_le32(LEECH_DEVICE_ERROR);
+            result.length = 0;
+            qemu_chr_fe_write_all(ch->chr, (uint8_t *)&result,
+                                  sizeof(result));
+            continue;
+        }
+        pci_leech_chunk_get(ch, entries[i].address, length,
+                            ch->buffer, &data);
+        result.result = cpu_to_le32(pci_leech_convert_result(data.result));
+        result.length = cpu_to_le32(length);
+        iov[1].iov_base = data.ptr;
+        iov[1].iov_len = length;
+        start = get_clock();
+        qemu_chr_fe_writev_all(ch->chr, iov, ARRAY_SIZE(iov));
+        pci_leech_account_send(ch->state, start);
+        pci_leech_chunk_put(ch->state, &data, length);
+    }
+    /* Sent at once; the frames after it pay for it. */
+    pci_leech_throttle_account(ch, THROTTLE_READ, reply_length);
+    pci_leech_event_done(ch->state);
+}
+
+static void pci_leech_start_scatter_request(PciLeechChannel *ch)
+{
+    const uint64_t count = ch->request.length;
+    if (count == 0 || count > pci_leech_scatter_max_entries(ch)) {
+        /* The entry vector must fit in one frame. */
+        trace_pcileech_scatter_refused(ch->state, ch->request.tag, count);
+        pci_leech_send_response(ch, ch->request.tag,
+                                count ? LEECH_DEVICE_ERROR : LEECH_RESULT_OK,
+                                0);
+        /* Skip the refused entries to stay in sync with the client. */
+        ch->discard = count > UINT64_MAX / sizeof(struct LeechScatterEntry) ?
+                      UINT64_MAX : count * sizeof(struct LeechScatterEntry);
+        return;
+    }
+    ch->scatter_pending = true;
+    ch->buffered = 0;
+}
+
+/* The commands this device can carry out. */
+static uint64_t pci_leech_commands(PciLeechState *state)
+{
+    return LEECH_FEATURE_COMMANDS &
+           ~(state->mailbox ? 0 : LEECH_FEATURE_MAILBOX) &
+           ~(state->pasid ? 0 : LEECH_FEATURE_PASID);
+}
+
+static void pci_leech_start_write_scatter_request(PciLeechChannel *ch)
+{
+    const uint64_t count = ch->request.address;
+    if (!ch->request.length || ch->request.length > ch->xfer_size ||
+        count > ch->request.length / sizeof(struct LeechScatterEntry)) {
+        trace_pcileech_scatter_refused(ch->state, ch->request.tag, count);
+        pci_leech_send_response(ch, ch->request.tag,
+                                ch->request.length || count ?
+                                LEECH_DEVICE_ERROR : LEECH_RESULT_OK, 0);
+        ch->discard = ch->request.length;
+        return;
+    }
+    /* Keep the order of the writes. */
+    pci_leech_wc_flush(ch);
+    ch->write_scatter_pending = true;
+    ch->buffered = 0;
+}
+
+static void pci_leech_process_write_scatter_request(PciLeechChannel *ch,
+                                                    const uint8_t *buf,
+                                                    int size)
+{
+    const uint32_t count = ch->request.address;
+    const uint32_t total = ch->request.length;
+    g_autofree struct LeechScatterResult *results = NULL;
+    uint32_t offset = count * sizeof(struct LeechScatterEntry);
+    uint64_t written = 0;
+    /* Collect the entries and their data first. */
+    memcpy(&ch->buffer[ch->buffered], buf, size);
+    ch->buffered += size;
+    if (ch->buffered < total) {
+        return;
+    }
+    ch->write_scatter_pending = false;
+    ch->buffered = 0;
+    results = g_new0(struct LeechScatterResult, count);
+    for (uint32_t i = 0; i < count; i++) {
+        struct LeechScatterEntry entry;
+        MemTxResult res;
+        int64_t start;
+        memcpy(&entry, ch->buffer + i * sizeof(entry), sizeof(entry));
+        entry.address = le64_to_cpu(entry.address);
+        entry.length = le32_to_cpu(entry.length);
+        if (entry.length > total - offset) {
+            /* The data ran out; the rest of the entries fail. */
+            results[i].result = cpu_to_le32(LEECH_DEVICE_ERROR);
+            offset = total;
+            continue;
+        }
+        trace_pcileech_dma_write(ch->state, entry.address, entry.length);
+        start = get_clock();
+        res = pci_leech_dma_write(ch->state, entry.address,
+                                  ch->buffer + offset, entry.length);
+        pci_leech_account_dma(ch->state, res, start);
+        trace_pcileech_dma_done(ch->state, entry.address, entry.length,
+                                false, res);
+        pci_leech_event_write(ch->state, entry.address, entry.length);
+        results[i].result = cpu_to_le32(pci_leech_convert_result(res));
+        results[i].length = cpu_to_le32(res == MEMTX_OK ? entry.length : 0);
+        offset += entry.length;
+        written += entry.length;
+    }
+    stat64_add(&ch->state->stats.write_bytes, written);
+    pci_leech_throttle_account(ch, THROTTLE_WRITE, written);
+    pci_leech_event_done(ch->state);
+    pci_leech_send_response(ch, ch->request.tag, LEECH_RESULT_OK,
+                            count * sizeof(*results));
+    qemu_chr_fe_write_all(ch->chr, (uint8_t *)results,
+                          count * sizeof(*results));
+}
+
+static void pci_leech_process_negotiate_request(PciLeechChannel *ch)
+{
+    struct LeechCapabilities caps = { 0 };
+    const uint64_t wanted = ch->request.length;
+    /* A zero length only queries the current parameters. */
+    if (wanted) {
+        ch->xfer_size = MAX(MIN(wanted, ch->state->chunk_size),
+                            PCILEECH_BUFFER_SIZE);
+        ch->features = pci_leech_commands(ch->state) |
+                       (ch->request.address & LEECH_FEATURE_MODES);
+        trace_pcileech_negotiate(ch->state, ch->xfer_size, ch->features);
+        if (ch->features & LEECH_FEATURE_MAILBOX_PUSH &&
+            ch->state->mailbox && ch->index == 0) {
+            /* Send what the guest posted before. */
+            replay_bh_schedule_event(ch->state->mbox_bh);
+        }
+    }
+    caps.version = cpu_to_le32(PCILEECH_PROTOCOL_VERSION);
+    caps.chunk_size = cpu_to_le32(ch->xfer_size);
+    caps.max_chunk_size = cpu_to_le32(ch->state->chunk_size);
+    caps.page_size = cpu_to_le32(qemu_target_page_size());
+    caps.features = cpu_to_le64(ch->features);
+    pci_leech_send_response(ch, ch->request.tag, LEECH_RESULT_OK,
+                            sizeof(caps));
+    qemu_chr_fe_write_all(ch->chr, (uint8_t *)&caps, sizeof(caps));
+}
+
+static bool pci_leech_memory_map_cb(Int128 start, Int128 len,
+                                    const MemoryRegion *mr,
+                                    hwaddr offset_in_region, void *opaque)
+{
+    GArray *ranges = opaque;
+    struct LeechMemoryRange range;
+    /* MMIO, including RAM-backed device BARs, is not worth dumping. */
+    if (!mr->ram || mr->ram_device) {
+        return false;
+    }
+    range.address = int128_get64(start);
+    range.length = int128_get64(len);
+    if (ranges->len) {
+        struct LeechMemoryRange *last =
+            &g_array_index(ranges, struct LeechMemoryRange, ranges->len - 1);
+        /* RAM split into several regions is still one range. */
+        if (last->address + last->length == range.address) {
+            last->length += range.length;
+            return false;
+        }
+    }
+    g_array_append_val(ranges, range);
+    return false;
+}
+
+static void pci_leech_process_memory_map_request(PciLeechChannel *ch)
+{
+    g_autoptr(GArray) ranges =
+        g_array_new(false, false, sizeof(struct LeechMemoryRange));
+    AddressSpace *as = pci_get_address_space(&ch->state->device);
+    if (ch->state->replay_file) {
+        GArray *map = ch->state->ram_map->ranges;
+        for (guint i = 0; i < map->len; i++) {
+            PciLeechRamRange *range = &g_array_index(map, PciLeechRamRange, i);
+            struct LeechMemoryRange entry = {
+                .address = range->start,
+                .length = range->size,
+            };
+            g_array_append_val(ranges, entry);
+        }
+    } else {
+        WITH_RCU_READ_LOCK_GUARD() {
+            flatview_for_each_range(address_space_to_flatview(as),
+                                    pci_leech_memory_map_cb, ranges);
+        }
+    }
+    trace_pcileech_memory_map(ch->state, ranges->len);
+    for (guint i = 0; i < ranges->len; i++) {
+        struct LeechMemoryRange *range =
+            &g_array_index(ranges, struct LeechMemoryRange, i);
+        range->address = cpu_to_le64(range->address);
+        range->length = cpu_to_le64(range->length);
+    }
+    pci_leech_send_response(ch, ch->request.tag, LEECH_RESULT_OK,
+                            ranges->len * sizeof(struct LeechMemoryRange));
+    qemu_chr_fe_write_all(ch->chr, (uint8_t *)ranges->data,
+                          ranges->len * sizeof(struct LeechMemoryRange));
+}
+
+typedef struct PciLeechPageMapArgs {
+    uint64_t start;
+    uint64_t end;
+    uint8_t *map;               /* LEECH_PAGE_* by page from start */
+} PciLeechPageMapArgs;
+
+static bool pci_leech_page_map_cb(Int128 start, Int128 len,
+                                  const MemoryRegion *mr,
+                                  hwaddr offset_in_region, void *opaque)
+{
+    PciLeechPageMapArgs *args = opaque;
+    const uint64_t page_size = qemu_target_page_size();
+    MemoryRegion *ram = (MemoryRegion *)mr;
+    RamDiscardManager *rdm;
+    uint64_t first, last;
+    if (!mr->ram || mr->ram_device) {
+        return false;
+    }
+    first = MAX(int128_get64(start), args->start);
+    last = MIN(int128_get64(int128_add(start, len)), args->end);
+    offset_in_region += first - int128_get64(start);
+    rdm = memory_region_get_ram_discard_manager(ram);
+    for (uint64_t addr = first; addr < last; addr += page_size) {
+        const hwaddr offset = offset_in_region + (addr - first);
+        uint8_t *page = &args->map[(addr - args->start) / page_size];
+        MemoryRegionSection section = {
+            .mr = ram,
+            .offset_within_region = offset,
+            .size = int128_make64(page_size),
+        };
+        if (rdm && !ram_discard_manager_is_populated(rdm, &section)) {
+            *page = LEECH_PAGE_DISCARDED;
+        } else if (ram_block_is_private(ram->ram_block, offset)) {
+            *page = LEECH_PAGE_PRIVATE;
+        } else {
+            *page = LEECH_PAGE_RAM;
+        }
+    }
+    return false;
+}
+
+static void pci_leech_process_page_map_request(PciLeechChannel *ch)
+{
+    const uint64_t page_size = qemu_target_page_size();
+    const uint64_t pages = ch->request.length / page_size;
+    PciLeechPageMapArgs args = {
+        .start = ch->request.address,
+        .end = ch->request.address + ch->request.length,
+    };
+    g_autofree uint8_t *map = NULL;
+    if (!QEMU_IS_ALIGNED(args.start, page_size) ||
+        !QEMU_IS_ALIGNED(ch->request.length, page_size) ||
+        args.end < args.start || !pages || pages > ch->xfer_size) {
+        trace_pcileech_page_map(ch->state, ch->request.address,
+                                ch->request.length, LEECH_DEVICE_ERROR);
+        pci_leech_send_response(ch, ch->request.tag, LEECH_DEVICE_ERROR, 0);
+        return;
+    }
+    map = g_malloc(pages);
+    memset(map, LEECH_PAGE_NONE, pages);
+    args.map = map;
+    if (ch->state->replay_file) {
+        /* Whatever is in the dump reads back. */
+        GArray *ranges = ch->state->ram_map->ranges;
+        for (guint i = 0; i < ranges->len; i++) {
+            PciLeechRamRange *range =
+                &g_array_index(ranges, PciLeechRamRange, i);
+            const uint64_t first = MAX(range->start, args.start);
+            const uint64_t last = MIN(range->start + range->size, args.end);
+            if (first < last) {
+                memset(map + (first - args.start) / page_size,
+                       LEECH_PAGE_RAM,
+                       DIV_ROUND_UP(last - first, page_size));
+            }
+        }
+    } else {
+        AddressSpace *as = pci_get_address_space(&ch->state->device);
+        /* virtio-mem changes what is plugged under the BQL. */
+        BQL_LOCK_GUARD();
+        WITH_RCU_READ_LOCK_GUARD() {
+            flatview_for_each_range(address_space_to_flatview(as),
+                                    pci_leech_page_map_cb, &args);
+        }
+    }
+    trace_pcileech_page_map(ch->state, ch->request.address,
+                            ch->request.length, LEECH_RESULT_OK);
+    pci_leech_send_response(ch, ch->request.tag, LEECH_RESULT_OK, pages);
+    qemu_chr_fe_write_all(ch->chr, map, pages);
+}
+
+typedef struct PciLeechDirtyArgs {
+    uint64_t start;
+    uint64_t end;
+    unsigned long *bitmap;      /* NULL to only clear the dirty log */
+} PciLeechDirtyArgs;
+
+static bool pci_leech_dirty_log_cb(Int128 start, Int128 len,
+                                   const MemoryRegion *mr,
+                                   hwaddr offset_in_region, void *opaque)
+{
+    PciLeechDirtyArgs *args = opaque;
+    const uint64_t page_size = qemu_target_page_size();
+    MemoryRegion *ram = (MemoryRegion *)mr;
+    DirtyBitmapSnapshot *snap;
+    uint64_t first, last;
+    if (!mr->ram || mr->ram_device) {
+        return false;
+    }
+    first = MAX(int128_get64(start), args->start);
+    last = MIN(int128_get64(int128_add(start, len)), args->end);
+    if (first >= last) {
+        return false;
+    }
+    offset_in_region += first - int128_get64(start);
+    snap = memory_region_snapshot_and_clear_dirty(ram, offset_in_region,
+                                                  last - first,
+                                                  DIRTY_MEMORY_MIGRATION);
+    for (uint64_t addr = first; args->bitmap && addr < last;
+         addr += page_size) {
+        if (memory_region_snapshot_get_dirty(ram, snap, offset_in_region +
+                                             (addr - first), page_size)) {
+            set_bit((addr - args->start) / page_size, args->bitmap);
+        }
+    }
+    g_free(snap);
+    return false;
+}
+
+/* Called with the BQL held. */
+static void pci_leech_dirty_log_walk(PciLeechState *state,
+                                     PciLeechDirtyArgs *args)
+{
+    AddressSpace *as = pci_get_address_space(&state->device);
+    WITH_RCU_READ_LOCK_GUARD() {
+        flatview_for_each_range(address_space_to_flatview(as),
+                                pci_leech_dirty_log_cb, args);
+    }
+}
+
+/* Called with the BQL held. */
+static void pci_leech_watch_stop(PciLeechState *state)
+{
+    g_array_set_size(state->watches, 0);
+    if (state->watch_timer) {
+        timer_del(state->watch_timer);
+    }
+    WITH_QEMU_LOCK_GUARD(&state->watch_lock) {
+        g_array_set_size(state->watch_events, 0);
+    }
+}
+
+/* Called with the BQL held. */
+static void pci_leech_dirty_log_stop(PciLeechState *state)
+{
+    pci_leech_watch_stop(state);
+    if (state->dirty_log) {
+        memory_global_dirty_log_stop(GLOBAL_DIRTY_PCILEECH);
+        state->dirty_log = NULL;
+    }
+}
+
+/* Called with the BQL held. */
+static uint32_t pci_leech_dirty_log_start(PciLeechChannel *ch)
+{
+    PciLeechDirtyArgs args = { .start = 0, .end = UINT64_MAX };
+    Error *local_err = NULL;
+    if (!ch->state->dirty_log) {
+        if (!memory_global_dirty_log_start(GLOBAL_DIRTY_PCILEECH,
+                                           &local_err)) {
+            error_report_err(local_err);
+            return LEECH_DEVICE_ERROR;
+        }
+        ch->state->dirty_log = ch;
+    }
+    /* Everything written from now on counts; the client reads the rest. */
+    memory_global_dirty_log_sync(false);
+    pci_leech_dirty_log_walk(ch->state, &args);
+    return LEECH_RESULT_OK;
+}
+
+static uint32_t pci_leech_dirty_log_query(PciLeechChannel *ch,
+                                          PciLeechDirtyArgs *args)
+{
+    if (ch->state->replay_file) {
+        /* A dump never changes. */
+        return LEECH_RESULT_OK;
+    }
+    BQL_LOCK_GUARD();
+    /* Clearing the log behind migration's or a dump's back loses pages. */
+    if ((global_dirty_tracking &
+         (GLOBAL_DIRTY_MIGRATION | GLOBAL_DIRTY_DUMP)) ||
+        (ch->state->dirty_log && ch->state->dirty_log != ch)) {
+        return LEECH_DEVICE_ERROR;
+    }
+    if (!args->bitmap) {
+        return pci_leech_dirty_log_start(ch);
+    }
+    if (ch->state->dirty_log != ch) {
+        /* Without tracking, every page may have changed. */
+        return LEECH_DEVICE_ERROR;
+    }
+    memory_global_dirty_log_sync(false);
+    pci_leech_dirty_log_walk(ch->state, args);
+    return LEECH_RESULT_OK;
+}
+
+static void pci_leech_process_dirty_log_request(PciLeechChannel *ch)
+{
+    const uint64_t align = LEECH_DIRTY_LOG_ALIGN * qemu_target_page_size();
+    const uint64_t pages = ch->request.length / qemu_target_page_size();
+    const uint64_t size = DIV_ROUND_UP(pages, BITS_PER_BYTE);
+    PciLeechDirtyArgs args = {
+        .start = ch->request.address,
+        .end = ch->request.address + ch->request.length,
+    };
+    g_autofree unsigned long *bitmap = NULL;
+    g_autofree unsigned long *le = NULL;
+    uint32_t result = LEECH_DEVICE_ERROR;
+    if (QEMU_IS_ALIGNED(args.start, align) &&
+        QEMU_IS_ALIGNED(ch->request.length, align) &&
+        args.end >= args.start && size <= ch->xfer_size) {
+        if (pages) {
+            bitmap = bitmap_new(pages);
+            args.bitmap = bitmap;
+        }
+        result = pci_leech_dirty_log_query(ch, &args);
+    }
+    trace_pcileech_dirty_log(ch->state, ch->request.address,
+                             ch->request.length, result);
+    if (!bitmap || result != LEECH_RESULT_OK) {
+        pci_leech_send_response(ch, ch->request.tag, result, 0);
+        return;
+    }
+    le = bitmap_new(pages);
+    bitmap_to_le(le, bitmap, pages);
+    pci_leech_send_response(ch, ch->request.tag, result, size);
+    qemu_chr_fe_write_all(ch->chr, (uint8_t *)le, size);
+}
+
+/* Send the writes found by the watch timer to the client. */
+static void pci_leech_watch_bh(void *opaque)
+{
+    PciLeechChannel *ch = opaque;
+    PciLeechState *state = ch->state;
+    const guint max = ch->xfer_size / sizeof(struct LeechWatchEvent);
+    g_autoptr(GArray) events = NULL;
+    WITH_QEMU_LOCK_GUARD(&state->watch_lock) {
+        events = state->watch_events;
+        state->watch_events = g_array_new(FALSE, FALSE,
+                                          sizeof(struct LeechWatchEvent));
+    }
+    for (guint i = 0; i < events->len; i += max) {
+        const guint count = MIN(max, events->len - i);
+        const struct LeechWatchEvent *first =
+            &g_array_index(events, struct LeechWatchEvent, i);
+        pci_leech_send_response(ch, LEECH_WATCH_TAG, LEECH_RESULT_OK,
+                                count * sizeof(*first));
+        qemu_chr_fe_write_all(ch->chr, (const uint8_t *)first,
+                              count * sizeof(*first));
+    }
+}
+
+/* Collect the written pages of the watched ranges; BQL held. */
+static void pci_leech_watch_timer(void *opaque)
+{
+    PciLeechState *state = opaque;
+    const uint64_t page_size = qemu_target_page_size();
+    bool found = false;
+    if (!state->watches->len) {
+        return;
+    }
+    timer_mod(state->watch_timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                                  PCILEECH_WATCH_INTERVAL);
+    /* Clearing the log behind migration's back would lose pages. */
+    if (global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) {
+        return;
+    }
+    WITH_QEMU_LOCK_GUARD(&state->watch_lock) {
+        if (state->watch_events->len >= PCILEECH_MAX_WATCH_EVENTS) {
+            /* Leave the pages dirty until the client catches up. */
+            return;
+        }
+    }
+    memory_global_dirty_log_sync(false);
+    for (guint i = 0; i < state->watches->len; i++) {
+        const struct LeechMemoryRange *range =
+            &g_array_index(state->watches, struct LeechMemoryRange, i);
+        const uint64_t pages = range->length / page_size;
+        g_autofree unsigned long *bitmap = bitmap_new(pages);
+        PciLeechDirtyArgs args = {
+            .start = range->address,
+            .end = range->address + range->length,
+            .bitmap = bitmap,
+        };
+        unsigned long first, last;
+        pci_leech_dirty_log_walk(state, &args);
+        for (first = find_first_bit(bitmap, pages); first < pages;
+             first = find_next_bit(bitmap, pages, last)) {
+            struct LeechWatchEvent event;
+            last = find_next_zero_bit(bitmap, pages, first);
+            event.address = cpu_to_le64(range->address + first * page_size);
+            event.length = cpu_to_le64((last - first) * page_size);
+            WITH_QEMU_LOCK_GUARD(&state->watch_lock) {
+                g_array_append_val(state->watch_events, event);
+            }
+            found = true;
+        }
+    }
+    if (found) {
+        replay_bh_schedule_event(state->dirty_log->watch_bh);
+    }
+}
+
+static uint32_t pci_leech_watch_update(PciLeechChannel *ch, uint64_t address,
+                                       uint64_t length)
+{
+    const uint64_t page_size = qemu_target_page_size();
+    PciLeechState *state = ch->state;
+    struct LeechMemoryRange range = { address, length };
+    PciLeechDirtyArgs args = { address, address + length, NULL };
+    uint32_t result;
+    if (!QEMU_IS_ALIGNED(address, page_size) ||
+        !QEMU_IS_ALIGNED(length, page_size) || address + length < address) {
+        return LEECH_DEVICE_ERROR;
+    }
+    if (state->replay_file) {
+        /* A dump never changes. */
+        return LEECH_RESULT_OK;
+    }
+    BQL_LOCK_GUARD();
+    if ((global_dirty_tracking & GLOBAL_DIRTY_MIGRATION) ||
+        (state->dirty_log && state->dirty_log != ch)) {
+        return LEECH_DEVICE_ERROR;
+    }
+    if (!length) {
+        for (guint i = 0; i < state->watches->len; i++) {
+            if (g_array_index(state->watches, struct LeechMemoryRange,
+                              i).address == address) {
+                g_array_remove_index_fast(state->watches, i);
+                return LEECH_RESULT_OK;
+            }
+        }
+        return LEECH_DEVICE_ERROR;
+    }
+    if (state->watches->len >= PCILEECH_MAX_WATCHES) {
+        return LEECH_DEVICE_ERROR;
+    }
+    if (!state->dirty_log) {
+        result = pci_leech_dirty_log_start(ch);
+        if (result != LEECH_RESULT_OK) {
+            return result;
+        }
+    } else {
+        /* Only writes from now on count. */
+        memory_global_dirty_log_sync(false);
+        pci_leech_dirty_log_walk(state, &args);
+    }
+    g_array_append_val(state->watches, range);
+    if (!state->watch_timer) {
+        state->watch_timer = timer_new_ms(QEMU_CLOCK_REALTIME,
+                                          pci_leech_watch_timer, state);
+    }
+    if (!timer_pending(state->watch_timer)) {
+        timer_mod(state->watch_timer,
+                  qemu_clock_get_ms(QEMU_CLOCK_REALTIME) +
+                  PCILEECH_WATCH_INTERVAL);
+    }
+    return LEECH_RESULT_OK;
+}
+
+static void pci_leech_process_watch_request(PciLeechChannel *ch)
+{
+    const uint32_t result = pci_leech_watch_update(ch, ch->request.address,
+                                                   ch->request.length);
+    trace_pcileech_watch(ch->state, ch->request.address, ch->request.length,
+                         result);
+    pci_leech_send_response(ch, ch->request.tag, result, 0);
+}
+
+#ifdef CONFIG_LINUX
+/* Save the pages that the guest is about to write, then let it go on. */
+static void *pci_leech_snapshot_thread(void *opaque)
+{
+    PciLeechSnapshot *snap = opaque;
+    struct pollfd fds[2] = {
+        { .fd = snap->uffd, .events = POLLIN },
+        { .fd = event_notifier_get_fd(&snap->quit), .events = POLLIN },
+    };
+    struct uffd_msg msgs[16];
+    while (!fds[1].revents) {
+        int count;
+        if (poll(fds, ARRAY_SIZE(fds), -1) < 0 && errno != EINTR) {
+            break;
+        }
+        count = uffd_read_events(snap->uffd, msgs, ARRAY_SIZE(msgs));
+        for (int i = 0; i < count; i++) {
+            void *address = (void *)(uintptr_t)msgs[i].arg.pagefault.address;
+            ram_addr_t offset;
+            RAMBlock *block;
+            size_t page_size;
+            uint8_t *page;
+            if (msgs[i].event != UFFD_EVENT_PAGEFAULT) {
+                continue;
+            }
+            WITH_RCU_READ_LOCK_GUARD() {
+                block = qemu_ram_block_from_host(address, false, &offset);
+                page_size = block ? qemu_ram_pagesize(block) :
+                                    qemu_real_host_page_size();
+            }
+            page = (uint8_t *)QEMU_ALIGN_PTR_DOWN(address, page_size);
+            WITH_QEMU_LOCK_GUARD(&snap->lock) {
+                if (!g_hash_table_contains(snap->pages, page)) {
+                    g_hash_table_insert(snap->pages, page,
+                                        g_memdup2(page, page_size));
+                }
+            }
+            /* This wakes up the writer. */
+            uffd_change_protection(snap->uffd, page, page_size, false,
+                                   false);
+        }
+    }
+    return NULL;
+}
+
+/* Called within call_rcu(). */
+static void pci_leech_snapshot_free(PciLeechSnapshot *snap)
+{
+    g_hash_table_unref(snap->pages);
+    qemu_mutex_destroy(&snap->lock);
+    g_free(snap);
+}
+
+/* Undo the start of @snap, which may have failed half-way. */
+static void pci_leech_snapshot_cleanup(PciLeechSnapshot *snap,
+                                       bool thread)
+{
+    for (guint i = 0; i < snap->ranges->len; i++) {
+        PciLeechSnapshotRange *range =
+            &g_array_index(snap->ranges, PciLeechSnapshotRange, i);
+        /* This also wakes up any writer that is still waiting. */
+        uffd_unregister_memory(snap->uffd, range->host, range->length);
+    }
+    g_array_unref(snap->ranges);
+    if (thread) {
+        event_notifier_set(&snap->quit);
+        qemu_thread_join(&snap->thread);
+    }
+    event_notifier_cleanup(&snap->quit);
+    uffd_close_fd(snap->uffd);
+    migrate_del_blocker(&snap->blocker);
+}
+
+/* Called with the BQL held. */
+static void pci_leech_snapshot_release(PciLeechState *state)
+{
+    PciLeechSnapshot *snap = state->snapshot;
+    if (!snap) {
+        return;
+    }
+    trace_pcileech_snapshot(state, false, g_hash_table_size(snap->pages));
+    qatomic_rcu_set(&state->snapshot, NULL);
+    state->snapshot_owner = NULL;
+    pci_leech_snapshot_cleanup(snap, true);
+    call_rcu(snap, pci_leech_snapshot_free, rcu);
+}
+
+/* Write-protect @block; called with the vCPUs paused. */
+static bool pci_leech_snapshot_protect(PciLeechSnapshot *snap,
+                                       RAMBlock *block)
+{
+    PciLeechSnapshotRange range = {
+        .host = block->host,
+        .length = block->max_length,
+    };
+    /* Protection skips pages that have never been touched. */
+    for (ram_addr_t offset = 0; offset < block->used_length;
+         offset += block->page_size) {
+        char tmp = *((char *)block->host + offset);
+        asm volatile("" : "+r" (tmp));
+    }
+    if (uffd_register_memory(snap->uffd, block->host, block->max_length,
+                             UFFDIO_REGISTER_MODE_WP, NULL)) {
+        return false;
+    }
+    g_array_append_val(snap->ranges, range);
+    return !uffd_change_protection(snap->uffd, block->host,
+                                   block->used_length, true, false);
+}
+
+/* Called with the BQL held. */
+static uint32_t pci_leech_snapshot_start(PciLeechChannel *ch)
+{
+    PciLeechState *state = ch->state;
+    const bool running = runstate_is_running();
+    Error *local_err = NULL;
+    PciLeechSnapshot *snap;
+    uint64_t features;
+    RAMBlock *block;
+    bool ok = true;
+    if (state->snapshot && state->snapshot_owner != ch) {
+        return LEECH_DEVICE_ERROR;
+    }
+    pci_leech_snapshot_release(state);
+    if (uffd_query_features(&features) ||
+        !(features & UFFD_FEATURE_PAGEFAULT_FLAG_WP)) {
+        return LEECH_DEVICE_ERROR;
+    }
+    snap = g_new0(PciLeechSnapshot, 1);
+    /* Migration's own write tracking or dirty pages would clash. */
+    error_setg(&snap->blocker, "pcileech device has a snapshot of the RAM");
+    if (migrate_add_blocker(&snap->blocker, &local_err) < 0) {
+        error_report_err(local_err);
+        g_free(snap);
+        return LEECH_DEVICE_ERROR;
+    }
+    snap->uffd = uffd_create_fd(UFFD_FEATURE_PAGEFAULT_FLAG_WP, true);
+    if (snap->uffd < 0) {
+        migrate_del_blocker(&snap->blocker);
+        g_free(snap);
+        return LEECH_DEVICE_ERROR;
+    }
+    snap->ranges = g_array_new(false, false, sizeof(PciLeechSnapshotRange));
+    snap->pages = g_hash_table_new_full(NULL, NULL, NULL, g_free);
+    qemu_mutex_init(&snap->lock);
+    event_notifier_init(&snap->quit, false);
+    /* Protect all of the RAM at the same moment. */
+    if (running) {
+        pause_all_vcpus();
+    }
+    WITH_RCU_READ_LOCK_GUARD() {
+        RAMBLOCK_FOREACH(block) {
+            MemoryRegion *mr = block->mr;
+            /* Devices' RAM and unplugged memory are read live. */
+            if (!block->host || mr->readonly || mr->rom_device ||
+                mr->ram_device || memory_region_has_ram_discard_manager(mr)) {
+                continue;
+            }
+            if (!pci_leech_snapshot_protect(snap, block)) {
+                ok = false;
+                break;
+            }
+        }
+    }
+    if (ok) {
+        qemu_thread_create(&snap->thread, "pcileech-snap",
+                           pci_leech_snapshot_thread, snap,
+                           QEMU_THREAD_JOINABLE);
+    } else {
+        pci_leech_snapshot_cleanup(snap, false);
+    }
+    if (running) {
+        resume_all_vcpus();
+    }
+    if (!ok) {
+        pci_leech_snapshot_free(snap);
+        return LEECH_DEVICE_ERROR;
+    }
+    qatomic_rcu_set(&state->snapshot, snap);
+    state->snapshot_owner = ch;
+    trace_pcileech_snapshot(state, true, snap->ranges->len);
+    return LEECH_RESULT_OK;
+}
+#else
+static void pci_leech_snapshot_release(PciLeechState *state)
+{
+}
+
+static uint32_t pci_leech_snapshot_start(PciLeechChannel *ch)
+{
+    return LEECH_DEVICE_ERROR;
+}
+#endif
+
+static void pci_leech_process_snapshot_request(PciLeechChannel *ch)
+{
+    uint32_t result = LEECH_RESULT_OK;
+    if (ch->state->replay_file) {
+        /* A dump is a snapshot already. */
+    } else {
+        BQL_LOCK_GUARD();
+        if (ch->request.address) {
+            result = pci_leech_snapshot_start(ch);
+        } else if (ch->state->snapshot_owner == ch) {
+            pci_leech_snapshot_release(ch->state);
+        } else if (ch->state->snapshot) {
+            result = LEECH_DEVICE_ERROR;
+        }
+    }
+    pci_leech_send_response(ch, ch->request.tag, result, 0);
+}
+
+/* Drop the dirty tracking and the snapshot that @ch started. */
+static void pci_leech_release(PciLeechChannel *ch)
+{
+    PciLeechState *state = ch->state;
+    /*
+     * Only @ch itself makes itself the owner, so this needs no lock; a
+     * client connecting elsewhere does not wait for the BQL.
+     */
+    if (qatomic_read(&state->dirty_log) != ch &&
+        qatomic_read(&state->snapshot_owner) != ch) {
+        return;
+    }
+    BQL_LOCK_GUARD();
+    if (state->dirty_log == ch) {
+        pci_leech_dirty_log_stop(state);
+    }
+    if (state->snapshot_owner == ch) {
+        pci_leech_snapshot_release(state);
+    }
+}
+
+static int pci_leech_cpu_note(const void *buf, size_t size, void *opaque)
+{
+    g_byte_array_append(opaque, buf, size);
+    return 0;
+}
+
+static void pci_leech_process_cpu_state_request(PciLeechChannel *ch)
+{
+    g_autoptr(GByteArray) notes = g_byte_array_new();
+    uint32_t result = LEECH_RESULT_OK;
+    CPUState *cpu;
+    if (ch->state->replay_file) {
+        g_byte_array_append(notes, ch->state->replay_notes,
+                            ch->state->replay_notes_size);
+    } else {
+        BQL_LOCK_GUARD();
+        cpu_synchronize_all_states();
+        CPU_FOREACH(cpu) {
+            if (cpu_write_elf64_qemunote(pci_leech_cpu_note, cpu,
+                                         notes) < 0) {
+                result = LEECH_DEVICE_ERROR;
+            }
+        }
+    }
+    if (result != LEECH_RESULT_OK) {
+        pci_leech_send_response(ch, ch->request.tag, result, 0);
+        return;
+    }
+    pci_leech_send_response(ch, ch->request.tag, result, notes->len);
+    qemu_chr_fe_write_all(ch->chr, notes->data, notes->len);
+}
+
+static void pci_leech_process_hash_request(PciLeechChannel *ch)
+{
+    const uint64_t page_size = qemu_target_page_size();
+    const uint64_t address = ch->request.address;
+    const uint64_t pages = ch->request.length / page_size;
+    g_autofree struct LeechHashEntry *entries = NULL;
+    if (!QEMU_IS_ALIGNED(address | ch->request.length, page_size) ||
+        pages > ch->xfer_size / sizeof(struct LeechHashEntry)) {
+        trace_pcileech_read_hash(ch->state, ch->request.tag, address,
+                                 ch->request.length, LEECH_DEVICE_ERROR);
+        pci_leech_send_response(ch, ch->request.tag, LEECH_DEVICE_ERROR, 0);
+        return;
+    }
+    entries = g_new(struct LeechHashEntry, pages);
+    for (uint64_t i = 0; i < pages; i++) {
+        uint32_t crc = 0xffffffff;
+        uint32_t result = LEECH_RESULT_OK;
+        /* Pages larger than the bounce buffer are hashed in pieces. */
+        for (uint64_t done = 0; done < page_size;) {
+            const uint64_t len = MIN(page_size - done, ch->state->chunk_size);
+            PciLeechChunk data;
+            pci_leech_chunk_get(ch, address + i * page_size + done,
+                                len, ch->buffer, &data);
+            result |= pci_leech_convert_result(data.result);
+            crc = crc32c(crc, data.ptr, len);
+            pci_leech_chunk_put(ch->state, &data, len);
+            done += len;
+        }
+        entries[i].result = cpu_to_le32(result);
+        entries[i].digest = cpu_to_le32(result ? 0 : crc ^ 0xffffffff);
+    }
+    trace_pcileech_read_hash(ch->state, ch->request.tag, address,
+                             ch->request.length, LEECH_RESULT_OK);
+    pci_leech_send_response(ch, ch->request.tag, LEECH_RESULT_OK,
+                            pages * sizeof(struct LeechHashEntry));
+    qemu_chr_fe_write_all(ch->chr, (uint8_t *)entries,
+                          pages * sizeof(struct LeechHashEntry));
+}
+
+/* Collects the matches that start in the first @limit bytes of @data. */
+static void pci_leech_search_window(const struct LeechSearchRequest *search,
+                                    const uint8_t *data, uint64_t address,
+                                    uint64_t limit, GArray *matches,
+                                    uint32_t max_matches)
+{
+    uint64_t off = 0;
+    while (off < limit && matches->len < max_matches) {
+        uint64_t match;
+        if (search->align > 1) {
+            off = ROUND_UP(address + off, search->align) - address;
+        } else {
+            /* memchr() is vectorised by the C library; memcmp() rarely. */
+            const uint8_t *hit = memchr(data + off, search->pattern[0],
+                                        limit - off);
+            if (!hit) {
+                break;
+            }
+            off = hit - data;
+        }
+        if (off >= limit) {
+            break;
+        }
+        if (!memcmp(data + off, search->pattern, search->pattern_length)) {
+            match = cpu_to_le64(address + off);
+            g_array_append_val(matches, match);
+        }
+        off += MAX(search->align, 1);
+    }
+}
+
+static void pci_leech_process_search_request(PciLeechChannel *ch,
+                                             const uint8_t *buf, int size)
+{
+    const uint64_t start = ch->request.address;
+    const uint64_t end = start + ch->request.length;
+    struct LeechSearchRequest search;
+    g_autoptr(GArray) matches = g_array_new(false, false, sizeof(uint64_t));
+    uint32_t max_matches = ch->xfer_size / sizeof(uint64_t);
+    uint32_t result = LEECH_RESULT_OK;
+    uint64_t pos;
+    memcpy(&ch->buffer[ch->buffered], buf, size);
+    ch->buffered += size;
+    if (ch->buffered < sizeof(search)) {
+        return;
+    }
+    ch->search_pending = false;
+    ch->buffered = 0;
+    memcpy(&search, ch->buffer, sizeof(search));
+    search.pattern_length = le32_to_cpu(search.pattern_length);
+    search.align = le32_to_cpu(search.align);
+    search.max_matches = le32_to_cpu(search.max_matches);
+    if (search.pattern_length == 0 ||
+        search.pattern_length > LEECH_SEARCH_MAX_PATTERN ||
+        (search.align && !is_power_of_2(search.align)) || end < start) {
+        trace_pcileech_search(ch->state, ch->request.tag, start,
+                              ch->request.length, 0, LEECH_DEVICE_ERROR);
+        pci_leech_send_response(ch, ch->request.tag, LEECH_DEVICE_ERROR, 0);
+        return;
+    }
+    if (search.max_matches) {
+        max_matches = MIN(max_matches, search.max_matches);
+    }
+    pos = start;
+    while (end - pos >= search.pattern_length &&
+           matches->len < max_matches) {
+        const uint64_t len = MIN(end - pos, ch->state->chunk_size);
+        PciLeechChunk data;
+        pci_leech_chunk_get(ch, pos, len, ch->buffer, &data);
+        if (data.result == MEMTX_OK) {
+            pci_leech_search_window(&search, data.ptr, pos,
+                                    len - search.pattern_length + 1,
+                                    matches, max_matches);
+        } else {
+            result |= pci_leech_convert_result(data.result);
+        }
+        pci_leech_chunk_put(ch->state, &data, len);
+        if (pos + len == end) {
+            break;
+        }
+        /* Windows overlap so that no match is lost at their edges. */
+        pos += len - search.pattern_length + 1;
+    }
+    trace_pcileech_search(ch->state, ch->request.tag, start,
+                          ch->request.length, matches->len, result);
+    pci_leech_send_response(ch, ch->request.tag, result,
+                            matches->len * sizeof(uint64_t));
+    qemu_chr_fe_write_all(ch->chr, (uint8_t *)matches->data,
+                          matches->len * sizeof(uint64_t));
+}
+
+/* x86-64 page-table entries */
+#define PCILEECH_PTE_PRESENT    (1ULL << 0)
+#define PCILEECH_PTE_PS         (1ULL << 7)
+#define PCILEECH_PTE_ADDR_MASK  0x000ffffffffff000ULL
+
+/*
+ * Paging-structure cache of one READ_VIRT request: table[l] is the
+ * physical address of the level-l table that covers the virtual
+ * addresses with tag[l] == va >> (12 + 9 * l), level 1 being the PT.
+ * Consecutive pages mostly need a single page-table read then.
+ */
+typedef struct PciLeechWalk {
+    uint64_t dtb;
+    int levels;
+    uint64_t table[5];
+    uint64_t tag[5];
+    bool valid[5];
+} PciLeechWalk;
+
+/*
+ * Translate @va. Returns the leaf entry, or 0 if the page is not present
+ * or a table could not be read, and sets *@pa to the physical address
+ * and *@size to the bytes left in the page.
+ */
+static uint64_t pci_leech_virt_walk(PciLeechChannel *ch, PciLeechWalk *walk,
+                                    uint64_t va, uint64_t *pa,
+                                    uint64_t *size)
+{
+    uint64_t table = walk->dtb & PCILEECH_PTE_ADDR_MASK;
+    int level = walk->levels;
+    /* Resume at the deepest cached table that covers @va. */
+    for (int l = 1; l < walk->levels; l++) {
+        if (walk->valid[l] && walk->tag[l] == va >> (12 + 9 * l)) {
+            table = walk->table[l];
+            level = l;
+            break;
+        }
+    }
+    for (; level > 0; level--) {
+        const int shift = 12 + 9 * (level - 1);
+        const uint64_t entry = table + ((va >> shift) & 511) * 8;
+        uint64_t pte;
+        pci_leech_wc_flush_overlap(ch, entry, sizeof(pte));
+        if (pci_leech_dma_read(ch->state, entry, &pte,
+                               sizeof(pte)) != MEMTX_OK) {
+            return 0;
+        }
+        pte = le64_to_cpu(pte);
+        if (!(pte & PCILEECH_PTE_PRESENT)) {
+            return 0;
+        }
+        if (level == 1 || ((level == 2 || level == 3) &&
+                           (pte & PCILEECH_PTE_PS))) {
+            /* A 4 KiB, 2 MiB or 1 GiB page. */
+            const uint64_t mask = (1ULL << shift) - 1;
+            *pa = (pte & PCILEECH_PTE_ADDR_MASK & ~mask) | (va & mask);
+            *size = mask + 1 - (va & mask);
+            return pte;
+        }
+        table = pte & PCILEECH_PTE_ADDR_MASK;
+        walk->table[level - 1] = table;
+        walk->tag[level - 1] = va >> shift;
+        walk->valid[level - 1] = true;
+    }
+    return 0;
+}
+
+/* Read physically contiguous @length bytes at @pa into @dest. */
+static uint32_t pci_leech_virt_read(PciLeechChannel *ch, uint64_t pa,
+                                    uint64_t length, uint8_t *dest)
+{
+    PciLeechChunk data;
+    uint32_t result;
+    pci_leech_chunk_get(ch, pa, length, dest, &data);
+    result = pci_leech_convert_result(data.result);
+    if (result != LEECH_RESULT_OK) {
+        memset(dest, 0, length);
+    } else if (data.ptr != dest) {
+        memcpy(dest, data.ptr, length);
+    }
+    pci_leech_chunk_put(ch->state, &data, length);
+    return result;
+}
+
+static AddressSpace *pci_leech_pasid_as(PciLeechState *state, uint32_t pasid)
+{
+    /* The IOMMU may create the address space on the first request. */
+    BQL_LOCK_GUARD();
+    return pci_device_iommu_address_space_pasid(&state->device, pasid);
+}
+
+/*
+ * Read @length bytes at @va of the address space that the IOMMU
+ * associates with @pasid into @dest, zeroing the pages it does not
+ * translate.
+ */
+static uint32_t pci_leech_pasid_read(PciLeechChannel *ch, uint32_t pasid,
+                                     uint64_t va, uint64_t length,
+                                     uint8_t *dest)
+{
+    PciLeechState *state = ch->state;
+    uint32_t result = LEECH_RESULT_OK;
+    AddressSpace *as;
+    if (!pcie_pasid_enabled(&state->device) || state->replay_file) {
+        return LEECH_DEVICE_ERROR;
+    }
+    as = pci_leech_pasid_as(state, pasid);
+    if (!as) {
+        return LEECH_DEVICE_ERROR;
+    }
+    /* The pages may alias anything that is still write-combined. */
+    pci_leech_wc_flush(ch);
+    stat64_add(&state->stats.read_bytes, length);
+    for (uint64_t done = 0, size; done < length; done += size) {
+        size = MIN(4096 - ((va + done) & 0xfff), length - done);
+        if (address_space_read(as, va + done, MEMTXATTRS_UNSPECIFIED,
+                               dest + done, size) != MEMTX_OK) {
+            memset(dest + done, 0, size);
+            result |= LEECH_ACCESS_ERROR;
+        }
+    }
+    return result;
+}
+
+static void pci_leech_process_virt_request(PciLeechChannel *ch,
+                                           const uint8_t *buf, int size)
+{
+    const uint64_t va = ch->request.address;
+    const uint64_t length = ch->request.length;
+    const uint64_t pages = DIV_ROUND_UP((va & 0xfff) + length, 4096);
+    g_autofree uint64_t *ptes = NULL;
+    struct LeechVirtRequest virt;
+    PciLeechWalk walk = { 0 };
+    uint32_t result = LEECH_RESULT_OK;
+    uint64_t done = 0, run_pa = 0, run_len = 0;
+    memcpy(&ch->buffer[ch->buffered], buf, size);
+    ch->buffered += size;
+    if (ch->buffered < sizeof(virt)) {
+        return;
+    }
+    ch->virt_pending = false;
+    ch->buffered = 0;
+    memcpy(&virt, ch->buffer, sizeof(virt));
+    virt.dtb = le64_to_cpu(virt.dtb);
+    virt.flags = le32_to_cpu(virt.flags);
+    virt.pasid = le32_to_cpu(virt.pasid);
+    if (length > ch->xfer_size) {
+        pci_leech_send_response(ch, ch->request.tag, LEECH_DEVICE_ERROR, 0);
+        return;
+    }
+    if (virt.flags & LEECH_VIRT_PASID) {
+        if (!ch->state->pasid || virt.flags != LEECH_VIRT_PASID ||
+            virt.pasid >= 1U << PCILEECH_PASID_WIDTH) {
+            result = LEECH_DEVICE_ERROR;
+        } else {
+            result = pci_leech_pasid_read(ch, virt.pasid, va, length,
+                                          ch->buffer);
+        }
+        trace_pcileech_read_pasid(ch->state, ch->request.tag, va, length,
+                                  virt.pasid, result);
+        if (result & LEECH_DEVICE_ERROR) {
+            pci_leech_send_response(ch, ch->request.tag, result, 0);
+            return;
+        }
+        pci_leech_send_response(ch, ch->request.tag, result, length);
+        qemu_chr_fe_write_all(ch->chr, ch->buffer, length);
+        return;
+    }
+    walk.dtb = virt.dtb;
+    walk.levels = virt.flags & LEECH_VIRT_LA57 ? 5 : 4;
+    if (virt.flags & LEECH_VIRT_PTES) {
+        ptes = g_new0(uint64_t, pages);
+    }
+    /* Read physically contiguous runs at once, into the transfer buffer. */
+    while (done < length) {
+        uint64_t pa, size;
+        const uint64_t pte = pci_leech_virt_walk(ch, &walk, va + done,
+                                                 &pa, &size);
+        if (!pte) {
+            size = 4096 - ((va + done) & 0xfff);
+        }
+        size = MIN(size, length - done);
+        if (run_len && (!pte || pa != run_pa + run_len)) {
+            result |= pci_leech_virt_read(ch, run_pa, run_len,
+                                          ch->buffer + done - run_len);
+            run_len = 0;
+        }
+        if (pte) {
+            if (!run_len) {
+                run_pa = pa;
+            }
+            run_len += size;
+        } else {
+            memset(ch->buffer + done, 0, size);
+            result |= LEECH_ACCESS_ERROR;
+        }
+        if (ptes) {
+            /* Every 4 KiB page that this piece touches has this entry. */
+            for (uint64_t p = ((va & 0xfff) + done) / 4096;
+                 p <= ((va & 0xfff) + done + size - 1) / 4096; p++) {
+                ptes[p] = cpu_to_le64(pte);
+            }
+        }
+        done += size;
+    }
+    if (run_len) {
+        result |= pci_leech_virt_read(ch, run_pa, run_len,
+                                      ch->buffer + done - run_len);
+    }
+    trace_pcileech_read_virt(ch->state, ch->request.tag, va, length,
+                             virt.dtb, result);
+    pci_leech_send_response(ch, ch->request.tag, result,
+                            length + (ptes ? pages * sizeof(*ptes) : 0));
+    qemu_chr_fe_write_all(ch->chr, ch->buffer, length);
+    if (ptes) {
+        qemu_chr_fe_write_all(ch->chr, (uint8_t *)ptes,
+                              pages * sizeof(*ptes));
+    }
+}
+
+/*
+ * Find the descriptor at the head of @ring. Returns false if the ring is
+ * empty. The descriptor is accessed without mbox_lock, so that rings in
+ * the BAR itself cannot deadlock; @generation tells whether the guest
+ * reset the ring in the meantime.
+ */
+static bool pci_leech_ring_peek(PciLeechState *state, PciLeechRing *ring,
+                                uint64_t *desc, uint32_t *generation)
+{
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    if (!ring->size || ring->head == ring->tail) {
+        return false;
+    }
+    *desc = ring->base + (uint64_t)(ring->head & (ring->size - 1)) *
+                         sizeof(struct LeechMailboxDesc);
+    *generation = ring->generation;
+    return true;
+}
+
+/* Complete the descriptor at the head of @ring. */
+static void pci_leech_ring_advance(PciLeechState *state, PciLeechRing *ring,
+                                   uint32_t generation, uint32_t irq)
+{
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    if (ring->generation == generation) {
+        ring->head++;
+        pci_leech_mbox_raise(state, irq);
+    }
+}
+
+/*
+ * Copy the next message of the guest into the transfer buffer and return
+ * its length, or -1 if there is none. A message longer than a frame is
+ * completed with LEECH_DESC_ERROR and returned empty.
+ */
+static int64_t pci_leech_mbox_pull(PciLeechChannel *ch, uint32_t *result)
+{
+    PciLeechState *state = ch->state;
+    struct LeechMailboxDesc desc;
+    uint64_t addr;
+    uint32_t generation, length;
+    MemTxResult res;
+    if (!pci_leech_ring_peek(state, &state->mbox_tx, &addr, &generation)) {
+        return -1;
+    }
+    res = pci_dma_read(&state->device, addr, &desc, sizeof(desc));
+    length = le32_to_cpu(desc.length);
+    if (res == MEMTX_OK && length > ch->xfer_size) {
+        res = MEMTX_ERROR;
+    }
+    if (res == MEMTX_OK) {
+        res = pci_dma_read(&state->device, le64_to_cpu(desc.address),
+                           ch->buffer, length);
+    }
+    stl_le_pci_dma(&state->device,
+                   addr + offsetof(struct LeechMailboxDesc, flags),
+                   LEECH_DESC_DONE | (res ? LEECH_DESC_ERROR : 0),
+                   MEMTXATTRS_UNSPECIFIED);
+    pci_leech_ring_advance(state, &state->mbox_tx, generation,
+                           PCILEECH_MBOX_IRQ_TX);
+    *result = pci_leech_convert_result(res);
+    trace_pcileech_mailbox(state, false, length, *result);
+    return res == MEMTX_OK ? length : 0;
+}
+
+/* Put a message of the client into the next buffer of the guest. */
+static uint32_t pci_leech_mbox_push(PciLeechChannel *ch, const uint8_t *data,
+                                    uint32_t length)
+{
+    PciLeechState *state = ch->state;
+    struct LeechMailboxDesc desc;
+    uint64_t addr;
+    uint32_t generation;
+    MemTxResult res;
+    if (!pci_leech_ring_peek(state, &state->mbox_rx, &addr, &generation)) {
+        return LEECH_DEVICE_ERROR;
+    }
+    res = pci_dma_read(&state->device, addr, &desc, sizeof(desc));
+    if (res == MEMTX_OK && length > le32_to_cpu(desc.length)) {
+        /* Leave the buffer to a message that fits. */
+        return LEECH_DEVICE_ERROR;
+    }
+    if (res == MEMTX_OK) {
+        res = pci_dma_write(&state->device, le64_to_cpu(desc.address),
+                            data, length);
+    }
+    desc.length = cpu_to_le32(res == MEMTX_OK ? length : 0);
+    desc.flags = cpu_to_le32(LEECH_DESC_DONE | (res ? LEECH_DESC_ERROR : 0));
+    pci_dma_write(&state->device,
+                  addr + offsetof(struct LeechMailboxDesc, length),
+                  &desc.length, sizeof(desc.length) + sizeof(desc.flags));
+    pci_leech_ring_advance(state, &state->mbox_rx, generation,
+                           PCILEECH_MBOX_IRQ_RX);
+    trace_pcileech_mailbox(state, true, length,
+                           pci_leech_convert_result(res));
+    return pci_leech_convert_result(res);
+}
+
+/* Send the messages of the guest to a client that wants them pushed. */
+static void pci_leech_mbox_bh(void *opaque)
+{
+    PciLeechChannel *ch = opaque;
+    uint32_t result;
+    int64_t length;
+    if (!ch->state->mailbox || !ch->state->mbox_connected ||
+        !(ch->features & LEECH_FEATURE_MAILBOX_PUSH)) {
+        return;
+    }
+    while ((length = pci_leech_mbox_pull(ch, &result)) >= 0) {
+        pci_leech_send_response(ch, LEECH_MAILBOX_TAG, result, length);
+        qemu_chr_fe_write_all(ch->chr, ch->buffer, length);
+    }
+}
+
+/* A client attached to or detached from the first channel. */
+static void pci_leech_mbox_link(PciLeechState *state, bool connected)
+{
+    if (!state->mailbox) {
+        return;
+    }
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    if (state->mbox_connected != connected) {
+        state->mbox_connected = connected;
+        pci_leech_mbox_raise(state, PCILEECH_MBOX_IRQ_LINK);
+    }
+}
+
+static void pci_leech_start_mbox_request(PciLeechChannel *ch)
+{
+    uint32_t result = LEECH_RESULT_OK;
+    int64_t length;
+    if (!ch->state->mailbox || ch->index ||
+        ch->request.length > ch->xfer_size) {
+        pci_leech_send_response(ch, ch->request.tag, LEECH_DEVICE_ERROR, 0);
+        ch->discard = ch->request.length;
+    } else if (ch->request.length) {
+        ch->mbox_pending = true;
+        ch->buffered = 0;
+    } else {
+        length = pci_leech_mbox_pull(ch, &result);
+        pci_leech_send_response(ch, ch->request.tag, result, MAX(length, 0));
+        if (length > 0) {
+            qemu_chr_fe_write_all(ch->chr, ch->buffer, length);
+        }
+    }
+}
+
+static void pci_leech_process_mbox_request(PciLeechChannel *ch,
+                                           const uint8_t *buf, int size)
+{
+    memcpy(&ch->buffer[ch->buffered], buf, size);
+    ch->buffered += size;
+    if (ch->buffered < ch->request.length) {
+        return;
+    }
+    ch->mbox_pending = false;
+    ch->buffered = 0;
+    pci_leech_send_response(ch, ch->request.tag,
+                            pci_leech_mbox_push(ch, ch->buffer,
+                                                ch->request.length),
+                            0);
+}
+
+static uint64_t pci_leech_mbox_read(void *opaque, hwaddr addr, unsigned size)
+{
+    PciLeechState *state = opaque;
+    PciLeechRing *ring;
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    switch (addr) {
+    case PCILEECH_MBOX_MAGIC:
+        return PCILEECH_MBOX_MAGIC_VALUE;
+    case PCILEECH_MBOX_STATUS:
+        return state->mbox_connected ? PCILEECH_MBOX_CONNECTED : 0;
+    case PCILEECH_MBOX_IRQ_STATUS:
+        return state->mbox_irq_status;
+    case PCILEECH_MBOX_IRQ_MASK:
+        return state->mbox_irq_mask;
+    case PCILEECH_MBOX_DONE_COUNT:
+        return state->done_count;
+    case PCILEECH_MBOX_WATCH_COUNT:
+        return state->watch_count;
+    case PCILEECH_MBOX_WATCH_BASE_LO:
+        return (uint32_t)state->watch_base;
+    case PCILEECH_MBOX_WATCH_BASE_HI:
+        return state->watch_base >> 32;
+    case PCILEECH_MBOX_WATCH_SIZE_LO:
+        return (uint32_t)state->watch_size;
+    case PCILEECH_MBOX_WATCH_SIZE_HI:
+        return state->watch_size >> 32;
+    case PCILEECH_MBOX_WATCH_HIT_LO:
+        return (uint32_t)state->watch_hit;
+    case PCILEECH_MBOX_WATCH_HIT_HI:
+        return state->watch_hit >> 32;
+    case PCILEECH_MBOX_COALESCE_COUNT:
+        return state->coalesce_count;
+    case PCILEECH_MBOX_COALESCE_TIME:
+        return state->coalesce_time;
+    }
+    if (addr < PCILEECH_MBOX_TX ||
+        addr >= PCILEECH_MBOX_RX + PCILEECH_MBOX_RING_REGS) {
+        return 0;
+    }
+    ring = addr < PCILEECH_MBOX_RX ? &state->mbox_tx : &state->mbox_rx;
+    switch (addr % PCILEECH_MBOX_RING_REGS) {
+    case PCILEECH_RING_BASE_LO:
+        return (uint32_t)ring->base;
+    case PCILEECH_RING_BASE_HI:
+        return ring->base >> 32;
+    case PCILEECH_RING_SIZE:
+        return ring->size;
+    case PCILEECH_RING_TAIL:
+        return ring->tail;
+    case PCILEECH_RING_HEAD:
+        return ring->head;
+    }
+    return 0;
+}
+
+static void pci_leech_mbox_write(void *opaque, hwaddr addr, uint64_t val,
+                                 unsigned size)
+{
+    PciLeechState *state = opaque;
+    PciLeechRing *ring;
+    switch (addr) {
+    case PCILEECH_MBOX_IRQ_ACK:
+        WITH_QEMU_LOCK_GUARD(&state->mbox_lock) {
+            state->mbox_irq_status &= ~val;
+        }
+        pci_leech_mbox_update_irq(state);
+        return;
+    case PCILEECH_MBOX_IRQ_MASK:
+        WITH_QEMU_LOCK_GUARD(&state->mbox_lock) {
+            state->mbox_irq_mask = val;
+        }
+        pci_leech_mbox_update_irq(state);
+        return;
+    case PCILEECH_MBOX_WATCH_BASE_LO:
+    case PCILEECH_MBOX_WATCH_BASE_HI:
+    case PCILEECH_MBOX_WATCH_SIZE_LO:
+    case PCILEECH_MBOX_WATCH_SIZE_HI:
+        WITH_QEMU_LOCK_GUARD(&state->mbox_lock) {
+            uint64_t *reg = addr < PCILEECH_MBOX_WATCH_SIZE_LO ?
+                            &state->watch_base : &state->watch_size;
+            *reg = deposit64(*reg, addr & 4 ? 32 : 0, 32, val);
+        }
+        return;
+    case PCILEECH_MBOX_COALESCE_COUNT:
+        WITH_QEMU_LOCK_GUARD(&state->mbox_lock) {
+            state->coalesce_count = val;
+        }
+        return;
+    case PCILEECH_MBOX_COALESCE_TIME:
+        WITH_QEMU_LOCK_GUARD(&state->mbox_lock) {
+            state->coalesce_time = val;
+        }
+        return;
+    }
+    if (addr < PCILEECH_MBOX_TX ||
+        addr >= PCILEECH_MBOX_RX + PCILEECH_MBOX_RING_REGS) {
+        qemu_log_mask(LOG_GUEST_ERROR, "pcileech: write to read-only "
+                      "mailbox register 0x%" HWADDR_PRIx "\n", addr);
+        return;
+    }
+    ring = addr < PCILEECH_MBOX_RX ? &state->mbox_tx : &state->mbox_rx;
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    switch (addr % PCILEECH_MBOX_RING_REGS) {
+    case PCILEECH_RING_BASE_LO:
+        ring->base = deposit64(ring->base, 0, 32, val);
+        break;
+    case PCILEECH_RING_BASE_HI:
+        ring->base = deposit64(ring->base, 32, 32, val);
+        break;
+    case PCILEECH_RING_SIZE:
+        if (val && (!is_power_of_2(val) || val > PCILEECH_MBOX_MAX_RING)) {
+            qemu_log_mask(LOG_GUEST_ERROR, "pcileech: invalid mailbox "
+                          "ring size %" PRIu64 "\n", val);
+            break;
+        }
+        ring->size = val;
+        ring->head = ring->tail = 0;
+        ring->generation++;
+        break;
+    case PCILEECH_RING_TAIL:
+        if ((uint32_t)(val - ring->head) > ring->size) {
+            qemu_log_mask(LOG_GUEST_ERROR, "pcileech: mailbox tail %" PRIu64
+                          " beyond the ring\n", val);
+            break;
+        }
+        ring->tail = val;
+        if (ring == &state->mbox_tx) {
+            replay_bh_schedule_event(state->mbox_bh);
+        }
+        break;
+    default:
+        qemu_log_mask(LOG_GUEST_ERROR, "pcileech: write to read-only "
+                      "mailbox register 0x%" HWADDR_PRIx "\n", addr);
+        break;
+    }
+}
+
+static const MemoryRegionOps pci_leech_mbox_ops = {
+    .read = pci_leech_mbox_read,
+    .write = pci_leech_mbox_write,
+    .endianness = DEVICE_LITTLE_ENDIAN,
+    .valid = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+    .impl = {
+        .min_access_size = 4,
+        .max_access_size = 4,
+    },
+};
+
+static void pci_leech_dispatch_request(PciLeechChannel *ch)
+{
+    stat64_add(&ch->state->stats.requests, 1);
+    trace_pcileech_request(ch->state, ch->request.command, ch->request.tag,
+                           ch->request.address, ch->request.length);
+    switch (ch->request.command) {
+    case PCILEECH_REQUEST_READ:
+        /* Reads are sent from a bottom half, frame by frame. */
+        pci_leech_queue_read_request(ch);
+        break;
+    case PCILEECH_REQUEST_WRITE:
+        if (ch->request.length == 0) {
+            /* Nothing to write, nothing to acknowledge. */
+            break;
+        }
+        /* In this context, we don't have data right now. */
+        /* Set to write-pending state */
+        ch->write_pending = true;
+        ch->written_length = 0;
+        ch->write_result = LEECH_RESULT_OK;
+        ch->write_error = ch->request.length;
+        ch->buffered = 0;
+        break;
+    case PCILEECH_REQUEST_NEGOTIATE:
+        pci_leech_process_negotiate_request(ch);
+        break;
+    case PCILEECH_REQUEST_READ_SCATTER:
+        pci_leech_start_scatter_request(ch);
+        break;
+    case PCILEECH_REQUEST_WRITE_SCATTER:
+        pci_leech_start_write_scatter_request(ch);
+        break;
+    case PCILEECH_REQUEST_CPU_STATE:
+        pci_leech_process_cpu_state_request(ch);
+        break;
+    case PCILEECH_REQUEST_MEMORY_MAP:
+        pci_leech_process_memory_map_request(ch);
+        break;
+    case PCILEECH_REQUEST_PAGE_MAP:
+        pci_leech_process_page_map_request(ch);
+        break;
+    case PCILEECH_REQUEST_DIRTY_LOG:
+        pci_leech_process_dirty_log_request(ch);
+        break;
+    case PCILEECH_REQUEST_READ_HASH:
+        pci_leech_process_hash_request(ch);
+        break;
+    case PCILEECH_REQUEST_SEARCH:
+        ch->search_pending = true;
+        ch->buffered = 0;
+        break;
+    case PCILEECH_REQUEST_READ_VIRT:
+        ch->virt_pending = true;
+        ch->buffered = 0;
+        break;
+    case PCILEECH_REQUEST_SNAPSHOT:
+        pci_leech_process_snapshot_request(ch);
+        break;
+    case PCILEECH_REQUEST_MAILBOX:
+        pci_leech_start_mbox_request(ch);
+        break;
+    case PCILEECH_REQUEST_WATCH:
+        pci_leech_process_watch_request(ch);
+        break;
+    case PCILEECH_REQUEST_FLUSH:
+        pci_leech_wc_flush(ch);
+        pci_leech_send_response(ch, ch->request.tag,
+                                pci_leech_convert_result(ch->wc_result), 0);
+        ch->wc_result = MEMTX_OK;
+        break;
+    default:
+        trace_pcileech_request_unknown(ch->state, ch->request.command,
+                                       ch->request.tag);
+        pci_leech_send_response(ch, ch->request.tag,
+                                LEECH_DEVICE_ERROR, 0);
+        break;
+    }
+}
+
+static AioContext *pci_leech_get_aio_context(PciLeechChannel *ch)
+{
+    return ch->iothread ? iothread_get_aio_context(ch->iothread) :
+                             qemu_get_aio_context();
+}
+
+#ifdef CONFIG_POSIX
+static uint32_t pci_leech_shm_run(PciLeechState *state,
+                                  LeechShmDescriptor *shared)
+{
+    const uint64_t data_size = state->shm_size - PCILEECH_SHM_DATA_OFFSET;
+    /* The client may still scribble on the slot; work on a snapshot. */
+    LeechShmDescriptor desc = *shared;
+    uint8_t *data = state->shm_ptr + PCILEECH_SHM_DATA_OFFSET + desc.data;
+    MemTxResult result;
+    int64_t start;
+
+    stat64_add(&state->stats.requests, 1);
+    if (desc.length > data_size || desc.data > data_size - desc.length) {
+        return LEECH_DEVICE_ERROR;
+    }
+    start = get_clock();
+    switch (desc.command) {
+    case PCILEECH_REQUEST_READ:
+        result = pci_leech_dma_read(state, desc.address, data,
+                                    desc.length);
+        stat64_add(&state->stats.read_bytes, desc.length);
+        break;
+    case PCILEECH_REQUEST_WRITE:
+        result = pci_leech_dma_write(state, desc.address, data,
+                                     desc.length);
+        stat64_add(&state->stats.write_bytes, desc.length);
+        pci_leech_event_write(state, desc.address, desc.length);
+        break;
+    default:
+        return LEECH_DEVICE_ERROR;
+    }
+    pci_leech_account_dma(state, result, start);
+    pci_leech_event_done(state);
+    return pci_leech_convert_result(result);
+}
+
+static void pci_leech_shm_kick(EventNotifier *n)
+{
+    PciLeechState *state = container_of(n, PciLeechState, shm_kick);
+    LeechShmHeader *header = (LeechShmHeader *)state->shm_ptr;
+    LeechShmDescriptor *ring = (LeechShmDescriptor *)
+                               (state->shm_ptr + PCILEECH_SHM_RING_OFFSET);
+    uint32_t submitted;
+    bool progress = false;
+
+    event_notifier_test_and_clear(n);
+    submitted = qatomic_load_acquire(&header->submitted);
+    while (state->shm_consumed != submitted) {
+        LeechShmDescriptor *desc =
+            &ring[state->shm_consumed % PCILEECH_SHM_RING_ENTRIES];
+        desc->result = pci_leech_shm_run(state, desc);
+        trace_pcileech_shm_descriptor(state, state->shm_consumed,
+                                      desc->command, desc->address,
+                                      desc->length, desc->result);
+        state->shm_consumed++;
+        qatomic_store_release(&header->completed, state->shm_consumed);
+        progress = true;
+        /* Pick up descriptors submitted in the meantime. */
+        submitted = qatomic_load_acquire(&header->submitted);
+    }
+    if (progress) {
+        event_notifier_set(&state->shm_done);
+    }
+}
+
+static void pci_leech_shm_connect(PciLeechState *state)
+{
+    LeechShmHeader *header = (LeechShmHeader *)state->shm_ptr;
+    struct LeechShmHello hello = {
+        .magic = LEECH_SHM_MAGIC,
+        .version = PCILEECH_PROTOCOL_VERSION,
+        .size = state->shm_size,
+    };
+    int fds[3] = {
+        state->shm_fd,
+        event_notifier_get_wfd(&state->shm_kick),
+        event_notifier_get_fd(&state->shm_done),
+    };
+
+    /* Start the new client with an empty ring. */
+    state->shm_consumed = 0;
+    qatomic_set(&header->submitted, 0);
+    qatomic_set(&header->completed, 0);
+    event_notifier_test_and_clear(&state->shm_kick);
+    event_notifier_test_and_clear(&state->shm_done);
+
+    if (qemu_chr_fe_set_msgfds(&state->chardev, fds, ARRAY_SIZE(fds)) < 0) {
+        error_report("pcileech: chardev cannot pass file descriptors, "
+                     "transport=shm needs a UNIX socket");
+        return;
+    }
+    qemu_chr_fe_write_all(&state->chardev, (uint8_t *)&hello, sizeof(hello));
+}
+
+static bool pci_leech_shm_init(PciLeechState *state, Error **errp)
+{
+    LeechShmHeader *header;
+
+    if (state->shm_size <= PCILEECH_SHM_DATA_OFFSET) {
+        error_setg(errp, "shm-size must be larger than %u bytes",
+                   (unsigned)PCILEECH_SHM_DATA_OFFSET);
+        return false;
+    }
+    state->shm_ptr = qemu_memfd_alloc("pcileech", state->shm_size,
+                                      F_SEAL_GROW | F_SEAL_SHRINK |
+                                      F_SEAL_SEAL, &state->shm_fd, errp);
+    if (!state->shm_ptr) {
+        return false;
+    }
+    if (event_notifier_init(&state->shm_kick, 0) < 0) {
+        goto fail_kick;
+    }
+    if (event_notifier_init(&state->shm_done, 0) < 0) {
+        goto fail_done;
+    }
+    header = (LeechShmHeader *)state->shm_ptr;
+    header->magic = LEECH_SHM_MAGIC;
+    header->version = PCILEECH_PROTOCOL_VERSION;
+    header->ring_entries = PCILEECH_SHM_RING_ENTRIES;
+    header->ring_offset = PCILEECH_SHM_RING_OFFSET;
+    header->data_offset = PCILEECH_SHM_DATA_OFFSET;
+    header->data_size = state->shm_size - PCILEECH_SHM_DATA_OFFSET;
+    aio_set_event_notifier(pci_leech_get_aio_context(&state->channels[0]),
+                           &state->shm_kick, pci_leech_shm_kick, NULL, NULL);
+    return true;
+
+fail_done:
+    event_notifier_cleanup(&state->shm_kick);
+fail_kick:
+    error_setg(errp, "failed to create event notifiers");
+    qemu_memfd_free(state->shm_ptr, state->shm_size, state->shm_fd);
+    state->shm_ptr = NULL;
+    return false;
+}
+
+/* Only valid while the channels, whose first AioContext we use, exist. */
+static void pci_leech_shm_cleanup(PciLeechState *state)
+{
+    if (!state->shm_ptr) {
+        return;
+    }
+    aio_set_event_notifier(pci_leech_get_aio_context(&state->channels[0]),
+                           &state->shm_kick, NULL, NULL, NULL);
+    event_notifier_cleanup(&state->shm_kick);
+    event_notifier_cleanup(&state->shm_done);
+    qemu_memfd_free(state->shm_ptr, state->shm_size, state->shm_fd);
+    state->shm_ptr = NULL;
+}
+#else
+static void pci_leech_shm_connect(PciLeechState *state)
+{
+}
+
+static bool pci_leech_shm_init(PciLeechState *state, Error **errp)
+{
+    error_setg(errp, "transport=shm is not supported on this host");
+    return false;
+}
+
+static void pci_leech_shm_cleanup(PciLeechState *state)
+{
+}
+#endif
+
+/* Whether the next input byte has to wait for queued reads. */
+static bool pci_leech_input_blocked(PciLeechChannel *ch)
+{
+    if (ch->deferred) {
+        /* A request is waiting for the queued reads. */
+        return true;
+    } else if (ch->write_pending && !ch->buffered &&
+               !pci_leech_throttle_check(ch, THROTTLE_WRITE)) {
+        /* The next write frame waits for the throttle timer. */
+        return true;
+    } else if (ch->write_pending || ch->scatter_pending ||
+               ch->write_scatter_pending || ch->search_pending ||
+               ch->virt_pending || ch->mbox_pending || ch->discard) {
+        /* Reads queued before a write must see the old data. */
+        return (ch->write_pending || ch->write_scatter_pending) &&
+               pci_leech_reads_pending(ch);
+    } else {
+        /* A new request needs room in the queue. */
+        return ch->queued >= ch->state->queue_depth;
+    }
+}
+
+static void pci_leech_decode_request(PciLeechChannel *ch)
+{
+    /* Flip byte-order to little-endian. */
+    ch->request.tag = le32_to_cpu(ch->request.tag);
+    ch->request.address = le64_to_cpu(ch->request.address);
+    ch->request.length = le64_to_cpu(ch->request.length);
+    ch->pos = 0;
+    if (!(ch->features & LEECH_FEATURE_OUT_OF_ORDER) &&
+        pci_leech_reads_pending(ch) &&
+        ch->request.command != PCILEECH_REQUEST_READ) {
+        /* Keep responses in order: wait for the queued reads. */
+        ch->deferred = true;
+        return;
+    }
+    pci_leech_dispatch_request(ch);
+}
+
+/* Consume the start of @buf. Returns the number of bytes used. */
+static size_t pci_leech_consume(PciLeechChannel *ch, const uint8_t *buf,
+                                size_t size)
+{
+    uint8_t *req_buff = (uint8_t *)&ch->request;
+    size_t len;
+    if (ch->write_pending) {
+        /* Complete pending write operation. */
+        len = MIN(size, pci_leech_write_frame_length(ch) - ch->buffered);
+        pci_leech_process_write_request(ch, buf, len);
+    } else if (ch->scatter_pending) {
+        len = MIN(size, ch->request.length *
+                        sizeof(struct LeechScatterEntry) - ch->buffered);
+        pci_leech_process_scatter_request(ch, buf, len);
+    } else if (ch->write_scatter_pending) {
+        len = MIN(size, ch->request.length - ch->buffered);
+        pci_leech_process_write_scatter_request(ch, buf, len);
+    } else if (ch->search_pending) {
+        len = MIN(size, sizeof(struct LeechSearchRequest) - ch->buffered);
+        pci_leech_process_search_request(ch, buf, len);
+    } else if (ch->virt_pending) {
+        len = MIN(size, sizeof(struct LeechVirtRequest) - ch->buffered);
+        pci_leech_process_virt_request(ch, buf, len);
+    } else if (ch->mbox_pending) {
+        len = MIN(size, ch->request.length - ch->buffered);
+        pci_leech_process_mbox_request(ch, buf, len);
+    } else if (ch->discard) {
+        len = MIN(size, ch->discard);
+        ch->discard -= len;
+    } else {
+        /* Copy request to internal state; it may arrive in pieces. */
+        len = MIN(size, sizeof(struct LeechRequestHeader) - ch->pos);
+        memcpy(&req_buff[ch->pos], buf, len);
+        ch->pos += len;
+        if (ch->pos == sizeof(struct LeechRequestHeader)) {
+            pci_leech_decode_request(ch);
+        }
+    }
+    return len;
+}
+
+/* Parse as many frames from @buf as possible. Returns the bytes used. */
+static size_t pci_leech_parse(PciLeechChannel *ch, const uint8_t *buf,
+                              size_t size)
+{
+    size_t used = 0;
+    while (used < size && !pci_leech_input_blocked(ch)) {
+        used += pci_leech_consume(ch, buf + used, size - used);
+    }
+    return used;
+}
+
+/* Resume parsing staged input after the device got unblocked. */
+static void pci_leech_drain_rx(PciLeechChannel *ch)
+{
+    size_t used = pci_leech_parse(ch, ch->rx, ch->rx_len);
+    memmove(ch->rx, ch->rx + used, ch->rx_len - used);
+    ch->rx_len -= used;
+}
+
+static void pci_leech_read_bh(void *opaque)
+{
+    PciLeechChannel *ch = opaque;
+    uint64_t sent = 0, frame;
+    while (sent < PCILEECH_BH_BUDGET && !QTAILQ_EMPTY(&ch->reads)) {
+        PciLeechRequest *req = QTAILQ_FIRST(&ch->reads);
+        const bool workers = pci_leech_use_workers(ch);
+        if (workers && !pci_leech_frame_ready(ch)) {
+            /* Continue when a worker completes or a buffer is free. */
+            break;
+        }
+        if (!pci_leech_throttle_check(ch, THROTTLE_READ)) {
+            /* Continue when the throttle timer fires. */
+            break;
+        }
+        if (!pci_leech_pace_read(ch, MIN(req->header.length - req->done,
+                                         ch->xfer_size))) {
+            /* Continue when the pacing timer fires. */
+            break;
+        }
+        frame = workers ? pci_leech_submit_read_frame(ch, req) :
+                          pci_leech_send_read_frame(ch, req);
+        pci_leech_throttle_account(ch, THROTTLE_READ, frame);
+        sent += frame;
+        QTAILQ_REMOVE(&ch->reads, req, next);
+        if (req->done < req->header.length) {
+            if (ch->features & LEECH_FEATURE_OUT_OF_ORDER) {
+                /* Interleave the frames of the queued reads per class. */
+                pci_leech_insert_read(ch, req);
+            } else {
+                QTAILQ_INSERT_HEAD(&ch->reads, req, next);
+            }
+            continue;
+        }
+        trace_pcileech_read_done(ch->state, req->header.tag);
+        pci_leech_event_done(ch->state);
+        g_free(req);
+        ch->queued--;
+    }
+    if (ch->deferred && !pci_leech_reads_pending(ch)) {
+        ch->deferred = false;
+        pci_leech_dispatch_request(ch);
+    }
+    /* Parse the input staged while the device was busy. */
+    pci_leech_drain_rx(ch);
+    qemu_chr_fe_accept_input(ch->chr);
+    if (!QTAILQ_EMPTY(&ch->reads) && !ch->pace_deadline && !ch->throttled &&
+        (!pci_leech_use_workers(ch) || pci_leech_frame_ready(ch))) {
+        /* Let the event loop, and thus new requests, run in between. */
+        replay_bh_schedule_event(ch->bh);
+    }
+}
+
+static void pci_leech_receive(void *opaque, const uint8_t *buf, int size)
+{
+    PciLeechChannel *ch = opaque;
+    size_t used = 0;
+    if (ch->rx_len) {
+        /* Keep the order: new input goes behind the staged input. */
+        memcpy(ch->rx + ch->rx_len, buf, size);
+        ch->rx_len += size;
+        pci_leech_drain_rx(ch);
+        return;
+    }
+    /* Fast path: parse straight from the chardev's buffer. */
+    used = pci_leech_parse(ch, buf, size);
+    /* Stage what is left; can_read made sure it fits. */
+    memcpy(ch->rx, buf + used, size - used);
+    ch->rx_len = size - used;
+}
+
+/* Recorded input, delivered at the same instruction in both modes. */
+static void pci_leech_rr_receive(void *opaque, const uint8_t *buf, int size)
+{
+    PciLeechChannel *ch = opaque;
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        ch->rr_pending -= size;
+    }
+    pci_leech_receive(ch, buf, size);
+}
+
+static void pci_leech_chardev_read_handler(void *opaque, const uint8_t *buf,
+                                           int size)
+{
+    PciLeechChannel *ch = opaque;
+    if (ch->rr) {
+        /* Count it first, the log may hand it back right away. */
+        ch->rr_pending += size;
+        replay_char_fe_read(ch->rr, buf, size);
+        return;
+    }
+    pci_leech_receive(ch, buf, size);
+}
+
+static int pci_leech_chardev_can_read_handler(void *opaque)
+{
+    PciLeechChannel *ch = opaque;
+    if (ch->state->shm && ch->index == 0) {
+        /* The chardev only hands out the shared memory. */
+        return 0;
+    }
+    if (replay_mode == REPLAY_MODE_PLAY) {
+        /* The input comes from the log. */
+        return 0;
+    }
+    return PCILEECH_RX_SIZE - ch->rx_len - ch->rr_pending;
+}
+
+/* Forget about the previous client and its outstanding requests. */
+static void pci_leech_reset(PciLeechChannel *ch)
+{
+    /* Whatever of the write frame arrived is in guest memory already. */
+    pci_leech_write_unmap(ch, ch->buffered);
+    /* The combined writes were acknowledged; they must not get lost. */
+    pci_leech_wc_flush(ch);
+    ch->wc_result = MEMTX_OK;
+    ch->write_pending = false;
+    ch->scatter_pending = false;
+    ch->write_scatter_pending = false;
+    ch->search_pending = false;
+    ch->virt_pending = false;
+    ch->mbox_pending = false;
+    ch->deferred = false;
+    ch->written_length = 0;
+    ch->discard = 0;
+    ch->rx_len = 0;
+    ch->buffered = 0;
+    ch->pos = 0;
+    ch->xfer_size = PCILEECH_BUFFER_SIZE;
+    ch->features = pci_leech_commands(ch->state);
+    if (ch->pace_timer) {
+        timer_del(ch->pace_timer);
+    }
+    ch->pace_deadline = 0;
+    ch->link_free = 0;
+    pci_leech_clear_read_requests(ch);
+    pci_leech_clear_frames(ch);
+}
+
+static void pci_leech_channel_event(PciLeechChannel *ch, QEMUChrEvent event)
+{
+    if (event == CHR_EVENT_CLOSED) {
+        pci_leech_release(ch);
+        if (ch->connected) {
+            ch->connected = false;
+            qatomic_dec(&ch->state->num_connected);
+        }
+        if (ch->index == 0) {
+            pci_leech_mbox_link(ch->state, false);
+        }
+        if (ch->client) {
+            replay_bh_schedule_event(ch->release_bh);
+        }
+    } else if (event == CHR_EVENT_OPENED) {
+        trace_pcileech_connected(ch->state, ch->index);
+        if (!ch->connected) {
+            ch->connected = true;
+            qatomic_inc(&ch->state->num_connected);
+        }
+        pci_leech_release(ch);
+        /* A new client starts with the legacy protocol parameters. */
+        pci_leech_reset(ch);
+        if (ch->state->shm && ch->index == 0) {
+            pci_leech_shm_connect(ch->state);
+        }
+        if (ch->index == 0) {
+            pci_leech_mbox_link(ch->state, true);
+        }
+    }
+}
+
+static void pci_leech_rr_event(void *opaque, int event)
+{
+    pci_leech_channel_event(opaque, event);
+}
+
+static void pci_leech_chardev_event(void *opaque, QEMUChrEvent event)
+{
+    PciLeechChannel *ch = opaque;
+    if (!ch->rr) {
+        pci_leech_channel_event(ch, event);
+    } else if (replay_mode == REPLAY_MODE_RECORD) {
+        replay_char_fe_event(ch->rr, event);
+    }
+    /* When replaying, the client's connection comes from the log too. */
+}
+
+static bool pci_leech_workers_init(PciLeechChannel *ch, Error **errp)
+{
+    QTAILQ_INIT(&ch->frames);
+    QTAILQ_INIT(&ch->idle);
+    ch->workers = g_new0(PciLeechFrame, ch->state->num_workers);
+    for (uint32_t i = 0; i < ch->state->num_workers; i++) {
+        PciLeechFrame *frame = &ch->workers[i];
+        frame->channel = ch;
+        if (!pci_leech_encoder_init(&frame->encoder, ch->state->zstd_level,
+                                    ch->state->chunk_size, errp)) {
+            return false;
+        }
+        QTAILQ_INSERT_TAIL(&ch->idle, frame, next);
+    }
+    return true;
+}
+
+static void pci_leech_workers_cleanup(PciLeechChannel *ch)
+{
+    if (!ch->workers) {
+        return;
+    }
+    for (uint32_t i = 0; i < ch->state->num_workers; i++) {
+        pci_leech_encoder_cleanup(&ch->workers[i].encoder);
+        g_free(ch->workers[i].buffer);
+    }
+    g_free(ch->workers);
+}
+
+static void pci_leech_detach_bh(void *opaque)
+{
+    PciLeechChannel *ch = opaque;
+    qemu_chr_fe_set_handlers(ch->chr, NULL, NULL, NULL, NULL,
+                            NULL, NULL, true);
+    qemu_bh_cancel(ch->bh);
+    qemu_bh_cancel(ch->watch_bh);
+    if (ch->state->mbox_bh && ch->index == 0) {
+        qemu_bh_cancel(ch->state->mbox_bh);
+    }
+    if (ch->state->shm && ch->index == 0) {
+        aio_set_event_notifier(pci_leech_get_aio_context(ch),
+                               &ch->state->shm_kick, NULL, NULL, NULL);
+    }
+    /* Leave nothing for frames that are still being encoded to resume. */
+    pci_leech_reset(ch);
+}
+
+/*
+ * The client on the listen socket left: once no handler or worker uses
+ * the channel any more, drop its chardev so that the slot takes the next
+ * connection.
+ */
+static void pci_leech_client_release(void *opaque)
+{
+    PciLeechChannel *ch = opaque;
+    if (ch->iothread) {
+        aio_wait_bh_oneshot(pci_leech_get_aio_context(ch),
+                            pci_leech_detach_bh, ch);
+    } else {
+        pci_leech_detach_bh(ch);
+    }
+    AIO_WAIT_WHILE(pci_leech_get_aio_context(ch),
+                   qatomic_read(&ch->encoding) > 0);
+    trace_pcileech_client_release(ch->state, ch->index);
+    qemu_chr_fe_deinit(&ch->backend, true);
+}
+
+/* Resolves the chardev and IOThread of channel @index and sets it up. */
+static bool pci_leech_channel_init(PciLeechState *state, uint32_t index,
+                                   Error **errp)
+{
+    PciLeechChannel *ch = &state->channels[index];
+    ch->state = state;
+    ch->index = index;
+    ch->iothread = state->iothread;
+    if (index == 0) {
+        ch->chr = &state->chardev;
+    } else if (index >= state->first_client) {
+        /* The chardev comes with the connection, see pci_leech_accept(). */
+        ch->client = true;
+        ch->chr = &ch->backend;
+        ch->release_bh = qemu_bh_new(pci_leech_client_release, ch);
+    } else {
+        const char *id = state->channel_ids[index - 1];
+        Chardev *chr = qemu_chr_find(id);
+        if (!chr) {
+            error_setg(errp, "channel chardev '%s' not found", id);
+            return false;
+        }
+        if (!qemu_chr_fe_init(&ch->backend, chr, errp)) {
+            return false;
+        }
+        ch->chr = &ch->backend;
+    }
+    if (index && index <= state->num_channel_iothreads) {
+        const char *id = state->channel_iothreads[index - 1];
+        ch->iothread = iothread_by_id(id);
+        if (!ch->iothread) {
+            error_setg(errp, "channel iothread '%s' not found", id);
+            return false;
+        }
+    }
+    if (!ch->iothread) {
+        /* Fall back to the iothread option of the chardev itself. */
+        ch->iothread = qemu_chr_fe_get_iothread(ch->chr);
+    }
+    if (ch->iothread) {
+        if (replay_mode != REPLAY_MODE_NONE) {
+            error_setg(errp, "record/replay does not support iothreads");
+            return false;
+        }
+        object_ref(OBJECT(ch->iothread));
+    }
+    if (!pci_leech_encoder_init(&ch->encoder, state->zstd_level,
+                                state->chunk_size, errp) ||
+        !pci_leech_workers_init(ch, errp)) {
+        return false;
+    }
+    ch->buffer = g_malloc(state->chunk_size);
+    ch->rx = g_malloc(PCILEECH_RX_SIZE);
+    ch->wc_buffer = g_malloc(PCILEECH_WC_SIZE);
+    ch->xfer_size = PCILEECH_BUFFER_SIZE;
+    ch->features = pci_leech_commands(ch->state);
+    QTAILQ_INIT(&ch->reads);
+    ch->cache = g_new0(PciLeechCache, 1);
+    ch->bh = aio_bh_new_guarded(pci_leech_get_aio_context(ch),
+                                pci_leech_read_bh, ch,
+                                &DEVICE(state)->mem_reentrancy_guard);
+    ch->watch_bh = aio_bh_new(pci_leech_get_aio_context(ch),
+                              pci_leech_watch_bh, ch);
+    ch->wc_timer = aio_timer_new(pci_leech_get_aio_context(ch),
+                                 pci_leech_wc_clock(), SCALE_NS,
+                                 pci_leech_wc_timer, ch);
+    throttle_timers_init(&ch->throttle_timers, pci_leech_get_aio_context(ch),
+                         state->throttle_clock, pci_leech_pace_timer,
+                         pci_leech_pace_timer, ch);
+    if (state->tlp_pacing) {
+        ch->pace_timer = aio_timer_new(pci_leech_get_aio_context(ch),
+                                       QEMU_CLOCK_VIRTUAL, SCALE_NS,
+                                       pci_leech_pace_timer, ch);
+    }
+    return true;
+}
+
+static void pci_leech_channel_start(PciLeechChannel *ch)
+{
+    GMainContext *context = NULL;
+    /* Service the chardev, and thus the DMA, in the IOThread if given. */
+    if (ch->iothread) {
+        context = iothread_get_g_main_context(ch->iothread);
+    }
+    /*
+     * Under record/replay, the client's input and connection events go
+     * through the log, so that its DMA hits the guest at the same
+     * instruction.  What the device sends back is not logged; replay
+     * does not need a client.
+     */
+    if (replay_mode != REPLAY_MODE_NONE) {
+        ch->rr = replay_register_char_fe(pci_leech_rr_receive,
+                                         pci_leech_rr_event, ch);
+    }
+    qemu_chr_fe_set_handlers(ch->chr,
+                            pci_leech_chardev_can_read_handler,
+                            pci_leech_chardev_read_handler,
+                            pci_leech_chardev_event, NULL, ch, context,
+                            true);
+}
+
+/* Undoes pci_leech_channel_init(), which may have failed half-way. */
+static void pci_leech_channel_cleanup(PciLeechChannel *ch)
+{
+    if (ch->chr) {
+        qemu_chr_fe_deinit(ch->chr, ch->client);
+    }
+    if (ch->release_bh) {
+        qemu_bh_delete(ch->release_bh);
+    }
+    if (ch->rr) {
+        replay_unregister_char_fe(ch->rr);
+    }
+    if (ch->bh) {
+        qemu_bh_delete(ch->bh);
+    }
+    if (ch->watch_bh) {
+        qemu_bh_delete(ch->watch_bh);
+    }
+    if (ch->pace_timer) {
+        timer_free(ch->pace_timer);
+    }
+    throttle_timers_destroy(&ch->throttle_timers);
+    if (ch->wc_timer) {
+        timer_free(ch->wc_timer);
+    }
+    pci_leech_clear_read_requests(ch);
+    if (ch->iothread) {
+        object_unref(OBJECT(ch->iothread));
+    }
+    pci_leech_workers_cleanup(ch);
+    pci_leech_encoder_cleanup(&ch->encoder);
+    if (ch->cache) {
+        pci_leech_cache_free(ch->cache);
+    }
+    g_free(ch->buffer);
+    g_free(ch->rx);
+    g_free(ch->wc_buffer);
+}
+
+/* Hands a connection taken on the listen socket to the free channel @ch. */
+static bool pci_leech_client_attach(PciLeechChannel *ch,
+                                    QIOChannelSocket *sioc, Error **errp)
+{
+    Object *obj = OBJECT(ch->state);
+    g_autofree char *id = NULL;
+    ChardevBackend *backend;
+    ChardevSocket *sock;
+    Chardev *chr;
+    int fd;
+
+    fd = qemu_dup(sioc->fd);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "failed to duplicate the socket");
+        return false;
+    }
+    sock = g_new0(ChardevSocket, 1);
+    sock->addr = g_new0(SocketAddressLegacy, 1);
+    sock->addr->type = SOCKET_ADDRESS_TYPE_FD;
+    sock->addr->u.fd.data = g_new0(FdSocketAddress, 1);
+    sock->addr->u.fd.data->str = g_strdup_printf("%d", fd);
+    sock->has_server = true;
+    sock->server = false;
+    backend = g_new0(ChardevBackend, 1);
+    backend->type = CHARDEV_BACKEND_KIND_SOCKET;
+    backend->u.socket.data = sock;
+
+    id = g_strdup_printf("%s.client%u", DEVICE(obj)->id ?:
+                         object_get_canonical_path_component(obj),
+                         ch->index);
+    chr = qemu_chardev_new(id, TYPE_CHARDEV_SOCKET, backend, NULL, errp);
+    qapi_free_ChardevBackend(backend);
+    if (!chr) {
+        return false;
+    }
+    if (!qemu_chr_fe_init(&ch->backend, chr, errp)) {
+        object_unparent(OBJECT(chr));
+        return false;
+    }
+    pci_leech_channel_start(ch);
+    return true;
+}
+
+static void pci_leech_accept(QIONetListener *listener,
+                             QIOChannelSocket *sioc, gpointer opaque)
+{
+    PciLeechState *state = opaque;
+    Error *err = NULL;
+
+    for (uint32_t i = state->first_client; i < state->num_channels; i++) {
+        PciLeechChannel *ch = &state->channels[i];
+        if (qemu_chr_fe_backend_connected(ch->chr)) {
+            continue;
+        }
+        trace_pcileech_client_accept(state, i);
+        if (!pci_leech_client_attach(ch, sioc, &err)) {
+            warn_reportf_err(err, "pcileech: dropping client: ");
+        }
+        return;
+    }
+    /* All slots are taken: closing the socket tells the client. */
+    trace_pcileech_client_reject(state);
+}
+
+/* Sets up the listen socket, which takes up to max-clients connections. */
+static bool pci_leech_listen_init(PciLeechState *state, Error **errp)
+{
+    g_autoptr(SocketAddress) addr = socket_parse(state->listen, errp);
+
+    if (!addr) {
+        return false;
+    }
+    state->listener = qio_net_listener_new();
+    qio_net_listener_set_name(state->listener, "pcileech-listener");
+    if (qio_net_listener_open_sync(state->listener, addr, state->max_clients,
+                                   errp) < 0) {
+        object_unref(OBJECT(state->listener));
+        state->listener = NULL;
+        return false;
+    }
+    qio_net_listener_set_client_func(state->listener, pci_leech_accept,
+                                     state, NULL);
+    return true;
+}
+
+static void pci_leech_listen_cleanup(PciLeechState *state)
+{
+    if (state->listener) {
+        qio_net_listener_disconnect(state->listener);
+        object_unref(OBJECT(state->listener));
+        state->listener = NULL;
+    }
+}
+
+/*
+ * Add BAR 0 and the interrupt: MSI-X in BAR 1 with msix-vectors, else
+ * MSI if the machine supports it, else INTx.
+ */
+static bool pci_leech_mbox_init(PciLeechState *state, Error **errp)
+{
+    PCIDevice *pdev = &state->device;
+    Error *err = NULL;
+    int ret;
+    pci_config_set_interrupt_pin(pdev->config, 1);
+    if (state->msix_vectors) {
+        if (msix_init_exclusive_bar(pdev, state->msix_vectors, 1, errp)) {
+            return false;
+        }
+        /* Events map to vectors statically; use them all. */
+        for (uint32_t v = 0; v < state->msix_vectors; v++) {
+            msix_vector_use(pdev, v);
+        }
+    } else {
+        ret = msi_init(pdev, 0, 1, true, false, &err);
+        if (ret == -ENOTSUP) {
+            error_free(err);
+        } else if (ret) {
+            error_propagate(errp, err);
+            return false;
+        }
+    }
+    memory_region_init_io(&state->mbox_mmio, OBJECT(state),
+                          &pci_leech_mbox_ops, state, "pcileech-mailbox",
+                          PCILEECH_MBOX_BAR_SIZE);
+    pci_register_bar(pdev, 0, PCI_BASE_ADDRESS_SPACE_MEMORY,
+                     &state->mbox_mmio);
+    state->mbox_irq_bh = qemu_bh_new(pci_leech_mbox_irq_bh, state);
+    state->event_timer = timer_new_ns(QEMU_CLOCK_VIRTUAL,
+                                      pci_leech_event_timer, state);
+    state->mbox_bh = aio_bh_new_guarded(
+        pci_leech_get_aio_context(&state->channels[0]), pci_leech_mbox_bh,
+        &state->channels[0], &DEVICE(state)->mem_reentrancy_guard);
+    return true;
+}
+
+static void pci_leech_mbox_cleanup(PciLeechState *state)
+{
+    if (!state->mailbox && !state->events) {
+        return;
+    }
+    g_clear_pointer(&state->mbox_bh, qemu_bh_delete);
+    g_clear_pointer(&state->mbox_irq_bh, qemu_bh_delete);
+    g_clear_pointer(&state->event_timer, timer_free);
+    if (state->msix_vectors) {
+        msix_uninit_exclusive_bar(&state->device);
+    } else {
+        msi_uninit(&state->device);
+    }
+}
+
+/* Stop the rings; the guest driver sets them up again. */
+static void pci_leech_mbox_reset(PciLeechState *state)
+{
+    QEMU_LOCK_GUARD(&state->mbox_lock);
+    state->mbox_tx = (PciLeechRing) {
+        .generation = state->mbox_tx.generation + 1,
+    };
+    state->mbox_rx = (PciLeechRing) {
+        .generation = state->mbox_rx.generation + 1,
+    };
+    state->mbox_irq_status = 0;
+    state->mbox_irq_mask = 0;
+    state->done_count = 0;
+    state->watch_count = 0;
+    state->watch_base = 0;
+    state->watch_size = 0;
+    state->watch_hit = 0;
+    state->coalesce_count = 0;
+    state->coalesce_time = 0;
+    state->event_irqs = 0;
+    state->event_batch = 0;
+    if (state->event_timer) {
+        timer_del(state->event_timer);
+    }
+}
+
+static void pci_leech_device_reset(DeviceState *dev)
+{
+    pci_leech_mbox_reset(PCILEECH(dev));
+}
+
+/* Restore the Device and Link Control defaults of the PCIe variant. */
+static void pci_leech_pcie_reset(DeviceState *dev)
+{
+    PCIDevice *pdev = PCI_DEVICE(dev);
+    uint8_t *exp_cap = pdev->config + pdev->exp.exp_cap;
+    pcie_cap_deverr_reset(pdev);
+    pci_word_test_and_clear_mask(exp_cap + PCI_EXP_DEVCTL,
+                                 PCI_EXP_DEVCTL_PAYLOAD |
+                                 PCI_EXP_DEVCTL_READRQ |
+                                 PCI_EXP_DEVCTL_EXT_TAG);
+    pci_word_test_and_set_mask(exp_cap + PCI_EXP_DEVCTL,
+                               PCI_EXP_DEVCTL_RELAX_EN |
+                               PCI_EXP_DEVCTL_NOSNOOP_EN |
+                               PCI_EXP_DEVCTL_READRQ_512B);
+    pci_word_test_and_clear_mask(exp_cap + PCI_EXP_LNKCTL,
+                                 PCI_EXP_LNKCTL_ASPMC);
+    if (pdev->exp.ats_cap) {
+        pci_set_word(pdev->config + pdev->exp.ats_cap + PCI_ATS_CTRL, 0);
+        pci_leech_atc_invalidate(PCILEECH(dev), 0, HWADDR_MAX);
+    }
+    if (pdev->exp.pasid_cap) {
+        pci_set_word(pdev->config + pdev->exp.pasid_cap + PCI_PASID_CTRL, 0);
+    }
+    pci_leech_device_reset(dev);
+}
+
+/*
+ * Add an Express capability that advertises the configured link and
+ * payload size, and lets the guest program MPS, MRRS, extended tags,
+ * the TLP attributes and ASPM.
+ */
+static bool pci_leech_pcie_init(PciLeechState *state, Error **errp)
+{
+    PCIDevice *pdev = &state->device;
+    uint8_t *exp_cap, *wmask;
+    int pos;
+    if (!pci_bus_is_express(pci_get_bus(pdev))) {
+        error_setg(errp, "%s must be plugged into a PCI Express bus",
+                   TYPE_PCILEECH_PCIE_DEVICE);
+        return false;
+    }
+    pos = pcie_endpoint_cap_init(pdev, 0);
+    if (pos < 0) {
+        error_setg(errp, "failed to add the PCI Express capability");
+        return false;
+    }
+    exp_cap = pdev->config + pos;
+    wmask = pdev->wmask + pos;
+    pcie_cap_fill_link_ep_usp(pdev, state->link_width, state->link_speed);
+    pcie_cap_deverr_init(pdev);
+    pci_long_test_and_set_mask(exp_cap + PCI_EXP_DEVCAP,
+                               (ctz32(state->mps) - 7) &
+                               PCI_EXP_DEVCAP_PAYLOAD);
+    if (state->tags > PCILEECH_SHORT_TAGS) {
+        pci_long_test_and_set_mask(exp_cap + PCI_EXP_DEVCAP,
+                                   PCI_EXP_DEVCAP_EXT_TAG);
+    }
+    pci_long_test_and_set_mask(exp_cap + PCI_EXP_LNKCAP,
+                               PCI_EXP_LNKCAP_ASPMS);
+    pci_word_test_and_set_mask(wmask + PCI_EXP_DEVCTL,
+                               PCI_EXP_DEVCTL_RELAX_EN |
+                               PCI_EXP_DEVCTL_PAYLOAD |
+                               PCI_EXP_DEVCTL_EXT_TAG |
+                               PCI_EXP_DEVCTL_NOSNOOP_EN |
+                               PCI_EXP_DEVCTL_READRQ);
+    pci_word_test_and_set_mask(wmask + PCI_EXP_LNKCTL, PCI_EXP_LNKCTL_ASPMC);
+    if (state->ats) {
+        pcie_ats_init(pdev, PCILEECH_ATS_OFFSET, true);
+    }
+    if (state->pasid) {
+        pcie_pasid_init(pdev, PCILEECH_ATS_OFFSET +
+                        (state->ats ? PCI_EXT_CAP_ATS_SIZEOF : 0),
+                        PCILEECH_PASID_WIDTH);
+    }
+    pci_leech_pcie_reset(DEVICE(state));
+    return true;
+}
+
+/*
+ * Behind an IOMMU, keep the ATC coherent with it. The IOMMU must send
+ * device-IOTLB invalidations, e.g. intel-iommu with device-iotlb=on.
+ */
+static bool pci_leech_atc_init(PciLeechState *state, Error **errp)
+{
+    iommu_notifier_init(&state->atc_notifier, pci_leech_atc_notify,
+                        IOMMU_NOTIFIER_DEVIOTLB_UNMAP, 0, HWADDR_MAX, 0);
+    if (pci_iommu_register_iotlb_notifier(&state->device,
+                                          &state->atc_notifier, errp)) {
+        error_prepend(errp, "ats=on needs device-IOTLB invalidations: ");
+        return false;
+    }
+    state->atc_registered = true;
+    return true;
+}
+
+static void pci_leech_atc_cleanup(PciLeechState *state)
+{
+    if (state->atc_registered) {
+        pci_iommu_unregister_iotlb_notifier(&state->device,
+                                            &state->atc_notifier);
+        state->atc_registered = false;
+    }
+}
+
+/* Called once the frames gave their buffers back, or freed them. */
+static void pci_leech_bounce_cleanup(PciLeechState *state)
+{
+    for (uint32_t i = 0; i < state->bounce_num_free; i++) {
+        g_free(state->bounce_free[i]);
+    }
+    g_free(state->bounce_free);
+    state->bounce_free = NULL;
+    state->bounce_num_free = 0;
+    qemu_mutex_destroy(&state->bounce_lock);
+}
+
+/* Start the workers of every host node that lists a thread context. */
+static bool pci_leech_nodes_init(PciLeechState *state, Error **errp)
+{
+    const char *dev_id = DEVICE(state)->id ?: "pcileech";
+    state->nodes = g_new0(PciLeechNode, state->num_node_contexts);
+    for (uint32_t i = 0; i < state->num_node_contexts; i++) {
+        PciLeechNode *n = &state->nodes[i];
+        const char *id = state->node_contexts[i];
+        Object *obj;
+        n->bounce_free = g_new(uint8_t *, state->bounce_limit);
+        if (!*id) {
+            continue;
+        }
+        obj = object_resolve_path_component(object_get_objects_root(), id);
+        if (!object_dynamic_cast(obj, TYPE_THREAD_CONTEXT)) {
+            error_setg(errp, "thread context '%s' not found", id);
+            return false;
+        }
+        n->tc = THREAD_CONTEXT(object_ref(obj));
+        qemu_mutex_init(&n->lock);
+        qemu_cond_init(&n->cond);
+        QSIMPLEQ_INIT(&n->queue);
+        n->threads = g_new0(QemuThread, state->node_threads);
+        for (; n->num_threads < state->node_threads; n->num_threads++) {
+            g_autofree char *name = g_strdup_printf("%s-node%u.%u", dev_id,
+                                                    i, n->num_threads);
+            thread_context_create_thread(n->tc, &n->threads[n->num_threads],
+                                         name, pci_leech_node_thread, n,
+                                         QEMU_THREAD_JOINABLE);
+        }
+    }
+    return true;
+}
+
+/* Called once no frame is in flight and the bounce pool is gone. */
+static void pci_leech_nodes_cleanup(PciLeechState *state)
+{
+    if (!state->nodes) {
+        return;
+    }
+    for (uint32_t i = 0; i < state->num_node_contexts; i++) {
+        PciLeechNode *n = &state->nodes[i];
+        for (uint32_t j = 0; j < n->bounce_num_free; j++) {
+            g_free(n->bounce_free[j]);
+        }
+        g_free(n->bounce_free);
+        if (!n->tc) {
+            continue;
+        }
+        WITH_QEMU_LOCK_GUARD(&n->lock) {
+            n->stop = true;
+            qemu_cond_broadcast(&n->cond);
+        }
+        for (uint32_t j = 0; j < n->num_threads; j++) {
+            qemu_thread_join(&n->threads[j]);
+        }
+        g_free(n->threads);
+        qemu_cond_destroy(&n->cond);
+        qemu_mutex_destroy(&n->lock);
+        object_unref(OBJECT(n->tc));
+    }
+    g_clear_pointer(&state->nodes, g_free);
+}
+
+/*
+ * Whether DMA through @mr can be translated by an IOMMU. The device's
+ * address space is not always the system one without an IOMMU: in a
+ * vfio-user server (x-remote machine) it is a container that the client's
+ * DMA regions, mapped from its shared memory, are added to. Those are
+ * plain RAM and can take the direct paths.
+ */
+static bool pci_leech_mr_translates(MemoryRegion *mr)
+{
+    MemoryRegion *sub;
+
+    if (memory_region_get_iommu(mr)) {
+        return true;
+    }
+    if (mr->alias) {
+        return pci_leech_mr_translates(mr->alias);
+    }
+    QTAILQ_FOREACH(sub, &mr->subregions, subregions_link) {
+        if (pci_leech_mr_translates(sub)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static void pci_leech_realize(PCIDevice *pdev, Error **errp)
+{
+    PciLeechState *state = PCILEECH(pdev);
+    if (state->chunk_size < PCILEECH_BUFFER_SIZE ||
+        state->chunk_size > PCILEECH_MAX_CHUNK_SIZE) {
+        error_setg(errp, "chunk-size must be between %u and %u bytes",
+                   PCILEECH_BUFFER_SIZE, (unsigned)PCILEECH_MAX_CHUNK_SIZE);
+        return;
+    }
+    if (state->queue_depth < 1 ||
+        state->queue_depth > PCILEECH_MAX_QUEUE_DEPTH) {
+        error_setg(errp, "queue-depth must be between 1 and %u",
+                   PCILEECH_MAX_QUEUE_DEPTH);
+        return;
+    }
+    if (state->transport && !strcmp(state->transport, "shm")) {
+        state->shm = true;
+    } else if (state->transport && strcmp(state->transport, "chardev")) {
+        error_setg(errp, "transport must be 'chardev' or 'shm'");
+        return;
+    }
+    if (state->zstd_level < 1 ||
+        state->zstd_level > PCILEECH_MAX_ZSTD_LEVEL) {
+        error_setg(errp, "zstd-level must be between 1 and %u",
+                   PCILEECH_MAX_ZSTD_LEVEL);
+        return;
+    }
+    if (state->compress_threads > PCILEECH_MAX_COMPRESS_THREADS) {
+        error_setg(errp, "compress-threads must be at most %u",
+                   PCILEECH_MAX_COMPRESS_THREADS);
+        return;
+    }
+    if (state->dma_threads > PCILEECH_MAX_DMA_THREADS) {
+        error_setg(errp, "dma-threads must be at most %u",
+                   PCILEECH_MAX_DMA_THREADS);
+        return;
+    }
+    if (state->num_node_contexts > MAX_NODES) {
+        error_setg(errp, "node-contexts can list at most %u nodes",
+                   MAX_NODES);
+        return;
+    }
+    if (state->node_threads < 1 ||
+        state->node_threads > PCILEECH_MAX_DMA_THREADS) {
+        error_setg(errp, "node-threads must be between 1 and %u",
+                   PCILEECH_MAX_DMA_THREADS);
+        return;
+    }
+    /* Encoding and DMA share the frames handed to the thread pool. */
+    state->num_workers = MAX(state->compress_threads, state->dma_threads);
+    if (state->num_node_contexts) {
+        /* Enough frames to keep the workers of every node busy. */
+        state->num_workers = MAX(state->num_workers, state->node_threads *
+                                                     state->num_node_contexts);
+    }
+    if (replay_mode != REPLAY_MODE_NONE && (state->shm || state->num_workers)) {
+        error_setg(errp, "record/replay does not support transport=shm, "
+                   "compress-threads, dma-threads or node-contexts");
+        return;
+    }
+    if (state->num_channel_ids >= PCILEECH_MAX_CHANNELS) {
+        error_setg(errp, "channels can list at most %u chardevs",
+                   PCILEECH_MAX_CHANNELS - 1);
+        return;
+    }
+    if (state->replay_map && !state->replay) {
+        error_setg(errp, "replay-map requires replay");
+        return;
+    }
+    if (state->listen) {
+        if (replay_mode != REPLAY_MODE_NONE) {
+            error_setg(errp, "record/replay does not support listen");
+            return;
+        }
+        if (state->max_clients < 1 ||
+            state->max_clients >= PCILEECH_MAX_CHANNELS -
+                                  state->num_channel_ids) {
+            error_setg(errp, "max-clients must be between 1 and %u",
+                       PCILEECH_MAX_CHANNELS - 1 - state->num_channel_ids);
+            return;
+        }
+    }
+    state->first_client = 1 + state->num_channel_ids;
+    state->num_channels = state->first_client +
+                          (state->listen ? state->max_clients : 0);
+    if (state->num_channel_iothreads >= state->num_channels) {
+        error_setg(errp, "channel-iothreads has more entries than channels");
+        return;
+    }
+    if (!is_power_of_2(state->mps) || state->mps < PCILEECH_MIN_TLP_SIZE ||
+        state->mps > PCILEECH_MAX_TLP_SIZE) {
+        error_setg(errp, "max-payload-size must be a power of two between "
+                   "%u and %u bytes", PCILEECH_MIN_TLP_SIZE,
+                   PCILEECH_MAX_TLP_SIZE);
+        return;
+    }
+    if (!is_power_of_2(state->mrrs) || state->mrrs < PCILEECH_MIN_TLP_SIZE ||
+        state->mrrs > PCILEECH_MAX_TLP_SIZE) {
+        error_setg(errp, "max-read-request-size must be a power of two "
+                   "between %u and %u bytes", PCILEECH_MIN_TLP_SIZE,
+                   PCILEECH_MAX_TLP_SIZE);
+        return;
+    }
+    if (state->read_ahead &&
+        (state->read_ahead < PCILEECH_MIN_READ_AHEAD ||
+         state->read_ahead > PCILEECH_MAX_READ_AHEAD)) {
+        error_setg(errp, "read-ahead must be 0 or between %u and %u bytes",
+                   (unsigned)PCILEECH_MIN_READ_AHEAD,
+                   (unsigned)PCILEECH_MAX_READ_AHEAD);
+        return;
+    }
+    if (state->tags < 1 || state->tags > PCILEECH_MAX_TAGS) {
+        error_setg(errp, "tags must be between 1 and %u", PCILEECH_MAX_TAGS);
+        return;
+    }
+    if (state->msix_vectors > PCILEECH_MAX_VECTORS) {
+        error_setg(errp, "msix-vectors must be at most %u",
+                   PCILEECH_MAX_VECTORS);
+        return;
+    }
+    if (state->msix_vectors && !state->mailbox && !state->events) {
+        error_setg(errp, "msix-vectors needs mailbox=on or events=on");
+        return;
+    }
+    if (state->ats && !pci_is_express(pdev)) {
+        error_setg(errp, "ats=on needs the %s device",
+                   TYPE_PCILEECH_PCIE_DEVICE);
+        return;
+    }
+    if (state->pasid && !pci_is_express(pdev)) {
+        error_setg(errp, "pasid=on needs the %s device",
+                   TYPE_PCILEECH_PCIE_DEVICE);
+        return;
+    }
+    if (pci_is_express(pdev) && !pci_leech_pcie_init(state, errp)) {
+        return;
+    }
+    /* By default, every frame of every channel can bounce at once. */
+    state->bounce_limit = state->bounce_buffers ?:
+                          state->num_workers * state->num_channels;
+    qemu_mutex_init(&state->bounce_lock);
+    qemu_mutex_init(&state->ra_lock);
+    state->bounce_free = g_new(uint8_t *, state->bounce_limit);
+    state->channels = g_new0(PciLeechChannel, state->num_channels);
+    if (state->num_node_contexts && !pci_leech_nodes_init(state, errp)) {
+        goto fail;
+    }
+    for (uint32_t i = 0; i < state->num_channels; i++) {
+        if (!pci_leech_channel_init(state, i, errp)) {
+            goto fail;
+        }
+    }
+    if (state->replay && !pci_leech_replay_init(state, errp)) {
+        goto fail;
+    }
+    if (state->shm && !pci_leech_shm_init(state, errp)) {
+        goto fail;
+    }
+    if ((state->mailbox || state->events) &&
+        !pci_leech_mbox_init(state, errp)) {
+        goto fail;
+    }
+    if (state->listen && !pci_leech_listen_init(state, errp)) {
+        goto fail;
+    }
+    state->iommu = pci_leech_mr_translates(
+        pci_device_iommu_address_space(pdev)->root);
+    if (state->ats && state->iommu && !pci_leech_atc_init(state, errp)) {
+        goto fail;
+    }
+    state->cache_listener = (MemoryListener) {
+        .name = "pcileech-cache",
+        .region_add = pci_leech_cache_region_changed,
+        .region_del = pci_leech_cache_region_changed,
+        .commit = pci_leech_cache_commit,
+    };
+    if (!state->replay_file) {
+        memory_listener_register(&state->cache_listener,
+                                 pci_get_address_space(pdev));
+    }
+    for (uint32_t i = 0; i < state->first_client; i++) {
+        pci_leech_channel_start(&state->channels[i]);
+    }
+    return;
+
+fail:
+    /* Undo the setup in reverse; the pools go last, as in exit. */
+    pci_leech_atc_cleanup(state);
+    pci_leech_listen_cleanup(state);
+    pci_leech_mbox_cleanup(state);
+    pci_leech_shm_cleanup(state);
+    pci_leech_replay_cleanup(state);
+    for (uint32_t i = 0; i < state->num_channels; i++) {
+        pci_leech_channel_cleanup(&state->channels[i]);
+    }
+    g_free(state->channels);
+    state->channels = NULL;
+    state->num_channels = 0;
+    pci_leech_bounce_cleanup(state);
+    pci_leech_nodes_cleanup(state);
+    pci_leech_read_ahead_cleanup(state);
+    if (pci_is_express(pdev)) {
+        pcie_cap_exit(pdev);
+    }
+}
+
+static void pci_leech_exit(PCIDevice *pdev)
+{
+    PciLeechState *state = PCILEECH(pdev);
+    pci_leech_listen_cleanup(state);
+    for (uint32_t i = 0; i < state->num_channels; i++) {
+        PciLeechChannel *ch = &state->channels[i];
+        if (ch->iothread) {
+            /* Make sure no handler is running before the state goes away. */
+            aio_wait_bh_oneshot(pci_leech_get_aio_context(ch),
+                                pci_leech_detach_bh, ch);
+        } else {
+            pci_leech_detach_bh(ch);
+        }
+    }
+    for (uint32_t i = 0; i < state->num_channels; i++) {
+        PciLeechChannel *ch = &state->channels[i];
+        AIO_WAIT_WHILE(pci_leech_get_aio_context(ch),
+                       qatomic_read(&ch->encoding) > 0);
+    }
+    pci_leech_dirty_log_stop(state);
+    g_clear_pointer(&state->watch_timer, timer_free);
+    pci_leech_snapshot_release(state);
+    memory_listener_unregister(&state->cache_listener);
+    pci_leech_atc_cleanup(state);
+    pci_leech_replay_cleanup(state);
+    if (state->shm) {
+        pci_leech_shm_cleanup(state);
+    }
+    pci_leech_mbox_cleanup(state);
+    for (uint32_t i = 0; i < state->num_channels; i++) {
+        pci_leech_channel_cleanup(&state->channels[i]);
+    }
+    g_free(state->channels);
+    pci_leech_bounce_cleanup(state);
+    pci_leech_nodes_cleanup(state);
+    pci_leech_read_ahead_cleanup(state);
+    if (pci_is_express(pdev)) {
+        pcie_cap_exit(pdev);
+    }
+}
+
+typedef struct PciLeechStatsArgs {
+    StatsResultList **result;
+    strList *names;
+} PciLeechStatsArgs;
+
+static StatsList *pci_leech_stats_add(StatsList *list, strList *names,
+                                      const char *name, const Stat64 *val)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = stat64_get(val);
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static StatsList *pci_leech_stats_add_histogram(StatsList *list,
+                                                strList *names,
+                                                const char *name,
+                                                const Stat64 *buckets)
+{
+    uint64List *values = NULL;
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    for (int i = PCILEECH_STATS_BUCKETS - 1; i >= 0; i--) {
+        QAPI_LIST_PREPEND(values, stat64_get(&buckets[i]));
+    }
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QLIST;
+    stats->value->u.list = values;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static int pci_leech_stats_query(Object *obj, void *opaque)
+{
+    PciLeechStatsArgs *args = opaque;
+    PciLeechStats *stats;
+    StatsList *list = NULL;
+    StatsResult *entry;
+
+    if (!object_dynamic_cast(obj, TYPE_PCILEECH_BASE) ||
+        !DEVICE(obj)->realized) {
+        return 0;
+    }
+    stats = &PCILEECH(obj)->stats;
+    list = pci_leech_stats_add_histogram(list, args->names,
+                                         PCILEECH_STAT_SEND_LATENCY,
+                                         stats->send_latency);
+    list = pci_leech_stats_add_histogram(list, args->names,
+                                         PCILEECH_STAT_DMA_LATENCY,
+                                         stats->dma_latency);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_ATC_HITS,
+                               &stats->atc_hits);
+    list = pci_leech_stats_add(list, args->names,
+                               PCILEECH_STAT_READ_AHEAD_HITS,
+                               &stats->read_ahead_hits);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_THROTTLED,
+                               &stats->throttled);
+    list = pci_leech_stats_add(list, args->names,
+                               PCILEECH_STAT_BOUNCE_EXHAUSTED,
+                               &stats->bounce_exhausted);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_SEND_TIME,
+                               &stats->send_time);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_DMA_TIME,
+                               &stats->dma_time);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_DMA_ERRORS,
+                               &stats->dma_errors);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_WRITE_BYTES,
+                               &stats->write_bytes);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_READ_BYTES,
+                               &stats->read_bytes);
+    list = pci_leech_stats_add(list, args->names, PCILEECH_STAT_REQUESTS,
+                               &stats->requests);
+    if (!list) {
+        return 0;
+    }
+
+    entry = g_new0(StatsResult, 1);
+    entry->provider = STATS_PROVIDER_PCILEECH;
+    entry->qom_path = object_get_canonical_path(obj);
+    entry->stats = list;
+    QAPI_LIST_PREPEND(*args->result, entry);
+    return 0;
+}
+
+static void pci_leech_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets,
+                               Error **errp)
+{
+    PciLeechStatsArgs args = {
+        .result = result,
+        .names = names,
+    };
+
+    if (target != STATS_TARGET_PCILEECH) {
+        return;
+    }
+    object_child_foreach_recursive(object_get_root(), pci_leech_stats_query,
+                                   &args);
+}
+
+/* STATS_UNIT__MAX stands for a plain count. */
+static StatsSchemaValueList *pci_leech_schemas_add(StatsSchemaValueList *list,
+                                                   const char *name,
+                                                   StatsType type,
+                                                   StatsUnit unit,
+                                                   int exponent)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (unit != STATS_UNIT__MAX) {
+        value->has_unit = true;
+        value->unit = unit;
+    }
+    if (exponent) {
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = exponent;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void pci_leech_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_SEND_LATENCY,
+                                 STATS_TYPE_LOG2_HISTOGRAM,
+                                 STATS_UNIT_SECONDS, -9);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_DMA_LATENCY,
+                                 STATS_TYPE_LOG2_HISTOGRAM,
+                                 STATS_UNIT_SECONDS, -9);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_ATC_HITS,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_READ_AHEAD_HITS,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_THROTTLED,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_BOUNCE_EXHAUSTED,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_SEND_TIME,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT_SECONDS, -9);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_DMA_TIME,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT_SECONDS, -9);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_DMA_ERRORS,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_WRITE_BYTES,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT_BYTES, 0);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_READ_BYTES,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT_BYTES, 0);
+    list = pci_leech_schemas_add(list, PCILEECH_STAT_REQUESTS,
+                                 STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+
+    add_stats_schema(result, STATS_PROVIDER_PCILEECH, STATS_TARGET_PCILEECH,
+                     list);
+}
+
+/* Like throttle-group's, the limits can be changed at any time. */
+static void pci_leech_set_limits(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    ERRP_GUARD();
+    PciLeechState *state = PCILEECH(obj);
+    g_autoptr(ThrottleLimits) limits = NULL;
+    ThrottleConfig cfg;
+    if (!visit_type_ThrottleLimits(v, name, &limits, errp)) {
+        return;
+    }
+    QEMU_LOCK_GUARD(&state->throttle_lock);
+    throttle_get_config(&state->throttle, &cfg);
+    throttle_limits_to_config(limits, &cfg, errp);
+    if (*errp) {
+        return;
+    }
+    throttle_config(&state->throttle, state->throttle_clock, &cfg);
+    /* Let waiting channels recheck against the new limits. */
+    for (uint32_t i = 0; i < state->num_channels; i++) {
+        if (state->channels[i].throttled) {
+            replay_bh_schedule_event(state->channels[i].bh);
+        }
+    }
+}
+
+static void pci_leech_get_limits(Object *obj, Visitor *v, const char *name,
+                                 void *opaque, Error **errp)
+{
+    PciLeechState *state = PCILEECH(obj);
+    ThrottleLimits limits = { 0 };
+    ThrottleLimits *limitsp = &limits;
+    ThrottleConfig cfg;
+    WITH_QEMU_LOCK_GUARD(&state->throttle_lock) {
+        throttle_get_config(&state->throttle, &cfg);
+    }
+    throttle_config_to_limits(&cfg, limitsp);
+    visit_type_ThrottleLimits(v, name, &limitsp, errp);
+}
+
+static void pci_leech_instance_init(Object *obj)
+{
+    PciLeechState *state = PCILEECH(obj);
+    qemu_mutex_init(&state->throttle_lock);
+    qemu_mutex_init(&state->mbox_lock);
+    qemu_mutex_init(&state->watch_lock);
+    qemu_mutex_init(&state->atc_lock);
+    state->watches = g_array_new(FALSE, FALSE,
+                                 sizeof(struct LeechMemoryRange));
+    state->watch_events = g_array_new(FALSE, FALSE,
+                                      sizeof(struct LeechWatchEvent));
+    throttle_init(&state->throttle);
+    state->throttle_clock = qtest_enabled() ||
+                            replay_mode != REPLAY_MODE_NONE ?
+                            QEMU_CLOCK_VIRTUAL : QEMU_CLOCK_REALTIME;
+}
+
+static void pci_leech_instance_finalize(Object *obj)
+{
+    PciLeechState *state = PCILEECH(obj);
+    qemu_mutex_destroy(&state->throttle_lock);
+    qemu_mutex_destroy(&state->mbox_lock);
+    qemu_mutex_destroy(&state->watch_lock);
+    qemu_mutex_destroy(&state->atc_lock);
+    g_array_free(state->watches, TRUE);
+    g_array_free(state->watch_events, TRUE);
+}
+
+static Property leech_properties[] = {
+    DEFINE_PROP_CHR("chardev", PciLeechState, chardev),
+    DEFINE_PROP_SIZE32("chunk-size", PciLeechState, chunk_size,
+                       PCILEECH_DEFAULT_CHUNK_SIZE),
+    DEFINE_PROP_UINT32("queue-depth", PciLeechState, queue_depth,
+                       PCILEECH_DEFAULT_QUEUE_DEPTH),
+    DEFINE_PROP_STRING("transport", PciLeechState, transport),
+    DEFINE_PROP_SIZE("shm-size", PciLeechState, shm_size,
+                     PCILEECH_DEFAULT_SHM_SIZE),
+    DEFINE_PROP_LINK("iothread", PciLeechState, iothread, TYPE_IOTHREAD,
+                     IOThread *),
+    DEFINE_PROP_UINT32("zstd-level", PciLeechState, zstd_level,
+                       PCILEECH_DEFAULT_ZSTD_LEVEL),
+    DEFINE_PROP_UINT32("compress-threads", PciLeechState, compress_threads, 0),
+    DEFINE_PROP_UINT32("dma-threads", PciLeechState, dma_threads, 0),
+    DEFINE_PROP_UINT32("bounce-buffers", PciLeechState, bounce_buffers, 0),
+    DEFINE_PROP_STRING("replay", PciLeechState, replay),
+    DEFINE_PROP_STRING("replay-map", PciLeechState, replay_map),
+    DEFINE_PROP_BOOL("mailbox", PciLeechState, mailbox, false),
+    DEFINE_PROP_BOOL("events", PciLeechState, events, false),
+    DEFINE_PROP_UINT32("msix-vectors", PciLeechState, msix_vectors, 0),
+    DEFINE_PROP_ARRAY("channels", PciLeechState, num_channel_ids,
+                      channel_ids, qdev_prop_string, char *),
+    DEFINE_PROP_ARRAY("channel-iothreads", PciLeechState,
+                      num_channel_iothreads, channel_iothreads,
+                      qdev_prop_string, char *),
+    DEFINE_PROP_ARRAY("node-contexts", PciLeechState, num_node_contexts,
+                      node_contexts, qdev_prop_string, char *),
+    DEFINE_PROP_UINT32("node-threads", PciLeechState, node_threads,
+                       PCILEECH_DEFAULT_NODE_THREADS),
+    DEFINE_PROP_STRING("listen", PciLeechState, listen),
+    DEFINE_PROP_UINT32("max-clients", PciLeechState, max_clients,
+                       PCILEECH_DEFAULT_MAX_CLIENTS),
+    DEFINE_PROP_SIZE32("read-ahead", PciLeechState, read_ahead, 0),
+    DEFINE_PROP_UINT32("read-ahead-ttl", PciLeechState, read_ahead_ttl,
+                       PCILEECH_DEFAULT_RA_TTL),
+    DEFINE_PROP_BOOL("ats", PciLeechState, ats, false),
+    DEFINE_PROP_BOOL("pasid", PciLeechState, pasid, false),
+    DEFINE_PROP_BOOL("tlp-pacing", PciLeechState, tlp_pacing, false),
+    DEFINE_PROP_PCIE_LINK_SPEED("link-speed", PciLeechState, link_speed,
+                                PCIE_LINK_SPEED_5),
+    DEFINE_PROP_PCIE_LINK_WIDTH("link-width", PciLeechState, link_width,
+                                PCIE_LINK_WIDTH_1),
+    DEFINE_PROP_SIZE32("max-payload-size", PciLeechState, mps, 256),
+    DEFINE_PROP_SIZE32("max-read-request-size", PciLeechState, mrrs, 512),
+    DEFINE_PROP_UINT32("tags", PciLeechState, tags, 32),
+    DEFINE_PROP_UINT32("completion-latency", PciLeechState,
+                       completion_latency, 1000),
+    DEFINE_PROP_END_OF_LIST(),
+};
+
+static void pci_leech_class_init(ObjectClass *class, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(class);
+    PCIDeviceClass *k = PCI_DEVICE_CLASS(class);
+    k->realize = pci_leech_realize;
+    k->exit = pci_leech_exit;
+    /* Change the Vendor/Device ID to your favor. */
+    /* These are the default values from PCILeech-FPGA. */
+    k->vendor_id = PCI_VENDOR_ID_XILINX;
+    k->device_id = 0x0666;
+    k->revision = 0;
+    k->class_id = PCI_CLASS_NETWORK_ETHERNET;
+    device_class_set_legacy_reset(dc, pci_leech_device_reset);
+    device_class_set_props(dc, leech_properties);
+    object_class_property_add(class, "limits", "ThrottleLimits",
+                              pci_leech_get_limits, pci_leech_set_limits,
+                              NULL, NULL);
+    object_class_property_set_description(class, "limits",
+                                          "I/O limits of guest memory "
+                                          "accesses");
+    set_bit(DEVICE_CATEGORY_MISC, dc->categories);
+
+    add_stats_callbacks(STATS_PROVIDER_PCILEECH, pci_leech_stats_cb,
+                        pci_leech_schemas_cb);
+}
+
+static void pci_leech_pcie_class_init(ObjectClass *class, void *data)
+{
+    DeviceClass *dc = DEVICE_CLASS(class);
+    device_class_set_legacy_reset(dc, pci_leech_pcie_reset);
+}
+
+static void pci_leech_register_types(void)
+{
+    static InterfaceInfo conventional_interfaces[] = {
+        {INTERFACE_CONVENTIONAL_PCI_DEVICE},
+        {},
+    };
+    static InterfaceInfo pcie_interfaces[] = {
+        {INTERFACE_PCIE_DEVICE},
+        {},
+    };
+    static const TypeInfo leech_base_info = {
+        .name = TYPE_PCILEECH_BASE,
+        .parent = TYPE_PCI_DEVICE,
+        .instance_size = sizeof(PciLeechState),
+        .instance_init = pci_leech_instance_init,
+        .instance_finalize = pci_leech_instance_finalize,
+        .class_init = pci_leech_class_init,
+        .abstract = true,
+    };
+    static const TypeInfo leech_info = {
+        .name = TYPE_PCILEECH_DEVICE,
+        .parent = TYPE_PCILEECH_BASE,
+        .interfaces = conventional_interfaces,
+    };
+    /* The same device as a PCIe endpoint, e.g. behind a root port. */
+    static const TypeInfo leech_pcie_info = {
+        .name = TYPE_PCILEECH_PCIE_DEVICE,
+        .parent = TYPE_PCILEECH_BASE,
+        .class_init = pci_leech_pcie_class_init,
+        .interfaces = pcie_interfaces,
     };
+    type_register_static(&leech_base_info);
     type_register_static(&leech_info);
+    type_register_static(&leech_pcie_info);
 }
 
 type_init(pci_leech_register_types)
@@ -55,6 +55,7 @@
 #define E1000E_MIN_XITR     (500)
 
 #define E1000E_MAX_TX_FRAGS (64)
+#define E1000E_TX_DESC_BATCH (32)
 
 union e1000_rx_desc_union {
     struct e1000_rx_desc legacy;
@@ -842,6 +843,16 @@ e1000e_ring_free_descr_num(E1000ECore *core, const E1000ERingInfo *r)
     g_assert_not_reached();
 }
 
+/* Bytes of descriptors from the head up to the tail or the end of the ring */
+static inline uint32_t
+e1000e_ring_fetch_len(E1000ECore *core, const E1000ERingInfo *r)
+{
+    uint32_t dh = core->mac[r->dh], dt = core->mac[r->dt];
+    uint32_t end = dh < dt ? dt : core->mac[r->dlen] / E1000_RING_DESC_LEN;
+
+    return end > dh ? (end - dh) * E1000_RING_DESC_LEN : 0;
+}
+
 static inline bool
 e1000e_ring_enabled(E1000ECore *core, const E1000ERingInfo *r)
 {
@@ -900,7 +911,9 @@ static void
 e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
 {
     dma_addr_t base;
+    struct e1000_tx_desc descs[E1000E_TX_DESC_BATCH];
     struct e1000_tx_desc desc;
+    unsigned int fetched = 0, next = 0;
     bool ide = false;
     const E1000ERingInfo *txi = txr->i;
     uint32_t cause = E1000_ICS_TXQE;
@@ -913,7 +926,14 @@ e1000e_start_xmit(E1000ECore *core, const E1000E_TxRing *txr)
     while (!e1000e_ring_empty(core, txi)) {
         base = e1000e_ring_head_descr(core, txi);
 
-        pci_dma_read(core->owner, base, &desc, sizeof(desc));
+        /* All descriptors up to the tail are ours, fetch them in one go */
+        if (next == fetched) {
+            fetched = e1000e_ring_fetch_len(core, txi) / sizeof(desc);
+            fetched = MAX(MIN(fetched, ARRAY_SIZE(descs)), 1);
+            next = 0;
+            pci_dma_read(core->owner, base, descs, fetched * sizeof(desc));
+        }
+        desc = descs[next++];
 
         trace_e1000e_tx_descr((void *)(intptr_t)desc.buffer_addr,
                               desc.lower.data, desc.upper.data);
@@ -1478,12 +1498,47 @@ e1000e_do_ps(E1000ECore *core, struct NetRxPkt *pkt, size_t *hdr_len)
     return true;
 }
 
+static void
+e1000e_rx_desc_cache_flush(E1000ECore *core)
+{
+    int i;
+
+    for (i = 0; i < E1000E_NUM_QUEUES; i++) {
+        core->rx_desc_cache[i].len = 0;
+    }
+}
+
+/* Read the RX descriptor at @base, the head of @rxi */
+static void
+e1000e_read_rx_desc(E1000ECore *core, const E1000ERingInfo *rxi,
+                    dma_addr_t base, union e1000_rx_desc_union *desc)
+{
+    E1000ERxDescCache *cache = &core->rx_desc_cache[rxi->idx];
+    uint32_t len;
+
+    if (cache->ring_base != e1000e_ring_base(core, rxi) ||
+        cache->ring_len != core->mac[rxi->dlen] ||
+        cache->desc_len != core->rx_desc_len ||
+        base < cache->addr ||
+        base + core->rx_desc_len > cache->addr + cache->len) {
+        len = MIN(e1000e_ring_fetch_len(core, rxi), sizeof(cache->buf));
+        len = MAX(QEMU_ALIGN_DOWN(len, core->rx_desc_len), core->rx_desc_len);
+        pci_dma_read(core->owner, base, cache->buf, len);
+        cache->ring_base = e1000e_ring_base(core, rxi);
+        cache->ring_len = core->mac[rxi->dlen];
+        cache->desc_len = core->rx_desc_len;
+        cache->addr = base;
+        cache->len = len;
+    }
+
+    memcpy(desc, cache->buf + (base - cache->addr), core->rx_desc_len);
+}
+
 static void
 e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
                              const E1000E_RxRing *rxr,
                              const E1000E_RSSInfo *rss_info)
 {
-    PCIDevice *d = core->owner;
     dma_addr_t base;
     union e1000_rx_desc_union desc;
     size_t desc_size;
@@ -1517,7 +1572,7 @@ e1000e_write_packet_to_guest(E1000ECore *core, struct NetRxPkt *pkt,
 
         base = e1000e_ring_head_descr(core, rxi);
 
-        pci_dma_read(d, base, &desc, core->rx_desc_len);
+        e1000e_read_rx_desc(core, rxi, base, &desc);
 
         trace_e1000e_rx_descr(rxi->idx, base, core->rx_desc_len);
 
@@ -1923,6 +1978,7 @@ e1000e_calc_rxdesclen(E1000ECore *core)
 static void
 e1000e_set_rx_control(E1000ECore *core, int index, uint32_t val)
 {
+    e1000e_rx_desc_cache_flush(core);
     core->mac[RCTL] = val;
     trace_e1000e_rx_set_rctl(core->mac[RCTL]);
 
@@ -2512,6 +2568,14 @@ e1000e_set_rdtr(E1000ECore *core, int index, uint32_t val)
     }
 }
 
+static void
+e1000e_set_rdh(E1000ECore *core, int index, uint32_t val)
+{
+    /* The guest may have refilled the ring */
+    e1000e_rx_desc_cache_flush(core);
+    e1000e_set_16bit(core, index, val);
+}
+
 static void
 e1000e_set_tidv(E1000ECore *core, int index, uint32_t val)
 {
@@ -3155,7 +3219,7 @@ static const writeops e1000e_macreg_writeops[] = {
     [MDIC]     = e1000e_set_mdic,
     [ICS]      = e1000e_set_ics,
     [TDH]      = e1000e_set_16bit,
-    [RDH0]     = e1000e_set_16bit,
+    [RDH0]     = e1000e_set_rdh,
     [RDT0]     = e1000e_set_rdt,
     [IMC]      = e1000e_set_imc,
     [IMS]      = e1000e_set_ims,
@@ -3194,7 +3258,7 @@ static const writeops e1000e_macreg_writeops[] = {
     [TDBAL1]   = e1000e_set_dbal,
     [RDBAL0]   = e1000e_set_dbal,
     [RDBAL1]   = e1000e_set_dbal,
-    [RDH1]     = e1000e_set_16bit,
+    [RDH1]     = e1000e_set_rdh,
     [RDT1]     = e1000e_set_rdt,
     [STATUS]   = e1000e_set_status,
     [PBACLR]   = e1000e_set_pbaclr,
@@ -3480,6 +3544,8 @@ static void e1000e_reset(E1000ECore *core, bool sw)
         memset(&core->tx[i].props, 0, sizeof(core->tx[i].props));
         core->tx[i].skip_cp = false;
     }
+
+    e1000e_rx_desc_cache_flush(core);
 }
 
 void
@@ -3521,6 +3587,8 @@ e1000e_core_post_load(E1000ECore *core)
      */
     nc->link_down = (core->mac[STATUS] & E1000_STATUS_LU) == 0;
 
+    e1000e_rx_desc_cache_flush(core);
+
     /*
      * we need to restart intrmgr timers, as an older version of
      * QEMU can have stopped them before migration
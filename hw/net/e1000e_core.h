@@ -43,6 +43,8 @@
 #define E1000E_MSIX_VEC_NUM     (5)
 #define E1000E_NUM_QUEUES       (2)
 
+#define E1000E_RX_DESC_CACHE_SIZE  512
+
 typedef struct E1000Core E1000ECore;
 
 enum { PHY_R = BIT(0),
@@ -50,6 +52,20 @@ enum { PHY_R = BIT(0),
        PHY_RW = PHY_R | PHY_W,
        PHY_ANYPAGE = BIT(2) };
 
+/*
+ * RX descriptors fetched ahead from [RDH, RDT), which the guest may not
+ * touch until we write them back.  The ring setup at fetch time is kept
+ * to tell when the cache no longer applies.
+ */
+typedef struct E1000ERxDescCache {
+    uint64_t ring_base;
+    uint32_t ring_len;
+    uint8_t desc_len;
+    uint64_t addr;
+    uint32_t len;
+    uint8_t buf[E1000E_RX_DESC_CACHE_SIZE];
+} E1000ERxDescCache;
+
 typedef struct E1000IntrDelayTimer_st {
     QEMUTimer *timer;
     bool running;
@@ -80,6 +96,7 @@ struct E1000Core {
     } tx[E1000E_NUM_QUEUES];
 
     struct NetRxPkt *rx_pkt;
+    E1000ERxDescCache rx_desc_cache[E1000E_NUM_QUEUES];
 
     bool has_vnet;
     int max_queue_num;
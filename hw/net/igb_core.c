@@ -56,6 +56,7 @@
 #include "trace.h"
 
 #define E1000E_MAX_TX_FRAGS (64)
+#define IGB_TX_DESC_BATCH   (32)
 
 union e1000_rx_desc_union {
     struct e1000_rx_desc legacy;
@@ -748,6 +749,16 @@ igb_ring_free_descr_num(IGBCore *core, const E1000ERingInfo *r)
     g_assert_not_reached();
 }
 
+/* Bytes of descriptors from the head up to the tail or the end of the ring */
+static inline uint32_t
+igb_ring_fetch_len(IGBCore *core, const E1000ERingInfo *r)
+{
+    uint32_t dh = core->mac[r->dh], dt = core->mac[r->dt];
+    uint32_t end = dh < dt ? dt : core->mac[r->dlen] / E1000_RING_DESC_LEN;
+
+    return end > dh ? (end - dh) * E1000_RING_DESC_LEN : 0;
+}
+
 static inline bool
 igb_ring_enabled(IGBCore *core, const E1000ERingInfo *r)
 {
@@ -876,7 +887,9 @@ igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
 {
     PCIDevice *d;
     dma_addr_t base;
+    union e1000_adv_tx_desc descs[IGB_TX_DESC_BATCH];
     union e1000_adv_tx_desc desc;
+    unsigned int fetched = 0, next = 0;
     const E1000ERingInfo *txi = txr->i;
     uint32_t eic = 0;
 
@@ -893,7 +906,14 @@ igb_start_xmit(IGBCore *core, const IGB_TxRing *txr)
     while (!igb_ring_empty(core, txi)) {
         base = igb_ring_head_descr(core, txi);
 
-        pci_dma_read(d, base, &desc, sizeof(desc));
+        /* All descriptors up to the tail are ours, fetch them in one go */
+        if (next == fetched) {
+            fetched = igb_ring_fetch_len(core, txi) / sizeof(desc);
+            fetched = MAX(MIN(fetched, ARRAY_SIZE(descs)), 1);
+            next = 0;
+            pci_dma_read(d, base, descs, fetched * sizeof(desc));
+        }
+        desc = descs[next++];
 
         trace_e1000e_tx_descr((void *)(intptr_t)desc.read.buffer_addr,
                               desc.read.cmd_type_len, desc.wb.status);
@@ -1889,6 +1909,42 @@ igb_write_to_rx_buffers(IGBCore *core,
     igb_write_payload_to_rx_buffers(core, pkt, d, pdma_st, &copy_size);
 }
 
+static void
+igb_rx_desc_cache_flush(IGBCore *core)
+{
+    int i;
+
+    for (i = 0; i < IGB_NUM_QUEUES; i++) {
+        core->rx_desc_cache[i].len = 0;
+    }
+}
+
+/* Read the RX descriptor at @base, the head of @rxi, through @d */
+static void
+igb_read_rx_desc(IGBCore *core, PCIDevice *d, const E1000ERingInfo *rxi,
+                 dma_addr_t base, union e1000_rx_desc_union *desc)
+{
+    IGBRxDescCache *cache = &core->rx_desc_cache[rxi->idx];
+    uint32_t len;
+
+    if (cache->ring_base != igb_ring_base(core, rxi) ||
+        cache->ring_len != core->mac[rxi->dlen] ||
+        cache->desc_len != core->rx_desc_len ||
+        base < cache->addr ||
+        base + core->rx_desc_len > cache->addr + cache->len) {
+        len = MIN(igb_ring_fetch_len(core, rxi), sizeof(cache->buf));
+        len = MAX(QEMU_ALIGN_DOWN(len, core->rx_desc_len), core->rx_desc_len);
+        pci_dma_read(d, base, cache->buf, len);
+        cache->ring_base = igb_ring_base(core, rxi);
+        cache->ring_len = core->mac[rxi->dlen];
+        cache->desc_len = core->rx_desc_len;
+        cache->addr = base;
+        cache->len = len;
+    }
+
+    memcpy(desc, cache->buf + (base - cache->addr), core->rx_desc_len);
+}
+
 static void
 igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
                           const E1000E_RxRing *rxr,
@@ -1927,7 +1983,7 @@ igb_write_packet_to_guest(IGBCore *core, struct NetRxPkt *pkt,
         }
 
         base = igb_ring_head_descr(core, rxi);
-        pci_dma_read(d, base, &desc, rx_desc_len);
+        igb_read_rx_desc(core, d, rxi, base, &desc);
         trace_e1000e_rx_descr(rxi->idx, base, rx_desc_len);
 
         igb_read_rx_descr(core, &desc, &pdma_st, rxi);
@@ -2223,6 +2279,7 @@ igb_calc_rxdesclen(IGBCore *core)
 static void
 igb_set_rx_control(IGBCore *core, int index, uint32_t val)
 {
+    igb_rx_desc_cache_flush(core);
     core->mac[RCTL] = val;
     trace_e1000e_rx_set_rctl(core->mac[RCTL]);
 
@@ -2464,6 +2521,8 @@ void igb_core_vf_reset(IGBCore *core, uint16_t vfn)
 
     trace_igb_core_vf_reset(vfn);
 
+    igb_rx_desc_cache_flush(core);
+
     /* disable Rx and Tx for the VF*/
     core->mac[RXDCTL0 + (qn0 * 16)] &= ~E1000_RXDCTL_QUEUE_ENABLE;
     core->mac[RXDCTL0 + (qn1 * 16)] &= ~E1000_RXDCTL_QUEUE_ENABLE;
@@ -2786,6 +2845,14 @@ IGB_LOW_BITS_SET_FUNC(4)
 IGB_LOW_BITS_SET_FUNC(13)
 IGB_LOW_BITS_SET_FUNC(16)
 
+static void
+igb_set_rdh(IGBCore *core, int index, uint32_t val)
+{
+    /* The guest may have refilled the ring */
+    igb_rx_desc_cache_flush(core);
+    igb_set_16bit(core, index, val);
+}
+
 static void
 igb_set_dlen(IGBCore *core, int index, uint32_t val)
 {
@@ -3893,22 +3960,22 @@ static const writeops igb_macreg_writeops[] = {
     [TDT15]    = igb_set_tdt,
     [MDIC]     = igb_set_mdic,
     [ICS]      = igb_set_ics,
-    [RDH0]     = igb_set_16bit,
-    [RDH1]     = igb_set_16bit,
-    [RDH2]     = igb_set_16bit,
-    [RDH3]     = igb_set_16bit,
-    [RDH4]     = igb_set_16bit,
-    [RDH5]     = igb_set_16bit,
-    [RDH6]     = igb_set_16bit,
-    [RDH7]     = igb_set_16bit,
-    [RDH8]     = igb_set_16bit,
-    [RDH9]     = igb_set_16bit,
-    [RDH10]    = igb_set_16bit,
-    [RDH11]    = igb_set_16bit,
-    [RDH12]    = igb_set_16bit,
-    [RDH13]    = igb_set_16bit,
-    [RDH14]    = igb_set_16bit,
-    [RDH15]    = igb_set_16bit,
+    [RDH0]     = igb_set_rdh,
+    [RDH1]     = igb_set_rdh,
+    [RDH2]     = igb_set_rdh,
+    [RDH3]     = igb_set_rdh,
+    [RDH4]     = igb_set_rdh,
+    [RDH5]     = igb_set_rdh,
+    [RDH6]     = igb_set_rdh,
+    [RDH7]     = igb_set_rdh,
+    [RDH8]     = igb_set_rdh,
+    [RDH9]     = igb_set_rdh,
+    [RDH10]    = igb_set_rdh,
+    [RDH11]    = igb_set_rdh,
+    [RDH12]    = igb_set_rdh,
+    [RDH13]    = igb_set_rdh,
+    [RDH14]    = igb_set_rdh,
+    [RDH15]    = igb_set_rdh,
     [RDT0]     = igb_set_rdt,
     [RDT1]     = igb_set_rdt,
     [RDT2]     = igb_set_rdt,
@@ -4499,6 +4566,8 @@ static void igb_reset(IGBCore *core, bool sw)
         tx->first = true;
         tx->skip_cp = false;
     }
+
+    igb_rx_desc_cache_flush(core);
 }
 
 void
@@ -4540,6 +4609,8 @@ igb_core_post_load(IGBCore *core)
      */
     nc->link_down = (core->mac[STATUS] & E1000_STATUS_LU) == 0;
 
+    igb_rx_desc_cache_flush(core);
+
     /*
      * we need to restart intrmgr timers, as an older version of
      * QEMU can have stopped them before migration
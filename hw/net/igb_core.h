@@ -48,6 +48,7 @@
 #define IGBVF_MSIX_VEC_NUM      (3)
 #define IGB_NUM_QUEUES          (16)
 #define IGB_NUM_VM_POOLS        (8)
+#define IGB_RX_DESC_CACHE_SIZE  (512)
 
 typedef struct IGBCore IGBCore;
 
@@ -55,6 +56,20 @@ enum { PHY_R = BIT(0),
        PHY_W = BIT(1),
        PHY_RW = PHY_R | PHY_W };
 
+/*
+ * RX descriptors fetched ahead from [RDH, RDT), which the guest may not
+ * touch until we write them back.  The ring setup at fetch time is kept
+ * to tell when the cache no longer applies.
+ */
+typedef struct IGBRxDescCache {
+    uint64_t ring_base;
+    uint32_t ring_len;
+    uint8_t desc_len;
+    uint64_t addr;
+    uint32_t len;
+    uint8_t buf[IGB_RX_DESC_CACHE_SIZE];
+} IGBRxDescCache;
+
 typedef struct IGBIntrDelayTimer_st {
     QEMUTimer *timer;
     bool running;
@@ -84,6 +99,7 @@ struct IGBCore {
     } tx[IGB_NUM_QUEUES];
 
     struct NetRxPkt *rx_pkt;
+    IGBRxDescCache rx_desc_cache[IGB_NUM_QUEUES];
 
     bool has_vnet;
     int max_queue_num;
@@ -16,6 +16,7 @@
 #include "qemu/iov.h"
 #include "qemu/log.h"
 #include "qemu/main-loop.h"
+#include "block/aio-wait.h"
 #include "qemu/module.h"
 #include "hw/virtio/virtio.h"
 #include "net/net.h"
@@ -31,9 +32,11 @@
 #include "net/vhost_net.h"
 #include "net/announce.h"
 #include "hw/virtio/virtio-bus.h"
+#include "hw/virtio/iothread-vq-mapping.h"
 #include "qapi/error.h"
 #include "qapi/qapi-events-net.h"
 #include "hw/qdev-properties.h"
+#include "hw/qdev-properties-system.h"
 #include "qapi/qapi-types-migration.h"
 #include "qapi/qapi-events-migration.h"
 #include "hw/virtio/virtio-access.h"
@@ -374,14 +377,36 @@ static void virtio_net_vnet_endian_status(VirtIONet *n, uint8_t status)
     }
 }
 
+/*
+ * Interrupt the guest for a virtqueue of a queue pair.  Once the queue pairs
+ * run in IOThreads, this may be called outside the BQL and must go through
+ * the irqfd.  Either way, backends that deliver packets in a batch inside a
+ * defer_call_begin()/defer_call_end() section get one interrupt per batch.
+ */
+static void virtio_net_notify(VirtIONet *n, VirtQueue *vq)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+
+    if (n->ioeventfd_started) {
+        virtio_notify_irqfd(vdev, vq);
+    } else {
+        virtio_notify_deferred(vdev, vq);
+    }
+}
+
 static void virtio_net_drop_tx_queue_data(VirtIODevice *vdev, VirtQueue *vq)
 {
     unsigned int dropped = virtqueue_drop_all(vq);
     if (dropped) {
-        virtio_notify(vdev, vq);
+        virtio_net_notify(VIRTIO_NET(vdev), vq);
     }
 }
 
+static void virtio_net_qp_pause(VirtIONet *n, int index);
+static void virtio_net_qp_resume(VirtIONet *n, int index);
+static void virtio_net_iothreads_pause(VirtIONet *n);
+static void virtio_net_iothreads_resume(VirtIONet *n);
+
 static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
 {
     VirtIONet *n = VIRTIO_NET(vdev);
@@ -392,6 +417,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
     virtio_net_vnet_endian_status(n, status);
     virtio_net_vhost_status(n, status);
 
+    virtio_net_iothreads_pause(n);
     for (i = 0; i < n->max_queue_pairs; i++) {
         NetClientState *ncs = qemu_get_subqueue(n->nic, i);
         bool queue_started;
@@ -437,6 +463,7 @@ static void virtio_net_set_status(struct VirtIODevice *vdev, uint8_t status)
             }
         }
     }
+    virtio_net_iothreads_resume(n);
 }
 
 static void virtio_net_set_link_status(NetClientState *nc)
@@ -562,6 +589,19 @@ static void virtio_net_queue_reset(VirtIODevice *vdev, uint32_t queue_index)
 
     nc = qemu_get_subqueue(n->nic, vq2q(queue_index));
 
+    /*
+     * The virtqueue is reset once this returns, keep the queue pair out of
+     * its IOThread until the guest enables the virtqueue again.
+     */
+    if (n->qp_aio_context) {
+        VirtIONetQueue *q = &n->vqs[vq2q(queue_index)];
+
+        if (!q->reset_vqs) {
+            virtio_net_qp_pause(n, vq2q(queue_index));
+        }
+        q->reset_vqs |= 1 << (queue_index % 2);
+    }
+
     if (!nc->peer) {
         return;
     }
@@ -587,6 +627,18 @@ static void virtio_net_queue_enable(VirtIODevice *vdev, uint32_t queue_index)
 
     nc = qemu_get_subqueue(n->nic, vq2q(queue_index));
 
+    if (n->qp_aio_context) {
+        VirtIONetQueue *q = &n->vqs[vq2q(queue_index)];
+        uint8_t bit = 1 << (queue_index % 2);
+
+        if (q->reset_vqs & bit) {
+            q->reset_vqs &= ~bit;
+            if (!q->reset_vqs) {
+                virtio_net_qp_resume(n, vq2q(queue_index));
+            }
+        }
+    }
+
     if (!nc->peer || !vdev->vhost_started) {
         return;
     }
@@ -1264,6 +1316,10 @@ static bool virtio_net_attach_ebpf_rss(VirtIONet *n)
     }
 
     rss_data_to_rss_config(&n->rss_data, &config);
+    config.flow_steering = n->ebpf_flow_steering;
+
+    /* the table may point to queues that are no longer in use */
+    ebpf_rss_clear_flows(&n->ebpf_rss);
 
     if (!ebpf_rss_set_all(&n->ebpf_rss, &config,
                           n->rss_data.indirections_table, n->rss_data.key,
@@ -1590,8 +1646,11 @@ size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
 
 static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
 {
+    VirtIONet *n = VIRTIO_NET(vdev);
     VirtQueueElement *elem;
 
+    /* Commands change the filters and queue pairs under the datapath */
+    virtio_net_iothreads_pause(n);
     for (;;) {
         size_t written;
         elem = virtqueue_pop(vq, sizeof(VirtQueueElement));
@@ -1611,6 +1670,7 @@ static void virtio_net_handle_ctrl(VirtIODevice *vdev, VirtQueue *vq)
             break;
         }
     }
+    virtio_net_iothreads_resume(n);
 }
 
 /* RX */
@@ -1926,7 +1986,15 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     if (n->rss_data.enabled && n->rss_data.enabled_software_rss) {
         int index = virtio_net_process_rss(nc, buf, size, &hdr.virtio_net);
         if (index >= 0) {
-            nc = qemu_get_subqueue(n->nic, index % n->curr_queue_pairs);
+            NetClientState *target =
+                qemu_get_subqueue(n->nic, index % n->curr_queue_pairs);
+
+            /* Queue pairs in another IOThread are not ours to fill */
+            if (!n->qp_aio_context ||
+                n->qp_aio_context[target->queue_index] ==
+                n->qp_aio_context[nc->queue_index]) {
+                nc = target;
+            }
         }
     }
 
@@ -2040,7 +2108,7 @@ static ssize_t virtio_net_receive_rcu(NetClientState *nc, const uint8_t *buf,
     }
 
     virtqueue_flush(q->rx_vq, i);
-    virtio_notify(vdev, q->rx_vq);
+    virtio_net_notify(n, q->rx_vq);
 
     return size;
 
@@ -2686,11 +2754,10 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
 {
     VirtIONet *n = qemu_get_nic_opaque(nc);
     VirtIONetQueue *q = virtio_net_get_subqueue(nc);
-    VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int ret;
 
     virtqueue_push(q->tx_vq, q->async_tx.elem, 0);
-    virtio_notify(vdev, q->tx_vq);
+    virtio_net_notify(n, q->tx_vq);
 
     g_free(q->async_tx.elem);
     q->async_tx.elem = NULL;
@@ -2714,6 +2781,54 @@ static void virtio_net_tx_complete(NetClientState *nc, ssize_t len)
     }
 }
 
+/*
+ * Make the eBPF steering program deliver the replies to a transmitted
+ * packet on the queue pair it was sent from.  The guest picks the TX
+ * queue from the vCPU the sending socket runs on (XPS in Linux), so
+ * this is what the device can see of a flow's affinity; virtio has no
+ * accelerated RFS requests.
+ */
+static void virtio_net_steer_flow(VirtIONet *n, const struct iovec *iov,
+                                  unsigned int iov_cnt, int queue_index)
+{
+    struct EBPFRSSFlowKey key = {};
+    eth_ip6_hdr_info ip6hdr_info;
+    eth_ip4_hdr_info ip4hdr_info;
+    eth_l4_hdr_info l4hdr_info;
+    size_t l3hdr_off, l4hdr_off, l5hdr_off;
+    bool hasip4, hasip6;
+
+    eth_get_protocols(iov, iov_cnt, n->host_hdr_len, &hasip4, &hasip6,
+                      &l3hdr_off, &l4hdr_off, &l5hdr_off,
+                      &ip6hdr_info, &ip4hdr_info, &l4hdr_info);
+
+    /* the key is in the receive direction, swap source and destination */
+    switch (l4hdr_info.proto) {
+    case ETH_L4_HDR_PROTO_TCP:
+        key.is_tcp = 1;
+        key.src_port = l4hdr_info.hdr.tcp.th_dport;
+        key.dst_port = l4hdr_info.hdr.tcp.th_sport;
+        break;
+    case ETH_L4_HDR_PROTO_UDP:
+        key.src_port = l4hdr_info.hdr.udp.uh_dport;
+        key.dst_port = l4hdr_info.hdr.udp.uh_sport;
+        break;
+    default:
+        return;
+    }
+
+    if (hasip4) {
+        memcpy(key.src, &ip4hdr_info.ip4_hdr.ip_dst, sizeof(uint32_t));
+        memcpy(key.dst, &ip4hdr_info.ip4_hdr.ip_src, sizeof(uint32_t));
+    } else {
+        key.is_ipv6 = 1;
+        memcpy(key.src, &ip6hdr_info.ip6_hdr.ip6_dst, sizeof(key.src));
+        memcpy(key.dst, &ip6hdr_info.ip6_hdr.ip6_src, sizeof(key.dst));
+    }
+
+    ebpf_rss_set_flow(&n->ebpf_rss, &key, queue_index);
+}
+
 /* TX */
 static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 {
@@ -2792,6 +2907,11 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
             }
         }
 
+        if (n->ebpf_flow_steering && n->rss_data.enabled &&
+            !n->rss_data.enabled_software_rss) {
+            virtio_net_steer_flow(n, out_sg, out_num, queue_index);
+        }
+
         ret = qemu_sendv_packet_async(qemu_get_subqueue(n->nic, queue_index),
                                       out_sg, out_num, virtio_net_tx_complete);
         if (ret == 0) {
@@ -2802,7 +2922,7 @@ static int32_t virtio_net_flush_tx(VirtIONetQueue *q)
 
 drop:
         virtqueue_push(q->tx_vq, elem, 0);
-        virtio_notify(vdev, q->tx_vq);
+        virtio_net_notify(n, q->tx_vq);
         g_free(elem);
 
         if (++num_packets >= n->tx_burst) {
@@ -2931,6 +3051,11 @@ static void virtio_net_tx_bh(void *opaque)
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
     int32_t ret;
 
+    /* The main loop owns the queue pair, virtio_net_qp_attach_bh() resumes */
+    if (q->detached) {
+        return;
+    }
+
     /* This happens when device was stopped but BH wasn't. */
     if (!vdev->vm_running) {
         /* Make sure tx waiting is set, so we'll run when restarted. */
@@ -2973,6 +3098,329 @@ static void virtio_net_tx_bh(void *opaque)
     }
 }
 
+/*
+ * With iothread-vq-mapping, each queue pair runs in its IOThread once
+ * ioeventfd has started: the handlers of its two virtqueues, its TX bottom
+ * half and the handlers of its backend.  The control virtqueue and the rest
+ * of the device stay in the main loop, which pauses the queue pairs before
+ * it touches their state.
+ */
+
+/* The queue pairs that have virtqueues */
+static int virtio_net_nr_qps(VirtIONet *n)
+{
+    return n->multiqueue ? n->max_queue_pairs : 1;
+}
+
+static QEMUBH *virtio_net_new_tx_bh(VirtIONet *n, VirtIONetQueue *q,
+                                    AioContext *ctx)
+{
+    return aio_bh_new_guarded(ctx, virtio_net_tx_bh, q,
+                              &DEVICE(n)->mem_reentrancy_guard);
+}
+
+/* Context: BH in the IOThread of the queue pair */
+static void virtio_net_qp_attach_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    q->detached = false;
+    if (nc->peer) {
+        qemu_set_aio_context(nc->peer, ctx);
+    }
+
+    /* Attaching the notifiers kicks the virtqueues */
+    virtio_queue_aio_attach_host_notifier(q->rx_vq, ctx);
+    virtio_queue_aio_attach_host_notifier(q->tx_vq, ctx);
+    if (q->tx_waiting) {
+        replay_bh_schedule_event(q->tx_bh);
+    }
+}
+
+/* Context: BH in the IOThread of the queue pair */
+static void virtio_net_qp_detach_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+    NetClientState *nc = qemu_get_subqueue(n->nic, q - n->vqs);
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    virtio_queue_aio_detach_host_notifier(q->rx_vq, ctx);
+    virtio_queue_aio_detach_host_notifier(q->tx_vq, ctx);
+    if (nc->peer) {
+        qemu_set_aio_context(nc->peer, NULL);
+    }
+    q->detached = true;
+}
+
+/* Context: BH in the IOThread of the queue pair */
+static void virtio_net_qp_stop_bh(void *opaque)
+{
+    VirtIONetQueue *q = opaque;
+    VirtIONet *n = q->n;
+
+    if (!q->detached) {
+        virtio_net_qp_detach_bh(q);
+    }
+
+    /* Catch the kicks that raced with detaching the notifiers */
+    virtio_queue_host_notifier_read(virtio_queue_get_host_notifier(q->rx_vq));
+    virtio_queue_host_notifier_read(virtio_queue_get_host_notifier(q->tx_vq));
+
+    /* From now on TX runs in the main loop again */
+    qemu_bh_delete(q->tx_bh);
+    q->tx_bh = virtio_net_new_tx_bh(n, q, qemu_get_aio_context());
+    q->detached = false;
+}
+
+/* Context: BQL held */
+static void virtio_net_qp_pause(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+
+    if (q->pause_depth++ == 0 && n->ioeventfd_started) {
+        aio_wait_bh_oneshot(n->qp_aio_context[index],
+                            virtio_net_qp_detach_bh, q);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_qp_resume(VirtIONet *n, int index)
+{
+    VirtIONetQueue *q = &n->vqs[index];
+
+    assert(q->pause_depth > 0);
+    if (--q->pause_depth == 0 && n->ioeventfd_started) {
+        aio_wait_bh_oneshot(n->qp_aio_context[index],
+                            virtio_net_qp_attach_bh, q);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_iothreads_pause(VirtIONet *n)
+{
+    if (!n->qp_aio_context) {
+        return;
+    }
+    for (int i = 0; i < virtio_net_nr_qps(n); i++) {
+        virtio_net_qp_pause(n, i);
+    }
+}
+
+/* Context: BQL held */
+static void virtio_net_iothreads_resume(VirtIONet *n)
+{
+    if (!n->qp_aio_context) {
+        return;
+    }
+    for (int i = 0; i < virtio_net_nr_qps(n); i++) {
+        virtio_net_qp_resume(n, i);
+    }
+}
+
+/* Context: BQL held */
+static int virtio_net_start_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    EventNotifier *ctrl_notifier;
+    int nvqs = virtio_get_num_queues(vdev);
+    int i, r;
+
+    if (!n->qp_aio_context) {
+        return virtio_device_start_ioeventfd_impl(vdev);
+    }
+
+    if (n->ioeventfd_started) {
+        return 0;
+    }
+
+    /* Set up guest notifier (irq) */
+    r = k->set_guest_notifiers(qbus->parent, nvqs, true);
+    if (r != 0) {
+        error_report("virtio-net failed to set guest notifier (%d), "
+                     "ensure -accel kvm is set.", r);
+        return -ENOSYS;
+    }
+
+    /*
+     * Batch all the host notifiers in a single transaction to avoid
+     * quadratic time complexity in address_space_update_ioeventfds().
+     */
+    memory_region_transaction_begin();
+
+    for (i = 0; i < nvqs; i++) {
+        r = virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, true);
+        if (r != 0) {
+            int j = i;
+
+            error_report("virtio-net failed to set host notifier (%d)", r);
+            while (i--) {
+                virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+            }
+
+            /*
+             * The transaction expects the ioeventfds to be open when it
+             * commits. Do it now, before the cleanup loop.
+             */
+            memory_region_transaction_commit();
+
+            while (j--) {
+                virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), j);
+            }
+            k->set_guest_notifiers(qbus->parent, nvqs, false);
+            return -ENOSYS;
+        }
+    }
+
+    memory_region_transaction_commit();
+
+    /* A pending TX bottom half is rescheduled by virtio_net_qp_attach_bh() */
+    for (i = 0; i < virtio_net_nr_qps(n); i++) {
+        VirtIONetQueue *q = &n->vqs[i];
+
+        qemu_bh_delete(q->tx_bh);
+        q->tx_bh = virtio_net_new_tx_bh(n, q, n->qp_aio_context[i]);
+    }
+
+    n->ioeventfd_started = true;
+    smp_wmb(); /* paired with aio_notify_accept() on the read side */
+
+    ctrl_notifier = virtio_queue_get_host_notifier(n->ctrl_vq);
+    event_notifier_set_handler(ctrl_notifier, virtio_queue_host_notifier_read);
+    event_notifier_set(ctrl_notifier);
+
+    for (i = 0; i < virtio_net_nr_qps(n); i++) {
+        if (!n->vqs[i].pause_depth) {
+            aio_wait_bh_oneshot(n->qp_aio_context[i],
+                                virtio_net_qp_attach_bh, &n->vqs[i]);
+        }
+    }
+    return 0;
+}
+
+/* Context: BQL held */
+static void virtio_net_stop_ioeventfd(VirtIODevice *vdev)
+{
+    VirtIONet *n = VIRTIO_NET(vdev);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+    EventNotifier *ctrl_notifier;
+    int nvqs = virtio_get_num_queues(vdev);
+    int i;
+
+    if (!n->qp_aio_context) {
+        virtio_device_stop_ioeventfd_impl(vdev);
+        return;
+    }
+
+    if (!n->ioeventfd_started) {
+        return;
+    }
+
+    for (i = 0; i < virtio_net_nr_qps(n); i++) {
+        aio_wait_bh_oneshot(n->qp_aio_context[i], virtio_net_qp_stop_bh,
+                            &n->vqs[i]);
+    }
+
+    ctrl_notifier = virtio_queue_get_host_notifier(n->ctrl_vq);
+    event_notifier_set_handler(ctrl_notifier, NULL);
+    virtio_queue_host_notifier_read(ctrl_notifier);
+
+    n->ioeventfd_started = false;
+
+    memory_region_transaction_begin();
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_set_host_notifier(VIRTIO_BUS(qbus), i, false);
+    }
+
+    /*
+     * The transaction expects the ioeventfds to be open when it
+     * commits. Do it now, before the cleanup loop.
+     */
+    memory_region_transaction_commit();
+
+    for (i = 0; i < nvqs; i++) {
+        virtio_bus_cleanup_host_notifier(VIRTIO_BUS(qbus), i);
+    }
+
+    k->set_guest_notifiers(qbus->parent, nvqs, false);
+
+    for (i = 0; i < virtio_net_nr_qps(n); i++) {
+        if (n->vqs[i].tx_waiting) {
+            replay_bh_schedule_event(n->vqs[i].tx_bh);
+        }
+    }
+}
+
+/* Context: BQL held */
+static bool virtio_net_qp_aio_context_init(VirtIONet *n, Error **errp)
+{
+    VirtIODevice *vdev = VIRTIO_DEVICE(n);
+    BusState *qbus = BUS(qdev_get_parent_bus(DEVICE(vdev)));
+    VirtioBusClass *k = VIRTIO_BUS_GET_CLASS(qbus);
+
+    if (!n->iothread_vq_mapping_list) {
+        return true;
+    }
+
+    if (!k->set_guest_notifiers || !k->ioeventfd_assign) {
+        error_setg(errp,
+                   "device is incompatible with iothread "
+                   "(transport does not support notifiers)");
+        return false;
+    }
+    if (!virtio_device_ioeventfd_enabled(vdev)) {
+        error_setg(errp, "ioeventfd is required for iothread");
+        return false;
+    }
+    if (n->net_conf.tx && !strcmp(n->net_conf.tx, "timer")) {
+        error_setg(errp, "iothread-vq-mapping requires tx=bh");
+        return false;
+    }
+    if (virtio_has_feature(n->host_features, VIRTIO_NET_F_RSC_EXT)) {
+        error_setg(errp, "iothread-vq-mapping is incompatible with "
+                   "guest_rsc_ext");
+        return false;
+    }
+
+    for (int i = 0; i < n->max_ncs; i++) {
+        NetClientState *peer = n->nic_conf.peers.ncs[i];
+
+        if (peer && peer->is_datapath && !qemu_can_set_aio_context(peer)) {
+            error_setg(errp, "netdev '%s' cannot run in an IOThread",
+                       peer->name);
+            return false;
+        }
+    }
+
+    n->qp_aio_context = g_new(AioContext *, n->max_queue_pairs);
+    if (!iothread_vq_mapping_apply(n->iothread_vq_mapping_list,
+                                   n->qp_aio_context, n->max_queue_pairs,
+                                   errp)) {
+        g_free(n->qp_aio_context);
+        n->qp_aio_context = NULL;
+        return false;
+    }
+    return true;
+}
+
+/* Context: BQL held */
+static void virtio_net_qp_aio_context_cleanup(VirtIONet *n)
+{
+    assert(!n->ioeventfd_started);
+
+    if (n->qp_aio_context) {
+        iothread_vq_mapping_cleanup(n->iothread_vq_mapping_list);
+        g_free(n->qp_aio_context);
+        n->qp_aio_context = NULL;
+    }
+}
+
 static void virtio_net_add_queue(VirtIONet *n, int index)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(n);
@@ -3725,6 +4173,12 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
         virtio_cleanup(vdev);
         return;
     }
+
+    if (!virtio_net_qp_aio_context_init(n, errp)) {
+        virtio_cleanup(vdev);
+        return;
+    }
+
     n->vqs = g_new0(VirtIONetQueue, n->max_queue_pairs);
     n->curr_queue_pairs = 1;
     n->tx_timeout = n->net_conf.txtimer;
@@ -3819,6 +4273,11 @@ static void virtio_net_device_realize(DeviceState *dev, Error **errp)
             }
         }
     }
+
+    if (n->ebpf_flow_steering && !ebpf_rss_has_flow_table(&n->ebpf_rss)) {
+        warn_report("eBPF flow steering is not available");
+        n->ebpf_flow_steering = false;
+    }
 }
 
 static void virtio_net_device_unrealize(DeviceState *dev)
@@ -3857,6 +4316,7 @@ static void virtio_net_device_unrealize(DeviceState *dev)
     /* delete also control vq */
     virtio_del_queue(vdev, max_queue_pairs * 2);
     qemu_announce_timer_del(&n->announce_timer, false);
+    virtio_net_qp_aio_context_cleanup(n);
     g_free(n->vqs);
     qemu_del_nic(n->nic);
     virtio_net_rsc_cleanup(n);
@@ -3898,6 +4358,14 @@ static void virtio_net_reset(VirtIODevice *vdev)
         flush_or_purge_queued_packets(qemu_get_subqueue(n->nic, i));
     }
 
+    /* Virtqueues reset by the guest are back in use */
+    for (i = 0; i < n->max_queue_pairs; i++) {
+        if (n->vqs[i].reset_vqs) {
+            n->vqs[i].reset_vqs = 0;
+            virtio_net_qp_resume(n, i);
+        }
+    }
+
     virtio_net_disable_rss(n);
 }
 
@@ -4032,6 +4500,8 @@ static Property virtio_net_properties[] = {
                     VIRTIO_NET_F_HASH_REPORT, false),
     DEFINE_PROP_ARRAY("ebpf-rss-fds", VirtIONet, nr_ebpf_rss_fds,
                       ebpf_rss_fds, qdev_prop_string, char*),
+    DEFINE_PROP_BOOL("ebpf-flow-steering", VirtIONet, ebpf_flow_steering,
+                     false),
     DEFINE_PROP_BIT64("guest_rsc_ext", VirtIONet, host_features,
                     VIRTIO_NET_F_RSC_EXT, false),
     DEFINE_PROP_UINT32("rsc_interval", VirtIONet, rsc_timeout,
@@ -4041,6 +4511,8 @@ static Property virtio_net_properties[] = {
                        TX_TIMER_INTERVAL),
     DEFINE_PROP_INT32("x-txburst", VirtIONet, net_conf.txburst, TX_BURST),
     DEFINE_PROP_STRING("tx", VirtIONet, net_conf.tx),
+    DEFINE_PROP_IOTHREAD_VQ_MAPPING_LIST("iothread-vq-mapping", VirtIONet,
+                                         iothread_vq_mapping_list),
     DEFINE_PROP_UINT16("rx_queue_size", VirtIONet, net_conf.rx_queue_size,
                        VIRTIO_NET_RX_QUEUE_DEFAULT_SIZE),
     DEFINE_PROP_UINT16("tx_queue_size", VirtIONet, net_conf.tx_queue_size,
@@ -4079,6 +4551,8 @@ static void virtio_net_class_init(ObjectClass *klass, void *data)
     vdc->queue_reset = virtio_net_queue_reset;
     vdc->queue_enable = virtio_net_queue_enable;
     vdc->set_status = virtio_net_set_status;
+    vdc->start_ioeventfd = virtio_net_start_ioeventfd;
+    vdc->stop_ioeventfd = virtio_net_stop_ioeventfd;
     vdc->guest_notifier_mask = virtio_net_guest_notifier_mask;
     vdc->guest_notifier_pending = virtio_net_guest_notifier_pending;
     vdc->legacy_features |= (0x1 << VIRTIO_NET_F_GSO);
@@ -43,6 +43,7 @@
  *              atomic.dn=<on|off[optional]>, \
  *              atomic.awun<N[optional]>, \
  *              atomic.awupf<N[optional]>, \
+ *              iothread=<iothread_id[optional]>, \
  *              subsys=<subsys_id>
  *      -device nvme-ns,drive=<drive_id>,bus=<bus_name>,nsid=<nsid>,\
  *              zoned=<true|false[optional]>, \
@@ -201,6 +202,7 @@
 #include "qemu/range.h"
 #include "qapi/error.h"
 #include "qapi/visitor.h"
+#include "block/aio-wait.h"
 #include "sysemu/sysemu.h"
 #include "sysemu/block-backend.h"
 #include "sysemu/hostmem.h"
@@ -226,6 +228,7 @@
 #define NVME_VF_RES_GRANULARITY 1
 #define NVME_VF_OFFSET 0x1
 #define NVME_VF_STRIDE 1
+#define NVME_PRP_LIST_CHUNK 256
 
 #define NVME_GUEST_ERR(trace, fmt, ...) \
     do { \
@@ -648,6 +651,37 @@ static uint8_t nvme_sq_empty(NvmeSQueue *sq)
     return sq->head == sq->tail;
 }
 
+static AioContext *nvme_queue_ctx(NvmeCtrl *n, uint16_t qid)
+{
+    return qid ? n->ctx : qemu_get_aio_context();
+}
+
+/* Runs @fn in the AioContext of queue @qid and waits for it to return */
+static void nvme_run_in_queue_ctx(NvmeCtrl *n, uint16_t qid, QEMUBHFunc *fn,
+                                  void *opaque)
+{
+    AioContext *ctx = nvme_queue_ctx(n, qid);
+
+    if (ctx == qemu_get_aio_context()) {
+        fn(opaque);
+    } else {
+        aio_wait_bh_oneshot(ctx, fn, opaque);
+    }
+}
+
+static void nvme_set_queue_notifier(NvmeCtrl *n, uint16_t qid,
+                                    EventNotifier *e,
+                                    EventNotifierHandler *handler)
+{
+    AioContext *ctx = nvme_queue_ctx(n, qid);
+
+    if (ctx == qemu_get_aio_context()) {
+        event_notifier_set_handler(e, handler);
+    } else {
+        aio_set_event_notifier(ctx, e, handler, NULL, NULL);
+    }
+}
+
 static void nvme_irq_check(NvmeCtrl *n)
 {
     PCIDevice *pci = PCI_DEVICE(n);
@@ -673,6 +707,9 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
 {
     PCIDevice *pci = PCI_DEVICE(n);
 
+    /* Queues can run in an IOThread, but interrupts need the BQL */
+    BQL_LOCK_GUARD();
+
     if (cq->irq_enabled) {
         if (msix_enabled(pci)) {
             trace_pci_nvme_irq_msix(cq->vector);
@@ -690,6 +727,8 @@ static void nvme_irq_assert(NvmeCtrl *n, NvmeCQueue *cq)
 
 static void nvme_irq_deassert(NvmeCtrl *n, NvmeCQueue *cq)
 {
+    BQL_LOCK_GUARD();
+
     if (cq->irq_enabled) {
         if (msix_enabled(PCI_DEVICE(n))) {
             return;
@@ -790,6 +829,45 @@ static void nvme_sg_split(NvmeSg *sg, NvmeNamespace *ns, NvmeSg *data,
     }
 }
 
+/*
+ * Guests commonly hand out physically contiguous buffers one PRP page at a
+ * time; extend the last mapping instead of adding an entry for each page so
+ * that the I/O path maps and submits the run in one go.
+ */
+static void nvme_iovec_add(QEMUIOVector *iov, void *base, size_t len)
+{
+    if (iov->niov) {
+        struct iovec *last = &iov->iov[iov->niov - 1];
+
+        if (last->iov_base + last->iov_len == base) {
+            last->iov_len += len;
+            iov->size += len;
+            return;
+        }
+    }
+
+    qemu_iovec_add(iov, base, len);
+}
+
+static bool nvme_sglist_merge(QEMUSGList *qsg, hwaddr addr, size_t len)
+{
+    ScatterGatherEntry *last;
+
+    if (!qsg->nsg) {
+        return false;
+    }
+
+    last = &qsg->sg[qsg->nsg - 1];
+    if (last->base + last->len != addr) {
+        return false;
+    }
+
+    last->len += len;
+    qsg->size += len;
+
+    return true;
+}
+
 static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
                                   size_t len)
 {
@@ -803,7 +881,7 @@ static uint16_t nvme_map_addr_cmb(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
+    nvme_iovec_add(iov, nvme_addr_to_cmb(n, addr), len);
 
     return NVME_SUCCESS;
 }
@@ -819,7 +897,7 @@ static uint16_t nvme_map_addr_pmr(NvmeCtrl *n, QEMUIOVector *iov, hwaddr addr,
         return NVME_DATA_TRAS_ERROR;
     }
 
-    qemu_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
+    nvme_iovec_add(iov, nvme_addr_to_pmr(n, addr), len);
 
     return NVME_SUCCESS;
 }
@@ -864,6 +942,10 @@ static uint16_t nvme_map_addr(NvmeCtrl *n, NvmeSg *sg, hwaddr addr, size_t len)
         return NVME_INVALID_USE_OF_CMB | NVME_DNR;
     }
 
+    if (nvme_sglist_merge(&sg->qsg, addr, len)) {
+        return NVME_SUCCESS;
+    }
+
     if (sg->qsg.nsg + 1 > IOV_MAX) {
         goto max_mappings_exceeded;
     }
@@ -904,45 +986,49 @@ static uint16_t nvme_map_prp(NvmeCtrl *n, NvmeSg *sg, uint64_t prp1,
     len -= trans_len;
     if (len) {
         if (len > n->page_size) {
-            g_autofree uint64_t *prp_list = g_new(uint64_t, n->max_prp_ents);
-            uint32_t nents, prp_trans;
+            uint64_t prp_list[NVME_PRP_LIST_CHUNK];
+            hwaddr list_addr = prp2;
+            uint32_t nents, chunk = 0;
             int i = 0;
 
             /*
              * The first PRP list entry, pointed to by PRP2 may contain offset.
              * Hence, we need to calculate the number of entries in based on
-             * that offset.
+             * that offset.  nents counts the entries of the current list page
+             * that have not been read into prp_list yet.
              */
             nents = (n->page_size - (prp2 & (n->page_size - 1))) >> 3;
-            prp_trans = MIN(n->max_prp_ents, nents) * sizeof(uint64_t);
-            ret = nvme_addr_read(n, prp2, (void *)prp_list, prp_trans);
-            if (ret) {
-                trace_pci_nvme_err_addr_read(prp2);
-                status = NVME_DATA_TRAS_ERROR;
-                goto unmap;
-            }
             while (len != 0) {
-                uint64_t prp_ent = le64_to_cpu(prp_list[i]);
+                uint64_t prp_ent;
+
+                if (i == chunk) {
+                    chunk = (len + n->page_size - 1) >> n->page_bits;
+                    chunk = MIN(chunk, MIN(nents, NVME_PRP_LIST_CHUNK));
+                    ret = nvme_addr_read(n, list_addr, (void *)prp_list,
+                                         chunk * sizeof(uint64_t));
+                    if (ret) {
+                        trace_pci_nvme_err_addr_read(list_addr);
+                        status = NVME_DATA_TRAS_ERROR;
+                        goto unmap;
+                    }
+                    list_addr += chunk * sizeof(uint64_t);
+                    nents -= chunk;
+                    i = 0;
+                }
+
+                prp_ent = le64_to_cpu(prp_list[i]);
 
-                if (i == nents - 1 && len > n->page_size) {
+                if (!nents && i == chunk - 1 && len > n->page_size) {
                     if (unlikely(prp_ent & (n->page_size - 1))) {
                         trace_pci_nvme_err_invalid_prplist_ent(prp_ent);
                         status = NVME_INVALID_PRP_OFFSET | NVME_DNR;
                         goto unmap;
                     }
 
-                    i = 0;
-                    nents = (len + n->page_size - 1) >> n->page_bits;
-                    nents = MIN(nents, n->max_prp_ents);
-                    prp_trans = nents * sizeof(uint64_t);
-                    ret = nvme_addr_read(n, prp_ent, (void *)prp_list,
-                                         prp_trans);
-                    if (ret) {
-                        trace_pci_nvme_err_addr_read(prp_ent);
-                        status = NVME_DATA_TRAS_ERROR;
-                        goto unmap;
-                    }
-                    prp_ent = le64_to_cpu(prp_list[i]);
+                    list_addr = prp_ent;
+                    nents = n->max_prp_ents;
+                    chunk = i = 0;
+                    continue;
                 }
 
                 if (unlikely(prp_ent & (n->page_size - 1))) {
@@ -1539,6 +1625,8 @@ static void nvme_post_cqes(void *opaque)
         QTAILQ_INSERT_TAIL(&sq->req_list, req, entry);
     }
     if (cq->tail != cq->head) {
+        BQL_LOCK_GUARD();
+
         if (cq->irq_enabled && !pending) {
             n->cq_pending++;
         }
@@ -4705,6 +4793,8 @@ static void nvme_cq_notifier(EventNotifier *e)
     nvme_update_cq_head(cq);
 
     if (cq->tail == cq->head) {
+        BQL_LOCK_GUARD();
+
         if (cq->irq_enabled) {
             n->cq_pending--;
         }
@@ -4726,7 +4816,7 @@ static int nvme_init_cq_ioeventfd(NvmeCQueue *cq)
         return ret;
     }
 
-    event_notifier_set_handler(&cq->notifier, nvme_cq_notifier);
+    nvme_set_queue_notifier(n, cq->cqid, &cq->notifier, nvme_cq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &cq->notifier);
 
@@ -4755,23 +4845,34 @@ static int nvme_init_sq_ioeventfd(NvmeSQueue *sq)
         return ret;
     }
 
-    event_notifier_set_handler(&sq->notifier, nvme_sq_notifier);
+    nvme_set_queue_notifier(n, sq->sqid, &sq->notifier, nvme_sq_notifier);
     memory_region_add_eventfd(&n->iomem,
                               0x1000 + offset, 4, false, 0, &sq->notifier);
 
     return 0;
 }
 
+/* Stops the handlers of @sq; runs in the AioContext of the queue */
+static void nvme_stop_sq(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+
+    qemu_bh_cancel(sq->bh);
+    if (sq->ioeventfd_enabled) {
+        nvme_set_queue_notifier(sq->ctrl, sq->sqid, &sq->notifier, NULL);
+    }
+}
+
 static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
 {
     uint16_t offset = sq->sqid << 3;
 
     n->sq[sq->sqid] = NULL;
+    nvme_run_in_queue_ctx(n, sq->sqid, nvme_stop_sq, sq);
     qemu_bh_delete(sq->bh);
     if (sq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &sq->notifier);
-        event_notifier_set_handler(&sq->notifier, NULL);
         event_notifier_cleanup(&sq->notifier);
     }
     g_free(sq->io_req);
@@ -4780,27 +4881,40 @@ static void nvme_free_sq(NvmeSQueue *sq, NvmeCtrl *n)
     }
 }
 
-static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
+/* Cancels the requests of @sq; runs in the AioContext of the queue */
+static void nvme_cancel_sq(NvmeSQueue *sq)
 {
-    NvmeDeleteQ *c = (NvmeDeleteQ *)&req->cmd;
+    AioContext *ctx = qemu_get_current_aio_context();
     NvmeRequest *r, *next;
-    NvmeSQueue *sq;
-    NvmeCQueue *cq;
-    uint16_t qid = le16_to_cpu(c->qid);
 
-    if (unlikely(!qid || nvme_check_sqid(n, qid))) {
-        trace_pci_nvme_err_invalid_del_sq(qid);
-        return NVME_INVALID_QID | NVME_DNR;
+    if (ctx == qemu_get_aio_context()) {
+        while (!QTAILQ_EMPTY(&sq->out_req_list)) {
+            r = QTAILQ_FIRST(&sq->out_req_list);
+            assert(r->aiocb);
+            blk_aio_cancel(r->aiocb);
+        }
+        return;
     }
 
-    trace_pci_nvme_del_sq(qid);
-
-    sq = n->sq[qid];
-    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
-        r = QTAILQ_FIRST(&sq->out_req_list);
+    /* blk_aio_cancel() is only for the main loop */
+    QTAILQ_FOREACH_SAFE(r, &sq->out_req_list, entry, next) {
         assert(r->aiocb);
-        blk_aio_cancel(r->aiocb);
+        blk_aio_cancel_async(r->aiocb);
     }
+    while (!QTAILQ_EMPTY(&sq->out_req_list)) {
+        aio_poll(ctx, true);
+    }
+}
+
+static void nvme_del_sq_bh(void *opaque)
+{
+    NvmeSQueue *sq = opaque;
+    NvmeCtrl *n = sq->ctrl;
+    NvmeRequest *r, *next;
+    NvmeCQueue *cq;
+
+    nvme_stop_sq(sq);
+    nvme_cancel_sq(sq);
 
     assert(QTAILQ_EMPTY(&sq->out_req_list));
 
@@ -4816,7 +4930,23 @@ static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
             }
         }
     }
+}
+
+static uint16_t nvme_del_sq(NvmeCtrl *n, NvmeRequest *req)
+{
+    NvmeDeleteQ *c = (NvmeDeleteQ *)&req->cmd;
+    NvmeSQueue *sq;
+    uint16_t qid = le16_to_cpu(c->qid);
+
+    if (unlikely(!qid || nvme_check_sqid(n, qid))) {
+        trace_pci_nvme_err_invalid_del_sq(qid);
+        return NVME_INVALID_QID | NVME_DNR;
+    }
 
+    trace_pci_nvme_del_sq(qid);
+
+    sq = n->sq[qid];
+    nvme_run_in_queue_ctx(n, qid, nvme_del_sq_bh, sq);
     nvme_free_sq(sq, n);
     return NVME_SUCCESS;
 }
@@ -4842,8 +4972,8 @@ static void nvme_init_sq(NvmeSQueue *sq, NvmeCtrl *n, uint64_t dma_addr,
         QTAILQ_INSERT_TAIL(&(sq->req_list), &sq->io_req[i], entry);
     }
 
-    sq->bh = qemu_bh_new_guarded(nvme_process_sq, sq,
-                                 &DEVICE(sq->ctrl)->mem_reentrancy_guard);
+    sq->bh = aio_bh_new_guarded(nvme_queue_ctx(n, sqid), nvme_process_sq, sq,
+                                &DEVICE(sq->ctrl)->mem_reentrancy_guard);
 
     if (n->dbbuf_enabled) {
         sq->db_addr = n->dbbuf_dbs + (sqid << 3);
@@ -5416,17 +5546,28 @@ static uint16_t nvme_get_log(NvmeCtrl *n, NvmeRequest *req)
     }
 }
 
+/* Stops the handlers of @cq; runs in the AioContext of the queue */
+static void nvme_stop_cq(void *opaque)
+{
+    NvmeCQueue *cq = opaque;
+
+    qemu_bh_cancel(cq->bh);
+    if (cq->ioeventfd_enabled) {
+        nvme_set_queue_notifier(cq->ctrl, cq->cqid, &cq->notifier, NULL);
+    }
+}
+
 static void nvme_free_cq(NvmeCQueue *cq, NvmeCtrl *n)
 {
     PCIDevice *pci = PCI_DEVICE(n);
     uint16_t offset = (cq->cqid << 3) + (1 << 2);
 
     n->cq[cq->cqid] = NULL;
+    nvme_run_in_queue_ctx(n, cq->cqid, nvme_stop_cq, cq);
     qemu_bh_delete(cq->bh);
     if (cq->ioeventfd_enabled) {
         memory_region_del_eventfd(&n->iomem,
                                   0x1000 + offset, 4, false, 0, &cq->notifier);
-        event_notifier_set_handler(&cq->notifier, NULL);
         event_notifier_cleanup(&cq->notifier);
     }
     if (msix_enabled(pci) && cq->irq_enabled) {
@@ -5495,8 +5636,8 @@ static void nvme_init_cq(NvmeCQueue *cq, NvmeCtrl *n, uint64_t dma_addr,
         }
     }
     n->cq[cqid] = cq;
-    cq->bh = qemu_bh_new_guarded(nvme_post_cqes, cq,
-                                 &DEVICE(cq->ctrl)->mem_reentrancy_guard);
+    cq->bh = aio_bh_new_guarded(nvme_queue_ctx(n, cqid), nvme_post_cqes, cq,
+                                &DEVICE(cq->ctrl)->mem_reentrancy_guard);
 }
 
 static uint16_t nvme_create_cq(NvmeCtrl *n, NvmeRequest *req)
@@ -7398,6 +7539,10 @@ static void nvme_process_sq(void *opaque)
     NvmeCmd cmd;
     NvmeRequest *req;
 
+    if (sq->sqid && n->ioqueues_stopped) {
+        return;
+    }
+
     if (n->dbbuf_enabled) {
         nvme_update_sq_tail(sq);
     }
@@ -7498,6 +7643,26 @@ static void nvme_activate_virt_res(NvmeCtrl *n)
     }
 }
 
+/*
+ * Keeps the I/O queues from starting new commands or posting completions;
+ * runs in the AioContext of the I/O queues.
+ */
+static void nvme_stop_ioqueues(void *opaque)
+{
+    NvmeCtrl *n = opaque;
+    int i;
+
+    n->ioqueues_stopped = true;
+    for (i = 1; i < n->params.max_ioqpairs + 1; i++) {
+        if (n->sq[i]) {
+            nvme_stop_sq(n->sq[i]);
+        }
+        if (n->cq[i]) {
+            nvme_stop_cq(n->cq[i]);
+        }
+    }
+}
+
 static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
 {
     PCIDevice *pci_dev = PCI_DEVICE(n);
@@ -7505,6 +7670,15 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
     NvmeNamespace *ns;
     int i;
 
+    /*
+     * With an IOThread, the I/O queues could otherwise keep submitting
+     * requests while the namespaces drain.  Stopping them again afterwards
+     * cancels completions that were scheduled during the drain.
+     */
+    if (n->iothread) {
+        aio_wait_bh_oneshot(n->ctx, nvme_stop_ioqueues, n);
+    }
+
     for (i = 1; i <= NVME_MAX_NAMESPACES; i++) {
         ns = nvme_ns(n, i);
         if (!ns) {
@@ -7514,6 +7688,10 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
         nvme_ns_drain(ns);
     }
 
+    if (n->iothread) {
+        aio_wait_bh_oneshot(n->ctx, nvme_stop_ioqueues, n);
+    }
+
     for (i = 0; i < n->params.max_ioqpairs + 1; i++) {
         if (n->sq[i] != NULL) {
             nvme_free_sq(n->sq[i], n);
@@ -7568,6 +7746,9 @@ static void nvme_ctrl_reset(NvmeCtrl *n, NvmeResetType rst)
     n->dbbuf_dbs = 0;
     n->dbbuf_eis = 0;
     n->dbbuf_enabled = false;
+
+    /* There are no I/O queues left */
+    n->ioqueues_stopped = false;
 }
 
 static void nvme_ctrl_shutdown(NvmeCtrl *n)
@@ -8848,12 +9029,21 @@ static void nvme_realize(PCIDevice *pci_dev, Error **errp)
          * this out.
          */
         object_ref(OBJECT(pn->subsys));
+
+        /* Same as above */
+        n->iothread = pn->iothread;
+        if (n->iothread) {
+            object_ref(OBJECT(n->iothread));
+        }
     }
 
     if (!nvme_check_params(n, errp)) {
         return;
     }
 
+    n->ctx = n->iothread ? iothread_get_aio_context(n->iothread) :
+                           qemu_get_aio_context();
+
     qbus_init(&n->bus, sizeof(NvmeBus), TYPE_NVME_BUS, dev, dev->id);
 
     if (nvme_init_subsys(n, errp)) {
@@ -8933,6 +9123,8 @@ static Property nvme_props[] = {
                      HostMemoryBackend *),
     DEFINE_PROP_LINK("subsys", NvmeCtrl, subsys, TYPE_NVME_SUBSYS,
                      NvmeSubsystem *),
+    DEFINE_PROP_LINK("iothread", NvmeCtrl, iothread, TYPE_IOTHREAD,
+                     IOThread *),
     DEFINE_PROP_STRING("serial", NvmeCtrl, params.serial),
     DEFINE_PROP_UINT32("cmb_size_mb", NvmeCtrl, params.cmb_size_mb, 0),
     DEFINE_PROP_UINT32("num_queues", NvmeCtrl, params.num_queues, 0),
@@ -21,6 +21,7 @@
 #include "qemu/uuid.h"
 #include "hw/pci/pci_device.h"
 #include "hw/block/block.h"
+#include "sysemu/iothread.h"
 
 #include "block/nvme.h"
 
@@ -583,6 +584,14 @@ typedef struct NvmeCtrl {
     uint64_t    dbbuf_eis;
     bool        dbbuf_enabled;
 
+    /*
+     * I/O queues run in the AioContext of @iothread if set; the admin
+     * queue always runs in the main loop.
+     */
+    IOThread    *iothread;
+    AioContext  *ctx;
+    bool        ioqueues_stopped;   /* accessed in @ctx only */
+
     struct {
         MemoryRegion mem;
         uint8_t      *buf;
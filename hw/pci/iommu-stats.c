@@ -0,0 +1,158 @@
+/*
+ * Translation statistics of PCI IOMMUs
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "hw/pci/iommu-stats.h"
+#include "hw/pci/pci.h"
+#include "qemu/main-loop.h"
+#include "sysemu/stats.h"
+
+#define IOMMU_STAT_TRANSLATIONS         "translations"
+#define IOMMU_STAT_IOTLB_HITS           "iotlb-hits"
+#define IOMMU_STAT_PAGE_WALKS           "page-walks"
+#define IOMMU_STAT_CONTEXT_MISSES       "context-misses"
+#define IOMMU_STAT_FAULTS               "faults"
+#define IOMMU_STAT_INVALIDATIONS        "invalidations"
+#define IOMMU_STAT_INVALIDATION_TIME    "invalidation-time"
+#define IOMMU_STAT_SOURCE_ID            "source-id"
+
+/* Protected by the BQL. */
+static QTAILQ_HEAD(, IOMMUStats) iommu_stats =
+    QTAILQ_HEAD_INITIALIZER(iommu_stats);
+
+static StatsList *iommu_stats_add(StatsList *list, strList *names,
+                                  const char *name, uint64_t val)
+{
+    Stats *stats;
+
+    if (!apply_str_list_filter(name, names)) {
+        return list;
+    }
+    stats = g_new0(Stats, 1);
+    stats->name = g_strdup(name);
+    stats->value = g_new0(StatsValue, 1);
+    stats->value->type = QTYPE_QNUM;
+    stats->value->u.scalar = val;
+    QAPI_LIST_PREPEND(list, stats);
+    return list;
+}
+
+static void iommu_stats_cb(StatsResultList **result, StatsTarget target,
+                           strList *names, strList *targets, Error **errp)
+{
+    IOMMUStats *stats;
+
+    if (target != STATS_TARGET_IOMMU) {
+        return;
+    }
+    QTAILQ_FOREACH(stats, &iommu_stats, next) {
+        Object *obj = stats->owner;
+        StatsList *list = NULL;
+        g_autofree char *path = NULL;
+
+        if (stats->bus) {
+            PCIDevice *dev = pci_find_device(stats->bus,
+                                             pci_bus_num(stats->bus),
+                                             stats->devfn);
+            if (!dev) {
+                continue;
+            }
+            obj = OBJECT(dev);
+            list = iommu_stats_add(list, names, IOMMU_STAT_SOURCE_ID,
+                                   PCI_BUILD_BDF(pci_bus_num(stats->bus),
+                                                 stats->devfn));
+        }
+        list = iommu_stats_add(list, names, IOMMU_STAT_INVALIDATION_TIME,
+                               stat64_get(&stats->invalidation_time));
+        list = iommu_stats_add(list, names, IOMMU_STAT_INVALIDATIONS,
+                               stat64_get(&stats->invalidations));
+        list = iommu_stats_add(list, names, IOMMU_STAT_FAULTS,
+                               stat64_get(&stats->faults));
+        list = iommu_stats_add(list, names, IOMMU_STAT_CONTEXT_MISSES,
+                               stat64_get(&stats->context_misses));
+        list = iommu_stats_add(list, names, IOMMU_STAT_PAGE_WALKS,
+                               stat64_get(&stats->page_walks));
+        list = iommu_stats_add(list, names, IOMMU_STAT_IOTLB_HITS,
+                               stat64_get(&stats->iotlb_hits));
+        list = iommu_stats_add(list, names, IOMMU_STAT_TRANSLATIONS,
+                               stat64_get(&stats->translations));
+        if (!list) {
+            continue;
+        }
+        path = object_get_canonical_path(obj);
+        add_stats_entry(result, STATS_PROVIDER_IOMMU, path, list);
+    }
+}
+
+/* STATS_UNIT__MAX stands for a plain count. */
+static StatsSchemaValueList *iommu_schemas_add(StatsSchemaValueList *list,
+                                               const char *name,
+                                               StatsType type,
+                                               StatsUnit unit, int exponent)
+{
+    StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+    value->name = g_strdup(name);
+    value->type = type;
+    if (unit != STATS_UNIT__MAX) {
+        value->has_unit = true;
+        value->unit = unit;
+    }
+    if (exponent) {
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = exponent;
+    }
+    QAPI_LIST_PREPEND(list, value);
+    return list;
+}
+
+static void iommu_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    list = iommu_schemas_add(list, IOMMU_STAT_SOURCE_ID, STATS_TYPE_INSTANT,
+                             STATS_UNIT__MAX, 0);
+    list = iommu_schemas_add(list, IOMMU_STAT_INVALIDATION_TIME,
+                             STATS_TYPE_CUMULATIVE, STATS_UNIT_SECONDS, -9);
+    list = iommu_schemas_add(list, IOMMU_STAT_INVALIDATIONS,
+                             STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = iommu_schemas_add(list, IOMMU_STAT_FAULTS,
+                             STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = iommu_schemas_add(list, IOMMU_STAT_CONTEXT_MISSES,
+                             STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = iommu_schemas_add(list, IOMMU_STAT_PAGE_WALKS,
+                             STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = iommu_schemas_add(list, IOMMU_STAT_IOTLB_HITS,
+                             STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    list = iommu_schemas_add(list, IOMMU_STAT_TRANSLATIONS,
+                             STATS_TYPE_CUMULATIVE, STATS_UNIT__MAX, 0);
+    add_stats_schema(result, STATS_PROVIDER_IOMMU, STATS_TARGET_IOMMU, list);
+}
+
+void iommu_stats_register(IOMMUStats *stats, Object *owner, PCIBus *bus,
+                          int devfn)
+{
+    static bool registered;
+
+    assert(bql_locked());
+    if (!registered) {
+        add_stats_callbacks(STATS_PROVIDER_IOMMU, iommu_stats_cb,
+                            iommu_schemas_cb);
+        registered = true;
+    }
+    stats->owner = owner;
+    stats->bus = bus;
+    stats->devfn = devfn;
+    QTAILQ_INSERT_TAIL(&iommu_stats, stats, next);
+}
+
+void iommu_stats_unregister(IOMMUStats *stats)
+{
+    assert(bql_locked());
+    QTAILQ_REMOVE(&iommu_stats, stats, next);
+}
@@ -41,6 +41,7 @@
 #include "hw/loader.h"
 #include "qemu/error-report.h"
 #include "qemu/range.h"
+#include "exec/target_page.h"
 #include "trace.h"
 #include "hw/pci/msi.h"
 #include "hw/pci/msix.h"
@@ -2479,6 +2480,10 @@ int pci_add_capability(PCIDevice *pdev, uint8_t cap_id,
     config[PCI_CAP_LIST_NEXT] = pdev->config[PCI_CAPABILITY_LIST];
     pdev->config[PCI_CAPABILITY_LIST] = offset;
     pdev->config[PCI_STATUS] |= PCI_STATUS_CAP_LIST;
+    if (cap_id <= PCI_CAP_ID_MAX) {
+        /* The list is searched from its head, where the new one is. */
+        pdev->cap_offsets[cap_id] = offset;
+    }
     memset(pdev->used + offset, 0xFF, QEMU_ALIGN_UP(size, 4));
     /* Make capability read-only by default */
     memset(pdev->wmask + offset, 0, size);
@@ -2503,10 +2508,26 @@ void pci_del_capability(PCIDevice *pdev, uint8_t cap_id, uint8_t size)
 
     if (!pdev->config[PCI_CAPABILITY_LIST])
         pdev->config[PCI_STATUS] &= ~PCI_STATUS_CAP_LIST;
+
+    if (cap_id <= PCI_CAP_ID_MAX) {
+        pdev->cap_offsets[cap_id] = 0;
+        offset = pci_find_capability_list(pdev, cap_id, NULL);
+        if (offset && pdev->used[offset]) {
+            pdev->cap_offsets[cap_id] = offset;
+        }
+    }
 }
 
 uint8_t pci_find_capability(PCIDevice *pdev, uint8_t cap_id)
 {
+    /*
+     * Capabilities that were not added with pci_add_capability(), such as
+     * those of a config space copied from an assigned device, and missing
+     * ones still need the walk.
+     */
+    if (cap_id <= PCI_CAP_ID_MAX && pdev->cap_offsets[cap_id]) {
+        return pdev->cap_offsets[cap_id];
+    }
     return pci_find_capability_list(pdev, cap_id, NULL);
 }
 
@@ -2767,6 +2788,22 @@ AddressSpace *pci_device_iommu_address_space(PCIDevice *dev)
     return &address_space_memory;
 }
 
+AddressSpace *pci_device_iommu_address_space_pasid(PCIDevice *dev,
+                                                   uint32_t pasid)
+{
+    PCIBus *bus;
+    PCIBus *iommu_bus;
+    int devfn;
+
+    assert(pasid < PCI_NO_PASID);
+    pci_device_get_iommu_bus_devfn(dev, &iommu_bus, &bus, &devfn);
+    if (iommu_bus && iommu_bus->iommu_ops->get_address_space_pasid) {
+        return iommu_bus->iommu_ops->get_address_space_pasid(bus,
+                                 iommu_bus->iommu_opaque, devfn, pasid);
+    }
+    return NULL;
+}
+
 bool pci_device_set_iommu_device(PCIDevice *dev, HostIOMMUDevice *hiod,
                                  Error **errp)
 {
@@ -2798,6 +2835,109 @@ void pci_device_unset_iommu_device(PCIDevice *dev)
     }
 }
 
+/* The IOMMU region that translates DMA through @mr, if there is one. */
+static IOMMUMemoryRegion *pci_iommu_find_region(MemoryRegion *mr)
+{
+    IOMMUMemoryRegion *iommu_mr = memory_region_get_iommu(mr);
+    MemoryRegion *sub;
+
+    if (iommu_mr) {
+        return iommu_mr;
+    }
+    while (mr->alias) {
+        mr = mr->alias;
+    }
+    QTAILQ_FOREACH(sub, &mr->subregions, subregions_link) {
+        iommu_mr = pci_iommu_find_region(sub);
+        if (iommu_mr) {
+            return iommu_mr;
+        }
+    }
+    return NULL;
+}
+
+ssize_t pci_ats_request_translation(PCIDevice *dev, hwaddr addr,
+                                    hwaddr length, bool no_write,
+                                    IOMMUTLBEntry *result,
+                                    size_t result_length)
+{
+    AddressSpace *as = pci_device_iommu_address_space(dev);
+    const IOMMUAccessFlags flag = no_write ? IOMMU_RO : IOMMU_RW;
+    const hwaddr page_mask = qemu_target_page_size() - 1;
+    const hwaddr last = addr + length - 1;
+    ssize_t count = 0;
+
+    if (!pcie_ats_enabled(dev)) {
+        return -EPERM;
+    }
+    if (!length || last < addr) {
+        return -EINVAL;
+    }
+
+    RCU_READ_LOCK_GUARD();
+    while (count < result_length) {
+        IOMMUTLBEntry *entry = &result[count++];
+        MemoryRegionSection section = memory_region_find(as->root, addr, 1);
+        IOMMUMemoryRegion *iommu_mr =
+            section.mr ? memory_region_get_iommu(section.mr) : NULL;
+
+        if (iommu_mr) {
+            IOMMUMemoryRegionClass *imrc =
+                memory_region_get_iommu_class_nocheck(iommu_mr);
+            hwaddr base = addr - section.offset_within_region;
+
+            *entry = imrc->translate(iommu_mr, section.offset_within_region,
+                                     flag,
+                                     memory_region_iommu_attrs_to_index(
+                                         iommu_mr, MEMTXATTRS_UNSPECIFIED));
+            entry->iova += base;
+        } else {
+            /* DMA that is not remapped translates to itself. */
+            *entry = (IOMMUTLBEntry) {
+                .target_as = as,
+                .iova = addr & ~page_mask,
+                .translated_addr = addr & ~page_mask,
+                .addr_mask = page_mask,
+                .perm = section.mr ? IOMMU_RW : IOMMU_NONE,
+            };
+        }
+        if (section.mr) {
+            memory_region_unref(section.mr);
+        }
+        if (entry->perm == IOMMU_NONE ||
+            (entry->iova | entry->addr_mask) >= last) {
+            break;
+        }
+        addr = (entry->iova | entry->addr_mask) + 1;
+    }
+    return count;
+}
+
+int pci_iommu_register_iotlb_notifier(PCIDevice *dev, IOMMUNotifier *n,
+                                      Error **errp)
+{
+    IOMMUMemoryRegion *iommu_mr =
+        pci_iommu_find_region(pci_device_iommu_address_space(dev)->root);
+
+    if (!iommu_mr) {
+        error_setg(errp, "DMA of %s is not translated by an IOMMU",
+                   dev->name);
+        return -ENODEV;
+    }
+    return memory_region_register_iommu_notifier(MEMORY_REGION(iommu_mr), n,
+                                                 errp);
+}
+
+void pci_iommu_unregister_iotlb_notifier(PCIDevice *dev, IOMMUNotifier *n)
+{
+    IOMMUMemoryRegion *iommu_mr =
+        pci_iommu_find_region(pci_device_iommu_address_space(dev)->root);
+
+    if (iommu_mr) {
+        memory_region_unregister_iommu_notifier(MEMORY_REGION(iommu_mr), n);
+    }
+}
+
 void pci_setup_iommu(PCIBus *bus, const PCIIOMMUOps *ops, void *opaque)
 {
     /*
@@ -1177,6 +1177,42 @@ void pcie_ats_init(PCIDevice *dev, uint16_t offset, bool aligned)
     pci_set_word(dev->wmask + dev->exp.ats_cap + PCI_ATS_CTRL, 0x800f);
 }
 
+bool pcie_ats_enabled(const PCIDevice *dev)
+{
+    if (!pci_is_express(dev) || !dev->exp.ats_cap) {
+        return false;
+    }
+    return pci_get_word(dev->config + dev->exp.ats_cap + PCI_ATS_CTRL) &
+           PCI_ATS_CTRL_ENABLE;
+}
+
+/* PASID, @width is the number of PASID bits the device supports */
+void pcie_pasid_init(PCIDevice *dev, uint16_t offset, uint8_t width)
+{
+    assert(width >= 1 && width <= 20);
+
+    pcie_add_capability(dev, PCI_EXT_CAP_ID_PASID, 0x1,
+                        offset, PCI_EXT_CAP_PASID_SIZEOF);
+
+    dev->exp.pasid_cap = offset;
+
+    /* Neither execute permission nor privileged mode, disabled by default */
+    pci_set_word(dev->config + offset + PCI_PASID_CAP,
+                 (width << 8) & PCI_PASID_CAP_WIDTH);
+    pci_set_word(dev->config + offset + PCI_PASID_CTRL, 0);
+
+    pci_set_word(dev->wmask + offset + PCI_PASID_CTRL, PCI_PASID_CTRL_ENABLE);
+}
+
+bool pcie_pasid_enabled(const PCIDevice *dev)
+{
+    if (!pci_is_express(dev) || !dev->exp.pasid_cap) {
+        return false;
+    }
+    return pci_get_word(dev->config + dev->exp.pasid_cap + PCI_PASID_CTRL) &
+           PCI_PASID_CTRL_ENABLE;
+}
+
 /* ACS (Access Control Services) */
 void pcie_acs_init(PCIDevice *dev, uint16_t offset)
 {
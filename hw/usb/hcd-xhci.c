@@ -136,6 +136,21 @@ typedef struct XHCITRB {
     bool ccs;
 } XHCITRB;
 
+/* Read ahead at most this much of a ring, and never across a page */
+#define TRB_CACHE_SIZE  1024
+#define TRB_CACHE_ALIGN 4096
+
+/*
+ * TRBs read from a ring in one go, for the duration of one pass over the
+ * ring.  A TRB the guest handed over is never changed until we are done
+ * with it, so the only stale TRBs are the ones that were not ours yet.
+ */
+typedef struct XHCITRBCache {
+    dma_addr_t base;
+    dma_addr_t len;
+    uint8_t buf[TRB_CACHE_SIZE];
+} XHCITRBCache;
+
 enum {
     PLS_U0              =  0,
     PLS_U1              =  1,
@@ -683,24 +698,76 @@ static void xhci_ring_init(XHCIState *xhci, XHCIRing *ring,
     ring->ccs = 1;
 }
 
-static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
+static MemTxResult xhci_trb_cache_fill(XHCIState *xhci, XHCITRBCache *cache,
+                                       dma_addr_t addr)
+{
+    dma_addr_t len = TRB_CACHE_ALIGN - (addr & (TRB_CACHE_ALIGN - 1));
+
+    len = MAX(MIN(len, TRB_CACHE_SIZE), TRB_SIZE);
+    cache->base = addr;
+    cache->len = 0;
+    if (len > TRB_SIZE &&
+        dma_memory_read(xhci->as, addr, cache->buf, len,
+                        MEMTXATTRS_UNSPECIFIED) == MEMTX_OK) {
+        cache->len = len;
+        return MEMTX_OK;
+    }
+    /* Whatever follows the TRB may not be readable, that's fine */
+    if (dma_memory_read(xhci->as, addr, cache->buf, TRB_SIZE,
+                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        return MEMTX_ERROR;
+    }
+    cache->len = TRB_SIZE;
+    return MEMTX_OK;
+}
+
+/*
+ * Read the TRB at @addr through @cache, refreshing it if the TRB seems
+ * not to belong to cycle state @ccs yet.
+ */
+static MemTxResult xhci_trb_read(XHCIState *xhci, XHCITRBCache *cache,
+                                 dma_addr_t addr, bool ccs, XHCITRB *trb)
+{
+    bool fresh = false;
+
+    if (addr < cache->base || addr - cache->base + TRB_SIZE > cache->len) {
+        if (xhci_trb_cache_fill(xhci, cache, addr) != MEMTX_OK) {
+            return MEMTX_ERROR;
+        }
+        fresh = true;
+    }
+
+    for (;;) {
+        memcpy(trb, cache->buf + (addr - cache->base), TRB_SIZE);
+        le64_to_cpus(&trb->parameter);
+        le32_to_cpus(&trb->status);
+        le32_to_cpus(&trb->control);
+        if (fresh || (trb->control & TRB_C) == ccs) {
+            return MEMTX_OK;
+        }
+        if (xhci_trb_cache_fill(xhci, cache, addr) != MEMTX_OK) {
+            return MEMTX_ERROR;
+        }
+        fresh = true;
+    }
+}
+
+static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring,
+                               XHCITRBCache *cache, XHCITRB *trb,
                                dma_addr_t *addr)
 {
     uint32_t link_cnt = 0;
 
     while (1) {
         TRBType type;
-        if (dma_memory_read(xhci->as, ring->dequeue, trb, TRB_SIZE,
-                            MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (xhci_trb_read(xhci, cache, ring->dequeue, ring->ccs,
+                          trb) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return 0;
         }
         trb->addr = ring->dequeue;
         trb->ccs = ring->ccs;
-        le64_to_cpus(&trb->parameter);
-        le32_to_cpus(&trb->status);
-        le32_to_cpus(&trb->control);
 
         trace_usb_xhci_fetch_trb(ring->dequeue, trb_name(trb),
                                  trb->parameter, trb->status, trb->control);
@@ -730,7 +797,8 @@ static TRBType xhci_ring_fetch(XHCIState *xhci, XHCIRing *ring, XHCITRB *trb,
     }
 }
 
-static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
+static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring,
+                                  XHCITRBCache *cache)
 {
     XHCITRB trb;
     int length = 0;
@@ -742,15 +810,11 @@ static int xhci_ring_chain_length(XHCIState *xhci, const XHCIRing *ring)
 
     do {
         TRBType type;
-        if (dma_memory_read(xhci->as, dequeue, &trb, TRB_SIZE,
-                        MEMTXATTRS_UNSPECIFIED) != MEMTX_OK) {
+        if (xhci_trb_read(xhci, cache, dequeue, ccs, &trb) != MEMTX_OK) {
             qemu_log_mask(LOG_GUEST_ERROR, "%s: DMA memory access failed!\n",
                           __func__);
             return -1;
         }
-        le64_to_cpus(&trb.parameter);
-        le32_to_cpus(&trb.status);
-        le32_to_cpus(&trb.control);
 
         if ((trb.control & TRB_C) != ccs) {
             return -length;
@@ -1427,6 +1491,19 @@ static TRBCCode xhci_set_ep_dequeue(XHCIState *xhci, unsigned int slotid,
     return CC_SUCCESS;
 }
 
+/* Add to @sgl, growing the last entry instead if @base directly follows it */
+static void xhci_sglist_add(QEMUSGList *sgl, dma_addr_t base, dma_addr_t len)
+{
+    ScatterGatherEntry *last = sgl->nsg ? &sgl->sg[sgl->nsg - 1] : NULL;
+
+    if (last && last->base + last->len == base) {
+        last->len += len;
+        sgl->size += len;
+        return;
+    }
+    qemu_sglist_add(sgl, base, len);
+}
+
 static int xhci_xfer_create_sgl(XHCITransfer *xfer, int in_xfer)
 {
     XHCIState *xhci = xfer->epctx->xhci;
@@ -1461,7 +1538,7 @@ static int xhci_xfer_create_sgl(XHCITransfer *xfer, int in_xfer)
                 }
                 qemu_sglist_add(&xfer->sgl, trb->addr, chunk);
             } else {
-                qemu_sglist_add(&xfer->sgl, addr, chunk);
+                xhci_sglist_add(&xfer->sgl, addr, chunk);
             }
             break;
         }
@@ -1870,6 +1947,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
     XHCIStreamContext *stctx = NULL;
     XHCITransfer *xfer;
     XHCIRing *ring;
+    XHCITRBCache cache = {};
     USBEndpoint *ep = NULL;
     uint64_t mfindex;
     unsigned int count = 0;
@@ -1954,7 +2032,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
 
     epctx->kick_active++;
     while (1) {
-        length = xhci_ring_chain_length(xhci, ring);
+        length = xhci_ring_chain_length(xhci, ring, &cache);
         if (length <= 0) {
             if (epctx->type == ET_ISO_OUT || epctx->type == ET_ISO_IN) {
                 /* 4.10.3.1 */
@@ -1975,7 +2053,7 @@ static void xhci_kick_epctx(XHCIEPContext *epctx, unsigned int streamid)
 
         for (i = 0; i < length; i++) {
             TRBType type;
-            type = xhci_ring_fetch(xhci, ring, &xfer->trbs[i], NULL);
+            type = xhci_ring_fetch(xhci, ring, &cache, &xfer->trbs[i], NULL);
             if (!type) {
                 xhci_die(xhci);
                 xhci_ep_free_xfer(xfer);
@@ -2464,6 +2542,7 @@ static uint32_t xhci_nec_challenge(uint32_t hi, uint32_t lo)
 static void xhci_process_commands(XHCIState *xhci)
 {
     XHCITRB trb;
+    XHCITRBCache cache = {};
     TRBType type;
     XHCIEvent event = {ER_COMMAND_COMPLETE, CC_SUCCESS};
     dma_addr_t addr;
@@ -2477,7 +2556,8 @@ static void xhci_process_commands(XHCIState *xhci)
 
     xhci->crcr_low |= CRCR_CRR;
 
-    while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &trb, &addr))) {
+    while ((type = xhci_ring_fetch(xhci, &xhci->cmd_ring, &cache, &trb,
+                                   &addr))) {
         event.ptr = addr;
         switch (type) {
         case CR_ENABLE_SLOT:
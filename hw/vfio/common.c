@@ -564,6 +564,167 @@ static bool vfio_get_section_iova_range(VFIOContainerBase *bcontainer,
     return true;
 }
 
+/*
+ * While the listener replays the address space of a container that is
+ * being set up, RAM sections are not mapped one by one: runs of sections
+ * that are contiguous both in IOVA and in host memory, such as the pieces
+ * of a RAM block split by aliases, are mapped with a single ioctl when the
+ * transaction commits.  A run that covered more than one section is kept
+ * in dma_extents, because neither type1v2 nor iommufd unmap part of a
+ * mapping; deleting one of its sections later remaps what is left.
+ */
+typedef struct VFIODMAExtent {
+    hwaddr iova;
+    ram_addr_t size;
+    void *vaddr;
+    bool readonly;
+    unsigned int sections;
+} VFIODMAExtent;
+
+static bool vfio_dma_extent_extends(const VFIODMAExtent *ext, hwaddr iova,
+                                    void *vaddr, bool readonly)
+{
+    return ext->iova + ext->size == iova &&
+           ext->vaddr + ext->size == vaddr &&
+           ext->readonly == readonly;
+}
+
+static void vfio_listener_queue_map(VFIOContainerBase *bcontainer,
+                                    hwaddr iova, ram_addr_t size,
+                                    void *vaddr, bool readonly)
+{
+    GArray *batch = bcontainer->dma_batch;
+    VFIODMAExtent ext = {
+        .iova = iova, .size = size, .vaddr = vaddr,
+        .readonly = readonly, .sections = 1,
+    };
+
+    if (batch->len) {
+        VFIODMAExtent *last = &g_array_index(batch, VFIODMAExtent,
+                                             batch->len - 1);
+
+        if (vfio_dma_extent_extends(last, iova, vaddr, readonly)) {
+            last->size += size;
+            last->sections++;
+            return;
+        }
+    }
+    g_array_append_val(batch, ext);
+}
+
+static void vfio_listener_begin(MemoryListener *listener)
+{
+    VFIOContainerBase *bcontainer = container_of(listener, VFIOContainerBase,
+                                                 listener);
+
+    if (!bcontainer->initialized && !bcontainer->dma_batch) {
+        bcontainer->dma_batch = g_array_new(false, false,
+                                            sizeof(VFIODMAExtent));
+    }
+}
+
+static void vfio_listener_commit(MemoryListener *listener)
+{
+    VFIOContainerBase *bcontainer = container_of(listener, VFIOContainerBase,
+                                                 listener);
+    g_autoptr(GArray) batch = g_steal_pointer(&bcontainer->dma_batch);
+    guint i;
+    int ret;
+
+    if (!batch) {
+        return;
+    }
+
+    for (i = 0; i < batch->len; i++) {
+        VFIODMAExtent *ext = &g_array_index(batch, VFIODMAExtent, i);
+
+        trace_vfio_listener_commit_map(ext->iova, ext->size, ext->sections);
+        ret = vfio_container_dma_map(bcontainer, ext->iova, ext->size,
+                                     ext->vaddr, ext->readonly);
+        if (ret) {
+            if (!bcontainer->error) {
+                error_setg(&bcontainer->error,
+                           "vfio_container_dma_map(%p, 0x%"HWADDR_PRIx", "
+                           "0x%"HWADDR_PRIx", %p) = %d (%s)",
+                           bcontainer, ext->iova, ext->size, ext->vaddr,
+                           ret, strerror(-ret));
+            }
+            continue;
+        }
+        if (ext->sections > 1) {
+            bcontainer->dma_extents = g_list_prepend(bcontainer->dma_extents,
+                                                     g_memdup2(ext,
+                                                               sizeof(*ext)));
+        }
+    }
+}
+
+static void vfio_dma_extent_remap(VFIOContainerBase *bcontainer, hwaddr iova,
+                                  ram_addr_t size, void *vaddr, bool readonly)
+{
+    VFIODMAExtent *ext;
+    int ret;
+
+    if (!size) {
+        return;
+    }
+    ret = vfio_container_dma_map(bcontainer, iova, size, vaddr, readonly);
+    if (ret) {
+        error_report("vfio_container_dma_map(%p, 0x%"HWADDR_PRIx", "
+                     "0x%"HWADDR_PRIx", %p) = %d (%s)",
+                     bcontainer, iova, size, vaddr, ret, strerror(-ret));
+        hw_error("vfio: DMA mapping failed, unable to continue");
+    }
+
+    /* What is left may still span several sections. */
+    ext = g_new(VFIODMAExtent, 1);
+    *ext = (VFIODMAExtent) {
+        .iova = iova, .size = size, .vaddr = vaddr,
+        .readonly = readonly, .sections = 2,
+    };
+    bcontainer->dma_extents = g_list_prepend(bcontainer->dma_extents, ext);
+}
+
+/*
+ * Unmap [@iova, @iova + @size) if it lies within a coalesced extent, and
+ * map the rest of the extent again.  Returns false if no extent covers
+ * the range and the caller has to unmap it itself.
+ */
+static bool vfio_dma_extent_unmap(VFIOContainerBase *bcontainer,
+                                  hwaddr iova, ram_addr_t size)
+{
+    VFIODMAExtent *ext = NULL;
+    hwaddr end;
+    GList *l;
+    int ret;
+
+    for (l = bcontainer->dma_extents; l; l = l->next) {
+        ext = l->data;
+        if (ext->iova <= iova && iova - ext->iova < ext->size) {
+            break;
+        }
+    }
+    if (!l) {
+        return false;
+    }
+    bcontainer->dma_extents = g_list_delete_link(bcontainer->dma_extents, l);
+
+    end = MIN(iova + size, ext->iova + ext->size);
+    trace_vfio_dma_extent_unmap(ext->iova, ext->size, iova, end - iova);
+    ret = vfio_container_dma_unmap(bcontainer, ext->iova, ext->size, NULL);
+    if (ret) {
+        error_report("vfio_container_dma_unmap(%p, 0x%"HWADDR_PRIx", "
+                     "0x%"HWADDR_PRIx") = %d (%s)",
+                     bcontainer, ext->iova, ext->size, ret, strerror(-ret));
+    }
+    vfio_dma_extent_remap(bcontainer, ext->iova, iova - ext->iova,
+                          ext->vaddr, ext->readonly);
+    vfio_dma_extent_remap(bcontainer, end, ext->iova + ext->size - end,
+                          ext->vaddr + (end - ext->iova), ext->readonly);
+    g_free(ext);
+    return end == iova + size;
+}
+
 static void vfio_listener_region_add(MemoryListener *listener,
                                      MemoryRegionSection *section)
 {
@@ -670,6 +831,12 @@ static void vfio_listener_region_add(MemoryListener *listener,
         }
     }
 
+    if (bcontainer->dma_batch && !memory_region_is_ram_device(section->mr)) {
+        vfio_listener_queue_map(bcontainer, iova, int128_get64(llsize),
+                                vaddr, section->readonly);
+        return;
+    }
+
     ret = vfio_container_dma_map(bcontainer, iova, int128_get64(llsize),
                                  vaddr, section->readonly);
     if (ret) {
@@ -767,6 +934,9 @@ static void vfio_listener_region_del(MemoryListener *listener,
         vfio_unregister_ram_discard_listener(bcontainer, section);
         /* Unregistering will trigger an unmap. */
         try_unmap = false;
+    } else if (bcontainer->dma_extents) {
+        try_unmap = !vfio_dma_extent_unmap(bcontainer, iova,
+                                           int128_get64(llsize));
     }
 
     if (try_unmap) {
@@ -924,6 +1094,138 @@ static void vfio_dirty_tracking_init(VFIOContainerBase *bcontainer,
     memory_listener_unregister(&dirty.listener);
 }
 
+static int vfio_device_dma_logging_report(VFIODevice *vbasedev, hwaddr iova,
+                                          hwaddr size, void *bitmap)
+{
+    uint64_t buf[DIV_ROUND_UP(sizeof(struct vfio_device_feature) +
+                        sizeof(struct vfio_device_feature_dma_logging_report),
+                        sizeof(uint64_t))] = {};
+    struct vfio_device_feature *feature = (struct vfio_device_feature *)buf;
+    struct vfio_device_feature_dma_logging_report *report =
+        (struct vfio_device_feature_dma_logging_report *)feature->data;
+
+    report->iova = iova;
+    report->length = size;
+    report->page_size = qemu_real_host_page_size();
+    report->bitmap = (uintptr_t)bitmap;
+
+    feature->argsz = sizeof(buf);
+    feature->flags = VFIO_DEVICE_FEATURE_GET |
+                     VFIO_DEVICE_FEATURE_DMA_LOGGING_REPORT;
+
+    if (ioctl(vbasedev->fd, VFIO_DEVICE_FEATURE, feature)) {
+        return -errno;
+    }
+
+    return 0;
+}
+
+/*
+ * With device dirty tracking, each device of a container reports its own
+ * bitmap.  While logging is on, a pool of threads queries the devices of
+ * a section in parallel, each into its own bitmap since the kernel does
+ * not set bits atomically; the caller takes part and ORs the bitmaps
+ * together before they are merged into the RAMBlock dirty bitmaps.
+ */
+typedef struct VFIODirtyQuery {
+    VFIODevice *vbasedev;
+    hwaddr iova;
+    hwaddr size;
+    unsigned long *bitmap;
+    int ret;
+} VFIODirtyQuery;
+
+struct VFIODirtyPool {
+    QemuThread *threads;
+    unsigned int nr_threads;
+    QemuSemaphore work_sem;     /* Posted once per thread for each batch */
+    QemuSemaphore done_sem;     /* Posted by each thread when it is done */
+    VFIODirtyQuery *queries;
+    unsigned int nr_queries;
+    unsigned int next;          /* Next query to claim, atomic */
+    bool exit;
+};
+
+static void vfio_dirty_pool_run(VFIODirtyPool *pool)
+{
+    unsigned int i;
+
+    while ((i = qatomic_fetch_inc(&pool->next)) < pool->nr_queries) {
+        VFIODirtyQuery *q = &pool->queries[i];
+
+        q->ret = vfio_device_dma_logging_report(q->vbasedev, q->iova,
+                                                q->size, q->bitmap);
+    }
+}
+
+static void *vfio_dirty_pool_thread(void *opaque)
+{
+    VFIODirtyPool *pool = opaque;
+
+    for (;;) {
+        qemu_sem_wait(&pool->work_sem);
+        if (pool->exit) {
+            break;
+        }
+        vfio_dirty_pool_run(pool);
+        qemu_sem_post(&pool->done_sem);
+    }
+    return NULL;
+}
+
+static void vfio_dirty_pool_create(VFIOContainerBase *bcontainer)
+{
+    VFIODirtyPool *pool;
+    VFIODevice *vbasedev;
+    unsigned int nr_devices = 0, i;
+
+    QLIST_FOREACH(vbasedev, &bcontainer->device_list, container_next) {
+        nr_devices++;
+    }
+    if (nr_devices < 2) {
+        return;
+    }
+
+    /* The caller queries devices as well. */
+    pool = g_new0(VFIODirtyPool, 1);
+    pool->nr_threads = MIN(nr_devices, MAX(g_get_num_processors(), 1)) - 1;
+    if (!pool->nr_threads) {
+        g_free(pool);
+        return;
+    }
+    pool->threads = g_new(QemuThread, pool->nr_threads);
+    pool->queries = g_new0(VFIODirtyQuery, nr_devices);
+    qemu_sem_init(&pool->work_sem, 0);
+    qemu_sem_init(&pool->done_sem, 0);
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_thread_create(&pool->threads[i], "vfio_dirty",
+                           vfio_dirty_pool_thread, pool, QEMU_THREAD_JOINABLE);
+    }
+    bcontainer->dirty_pool = pool;
+}
+
+static void vfio_dirty_pool_destroy(VFIOContainerBase *bcontainer)
+{
+    VFIODirtyPool *pool = g_steal_pointer(&bcontainer->dirty_pool);
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+    pool->exit = true;
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+    qemu_sem_destroy(&pool->work_sem);
+    qemu_sem_destroy(&pool->done_sem);
+    g_free(pool->queries);
+    g_free(pool->threads);
+    g_free(pool);
+}
+
 static void vfio_devices_dma_logging_stop(VFIOContainerBase *bcontainer)
 {
     uint64_t buf[DIV_ROUND_UP(sizeof(struct vfio_device_feature),
@@ -946,6 +1248,8 @@ static void vfio_devices_dma_logging_stop(VFIOContainerBase *bcontainer)
         }
         vbasedev->dirty_tracking = false;
     }
+
+    vfio_dirty_pool_destroy(bcontainer);
 }
 
 static struct vfio_device_feature *
@@ -1056,6 +1360,8 @@ static bool vfio_devices_dma_logging_start(VFIOContainerBase *bcontainer,
 out:
     if (ret) {
         vfio_devices_dma_logging_stop(bcontainer);
+    } else if (!bcontainer->dirty_pool) {
+        vfio_dirty_pool_create(bcontainer);
     }
 
     vfio_device_feature_dma_logging_start_destroy(feature);
@@ -1105,30 +1411,52 @@ static void vfio_listener_log_global_stop(MemoryListener *listener)
     }
 }
 
-static int vfio_device_dma_logging_report(VFIODevice *vbasedev, hwaddr iova,
-                                          hwaddr size, void *bitmap)
+static int vfio_devices_query_dirty_bitmap_parallel(
+                 const VFIOContainerBase *bcontainer, VFIOBitmap *vbmap,
+                 hwaddr iova, hwaddr size, Error **errp)
 {
-    uint64_t buf[DIV_ROUND_UP(sizeof(struct vfio_device_feature) +
-                        sizeof(struct vfio_device_feature_dma_logging_report),
-                        sizeof(uint64_t))] = {};
-    struct vfio_device_feature *feature = (struct vfio_device_feature *)buf;
-    struct vfio_device_feature_dma_logging_report *report =
-        (struct vfio_device_feature_dma_logging_report *)feature->data;
+    VFIODirtyPool *pool = bcontainer->dirty_pool;
+    VFIODevice *vbasedev;
+    unsigned int i, n = 0;
+    int ret = 0;
 
-    report->iova = iova;
-    report->length = size;
-    report->page_size = qemu_real_host_page_size();
-    report->bitmap = (uintptr_t)bitmap;
+    QLIST_FOREACH(vbasedev, &bcontainer->device_list, container_next) {
+        pool->queries[n] = (VFIODirtyQuery) {
+            .vbasedev = vbasedev,
+            .iova = iova,
+            .size = size,
+            .bitmap = n ? g_malloc0(vbmap->size) : vbmap->bitmap,
+        };
+        n++;
+    }
+    pool->nr_queries = n;
+    pool->next = 0;
 
-    feature->argsz = sizeof(buf);
-    feature->flags = VFIO_DEVICE_FEATURE_GET |
-                     VFIO_DEVICE_FEATURE_DMA_LOGGING_REPORT;
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+    vfio_dirty_pool_run(pool);
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_wait(&pool->done_sem);
+    }
 
-    if (ioctl(vbasedev->fd, VFIO_DEVICE_FEATURE, feature)) {
-        return -errno;
+    for (i = 0; i < n; i++) {
+        VFIODirtyQuery *q = &pool->queries[i];
+
+        if (q->ret && !ret) {
+            ret = q->ret;
+            error_setg_errno(errp, -ret,
+                             "%s: Failed to get DMA logging report, iova: "
+                             "0x%" HWADDR_PRIx ", size: 0x%" HWADDR_PRIx,
+                             q->vbasedev->name, iova, size);
+        }
+        if (i) {
+            bitmap_or(vbmap->bitmap, vbmap->bitmap, q->bitmap, vbmap->pages);
+            g_free(q->bitmap);
+        }
     }
 
-    return 0;
+    return ret;
 }
 
 int vfio_devices_query_dirty_bitmap(const VFIOContainerBase *bcontainer,
@@ -1137,6 +1465,11 @@ int vfio_devices_query_dirty_bitmap(const VFIOContainerBase *bcontainer,
     VFIODevice *vbasedev;
     int ret;
 
+    if (bcontainer->dirty_pool) {
+        return vfio_devices_query_dirty_bitmap_parallel(bcontainer, vbmap,
+                                                        iova, size, errp);
+    }
+
     QLIST_FOREACH(vbasedev, &bcontainer->device_list, container_next) {
         ret = vfio_device_dma_logging_report(vbasedev, iova, size,
                                              vbmap->bitmap);
@@ -1384,6 +1717,8 @@ static void vfio_listener_log_sync(MemoryListener *listener,
 
 const MemoryListener vfio_memory_listener = {
     .name = "vfio",
+    .begin = vfio_listener_begin,
+    .commit = vfio_listener_commit,
     .region_add = vfio_listener_region_add,
     .region_del = vfio_listener_region_del,
     .log_global_start = vfio_listener_log_global_start,
@@ -113,6 +113,7 @@ static void vfio_container_instance_finalize(Object *obj)
     }
 
     g_list_free_full(bcontainer->iova_ranges, g_free);
+    g_list_free_full(bcontainer->dma_extents, g_free);
 }
 
 static void vfio_container_instance_init(Object *obj)
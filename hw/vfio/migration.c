@@ -47,6 +47,7 @@
 #define VFIO_MIG_FLAG_DEV_SETUP_STATE   (0xffffffffef100003ULL)
 #define VFIO_MIG_FLAG_DEV_DATA_STATE    (0xffffffffef100004ULL)
 #define VFIO_MIG_FLAG_DEV_INIT_DATA_SENT (0xffffffffef100005ULL)
+#define VFIO_MIG_FLAG_DEV_MULTIFD_STATE (0xffffffffef100006ULL)
 
 /*
  * This is an arbitrary size based on migration of mlx5 devices, where typically
@@ -638,6 +639,64 @@ static int vfio_save_iterate(QEMUFile *f, void *opaque)
     return !migration->precopy_init_size && !migration->precopy_dirty_size;
 }
 
+static const SaveVMHandlers savevm_vfio_handlers;
+
+static bool vfio_multifd_transfer_enabled(VFIODevice *vbasedev)
+{
+    return vbasedev->migration_multifd_transfer &&
+           multifd_device_state_supported();
+}
+
+/*
+ * Queue the stop-copy data on the multifd channels, one buffer per read,
+ * and tell the destination on the main channel how many buffers to wait
+ * for.
+ */
+static int vfio_save_complete_precopy_multifd(QEMUFile *f,
+                                              VFIODevice *vbasedev)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    const char *idstr;
+    uint32_t instance_id, idx = 0;
+    int ret = 0;
+
+    if (!qemu_savevm_find_section(&savevm_vfio_handlers, vbasedev,
+                                  &idstr, &instance_id)) {
+        return -EINVAL;
+    }
+
+    for (;;) {
+        char *buf = g_malloc(migration->data_buffer_size);
+        ssize_t data_size = read(migration->data_fd, buf,
+                                 migration->data_buffer_size);
+
+        if (data_size <= 0) {
+            ret = data_size < 0 ? -errno : 0;
+            g_free(buf);
+            break;
+        }
+        if (!multifd_queue_device_state(idstr, instance_id, idx, buf,
+                                        data_size)) {
+            ret = -EIO;
+            break;
+        }
+        idx++;
+        bytes_transferred += data_size;
+    }
+
+    if (!ret) {
+        ret = multifd_device_state_send_sync();
+    }
+    trace_vfio_save_complete_precopy_multifd(vbasedev->name, idx, ret);
+    if (ret) {
+        return ret;
+    }
+
+    qemu_put_be64(f, VFIO_MIG_FLAG_DEV_MULTIFD_STATE);
+    qemu_put_be32(f, idx);
+    return 0;
+}
+
 static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
 {
     VFIODevice *vbasedev = opaque;
@@ -655,12 +714,19 @@ static int vfio_save_complete_precopy(QEMUFile *f, void *opaque)
         return ret;
     }
 
-    do {
-        data_size = vfio_save_block(f, vbasedev->migration);
-        if (data_size < 0) {
-            return data_size;
+    if (vfio_multifd_transfer_enabled(vbasedev)) {
+        ret = vfio_save_complete_precopy_multifd(f, vbasedev);
+        if (ret) {
+            return ret;
         }
-    } while (data_size);
+    } else {
+        do {
+            data_size = vfio_save_block(f, vbasedev->migration);
+            if (data_size < 0) {
+                return data_size;
+            }
+        } while (data_size);
+    }
 
     qemu_put_be64(f, VFIO_MIG_FLAG_END_OF_STATE);
     ret = qemu_file_get_error(f);
@@ -685,9 +751,117 @@ static void vfio_save_state(QEMUFile *f, void *opaque)
     }
 }
 
+typedef struct VFIOLoadBuf {
+    char *buf;
+    size_t len;
+} VFIOLoadBuf;
+
+static void vfio_load_bufs_clear(VFIOMigration *migration)
+{
+    guint i;
+
+    QEMU_LOCK_GUARD(&migration->load_bufs_mutex);
+    if (migration->load_bufs) {
+        for (i = 0; i < migration->load_bufs->len; i++) {
+            g_free(g_array_index(migration->load_bufs, VFIOLoadBuf, i).buf);
+        }
+        g_array_set_size(migration->load_bufs, 0);
+    }
+    migration->load_bufs_next = 0;
+    migration->load_bufs_ret = 0;
+}
+
+static int vfio_load_state_buffer(void *opaque, uint32_t buf_idx, char *buf,
+                                  size_t len, Error **errp)
+{
+    VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+    GArray *bufs;
+    VFIOLoadBuf *lb;
+
+    trace_vfio_load_state_buffer(vbasedev->name, buf_idx, len);
+
+    QEMU_LOCK_GUARD(&migration->load_bufs_mutex);
+    bufs = migration->load_bufs;
+    if (!bufs) {
+        g_free(buf);
+        error_setg(errp, "%s: device state buffer before load setup",
+                   vbasedev->name);
+        return -EINVAL;
+    }
+    if (buf_idx < migration->load_bufs_next ||
+        (buf_idx < bufs->len &&
+         g_array_index(bufs, VFIOLoadBuf, buf_idx).buf)) {
+        g_free(buf);
+        error_setg(errp, "%s: duplicate device state buffer %u",
+                   vbasedev->name, buf_idx);
+        return -EINVAL;
+    }
+    if (buf_idx >= bufs->len) {
+        g_array_set_size(bufs, buf_idx + 1);
+    }
+    lb = &g_array_index(bufs, VFIOLoadBuf, buf_idx);
+    lb->buf = buf;
+    lb->len = len;
+
+    while (migration->load_bufs_next < bufs->len) {
+        lb = &g_array_index(bufs, VFIOLoadBuf, migration->load_bufs_next);
+        if (!lb->buf) {
+            break;
+        }
+        if (!migration->load_bufs_ret &&
+            qemu_write_full(migration->data_fd, lb->buf,
+                            lb->len) != (ssize_t)lb->len) {
+            migration->load_bufs_ret = -errno;
+        }
+        trace_vfio_load_state_device_data(vbasedev->name, lb->len,
+                                          migration->load_bufs_ret);
+        g_clear_pointer(&lb->buf, g_free);
+        migration->load_bufs_next++;
+    }
+
+    if (migration->load_bufs_ret) {
+        error_setg_errno(errp, -migration->load_bufs_ret,
+                         "%s: failed to load device state buffer",
+                         vbasedev->name);
+        return migration->load_bufs_ret;
+    }
+    return 0;
+}
+
+/* Wait for the @nr buffers that the source queued on multifd channels. */
+static int vfio_load_state_multifd(VFIODevice *vbasedev, uint32_t nr)
+{
+    VFIOMigration *migration = vbasedev->migration;
+    int ret;
+
+    trace_vfio_load_state_multifd(vbasedev->name, nr);
+    multifd_device_state_recv_sync();
+
+    WITH_QEMU_LOCK_GUARD(&migration->load_bufs_mutex) {
+        ret = migration->load_bufs_ret;
+        if (!ret && (migration->load_bufs_next != nr ||
+                     migration->load_bufs->len != nr)) {
+            error_report("%s: received %u of %u device state buffers",
+                         vbasedev->name, migration->load_bufs_next, nr);
+            ret = -EINVAL;
+        }
+    }
+    vfio_load_bufs_clear(migration);
+    return ret;
+}
+
 static int vfio_load_setup(QEMUFile *f, void *opaque, Error **errp)
 {
     VFIODevice *vbasedev = opaque;
+    VFIOMigration *migration = vbasedev->migration;
+
+    WITH_QEMU_LOCK_GUARD(&migration->load_bufs_mutex) {
+        if (!migration->load_bufs) {
+            migration->load_bufs = g_array_new(false, true,
+                                               sizeof(VFIOLoadBuf));
+        }
+    }
 
     return vfio_migration_set_state(vbasedev, VFIO_DEVICE_STATE_RESUMING,
                                     vbasedev->migration->device_state, errp);
@@ -697,6 +871,7 @@ static int vfio_load_cleanup(void *opaque)
 {
     VFIODevice *vbasedev = opaque;
 
+    vfio_load_bufs_clear(vbasedev->migration);
     vfio_migration_cleanup(vbasedev);
     trace_vfio_load_cleanup(vbasedev->name);
 
@@ -743,6 +918,14 @@ static int vfio_load_state(QEMUFile *f, void *opaque, int version_id)
             }
             break;
         }
+        case VFIO_MIG_FLAG_DEV_MULTIFD_STATE:
+        {
+            ret = vfio_load_state_multifd(vbasedev, qemu_get_be32(f));
+            if (ret) {
+                return ret;
+            }
+            break;
+        }
         case VFIO_MIG_FLAG_DEV_INIT_DATA_SENT:
         {
             if (!vfio_precopy_supported(vbasedev) ||
@@ -795,6 +978,7 @@ static const SaveVMHandlers savevm_vfio_handlers = {
     .load_setup = vfio_load_setup,
     .load_cleanup = vfio_load_cleanup,
     .load_state = vfio_load_state,
+    .load_state_buffer = vfio_load_state_buffer,
     .switchover_ack_needed = vfio_switchover_ack_needed,
 };
 
@@ -886,6 +1070,13 @@ static int vfio_migration_state_notifier(NotifierWithReturn *notifier,
 
 static void vfio_migration_free(VFIODevice *vbasedev)
 {
+    VFIOMigration *migration = vbasedev->migration;
+
+    vfio_load_bufs_clear(migration);
+    if (migration->load_bufs) {
+        g_array_free(migration->load_bufs, true);
+    }
+    qemu_mutex_destroy(&migration->load_bufs_mutex);
     g_free(vbasedev->migration);
     vbasedev->migration = NULL;
 }
@@ -958,6 +1149,7 @@ static int vfio_migration_init(VFIODevice *vbasedev)
     migration->device_state = VFIO_DEVICE_STATE_RUNNING;
     migration->data_fd = -1;
     migration->mig_flags = mig_flags;
+    qemu_mutex_init(&migration->load_bufs_mutex);
 
     vbasedev->dirty_pages_supported = vfio_dma_logging_supported(vbasedev);
 
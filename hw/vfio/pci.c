@@ -3380,6 +3380,8 @@ static Property vfio_pci_dev_properties[] = {
                             vbasedev.enable_migration, ON_OFF_AUTO_AUTO),
     DEFINE_PROP_BOOL("migration-events", VFIOPCIDevice,
                      vbasedev.migration_events, false),
+    DEFINE_PROP_BOOL("x-migration-multifd-transfer", VFIOPCIDevice,
+                     vbasedev.migration_multifd_transfer, false),
     DEFINE_PROP_BOOL("x-no-mmap", VFIOPCIDevice, vbasedev.no_mmap, false),
     DEFINE_PROP_BOOL("x-balloon-allowed", VFIOPCIDevice,
                      vbasedev.ram_block_discard_allowed, false),
@@ -16,6 +16,7 @@
 #include "qemu/log.h"
 #include "qemu/memalign.h"
 #include "linux-headers/linux/vhost.h"
+#include "trace.h"
 
 /**
  * Validate the transport device features that both guests can use with the SVQ
@@ -83,6 +84,8 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
                                      hwaddr *addrs, const struct iovec *iovec,
                                      size_t num)
 {
+    const DMAMap *map = NULL;
+
     if (num == 0) {
         return true;
     }
@@ -95,7 +98,11 @@ static bool vhost_svq_translate_addr(const VhostShadowVirtqueue *svq,
         Int128 needle_last, map_last;
         size_t off;
 
-        const DMAMap *map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+        /* The segments of an element are usually in the same map */
+        if (!map || needle.translated_addr < map->translated_addr ||
+            needle.translated_addr - map->translated_addr > map->size) {
+            map = vhost_iova_tree_find_iova(svq->iova_tree, &needle);
+        }
         /*
          * Map cannot be NULL since iova map contains all guest space and
          * qemu already has a physical address mapped
@@ -210,17 +217,21 @@ static bool vhost_svq_add_split(VhostShadowVirtqueue *svq,
     avail->ring[avail_idx] = cpu_to_le16(*head);
     svq->shadow_avail_idx++;
 
-    /* Update the avail index after write the descriptor */
-    smp_wmb();
-    avail->idx = cpu_to_le16(svq->shadow_avail_idx);
-
     return true;
 }
 
-static void vhost_svq_kick(VhostShadowVirtqueue *svq)
+/**
+ * Expose the entries added to the available array since @old_avail_idx to the
+ * device, and notify it if it asked for it.
+ */
+static void vhost_svq_kick(VhostShadowVirtqueue *svq, uint16_t old_avail_idx)
 {
     bool needs_kick;
 
+    /* Update the avail index after write the descriptor */
+    smp_wmb();
+    svq->vring.avail->idx = cpu_to_le16(svq->shadow_avail_idx);
+
     /*
      * We need to expose the available array entries before checking the used
      * flags
@@ -229,11 +240,14 @@ static void vhost_svq_kick(VhostShadowVirtqueue *svq)
 
     if (virtio_vdev_has_feature(svq->vdev, VIRTIO_RING_F_EVENT_IDX)) {
         uint16_t avail_event = *(uint16_t *)(&svq->vring.used->ring[svq->vring.num]);
-        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx, svq->shadow_avail_idx - 1);
+        needs_kick = vring_need_event(avail_event, svq->shadow_avail_idx,
+                                      old_avail_idx);
     } else {
         needs_kick = !(svq->vring.used->flags & VRING_USED_F_NO_NOTIFY);
     }
 
+    trace_vhost_svq_kick(svq, (uint16_t)(svq->shadow_avail_idx - old_avail_idx),
+                         needs_kick);
     if (!needs_kick) {
         return;
     }
@@ -266,7 +280,9 @@ int vhost_svq_add(VhostShadowVirtqueue *svq, const struct iovec *out_sg,
     svq->num_free -= ndescs;
     svq->desc_state[qemu_head].elem = elem;
     svq->desc_state[qemu_head].ndescs = ndescs;
-    vhost_svq_kick(svq);
+    if (!svq->kick_deferred) {
+        vhost_svq_kick(svq, svq->shadow_avail_idx - 1);
+    }
     return 0;
 }
 
@@ -278,23 +294,8 @@ static int vhost_svq_add_element(VhostShadowVirtqueue *svq,
                          elem->in_num, elem);
 }
 
-/**
- * Forward available buffers.
- *
- * @svq: Shadow VirtQueue
- *
- * Note that this function does not guarantee that all guest's available
- * buffers are available to the device in SVQ avail ring. The guest may have
- * exposed a GPA / GIOVA contiguous buffer, but it may not be contiguous in
- * qemu vaddr.
- *
- * If that happens, guest's kick notifications will be disabled until the
- * device uses some buffers.
- */
-static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+static void vhost_svq_forward_avail(VhostShadowVirtqueue *svq)
 {
-    /* Clear event notifier */
-    event_notifier_test_and_clear(&svq->svq_kick);
 
     /* Forward to the device as many available buffers as possible */
     do {
@@ -346,6 +347,41 @@ static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
     } while (!virtio_queue_empty(svq->vq));
 }
 
+/**
+ * Forward available buffers.
+ *
+ * @svq: Shadow VirtQueue
+ *
+ * Note that this function does not guarantee that all guest's available
+ * buffers are available to the device in SVQ avail ring. The guest may have
+ * exposed a GPA / GIOVA contiguous buffer, but it may not be contiguous in
+ * qemu vaddr.
+ *
+ * If that happens, guest's kick notifications will be disabled until the
+ * device uses some buffers.
+ */
+static void vhost_handle_guest_kick(VhostShadowVirtqueue *svq)
+{
+    uint16_t old_avail_idx = svq->shadow_avail_idx;
+
+    /* Clear event notifier */
+    event_notifier_test_and_clear(&svq->svq_kick);
+
+    /*
+     * Expose all the buffers to the device at once, with at most one kick.
+     * Avail handlers may wait for the device to use the buffers they add,
+     * so those get their buffers exposed right away.
+     */
+    svq->kick_deferred = !svq->ops;
+    vhost_svq_forward_avail(svq);
+    if (svq->kick_deferred) {
+        svq->kick_deferred = false;
+        if (svq->shadow_avail_idx != old_avail_idx) {
+            vhost_svq_kick(svq, old_avail_idx);
+        }
+    }
+}
+
 /**
  * Handle guest's kick.
  *
@@ -473,6 +509,23 @@ void vhost_svq_push_elem(VhostShadowVirtqueue *svq,
     }
 }
 
+/* Notify the guest of @num used buffers, unless it suppressed notifications */
+static void vhost_svq_call(VhostShadowVirtqueue *svq, unsigned num)
+{
+    bool needs_call = false;
+
+    if (num) {
+        WITH_RCU_READ_LOCK_GUARD() {
+            needs_call = virtio_should_notify(svq->vdev, svq->vq);
+        }
+    }
+
+    trace_vhost_svq_call(svq, num, needs_call);
+    if (needs_call) {
+        event_notifier_set(&svq->svq_call);
+    }
+}
+
 static void vhost_svq_flush(VhostShadowVirtqueue *svq,
                             bool check_for_avail_queue)
 {
@@ -502,7 +555,7 @@ static void vhost_svq_flush(VhostShadowVirtqueue *svq,
         }
 
         virtqueue_flush(vq, i);
-        event_notifier_set(&svq->svq_call);
+        vhost_svq_call(svq, i);
 
         if (check_for_avail_queue && svq->next_guest_avail_elem) {
             /*
@@ -24,6 +24,7 @@
 #include "qemu/main-loop.h"
 #include "qemu/uuid.h"
 #include "qemu/sockets.h"
+#include "qemu/timer.h"
 #include "sysemu/runstate.h"
 #include "sysemu/cryptodev.h"
 #include "migration/postcopy-ram.h"
@@ -658,6 +659,17 @@ static void scrub_shadow_regions(struct vhost_dev *dev,
     return;
 }
 
+/*
+ * Region updates are pipelined: all the messages of an update go out before
+ * the first reply is read, so that an update costs one round trip to the
+ * backend instead of one per region.  The backend handles and answers the
+ * messages in order, and the replies of at most VHOST_USER_MAX_RAM_SLOTS
+ * messages fit in the socket buffer.
+ *
+ * Every sent message still gets its reply read, so the shadow table
+ * follows exactly what the backend did even if some of them fail.
+ */
+
 static int send_remove_regions(struct vhost_dev *dev,
                                struct scrub_regions *remove_reg,
                                int nr_rem_reg, VhostUserMsg *msg,
@@ -665,18 +677,13 @@ static int send_remove_regions(struct vhost_dev *dev,
 {
     struct vhost_user *u = dev->opaque;
     struct vhost_memory_region *shadow_reg;
-    int i, fd, shadow_reg_idx, ret;
+    bool sent[VHOST_USER_MAX_RAM_SLOTS] = {};
+    int i, fd, shadow_reg_idx, ret = 0, reply_ret;
     ram_addr_t offset;
     VhostUserMemoryRegion region_buffer;
 
-    /*
-     * The regions in remove_reg appear in the same order they do in the
-     * shadow table. Therefore we can minimize memory copies by iterating
-     * through remove_reg backwards.
-     */
     for (i = nr_rem_reg - 1; i >= 0; i--) {
         shadow_reg = remove_reg[i].region;
-        shadow_reg_idx = remove_reg[i].reg_idx;
 
         vhost_user_get_mr_data(shadow_reg->userspace_addr, &offset, &fd);
 
@@ -687,13 +694,37 @@ static int send_remove_regions(struct vhost_dev *dev,
 
             ret = vhost_user_write(dev, msg, NULL, 0);
             if (ret < 0) {
-                return ret;
+                break;
             }
+            sent[i] = true;
+        }
+    }
 
+    /*
+     * The regions in remove_reg appear in the same order they do in the
+     * shadow table. Therefore we can minimize memory copies by iterating
+     * through remove_reg backwards.
+     */
+    for (i = nr_rem_reg - 1; i >= 0; i--) {
+        shadow_reg = remove_reg[i].region;
+        shadow_reg_idx = remove_reg[i].reg_idx;
+
+        vhost_user_get_mr_data(shadow_reg->userspace_addr, &offset, &fd);
+
+        if (fd > 0) {
+            if (!sent[i]) {
+                continue;
+            }
             if (reply_supported) {
-                ret = process_message_reply(dev, msg);
-                if (ret) {
-                    return ret;
+                msg->hdr.request = VHOST_USER_REM_MEM_REG;
+                reply_ret = process_message_reply(dev, msg);
+                if (reply_ret) {
+                    ret = ret ?: reply_ret;
+                    if (reply_ret != -EIO) {
+                        /* Lost track of the replies, stop reading */
+                        return ret;
+                    }
+                    continue;
                 }
             }
         }
@@ -709,7 +740,85 @@ static int send_remove_regions(struct vhost_dev *dev,
         u->num_shadow_regions--;
     }
 
-    return 0;
+    return ret;
+}
+
+static void shadow_regions_append(struct vhost_user *u,
+                                  struct vhost_memory_region *reg)
+{
+    u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
+        reg->guest_phys_addr;
+    u->shadow_regions[u->num_shadow_regions].userspace_addr =
+        reg->userspace_addr;
+    u->shadow_regions[u->num_shadow_regions].memory_size =
+        reg->memory_size;
+    u->num_shadow_regions++;
+}
+
+/* Without postcopy, see send_remove_regions() for the pipelining */
+static int send_add_regions_pipelined(struct vhost_dev *dev,
+                                      struct scrub_regions *add_reg,
+                                      int nr_add_reg, VhostUserMsg *msg,
+                                      bool reply_supported)
+{
+    struct vhost_user *u = dev->opaque;
+    bool sent[VHOST_USER_MAX_RAM_SLOTS] = {};
+    int i, fd, ret = 0, reply_ret;
+    struct vhost_memory_region *reg;
+    ram_addr_t offset;
+    VhostUserMemoryRegion region_buffer;
+
+    for (i = 0; i < nr_add_reg; i++) {
+        reg = add_reg[i].region;
+
+        vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
+
+        if (fd > 0) {
+            msg->hdr.request = VHOST_USER_ADD_MEM_REG;
+            vhost_user_fill_msg_region(&region_buffer, reg, offset);
+            msg->payload.mem_reg.region = region_buffer;
+
+            ret = vhost_user_write(dev, msg, &fd, 1);
+            if (ret < 0) {
+                break;
+            }
+            sent[i] = true;
+        }
+    }
+
+    for (i = 0; i < nr_add_reg; i++) {
+        reg = add_reg[i].region;
+
+        vhost_user_get_mr_data(reg->userspace_addr, &offset, &fd);
+
+        if (fd > 0) {
+            if (!sent[i]) {
+                continue;
+            }
+            if (reply_supported) {
+                msg->hdr.request = VHOST_USER_ADD_MEM_REG;
+                reply_ret = process_message_reply(dev, msg);
+                if (reply_ret) {
+                    ret = ret ?: reply_ret;
+                    if (reply_ret != -EIO) {
+                        /* Lost track of the replies, stop reading */
+                        return ret;
+                    }
+                    continue;
+                }
+            }
+        }
+
+        /*
+         * At this point, we know the backend has mapped in the new
+         * region, if the region has a valid file descriptor.
+         *
+         * The region should now be added to the shadow table.
+         */
+        shadow_regions_append(u, reg);
+    }
+
+    return ret;
 }
 
 static int send_add_regions(struct vhost_dev *dev,
@@ -725,6 +834,11 @@ static int send_add_regions(struct vhost_dev *dev,
     VhostUserMsg msg_reply;
     VhostUserMemoryRegion region_buffer;
 
+    if (!track_ramblocks) {
+        return send_add_regions_pipelined(dev, add_reg, nr_add_reg, msg,
+                                          reply_supported);
+    }
+
     for (i = 0; i < nr_add_reg; i++) {
         reg = add_reg[i].region;
         reg_idx = add_reg[i].reg_idx;
@@ -812,13 +926,7 @@ static int send_add_regions(struct vhost_dev *dev,
          *
          * The region should now be added to the shadow table.
          */
-        u->shadow_regions[u->num_shadow_regions].guest_phys_addr =
-            reg->guest_phys_addr;
-        u->shadow_regions[u->num_shadow_regions].userspace_addr =
-            reg->userspace_addr;
-        u->shadow_regions[u->num_shadow_regions].memory_size =
-            reg->memory_size;
-        u->num_shadow_regions++;
+        shadow_regions_append(u, reg);
     }
 
     return 0;
@@ -833,6 +941,7 @@ static int vhost_user_add_remove_regions(struct vhost_dev *dev,
     struct scrub_regions add_reg[VHOST_USER_MAX_RAM_SLOTS];
     struct scrub_regions rem_reg[VHOST_USER_MAX_RAM_SLOTS];
     uint64_t shadow_pcb[VHOST_USER_MAX_RAM_SLOTS] = {};
+    int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     int nr_add_reg, nr_rem_reg;
     int ret;
 
@@ -858,6 +967,9 @@ static int vhost_user_add_remove_regions(struct vhost_dev *dev,
         }
     }
 
+    trace_vhost_user_add_remove_regions(dev, nr_rem_reg, nr_add_reg,
+        qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_ns);
+
     if (track_ramblocks) {
         memcpy(u->postcopy_client_bases, shadow_pcb,
                sizeof(uint64_t) * VHOST_USER_MAX_RAM_SLOTS);
@@ -337,14 +337,77 @@ static void balloon_stats_set_poll_interval(Object *obj, Visitor *v,
     balloon_stats_change_timer(s, 0);
 }
 
+typedef struct BalloonReportRange {
+    RAMBlock *rb;
+    ram_addr_t offset;
+    size_t size;
+} BalloonReportRange;
+
+static gint balloon_report_range_cmp(gconstpointer a, gconstpointer b)
+{
+    const BalloonReportRange *x = a, *y = b;
+
+    if (x->rb != y->rb) {
+        return (uintptr_t)x->rb < (uintptr_t)y->rb ? -1 : 1;
+    }
+    if (x->offset != y->offset) {
+        return x->offset < y->offset ? -1 : 1;
+    }
+    return 0;
+}
+
+static void balloon_report_range_discard(BalloonReportRange *r,
+                                         unsigned int merged)
+{
+    trace_virtio_balloon_discard_range(qemu_ram_get_idstr(r->rb), r->offset,
+                                       r->size, merged);
+    ram_block_discard_range(r->rb, r->offset, r->size);
+}
+
+/*
+ * Discard the reported ranges with one call per contiguous part of a
+ * RAMBlock.  Free page reporting hands out high-order pages in batches,
+ * buddies often end up next to each other once sorted.
+ */
+static void virtio_balloon_discard_ranges(GArray *ranges)
+{
+    BalloonReportRange *cur = NULL;
+    unsigned int merged = 0;
+
+    g_array_sort(ranges, balloon_report_range_cmp);
+
+    for (guint i = 0; i < ranges->len; i++) {
+        BalloonReportRange *r = &g_array_index(ranges, BalloonReportRange, i);
+
+        if (cur && cur->rb == r->rb && r->offset <= cur->offset + cur->size) {
+            cur->size = MAX(cur->size, r->offset + r->size - cur->offset);
+            merged++;
+            continue;
+        }
+        if (cur) {
+            balloon_report_range_discard(cur, merged);
+        }
+        cur = r;
+        merged = 1;
+    }
+    if (cur) {
+        balloon_report_range_discard(cur, merged);
+    }
+}
+
 static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
 {
     VirtIOBalloon *dev = VIRTIO_BALLOON(vdev);
+    g_autoptr(GPtrArray) elems = g_ptr_array_new();
+    g_autoptr(GArray) ranges = g_array_new(false, false,
+                                           sizeof(BalloonReportRange));
     VirtQueueElement *elem;
 
     while ((elem = virtqueue_pop(vq, sizeof(VirtQueueElement)))) {
         unsigned int i;
 
+        g_ptr_array_add(elems, elem);
+
         /*
          * When we discard the page it has the effect of removing the page
          * from the hypervisor itself and causing it to be zeroed when it
@@ -353,12 +416,13 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
          * expecting it to retain a non-zero value.
          */
         if (virtio_balloon_inhibited() || dev->poison_val) {
-            goto skip_element;
+            continue;
         }
 
         for (i = 0; i < elem->in_num; i++) {
             void *addr = elem->in_sg[i].iov_base;
             size_t size = elem->in_sg[i].iov_len;
+            BalloonReportRange range;
             ram_addr_t ram_offset;
             RAMBlock *rb;
 
@@ -388,14 +452,31 @@ static void virtio_balloon_handle_report(VirtIODevice *vdev, VirtQueue *vq)
                 continue;
             }
 
-            ram_block_discard_range(rb, ram_offset, size);
+            range = (BalloonReportRange) {
+                .rb = rb,
+                .offset = ram_offset,
+                .size = size,
+            };
+            g_array_append_val(ranges, range);
         }
+    }
+
+    if (!elems->len) {
+        return;
+    }
 
-skip_element:
+    /*
+     * The pages must be gone before the guest gets them back, and the
+     * mappings of the elements keep the RAMBlocks alive until then.
+     */
+    virtio_balloon_discard_ranges(ranges);
+
+    for (guint i = 0; i < elems->len; i++) {
+        elem = g_ptr_array_index(elems, i);
         virtqueue_push(vq, elem, 0);
-        virtio_notify(vdev, vq);
         g_free(elem);
     }
+    virtio_notify(vdev, vq);
 }
 
 static void virtio_balloon_handle_output(VirtIODevice *vdev, VirtQueue *vq)
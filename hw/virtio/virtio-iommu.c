@@ -30,6 +30,7 @@
 #include "sysemu/sysemu.h"
 #include "qemu/reserved-region.h"
 #include "qemu/units.h"
+#include "qemu/timer.h"
 #include "qapi/error.h"
 #include "qemu/error-report.h"
 #include "trace.h"
@@ -45,13 +46,30 @@
 #define VIOMMU_DEFAULT_QUEUE_SIZE 256
 #define VIOMMU_PROBE_SIZE 512
 
+/* Slow path lookups without map or unmap before the mappings are copied */
+#define VIOMMU_FLAT_LOOKUPS 64
+
+#define VIRTIO_IOMMU_STAT_INC(sdev, field) do {                         \
+        stat64_add(&(sdev)->stats.field, 1);                            \
+        stat64_add(&((VirtIOIOMMU *)(sdev)->viommu)->stats.field, 1);   \
+    } while (0)
+
 typedef struct VirtIOIOMMUDomain {
     uint32_t id;
     bool bypass;
     GTree *mappings;
     QLIST_HEAD(, VirtIOIOMMUEndpoint) endpoint_list;
+    VirtIOIOMMUMappingSet *flat;    /* Sorted copy of @mappings, or NULL */
+    uint32_t lookups;               /* Since @mappings last changed */
 } VirtIOIOMMUDomain;
 
+/* Immutable, so that translations can search it without the mutex */
+struct VirtIOIOMMUMappingSet {
+    struct rcu_head rcu;
+    uint32_t nr;
+    VirtIOIOMMUFlatMapping maps[];
+};
+
 typedef struct VirtIOIOMMUEndpoint {
     uint32_t id;
     VirtIOIOMMUDomain *domain;
@@ -300,6 +318,138 @@ static gboolean virtio_iommu_notify_map_cb(gpointer key, gpointer value,
     return false;
 }
 
+static void virtio_iommu_set_last_hit(IOMMUDevice *sdev, uint64_t low,
+                                      uint64_t high, uint64_t phys_addr,
+                                      uint32_t flags)
+{
+    seqlock_write_begin(&sdev->last_hit_lock);
+    sdev->last_hit.low = low;
+    sdev->last_hit.high = high;
+    sdev->last_hit.phys_addr = phys_addr;
+    sdev->last_hit.flags = flags;
+    seqlock_write_end(&sdev->last_hit_lock);
+}
+
+static bool virtio_iommu_resv_overlaps(IOMMUDevice *sdev, uint64_t low,
+                                       uint64_t high)
+{
+    GList *l;
+
+    for (l = sdev->resv_regions; l; l = l->next) {
+        ReservedRegion *reg = l->data;
+
+        if (range_lob(&reg->range) <= high && low <= range_upb(&reg->range)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/* Index of the first mapping of @set that ends at or after @addr */
+static uint32_t virtio_iommu_flat_find(const VirtIOIOMMUMappingSet *set,
+                                       uint64_t addr)
+{
+    uint32_t lo = 0, hi = set->nr;
+
+    while (lo < hi) {
+        uint32_t mid = lo + (hi - lo) / 2;
+
+        if (set->maps[mid].high < addr) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/*
+ * Let @sdev translate from @set without the mutex, unless a reserved
+ * region of @sdev, which takes precedence, overlaps one of the mappings.
+ */
+static void virtio_iommu_publish_flat(IOMMUDevice *sdev,
+                                      VirtIOIOMMUMappingSet *set)
+{
+    GList *l;
+
+    for (l = sdev->resv_regions; l; l = l->next) {
+        ReservedRegion *reg = l->data;
+        uint32_t i = virtio_iommu_flat_find(set, range_lob(&reg->range));
+
+        if (i < set->nr && set->maps[i].low <= range_upb(&reg->range)) {
+            return;
+        }
+    }
+    qatomic_rcu_set(&sdev->mappings, set);
+}
+
+/* Drop what @sdev caches of its domain.  Called with the mutex held. */
+static void virtio_iommu_flush_sdev(IOMMUDevice *sdev)
+{
+    qatomic_rcu_set(&sdev->mappings, NULL);
+    virtio_iommu_set_last_hit(sdev, 1, 0, 0, 0);
+}
+
+static gboolean virtio_iommu_flatten_cb(gpointer key, gpointer value,
+                                        gpointer data)
+{
+    VirtIOIOMMUInterval *interval = key;
+    VirtIOIOMMUMapping *mapping = value;
+    VirtIOIOMMUMappingSet *set = data;
+
+    set->maps[set->nr++] = (VirtIOIOMMUFlatMapping) {
+        .low = interval->low,
+        .high = interval->high,
+        .phys_addr = mapping->phys_addr,
+        .flags = mapping->flags,
+    };
+    return false;
+}
+
+/* Copy the mappings of @domain into a sorted array for its endpoints */
+static void virtio_iommu_flatten(VirtIOIOMMUDomain *domain)
+{
+    VirtIOIOMMUMappingSet *set;
+    VirtIOIOMMUEndpoint *ep;
+
+    set = g_malloc(sizeof(*set) +
+                   g_tree_nnodes(domain->mappings) * sizeof(set->maps[0]));
+    set->nr = 0;
+    g_tree_foreach(domain->mappings, virtio_iommu_flatten_cb, set);
+    trace_virtio_iommu_flatten(domain->id, set->nr);
+    domain->flat = set;
+    QLIST_FOREACH(ep, &domain->endpoint_list, next) {
+        virtio_iommu_publish_flat(container_of(ep->iommu_mr, IOMMUDevice,
+                                               iommu_mr), set);
+    }
+}
+
+/*
+ * The mappings of @domain changed: drop its sorted copy, and with
+ * @unmapped the last hits of its endpoints too.
+ */
+static void virtio_iommu_domain_changed(VirtIOIOMMUDomain *domain,
+                                        bool unmapped)
+{
+    VirtIOIOMMUMappingSet *flat = domain->flat;
+    VirtIOIOMMUEndpoint *ep;
+
+    domain->lookups = 0;
+    QLIST_FOREACH(ep, &domain->endpoint_list, next) {
+        IOMMUDevice *sdev = container_of(ep->iommu_mr, IOMMUDevice, iommu_mr);
+
+        if (unmapped) {
+            virtio_iommu_flush_sdev(sdev);
+        } else {
+            qatomic_rcu_set(&sdev->mappings, NULL);
+        }
+    }
+    if (flat) {
+        domain->flat = NULL;
+        g_free_rcu(flat, rcu);
+    }
+}
+
 static void virtio_iommu_detach_endpoint_from_domain(VirtIOIOMMUEndpoint *ep)
 {
     VirtIOIOMMUDomain *domain = ep->domain;
@@ -313,6 +463,7 @@ static void virtio_iommu_detach_endpoint_from_domain(VirtIOIOMMUEndpoint *ep)
                    ep->iommu_mr);
     QLIST_REMOVE(ep, next);
     ep->domain = NULL;
+    virtio_iommu_flush_sdev(sdev);
     virtio_iommu_switch_address_space(sdev);
 }
 
@@ -383,6 +534,9 @@ static void virtio_iommu_put_domain(gpointer data)
     QLIST_FOREACH_SAFE(iter, &domain->endpoint_list, next, tmp) {
         virtio_iommu_detach_endpoint_from_domain(iter);
     }
+    if (domain->flat) {
+        g_free_rcu(domain->flat, rcu);
+    }
     g_tree_destroy(domain->mappings);
     trace_virtio_iommu_put_domain(domain->id);
     g_free(domain);
@@ -426,6 +580,9 @@ static AddressSpace *virtio_iommu_find_add_as(PCIBus *bus, void *opaque,
         sdev->viommu = s;
         sdev->bus = bus;
         sdev->devfn = devfn;
+        iommu_stats_register(&sdev->stats, OBJECT(s), bus, devfn);
+        seqlock_init(&sdev->last_hit_lock);
+        sdev->last_hit.low = 1;
 
         trace_virtio_iommu_init_iommu_mr(name);
 
@@ -505,6 +662,7 @@ get_host_iommu_device(VirtIOIOMMU *viommu, PCIBus *bus, int devfn) {
  */
 static int rebuild_resv_regions(IOMMUDevice *sdev)
 {
+    VirtIOIOMMU *s = sdev->viommu;
     GList *l;
     int i = 0;
 
@@ -530,6 +688,11 @@ static int rebuild_resv_regions(IOMMUDevice *sdev)
      * through properties
      */
     add_prop_resv_regions(sdev);
+
+    /* The caches did not account for the new regions */
+    WITH_QEMU_LOCK_GUARD(&s->mutex) {
+        virtio_iommu_flush_sdev(sdev);
+    }
     return 0;
 }
 
@@ -752,6 +915,9 @@ static int virtio_iommu_attach(VirtIOIOMMU *s,
 
     ep->domain = domain;
     sdev = container_of(ep->iommu_mr, IOMMUDevice, iommu_mr);
+    if (domain->flat) {
+        virtio_iommu_publish_flat(sdev, domain->flat);
+    }
     virtio_iommu_switch_address_space(sdev);
 
     /* Replay domain mappings on the associated memory region */
@@ -835,6 +1001,7 @@ static int virtio_iommu_map(VirtIOIOMMU *s,
     mapping->flags = flags;
 
     g_tree_insert(domain->mappings, interval, mapping);
+    virtio_iommu_domain_changed(domain, false);
 
     QLIST_FOREACH(ep, &domain->endpoint_list, next) {
         virtio_iommu_notify_map(ep->iommu_mr, virt_start, virt_end, phys_start,
@@ -855,6 +1022,7 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
     VirtIOIOMMUDomain *domain;
     VirtIOIOMMUEndpoint *ep;
     int ret = VIRTIO_IOMMU_S_OK;
+    bool unmapped = false;
 
     trace_virtio_iommu_unmap(domain_id, virt_start, virt_end);
 
@@ -881,12 +1049,16 @@ static int virtio_iommu_unmap(VirtIOIOMMU *s,
                                           current_high);
             }
             g_tree_remove(domain->mappings, iter_key);
+            unmapped = true;
             trace_virtio_iommu_unmap_done(domain_id, current_low, current_high);
         } else {
             ret = VIRTIO_IOMMU_S_RANGE;
             break;
         }
     }
+    if (unmapped) {
+        virtio_iommu_domain_changed(domain, true);
+    }
     return ret;
 }
 
@@ -983,6 +1155,12 @@ virtio_iommu_handle_req(detach)
 virtio_iommu_handle_req(map)
 virtio_iommu_handle_req(unmap)
 
+static void virtio_iommu_account_invalidation(VirtIOIOMMU *s, int64_t start)
+{
+    stat64_add(&s->stats.invalidations, 1);
+    stat64_add(&s->stats.invalidation_time, get_clock() - start);
+}
+
 static int virtio_iommu_handle_probe(VirtIOIOMMU *s,
                                      struct iovec *iov,
                                      unsigned int iov_cnt,
@@ -1003,6 +1181,7 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
     unsigned int iov_cnt;
     struct iovec *iov;
     void *buf = NULL;
+    int64_t start;
     size_t sz;
 
     for (;;) {
@@ -1037,13 +1216,17 @@ static void virtio_iommu_handle_command(VirtIODevice *vdev, VirtQueue *vq)
             tail.status = virtio_iommu_handle_attach(s, iov, iov_cnt);
             break;
         case VIRTIO_IOMMU_T_DETACH:
+            start = get_clock();
             tail.status = virtio_iommu_handle_detach(s, iov, iov_cnt);
+            virtio_iommu_account_invalidation(s, start);
             break;
         case VIRTIO_IOMMU_T_MAP:
             tail.status = virtio_iommu_handle_map(s, iov, iov_cnt);
             break;
         case VIRTIO_IOMMU_T_UNMAP:
+            start = get_clock();
             tail.status = virtio_iommu_handle_unmap(s, iov, iov_cnt);
+            virtio_iommu_account_invalidation(s, start);
             break;
         case VIRTIO_IOMMU_T_PROBE:
         {
@@ -1135,6 +1318,46 @@ static void virtio_iommu_report_fault(VirtIOIOMMU *viommu, uint8_t reason,
 
 }
 
+/*
+ * Translate @addr into @entry from the caches of @sdev, without the
+ * mutex.  Misses and permission faults are left to the slow path.
+ */
+static bool virtio_iommu_translate_cached(IOMMUDevice *sdev, hwaddr addr,
+                                          IOMMUAccessFlags flag,
+                                          IOMMUTLBEntry *entry)
+{
+    VirtIOIOMMUFlatMapping hit;
+    VirtIOIOMMUMappingSet *set;
+    unsigned start;
+
+    do {
+        start = seqlock_read_begin(&sdev->last_hit_lock);
+        hit = sdev->last_hit;
+    } while (seqlock_read_retry(&sdev->last_hit_lock, start));
+
+    if (addr < hit.low || addr > hit.high) {
+        uint32_t i;
+
+        RCU_READ_LOCK_GUARD();
+        set = qatomic_rcu_read(&sdev->mappings);
+        if (!set) {
+            return false;
+        }
+        i = virtio_iommu_flat_find(set, addr);
+        if (i == set->nr || set->maps[i].low > addr) {
+            return false;
+        }
+        hit = set->maps[i];
+    }
+    if (((flag & IOMMU_RO) && !(hit.flags & VIRTIO_IOMMU_MAP_F_READ)) ||
+        ((flag & IOMMU_WO) && !(hit.flags & VIRTIO_IOMMU_MAP_F_WRITE))) {
+        return false;
+    }
+    entry->translated_addr = addr - hit.low + hit.phys_addr;
+    entry->perm = flag;
+    return true;
+}
+
 static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
                                             IOMMUAccessFlags flag,
                                             int iommu_idx)
@@ -1168,6 +1391,12 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     sid = virtio_iommu_get_bdf(sdev);
 
     trace_virtio_iommu_translate(mr->parent_obj.name, sid, addr, flag);
+    VIRTIO_IOMMU_STAT_INC(sdev, translations);
+    if (virtio_iommu_translate_cached(sdev, addr, flag, &entry)) {
+        VIRTIO_IOMMU_STAT_INC(sdev, iotlb_hits);
+        trace_virtio_iommu_translate_out(addr, entry.translated_addr, sid);
+        return entry;
+    }
     qemu_rec_mutex_lock(&s->mutex);
 
     ep = g_tree_lookup(s->endpoints, GUINT_TO_POINTER(sid));
@@ -1223,6 +1452,12 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
         goto unlock;
     }
 
+    /* Lookups that miss the caches count as walks */
+    VIRTIO_IOMMU_STAT_INC(sdev, page_walks);
+    if (!ep->domain->flat &&
+        ++ep->domain->lookups >= VIOMMU_FLAT_LOOKUPS) {
+        virtio_iommu_flatten(ep->domain);
+    }
     found = g_tree_lookup_extended(ep->domain->mappings, (gpointer)(&interval),
                                    (void **)&mapping_key,
                                    (void **)&mapping_value);
@@ -1253,9 +1488,18 @@ static IOMMUTLBEntry virtio_iommu_translate(IOMMUMemoryRegion *mr, hwaddr addr,
     }
     entry.translated_addr = addr - mapping_key->low + mapping_value->phys_addr;
     entry.perm = flag;
+    if (!virtio_iommu_resv_overlaps(sdev, mapping_key->low,
+                                    mapping_key->high)) {
+        virtio_iommu_set_last_hit(sdev, mapping_key->low, mapping_key->high,
+                                  mapping_value->phys_addr,
+                                  mapping_value->flags);
+    }
     trace_virtio_iommu_translate_out(addr, entry.translated_addr, sid);
 
 unlock:
+    if (entry.perm != flag) {
+        VIRTIO_IOMMU_STAT_INC(sdev, faults);
+    }
     qemu_rec_mutex_unlock(&s->mutex);
     return entry;
 }
@@ -1463,6 +1707,7 @@ static void virtio_iommu_device_realize(DeviceState *dev, Error **errp)
     virtio_add_feature(&s->features, VIRTIO_IOMMU_F_BYPASS_CONFIG);
 
     qemu_rec_mutex_init(&s->mutex);
+    iommu_stats_register(&s->stats, OBJECT(s), NULL, 0);
 
     s->as_by_busptr = g_hash_table_new_full(NULL, NULL, NULL, g_free);
 
@@ -1485,10 +1730,22 @@ static void virtio_iommu_device_unrealize(DeviceState *dev)
 {
     VirtIODevice *vdev = VIRTIO_DEVICE(dev);
     VirtIOIOMMU *s = VIRTIO_IOMMU(dev);
+    GHashTableIter iter;
+    IOMMUPciBus *sbus;
 
     qemu_unregister_reset(virtio_iommu_system_reset, s);
     qemu_remove_machine_init_done_notifier(&s->machine_done);
 
+    g_hash_table_iter_init(&iter, s->as_by_busptr);
+    while (g_hash_table_iter_next(&iter, NULL, (void **)&sbus)) {
+        for (int i = 0; i < PCI_DEVFN_MAX; i++) {
+            if (sbus->pbdev[i]) {
+                iommu_stats_unregister(&sbus->pbdev[i]->stats);
+            }
+        }
+    }
+    iommu_stats_unregister(&s->stats);
+
     g_hash_table_destroy(s->as_by_busptr);
     if (s->domains) {
         g_tree_destroy(s->domains);
@@ -1610,6 +1867,7 @@ static gboolean reconstruct_endpoints(gpointer key, gpointer value,
 
         iter->domain = d;
         iter->iommu_mr = mr;
+        virtio_iommu_flush_sdev(container_of(mr, IOMMUDevice, iommu_mr));
         g_tree_insert(s->endpoints, GUINT_TO_POINTER(iter->id), iter);
     }
     return false; /* continue the domain traversal */
@@ -153,6 +153,32 @@ struct VirtQueue
     EventNotifier host_notifier;
     bool host_notifier_enabled;
     QLIST_ENTRY(VirtQueue) node;
+
+    VirtQueueElementPool *elem_pool;
+};
+
+/* A free pool slot, overlaid on the memory of a former element */
+typedef struct VirtQueueElementSlot {
+    QSLIST_ENTRY(VirtQueueElementSlot) next;
+} VirtQueueElementSlot;
+
+/*
+ * Cache of element allocations for one queue.  All slots have room for
+ * @sg_max descriptors after a device struct of @sz bytes; other elements are
+ * allocated with g_malloc().
+ *
+ * Elements are taken from @local by the thread popping from the queue, which
+ * refills it from @freed, where virtqueue_element_free() puts them back from
+ * any thread.  The pool lives as long as the queue uses it or as any of its
+ * elements is allocated.
+ */
+struct VirtQueueElementPool {
+    unsigned int sg_max;
+    size_t sz;          /* 0 until the first allocation */
+    size_t slot_size;
+    int refcnt;         /* atomic */
+    QSLIST_HEAD(, VirtQueueElementSlot) local;
+    QSLIST_HEAD(, VirtQueueElementSlot) freed;
 };
 
 const char *virtio_device_names[] = {
@@ -1056,7 +1082,8 @@ static void virtqueue_packed_flush(VirtQueue *vq, unsigned int count)
     /*
      * For indirect element's 'ndescs' is 1.
      * For all other elemment's 'ndescs' is the
-     * number of descriptors chained by NEXT (as set in virtqueue_packed_pop).
+     * number of descriptors chained by NEXT (as set in
+     * virtqueue_packed_pop_one()).
      * So When the 'elem' be filled into the descriptor ring,
      * The 'idx' of this 'elem' shall be
      * the value of 'vq->used_idx' plus the 'ndescs'.
@@ -1168,6 +1195,18 @@ void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
     virtqueue_flush(vq, 1);
 }
 
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int n)
+{
+    unsigned int i;
+
+    RCU_READ_LOCK_GUARD();
+    for (i = 0; i < n; i++) {
+        virtqueue_fill(vq, elems[i], lens[i], i);
+    }
+    virtqueue_flush(vq, n);
+}
+
 /* Called within rcu_read_lock().  */
 static int virtqueue_num_heads(VirtQueue *vq, unsigned int idx)
 {
@@ -1648,7 +1687,92 @@ void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem)
                                                                         false);
 }
 
-static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_num)
+static void virtqueue_element_pool_unref(VirtQueueElementPool *pool)
+{
+    VirtQueueElementSlot *slot, *next;
+
+    if (qatomic_fetch_dec(&pool->refcnt) != 1) {
+        return;
+    }
+
+    QSLIST_FOREACH_SAFE(slot, &pool->local, next, next) {
+        g_free(slot);
+    }
+    QSLIST_FOREACH_SAFE(slot, &pool->freed, next, next) {
+        g_free(slot);
+    }
+    g_free(pool);
+}
+
+/* Called by the thread popping from the queue */
+static void *virtqueue_element_pool_get(VirtQueueElementPool *pool)
+{
+    VirtQueueElementSlot *slot = QSLIST_FIRST(&pool->local);
+
+    if (!slot) {
+        QSLIST_MOVE_ATOMIC(&pool->local, &pool->freed);
+        slot = QSLIST_FIRST(&pool->local);
+    }
+
+    if (slot) {
+        QSLIST_REMOVE_HEAD(&pool->local, next);
+    } else {
+        slot = g_malloc(pool->slot_size);
+    }
+
+    qatomic_inc(&pool->refcnt);
+    return slot;
+}
+
+void virtio_queue_set_element_pool(VirtQueue *vq, unsigned int sg_max)
+{
+    if (vq->elem_pool) {
+        virtqueue_element_pool_unref(vq->elem_pool);
+        vq->elem_pool = NULL;
+    }
+
+    if (sg_max) {
+        vq->elem_pool = g_new0(VirtQueueElementPool, 1);
+        vq->elem_pool->sg_max = sg_max;
+        vq->elem_pool->refcnt = 1;
+    }
+}
+
+void virtqueue_element_free(VirtQueueElement *elem)
+{
+    VirtQueueElementPool *pool;
+
+    if (!elem) {
+        return;
+    }
+
+    pool = elem->pool;
+    if (!pool) {
+        g_free(elem);
+        return;
+    }
+
+    QSLIST_INSERT_HEAD_ATOMIC(&pool->freed, (VirtQueueElementSlot *)elem,
+                              next);
+    virtqueue_element_pool_unref(pool);
+}
+
+static size_t virtqueue_element_size(size_t sz, unsigned out_num,
+                                     unsigned in_num)
+{
+    VirtQueueElement *elem;
+    size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
+    size_t out_addr_ofs = in_addr_ofs + in_num * sizeof(elem->in_addr[0]);
+    size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
+    size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
+    size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
+
+    return out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
+}
+
+/* @pool may be NULL */
+static void *virtqueue_alloc_element(VirtQueueElementPool *pool, size_t sz,
+                                     unsigned out_num, unsigned in_num)
 {
     VirtQueueElement *elem;
     size_t in_addr_ofs = QEMU_ALIGN_UP(sz, __alignof__(elem->in_addr[0]));
@@ -1656,10 +1780,22 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     size_t out_addr_end = out_addr_ofs + out_num * sizeof(elem->out_addr[0]);
     size_t in_sg_ofs = QEMU_ALIGN_UP(out_addr_end, __alignof__(elem->in_sg[0]));
     size_t out_sg_ofs = in_sg_ofs + in_num * sizeof(elem->in_sg[0]);
-    size_t out_sg_end = out_sg_ofs + out_num * sizeof(elem->out_sg[0]);
 
     assert(sz >= sizeof(VirtQueueElement));
-    elem = g_malloc(out_sg_end);
+
+    if (pool && !pool->sz) {
+        /* Devices pop elements of a single size from a queue */
+        pool->sz = sz;
+        pool->slot_size = virtqueue_element_size(sz, pool->sg_max, 0);
+    }
+
+    if (pool && pool->sz == sz && out_num + in_num <= pool->sg_max) {
+        elem = virtqueue_element_pool_get(pool);
+        elem->pool = pool;
+    } else {
+        elem = g_malloc(virtqueue_element_size(sz, out_num, in_num));
+        elem->pool = NULL;
+    }
     trace_virtqueue_alloc_element(elem, sz, in_num, out_num);
     elem->out_num = out_num;
     elem->in_num = in_num;
@@ -1670,10 +1806,14 @@ static void *virtqueue_alloc_element(size_t sz, unsigned out_num, unsigned in_nu
     return elem;
 }
 
-static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
+/*
+ * Called within rcu_read_lock(), with @caches checked to cover the
+ * descriptor ring.
+ */
+static void *virtqueue_split_pop_one(VirtQueue *vq, size_t sz,
+                                     VRingMemoryRegionCaches *caches)
 {
     unsigned int i, head, max, idx;
-    VRingMemoryRegionCaches *caches;
     MemoryRegionCache indirect_desc_cache;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1687,14 +1827,6 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_empty_rcu(vq)) {
-        goto done;
-    }
-    /* Needed after virtio_queue_empty(), see comment in
-     * virtqueue_num_heads(). */
-    smp_rmb();
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1709,23 +1841,8 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
         goto done;
     }
 
-    if (virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
-        vring_set_avail_event(vq, vq->last_avail_idx);
-    }
-
     i = head;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_split_desc_read(vdev, &desc, desc_cache, i);
     if (desc.flags & VRING_DESC_F_INDIRECT) {
@@ -1784,7 +1901,7 @@ static void *virtqueue_split_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq->elem_pool, sz, out_num, in_num);
     elem->index = head;
     elem->ndescs = 1;
     for (i = 0; i < out_num; i++) {
@@ -1816,10 +1933,61 @@ err_undo_map:
     goto done;
 }
 
-static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
+static unsigned int virtqueue_split_pop_batch(VirtQueue *vq, size_t sz,
+                                              void **elems, unsigned int max)
 {
-    unsigned int i, max;
+    VirtIODevice *vdev = vq->vdev;
     VRingMemoryRegionCaches *caches;
+    uint16_t start_avail_idx = vq->last_avail_idx;
+    unsigned int n = 0;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_empty_rcu(vq)) {
+        return 0;
+    }
+    /* Needed after virtio_queue_empty(), see comment in
+     * virtqueue_num_heads(). */
+    smp_rmb();
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        virtio_error(vdev, "Region caches not initialized");
+        return 0;
+    }
+
+    if (caches->desc.len < vq->vring.num * sizeof(VRingDesc)) {
+        virtio_error(vdev, "Cannot map descriptor ring");
+        return 0;
+    }
+
+    /*
+     * Only take the heads that the avail index read above made visible,
+     * the barrier covers all of them.
+     */
+    while (n < max && vq->last_avail_idx != vq->shadow_avail_idx) {
+        elems[n] = virtqueue_split_pop_one(vq, sz, caches);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    }
+
+    if (vq->last_avail_idx != start_avail_idx &&
+        virtio_vdev_has_feature(vdev, VIRTIO_RING_F_EVENT_IDX)) {
+        vring_set_avail_event(vq, vq->last_avail_idx);
+    }
+
+    return n;
+}
+
+/*
+ * Called within rcu_read_lock(), with @caches checked to cover the
+ * descriptor ring.
+ */
+static void *virtqueue_packed_pop_one(VirtQueue *vq, size_t sz,
+                                      VRingMemoryRegionCaches *caches)
+{
+    unsigned int i, max;
     MemoryRegionCache indirect_desc_cache;
     MemoryRegionCache *desc_cache;
     int64_t len;
@@ -1834,11 +2002,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     address_space_cache_init_empty(&indirect_desc_cache);
 
-    RCU_READ_LOCK_GUARD();
-    if (virtio_queue_packed_empty_rcu(vq)) {
-        goto done;
-    }
-
     /* When we start there are none of either input nor output. */
     out_num = in_num = elem_entries = 0;
 
@@ -1851,17 +2014,6 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
 
     i = vq->last_avail_idx;
 
-    caches = vring_get_region_caches(vq);
-    if (!caches) {
-        virtio_error(vdev, "Region caches not initialized");
-        goto done;
-    }
-
-    if (caches->desc.len < max * sizeof(VRingDesc)) {
-        virtio_error(vdev, "Cannot map descriptor ring");
-        goto done;
-    }
-
     desc_cache = &caches->desc;
     vring_packed_desc_read(vdev, &desc, desc_cache, i, true);
     id = desc.id;
@@ -1924,7 +2076,7 @@ static void *virtqueue_packed_pop(VirtQueue *vq, size_t sz)
     }
 
     /* Now copy what we have collected and mapped */
-    elem = virtqueue_alloc_element(sz, out_num, in_num);
+    elem = virtqueue_alloc_element(vq->elem_pool, sz, out_num, in_num);
     for (i = 0; i < out_num; i++) {
         elem->out_addr[i] = addr[i];
         elem->out_sg[i] = iov[i];
@@ -1965,19 +2117,61 @@ err_undo_map:
     goto done;
 }
 
-void *virtqueue_pop(VirtQueue *vq, size_t sz)
+static unsigned int virtqueue_packed_pop_batch(VirtQueue *vq, size_t sz,
+                                               void **elems, unsigned int max)
 {
-    if (virtio_device_disabled(vq->vdev)) {
-        return NULL;
+    VirtIODevice *vdev = vq->vdev;
+    VRingMemoryRegionCaches *caches;
+    unsigned int n = 0;
+
+    RCU_READ_LOCK_GUARD();
+    if (virtio_queue_packed_empty_rcu(vq)) {
+        return 0;
+    }
+
+    caches = vring_get_region_caches(vq);
+    if (!caches) {
+        virtio_error(vdev, "Region caches not initialized");
+        return 0;
+    }
+
+    if (caches->desc.len < vq->vring.num * sizeof(VRingDesc)) {
+        virtio_error(vdev, "Cannot map descriptor ring");
+        return 0;
+    }
+
+    do {
+        elems[n] = virtqueue_packed_pop_one(vq, sz, caches);
+        if (!elems[n]) {
+            break;
+        }
+        n++;
+    } while (n < max && !virtio_queue_packed_empty_rcu(vq));
+
+    return n;
+}
+
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max)
+{
+    if (virtio_device_disabled(vq->vdev) || !max) {
+        return 0;
     }
 
     if (virtio_vdev_has_feature(vq->vdev, VIRTIO_F_RING_PACKED)) {
-        return virtqueue_packed_pop(vq, sz);
+        return virtqueue_packed_pop_batch(vq, sz, elems, max);
     } else {
-        return virtqueue_split_pop(vq, sz);
+        return virtqueue_split_pop_batch(vq, sz, elems, max);
     }
 }
 
+void *virtqueue_pop(VirtQueue *vq, size_t sz)
+{
+    void *elem;
+
+    return virtqueue_pop_batch(vq, sz, &elem, 1) ? elem : NULL;
+}
+
 static unsigned int virtqueue_packed_drop_all(VirtQueue *vq)
 {
     VRingMemoryRegionCaches *caches;
@@ -2113,7 +2307,7 @@ void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz)
     assert(ARRAY_SIZE(data.in_addr) >= data.in_num);
     assert(ARRAY_SIZE(data.out_addr) >= data.out_num);
 
-    elem = virtqueue_alloc_element(sz, data.out_num, data.in_num);
+    elem = virtqueue_alloc_element(NULL, sz, data.out_num, data.in_num);
     elem->index = data.index;
 
     for (i = 0; i < elem->in_num; i++) {
@@ -2561,6 +2755,7 @@ void virtio_delete_queue(VirtQueue *vq)
     vq->handle_output = NULL;
     g_free(vq->used_elems);
     vq->used_elems = NULL;
+    virtio_queue_set_element_pool(vq, 0);
     virtio_virtqueue_reset_region_cache(vq);
 }
 
@@ -2653,7 +2848,7 @@ static bool virtio_packed_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 }
 
 /* Called within rcu_read_lock().  */
-static bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
+bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq)
 {
     if (virtio_vdev_has_feature(vdev, VIRTIO_F_RING_PACKED)) {
         return virtio_packed_should_notify(vdev, vq);
@@ -2719,6 +2914,20 @@ void virtio_notify(VirtIODevice *vdev, VirtQueue *vq)
     virtio_irq(vq);
 }
 
+/* Batch irqs while inside a defer_call_begin()/defer_call_end() section */
+static void virtio_notify_deferred_fn(void *opaque)
+{
+    VirtQueue *vq = opaque;
+
+    virtio_notify(vq->vdev, vq);
+}
+
+void virtio_notify_deferred(VirtIODevice *vdev, VirtQueue *vq)
+{
+    assert(vq->vdev == vdev);
+    defer_call(virtio_notify_deferred_fn, vq);
+}
+
 void virtio_notify_config(VirtIODevice *vdev)
 {
     if (!(vdev->status & VIRTIO_CONFIG_S_DRIVER_OK))
@@ -3997,6 +4206,7 @@ static void virtio_device_free_virtqueues(VirtIODevice *vdev)
         if (vdev->vq[i].vring.num == 0) {
             break;
         }
+        virtio_queue_set_element_pool(&vdev->vq[i], 0);
         virtio_virtqueue_reset_region_cache(&vdev->vq[i]);
     }
     g_free(vdev->vq);
@@ -4021,7 +4231,7 @@ static Property virtio_properties[] = {
     DEFINE_PROP_END_OF_LIST(),
 };
 
-static int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int i, n, r, err;
@@ -4091,7 +4301,7 @@ int virtio_device_start_ioeventfd(VirtIODevice *vdev)
     return virtio_bus_start_ioeventfd(vbus);
 }
 
-static void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev)
 {
     VirtioBusState *qbus = VIRTIO_BUS(qdev_get_parent_bus(DEVICE(vdev)));
     int n, r;
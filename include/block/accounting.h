@@ -94,6 +94,31 @@ struct BlockAcctStats {
     BlockLatencyHistogram latency_histogram[BLOCK_MAX_IOTYPE];
 };
 
+/*
+ * Per-node accounting splits the latency of the requests a node handles in
+ * the time they wait before being dispatched to its driver (serialisation
+ * against overlapping requests) and the time the driver takes to complete
+ * them.  Format drivers additionally account their own metadata accesses.
+ */
+enum BlockNodeAcctPhase {
+    BLOCK_NODE_ACCT_QUEUE,
+    BLOCK_NODE_ACCT_IO,
+    BLOCK_NODE_ACCT_METADATA,
+    BLOCK_NODE_ACCT_MAX,
+};
+
+typedef struct BlockNodeAcctPhaseStats {
+    uint64_t nr_ops;
+    uint64_t total_time_ns;
+    BlockLatencyHistogram latency_histogram;
+} BlockNodeAcctPhaseStats;
+
+typedef struct BlockNodeAcctStats {
+    QemuMutex lock;
+    bool enabled; /* atomic */
+    BlockNodeAcctPhaseStats phase[BLOCK_NODE_ACCT_MAX][BLOCK_MAX_IOTYPE];
+} BlockNodeAcctStats;
+
 typedef struct BlockAcctCookie {
     int64_t bytes;
     int64_t start_time_ns;
@@ -121,4 +146,22 @@ int block_latency_histogram_set(BlockAcctStats *stats, enum BlockAcctType type,
                                 uint64List *boundaries);
 void block_latency_histograms_clear(BlockAcctStats *stats);
 
+void block_node_acct_init(BlockNodeAcctStats *stats);
+void block_node_acct_cleanup(BlockNodeAcctStats *stats);
+int block_node_acct_setup(BlockNodeAcctStats *stats, bool enable,
+                          uint64List *boundaries);
+
+static inline bool block_node_acct_enabled(BlockNodeAcctStats *stats)
+{
+    return qatomic_read(&stats->enabled);
+}
+
+/* Returns the start time of an operation, or 0 if accounting is disabled */
+int64_t block_node_acct_start(BlockNodeAcctStats *stats);
+void block_node_acct_request(BlockNodeAcctStats *stats,
+                             enum BlockAcctType type,
+                             int64_t start_ns, int64_t dispatch_ns);
+void block_node_acct_metadata(BlockNodeAcctStats *stats,
+                              enum BlockAcctType type, int64_t start_ns);
+
 #endif
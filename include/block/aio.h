@@ -58,9 +58,40 @@ struct ThreadPool;
 struct LinuxAioState;
 typedef struct LuringState LuringState;
 
+/* Flags of the io_uring rings of an AioContext */
+#define AIO_IO_URING_IOPOLL     (1 << 0) /* poll for completions */
+#define AIO_IO_URING_SQPOLL     (1 << 1) /* kernel thread polls submissions */
+#define AIO_IO_URING_MODES      4
+
 /* Is polling disabled? */
 bool aio_poll_disabled(AioContext *ctx);
 
+#ifdef CONFIG_LINUX_IO_URING
+typedef struct CqeHandler CqeHandler;
+
+/* Completion callback of a request submitted with aio_add_sqe() */
+typedef void CqeHandlerFunc(CqeHandler *cqe_handler);
+
+/* Fills in an sqe for aio_add_sqe() */
+typedef void AioPrepSqeFunc(struct io_uring_sqe *sqe, void *opaque);
+
+/*
+ * The state of a request submitted with aio_add_sqe().  It is usually
+ * embedded in a larger structure that @cb finds with container_of().
+ */
+struct CqeHandler {
+    CqeHandlerFunc *cb;
+
+    /* The completion of the request, filled in before @cb is called */
+    struct io_uring_cqe cqe;
+
+    /* Used internally, do not access this */
+    QSIMPLEQ_ENTRY(CqeHandler) next;
+};
+
+typedef QSIMPLEQ_HEAD(, CqeHandler) CqeHandlerSimpleQ;
+#endif
+
 /* Callbacks for file descriptor monitoring implementations */
 typedef struct {
     /*
@@ -106,6 +137,32 @@ typedef struct {
      * Returns: true if ->wait() should be called, false otherwise.
      */
     bool (*need_wait)(AioContext *ctx);
+
+    /*
+     * dispatch:
+     * @ctx: the AioContext
+     *
+     * Run the completion callbacks of requests that ->wait() collected, or
+     * NULL if the implementation has none.
+     *
+     * Returns: true if any callback was run, false otherwise.
+     */
+    bool (*dispatch)(AioContext *ctx);
+
+#ifdef CONFIG_LINUX_IO_URING
+    /*
+     * add_sqe:
+     * @ctx: the AioContext
+     * @prep_sqe: fills in the sqe
+     * @opaque: argument of @prep_sqe
+     * @cqe_handler: called from ->dispatch() when the request completes
+     *
+     * Add an io_uring request, see aio_add_sqe().  NULL if the
+     * implementation does not use io_uring.
+     */
+    void (*add_sqe)(AioContext *ctx, AioPrepSqeFunc *prep_sqe, void *opaque,
+                    CqeHandler *cqe_handler);
+#endif
 } FDMonOps;
 
 /*
@@ -213,11 +270,15 @@ struct AioContext {
     struct LinuxAioState *linux_aio;
 #endif
 #ifdef CONFIG_LINUX_IO_URING
-    LuringState *linux_io_uring;
+    /* One ring for each combination of AIO_IO_URING_* flags */
+    LuringState *linux_io_uring[AIO_IO_URING_MODES];
 
     /* State for file descriptor monitoring using Linux io_uring */
     struct io_uring fdmon_io_uring;
     AioHandlerSList submit_list;
+
+    /* Completed aio_add_sqe() requests waiting for ->dispatch() */
+    CqeHandlerSimpleQ cqe_handler_ready_list;
 #endif
 
     /* TimerLists for calling timers - one per clock type.  Has its own
@@ -509,11 +570,49 @@ struct LinuxAioState *aio_setup_linux_aio(AioContext *ctx, Error **errp);
 /* Return the LinuxAioState bound to this AioContext */
 struct LinuxAioState *aio_get_linux_aio(AioContext *ctx);
 
-/* Setup the LuringState bound to this AioContext */
-LuringState *aio_setup_linux_io_uring(AioContext *ctx, Error **errp);
+/* Setup the LuringState bound to this AioContext with AIO_IO_URING_* @flags */
+LuringState *aio_setup_linux_io_uring(AioContext *ctx, unsigned flags,
+                                      Error **errp);
 
-/* Return the LuringState bound to this AioContext */
-LuringState *aio_get_linux_io_uring(AioContext *ctx);
+/* Return the LuringState bound to this AioContext with AIO_IO_URING_* @flags */
+LuringState *aio_get_linux_io_uring(AioContext *ctx, unsigned flags);
+
+#ifdef CONFIG_LINUX_IO_URING
+/**
+ * aio_has_io_uring:
+ * @ctx: the aio context
+ *
+ * Returns: true if @ctx monitors file descriptors with io_uring, and so
+ * aio_add_sqe() can be used in it.  This is not the case in the main loop,
+ * which uses the glib event loop, or if the host kernel lacks io_uring;
+ * callers must then fall back to aio_set_fd_handler().
+ */
+bool aio_has_io_uring(AioContext *ctx);
+
+/**
+ * aio_add_sqe:
+ * @prep_sqe: fills in the sqe, like io_uring_prep_recv() would
+ * @opaque: argument of @prep_sqe
+ * @cqe_handler: the state of the request, with cqe_handler->cb set
+ *
+ * Submit an io_uring request in the fd monitoring ring of the current
+ * AioContext, which must satisfy aio_has_io_uring().  Instead of waiting for
+ * a file descriptor to become ready and then doing the I/O from its handler,
+ * the caller lets the kernel do both and only gets the result, at the cost
+ * of keeping its buffers reserved until then.
+ *
+ * @prep_sqe must not call io_uring_sqe_set_data().  The request may reach
+ * the kernel right away or with the next event loop iteration.  When it
+ * completes, cqe_handler->cb is called from aio_poll() with
+ * cqe_handler->cqe filled in.  @cqe_handler must stay valid until then, and
+ * requests must have completed before the AioContext is destroyed; cancel
+ * them with IORING_OP_ASYNC_CANCEL if needed.
+ *
+ * This function is not thread-safe.
+ */
+void aio_add_sqe(AioPrepSqeFunc *prep_sqe, void *opaque,
+                 CqeHandler *cqe_handler);
+#endif
 /**
  * aio_timer_new_with_attrs:
  * @ctx: the aio context
@@ -705,6 +804,25 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
                                  int64_t grow, int64_t shrink,
                                  Error **errp);
 
+/* Adaptive polling state of a file descriptor handler */
+typedef struct AioPollStats {
+    int fd;
+    int64_t poll_ns;    /* current polling time in nanoseconds */
+    uint64_t hits;      /* events detected by polling */
+    uint64_t misses;    /* events detected by fd monitoring instead */
+} AioPollStats;
+
+/**
+ * aio_context_get_poll_stats:
+ * @ctx: the aio context
+ * @n: set to the number of returned entries
+ *
+ * Return the polling state of the handlers of @ctx that support polling,
+ * as an array to be freed with g_free().  This may be called from any
+ * thread, the values are snapshots of a running event loop.
+ */
+AioPollStats *aio_context_get_poll_stats(AioContext *ctx, size_t *n);
+
 /**
  * aio_context_set_aio_params:
  * @ctx: the aio context
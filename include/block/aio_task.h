@@ -43,6 +43,13 @@ int aio_task_pool_status(AioTaskPool *pool);
 /* User provides filled @task, however task->pool will be set automatically */
 void coroutine_fn aio_task_pool_start_task(AioTaskPool *pool, AioTask *task);
 
+/*
+ * Change the number of tasks that may run at once.  Tasks already running
+ * beyond a lowered limit are not interrupted, but no new ones can start until
+ * enough of them finished.
+ */
+void aio_task_pool_set_max_busy_tasks(AioTaskPool *pool, int max_busy_tasks);
+
 void coroutine_fn aio_task_pool_wait_slot(AioTaskPool *pool);
 void coroutine_fn aio_task_pool_wait_one(AioTaskPool *pool);
 void coroutine_fn aio_task_pool_wait_all(AioTaskPool *pool);
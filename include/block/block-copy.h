@@ -83,6 +83,14 @@ bool block_copy_call_cancelled(BlockCopyCallState *call_state);
 int block_copy_call_status(BlockCopyCallState *call_state, bool *error_is_read);
 
 void block_copy_set_speed(BlockCopyState *s, uint64_t speed);
+
+/*
+ * Let block_copy_async() calls started from now on adapt their chunk size
+ * and number of workers, within @max_chunk and @max_workers, so that their
+ * requests and copy-before-write operations take at most @max_latency_ns.
+ * Zero disables the adaptation, which is also the default.
+ */
+void block_copy_set_max_latency(BlockCopyState *s, int64_t max_latency_ns);
 void block_copy_kick(BlockCopyCallState *call_state);
 
 /*
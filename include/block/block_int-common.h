@@ -24,6 +24,7 @@
 #ifndef BLOCK_INT_COMMON_H
 #define BLOCK_INT_COMMON_H
 
+#include "block/accounting.h"
 #include "block/aio.h"
 #include "block/block-common.h"
 #include "block/block-global-state.h"
@@ -79,6 +80,10 @@ typedef struct BdrvTrackedRequest {
     int64_t bytes;
     enum BdrvTrackedRequestType type;
 
+    /* For bs->node_stats, 0 if not accounted or not dispatched yet */
+    int64_t acct_start_ns;
+    int64_t acct_dispatch_ns;
+
     bool serialising;
     int64_t overlap_offset;
     int64_t overlap_bytes;
@@ -1213,6 +1218,9 @@ struct BlockDriverState {
     /* Offset after the highest byte written to */
     Stat64 wr_highest_offset;
 
+    /* Latency of the requests on this node, see block-node-latency-set */
+    BlockNodeAcctStats node_stats;
+
     /*
      * If true, copy read backing sectors into image.  Can be >1 if more
      * than one client has requested copy-on-read.  Accessed with atomic
@@ -0,0 +1,87 @@
+/*
+ * Latency driven tuning of block copy jobs
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef BLOCK_COPY_TUNER_H
+#define BLOCK_COPY_TUNER_H
+
+#include "qemu/atomic.h"
+#include "qemu/thread.h"
+
+/*
+ * Picks the request size and the number of parallel requests of a copy
+ * job, so that the job runs as fast as possible while its own requests
+ * and the guest requests competing with it complete within a latency
+ * bound.
+ *
+ * The job reports each request it completes through copy_tuner_op_done(),
+ * the guest I/O path does the same through copy_tuner_guest_op_done().
+ * Once per period the worse of the two average latencies is compared to
+ * the bound: above it, concurrency and request size are halved; below half
+ * of it, concurrency grows by a quarter or, once at its maximum, the
+ * request size doubles.
+ *
+ * Any thread may use a CopyTuner.
+ */
+typedef struct CopyTuner {
+    /* Fixed by copy_tuner_init() */
+    int64_t min_chunk;
+    int64_t max_chunk;
+    int max_workers;
+
+    bool enabled; /* atomic */
+
+    QemuMutex lock;
+    int64_t max_latency_ns;
+    int64_t chunk;
+    int workers;
+    int64_t period_start_ns;
+    uint64_t ops;
+    uint64_t guest_ops;
+    int64_t latency_ns;         /* Sum over the current period */
+    int64_t guest_latency_ns;   /* Sum over the current period */
+} CopyTuner;
+
+/**
+ * copy_tuner_init: set up @t for a job
+ *
+ * @t: the tuner
+ * @max_latency_ns: latency bound, see copy_tuner_set_max_latency()
+ * @min_chunk: smallest request size, used as alignment of the others
+ * @chunk: initial request size
+ * @max_chunk: largest request size
+ * @workers: initial number of parallel requests
+ * @max_workers: largest number of parallel requests
+ */
+void copy_tuner_init(CopyTuner *t, int64_t max_latency_ns,
+                     int64_t min_chunk, int64_t chunk, int64_t max_chunk,
+                     int workers, int max_workers);
+void copy_tuner_destroy(CopyTuner *t);
+
+/*
+ * Change the latency bound of @t.  0 disables tuning, which keeps the
+ * request size and the number of parallel requests where they are.
+ */
+void copy_tuner_set_max_latency(CopyTuner *t, int64_t max_latency_ns);
+
+static inline bool copy_tuner_enabled(CopyTuner *t)
+{
+    return qatomic_read(&t->enabled);
+}
+
+/* The request size the job should use at most right now */
+int64_t copy_tuner_chunk(CopyTuner *t);
+
+/* The number of requests the job should keep in flight at most right now */
+int copy_tuner_workers(CopyTuner *t);
+
+/* Report a job request that started at @start_ns on QEMU_CLOCK_REALTIME */
+void copy_tuner_op_done(CopyTuner *t, int64_t start_ns);
+
+/* Report a guest request that started at @start_ns on QEMU_CLOCK_REALTIME */
+void copy_tuner_guest_op_done(CopyTuner *t, int64_t start_ns);
+
+#endif
@@ -66,12 +66,20 @@ void laio_attach_aio_context(LinuxAioState *s, AioContext *new_context);
 #endif
 /* io_uring.c - Linux io_uring implementation */
 #ifdef CONFIG_LINUX_IO_URING
-LuringState *luring_init(Error **errp);
+LuringState *luring_init(unsigned flags, Error **errp);
 void luring_cleanup(LuringState *s);
 
-/* luring_co_submit: submit I/O requests in the thread's current AioContext. */
-int coroutine_fn luring_co_submit(BlockDriverState *bs, int fd, uint64_t offset,
+/*
+ * luring_co_submit: submit I/O requests in the thread's current AioContext,
+ * on its ring with AIO_IO_URING_* @flags.
+ */
+int coroutine_fn luring_co_submit(BlockDriverState *bs, unsigned flags, int fd,
+                                  int fixed_file, uint64_t offset,
                                   QEMUIOVector *qiov, int type);
+void luring_register_buf(void *host, size_t size);
+void luring_unregister_buf(void *host, size_t size);
+int luring_register_file(int fd);
+void luring_unregister_file(int slot);
 void luring_detach_aio_context(LuringState *s, AioContext *old_context);
 void luring_attach_aio_context(LuringState *s, AioContext *new_context);
 #endif
@@ -3,13 +3,27 @@
 
 #include "chardev/char.h"
 #include "qemu/main-loop.h"
+#include "qemu/units.h"
 
 typedef void IOEventHandler(void *opaque, QEMUChrEvent event);
 typedef int BackendChangeHandler(void *opaque);
 
+/*
+ * FEWriteDoneFunc: called once the back end has consumed the data of a
+ * queued qemu_chr_fe_write_async(), with 0 or a negative errno.
+ */
+typedef void FEWriteDoneFunc(void *opaque, int ret);
+
+/* Default bound of the asynchronous write queue, in bytes */
+#define CHR_FE_WRITE_QUEUE_LIMIT (1 * MiB)
+
 /**
  * struct CharBackend - back end as seen by front end
  * @fe_is_open: the front end is ready for IO
+ * @write_queue: data of qemu_chr_fe_write_async() not yet consumed
+ * @write_queued: number of bytes in @write_queue
+ * @write_limit: bound of @write_queued, or 0 for the default
+ * @write_watch: source tag of the watch flushing @write_queue
  *
  * The actual backend is Chardev
  */
@@ -18,10 +32,15 @@ struct CharBackend {
     IOEventHandler *chr_event;
     IOCanReadHandler *chr_can_read;
     IOReadHandler *chr_read;
+    IOReadHandler *chr_read_msg;
     BackendChangeHandler *chr_be_change;
     void *opaque;
     unsigned int tag;
     bool fe_is_open;
+    GQueue write_queue;
+    size_t write_queued;
+    size_t write_limit;
+    guint write_watch;
 };
 
 /**
@@ -89,6 +108,12 @@ bool qemu_chr_fe_backend_open(CharBackend *be);
  * Set the front end char handlers. The front end takes the focus if
  * any of the handler is non-NULL.
  *
+ * The chardev's sources, including its listener, reconnect timer and
+ * TLS handshake, move to @context, so the handlers run in whichever
+ * thread runs it.  With a context other than the default, they run
+ * without the BQL, and must only use thread-safe chardev functions.
+ * Websocket chardevs cannot be moved.
+ *
  * Without associated Chardev, nothing is changed.
  */
 void qemu_chr_fe_set_handlers_full(CharBackend *b,
@@ -115,6 +140,28 @@ void qemu_chr_fe_set_handlers(CharBackend *b,
                               GMainContext *context,
                               bool set_open);
 
+/**
+ * qemu_chr_fe_get_iothread:
+ *
+ * Returns: the IOThread that the chardev's iothread option names, for
+ *          front ends that can run it there, or NULL.  No reference
+ *          is taken.
+ */
+IOThread *qemu_chr_fe_get_iothread(CharBackend *be);
+
+/**
+ * qemu_chr_fe_set_msg_handler:
+ * @b: a CharBackend
+ * @fd_read_msg: called with each whole message
+ *
+ * On back ends with %QEMU_CHAR_FEATURE_SEQPACKET, deliver each message
+ * whole to @fd_read_msg instead of as part of the byte stream given to
+ * the read handler.  The can_read handler still gates reading, but any
+ * non-zero value admits a whole message.  Must be called after
+ * qemu_chr_fe_set_handlers(), which resets it.
+ */
+void qemu_chr_fe_set_msg_handler(CharBackend *b, IOReadHandler *fd_read_msg);
+
 /**
  * qemu_chr_fe_take_focus:
  *
@@ -247,6 +294,63 @@ int qemu_chr_fe_write(CharBackend *be, const uint8_t *buf, int len);
  */
 int qemu_chr_fe_write_all(CharBackend *be, const uint8_t *buf, int len);
 
+/**
+ * qemu_chr_fe_writev_all:
+ * @iov: the data
+ * @iovcnt: the number of elements in @iov
+ *
+ * Like @qemu_chr_fe_write_all, but gathers the data from @iov.  Socket
+ * and fd back ends send it with a single vectored write where they can;
+ * other back ends are written one element at a time.  The elements are
+ * never interleaved with concurrent writers.  This function is
+ * thread-safe.
+ *
+ * Returns: the number of bytes consumed (0 if no associated Chardev)
+ *          or -1 on error.
+ */
+int qemu_chr_fe_writev_all(CharBackend *be, const struct iovec *iov,
+                           int iovcnt);
+
+/**
+ * qemu_chr_fe_write_async:
+ * @iov: the data
+ * @iovcnt: the number of elements in @iov
+ * @cb: called when queued data has been consumed, or NULL
+ * @opaque: passed to @cb
+ *
+ * Write data to a character backend without blocking.  Whatever the back
+ * end does not take right away is copied to a queue that is flushed from
+ * a G_IO_OUT watch in the chardev's context, and @cb is called once it is
+ * all gone, or with -ECANCELED from qemu_chr_fe_deinit().  @cb may be
+ * NULL even if the data gets queued, when the caller does not need to
+ * know when it is consumed.  Data never overtakes earlier queued data,
+ * but synchronous writes do, so do not mix them while the queue is not
+ * empty.  Must be called from the thread running the chardev's context.
+ *
+ * Returns: 1 if all data went out right away and @cb will not be
+ *          called, 0 if some of it was queued, -EAGAIN if it would
+ *          exceed the queue limit and nothing was written, or another
+ *          negative errno on error.
+ */
+int qemu_chr_fe_write_async(CharBackend *be, const struct iovec *iov,
+                            int iovcnt, FEWriteDoneFunc *cb, void *opaque);
+
+/**
+ * qemu_chr_fe_set_write_limit:
+ * @limit: the number of bytes, or 0 for %CHR_FE_WRITE_QUEUE_LIMIT
+ *
+ * Bound the queue of qemu_chr_fe_write_async().  A write larger than the
+ * bound is still accepted when the queue is empty.
+ */
+void qemu_chr_fe_set_write_limit(CharBackend *be, size_t limit);
+
+/**
+ * qemu_chr_fe_write_pending:
+ *
+ * Returns: the number of bytes queued by qemu_chr_fe_write_async()
+ */
+size_t qemu_chr_fe_write_pending(CharBackend *be);
+
 /**
  * qemu_chr_fe_read_all:
  * @buf: the data buffer
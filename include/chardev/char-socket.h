@@ -64,6 +64,11 @@ struct SocketChardev {
     size_t write_msgfds_num;
     bool registered_yank;
 
+    /* Receive buffer, grown up to read_buf_max while reads fill it */
+    uint8_t *read_buf;
+    size_t read_buf_len;
+    size_t read_buf_max;
+
     SocketAddress *addr;
     bool is_listen;
     bool is_telnet;
@@ -72,6 +77,7 @@ struct SocketChardev {
     TCPChardevTelnetInit *telnet_init;
 
     bool is_websock;
+    bool is_seqpacket;
 
     GSource *reconnect_timer;
     int64_t reconnect_time_ms;
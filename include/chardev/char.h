@@ -50,6 +50,9 @@ typedef enum {
     /* Whether the gcontext can be changed after calling
      * qemu_chr_be_update_read_handlers() */
     QEMU_CHAR_FEATURE_GCONTEXT,
+    /* Whether the data channel preserves message boundaries, see
+     * qemu_chr_be_write_msg() */
+    QEMU_CHAR_FEATURE_SEQPACKET,
 
     QEMU_CHAR_FEATURE_LAST,
 } ChardevFeature;
@@ -69,6 +72,8 @@ struct Chardev {
     bool handover_yank_instance;
     GSource *gsource;
     GMainContext *gcontext;
+    /* offered to front ends, see qemu_chr_fe_get_iothread() */
+    IOThread *iothread;
     DECLARE_BITMAP(features, QEMU_CHAR_FEATURE_LAST);
 };
 
@@ -197,6 +202,18 @@ void qemu_chr_be_write(Chardev *s, const uint8_t *buf, int len);
  */
 void qemu_chr_be_write_impl(Chardev *s, const uint8_t *buf, int len);
 
+/**
+ * qemu_chr_be_write_msg:
+ * @buf: a buffer holding one whole message
+ * @len: the length of the message
+ *
+ * Like @qemu_chr_be_write, for back ends that preserve message
+ * boundaries.  The message goes to the front end's message handler if it
+ * has one, and is written to its byte stream otherwise.  Under record or
+ * replay, messages are always treated as part of the byte stream.
+ */
+void qemu_chr_be_write_msg(Chardev *s, const uint8_t *buf, int len);
+
 /**
  * qemu_chr_be_update_read_handlers:
  * @context: the gcontext that will be used to attach the watch sources
@@ -225,6 +242,8 @@ QemuOpts *qemu_chr_parse_compat(const char *label, const char *filename,
                                 bool permit_mux_mon);
 int qemu_chr_write(Chardev *s, const uint8_t *buf, int len, bool write_all);
 #define qemu_chr_write_all(s, buf, len) qemu_chr_write(s, buf, len, true)
+int qemu_chr_writev(Chardev *s, const struct iovec *iov, int iovcnt,
+                    bool write_all);
 int qemu_chr_wait_connected(Chardev *chr, Error **errp);
 
 #define TYPE_CHARDEV "chardev"
@@ -265,6 +284,9 @@ struct ChardevClass {
     /* write buf to the backend */
     int (*chr_write)(Chardev *s, const uint8_t *buf, int len);
 
+    /* write iov to the backend, optional; may write less than all of it */
+    int (*chr_writev)(Chardev *s, const struct iovec *iov, int iovcnt);
+
     /*
      * Read from the backend (blocking). A typical front-end will instead rely
      * on chr_can_read/chr_read being called when polling/looping.
@@ -353,4 +353,28 @@ int qcrypto_tls_session_get_key_size(QCryptoTLSSession *sess,
  */
 char *qcrypto_tls_session_get_peer_name(QCryptoTLSSession *sess);
 
+/**
+ * qcrypto_tls_session_enable_ktls_tx:
+ * @sess: the TLS session object
+ * @fd: the TCP socket the session runs over
+ * @errp: pointer to a NULL-initialized error object
+ *
+ * If the credentials of @sess ask for it, hand the sending side
+ * of the session over to the kernel, so that plain data written
+ * to @fd is encrypted by the kernel (Linux kTLS).  This must be
+ * called once the handshake has completed, before any payload
+ * was written.  Afterwards, qcrypto_tls_session_write() must no
+ * longer be used, but qcrypto_tls_session_read() still is.
+ *
+ * If kTLS was asked for but can't be used, for example because
+ * of the cipher in use, @errp is set and the session stays as it
+ * was, i.e. it can keep encrypting in userspace.
+ *
+ * Returns: true if the kernel now encrypts the data written to
+ * @fd, false otherwise
+ */
+bool qcrypto_tls_session_enable_ktls_tx(QCryptoTLSSession *sess,
+                                        int fd,
+                                        Error **errp);
+
 #endif /* QCRYPTO_TLSSESSION_H */
@@ -29,6 +29,11 @@
 
 #define XTS_BLOCK_SIZE 16
 
+/*
+ * Encrypt or decrypt @length bytes, a multiple of XTS_BLOCK_SIZE that
+ * may span several blocks, applying the cipher to each block in turn.
+ * @dst and @src may be the same buffer.
+ */
 typedef void xts_cipher_func(const void *ctx,
                              size_t length,
                              uint8_t *dst,
@@ -175,6 +175,9 @@ int qemu_ram_foreach_block(RAMBlockIterFunc func, void *opaque);
 int ram_block_discard_range(RAMBlock *rb, uint64_t start, size_t length);
 int ram_block_discard_guest_memfd_range(RAMBlock *rb, uint64_t start,
                                         size_t length);
+void ram_block_set_private(RAMBlock *rb, uint64_t start, size_t length,
+                           bool to_private);
+bool ram_block_is_private(RAMBlock *rb, uint64_t offset);
 
 #endif
 
@@ -73,7 +73,16 @@ static inline void fuzz_dma_read_cb(size_t addr,
 /* Dirty tracking enabled because dirty limit */
 #define GLOBAL_DIRTY_LIMIT      (1U << 2)
 
-#define GLOBAL_DIRTY_MASK  (0x7)
+/* Dirty tracking enabled because a pcileech client asked for it */
+#define GLOBAL_DIRTY_PCILEECH   (1U << 3)
+
+/* Dirty tracking enabled because an incremental dump chain is open */
+#define GLOBAL_DIRTY_DUMP       (1U << 4)
+
+/* Dirty tracking enabled to estimate dirty rates from the KVM dirty ring */
+#define GLOBAL_DIRTY_ESTIMATE   (1U << 5)
+
+#define GLOBAL_DIRTY_MASK  (0x3f)
 
 extern unsigned int global_dirty_tracking;
 
@@ -128,6 +137,19 @@ struct IOMMUTLBEntry {
     IOMMUAccessFlags perm;
 };
 
+/*
+ * A run of IOVAs that translate to contiguous addresses in @target_as,
+ * as returned by memory_region_iommu_translate_range().  Unlike
+ * IOMMUTLBEntry, @len need not be a power of two.
+ */
+typedef struct IOMMUTLBRun {
+    AddressSpace    *target_as;
+    hwaddr           iova;
+    hwaddr           translated_addr;
+    hwaddr           len;
+    IOMMUAccessFlags perm;
+} IOMMUTLBRun;
+
 /*
  * Bitmap for different IOMMUNotifier capabilities. Each notifier can
  * register with one or multiple IOMMU Notifier capability bit(s).
@@ -1878,6 +1900,34 @@ int memory_region_iommu_get_attr(IOMMUMemoryRegion *iommu_mr,
                                  enum IOMMUMemoryRegionAttr attr,
                                  void *data);
 
+/**
+ * memory_region_iommu_translate_range: translate a range of IOVAs
+ *
+ * Walks [@addr, @addr + @len) through the IOMMU translate() callback,
+ * one IOTLB entry at a time, and merges the results into runs that are
+ * contiguous in the same target address space with the same
+ * permissions.  A single large-page entry therefore costs one lookup.
+ * The walk stops at the first IOVA that does not allow @flag, or when
+ * @max_runs runs are full.  Must be called inside an RCU critical
+ * section, like address_space_translate().
+ *
+ * Returns the number of bytes from @addr covered by the runs.
+ *
+ * @iommu_mr: the IOMMU memory region
+ * @addr: the first IOVA to translate
+ * @len: the number of bytes to translate
+ * @flag: the access that the translation must allow
+ * @iommu_idx: the IOMMU index for the translation
+ * @runs: array that receives the runs
+ * @max_runs: size of @runs
+ * @nr_runs: set to the number of runs stored into @runs
+ */
+hwaddr memory_region_iommu_translate_range(IOMMUMemoryRegion *iommu_mr,
+                                           hwaddr addr, hwaddr len,
+                                           IOMMUAccessFlags flag,
+                                           int iommu_idx, IOMMUTLBRun *runs,
+                                           int max_runs, int *nr_runs);
+
 /**
  * memory_region_iommu_attrs_to_index: return the IOMMU index to
  * use for translations with the given memory transaction attributes.
@@ -2671,6 +2721,30 @@ MemTxResult address_space_write(AddressSpace *as, hwaddr addr,
                                 MemTxAttrs attrs,
                                 const void *buf, hwaddr len);
 
+/**
+ * address_space_memcpy: copy between two ranges of an address space.
+ *
+ * Copy @len bytes from @src to @dest without a bounce buffer where the
+ * source is RAM; the ranges must not overlap.  Where either side is not
+ * RAM, copy with transactions of at most @burst bytes, as a DMA
+ * controller moving data through its internal buffer would.  Within a
+ * transaction, MMIO is accessed as in address_space_read() and
+ * address_space_write().
+ *
+ * Return a MemTxResult indicating whether the operation succeeded
+ * or failed (eg unassigned memory, device rejected the transaction,
+ * IOMMU fault).
+ *
+ * @as: #AddressSpace to be accessed
+ * @dest: destination address within that address space
+ * @src: source address within that address space
+ * @attrs: memory transaction attributes
+ * @len: the number of bytes to copy
+ * @burst: the largest transaction size, for MMIO
+ */
+MemTxResult address_space_memcpy(AddressSpace *as, hwaddr dest, hwaddr src,
+                                 MemTxAttrs attrs, hwaddr len, hwaddr burst);
+
 /**
  * address_space_write_rom: write to address space, including ROM.
  *
@@ -27,6 +27,7 @@
 #include "exec/ramblock.h"
 #include "exec/exec-all.h"
 #include "qemu/rcu.h"
+#include "qemu/cutils.h"
 
 extern uint64_t total_dirty_pages;
 
@@ -45,7 +46,8 @@ static inline long clear_bmap_size(uint64_t pages, uint8_t shift)
 
 /**
  * clear_bmap_set: set clear bitmap for the page range.  Must be with
- * bitmap_mutex held.
+ * bitmap_mutex held; threads syncing disjoint ranges on behalf of the
+ * holder may call it concurrently.
  *
  * @rb: the ramblock to operate on
  * @start: the start page number
@@ -58,7 +60,8 @@ static inline void clear_bmap_set(RAMBlock *rb, uint64_t start,
 {
     uint8_t shift = rb->clear_bmap_shift;
 
-    bitmap_set(rb->clear_bmap, start >> shift, clear_bmap_size(npages, shift));
+    bitmap_set_atomic(rb->clear_bmap, start >> shift,
+                      clear_bmap_size(npages, shift));
 }
 
 /**
@@ -488,7 +491,7 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
     if (((word * BITS_PER_LONG) << TARGET_PAGE_BITS) ==
          (start + rb->offset) &&
         !(length & ((BITS_PER_LONG << TARGET_PAGE_BITS) - 1))) {
-        int k;
+        int k, n;
         int nr = BITS_TO_LONGS(length >> TARGET_PAGE_BITS);
         unsigned long * const *src;
         unsigned long idx = (word * BITS_PER_LONG) / DIRTY_MEMORY_BLOCK_SIZE;
@@ -499,15 +502,42 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         src = qatomic_rcu_read(
                 &ram_list.dirty_memory[DIRTY_MEMORY_MIGRATION])->blocks;
 
-        for (k = page; k < page + nr; k++) {
+        for (k = page; k < page + nr; k += n) {
+            unsigned long bits = 0;
+
+            /*
+             * Runs are aligned within the DirtyMemoryBlock, whose size is
+             * a multiple of the run, so they never straddle two blocks.
+             */
+            n = BITMAP_ZERO_RUN_LONGS;
+            if (!(offset % n) && k + n <= page + nr &&
+                buffer_is_zero_ge256(&src[idx][offset],
+                                     n * sizeof(unsigned long))) {
+                if (rb->dirty_prev) {
+                    memset(&rb->hot_bmap[k], 0, n * sizeof(unsigned long));
+                    memset(&rb->dirty_prev[k], 0, n * sizeof(unsigned long));
+                }
+                offset += n;
+                if (offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
+                    offset = 0;
+                    idx++;
+                }
+                continue;
+            }
+
+            n = 1;
             if (src[idx][offset]) {
-                unsigned long bits = qatomic_xchg(&src[idx][offset], 0);
                 unsigned long new_dirty;
+                bits = qatomic_xchg(&src[idx][offset], 0);
                 new_dirty = ~dest[k];
                 dest[k] |= bits;
                 new_dirty &= bits;
                 num_dirty += ctpopl(new_dirty);
             }
+            if (rb->dirty_prev) {
+                rb->hot_bmap[k] = bits & rb->dirty_prev[k];
+                rb->dirty_prev[k] = bits;
+            }
 
             if (++offset >= BITS_TO_LONGS(DIRTY_MEMORY_BLOCK_SIZE)) {
                 offset = 0;
@@ -534,13 +564,25 @@ uint64_t cpu_physical_memory_sync_dirty_bitmap(RAMBlock *rb,
         ram_addr_t offset = rb->offset;
 
         for (addr = 0; addr < length; addr += TARGET_PAGE_SIZE) {
-            if (cpu_physical_memory_test_and_clear_dirty(
+            long k = (start + addr) >> TARGET_PAGE_BITS;
+            bool dirty = cpu_physical_memory_test_and_clear_dirty(
                         start + addr + offset,
                         TARGET_PAGE_SIZE,
-                        DIRTY_MEMORY_MIGRATION)) {
-                long k = (start + addr) >> TARGET_PAGE_BITS;
-                if (!test_and_set_bit(k, dest)) {
-                    num_dirty++;
+                        DIRTY_MEMORY_MIGRATION);
+
+            if (dirty && !test_and_set_bit(k, dest)) {
+                num_dirty++;
+            }
+            if (rb->dirty_prev) {
+                if (dirty && test_bit(k, rb->dirty_prev)) {
+                    set_bit(k, rb->hot_bmap);
+                } else {
+                    clear_bit(k, rb->hot_bmap);
+                }
+                if (dirty) {
+                    set_bit(k, rb->dirty_prev);
+                } else {
+                    clear_bit(k, rb->dirty_prev);
                 }
             }
         }
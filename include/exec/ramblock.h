@@ -42,6 +42,11 @@ struct RAMBlock {
     int fd;
     uint64_t fd_offset;
     int guest_memfd;
+    /*
+     * With guest_memfd, one bit per host page that is private to the
+     * guest; the shared memory behind such pages is discarded.
+     */
+    unsigned long *private_bmap;
     size_t page_size;
     /* dirty bitmap used during migration */
     unsigned long *bmap;
@@ -80,6 +85,15 @@ struct RAMBlock {
     unsigned long *clear_bmap;
     uint8_t clear_bmap_shift;
 
+    /*
+     * Hot page tracking of the x-defer-hot-pages capability, NULL if it
+     * is off.  `dirty_prev' has the pages the guest dirtied during the
+     * last sync period, `hot_bmap' those it dirtied during both of the
+     * last two.  Only used on the source, protected like `bmap'.
+     */
+    unsigned long *dirty_prev;
+    unsigned long *hot_bmap;
+
     /*
      * RAM block length that corresponds to the used_length on the migration
      * source (after RAM block sizes were synchronized). Especially, after
@@ -141,6 +141,9 @@ struct TranslationBlock {
     uintptr_t jmp_list_head;
     uintptr_t jmp_list_next[2];
     uintptr_t jmp_dest[2];
+
+    /* Executions so far, only counted with a perf threshold */
+    uint32_t perf_count;
 };
 
 /* The alignment given to TranslationBlock during allocation. */
@@ -152,6 +152,7 @@ struct SMMUState {
     GHashTable *smmu_pcibus_by_busptr;
     GHashTable *configs; /* cache for configuration data */
     GHashTable *iotlb;
+    GHashTable *iotlb_tags; /* IOTLB index by ASID/VMID, for invalidation */
     SMMUPciBus *smmu_pcibus_by_bus_num[SMMU_PCI_BUS_MAX];
     PCIBus *pci_bus;
     QLIST_HEAD(, SMMUDevice) devices_with_notifiers;
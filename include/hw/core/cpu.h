@@ -198,8 +198,12 @@ struct CPUClass {
  */
 #define NB_MMU_MODES 16
 
-/* Use a fully associative victim tlb of 8 entries. */
+/*
+ * Use a fully associative victim tlb of 8 to 32 entries.  The size is
+ * adapted to the victim hit rate whenever the mmu mode is flushed.
+ */
 #define CPU_VTLB_SIZE 8
+#define CPU_VTLB_SIZE_MAX 32
 
 /*
  * The full TLB entry, which is not accessed by generated TCG code,
@@ -284,9 +288,16 @@ typedef struct CPUTLBDesc {
     size_t n_used_entries;
     /* The next index to use in the tlb victim table.  */
     size_t vindex;
+    /* The number of entries in use in the tlb victim table.  */
+    size_t vtlb_size;
+    /* Victim table lookups that hit and missed since the last flush.  */
+    size_t vtlb_hits;
+    size_t vtlb_misses;
+    /* The page of the last tlb fill for a load, to detect streaming.  */
+    vaddr last_fill_page;
     /* The tlb victim table, in two parts.  */
-    CPUTLBEntry vtable[CPU_VTLB_SIZE];
-    CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE];
+    CPUTLBEntry vtable[CPU_VTLB_SIZE_MAX];
+    CPUTLBEntryFull vfulltlb[CPU_VTLB_SIZE_MAX];
     CPUTLBEntryFull *fulltlb;
 } CPUTLBDesc;
 
@@ -310,6 +321,9 @@ typedef struct CPUTLBCommon {
     size_t full_flush_count;
     size_t part_flush_count;
     size_t elide_flush_count;
+    size_t fill_count;
+    size_t victim_hit_count;
+    size_t prefetch_count;
 } CPUTLBCommon;
 
 /*
@@ -448,6 +462,10 @@ struct qemu_work_item;
  *    ring is enabled.
  * @kvm_fetch_index: Keeps the index that we last fetched from the per-vCPU
  *    dirty ring structure.
+ * @kvm_dirty_rate: Estimated number of pages per second that the vCPU
+ *    dirties, from the pages collected from its dirty ring.
+ * @kvm_dirty_ring_full_exits: Number of times the vCPU stopped because
+ *    its dirty ring was full.
  *
  * @neg_align: The CPUState is the common part of a concrete ArchCPU
  * which is allocated when an individual CPU instance is created. As
@@ -533,6 +551,9 @@ struct CPUState {
     struct kvm_dirty_gfn *kvm_dirty_gfns;
     uint32_t kvm_fetch_index;
     uint64_t dirty_pages;
+    uint64_t kvm_dirty_pages_last;
+    uint64_t kvm_dirty_rate;
+    uint64_t kvm_dirty_ring_full_exits;
     int kvm_vcpu_stats_fd;
     bool vcpu_dirty;
 
@@ -23,7 +23,10 @@
 #define INTEL_IOMMU_H
 
 #include "hw/i386/x86-iommu.h"
+#include "hw/pci/iommu-stats.h"
 #include "qemu/iova-tree.h"
+#include "qemu/qht.h"
+#include "qemu/rcu.h"
 #include "qom/object.h"
 
 #define TYPE_INTEL_IOMMU_DEVICE "intel-iommu"
@@ -58,6 +61,7 @@ typedef struct VTDContextEntry VTDContextEntry;
 typedef struct VTDContextCacheEntry VTDContextCacheEntry;
 typedef struct VTDAddressSpace VTDAddressSpace;
 typedef struct VTDIOTLBEntry VTDIOTLBEntry;
+typedef struct VTDIOTLBRuns VTDIOTLBRuns;
 typedef union VTD_IR_TableEntry VTD_IR_TableEntry;
 typedef union VTD_IR_MSIAddress VTD_IR_MSIAddress;
 typedef struct VTDPASIDDirEntry VTDPASIDDirEntry;
@@ -146,15 +150,36 @@ struct VTDAddressSpace {
      * with the guest IOMMU pgtables for a device.
      */
     IOVATree *iova_tree;
+    /*
+     * Contiguous translations cached next to the IOTLB, so that DMA over
+     * a superpage or a run of 4K pages costs one lookup.  Replaced under
+     * the IOMMU lock and read under RCU; NULL while there are none.
+     */
+    VTDIOTLBRuns *iotlb_runs;
+    IOMMUStats stats;           /* Requests of this address space */
 };
 
 struct VTDIOTLBEntry {
+    struct rcu_head rcu;
     uint64_t gfn;
     uint16_t domain_id;
+    uint16_t sid;
     uint32_t pasid;
     uint64_t slpte;
     uint64_t mask;
     uint8_t access_flags;
+    uint8_t level;
+    bool referenced;                        /* Hit since it was last aged */
+    QTAILQ_ENTRY(VTDIOTLBEntry) lru;        /* Link in IOTLB eviction list */
+    QLIST_ENTRY(VTDIOTLBEntry) domain_link; /* Link in domain entry list */
+};
+
+/* Immutable set of runs of one address space, see VTDAddressSpace */
+struct VTDIOTLBRuns {
+    struct rcu_head rcu;
+    uint16_t domain_id;         /* Domain of the page tables of all runs */
+    uint32_t nr;
+    DMAMap runs[];              /* Sorted by IOVA, never overlapping */
 };
 
 /* VT-d Source-ID Qualifier types */
@@ -285,7 +310,12 @@ struct IntelIOMMUState {
     uint64_t ecap;                  /* The value of extended capability reg */
 
     uint32_t context_cache_gen;     /* Should be in [1,MAX] */
-    GHashTable *iotlb;              /* IOTLB */
+    struct qht iotlb;               /* IOTLB, looked up under RCU */
+    GHashTable *iotlb_domains;      /* IOTLB entries by domain ID */
+    QTAILQ_HEAD(, VTDIOTLBEntry) iotlb_lru; /* IOTLB entries, oldest first */
+    uint32_t iotlb_size;            /* Max number of IOTLB entries */
+    uint32_t iotlb_nr;              /* Number of IOTLB entries */
+    IOMMUStats stats;               /* Requests of all address spaces */
 
     GHashTable *vtd_address_spaces;             /* VTD address spaces */
     VTDAddressSpace *vtd_as_cache[VTD_PCI_BUS_MAX]; /* VTD address space cache */
@@ -312,6 +342,7 @@ struct IntelIOMMUState {
     /*
      * Protects IOMMU states in general.  Currently it protects the
      * per-IOMMU IOTLB cache, and context entry cache in VTDAddressSpace.
+     * IOTLB and run lookups only need RCU; updates still take the lock.
      */
     QemuMutex iommu_lock;
 };
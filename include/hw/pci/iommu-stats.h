@@ -0,0 +1,58 @@
+/*
+ * Translation statistics of PCI IOMMUs
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef HW_PCI_IOMMU_STATS_H
+#define HW_PCI_IOMMU_STATS_H
+
+#include "qemu/queue.h"
+#include "qemu/stats64.h"
+
+/*
+ * Counters of one IOMMU, or of one requester behind it.  IOMMU models
+ * embed one in their state and one in each per-device address space,
+ * update both as requests come in, and register them so that
+ * query-stats reports them under the "iommu" target.
+ */
+typedef struct IOMMUStats {
+    Stat64 translations;        /* Translation requests */
+    Stat64 iotlb_hits;          /* Requests answered from the IOTLB */
+    Stat64 page_walks;          /* Requests that walked the page tables */
+    Stat64 context_misses;      /* Context or device table entries fetched */
+    Stat64 faults;              /* Requests that failed to translate */
+    Stat64 invalidations;       /* Invalidation requests of the guest */
+    Stat64 invalidation_time;   /* Nanoseconds spent invalidating */
+
+    /* private */
+    Object *owner;
+    PCIBus *bus;
+    int devfn;
+    QTAILQ_ENTRY(IOMMUStats) next;
+} IOMMUStats;
+
+/**
+ * iommu_stats_register: report @stats through query-stats
+ *
+ * @stats: the counters, which must stay valid until unregistered
+ * @owner: the IOMMU
+ * @bus: bus of the requester, or NULL if @stats cover the whole IOMMU
+ * @devfn: devfn of the requester on @bus
+ *
+ * Counters of a requester are reported under the QOM path of the PCI
+ * device at @bus and @devfn, together with its source ID; they are left
+ * out while no device is there.
+ */
+void iommu_stats_register(IOMMUStats *stats, Object *owner, PCIBus *bus,
+                          int devfn);
+
+/**
+ * iommu_stats_unregister: stop reporting @stats
+ *
+ * @stats: counters passed to iommu_stats_register()
+ */
+void iommu_stats_unregister(IOMMUStats *stats);
+
+#endif
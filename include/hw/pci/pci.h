@@ -420,13 +420,96 @@ typedef struct PCIIOMMUOps {
      * @devfn: device and function number of the PCI device.
      */
     void (*unset_iommu_device)(PCIBus *bus, void *opaque, int devfn);
+    /**
+     * @get_address_space_pasid: get the address space that translates
+     * the DMA a device tags with a PASID
+     *
+     * Optional callback, if not implemented in vIOMMU, then devices
+     * can't issue PASID-tagged DMA.
+     *
+     * Returns: the #AddressSpace, or NULL if the vIOMMU does not
+     * translate requests with a PASID.
+     *
+     * @bus: the #PCIBus being accessed.
+     *
+     * @opaque: the data passed to pci_setup_iommu().
+     *
+     * @devfn: device and function number
+     *
+     * @pasid: the Process Address Space ID
+     */
+    AddressSpace * (*get_address_space_pasid)(PCIBus *bus, void *opaque,
+                                              int devfn, uint32_t pasid);
 } PCIIOMMUOps;
 
 AddressSpace *pci_device_iommu_address_space(PCIDevice *dev);
+/**
+ * pci_device_iommu_address_space_pasid: address space of PASID-tagged DMA
+ *
+ * Returns the address space in which the IOMMU of @dev translates the
+ * requests that @dev tags with @pasid, e.g. the shared virtual memory of
+ * a process; or NULL if @dev is not behind an IOMMU that supports PASIDs.
+ *
+ * @dev: the #PCIDevice issuing the requests
+ *
+ * @pasid: the Process Address Space ID, below 1 << 20
+ */
+AddressSpace *pci_device_iommu_address_space_pasid(PCIDevice *dev,
+                                                   uint32_t pasid);
 bool pci_device_set_iommu_device(PCIDevice *dev, HostIOMMUDevice *hiod,
                                  Error **errp);
 void pci_device_unset_iommu_device(PCIDevice *dev);
 
+/**
+ * pci_ats_request_translation: translate a range like an ATS request
+ *
+ * Translates the DMA addresses from @addr to @addr + @length - 1 of @dev,
+ * walking its IOMMU the way a PCIe Address Translation Services request
+ * would, so that the device can cache the result and issue translated
+ * transactions until the IOMMU invalidates it.
+ *
+ * @dev: the PCI device, whose ATS capability must be enabled
+ * @addr: the first untranslated address
+ * @length: the number of bytes to translate
+ * @no_write: only read access is requested
+ * @result: filled with one entry per translated page or block
+ * @result_length: the number of entries in @result
+ *
+ * Translation stops at the first entry without permissions, which is
+ * included in @result, or once @result is full.
+ *
+ * Returns: the number of entries in @result, or a negative errno if
+ * ATS is not enabled or the range is empty.
+ */
+ssize_t pci_ats_request_translation(PCIDevice *dev, hwaddr addr,
+                                    hwaddr length, bool no_write,
+                                    IOMMUTLBEntry *result,
+                                    size_t result_length);
+
+/**
+ * pci_iommu_register_iotlb_notifier: watch the IOMMU of a PCI device
+ *
+ * Registers @n with the IOMMU region that translates the DMA of @dev,
+ * typically with IOMMU_NOTIFIER_DEVIOTLB_UNMAP so that translations
+ * returned by pci_ats_request_translation() can be invalidated.
+ *
+ * @dev: the PCI device
+ * @n: the notifier, set up with iommu_notifier_init()
+ * @errp: pointer to Error*, to store an error if it happens
+ *
+ * Returns: 0 on success, or a negative errno otherwise.
+ */
+int pci_iommu_register_iotlb_notifier(PCIDevice *dev, IOMMUNotifier *n,
+                                      Error **errp);
+
+/**
+ * pci_iommu_unregister_iotlb_notifier: stop watching the IOMMU
+ *
+ * @dev: the PCI device
+ * @n: the notifier passed to pci_iommu_register_iotlb_notifier()
+ */
+void pci_iommu_unregister_iotlb_notifier(PCIDevice *dev, IOMMUNotifier *n);
+
 /**
  * pci_setup_iommu: Initialize specific IOMMU handlers for a PCIBus
  *
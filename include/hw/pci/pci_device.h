@@ -4,6 +4,7 @@
 #include "hw/pci/pci.h"
 #include "hw/pci/pcie.h"
 #include "hw/pci/pcie_doe.h"
+#include "qemu/plugin.h"
 
 #define TYPE_PCI_DEVICE "pci-device"
 typedef struct PCIDeviceClass PCIDeviceClass;
@@ -77,6 +78,12 @@ struct PCIDevice {
     /* Used to allocate config space for capabilities. */
     uint8_t *used;
 
+    /*
+     * Offset of the capability with each ID that pci_find_capability()
+     * returns, kept by pci_add_capability() and pci_del_capability().
+     */
+    uint8_t cap_offsets[PCI_CAP_ID_MAX + 1];
+
     /* the following fields are read only */
     int32_t devfn;
     /*
@@ -240,10 +247,31 @@ static inline AddressSpace *pci_get_address_space(PCIDevice *dev)
  * @len: the number of bytes to read or write
  * @dir: indicates the transfer direction
  */
+/**
+ * pci_dma_plugin_cb: Report a DMA access of a PCI device to TCG plugins.
+ *
+ * The PCI DMA helpers call this; devices that access guest RAM through
+ * their own mappings call it for each access.
+ *
+ * @dev: #PCIDevice doing the memory access
+ * @addr: address within the #PCIDevice address space
+ * @len: the number of bytes read or written
+ * @dir: indicates the transfer direction
+ */
+static inline void pci_dma_plugin_cb(PCIDevice *dev, dma_addr_t addr,
+                                     dma_addr_t len, DMADirection dir)
+{
+    if (unlikely(qemu_plugin_dma_enabled())) {
+        qemu_plugin_dma_cb(pci_requester_id(dev), addr, len,
+                           dir == DMA_DIRECTION_FROM_DEVICE);
+    }
+}
+
 static inline MemTxResult pci_dma_rw(PCIDevice *dev, dma_addr_t addr,
                                      void *buf, dma_addr_t len,
                                      DMADirection dir, MemTxAttrs attrs)
 {
+    pci_dma_plugin_cb(dev, addr, len, dir);
     return dma_memory_rw(pci_get_address_space(dev), addr, buf, len,
                          dir, attrs);
 }
@@ -292,6 +320,7 @@ static inline MemTxResult pci_dma_write(PCIDevice *dev, dma_addr_t addr,
                                                uint##_bits##_t *val, \
                                                MemTxAttrs attrs) \
     { \
+        pci_dma_plugin_cb(dev, addr, _bits / 8, DMA_DIRECTION_TO_DEVICE); \
         return ld##_l##_dma(pci_get_address_space(dev), addr, val, attrs); \
     } \
     static inline MemTxResult st##_s##_pci_dma(PCIDevice *dev, \
@@ -299,6 +328,7 @@ static inline MemTxResult pci_dma_write(PCIDevice *dev, dma_addr_t addr,
                                                uint##_bits##_t val, \
                                                MemTxAttrs attrs) \
     { \
+        pci_dma_plugin_cb(dev, addr, _bits / 8, DMA_DIRECTION_FROM_DEVICE); \
         return st##_s##_dma(pci_get_address_space(dev), addr, val, attrs); \
     }
 
@@ -327,8 +357,13 @@ PCI_DMA_DEFINE_LDST(q_be, q_be, 64);
 static inline void *pci_dma_map(PCIDevice *dev, dma_addr_t addr,
                                 dma_addr_t *plen, DMADirection dir)
 {
-    return dma_memory_map(pci_get_address_space(dev), addr, plen, dir,
-                          MEMTXATTRS_UNSPECIFIED);
+    void *buffer = dma_memory_map(pci_get_address_space(dev), addr, plen, dir,
+                                  MEMTXATTRS_UNSPECIFIED);
+
+    if (buffer) {
+        pci_dma_plugin_cb(dev, addr, *plen, dir);
+    }
+    return buffer;
 }
 
 static inline void pci_dma_unmap(PCIDevice *dev, void *buffer, dma_addr_t len,
@@ -75,6 +75,9 @@ struct PCIExpressDevice {
     /* Offset of ATS capability in config space */
     uint16_t ats_cap;
 
+    /* Offset of PASID capability in config space */
+    uint16_t pasid_cap;
+
     /* ACS */
     uint16_t acs_cap;
 
@@ -141,6 +144,9 @@ void pcie_acs_reset(PCIDevice *dev);
 void pcie_ari_init(PCIDevice *dev, uint16_t offset);
 void pcie_dev_ser_num_init(PCIDevice *dev, uint16_t offset, uint64_t ser_num);
 void pcie_ats_init(PCIDevice *dev, uint16_t offset, bool aligned);
+bool pcie_ats_enabled(const PCIDevice *dev);
+void pcie_pasid_init(PCIDevice *dev, uint16_t offset, uint8_t width);
+bool pcie_pasid_enabled(const PCIDevice *dev);
 void pcie_cap_fill_link_ep_usp(PCIDevice *dev, PCIExpLinkWidth width,
                                PCIExpLinkSpeed speed);
 
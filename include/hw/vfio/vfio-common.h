@@ -76,6 +76,15 @@ typedef struct VFIOMigration {
 
     bool event_save_iterate_started;
     bool event_precopy_empty_hit;
+
+    /*
+     * Stop-copy buffers received through multifd channels, written to
+     * the device in order by whichever thread completes the next one.
+     */
+    QemuMutex load_bufs_mutex;
+    GArray *load_bufs;
+    uint32_t load_bufs_next;
+    int load_bufs_ret;
 } VFIOMigration;
 
 struct VFIOGroup;
@@ -134,6 +143,7 @@ typedef struct VFIODevice {
     bool ram_block_discard_allowed;
     OnOffAuto enable_migration;
     bool migration_events;
+    bool migration_multifd_transfer;
     VFIODeviceOps *ops;
     unsigned int num_irqs;
     unsigned int num_regions;
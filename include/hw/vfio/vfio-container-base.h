@@ -17,6 +17,7 @@
 
 typedef struct VFIODevice VFIODevice;
 typedef struct VFIOIOMMUClass VFIOIOMMUClass;
+typedef struct VFIODirtyPool VFIODirtyPool;
 
 typedef struct {
     unsigned long *bitmap;
@@ -44,11 +45,14 @@ typedef struct VFIOContainerBase {
     unsigned long pgsizes;
     unsigned int dma_max_mappings;
     bool dirty_pages_supported;
+    VFIODirtyPool *dirty_pool;
     QLIST_HEAD(, VFIOGuestIOMMU) giommu_list;
     QLIST_HEAD(, VFIORamDiscardListener) vrdl_list;
     QLIST_ENTRY(VFIOContainerBase) next;
     QLIST_HEAD(, VFIODevice) device_list;
     GList *iova_ranges;
+    GArray *dma_batch;
+    GList *dma_extents;
     NotifierWithReturn cpr_reboot_notifier;
 } VFIOContainerBase;
 
@@ -94,6 +94,12 @@ typedef struct VirtIOBlockReq {
 
 #define VIRTIO_BLK_MAX_MERGE_REQS 32
 
+/*
+ * Requests with up to that many descriptors (header, data, status) are
+ * allocated from a per-queue pool, larger ones with g_malloc()
+ */
+#define VIRTIO_BLK_POOL_SG 16
+
 typedef struct MultiReqBuffer {
     VirtIOBlockReq *reqs[VIRTIO_BLK_MAX_MERGE_REQS];
     unsigned int num_reqs;
@@ -23,6 +23,8 @@
 #include "standard-headers/linux/virtio_iommu.h"
 #include "hw/virtio/virtio.h"
 #include "hw/pci/pci.h"
+#include "hw/pci/iommu-stats.h"
+#include "qemu/seqlock.h"
 #include "qom/object.h"
 #include "qapi/qapi-types-virtio.h"
 #include "sysemu/host_iommu_device.h"
@@ -33,6 +35,16 @@ OBJECT_DECLARE_SIMPLE_TYPE(VirtIOIOMMU, VIRTIO_IOMMU)
 
 #define TYPE_VIRTIO_IOMMU_MEMORY_REGION "virtio-iommu-memory-region"
 
+/* One mapping of a domain, from @low to @high inclusive */
+typedef struct VirtIOIOMMUFlatMapping {
+    uint64_t low;
+    uint64_t high;
+    uint64_t phys_addr;
+    uint32_t flags;
+} VirtIOIOMMUFlatMapping;
+
+typedef struct VirtIOIOMMUMappingSet VirtIOIOMMUMappingSet;
+
 typedef struct IOMMUDevice {
     void         *viommu;
     PCIBus       *bus;
@@ -43,6 +55,16 @@ typedef struct IOMMUDevice {
     MemoryRegion bypass_mr;     /* The alias of shared memory MR */
     GList *resv_regions;
     GList *host_resv_ranges;
+    IOMMUStats stats;
+    /*
+     * Translation caches, written under the VirtIOIOMMU mutex and read
+     * without it: the mapping of the last slow path translation, empty
+     * while low > high, and a sorted copy of the mappings of the domain
+     * once they have stopped changing, read under RCU.
+     */
+    QemuSeqLock last_hit_lock;
+    VirtIOIOMMUFlatMapping last_hit;
+    VirtIOIOMMUMappingSet *mappings;
 } IOMMUDevice;
 
 typedef struct IOMMUPciBus {
@@ -70,6 +92,7 @@ struct VirtIOIOMMU {
     bool granule_frozen;
     GranuleMode granule_mode;
     uint8_t aw_bits;
+    IOMMUStats stats;
 };
 
 #endif
@@ -20,6 +20,7 @@
 #include "net/announce.h"
 #include "qemu/option_int.h"
 #include "qom/object.h"
+#include "qapi/qapi-types-virtio.h"
 
 #include "ebpf/ebpf_rss.h"
 
@@ -161,6 +162,11 @@ typedef struct VirtIONetQueue {
         VirtQueueElement *elem;
     } async_tx;
     struct VirtIONet *n;
+    /* With iothread-vq-mapping, protected by the BQL */
+    unsigned int pause_depth;
+    uint8_t reset_vqs;      /* bit 0: rx_vq, bit 1: tx_vq */
+    /* With iothread-vq-mapping, only used in the IOThread */
+    bool detached;
 } VirtIONetQueue;
 
 struct VirtIONet {
@@ -227,6 +233,12 @@ struct VirtIONet {
     struct EBPFRSSContext ebpf_rss;
     uint32_t nr_ebpf_rss_fds;
     char **ebpf_rss_fds;
+    /* steer received flows to the queue pair that transmits them */
+    bool ebpf_flow_steering;
+    /* The vqs of the mapping are queue pair indices */
+    IOThreadVirtQueueMappingList *iothread_vq_mapping_list;
+    AioContext **qp_aio_context; /* NULL: all queue pairs in the main loop */
+    bool ioeventfd_started;
 };
 
 size_t virtio_net_handle_ctrl_iov(VirtIODevice *vdev,
@@ -62,6 +62,8 @@ typedef struct VirtQueue VirtQueue;
 
 #define VIRTQUEUE_MAX_SIZE 1024
 
+typedef struct VirtQueueElementPool VirtQueueElementPool;
+
 typedef struct VirtQueueElement
 {
     unsigned int index;
@@ -75,6 +77,8 @@ typedef struct VirtQueueElement
     hwaddr *out_addr;
     struct iovec *in_sg;
     struct iovec *out_sg;
+    /* Where the element was allocated, NULL for g_malloc() */
+    VirtQueueElementPool *pool;
 } VirtQueueElement;
 
 #define VIRTIO_QUEUE_MAX 1024
@@ -259,6 +263,12 @@ void virtio_delete_queue(VirtQueue *vq);
 
 void virtqueue_push(VirtQueue *vq, const VirtQueueElement *elem,
                     unsigned int len);
+/*
+ * Complete @n elements at once: like virtqueue_fill() for each of them with
+ * its length from @lens, followed by a single virtqueue_flush().
+ */
+void virtqueue_push_batch(VirtQueue *vq, VirtQueueElement *const *elems,
+                          const unsigned int *lens, unsigned int n);
 void virtqueue_flush(VirtQueue *vq, unsigned int count);
 void virtqueue_detach_element(VirtQueue *vq, const VirtQueueElement *elem,
                               unsigned int len);
@@ -270,6 +280,26 @@ void virtqueue_fill(VirtQueue *vq, const VirtQueueElement *elem,
 
 void virtqueue_map(VirtIODevice *vdev, VirtQueueElement *elem);
 void *virtqueue_pop(VirtQueue *vq, size_t sz);
+/*
+ * Pop up to @max elements into @elems, like as many virtqueue_pop() calls
+ * but reading the avail index and looking up the rings only once.  Returns
+ * the number of elements popped.
+ */
+unsigned int virtqueue_pop_batch(VirtQueue *vq, size_t sz, void **elems,
+                                 unsigned int max);
+/*
+ * Free an element returned by virtqueue_pop(), virtqueue_pop_batch() or
+ * qemu_get_virtqueue_element().  Unless the queue has an element pool,
+ * g_free() does the same.
+ */
+void virtqueue_element_free(VirtQueueElement *elem);
+/*
+ * Allocate the elements popped from @vq from a per-queue pool if they have
+ * at most @sg_max descriptors, instead of g_malloc() for each of them.  The
+ * device must then free all of its elements with virtqueue_element_free().
+ * 0 removes the pool.  Should be called before the queue is used.
+ */
+void virtio_queue_set_element_pool(VirtQueue *vq, unsigned int sg_max);
 unsigned int virtqueue_drop_all(VirtQueue *vq);
 void *qemu_get_virtqueue_element(VirtIODevice *vdev, QEMUFile *f, size_t sz);
 void qemu_put_virtqueue_element(VirtIODevice *vdev, QEMUFile *f,
@@ -284,8 +314,20 @@ int virtqueue_get_avail_bytes(VirtQueue *vq, unsigned int *in_bytes,
                               unsigned int *out_bytes, unsigned max_in_bytes,
                               unsigned max_out_bytes);
 
+/*
+ * Whether the driver wants a notification for the buffers used since the
+ * last one, for devices that deliver it by other means.  Must be called
+ * within rcu_read_lock().
+ */
+bool virtio_should_notify(VirtIODevice *vdev, VirtQueue *vq);
 void virtio_notify_irqfd(VirtIODevice *vdev, VirtQueue *vq);
 void virtio_notify(VirtIODevice *vdev, VirtQueue *vq);
+/*
+ * Like virtio_notify(), but inside a defer_call_begin()/defer_call_end()
+ * section all the notifications of @vq become a single one at
+ * defer_call_end().
+ */
+void virtio_notify_deferred(VirtIODevice *vdev, VirtQueue *vq);
 
 int virtio_save(VirtIODevice *vdev, QEMUFile *f);
 
@@ -413,6 +455,12 @@ EventNotifier *virtio_queue_get_guest_notifier(VirtQueue *vq);
 void virtio_queue_set_guest_notifier_fd_handler(VirtQueue *vq, bool assign,
                                                 bool with_irqfd);
 int virtio_device_start_ioeventfd(VirtIODevice *vdev);
+/*
+ * The default VirtioDeviceClass::start_ioeventfd and stop_ioeventfd, for
+ * devices that only replace them in some configurations.
+ */
+int virtio_device_start_ioeventfd_impl(VirtIODevice *vdev);
+void virtio_device_stop_ioeventfd_impl(VirtIODevice *vdev);
 int virtio_device_grab_ioeventfd(VirtIODevice *vdev);
 void virtio_device_release_ioeventfd(VirtIODevice *vdev);
 bool virtio_device_ioeventfd_enabled(VirtIODevice *vdev);
@@ -261,5 +261,20 @@ QIOChannelSocket *
 qio_channel_socket_accept(QIOChannelSocket *ioc,
                           Error **errp);
 
+/**
+ * qio_channel_socket_enable_zero_copy:
+ * @ioc: the socket channel object
+ *
+ * Ask the host to allow zero copy transmission on the
+ * connected socket @ioc, so that writes may pass the
+ * QIO_CHANNEL_WRITE_FLAG_ZERO_COPY flag.  On success the
+ * channel gains the QIO_CHANNEL_FEATURE_WRITE_ZERO_COPY
+ * feature.
+ *
+ * Returns: true if zero copy is available, false otherwise
+ */
+bool
+qio_channel_socket_enable_zero_copy(QIOChannelSocket *ioc);
+
 
 #endif /* QIO_CHANNEL_SOCKET_H */
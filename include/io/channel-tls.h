@@ -49,6 +49,7 @@ struct QIOChannelTLS {
     QCryptoTLSSession *session;
     QIOChannelShutdown shutdown;
     guint hs_ioc_tag;
+    bool ktls_tx;       /* the kernel encrypts what is written to master */
 };
 
 /**
@@ -106,4 +106,24 @@ bool migration_incoming_postcopy_advised(void);
 /* True if background snapshot is active */
 bool migration_in_bg_snapshot(void);
 
+/* migration/multifd-device-state.c */
+/* True if device state buffers can be sent over multifd channels */
+bool multifd_device_state_supported(void);
+/*
+ * Queue @buf, the @buf_idx'th buffer of the state of the section @idstr
+ * and @instance_id, on a multifd channel, which frees it once sent.  The
+ * destination hands it to the load_state_buffer handler of the section.
+ * Only called from the migration thread.
+ */
+bool multifd_queue_device_state(const char *idstr, uint32_t instance_id,
+                                uint32_t buf_idx, char *buf, size_t len);
+/*
+ * Wait until the queued buffers are on the wire.  Each call must be
+ * matched by the destination calling multifd_device_state_recv_sync()
+ * at the same point of the main stream, which returns once all buffers
+ * sent before have been handed to their handlers.
+ */
+int multifd_device_state_send_sync(void);
+void multifd_device_state_recv_sync(void);
+
 #endif
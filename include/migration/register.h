@@ -251,6 +251,25 @@ typedef struct SaveVMHandlers {
      */
     int (*load_cleanup)(void *opaque);
 
+    /**
+     * @load_state_buffer
+     *
+     * Loads a buffer of device state that the source queued with
+     * multifd_queue_device_state().  Runs in a multifd receive thread,
+     * outside the BQL and possibly concurrently for several buffers;
+     * buffers may arrive in any order.
+     *
+     * @opaque: data pointer passed to register_savevm_live()
+     * @buf_idx: position of the buffer in the device state
+     * @buf: the buffer, freed by the handler with g_free()
+     * @len: size of @buf
+     * @errp: pointer to Error*, to store an error if it happens.
+     *
+     * Returns zero to indicate success and negative for error
+     */
+    int (*load_state_buffer)(void *opaque, uint32_t buf_idx, char *buf,
+                             size_t len, Error **errp);
+
     /**
      * @resume_prepare
      *
@@ -292,6 +311,19 @@ int register_savevm_live(const char *idstr,
                          const SaveVMHandlers *ops,
                          void *opaque);
 
+/**
+ * qemu_savevm_find_section: Look up the section of migration handlers
+ *
+ * @ops: SaveVMHandlers structure passed to register_savevm_live()
+ * @opaque: data pointer passed to register_savevm_live()
+ * @idstr: set to the state section identifier
+ * @instance_id: set to the instance id, as assigned at registration
+ *
+ * Returns false if no such handlers are registered.
+ */
+bool qemu_savevm_find_section(const SaveVMHandlers *ops, void *opaque,
+                              const char **idstr, uint32_t *instance_id);
+
 /**
  * unregister_savevm: Unregister custom migration handlers
  *
@@ -42,4 +42,12 @@ Visitor *qobject_input_visitor_new_qmp(QObject *obj);
  */
 Visitor *qobject_output_visitor_new_qmp(QObject **result);
 
+/*
+ * Create a JSON output visitor for @result for use with QMP
+ *
+ * This is like json_output_visitor_new(), except it obeys the policy
+ * for handling deprecated management interfaces set with -compat.
+ */
+Visitor *json_output_visitor_new_qmp(GString **result);
+
 #endif
@@ -0,0 +1,41 @@
+/*
+ * JSON Output Visitor
+ *
+ * This work is licensed under the terms of the GNU LGPL, version 2.1 or later.
+ * See the COPYING.LIB file in the top-level directory.
+ *
+ */
+
+#ifndef JSON_OUTPUT_VISITOR_H
+#define JSON_OUTPUT_VISITOR_H
+
+#include "qapi/visitor.h"
+
+typedef struct JSONOutputVisitor JSONOutputVisitor;
+
+/**
+ * Create a JSON output visitor for @result
+ *
+ * A JSON output visitor writes the JSON text for a QAPI object as it
+ * walks it, without building a QObject first.  The text is the same
+ * as qobject_to_json() of what the QObject output visitor would have
+ * built, except that members of an object appear in the order they
+ * are visited, i.e. in schema order.
+ *
+ * visit_type_FOO() writes the value of QAPI type FOO.  Type 'str'
+ * and enumeration types become JSON strings, a NULL 'str' an empty
+ * string.  For type 'any', the QObject is serialized as is.  For QAPI
+ * alternate types, it writes the member that is in use.
+ *
+ * visit_start_struct() ... visit_end_struct() and visit_start_list()
+ * ... visit_end_list() write a JSON object and a JSON array.
+ *
+ * Errors are not expected to happen.
+ *
+ * The caller is responsible for freeing the visitor with
+ * visit_free().  visit_complete() hands over the text to the caller,
+ * who should free it with g_string_free().
+ */
+Visitor *json_output_visitor_new(GString **result);
+
+#endif
@@ -261,6 +261,13 @@ bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr);
 bool bitmap_test_and_clear(unsigned long *map, long start, long nr);
 void bitmap_copy_and_clear_atomic(unsigned long *dst, unsigned long *src,
                                   long nr);
+
+/*
+ * Dirty bitmaps are mostly clean; code that consumes them checks this
+ * many aligned words at a time with buffer_is_zero_ge256() before doing
+ * any per-word work.
+ */
+#define BITMAP_ZERO_RUN_LONGS   (256 / sizeof(unsigned long))
 unsigned long bitmap_find_next_zero_area(unsigned long *map,
                                          unsigned long size,
                                          unsigned long start,
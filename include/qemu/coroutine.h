@@ -273,6 +273,21 @@ void qemu_co_sleep_wake(QemuCoSleep *w);
  */
 void coroutine_fn yield_until_fd_readable(int fd);
 
+/* Smallest stack accepted by qemu_coroutine_set_stack_size() */
+#define COROUTINE_STACK_SIZE_MIN (32 * 1024)
+
+/**
+ * qemu_coroutine_set_stack_size:
+ * @size: stack size in bytes, or 0 for the default of 1 MiB
+ *
+ * Give the coroutines that the calling thread creates from now on @size
+ * bytes of stack.  Threads whose coroutines are known to stay shallow, such
+ * as IOThreads running only device emulation and block layer requests, can
+ * use this to save memory when many requests are in flight.  @size must be
+ * at least 32 KiB.
+ */
+void qemu_coroutine_set_stack_size(size_t size);
+
 /**
  * Increase coroutine pool size
  */
@@ -195,6 +195,14 @@ bool buffer_is_zero_ool(const void *vbuf, size_t len);
 bool buffer_is_zero_ge256(const void *vbuf, size_t len);
 bool test_buffer_is_zero_next_accel(void);
 
+/*
+ * Check which of @n buffers of @len bytes each are all zeroes; bit i
+ * of the result is set if @bufs[i] is.  @n must not exceed 64.
+ */
+#define BUFFER_IS_ZERO_BATCH_MAX 64
+uint64_t buffer_is_zero_batch(const void * const *bufs, unsigned n,
+                              size_t len);
+
 static inline bool buffer_is_zero_sample3(const char *buf, size_t len)
 {
     /*
@@ -269,6 +269,27 @@ char *hbitmap_sha256(const HBitmap *bitmap, Error **errp);
  */
 void hbitmap_free(HBitmap *hb);
 
+/**
+ * hbitmap_create_meta:
+ * @hb: The HBitmap to operate on.
+ * @chunk_size: How many bits in @hb one bit of the meta bitmap tracks.
+ *
+ * Create a "meta" HBitmap that tracks which parts of @hb changed: whenever
+ * bits of @hb are set, reset or overwritten, the bits covering them are
+ * set in the meta bitmap.  Bits may also be set in the meta bitmap while
+ * the corresponding part of @hb ends up unchanged.
+ *
+ * The meta bitmap belongs to @hb and must be freed with
+ * hbitmap_free_meta() before @hb is freed.
+ */
+HBitmap *hbitmap_create_meta(HBitmap *hb, int chunk_size);
+
+/**
+ * hbitmap_free_meta:
+ * @hb: The HBitmap whose meta bitmap should be freed.
+ */
+void hbitmap_free_meta(HBitmap *hb);
+
 /**
  * hbitmap_iter_init:
  * @hbi: HBitmapIter to initialize.
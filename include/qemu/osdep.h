@@ -721,6 +721,40 @@ bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
  */
 bool qemu_finish_async_prealloc_mem(Error **errp);
 
+typedef struct MemsetContext MemsetContext;
+
+/**
+ * qemu_prealloc_mem_background:
+ * @fd: the fd mapped into the area, -1 for anonymous memory
+ * @area: start address of the are to preallocate
+ * @sz: the size of the area to preallocate
+ * @max_threads: maximum number of threads to use
+ * @tc: prealloc context threads pointer, NULL if not in use
+ * @errp: returns an error if this function fails
+ *
+ * Start preallocating memory like qemu_prealloc_mem(), but return right
+ * away and keep going in the background, while the area is already in use.
+ * Failing to preallocate part of the area only results in a warning, as
+ * there is nobody to return the error to.
+ *
+ * Requires MADV_POPULATE_WRITE support for the area.
+ *
+ * Return: a handle to pass to qemu_prealloc_mem_background_stop() before
+ * the area is unmapped, or NULL setting @errp with error.
+ */
+MemsetContext *qemu_prealloc_mem_background(int fd, char *area, size_t sz,
+                                            int max_threads, ThreadContext *tc,
+                                            Error **errp);
+
+/**
+ * qemu_prealloc_mem_background_stop:
+ * @context: the handle returned by qemu_prealloc_mem_background()
+ *
+ * Stop background preallocation if it is still in progress, wait for its
+ * threads to exit and free @context.
+ */
+void qemu_prealloc_mem_background_stop(MemsetContext *context);
+
 /**
  * qemu_get_pid_name:
  * @pid: pid of a process
@@ -63,6 +63,7 @@ union qemu_plugin_cb_sig {
     qemu_plugin_vcpu_mem_cb_t        vcpu_mem;
     qemu_plugin_vcpu_syscall_cb_t    vcpu_syscall;
     qemu_plugin_vcpu_syscall_ret_cb_t vcpu_syscall_ret;
+    qemu_plugin_dma_cb_t             dma;
     void *generic;
 };
 
@@ -173,6 +174,17 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 
 void qemu_plugin_flush_cb(void);
 
+extern bool plugin_dma_enabled;
+
+/* Devices only report DMA accesses while a plugin listens for them. */
+static inline bool qemu_plugin_dma_enabled(void)
+{
+    return qatomic_read(&plugin_dma_enabled);
+}
+
+void qemu_plugin_dma_cb(uint16_t requester_id, uint64_t addr, uint64_t len,
+                        bool is_write);
+
 void qemu_plugin_atexit_cb(void);
 
 void qemu_plugin_add_dyn_cb_arr(GArray *arr);
@@ -262,6 +274,15 @@ static inline void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
 static inline void qemu_plugin_flush_cb(void)
 { }
 
+static inline bool qemu_plugin_dma_enabled(void)
+{
+    return false;
+}
+
+static inline void qemu_plugin_dma_cb(uint16_t requester_id, uint64_t addr,
+                                      uint64_t len, bool is_write)
+{ }
+
 static inline void qemu_plugin_atexit_cb(void)
 { }
 
@@ -65,11 +65,14 @@ typedef uint64_t qemu_plugin_id_t;
  *
  * version 4:
  * - added qemu_plugin_read_memory_vaddr
+ *
+ * version 5:
+ * - added qemu_plugin_register_dma_cb
  */
 
 extern QEMU_PLUGIN_EXPORT int qemu_plugin_version;
 
-#define QEMU_PLUGIN_VERSION 4
+#define QEMU_PLUGIN_VERSION 5
 
 /**
  * struct qemu_info_t - system information for plugins
@@ -785,6 +788,50 @@ QEMU_PLUGIN_API
 void qemu_plugin_register_flush_cb(qemu_plugin_id_t id,
                                    qemu_plugin_simple_cb_t cb);
 
+/**
+ * struct qemu_plugin_dma_access - a memory access made by a device
+ * @addr: address in the device's address space, before any IOMMU
+ * @len: length of the access in bytes
+ * @requester_id: PCI requester ID of the device (bus << 8 | devfn)
+ * @is_write: true if the device wrote to memory
+ */
+struct qemu_plugin_dma_access {
+    uint64_t addr;
+    uint64_t len;
+    uint16_t requester_id;
+    bool is_write;
+};
+
+/**
+ * typedef qemu_plugin_dma_cb_t - DMA access callback
+ * @id: plugin ID
+ * @accesses: array of accesses, oldest first
+ * @n: number of entries in @accesses
+ * @dropped: accesses lost since the previous call because the
+ *           buffer of the issuing thread was full
+ * @userdata: user data passed at registration
+ */
+typedef void (*qemu_plugin_dma_cb_t)(
+    qemu_plugin_id_t id, const struct qemu_plugin_dma_access *accesses,
+    size_t n, uint64_t dropped, void *userdata);
+
+/**
+ * qemu_plugin_register_dma_cb() - register a DMA access callback
+ * @id: plugin ID
+ * @cb: callback, or NULL to unregister
+ * @userdata: user data for callback
+ *
+ * Devices record their accesses to memory through the PCI DMA helpers
+ * in a buffer of the thread that issues them, without taking a lock.
+ * A QEMU thread passes them to @cb in batches, a few milliseconds
+ * after they happen; once more before the exit callbacks run. The
+ * accesses of one thread are in order, those of different threads are
+ * not. Calls to @cb never overlap. Only available in system emulation.
+ */
+QEMU_PLUGIN_API
+void qemu_plugin_register_dma_cb(qemu_plugin_id_t id,
+                                 qemu_plugin_dma_cb_t cb, void *userdata);
+
 /**
  * qemu_plugin_register_atexit_cb() - register exit callback
  * @id: plugin ID
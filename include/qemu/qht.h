@@ -18,6 +18,7 @@ struct qht {
     qht_cmp_func_t cmp;
     QemuMutex lock; /* serializes setters of ht->map */
     unsigned int mode;
+    size_t n_resizes; /* written under lock */
 };
 
 /**
@@ -29,10 +30,16 @@ struct qht {
  *         chain, excluding empty chains.
  * @occupancy: frequency distribution representing chain occupancy rate.
  *             Valid range: from 0.0 (empty) to 1.0 (full occupancy).
+ * @chain_entries: frequency distribution representing the number of entries
+ *                 in each chain, excluding empty chains.
+ * @resizes: number of resizes since the QHT was initialized
  *
  * An entry is a pointer-hash pair.
  * Each bucket can host several entries.
  * Chains are chains of buckets, whose first link is always a head bucket.
+ *
+ * While a resize is in progress, the entries that it has already moved are
+ * not accounted for.
  */
 struct qht_stats {
     size_t head_buckets;
@@ -40,6 +47,8 @@ struct qht_stats {
     size_t entries;
     struct qdist chain;
     struct qdist occupancy;
+    struct qdist chain_entries;
+    size_t resizes;
 };
 
 typedef bool (*qht_lookup_func_t)(const void *obj, const void *userp);
@@ -168,6 +177,9 @@ bool qht_reset_size(struct qht *ht, size_t n_elems);
  *
  * Returns true on success.
  * Returns false if the resize was not necessary and therefore not performed.
+ *
+ * Lookups, insertions and removals can run concurrently with the resize;
+ * they only wait if the resize is moving their bucket at that time.
  * See also: qht_reset_size().
  */
 bool qht_resize(struct qht *ht, size_t n_elems);
@@ -65,6 +65,15 @@ struct rcu_reader_data {
     /* Data used for registry, protected by rcu_registry_lock */
     QLIST_ENTRY(rcu_reader_data) node;
 
+    /*
+     * Callbacks queued by call_rcu1() while the thread is registered,
+     * newest first.  Pushed by the reader, taken by the call_rcu thread
+     * with rcu_registry_lock held.
+     */
+    struct rcu_head *cb_head;
+    unsigned long cb_count;
+    bool registered;
+
     /*
      * NotifierList used to force an RCU grace period.  Accessed under
      * rcu_registry_lock.  Note that the notifier is called _outside_
@@ -120,6 +129,13 @@ static inline void rcu_read_unlock(void)
 
 void synchronize_rcu(void);
 
+/*
+ * Like synchronize_rcu(), but asks the readers that are in a read-side
+ * critical section to leave it as soon as possible, through their
+ * force_rcu notifiers.
+ */
+void synchronize_rcu_expedited(void);
+
 /*
  * Reader thread registration.
  */
@@ -143,6 +159,16 @@ struct rcu_head {
 void call_rcu1(struct rcu_head *head, RCUCBFunc *func);
 void drain_call_rcu(void);
 
+typedef struct RCUStats {
+    uint64_t pending;           /* callbacks waiting for a grace period */
+    uint64_t max_pending;       /* largest batch of callbacks so far */
+    uint64_t invoked;           /* callbacks that ran */
+    uint64_t grace_periods;
+    uint64_t expedited_grace_periods;
+} RCUStats;
+
+void rcu_get_stats(RCUStats *stats);
+
 /* The operands of the minus operator must have the same type,
  * which must be the one that we specify in the cast.
  */
@@ -136,6 +136,8 @@ struct ObjectClass
     ObjectUnparent *unparent;
 
     GHashTable *properties;
+    /* The properties of the class and all its parents, once initialized */
+    GHashTable *all_properties;
 };
 
 /**
@@ -236,6 +236,24 @@ static inline void dma_memory_unmap(AddressSpace *as,
                         dir == DMA_DIRECTION_FROM_DEVICE, access_len);
 }
 
+/**
+ * dma_memory_map_direct: Map guest RAM into a host virtual address.
+ *
+ * Like dma_memory_map(), but return %NULL rather than a bounce buffer
+ * if @addr is not directly accessible RAM, so that the caller can keep
+ * accessing MMIO with bursts of the size the device model uses.  Unmap
+ * the result with dma_memory_unmap().
+ *
+ * @as: #AddressSpace to be accessed
+ * @addr: address within that address space
+ * @len: pointer to length of buffer; updated on return
+ * @dir: indicates the transfer direction
+ * @attrs: memory attributes
+ */
+void *dma_memory_map_direct(AddressSpace *as, dma_addr_t addr,
+                            dma_addr_t *len, DMADirection dir,
+                            MemTxAttrs attrs);
+
 #define DEFINE_LDST_DMA(_lname, _sname, _bits, _end) \
     static inline MemTxResult ld##_lname##_##_end##_dma(AddressSpace *as, \
                                                         dma_addr_t addr, \
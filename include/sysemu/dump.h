@@ -33,6 +33,7 @@
 #define DUMP_DH_COMPRESSED_ZLIB     (0x1)
 #define DUMP_DH_COMPRESSED_LZO      (0x2)
 #define DUMP_DH_COMPRESSED_SNAPPY   (0x4)
+#define DUMP_DH_COMPRESSED_ZSTD     (0x20)
 
 #define KDUMP_SIGNATURE             "KDUMP   "
 #define SIG_LEN                     (sizeof(KDUMP_SIGNATURE) - 1)
@@ -151,6 +152,20 @@ typedef struct QEMU_PACKED PageDescriptor {
     uint64_t page_flags;            /* page flags */
 } PageDescriptor;
 
+/*
+ * Descriptor of the "QEMU-INCR" note of an incremental ELF dump. The dumps
+ * of a chain share @chain. The first one, with @seq 0, holds all of the
+ * memory; each later one only holds the pages written since the previous
+ * one. Applying the PT_LOAD segments in @seq order yields the memory at
+ * the time of the last dump.
+ */
+typedef struct DumpIncrementalNote {
+    uint64_t chain;
+    uint64_t seq;
+} DumpIncrementalNote;
+
+typedef struct DumpWriter DumpWriter;
+
 typedef struct DumpState {
     GuestPhysBlockList guest_phys_blocks;
     ArchDumpInfo dump_info;
@@ -158,6 +173,9 @@ typedef struct DumpState {
     bool resume;
     bool detached;
     bool kdump_raw;
+    bool sparse;                /* Leave holes for zero pages */
+    bool direct;                /* The file is opened with O_DIRECT */
+    DumpWriter *writer;         /* Write pipeline of ELF dumps */
     hwaddr memory_offset;
     int fd;
 
@@ -212,6 +230,9 @@ typedef struct DumpState {
                                   * finished. */
     uint8_t *guest_note;         /* ELF note content */
     size_t guest_note_size;
+    bool incremental;            /* Part of an incremental dump chain */
+    uint8_t *incremental_note;   /* "QEMU-INCR" ELF note */
+    size_t incremental_note_size;
 } DumpState;
 
 uint16_t cpu_to_dump16(DumpState *s, uint16_t val);
@@ -38,8 +38,10 @@ struct IOThread {
     int64_t poll_max_ns;
     int64_t poll_grow;
     int64_t poll_shrink;
+
+    /* Stack size of the iothread's coroutines, 0 for the default */
+    uint64_t coroutine_stack_size;
 };
-typedef struct IOThread IOThread;
 
 DECLARE_INSTANCE_CHECKER(IOThread, IOTHREAD,
                          TYPE_IOTHREAD)
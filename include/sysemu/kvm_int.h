@@ -13,6 +13,8 @@
 #include "qapi/qapi-types-common.h"
 #include "qemu/accel.h"
 #include "qemu/queue.h"
+#include "qemu/stats64.h"
+#include "qemu/thread.h"
 #include "sysemu/kvm.h"
 #include "hw/boards.h"
 #include "hw/i386/topology.h"
@@ -35,6 +37,10 @@ typedef struct KVMSlot
     ram_addr_t ram_start_offset;
     int guest_memfd;
     hwaddr guest_memfd_offset;
+    /* Pages collected from the dirty rings, and their estimated rate */
+    uint64_t dirty_pages;
+    uint64_t dirty_pages_last;
+    uint64_t dirty_rate;
 } KVMSlot;
 
 typedef struct KVMMemoryUpdate {
@@ -92,14 +98,30 @@ enum KVMDirtyRingReaperState {
 
 /*
  * KVM reaper instance, responsible for collecting the KVM dirty bits
- * via the dirty ring.
+ * via the dirty rings of the vCPUs whose cpu_index modulo the number of
+ * reapers is @index.
  */
 struct KVMDirtyRingReaper {
     /* The reaper thread */
     QemuThread reaper_thr;
     volatile uint64_t reaper_iteration; /* iteration number of reaper thr */
     volatile enum KVMDirtyRingReaperState reaper_state; /* reap thr state */
+    unsigned int index;
+    int64_t interval_ms;    /* Sleep between two passes of the thread */
+    /* Serializes walking the rings of this reaper's vCPUs */
+    QemuMutex lock;
+    /* Entries collected from the rings, not yet in the slot bitmaps */
+    GArray *gfns;
 };
+
+typedef struct KVMDirtyRingStats {
+    Stat64 reaps;
+    Stat64 reap_ns;         /* Sum over all reaps */
+    Stat64 reap_max_ns;
+    Stat64 resets;
+    Stat64 resets_skipped;  /* Covered by another reaper's reset */
+    Stat64 full_exits;
+} KVMDirtyRingStats;
 struct KVMState
 {
     AccelState parent_obj;
@@ -157,7 +179,15 @@ struct KVMState
     uint32_t kvm_dirty_ring_size;   /* Number of dirty GFNs per ring */
     bool kvm_dirty_ring_with_bitmap;
     uint64_t kvm_eager_split_size;  /* Eager Page Splitting chunk size */
-    struct KVMDirtyRingReaper reaper;
+    struct KVMDirtyRingReaper *reapers;
+    uint32_t nr_reapers;            /* dirty-ring-reapers, 0 for auto */
+    /* Bumped under slots_lock before each KVM_RESET_DIRTY_RINGS */
+    uint64_t dirty_ring_reset_seq;
+    KVMDirtyRingStats dirty_ring_stats;
+    /* Keep dirty logging enabled to estimate dirty rates */
+    bool dirty_rate_estimate;
+    Notifier dirty_rate_notifier;
+    int64_t dirty_rate_stamp;       /* Time of the last rate update */
     struct KVMMsrEnergy msr_energy;
     NotifyVmexitOption notify_vmexit;
     uint32_t notify_window;
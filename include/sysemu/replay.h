@@ -19,7 +19,7 @@
 #include "qapi/qapi-types-misc.h"
 #include "qapi/qapi-types-run-state.h"
 #include "qapi/qapi-types-ui.h"
-#include "block/aio.h"
+#include "qemu/main-loop.h"
 
 /* replay clock kinds */
 enum ReplayClockKind {
@@ -47,6 +47,8 @@ enum ReplayCheckpoint {
 typedef enum ReplayCheckpoint ReplayCheckpoint;
 
 typedef struct ReplayNetState ReplayNetState;
+typedef struct ReplayCharFe ReplayCharFe;
+typedef void ReplayCharFeEventFunc(void *opaque, int event);
 
 /* Name of the initial VM snapshot */
 extern char *replay_snapshot;
@@ -153,6 +155,16 @@ int replay_char_read_all_load(uint8_t *buf);
 void replay_char_read_all_save_error(int res);
 /*! Writes character read_all execution result into the replay log. */
 void replay_char_read_all_save_buf(uint8_t *buf, int offset);
+/*! Registers a char frontend whose input, but not output, is logged. */
+ReplayCharFe *replay_register_char_fe(IOReadHandler *fd_read,
+                                      ReplayCharFeEventFunc *fd_event,
+                                      void *opaque);
+/*! Unregisters a char frontend. */
+void replay_unregister_char_fe(ReplayCharFe *rcf);
+/*! Queues input of a char frontend, to be passed to @fd_read in order. */
+void replay_char_fe_read(ReplayCharFe *rcf, const uint8_t *buf, int len);
+/*! Queues a chardev event of a char frontend, to be passed to @fd_event. */
+void replay_char_fe_event(ReplayCharFe *rcf, int event);
 
 /* Network */
 
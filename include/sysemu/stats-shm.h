@@ -0,0 +1,63 @@
+/*
+ * Layout of the stats-shm shared memory region
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ *
+ * A stats-shm object periodically publishes what query-stats would
+ * return into a file, meant to be in /dev/shm, that collectors map
+ * read-only.  The file starts with a StatsShmHeader, followed by
+ * @num_entries entries of StatsShmEntry; all fields are in host byte
+ * order and entries are 8-byte aligned.
+ *
+ * The contents are protected by a seqlock: @sequence is odd while QEMU
+ * updates them.  A reader loads @sequence (retrying while odd), issues
+ * a read barrier, copies the data it needs, issues another read barrier
+ * and starts over if @sequence changed.
+ */
+
+#ifndef STATS_SHM_H
+#define STATS_SHM_H
+
+#define STATS_SHM_MAGIC         0x41545351      /* "QSTA" */
+#define STATS_SHM_VERSION       1
+
+/* The entries did not all fit in the region, the last ones are missing */
+#define STATS_SHM_F_TRUNCATED   (1u << 0)
+
+typedef struct StatsShmHeader {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t sequence;          /* seqlock, odd while updating */
+    uint32_t header_size;       /* offset of the first entry */
+    uint64_t size;              /* size of the region */
+    uint64_t generation;        /* incremented on every update */
+    int64_t timestamp_ns;       /* CLOCK_REALTIME of the last update */
+    uint32_t num_entries;
+    uint32_t flags;             /* STATS_SHM_F_* */
+} StatsShmHeader;
+
+enum {
+    STATS_SHM_VALUE_SCALAR, /* one uint64_t */
+    STATS_SHM_VALUE_BOOL,   /* one uint64_t, 0 or 1 */
+    STATS_SHM_VALUE_LIST,   /* @count uint64_t, e.g. histogram buckets */
+};
+
+/*
+ * One statistic.  The fixed part is followed by @strings_len bytes
+ * holding the provider name (as in StatsProvider), the QOM path of the
+ * object (empty for the whole VM) and the name of the statistic, each
+ * NUL-terminated, padded so that the @count uint64_t values that come
+ * next are 8-byte aligned.  The next entry starts @entry_size bytes
+ * after the start of this one.
+ */
+typedef struct StatsShmEntry {
+    uint32_t entry_size;
+    uint8_t type;               /* STATS_SHM_VALUE_* */
+    uint8_t reserved;
+    uint16_t strings_len;
+    uint32_t count;
+    uint32_t reserved2;
+} StatsShmEntry;
+
+#endif
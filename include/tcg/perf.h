@@ -14,6 +14,12 @@ void perf_enable_perfmap(void);
 /* Start writing jit-<pid>.dump. */
 void perf_enable_jitdump(void);
 
+/* Only report TBs once they have been executed @count times, 0 for all. */
+void perf_set_threshold(uint32_t count);
+
+/* Get the threshold, 0 if none or no profiler map is written. */
+uint32_t perf_get_threshold(void);
+
 /* Add information about TCG prologue to profiler maps. */
 void perf_report_prologue(const void *start, size_t size);
 
@@ -21,6 +27,14 @@ void perf_report_prologue(const void *start, size_t size);
 void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
                       const void *start);
 
+/*
+ * Add information about a TB that reached the threshold, with its
+ * instruction data and end offsets recovered from the search data.
+ */
+void perf_report_hot_code(uint64_t guest_pc, TranslationBlock *tb,
+                          const uint64_t *insn_data,
+                          const uint16_t *insn_end_off, int start_words);
+
 /* Stop writing perf-<pid>.map and/or jit-<pid>.dump. */
 void perf_exit(void);
 #else
@@ -32,6 +46,15 @@ static inline void perf_enable_jitdump(void)
 {
 }
 
+static inline void perf_set_threshold(uint32_t count)
+{
+}
+
+static inline uint32_t perf_get_threshold(void)
+{
+    return 0;
+}
+
 static inline void perf_report_prologue(const void *start, size_t size)
 {
 }
@@ -41,6 +64,14 @@ static inline void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
 {
 }
 
+static inline void perf_report_hot_code(uint64_t guest_pc,
+                                        TranslationBlock *tb,
+                                        const uint64_t *insn_data,
+                                        const uint16_t *insn_end_off,
+                                        int start_words)
+{
+}
+
 static inline void perf_exit(void)
 {
 }
@@ -493,6 +493,9 @@ struct TCGContext {
     /* Threshold to flush the translated code buffer.  */
     void *code_gen_highwater;
 
+    /* Host NUMA node of the thread generating code, or -1 if unknown.  */
+    int code_gen_node;
+
     /* Track which vCPU triggers events */
     CPUState *cpu;                      /* *_trans */
 
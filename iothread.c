@@ -24,6 +24,7 @@
 #include "qemu/error-report.h"
 #include "qemu/rcu.h"
 #include "qemu/main-loop.h"
+#include "qemu/coroutine.h"
 
 
 #ifdef CONFIG_POSIX
@@ -47,6 +48,7 @@ static void *iothread_run(void *opaque)
      */
     g_main_context_push_thread_default(iothread->worker_context);
     qemu_set_current_aio_context(iothread->ctx);
+    qemu_coroutine_set_stack_size(iothread->coroutine_stack_size);
     iothread->thread_id = qemu_get_thread_id();
     qemu_sem_post(&iothread->init_done_sem);
 
@@ -292,6 +294,38 @@ static void iothread_set_poll_param(Object *obj, Visitor *v,
     }
 }
 
+static void iothread_get_coroutine_stack_size(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+
+    visit_type_size(v, name, &iothread->coroutine_stack_size, errp);
+}
+
+static void iothread_set_coroutine_stack_size(Object *obj, Visitor *v,
+        const char *name, void *opaque, Error **errp)
+{
+    IOThread *iothread = IOTHREAD(obj);
+    uint64_t value;
+
+    if (iothread->ctx) {
+        error_setg(errp, "%s cannot be changed once the iothread runs", name);
+        return;
+    }
+
+    if (!visit_type_size(v, name, &value, errp)) {
+        return;
+    }
+
+    if (value && (value < COROUTINE_STACK_SIZE_MIN || value > SIZE_MAX)) {
+        error_setg(errp, "%s must be 0 or at least %d", name,
+                   COROUTINE_STACK_SIZE_MIN);
+        return;
+    }
+
+    iothread->coroutine_stack_size = value;
+}
+
 static void iothread_class_init(ObjectClass *klass, void *class_data)
 {
     EventLoopBaseClass *bc = EVENT_LOOP_BASE_CLASS(klass);
@@ -311,6 +345,10 @@ static void iothread_class_init(ObjectClass *klass, void *class_data)
                               iothread_get_poll_param,
                               iothread_set_poll_param,
                               NULL, &poll_shrink_info);
+    object_class_property_add(klass, "coroutine-stack-size", "size",
+                              iothread_get_coroutine_stack_size,
+                              iothread_set_coroutine_stack_size,
+                              NULL, NULL);
 }
 
 static const TypeInfo iothread_info = {
@@ -358,6 +396,24 @@ static int query_one_iothread(Object *object, void *opaque)
     info->poll_shrink = iothread->poll_shrink;
     info->aio_max_batch = iothread->parent_obj.aio_max_batch;
 
+    if (iothread->ctx && iothread->poll_max_ns) {
+        IOThreadPollHandlerInfoList **handlers_tail = &info->poll_handlers;
+        size_t n;
+        g_autofree AioPollStats *stats =
+            aio_context_get_poll_stats(iothread->ctx, &n);
+
+        for (size_t i = 0; i < n; i++) {
+            IOThreadPollHandlerInfo *handler =
+                g_new0(IOThreadPollHandlerInfo, 1);
+
+            handler->fd = stats[i].fd;
+            handler->poll_ns = stats[i].poll_ns;
+            handler->poll_hits = stats[i].hits;
+            handler->poll_misses = stats[i].misses;
+            QAPI_LIST_APPEND(handlers_tail, handler);
+        }
+    }
+
     QAPI_LIST_APPEND(*tail, info);
     return 0;
 }
@@ -458,6 +458,16 @@ static void handle_arg_jitdump(const char *arg)
     perf_enable_jitdump();
 }
 
+static void handle_arg_perf_threshold(const char *arg)
+{
+    unsigned count;
+
+    if (qemu_strtoui(arg, NULL, 0, &count)) {
+        usage(EXIT_FAILURE);
+    }
+    perf_set_threshold(count);
+}
+
 static QemuPluginList plugins = QTAILQ_HEAD_INITIALIZER(plugins);
 
 #ifdef CONFIG_PLUGIN
@@ -536,6 +546,8 @@ static const struct qemu_argument arg_table[] = {
      "",           "Generate a /tmp/perf-${pid}.map file for perf"},
     {"jitdump",    "QEMU_JITDUMP",     false, handle_arg_jitdump,
      "",           "Generate a jit-${pid}.dump file for perf"},
+    {"perf-threshold", "QEMU_PERF_THRESHOLD", true, handle_arg_perf_threshold,
+     "count",      "Only report blocks to perf after 'count' executions"},
     {NULL, NULL, false, NULL, NULL, NULL}
 };
 
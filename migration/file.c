@@ -6,6 +6,8 @@
  */
 
 #include "qemu/osdep.h"
+#include "exec/address-spaces.h"
+#include "exec/memory.h"
 #include "exec/ramblock.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
@@ -16,6 +18,7 @@
 #include "io/channel-file.h"
 #include "io/channel-socket.h"
 #include "io/channel-util.h"
+#include "migration/misc.h"
 #include "options.h"
 #include "trace.h"
 
@@ -50,6 +53,50 @@ void file_cleanup_outgoing_migration(void)
     outgoing_args.fname = NULL;
 }
 
+static bool file_memory_map_range(Int128 start, Int128 len,
+                                  const MemoryRegion *mr,
+                                  hwaddr offset_in_region, void *opaque)
+{
+    RAMBlock *block = mr->ram_block;
+    GString *map = opaque;
+
+    if (!mr->ram || !block || !qemu_ram_is_migratable(block) ||
+        migrate_ram_is_ignored(block)) {
+        return false;
+    }
+    g_string_append_printf(map, "0x%" PRIx64 " 0x%" PRIx64 " 0x%" PRIx64 "\n",
+                           int128_get64(start), int128_get64(len),
+                           (uint64_t)block->pages_offset + offset_in_region);
+    return false;
+}
+
+/*
+ * With mapped-ram, every RAM block sits at a fixed offset of the file.
+ * Write "<file>.memmap" with the physical ranges of the guest and where
+ * they are in the file, so that the file can be read as a memory image.
+ * Only done with the x-memory-map capability.
+ */
+void file_write_memory_map(void)
+{
+    g_autofree char *name = NULL;
+    g_autoptr(GString) map = NULL;
+    g_autoptr(GError) gerr = NULL;
+
+    if (!outgoing_args.fname) {
+        return;
+    }
+    name = g_strdup_printf("%s.memmap", outgoing_args.fname);
+    map = g_string_new("# gpa length offset\n");
+    WITH_RCU_READ_LOCK_GUARD() {
+        FlatView *fv = address_space_to_flatview(&address_space_memory);
+
+        flatview_for_each_range(fv, file_memory_map_range, map);
+    }
+    if (!g_file_set_contents(name, map->str, map->len, &gerr)) {
+        warn_report("cannot write memory map '%s': %s", name, gerr->message);
+    }
+}
+
 static void file_enable_direct_io(int *flags)
 {
 #ifdef O_DIRECT
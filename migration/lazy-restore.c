@@ -0,0 +1,463 @@
+/*
+ * Lazy restore of RAM from mapped-ram files
+ *
+ * A mapped-ram file keeps every page of a RAM block at a fixed offset,
+ * so pages can be read in any order.  Instead of reading the whole image
+ * before the guest resumes, the memory of each block is dropped and
+ * registered with userfaultfd: a fault thread reads the pages that the
+ * guest touches, and a background thread fetches all the others.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bitmap.h"
+#include "qemu/error-report.h"
+#include "qemu/lockable.h"
+#include "qemu/memalign.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qemu/userfaultfd.h"
+#include "exec/memory.h"
+#include "exec/ramblock.h"
+#include "exec/target_page.h"
+#include "io/channel-file.h"
+#include "qapi/error.h"
+#include "lazy-restore.h"
+#include "trace.h"
+
+#if defined(__linux__)
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#endif
+
+#if defined(__linux__) && defined(__NR_userfaultfd) && defined(CONFIG_EVENTFD)
+#include <sys/eventfd.h>
+
+/* Bytes fetched at once by the background thread */
+#define LAZY_RESTORE_CHUNK_SIZE (1 * MiB)
+
+typedef struct LazyRestoreBlock {
+    RAMBlock *rb;
+    uint8_t *host;
+    size_t length;
+    size_t pagesize;
+    uint64_t pages_offset;
+    /* Target pages that are in the file, the others are zero */
+    unsigned long *bitmap;
+    /* Host pages that are filled already, set atomically */
+    unsigned long *placed;
+} LazyRestoreBlock;
+
+typedef struct LazyRestoreState {
+    /* Own descriptor of the migration file, which outlives the channel */
+    int fd;
+    int uffd;
+    /* Tells the fault thread to quit */
+    int quit_fd;
+    /* Largest host page size of RAM */
+    size_t pagesize_max;
+    QemuThread fault_thread;
+    /* Protects blocks against the fault thread while they are added */
+    QemuMutex lock;
+    GPtrArray *blocks;
+} LazyRestoreState;
+
+/* Blocks added by the incoming migration in progress; main thread only */
+static LazyRestoreState *lazy_restore;
+
+static void lazy_restore_block_free(gpointer data)
+{
+    LazyRestoreBlock *lb = data;
+
+    g_free(lb->bitmap);
+    g_free(lb->placed);
+    g_free(lb);
+}
+
+static LazyRestoreBlock *lazy_restore_find(LazyRestoreState *s, uint8_t *addr)
+{
+    QEMU_LOCK_GUARD(&s->lock);
+
+    for (guint i = 0; i < s->blocks->len; i++) {
+        LazyRestoreBlock *lb = g_ptr_array_index(s->blocks, i);
+
+        if (addr >= lb->host && addr < lb->host + lb->length) {
+            return lb;
+        }
+    }
+    return NULL;
+}
+
+static int lazy_restore_ioctl(int uffd, void *host, void *from, size_t len)
+{
+    int ret;
+
+    if (from) {
+        struct uffdio_copy copy = {
+            .dst = (uintptr_t)host,
+            .src = (uintptr_t)from,
+            .len = len,
+        };
+
+        ret = ioctl(uffd, UFFDIO_COPY, &copy);
+    } else {
+        struct uffdio_zeropage zero = {
+            .range.start = (uintptr_t)host,
+            .range.len = len,
+        };
+
+        ret = ioctl(uffd, UFFDIO_ZEROPAGE, &zero);
+    }
+    return ret ? -errno : 0;
+}
+
+static int lazy_restore_pread(int fd, uint8_t *buf, size_t len, off_t pos)
+{
+    while (len) {
+        ssize_t n = pread(fd, buf, len, pos);
+
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        if (n == 0) {
+            return -EIO;
+        }
+        buf += n;
+        len -= n;
+        pos += n;
+    }
+    return 0;
+}
+
+/*
+ * Read @len bytes at @offset of @lb into @buf, with zeroes for the
+ * target pages that are not in the file.
+ */
+static int lazy_restore_read(LazyRestoreState *s, LazyRestoreBlock *lb,
+                             size_t offset, size_t len, uint8_t *buf)
+{
+    size_t tps = qemu_target_page_size();
+    unsigned long first = offset / tps;
+    unsigned long last = (offset + len) / tps;
+    unsigned long pos = first;
+
+    while (pos < last) {
+        unsigned long set = find_next_bit(lb->bitmap, last, pos);
+        unsigned long clear;
+        int ret;
+
+        memset(buf + (pos - first) * tps, 0, (set - pos) * tps);
+        if (set == last) {
+            break;
+        }
+        clear = find_next_zero_bit(lb->bitmap, last, set);
+        ret = lazy_restore_pread(s->fd, buf + (set - first) * tps,
+                                 (clear - set) * tps,
+                                 lb->pages_offset + set * tps);
+        if (ret) {
+            return ret;
+        }
+        pos = clear;
+    }
+    return 0;
+}
+
+/*
+ * Fill the host pages of @lb between @offset and @offset + @len.  Both
+ * threads may do so concurrently, whoever comes second gets EEXIST.
+ */
+static int lazy_restore_place(LazyRestoreState *s, LazyRestoreBlock *lb,
+                              size_t offset, size_t len, uint8_t *buf)
+{
+    size_t tps = qemu_target_page_size();
+    unsigned long last = (offset + len) / tps;
+    uint8_t *from = buf;
+    int ret;
+
+    /* UFFDIO_ZEROPAGE does not support huge pages */
+    if (find_next_bit(lb->bitmap, last, offset / tps) == last &&
+        lb->pagesize == qemu_real_host_page_size()) {
+        from = NULL;
+    } else {
+        ret = lazy_restore_read(s, lb, offset, len, buf);
+        if (ret) {
+            return ret;
+        }
+    }
+
+    ret = lazy_restore_ioctl(s->uffd, lb->host + offset, from, len);
+    if (ret == -EEXIST && len > lb->pagesize) {
+        /* Some of the pages were faulted in meanwhile */
+        for (size_t done = 0; done < len; done += lb->pagesize) {
+            ret = lazy_restore_ioctl(s->uffd, lb->host + offset + done,
+                                     from ? from + done : NULL,
+                                     lb->pagesize);
+            if (ret && ret != -EEXIST) {
+                return ret;
+            }
+        }
+    }
+    if (ret && ret != -EEXIST) {
+        return ret;
+    }
+    bitmap_set_atomic(lb->placed, offset / lb->pagesize, len / lb->pagesize);
+    return 0;
+}
+
+static void lazy_restore_fail(LazyRestoreBlock *lb, size_t offset, int err)
+{
+    /* The guest cannot go on without its memory */
+    error_report("Lazy restore of %s at 0x%zx failed: %s",
+                 qemu_ram_get_idstr(lb->rb), offset, strerror(-err));
+    exit(EXIT_FAILURE);
+}
+
+static void *lazy_restore_fault_thread(void *opaque)
+{
+    LazyRestoreState *s = opaque;
+    uint8_t *buf = qemu_memalign(qemu_real_host_page_size(), s->pagesize_max);
+    struct pollfd pfd[2] = {
+        { .fd = s->uffd, .events = POLLIN },
+        { .fd = s->quit_fd, .events = POLLIN },
+    };
+
+    while (true) {
+        struct uffd_msg msg;
+        LazyRestoreBlock *lb;
+        uint8_t *addr;
+        size_t offset;
+        int ret;
+
+        if (poll(pfd, ARRAY_SIZE(pfd), -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            error_report("%s: poll: %s", __func__, strerror(errno));
+            break;
+        }
+        if (pfd[1].revents) {
+            break;
+        }
+
+        ret = uffd_read_events(s->uffd, &msg, 1);
+        if (ret < 0) {
+            break;
+        }
+        if (ret == 0 || msg.event != UFFD_EVENT_PAGEFAULT) {
+            continue;
+        }
+
+        addr = (uint8_t *)(uintptr_t)msg.arg.pagefault.address;
+        lb = lazy_restore_find(s, addr);
+        if (!lb) {
+            error_report("%s: fault at %p outside of RAM", __func__, addr);
+            continue;
+        }
+        offset = QEMU_ALIGN_DOWN(addr - lb->host, lb->pagesize);
+        trace_lazy_restore_fault(qemu_ram_get_idstr(lb->rb), offset);
+        if (test_bit(offset / lb->pagesize, lb->placed)) {
+            continue;
+        }
+        ret = lazy_restore_place(s, lb, offset, lb->pagesize, buf);
+        if (ret) {
+            lazy_restore_fail(lb, offset, ret);
+        }
+    }
+
+    qemu_vfree(buf);
+    return NULL;
+}
+
+static void *lazy_restore_fetch_thread(void *opaque)
+{
+    LazyRestoreState *s = opaque;
+    size_t size = MAX(LAZY_RESTORE_CHUNK_SIZE, s->pagesize_max);
+    uint8_t *buf = qemu_memalign(qemu_real_host_page_size(), size);
+    int64_t start = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
+    uint64_t val = 1;
+
+    for (guint i = 0; i < s->blocks->len; i++) {
+        LazyRestoreBlock *lb = g_ptr_array_index(s->blocks, i);
+        unsigned long npages = lb->length / lb->pagesize;
+        unsigned long chunk = MAX(LAZY_RESTORE_CHUNK_SIZE / lb->pagesize, 1);
+        unsigned long first, end;
+
+        for (first = find_first_zero_bit(lb->placed, npages);
+             first < npages;
+             first = find_next_zero_bit(lb->placed, npages, end)) {
+            int ret;
+
+            end = find_next_bit(lb->placed, MIN(npages, first + chunk), first);
+            ret = lazy_restore_place(s, lb, first * lb->pagesize,
+                                     (end - first) * lb->pagesize, buf);
+            if (ret) {
+                lazy_restore_fail(lb, first * lb->pagesize, ret);
+            }
+        }
+        uffd_unregister_memory(s->uffd, lb->host, lb->length);
+        trace_lazy_restore_block_done(qemu_ram_get_idstr(lb->rb));
+    }
+    qemu_vfree(buf);
+
+    if (write(s->quit_fd, &val, sizeof(val)) != sizeof(val)) {
+        error_report("%s: failed to stop the fault thread", __func__);
+        return NULL;
+    }
+    qemu_thread_join(&s->fault_thread);
+    trace_lazy_restore_done(qemu_clock_get_ms(QEMU_CLOCK_REALTIME) - start);
+
+    close(s->quit_fd);
+    uffd_close_fd(s->uffd);
+    close(s->fd);
+    g_ptr_array_free(s->blocks, true);
+    qemu_mutex_destroy(&s->lock);
+    g_free(s);
+    return NULL;
+}
+
+static LazyRestoreState *lazy_restore_init(QEMUFile *f, Error **errp)
+{
+    QIOChannel *ioc = qemu_file_get_ioc(f);
+    LazyRestoreState *s;
+    int fd;
+
+    /*
+     * Snapshots on block devices are not supported: their vmstate can
+     * only be read from the main loop, which may be the one faulting.
+     */
+    if (!object_dynamic_cast(OBJECT(ioc), TYPE_QIO_CHANNEL_FILE)) {
+        error_setg(errp, "Lazy restore needs a file migration");
+        return NULL;
+    }
+
+    fd = qemu_dup(QIO_CHANNEL_FILE(ioc)->fd);
+    if (fd < 0) {
+        error_setg_errno(errp, errno, "Failed to duplicate migration file");
+        return NULL;
+    }
+
+    s = g_new0(LazyRestoreState, 1);
+    s->fd = fd;
+    s->pagesize_max = qemu_ram_pagesize_largest();
+    s->uffd = uffd_create_fd(0, true);
+    if (s->uffd < 0) {
+        error_setg(errp, "Lazy restore needs userfaultfd");
+        goto err_fd;
+    }
+    s->quit_fd = eventfd(0, EFD_CLOEXEC);
+    if (s->quit_fd < 0) {
+        error_setg_errno(errp, errno, "Failed to create lazy restore eventfd");
+        goto err_uffd;
+    }
+    qemu_mutex_init(&s->lock);
+    s->blocks = g_ptr_array_new_with_free_func(lazy_restore_block_free);
+    qemu_thread_create(&s->fault_thread, "mig/dst/lazyflt",
+                       lazy_restore_fault_thread, s, QEMU_THREAD_JOINABLE);
+    return s;
+
+err_uffd:
+    uffd_close_fd(s->uffd);
+err_fd:
+    close(s->fd);
+    g_free(s);
+    return NULL;
+}
+
+bool lazy_restore_add_block(QEMUFile *f, RAMBlock *rb, unsigned long *bitmap,
+                            long num_pages, uint64_t pages_offset,
+                            Error **errp)
+{
+    LazyRestoreBlock *lb;
+    uint64_t ioctls;
+
+    if (ram_block_discard_is_disabled()) {
+        error_setg(errp, "Lazy restore is not possible while devices pin "
+                   "guest memory");
+        return false;
+    }
+    if (!lazy_restore) {
+        lazy_restore = lazy_restore_init(f, errp);
+        if (!lazy_restore) {
+            return false;
+        }
+    }
+
+    lb = g_new0(LazyRestoreBlock, 1);
+    lb->rb = rb;
+    lb->host = qemu_ram_get_host_addr(rb);
+    lb->pagesize = qemu_ram_pagesize(rb);
+    lb->length = MIN(num_pages * qemu_target_page_size(),
+                     qemu_ram_get_used_length(rb));
+    lb->length = QEMU_ALIGN_DOWN(lb->length, lb->pagesize);
+    lb->pages_offset = pages_offset;
+    lb->bitmap = bitmap_new(num_pages);
+    bitmap_copy(lb->bitmap, bitmap, num_pages);
+    lb->placed = bitmap_new(lb->length / lb->pagesize);
+
+    if (ram_block_discard_range(rb, 0, lb->length)) {
+        error_setg(errp, "Failed to discard RAM block %s", rb->idstr);
+        lazy_restore_block_free(lb);
+        return false;
+    }
+
+    /* Visible to the fault thread before the first fault can come */
+    WITH_QEMU_LOCK_GUARD(&lazy_restore->lock) {
+        g_ptr_array_add(lazy_restore->blocks, lb);
+    }
+    if (uffd_register_memory(lazy_restore->uffd, lb->host, lb->length,
+                             UFFDIO_REGISTER_MODE_MISSING, &ioctls)) {
+        error_setg(errp, "Failed to register RAM block %s with userfaultfd",
+                   rb->idstr);
+        goto err;
+    }
+    if (!(ioctls & BIT_ULL(_UFFDIO_COPY))) {
+        uffd_unregister_memory(lazy_restore->uffd, lb->host, lb->length);
+        error_setg(errp, "RAM block %s does not support lazy restore",
+                   rb->idstr);
+        goto err;
+    }
+
+    trace_lazy_restore_add_block(rb->idstr, lb->length, lb->pagesize);
+    return true;
+
+err:
+    WITH_QEMU_LOCK_GUARD(&lazy_restore->lock) {
+        g_ptr_array_remove_fast(lazy_restore->blocks, lb);
+    }
+    return false;
+}
+
+void lazy_restore_start(void)
+{
+    QemuThread thread;
+
+    if (!lazy_restore) {
+        return;
+    }
+    qemu_thread_create(&thread, "mig/dst/lazy", lazy_restore_fetch_thread,
+                       lazy_restore, QEMU_THREAD_DETACHED);
+    lazy_restore = NULL;
+}
+
+#else
+
+bool lazy_restore_add_block(QEMUFile *f, RAMBlock *rb, unsigned long *bitmap,
+                            long num_pages, uint64_t pages_offset,
+                            Error **errp)
+{
+    error_setg(errp, "Lazy restore is not supported on this host");
+    return false;
+}
+
+void lazy_restore_start(void)
+{
+}
+
+#endif
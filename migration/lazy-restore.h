@@ -0,0 +1,34 @@
+/*
+ * Lazy restore of RAM from mapped-ram files
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#ifndef QEMU_MIGRATION_LAZY_RESTORE_H
+#define QEMU_MIGRATION_LAZY_RESTORE_H
+
+#include "qemu-file.h"
+
+/*
+ * Instead of reading the pages of @rb from the mapped-ram file behind
+ * @f, drop its memory and fill it on demand: a fault thread reads the
+ * pages that are touched from the file, and a background thread fetches
+ * the others once lazy_restore_start() is called.
+ *
+ * @bitmap tells which of the first @num_pages target pages are in the
+ * file, whose page data start at @pages_offset; the others are zero.
+ *
+ * Returns true on success, false with @errp set otherwise.
+ */
+bool lazy_restore_add_block(QEMUFile *f, RAMBlock *rb, unsigned long *bitmap,
+                            long num_pages, uint64_t pages_offset,
+                            Error **errp);
+
+/*
+ * Called at the end of loading RAM; starts fetching the pages of the
+ * blocks added by lazy_restore_add_block() in the background.
+ */
+void lazy_restore_start(void);
+
+#endif
@@ -141,6 +141,10 @@ void hmp_info_migrate(Monitor *mon, const QDict *qdict)
                            "Zero-copy-send fallbacks happened: %" PRIu64 " times\n",
                            info->ram->dirty_sync_missed_zero_copy);
         }
+        if (info->ram->dirty_sync_time) {
+            monitor_printf(mon, "dirty sync time: %" PRIu64 " us\n",
+                           info->ram->dirty_sync_time);
+        }
     }
 
     if (info->xbzrle_cache) {
@@ -11,6 +11,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/host-utils.h"
 #include "qemu/stats64.h"
 #include "qemu-file.h"
 #include "trace.h"
@@ -68,3 +69,11 @@ uint64_t migration_transferred_bytes(void)
     trace_migration_transferred_bytes(qemu_file, multifd, rdma);
     return qemu_file + multifd + rdma;
 }
+
+void migration_histogram_add(MigrationHistogram *hist, uint64_t val)
+{
+    int bucket = val ? 64 - clz64(val) : 0;
+
+    stat64_add(&hist->buckets[MIN(bucket, MIGRATION_HISTOGRAM_BUCKETS - 1)],
+               1);
+}
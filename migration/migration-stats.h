@@ -27,6 +27,17 @@
  */
 #define RATE_LIMIT_DISABLED 0
 
+#define MIGRATION_HISTOGRAM_BUCKETS 32
+
+/*
+ * Logarithmic histogram: bucket 0 counts zeroes, bucket n counts the
+ * values from 2^(n-1) to 2^n - 1, and the last bucket also counts all
+ * larger values.
+ */
+typedef struct {
+    Stat64 buckets[MIGRATION_HISTOGRAM_BUCKETS];
+} MigrationHistogram;
+
 /*
  * These are the ram migration statistic counters.  It is loosely
  * based on MigrationStats.  We change to Stat64 any counter that
@@ -55,6 +66,14 @@ typedef struct {
      * copy.
      */
     Stat64 dirty_sync_missed_zero_copy;
+    /*
+     * Microseconds spent synchronizing guest bitmaps.
+     */
+    Stat64 dirty_sync_time;
+    /*
+     * Microseconds spent in each synchronization of guest bitmaps.
+     */
+    MigrationHistogram dirty_sync_time_hist;
     /*
      * Number of bytes sent at migration completion stage while the
      * guest is stopped.
@@ -64,6 +83,14 @@ typedef struct {
      * Number of bytes sent through multifd channels.
      */
     Stat64 multifd_bytes;
+    /*
+     * Nanoseconds per page spent compressing multifd packets.
+     */
+    MigrationHistogram multifd_compress_time;
+    /*
+     * Microseconds spent writing each multifd packet to its channel.
+     */
+    MigrationHistogram multifd_send_time;
     /*
      * Number of pages transferred that were not full of zeros.
      */
@@ -77,6 +104,12 @@ typedef struct {
      * postcopy stage.
      */
     Stat64 postcopy_requests;
+    /*
+     * Microseconds from a postcopy page request to the page having
+     * been sent on the preempt channel, including the wait for the
+     * migration thread to release the bitmap.
+     */
+    MigrationHistogram postcopy_urgent_time;
     /*
      * Number of bytes sent during precopy stage.
      */
@@ -136,4 +169,12 @@ void migration_rate_set(uint64_t new_rate);
  * channel, multifd, qemu_file, rdma, ....
  */
 uint64_t migration_transferred_bytes(void);
+
+/**
+ * migration_histogram_add: Count a value in a histogram.
+ *
+ * @hist: histogram to update
+ * @val: value to count
+ */
+void migration_histogram_add(MigrationHistogram *hist, uint64_t val);
 #endif
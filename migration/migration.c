@@ -66,6 +66,7 @@
 #include "sysemu/dirtylimit.h"
 #include "qemu/sockets.h"
 #include "sysemu/kvm.h"
+#include "sysemu/stats.h"
 
 #define NOTIFIER_ELEM_INIT(array, elem)    \
     [elem] = NOTIFIER_WITH_RETURN_LIST_INITIALIZER((array)[elem])
@@ -230,6 +231,70 @@ static int migration_stop_vm(MigrationState *s, RunState state)
     return ret;
 }
 
+typedef struct {
+    const char *name;
+    MigrationHistogram *hist;
+    /* Power of ten of the unit of the values, in seconds */
+    int exponent;
+} MigrationHistogramDesc;
+
+static const MigrationHistogramDesc migration_histograms[] = {
+    { "dirty-sync-time", &mig_stats.dirty_sync_time_hist, -6 },
+    { "multifd-compress-time", &mig_stats.multifd_compress_time, -9 },
+    { "multifd-send-time", &mig_stats.multifd_send_time, -6 },
+    { "postcopy-urgent-time", &mig_stats.postcopy_urgent_time, -6 },
+};
+
+static void migration_stats_cb(StatsResultList **result, StatsTarget target,
+                               strList *names, strList *targets, Error **errp)
+{
+    StatsList *list = NULL;
+
+    if (target != STATS_TARGET_VM) {
+        return;
+    }
+    for (int i = ARRAY_SIZE(migration_histograms) - 1; i >= 0; i--) {
+        const MigrationHistogramDesc *desc = &migration_histograms[i];
+        uint64List *buckets = NULL;
+        Stats *stats;
+
+        if (!apply_str_list_filter(desc->name, names)) {
+            continue;
+        }
+        for (int j = MIGRATION_HISTOGRAM_BUCKETS - 1; j >= 0; j--) {
+            QAPI_LIST_PREPEND(buckets, stat64_get(&desc->hist->buckets[j]));
+        }
+        stats = g_new0(Stats, 1);
+        stats->name = g_strdup(desc->name);
+        stats->value = g_new0(StatsValue, 1);
+        stats->value->type = QTYPE_QLIST;
+        stats->value->u.list = buckets;
+        QAPI_LIST_PREPEND(list, stats);
+    }
+    if (list) {
+        add_stats_entry(result, STATS_PROVIDER_MIGRATION, NULL, list);
+    }
+}
+
+static void migration_schemas_cb(StatsSchemaList **result, Error **errp)
+{
+    StatsSchemaValueList *list = NULL;
+
+    for (int i = ARRAY_SIZE(migration_histograms) - 1; i >= 0; i--) {
+        StatsSchemaValue *value = g_new0(StatsSchemaValue, 1);
+
+        value->name = g_strdup(migration_histograms[i].name);
+        value->type = STATS_TYPE_LOG2_HISTOGRAM;
+        value->has_unit = true;
+        value->unit = STATS_UNIT_SECONDS;
+        value->has_base = true;
+        value->base = 10;
+        value->exponent = migration_histograms[i].exponent;
+        QAPI_LIST_PREPEND(list, value);
+    }
+    add_stats_schema(result, STATS_PROVIDER_MIGRATION, STATS_TARGET_VM, list);
+}
+
 void migration_object_init(void)
 {
     /* This can only be called once. */
@@ -263,6 +328,8 @@ void migration_object_init(void)
 
     ram_mig_init();
     dirty_bitmap_mig_init();
+    add_stats_callbacks(STATS_PROVIDER_MIGRATION, migration_stats_cb,
+                        migration_schemas_cb);
 
     /* Initialize cpu throttle timers */
     cpu_throttle_init();
@@ -456,17 +523,17 @@ static int migrate_send_rp_message(MigrationIncomingState *mis,
     return qemu_fflush(mis->to_src_file);
 }
 
-/* Request one page from the source VM at the given start address.
+/* Request pages from the source VM at the given start address.
  *   rb: the RAMBlock to request the page in
  *   Start: Address offset within the RB
  *   Len: Length in bytes required - must be a multiple of pagesize
  */
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start)
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len)
 {
     uint8_t bufc[12 + 1 + 255]; /* start (8), len (4), rbname up to 256 */
     size_t msglen = 12; /* start + len */
-    size_t len = qemu_ram_pagesize(rb);
     enum mig_rp_message_type msg_type;
     const char *rbname;
     int rbname_len;
@@ -526,7 +593,8 @@ int migrate_send_rp_req_pages(MigrationIncomingState *mis,
         return 0;
     }
 
-    return migrate_send_rp_message_req_pages(mis, rb, start);
+    return migrate_send_rp_message_req_pages(mis, rb, start,
+                                             qemu_ram_pagesize(rb));
 }
 
 static bool migration_colo_enabled;
@@ -1183,6 +1251,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
         stat64_get(&mig_stats.dirty_sync_count);
     info->ram->dirty_sync_missed_zero_copy =
         stat64_get(&mig_stats.dirty_sync_missed_zero_copy);
+    info->ram->dirty_sync_time = stat64_get(&mig_stats.dirty_sync_time);
     info->ram->postcopy_requests =
         stat64_get(&mig_stats.postcopy_requests);
     info->ram->page_size = page_size;
@@ -1192,7 +1261,7 @@ static void populate_ram_info(MigrationInfo *info, MigrationState *s)
     info->ram->downtime_bytes = stat64_get(&mig_stats.downtime_bytes);
     info->ram->postcopy_bytes = stat64_get(&mig_stats.postcopy_bytes);
 
-    if (migrate_xbzrle()) {
+    if (migrate_xbzrle_encoding()) {
         info->xbzrle_cache = g_malloc0(sizeof(*info->xbzrle_cache));
         info->xbzrle_cache->cache_size = migrate_xbzrle_cache_size();
         info->xbzrle_cache->bytes = xbzrle_counters.bytes;
@@ -35,6 +35,7 @@
 #define  MIGRATION_THREAD_SRC_MULTIFD       "mig/src/send_%d"
 #define  MIGRATION_THREAD_SRC_RETURN        "mig/src/return"
 #define  MIGRATION_THREAD_SRC_TLS           "mig/src/tls"
+#define  MIGRATION_THREAD_SRC_SYNC          "mig/src/sync"
 
 #define  MIGRATION_THREAD_DST_COLO          "mig/dst/colo"
 #define  MIGRATION_THREAD_DST_MULTIFD       "mig/dst/recv_%d"
@@ -509,7 +510,8 @@ void migrate_send_rp_pong(MigrationIncomingState *mis,
 int migrate_send_rp_req_pages(MigrationIncomingState *mis, RAMBlock *rb,
                               ram_addr_t start, uint64_t haddr);
 int migrate_send_rp_message_req_pages(MigrationIncomingState *mis,
-                                      RAMBlock *rb, ram_addr_t start);
+                                      RAMBlock *rb, ram_addr_t start,
+                                      size_t len);
 void migrate_send_rp_recv_bitmap(MigrationIncomingState *mis,
                                  char *block_name);
 void migrate_send_rp_resume_ack(MigrationIncomingState *mis, uint32_t value);
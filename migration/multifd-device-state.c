@@ -0,0 +1,144 @@
+/*
+ * Multifd device state migration
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/cutils.h"
+#include "qapi/error.h"
+#include "migration/misc.h"
+#include "multifd.h"
+#include "options.h"
+#include "savevm.h"
+#include "trace.h"
+
+static MultiFDSendData *device_state_send;
+
+bool multifd_device_state_supported(void)
+{
+    return migrate_multifd() && !migrate_mapped_ram();
+}
+
+void multifd_device_state_clear(MultiFDDeviceState_t *state)
+{
+    g_clear_pointer(&state->idstr, g_free);
+    g_clear_pointer(&state->buf, g_free);
+}
+
+void multifd_device_state_send_cleanup(void)
+{
+    if (device_state_send) {
+        multifd_device_state_clear(&device_state_send->u.device_state);
+    }
+    g_clear_pointer(&device_state_send, g_free);
+}
+
+bool multifd_queue_device_state(const char *idstr, uint32_t instance_id,
+                                uint32_t buf_idx, char *buf, size_t len)
+{
+    MultiFDDeviceState_t *state;
+
+    if (!device_state_send) {
+        device_state_send = multifd_send_data_alloc();
+    }
+
+    state = &device_state_send->u.device_state;
+    state->idstr = g_strdup(idstr);
+    state->instance_id = instance_id;
+    state->buf_idx = buf_idx;
+    state->buf = buf;
+    state->buf_len = len;
+    multifd_set_payload_type(device_state_send, MULTIFD_PAYLOAD_DEVICE_STATE);
+
+    if (!multifd_send(&device_state_send)) {
+        multifd_device_state_clear(&device_state_send->u.device_state);
+        multifd_set_payload_type(device_state_send, MULTIFD_PAYLOAD_NONE);
+        return false;
+    }
+    return true;
+}
+
+int multifd_device_state_send_sync(void)
+{
+    return multifd_send_sync_main();
+}
+
+void multifd_device_state_recv_sync(void)
+{
+    multifd_recv_sync_main();
+}
+
+void multifd_device_state_send_prepare(MultiFDSendParams *p)
+{
+    MultiFDDeviceState_t *state = &p->data->u.device_state;
+    MultiFDPacketDeviceState_t *packet = p->packet_device_state;
+
+    memset(packet, 0, sizeof(*packet));
+    packet->hdr.magic = cpu_to_be32(MULTIFD_MAGIC);
+    packet->hdr.version = cpu_to_be32(MULTIFD_VERSION);
+    packet->hdr.flags = cpu_to_be32(MULTIFD_FLAG_DEVICE_STATE);
+    packet->next_packet_size = cpu_to_be32(state->buf_len);
+    packet->instance_id = cpu_to_be32(state->instance_id);
+    packet->buf_idx = cpu_to_be32(state->buf_idx);
+    pstrcpy(packet->idstr, sizeof(packet->idstr), state->idstr);
+
+    p->iov[0].iov_base = packet;
+    p->iov[0].iov_len = sizeof(*packet);
+    p->iov[1].iov_base = state->buf;
+    p->iov[1].iov_len = state->buf_len;
+    p->iovs_num = 2;
+    p->next_packet_size = state->buf_len;
+    p->packets_sent++;
+
+    trace_multifd_device_state_send(p->id, state->idstr, state->instance_id,
+                                    state->buf_idx, state->buf_len);
+}
+
+/* Called with the header of the packet already in p->packet. */
+int multifd_device_state_recv(MultiFDRecvParams *p, Error **errp)
+{
+    MultiFDPacketDeviceState_t packet;
+    size_t hdr_len = sizeof(packet.hdr);
+    uint32_t instance_id, buf_idx, len;
+    g_autofree char *buf = NULL;
+
+    memcpy(&packet.hdr, p->packet, hdr_len);
+    if (be32_to_cpu(packet.hdr.magic) != MULTIFD_MAGIC ||
+        be32_to_cpu(packet.hdr.version) != MULTIFD_VERSION) {
+        error_setg(errp, "multifd: device state packet with magic %x "
+                   "version %u", be32_to_cpu(packet.hdr.magic),
+                   be32_to_cpu(packet.hdr.version));
+        return -1;
+    }
+
+    if (qio_channel_read_all(p->c, (char *)&packet + hdr_len,
+                             sizeof(packet) - hdr_len, errp)) {
+        return -1;
+    }
+    if (!memchr(packet.idstr, 0, sizeof(packet.idstr))) {
+        error_setg(errp, "multifd: device state packet with invalid idstr");
+        return -1;
+    }
+
+    len = be32_to_cpu(packet.next_packet_size);
+    instance_id = be32_to_cpu(packet.instance_id);
+    buf_idx = be32_to_cpu(packet.buf_idx);
+    trace_multifd_device_state_recv(p->id, packet.idstr, instance_id,
+                                    buf_idx, len);
+
+    buf = g_try_malloc(len);
+    if (len && !buf) {
+        error_setg(errp, "multifd: cannot allocate %u bytes of device state",
+                   len);
+        return -1;
+    }
+    if (qio_channel_read_all(p->c, buf, len, errp)) {
+        return -1;
+    }
+    p->packets_recved++;
+
+    return qemu_loadvm_load_state_buffer(packet.idstr, instance_id, buf_idx,
+                                         g_steal_pointer(&buf), len, errp);
+}
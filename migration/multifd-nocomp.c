@@ -14,8 +14,10 @@
 #include "exec/ramblock.h"
 #include "exec/target_page.h"
 #include "file.h"
+#include "migration.h"
 #include "multifd.h"
 #include "options.h"
+#include "postcopy-ram.h"
 #include "qapi/error.h"
 #include "qemu/cutils.h"
 #include "qemu/error-report.h"
@@ -141,6 +143,10 @@ static int multifd_nocomp_send_prepare(MultiFDSendParams *p, Error **errp)
 static int multifd_nocomp_recv_setup(MultiFDRecvParams *p, Error **errp)
 {
     p->iov = g_new0(struct iovec, multifd_ram_page_count());
+    if (migrate_postcopy_ram()) {
+        p->postcopy_pages = g_malloc(multifd_ram_page_count() *
+                                     multifd_ram_page_size());
+    }
     return 0;
 }
 
@@ -148,11 +154,68 @@ static void multifd_nocomp_recv_cleanup(MultiFDRecvParams *p)
 {
     g_free(p->iov);
     p->iov = NULL;
+    g_free(p->postcopy_pages);
+    p->postcopy_pages = NULL;
+}
+
+/*
+ * Guest memory is registered with userfaultfd during postcopy, so the
+ * pages are read into a buffer first and then placed one by one.  The
+ * source only sends pages of RAMBlocks whose host page is a target page
+ * through multifd.
+ */
+static int multifd_nocomp_recv_postcopy(MultiFDRecvParams *p, Error **errp)
+{
+    MigrationIncomingState *mis = migration_incoming_get_current();
+    size_t page_size = multifd_ram_page_size();
+    int ret;
+
+    if (qemu_ram_pagesize(p->block) != page_size) {
+        error_setg(errp, "multifd %u: postcopy page of RAMBlock %s with "
+                   "host page size %zu", p->id, p->block->idstr,
+                   qemu_ram_pagesize(p->block));
+        return -1;
+    }
+
+    for (int i = 0; i < p->zero_num; i++) {
+        if (ramblock_recv_bitmap_test_byte_offset(p->block, p->zero[i])) {
+            continue;
+        }
+        ret = postcopy_place_page_zero(mis, p->host + p->zero[i], p->block);
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %u: failed to place "
+                             "zero page", p->id);
+            return -1;
+        }
+    }
+
+    if (!p->normal_num) {
+        return 0;
+    }
+
+    if (qio_channel_read_all(p->c, (char *)p->postcopy_pages,
+                             p->normal_num * page_size, errp)) {
+        return -1;
+    }
+
+    for (int i = 0; i < p->normal_num; i++) {
+        ret = postcopy_place_page(mis, p->host + p->normal[i],
+                                  p->postcopy_pages + i * page_size,
+                                  p->block);
+        if (ret) {
+            error_setg_errno(errp, -ret, "multifd %u: failed to place page",
+                             p->id);
+            return -1;
+        }
+    }
+    return 0;
 }
 
 static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
 {
+    size_t page_size = multifd_ram_page_size();
     uint32_t flags;
+    int niov;
 
     if (migrate_mapped_ram()) {
         return multifd_file_recv_data(p, errp);
@@ -166,18 +229,40 @@ static int multifd_nocomp_recv(MultiFDRecvParams *p, Error **errp)
         return -1;
     }
 
+    if (p->flags & MULTIFD_FLAG_POSTCOPY) {
+        return multifd_nocomp_recv_postcopy(p, errp);
+    }
+
     multifd_recv_zero_page_process(p);
 
     if (!p->normal_num) {
         return 0;
     }
 
+    /*
+     * The pages are read straight into guest RAM.  Pages of a packet are
+     * usually contiguous, so merge them into as few iovecs as possible:
+     * the kernel then copies large runs at once and readv_all() needs
+     * fewer calls.
+     */
+    niov = 0;
     for (int i = 0; i < p->normal_num; i++) {
-        p->iov[i].iov_base = p->host + p->normal[i];
-        p->iov[i].iov_len = multifd_ram_page_size();
-        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        uint8_t *host = p->host + p->normal[i];
+
+        if (niov && (uint8_t *)p->iov[niov - 1].iov_base +
+                    p->iov[niov - 1].iov_len == host) {
+            p->iov[niov - 1].iov_len += page_size;
+        } else {
+            p->iov[niov].iov_base = host;
+            p->iov[niov].iov_len = page_size;
+            niov++;
+        }
     }
-    return qio_channel_readv_all(p->c, p->iov, p->normal_num, errp);
+    for (int i = 0; i < niov; i++) {
+        ramblock_recv_bitmap_set_range(p->block, p->iov[i].iov_base,
+                                       p->iov[i].iov_len / page_size);
+    }
+    return qio_channel_readv_all(p->c, p->iov, niov, errp);
 }
 
 static void multifd_pages_reset(MultiFDPages_t *pages)
@@ -343,12 +428,9 @@ retry:
     return true;
 }
 
-int multifd_ram_flush_and_sync(void)
+/* Hand the queued pages to a channel without waiting for them */
+int multifd_ram_flush(void)
 {
-    if (!migrate_multifd()) {
-        return 0;
-    }
-
     if (!multifd_payload_empty(multifd_ram_send)) {
         if (!multifd_send(&multifd_ram_send)) {
             error_report("%s: multifd_send fail", __func__);
@@ -356,6 +438,19 @@ int multifd_ram_flush_and_sync(void)
         }
     }
 
+    return 0;
+}
+
+int multifd_ram_flush_and_sync(void)
+{
+    if (!migrate_multifd()) {
+        return 0;
+    }
+
+    if (multifd_ram_flush() < 0) {
+        return -1;
+    }
+
     return multifd_send_sync_main();
 }
 
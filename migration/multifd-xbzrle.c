@@ -0,0 +1,298 @@
+/*
+ * Multifd XBZRLE delta encoding implementation
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/bswap.h"
+#include "exec/ramblock.h"
+#include "qapi/error.h"
+#include "migration.h"
+#include "migration-stats.h"
+#include "multifd.h"
+#include "options.h"
+#include "page_cache.h"
+#include "ram.h"
+#include "trace.h"
+#include "xbzrle.h"
+
+/*
+ * Each normal page of a packet is sent as a big endian 32-bit header
+ * followed by its data.  The header is either the length of an XBZRLE
+ * delta against the previous version of the page, zero if the page did
+ * not change, or XBZRLE_PAGE_RAW if the whole page follows.
+ *
+ * All channels share one page cache of the last version of the pages
+ * they sent.  A page is only in flight on one channel at a time, since
+ * the channels sync at the end of each pass over RAM; the cache locks
+ * protect the sets that pages of different channels share.
+ */
+#define XBZRLE_PAGE_RAW     (1U << 31)
+
+struct xbzrle_data {
+    /* copy of the page being encoded, since the guest might be writing it */
+    uint8_t *buf;
+    /* encoded packet data */
+    uint8_t *ebuf;
+};
+
+/* Channels are set up and cleaned up one at a time */
+static PageCache *xbzrle_cache;
+static unsigned int xbzrle_cache_users;
+/* Protects xbzrle_counters against concurrent channels */
+static QemuMutex xbzrle_counters_lock;
+
+static uint32_t multifd_xbzrle_ebuf_len(void)
+{
+    return multifd_ram_page_count() *
+           (multifd_ram_page_size() + sizeof(uint32_t));
+}
+
+static int multifd_xbzrle_send_setup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x;
+
+    if (!xbzrle_cache) {
+        xbzrle_cache = cache_init(migrate_xbzrle_cache_size(),
+                                  multifd_ram_page_size(), errp);
+        if (!xbzrle_cache) {
+            return -1;
+        }
+    }
+    xbzrle_cache_users++;
+
+    x = g_new0(struct xbzrle_data, 1);
+    x->buf = g_try_malloc(multifd_ram_page_size());
+    x->ebuf = g_try_malloc(multifd_xbzrle_ebuf_len());
+    p->compress_data = x;
+    if (!x->buf || !x->ebuf) {
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffers",
+                   p->id);
+        return -1;
+    }
+
+    /* Needs 2 IOVs, one for packet header and one for encoded data */
+    p->iov = g_new0(struct iovec, 2);
+    return 0;
+}
+
+static void multifd_xbzrle_send_cleanup(MultiFDSendParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (x) {
+        g_free(x->buf);
+        g_free(x->ebuf);
+        g_free(x);
+        p->compress_data = NULL;
+        if (!--xbzrle_cache_users) {
+            cache_fini(xbzrle_cache);
+            xbzrle_cache = NULL;
+        }
+    }
+
+    g_free(p->iov);
+    p->iov = NULL;
+}
+
+static int multifd_xbzrle_send_prepare(MultiFDSendParams *p, Error **errp)
+{
+    MultiFDPages_t *pages = &p->data->u.ram;
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t page_size = multifd_ram_page_size();
+    uint64_t age = stat64_get(&mig_stats.dirty_sync_count);
+    uint64_t nr_pages = 0, nr_misses = 0, nr_overflows = 0;
+    uint32_t out_size = 0;
+    bool has_normal;
+    uint32_t i;
+
+    has_normal = multifd_send_prepare_common(p);
+
+    /*
+     * The destination clears zero pages, so the cached versions of those
+     * must be cleared as well.
+     */
+    for (i = pages->normal_num; i < pages->num; i++) {
+        ram_addr_t addr = pages->block->offset + pages->offset[i];
+        uint8_t *cached = cache_lookup_lock(xbzrle_cache, addr, age);
+
+        if (cached) {
+            memset(cached, 0, page_size);
+        }
+        cache_unlock(xbzrle_cache, addr);
+    }
+    if (!has_normal) {
+        goto out;
+    }
+
+    for (i = 0; i < pages->normal_num; i++) {
+        ram_addr_t addr = pages->block->offset + pages->offset[i];
+        uint8_t *hdr = x->ebuf + out_size;
+        uint8_t *out = hdr + sizeof(uint32_t);
+        uint8_t *cached;
+        int len = -1;
+
+        memcpy(x->buf, pages->block->host + pages->offset[i], page_size);
+
+        cached = cache_lookup_lock(xbzrle_cache, addr, age);
+        if (cached) {
+            nr_pages++;
+            /* An encoding as long as the page is not worth it */
+            len = xbzrle_encode_buffer(cached, x->buf, page_size, out,
+                                       page_size - 1);
+            if (len < 0) {
+                nr_overflows++;
+            }
+            memcpy(cached, x->buf, page_size);
+        } else {
+            nr_misses++;
+            cache_insert_locked(xbzrle_cache, addr, x->buf, age);
+        }
+        cache_unlock(xbzrle_cache, addr);
+
+        if (len < 0) {
+            memcpy(out, x->buf, page_size);
+            stl_be_p(hdr, XBZRLE_PAGE_RAW);
+            out_size += sizeof(uint32_t) + page_size;
+        } else {
+            stl_be_p(hdr, len);
+            out_size += sizeof(uint32_t) + len;
+        }
+    }
+
+    p->iov[p->iovs_num].iov_base = x->ebuf;
+    p->iov[p->iovs_num].iov_len = out_size;
+    p->iovs_num++;
+    p->next_packet_size = out_size;
+
+    qemu_mutex_lock(&xbzrle_counters_lock);
+    xbzrle_counters.pages += nr_pages;
+    xbzrle_counters.cache_miss += nr_misses;
+    xbzrle_counters.overflow += nr_overflows;
+    xbzrle_counters.bytes += out_size;
+    qemu_mutex_unlock(&xbzrle_counters_lock);
+
+out:
+    p->flags |= MULTIFD_FLAG_XBZRLE;
+    multifd_send_fill_packet(p);
+    return 0;
+}
+
+static int multifd_xbzrle_recv_setup(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = g_new0(struct xbzrle_data, 1);
+
+    p->compress_data = x;
+    x->ebuf = g_try_malloc(multifd_xbzrle_ebuf_len());
+    if (!x->ebuf) {
+        error_setg(errp, "multifd %u: out of memory for xbzrle buffer",
+                   p->id);
+        return -1;
+    }
+    return 0;
+}
+
+static void multifd_xbzrle_recv_cleanup(MultiFDRecvParams *p)
+{
+    struct xbzrle_data *x = p->compress_data;
+
+    if (x) {
+        g_free(x->ebuf);
+        g_free(x);
+        p->compress_data = NULL;
+    }
+}
+
+static int multifd_xbzrle_recv(MultiFDRecvParams *p, Error **errp)
+{
+    struct xbzrle_data *x = p->compress_data;
+    uint32_t in_size = p->next_packet_size;
+    uint32_t page_size = multifd_ram_page_size();
+    uint32_t flags = p->flags & MULTIFD_FLAG_COMPRESSION_MASK;
+    uint32_t pos = 0;
+    uint32_t i;
+    int ret;
+
+    if (flags != MULTIFD_FLAG_XBZRLE) {
+        error_setg(errp, "multifd %u: flags received %x flags expected %x",
+                   p->id, flags, MULTIFD_FLAG_XBZRLE);
+        return -1;
+    }
+
+    multifd_recv_zero_page_process(p);
+
+    if (!p->normal_num) {
+        assert(in_size == 0);
+        return 0;
+    }
+
+    if (in_size > multifd_xbzrle_ebuf_len()) {
+        error_setg(errp, "multifd %u: packet size %u too big", p->id,
+                   in_size);
+        return -1;
+    }
+    ret = qio_channel_read_all(p->c, (void *)x->ebuf, in_size, errp);
+    if (ret != 0) {
+        return ret;
+    }
+
+    for (i = 0; i < p->normal_num; i++) {
+        uint8_t *page = p->host + p->normal[i];
+        uint32_t len;
+
+        if (in_size - pos < sizeof(uint32_t)) {
+            goto truncated;
+        }
+        len = ldl_be_p(x->ebuf + pos);
+        pos += sizeof(uint32_t);
+
+        ramblock_recv_bitmap_set_offset(p->block, p->normal[i]);
+        if (len == XBZRLE_PAGE_RAW) {
+            if (in_size - pos < page_size) {
+                goto truncated;
+            }
+            memcpy(page, x->ebuf + pos, page_size);
+            pos += page_size;
+            continue;
+        }
+        if (len >= page_size || in_size - pos < len) {
+            goto truncated;
+        }
+        if (len && xbzrle_decode_buffer(x->ebuf + pos, len, page,
+                                        page_size) < 0) {
+            error_setg(errp, "multifd %u: failed to decode XBZRLE page at "
+                       "offset 0x" RAM_ADDR_FMT, p->id, p->normal[i]);
+            return -1;
+        }
+        pos += len;
+    }
+
+    if (pos != in_size) {
+        goto truncated;
+    }
+    return 0;
+
+truncated:
+    error_setg(errp, "multifd %u: packet of %u bytes does not match its "
+               "%u pages", p->id, in_size, p->normal_num);
+    return -1;
+}
+
+static const MultiFDMethods multifd_xbzrle_ops = {
+    .send_setup = multifd_xbzrle_send_setup,
+    .send_cleanup = multifd_xbzrle_send_cleanup,
+    .send_prepare = multifd_xbzrle_send_prepare,
+    .recv_setup = multifd_xbzrle_recv_setup,
+    .recv_cleanup = multifd_xbzrle_recv_cleanup,
+    .recv = multifd_xbzrle_recv
+};
+
+static void multifd_xbzrle_register(void)
+{
+    qemu_mutex_init(&xbzrle_counters_lock);
+    multifd_register_ops(MULTIFD_COMPRESSION_XBZRLE, &multifd_xbzrle_ops);
+}
+
+migration_init(multifd_xbzrle_register);
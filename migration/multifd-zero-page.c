@@ -24,19 +24,6 @@ static bool multifd_zero_page_enabled(void)
     return migrate_zero_page_detection() == ZERO_PAGE_DETECTION_MULTIFD;
 }
 
-static void swap_page_offset(ram_addr_t *pages_offset, int a, int b)
-{
-    ram_addr_t temp;
-
-    if (a == b) {
-        return;
-    }
-
-    temp = pages_offset[a];
-    pages_offset[a] = pages_offset[b];
-    pages_offset[b] = temp;
-}
-
 /**
  * multifd_send_zero_page_detect: Perform zero page detection on all pages.
  *
@@ -49,8 +36,8 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
 {
     MultiFDPages_t *pages = &p->data->u.ram;
     RAMBlock *rb = pages->block;
-    int i = 0;
-    int j = pages->num - 1;
+    const void *bufs[BUFFER_IS_ZERO_BATCH_MAX];
+    uint32_t normal = 0, i, k;
 
     if (!multifd_zero_page_enabled()) {
         pages->normal_num = pages->num;
@@ -58,23 +45,33 @@ void multifd_send_zero_page_detect(MultiFDSendParams *p)
     }
 
     /*
-     * Sort the page offset array by moving all normal pages to
-     * the left and all zero pages to the right of the array.
+     * Test the pages a batch at a time, and sort the page offset array
+     * by moving all normal pages to the left and all zero pages to the
+     * right of the array.  Pages before @normal are normal, the ones
+     * from there to the current batch are zero.
      */
-    while (i <= j) {
-        uint64_t offset = pages->offset[i];
+    for (i = 0; i < pages->num; i += BUFFER_IS_ZERO_BATCH_MAX) {
+        uint32_t n = MIN(pages->num - i, BUFFER_IS_ZERO_BATCH_MAX);
+        uint64_t zero;
 
-        if (!buffer_is_zero(rb->host + offset, multifd_ram_page_size())) {
-            i++;
-            continue;
+        for (k = 0; k < n; k++) {
+            bufs[k] = rb->host + pages->offset[i + k];
         }
+        zero = buffer_is_zero_batch(bufs, n, multifd_ram_page_size());
 
-        swap_page_offset(pages->offset, i, j);
-        ram_release_page(rb->idstr, offset);
-        j--;
+        for (k = 0; k < n; k++) {
+            ram_addr_t offset = pages->offset[i + k];
+
+            if (zero & (1ull << k)) {
+                ram_release_page(rb->idstr, offset);
+                continue;
+            }
+            pages->offset[i + k] = pages->offset[normal];
+            pages->offset[normal++] = offset;
+        }
     }
 
-    pages->normal_num = i;
+    pages->normal_num = normal;
 
 out:
     stat64_add(&mig_stats.normal_pages, pages->normal_num);
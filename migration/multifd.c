@@ -13,6 +13,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/rcu.h"
+#include "qemu/timer.h"
 #include "exec/target_page.h"
 #include "sysemu/sysemu.h"
 #include "exec/ramblock.h"
@@ -35,9 +36,6 @@
 
 /* Multiple fd's */
 
-#define MULTIFD_MAGIC 0x11223344U
-#define MULTIFD_VERSION 1
-
 typedef struct {
     uint32_t magic;
     uint32_t version;
@@ -92,6 +90,11 @@ struct {
     /* global number of generated multifd packets */
     uint64_t packet_num;
     int exiting;
+    /*
+     * Set once the destination listens for postcopy pages, or when the
+     * channels are terminated.  Postcopy packets wait for it.
+     */
+    QemuEvent postcopy_listen;
     /* multifd ops */
     const MultiFDMethods *ops;
 } *multifd_recv_state;
@@ -459,11 +462,16 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
     qemu_sem_destroy(&p->sem_sync);
     g_free(p->name);
     p->name = NULL;
+    if (p->data && p->data->type == MULTIFD_PAYLOAD_DEVICE_STATE) {
+        multifd_device_state_clear(&p->data->u.device_state);
+    }
     g_free(p->data);
     p->data = NULL;
     p->packet_len = 0;
     g_free(p->packet);
     p->packet = NULL;
+    g_free(p->packet_device_state);
+    p->packet_device_state = NULL;
     multifd_send_state->ops->send_cleanup(p, errp);
     assert(!p->iov);
 
@@ -472,6 +480,7 @@ static bool multifd_send_cleanup_channel(MultiFDSendParams *p, Error **errp)
 
 static void multifd_send_cleanup_state(void)
 {
+    multifd_device_state_send_cleanup();
     file_cleanup_outgoing_migration();
     socket_cleanup_outgoing_migration();
     qemu_sem_destroy(&multifd_send_state->channels_created);
@@ -599,30 +608,67 @@ static void *multifd_send_thread(void *opaque)
          * qatomic_store_release() in multifd_send().
          */
         if (qatomic_load_acquire(&p->pending_job)) {
+            bool device_state = p->data->type == MULTIFD_PAYLOAD_DEVICE_STATE;
+            uint32_t packet_len = p->packet_len;
+            int64_t start_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+            int64_t send_ns = start_ns;
+
             p->flags = 0;
             p->iovs_num = 0;
             assert(!multifd_payload_empty(p->data));
-
-            ret = multifd_send_state->ops->send_prepare(p, &local_err);
-            if (ret != 0) {
-                break;
+            if (!device_state && migration_in_postcopy()) {
+                p->flags |= MULTIFD_FLAG_POSTCOPY;
             }
 
-            if (migrate_mapped_ram()) {
-                ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
-                                              &p->data->u.ram, &local_err);
-            } else {
+            if (device_state) {
+                /* Device state is neither compressed nor sent zero-copy. */
+                multifd_device_state_send_prepare(p);
+                packet_len = sizeof(*p->packet_device_state);
                 ret = qio_channel_writev_full_all(p->c, p->iov, p->iovs_num,
-                                                  NULL, 0, p->write_flags,
-                                                  &local_err);
+                                                  NULL, 0, 0, &local_err);
+                multifd_device_state_clear(&p->data->u.device_state);
+            } else {
+                ret = multifd_send_state->ops->send_prepare(p, &local_err);
+                if (ret != 0) {
+                    break;
+                }
+                send_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+                if (migrate_multifd_compression() != MULTIFD_COMPRESSION_NONE &&
+                    p->data->u.ram.normal_num) {
+                    migration_histogram_add(&mig_stats.multifd_compress_time,
+                                            (send_ns - start_ns) /
+                                            p->data->u.ram.normal_num);
+                }
+
+                if (migrate_mapped_ram()) {
+                    ret = file_write_ramblock_iov(p->c, p->iov, p->iovs_num,
+                                                  &p->data->u.ram, &local_err);
+                } else {
+                    ret = qio_channel_writev_full_all(p->c, p->iov,
+                                                      p->iovs_num, NULL, 0,
+                                                      p->write_flags,
+                                                      &local_err);
+                }
+                /* Saved; the guest may write to the pages again. */
+                if (!ret && migrate_background_snapshot() &&
+                    ram_write_tracking_release(p->data->u.ram.block,
+                                               p->data->u.ram.offset,
+                                               p->data->u.ram.num)) {
+                    error_setg(&local_err, "multifd %s: failed to release "
+                               "write protection", p->name);
+                    ret = -1;
+                }
             }
 
             if (ret != 0) {
                 break;
             }
 
+            migration_histogram_add(&mig_stats.multifd_send_time,
+                                    (qemu_clock_get_ns(QEMU_CLOCK_REALTIME) -
+                                     send_ns) / SCALE_US);
             stat64_add(&mig_stats.multifd_bytes,
-                       (uint64_t)p->next_packet_size + p->packet_len);
+                       (uint64_t)p->next_packet_size + packet_len);
 
             p->next_packet_size = 0;
             multifd_set_payload_type(p->data, MULTIFD_PAYLOAD_NONE);
@@ -839,6 +885,8 @@ bool multifd_send_setup(void)
             p->packet_len = sizeof(MultiFDPacket_t)
                           + sizeof(uint64_t) * page_count;
             p->packet = g_malloc0(p->packet_len);
+            p->packet_device_state =
+                g_new0(MultiFDPacketDeviceState_t, 1);
         }
         p->name = g_strdup_printf(MIGRATION_THREAD_SRC_MULTIFD, i);
         p->write_flags = 0;
@@ -942,6 +990,7 @@ static void multifd_recv_terminate_threads(Error *err)
     if (qatomic_xchg(&multifd_recv_state->exiting, 1)) {
         return;
     }
+    qemu_event_set(&multifd_recv_state->postcopy_listen);
 
     if (err) {
         MigrationState *s = migrate_get_current();
@@ -1023,6 +1072,7 @@ static void multifd_recv_cleanup_channel(MultiFDRecvParams *p)
 static void multifd_recv_cleanup_state(void)
 {
     qemu_sem_destroy(&multifd_recv_state->sem_sync);
+    qemu_event_destroy(&multifd_recv_state->postcopy_listen);
     g_free(multifd_recv_state->params);
     multifd_recv_state->params = NULL;
     g_free(multifd_recv_state->data);
@@ -1114,6 +1164,18 @@ void multifd_recv_sync_main(void)
     trace_multifd_recv_sync_main(multifd_recv_state->packet_num);
 }
 
+/*
+ * Called once the destination has registered guest memory with
+ * userfaultfd and applied the discard bitmap, so pages sent during
+ * postcopy can be placed.
+ */
+void multifd_recv_postcopy_listen(void)
+{
+    if (multifd_recv_state) {
+        qemu_event_set(&multifd_recv_state->postcopy_listen);
+    }
+}
+
 static void *multifd_recv_thread(void *opaque)
 {
     MultiFDRecvParams *p = opaque;
@@ -1135,11 +1197,29 @@ static void *multifd_recv_thread(void *opaque)
             }
 
             ret = qio_channel_read_all_eof(p->c, (void *)p->packet,
-                                           p->packet_len, &local_err);
+                                           sizeof(MultiFDPacketHdr_t),
+                                           &local_err);
             if (ret == 0 || ret == -1) {   /* 0: EOF  -1: Error */
                 break;
             }
 
+            if (be32_to_cpu(p->packet->flags) & MULTIFD_FLAG_DEVICE_STATE) {
+                ret = multifd_device_state_recv(p, &local_err);
+                if (ret) {
+                    break;
+                }
+                continue;
+            }
+
+            ret = qio_channel_read_all(p->c, (char *)p->packet +
+                                       sizeof(MultiFDPacketHdr_t),
+                                       p->packet_len -
+                                       sizeof(MultiFDPacketHdr_t),
+                                       &local_err);
+            if (ret) {
+                break;
+            }
+
             qemu_mutex_lock(&p->mutex);
             ret = multifd_recv_unfill_packet(p, &local_err);
             if (ret) {
@@ -1184,6 +1264,17 @@ static void *multifd_recv_thread(void *opaque)
             has_data = !!p->data->size;
         }
 
+        if (has_data && (flags & MULTIFD_FLAG_POSTCOPY)) {
+            /*
+             * The packet may overtake the discard bitmap and the listen
+             * command on the main channel.
+             */
+            qemu_event_wait(&multifd_recv_state->postcopy_listen);
+            if (multifd_recv_should_exit()) {
+                break;
+            }
+        }
+
         if (has_data) {
             ret = multifd_recv_state->ops->recv(p, &local_err);
             if (ret != 0) {
@@ -1243,6 +1334,7 @@ int multifd_recv_setup(Error **errp)
     qatomic_set(&multifd_recv_state->count, 0);
     qatomic_set(&multifd_recv_state->exiting, 0);
     qemu_sem_init(&multifd_recv_state->sem_sync, 0);
+    qemu_event_init(&multifd_recv_state->postcopy_listen, false);
     multifd_recv_state->ops = multifd_ops[migrate_multifd_compression()];
 
     for (i = 0; i < thread_count; i++) {
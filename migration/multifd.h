@@ -32,6 +32,7 @@ int multifd_send_sync_main(void);
 bool multifd_queue_page(RAMBlock *block, ram_addr_t offset);
 bool multifd_recv(void);
 MultiFDRecvData *multifd_get_recv_data(void);
+void multifd_recv_postcopy_listen(void);
 
 /* Multifd Compression flags */
 #define MULTIFD_FLAG_SYNC (1 << 0)
@@ -45,10 +46,27 @@ MultiFDRecvData *multifd_get_recv_data(void);
 #define MULTIFD_FLAG_QPL (4 << 1)
 #define MULTIFD_FLAG_UADK (8 << 1)
 #define MULTIFD_FLAG_QATZIP (16 << 1)
+#define MULTIFD_FLAG_XBZRLE (3 << 1)
+
+/* The packet carries a buffer of device state instead of pages */
+#define MULTIFD_FLAG_DEVICE_STATE (1 << 6)
+
+/* The pages were sent during postcopy and must be placed atomically */
+#define MULTIFD_FLAG_POSTCOPY (1 << 7)
+
+#define MULTIFD_MAGIC 0x11223344U
+#define MULTIFD_VERSION 1
 
 /* This value needs to be a multiple of qemu_target_page_size() */
 #define MULTIFD_PACKET_SIZE (512 * 1024)
 
+/* Start of every packet, telling which kind of packet follows */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t flags;
+} __attribute__((packed)) MultiFDPacketHdr_t;
+
 typedef struct {
     uint32_t magic;
     uint32_t version;
@@ -73,6 +91,18 @@ typedef struct {
     uint64_t offset[];
 } __attribute__((packed)) MultiFDPacket_t;
 
+typedef struct {
+    MultiFDPacketHdr_t hdr;
+    /* size of the buffer that follows the packet */
+    uint32_t next_packet_size;
+    uint32_t instance_id;
+    /* position of the buffer in the state of the device */
+    uint32_t buf_idx;
+    uint32_t unused32[1];    /* Reserved for future use */
+    uint64_t unused64[2];    /* Reserved for future use */
+    char idstr[256];
+} __attribute__((packed)) MultiFDPacketDeviceState_t;
+
 typedef struct {
     /* number of used pages */
     uint32_t num;
@@ -83,6 +113,14 @@ typedef struct {
     ram_addr_t offset[];
 } MultiFDPages_t;
 
+typedef struct {
+    char *idstr;
+    uint32_t instance_id;
+    uint32_t buf_idx;
+    char *buf;
+    size_t buf_len;
+} MultiFDDeviceState_t;
+
 struct MultiFDRecvData {
     void *opaque;
     size_t size;
@@ -93,10 +131,12 @@ struct MultiFDRecvData {
 typedef enum {
     MULTIFD_PAYLOAD_NONE,
     MULTIFD_PAYLOAD_RAM,
+    MULTIFD_PAYLOAD_DEVICE_STATE,
 } MultiFDPayloadType;
 
 typedef union MultiFDPayload {
     MultiFDPages_t ram;
+    MultiFDDeviceState_t device_state;
 } MultiFDPayload;
 
 struct MultiFDSendData {
@@ -159,6 +199,8 @@ typedef struct {
 
     /* pointer to the packet */
     MultiFDPacket_t *packet;
+    /* pointer to the packet of device state buffers */
+    MultiFDPacketDeviceState_t *packet_device_state;
     /* size of the next packet that contains pages */
     uint32_t next_packet_size;
     /* packets sent through this channel */
@@ -225,6 +267,8 @@ typedef struct {
     ram_addr_t *zero;
     /* num of zero pages */
     uint32_t zero_num;
+    /* pages of a postcopy packet, received here and then placed */
+    uint8_t *postcopy_pages;
     /* used for de-compression methods */
     void *compress_data;
 } MultiFDRecvParams;
@@ -337,8 +381,14 @@ static inline uint32_t multifd_ram_page_count(void)
 
 void multifd_ram_save_setup(void);
 void multifd_ram_save_cleanup(void);
+int multifd_ram_flush(void);
 int multifd_ram_flush_and_sync(void);
 size_t multifd_ram_payload_size(void);
 void multifd_ram_fill_packet(MultiFDSendParams *p);
 int multifd_ram_unfill_packet(MultiFDRecvParams *p, Error **errp);
+
+void multifd_device_state_send_cleanup(void);
+void multifd_device_state_send_prepare(MultiFDSendParams *p);
+void multifd_device_state_clear(MultiFDDeviceState_t *state);
+int multifd_device_state_recv(MultiFDRecvParams *p, Error **errp);
 #endif
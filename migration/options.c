@@ -196,6 +196,12 @@ Property migration_properties[] = {
                         MIGRATION_CAPABILITY_SWITCHOVER_ACK),
     DEFINE_PROP_MIG_CAP("x-dirty-limit", MIGRATION_CAPABILITY_DIRTY_LIMIT),
     DEFINE_PROP_MIG_CAP("mapped-ram", MIGRATION_CAPABILITY_MAPPED_RAM),
+    DEFINE_PROP_MIG_CAP("x-defer-hot-pages",
+                        MIGRATION_CAPABILITY_X_DEFER_HOT_PAGES),
+    DEFINE_PROP_MIG_CAP("x-postcopy-prefetch",
+                        MIGRATION_CAPABILITY_X_POSTCOPY_PREFETCH),
+    DEFINE_PROP_MIG_CAP("x-lazy-restore", MIGRATION_CAPABILITY_X_LAZY_RESTORE),
+    DEFINE_PROP_MIG_CAP("x-memory-map", MIGRATION_CAPABILITY_X_MEMORY_MAP),
     DEFINE_PROP_END_OF_LIST(),
 };
 
@@ -220,6 +226,13 @@ bool migrate_colo(void)
     return s->capabilities[MIGRATION_CAPABILITY_X_COLO];
 }
 
+bool migrate_defer_hot_pages(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_DEFER_HOT_PAGES];
+}
+
 bool migrate_dirty_bitmaps(void)
 {
     MigrationState *s = migrate_get_current();
@@ -262,6 +275,20 @@ bool migrate_late_block_activate(void)
     return s->capabilities[MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE];
 }
 
+bool migrate_lazy_restore(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_LAZY_RESTORE];
+}
+
+bool migrate_memory_map(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_MEMORY_MAP];
+}
+
 bool migrate_multifd(void)
 {
     MigrationState *s = migrate_get_current();
@@ -283,6 +310,13 @@ bool migrate_postcopy_blocktime(void)
     return s->capabilities[MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME];
 }
 
+bool migrate_postcopy_prefetch(void)
+{
+    MigrationState *s = migrate_get_current();
+
+    return s->capabilities[MIGRATION_CAPABILITY_X_POSTCOPY_PREFETCH];
+}
+
 bool migrate_postcopy_preempt(void)
 {
     MigrationState *s = migrate_get_current();
@@ -352,7 +386,13 @@ bool migrate_multifd_flush_after_each_section(void)
 {
     MigrationState *s = migrate_get_current();
 
-    return s->multifd_flush_after_each_section;
+    /*
+     * With postcopy, the destination must have received every multifd
+     * page of precopy before it applies the discard bitmap.  Postcopy
+     * starts between two sections, so sync at the end of each one.
+     */
+    return s->multifd_flush_after_each_section ||
+           (migrate_multifd() && migrate_postcopy_ram());
 }
 
 bool migrate_postcopy(void)
@@ -374,6 +414,14 @@ bool migrate_tls(void)
     return s->parameters.tls_creds && *s->parameters.tls_creds;
 }
 
+/* XBZRLE on the main channel, or on the multifd channels */
+bool migrate_xbzrle_encoding(void)
+{
+    return migrate_xbzrle() ||
+           (migrate_multifd() &&
+            migrate_multifd_compression() == MULTIFD_COMPRESSION_XBZRLE);
+}
+
 typedef enum WriteTrackingSupport {
     WT_SUPPORT_UNKNOWN = 0,
     WT_SUPPORT_ABSENT,
@@ -421,7 +469,6 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_POSTCOPY_BLOCKTIME,
     MIGRATION_CAPABILITY_LATE_BLOCK_ACTIVATE,
     MIGRATION_CAPABILITY_RETURN_PATH,
-    MIGRATION_CAPABILITY_MULTIFD,
     MIGRATION_CAPABILITY_PAUSE_BEFORE_SWITCHOVER,
     MIGRATION_CAPABILITY_AUTO_CONVERGE,
     MIGRATION_CAPABILITY_RELEASE_RAM,
@@ -429,7 +476,8 @@ INITIALIZE_MIGRATE_CAPS_SET(check_caps_background_snapshot,
     MIGRATION_CAPABILITY_XBZRLE,
     MIGRATION_CAPABILITY_X_COLO,
     MIGRATION_CAPABILITY_VALIDATE_UUID,
-    MIGRATION_CAPABILITY_ZERO_COPY_SEND);
+    MIGRATION_CAPABILITY_ZERO_COPY_SEND,
+    MIGRATION_CAPABILITY_X_DEFER_HOT_PAGES);
 
 static bool migrate_incoming_started(void)
 {
@@ -480,9 +528,22 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
             return false;
         }
 
+        /*
+         * Multifd keeps sending background pages during postcopy; urgent
+         * pages need the preempt channel so they do not queue behind
+         * them.
+         */
         if (new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
-            error_setg(errp, "Postcopy is not yet compatible with multifd");
-            return false;
+            if (!new_caps[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
+                error_setg(errp, "Postcopy with multifd requires "
+                           "postcopy-preempt");
+                return false;
+            }
+            if (migrate_multifd_compression()) {
+                error_setg(errp, "Postcopy with multifd requires "
+                           "multifd-compression none");
+                return false;
+            }
         }
     }
 
@@ -517,6 +578,17 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
                 return false;
             }
         }
+
+        /*
+         * Releasing a huge page waits for all the channels, which only
+         * mapped-ram can do without telling the destination.
+         */
+        if (new_caps[MIGRATION_CAPABILITY_MULTIFD] &&
+            !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+            error_setg(errp, "Background-snapshot with multifd requires "
+                       "mapped-ram");
+            return false;
+        }
     }
 
 #ifdef CONFIG_LINUX
@@ -537,6 +609,24 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
     }
 #endif
 
+    if (new_caps[MIGRATION_CAPABILITY_X_LAZY_RESTORE] &&
+        !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Lazy restore requires mapped-ram");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_MEMORY_MAP] &&
+        !new_caps[MIGRATION_CAPABILITY_MAPPED_RAM]) {
+        error_setg(errp, "Memory map requires mapped-ram");
+        return false;
+    }
+
+    if (new_caps[MIGRATION_CAPABILITY_X_POSTCOPY_PREFETCH] &&
+        !new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
+        error_setg(errp, "Postcopy prefetch requires postcopy-ram");
+        return false;
+    }
+
     if (new_caps[MIGRATION_CAPABILITY_POSTCOPY_PREEMPT]) {
         if (!new_caps[MIGRATION_CAPABILITY_POSTCOPY_RAM]) {
             error_setg(errp, "Postcopy preempt requires postcopy-ram");
@@ -581,6 +671,9 @@ bool migrate_caps_check(bool *old_caps, bool *new_caps, Error **errp)
     if (new_caps[MIGRATION_CAPABILITY_MULTIFD]) {
         if (new_caps[MIGRATION_CAPABILITY_XBZRLE]) {
             error_setg(errp, "Multifd is not compatible with xbzrle");
+            error_append_hint(errp, "Use multifd-compression=xbzrle to "
+                              "encode pages with XBZRLE in the multifd "
+                              "channels.\n");
             return false;
         }
     }
@@ -1114,6 +1207,24 @@ bool migrate_params_check(MigrationParameters *params, Error **errp)
     }
 #endif
 
+    /* Zero pages sent by the migration thread would leave the cache stale */
+    if (params->has_multifd_compression &&
+        params->multifd_compression == MULTIFD_COMPRESSION_XBZRLE &&
+        params->has_zero_page_detection &&
+        params->zero_page_detection == ZERO_PAGE_DETECTION_LEGACY) {
+        error_setg(errp, "Multifd xbzrle is not compatible with legacy "
+                   "zero page detection");
+        return false;
+    }
+
+    /* Postcopy places multifd pages as they are received */
+    if (params->has_multifd_compression && params->multifd_compression &&
+        migrate_multifd() && migrate_postcopy_ram()) {
+        error_setg(errp, "Postcopy with multifd requires "
+                   "multifd-compression none");
+        return false;
+    }
+
     if (migrate_mapped_ram() &&
         (migrate_multifd_compression() || migrate_tls())) {
         error_setg(errp,
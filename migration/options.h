@@ -26,14 +26,18 @@ extern Property migration_properties[];
 
 bool migrate_auto_converge(void);
 bool migrate_colo(void);
+bool migrate_defer_hot_pages(void);
 bool migrate_dirty_bitmaps(void);
 bool migrate_events(void);
 bool migrate_mapped_ram(void);
 bool migrate_ignore_shared(void);
 bool migrate_late_block_activate(void);
+bool migrate_lazy_restore(void);
+bool migrate_memory_map(void);
 bool migrate_multifd(void);
 bool migrate_pause_before_switchover(void);
 bool migrate_postcopy_blocktime(void);
+bool migrate_postcopy_prefetch(void);
 bool migrate_postcopy_preempt(void);
 bool migrate_rdma_pin_all(void);
 bool migrate_release_ram(void);
@@ -53,6 +57,7 @@ bool migrate_multifd_flush_after_each_section(void);
 bool migrate_postcopy(void);
 bool migrate_rdma(void);
 bool migrate_tls(void);
+bool migrate_xbzrle_encoding(void);
 
 /* capabilities helpers */
 
@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set associative hash of the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -17,12 +17,22 @@
 #include "qapi/qmp/qerror.h"
 #include "qapi/error.h"
 #include "qemu/host-utils.h"
+#include "qemu/thread.h"
 #include "page_cache.h"
 #include "trace.h"
 
 /* the page in cache will not be replaced in two cycles */
 #define CACHED_PAGE_LIFETIME 2
 
+/*
+ * The cache is set associative: a page can be held by any way of the set
+ * its address maps to, so that a few pages competing for a set do not
+ * keep evicting each other.  Each set has its own lock, which lets the
+ * multifd threads share one cache; the migration thread also takes it,
+ * which costs little as it is the only user then.
+ */
+#define PAGE_CACHE_WAYS 4
+
 typedef struct CacheItem CacheItem;
 
 struct CacheItem {
@@ -31,18 +41,24 @@ struct CacheItem {
     uint8_t *it_data;
 };
 
+typedef struct CacheSet {
+    QemuSpin lock;
+    CacheItem items[PAGE_CACHE_WAYS];
+} CacheSet;
+
 struct PageCache {
-    CacheItem *page_cache;
+    CacheSet *sets;
     size_t page_size;
-    size_t max_num_items;
-    size_t num_items;
+    size_t num_sets;
+    unsigned int num_ways;
 };
 
 PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
 {
-    int64_t i;
     size_t num_pages = new_size / page_size;
     PageCache *cache;
+    size_t i;
+    unsigned int j;
 
     if (new_size < page_size) {
         error_setg(errp, QERR_INVALID_PARAMETER_VALUE, "cache size",
@@ -64,24 +80,31 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
         return NULL;
     }
     cache->page_size = page_size;
-    cache->num_items = 0;
-    cache->max_num_items = num_pages;
+    cache->num_ways = MIN(num_pages, PAGE_CACHE_WAYS);
+    cache->num_sets = num_pages / cache->num_ways;
 
-    trace_migration_pagecache_init(cache->max_num_items);
+    trace_migration_pagecache_init(num_pages);
 
-    /* We prefer not to abort if there is no memory */
-    cache->page_cache = g_try_malloc((cache->max_num_items) *
-                                     sizeof(*cache->page_cache));
-    if (!cache->page_cache) {
+    /*
+     * We prefer not to abort if there is no memory.  Pages are allocated
+     * when first inserted, by the thread that encodes them.
+     */
+    cache->sets = g_try_malloc(cache->num_sets * sizeof(*cache->sets));
+    if (!cache->sets) {
         error_setg(errp, "Failed to allocate page cache");
         g_free(cache);
         return NULL;
     }
 
-    for (i = 0; i < cache->max_num_items; i++) {
-        cache->page_cache[i].it_data = NULL;
-        cache->page_cache[i].it_age = 0;
-        cache->page_cache[i].it_addr = -1;
+    for (i = 0; i < cache->num_sets; i++) {
+        CacheSet *set = &cache->sets[i];
+
+        qemu_spin_init(&set->lock);
+        for (j = 0; j < PAGE_CACHE_WAYS; j++) {
+            set->items[j].it_data = NULL;
+            set->items[j].it_age = 0;
+            set->items[j].it_addr = -1;
+        }
     }
 
     return cache;
@@ -89,81 +112,91 @@ PageCache *cache_init(uint64_t new_size, size_t page_size, Error **errp)
 
 void cache_fini(PageCache *cache)
 {
-    int64_t i;
+    size_t i;
+    unsigned int j;
 
     g_assert(cache);
-    g_assert(cache->page_cache);
+    g_assert(cache->sets);
 
-    for (i = 0; i < cache->max_num_items; i++) {
-        g_free(cache->page_cache[i].it_data);
+    for (i = 0; i < cache->num_sets; i++) {
+        for (j = 0; j < cache->num_ways; j++) {
+            g_free(cache->sets[i].items[j].it_data);
+        }
     }
 
-    g_free(cache->page_cache);
-    cache->page_cache = NULL;
+    g_free(cache->sets);
+    cache->sets = NULL;
     g_free(cache);
 }
 
-static size_t cache_get_cache_pos(const PageCache *cache,
-                                  uint64_t address)
-{
-    g_assert(cache->max_num_items);
-    return (address / cache->page_size) & (cache->max_num_items - 1);
-}
-
-static CacheItem *cache_get_by_addr(const PageCache *cache, uint64_t addr)
+static CacheSet *cache_get_set(const PageCache *cache, uint64_t address)
 {
-    size_t pos;
-
     g_assert(cache);
-    g_assert(cache->page_cache);
+    g_assert(cache->sets);
 
-    pos = cache_get_cache_pos(cache, addr);
-
-    return &cache->page_cache[pos];
+    return &cache->sets[(address / cache->page_size) &
+                        (cache->num_sets - 1)];
 }
 
-uint8_t *get_cached_data(const PageCache *cache, uint64_t addr)
+/* Called with the lock of the set held */
+static CacheItem *cache_find_item(const PageCache *cache, CacheSet *set,
+                                  uint64_t addr)
 {
-    return cache_get_by_addr(cache, addr)->it_data;
+    unsigned int i;
+
+    for (i = 0; i < cache->num_ways; i++) {
+        if (set->items[i].it_data && set->items[i].it_addr == addr) {
+            return &set->items[i];
+        }
+    }
+    return NULL;
 }
 
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age)
+uint8_t *cache_lookup_lock(PageCache *cache, uint64_t addr,
+                           uint64_t current_age)
 {
+    CacheSet *set = cache_get_set(cache, addr);
     CacheItem *it;
 
-    it = cache_get_by_addr(cache, addr);
-
-    if (it->it_addr == addr) {
-        /* update the it_age when the cache hit */
-        it->it_age = current_age;
-        return true;
+    qemu_spin_lock(&set->lock);
+    it = cache_find_item(cache, set, addr);
+    if (!it) {
+        return NULL;
     }
-    return false;
+    /* update the it_age when the cache hit */
+    it->it_age = current_age;
+    return it->it_data;
 }
 
-int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
-                 uint64_t current_age)
+uint8_t *cache_insert_locked(PageCache *cache, uint64_t addr,
+                             const uint8_t *pdata, uint64_t current_age)
 {
-
-    CacheItem *it;
-
-    /* actual update of entry */
-    it = cache_get_by_addr(cache, addr);
-
-    if (it->it_data && it->it_addr != addr &&
-        it->it_age + CACHED_PAGE_LIFETIME > current_age) {
-        /* the cache page is fresh, don't replace it */
-        return -1;
+    CacheSet *set = cache_get_set(cache, addr);
+    CacheItem *it = cache_find_item(cache, set, addr);
+    unsigned int i;
+
+    if (!it) {
+        /* Take a free way, or else replace the stalest page */
+        it = &set->items[0];
+        for (i = 0; i < cache->num_ways && it->it_data; i++) {
+            CacheItem *way = &set->items[i];
+
+            if (!way->it_data || way->it_age < it->it_age) {
+                it = way;
+            }
+        }
+        if (it->it_data && it->it_age + CACHED_PAGE_LIFETIME > current_age) {
+            /* the cache page is fresh, don't replace it */
+            return NULL;
+        }
     }
     /* allocate page */
     if (!it->it_data) {
         it->it_data = g_try_malloc(cache->page_size);
         if (!it->it_data) {
             trace_migration_pagecache_insert();
-            return -1;
+            return NULL;
         }
-        cache->num_items++;
     }
 
     memcpy(it->it_data, pdata, cache->page_size);
@@ -171,5 +204,42 @@ int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
     it->it_age = current_age;
     it->it_addr = addr;
 
-    return 0;
+    return it->it_data;
+}
+
+void cache_unlock(PageCache *cache, uint64_t addr)
+{
+    qemu_spin_unlock(&cache_get_set(cache, addr)->lock);
+}
+
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age)
+{
+    bool hit = cache_lookup_lock(cache, addr, current_age);
+
+    cache_unlock(cache, addr);
+    return hit;
+}
+
+uint8_t *get_cached_data(PageCache *cache, uint64_t addr)
+{
+    CacheSet *set = cache_get_set(cache, addr);
+    CacheItem *it;
+
+    qemu_spin_lock(&set->lock);
+    it = cache_find_item(cache, set, addr);
+    qemu_spin_unlock(&set->lock);
+
+    return it ? it->it_data : NULL;
+}
+
+int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
+                 uint64_t current_age)
+{
+    uint8_t *data;
+
+    qemu_spin_lock(&cache_get_set(cache, addr)->lock);
+    data = cache_insert_locked(cache, addr, pdata, current_age);
+    cache_unlock(cache, addr);
+
+    return data ? 0 : -1;
 }
@@ -1,6 +1,6 @@
 /*
  * Page cache for QEMU
- * The cache is base on a hash of the page address
+ * The cache is a set associative hash of the page address
  *
  * Copyright 2012 Red Hat, Inc. and/or its affiliates
  *
@@ -44,8 +44,7 @@ void cache_fini(PageCache *cache);
  * @addr: page addr
  * @current_age: current bitmap generation
  */
-bool cache_is_cached(const PageCache *cache, uint64_t addr,
-                     uint64_t current_age);
+bool cache_is_cached(PageCache *cache, uint64_t addr, uint64_t current_age);
 
 /**
  * get_cached_data: Get the data cached for an addr
@@ -55,7 +54,7 @@ bool cache_is_cached(const PageCache *cache, uint64_t addr,
  * @cache pointer to the PageCache struct
  * @addr: page addr
  */
-uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
+uint8_t *get_cached_data(PageCache *cache, uint64_t addr);
 
 /**
  * cache_insert: insert the page into the cache. the page cache
@@ -71,4 +70,47 @@ uint8_t *get_cached_data(const PageCache *cache, uint64_t addr);
 int cache_insert(PageCache *cache, uint64_t addr, const uint8_t *pdata,
                  uint64_t current_age);
 
+/*
+ * The functions above each take the lock of the set that holds @addr,
+ * so that only the pages themselves need protecting by the caller.  To
+ * look up and update a page atomically, threads sharing the cache use
+ * the ones below instead.
+ */
+
+/**
+ * cache_lookup_lock: look up a page and lock its set
+ *
+ * Returns the data cached for the page or NULL if not cached.  Either
+ * way, the set stays locked until cache_unlock().
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page addr
+ * @current_age: current bitmap generation
+ */
+uint8_t *cache_lookup_lock(PageCache *cache, uint64_t addr,
+                           uint64_t current_age);
+
+/**
+ * cache_insert_locked: insert the page into the cache, with its set
+ * locked by cache_lookup_lock()
+ *
+ * Returns the cached copy of @pdata, or NULL when the page isn't
+ * inserted into cache
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page address
+ * @pdata: pointer to the page
+ * @current_age: current bitmap generation
+ */
+uint8_t *cache_insert_locked(PageCache *cache, uint64_t addr,
+                             const uint8_t *pdata, uint64_t current_age);
+
+/**
+ * cache_unlock: unlock the set locked by cache_lookup_lock()
+ *
+ * @cache pointer to the PageCache struct
+ * @addr: page address
+ */
+void cache_unlock(PageCache *cache, uint64_t addr);
+
 #endif
@@ -18,6 +18,7 @@
 
 #include "qemu/osdep.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "exec/target_page.h"
 #include "migration.h"
 #include "qemu-file.h"
@@ -943,6 +944,165 @@ static void mark_postcopy_blocktime_end(uintptr_t addr)
                                       affected_cpu);
 }
 
+/*
+ * Prefetch after faults (x-postcopy-prefetch)
+ *
+ * Each vCPU remembers where it faulted last.  When the distance between
+ * its faults repeats, the following pages along that stride are
+ * requested together with the faulting one; otherwise the pages right
+ * after it are.  The number of pages requested grows while faults land
+ * on predicted pages, and shrinks on mispredictions unless the vCPU
+ * spent a long time blocked on its previous fault, as measured by the
+ * postcopy-blocktime accounting.
+ */
+#define POSTCOPY_PREFETCH_MIN_PAGES     4
+#define POSTCOPY_PREFETCH_MAX_SIZE      (512 * KiB)
+#define POSTCOPY_PREFETCH_MAX_STRIDE    64
+#define POSTCOPY_PREFETCH_STRIDE_HITS   2
+#define POSTCOPY_PREFETCH_STALL_MS      1
+
+/* Prefetch state of one vCPU, only used by the fault thread */
+typedef struct PostcopyPrefetch {
+    RAMBlock *rb;
+    ram_addr_t last_offset;
+    /* Distance between the last two faults, in host pages */
+    int64_t stride;
+    /* Number of faults in a row that were @stride apart */
+    unsigned int stride_hits;
+    /* Distance between the pages prefetched after the last fault */
+    int64_t step;
+    /* Number of pages to prefetch */
+    unsigned int window;
+    /* Offset of the first page along @step that was not requested yet */
+    ram_addr_t next_offset;
+    /* vcpu_blocktime of the blocktime context at the last fault */
+    uint32_t blocktime;
+} PostcopyPrefetch;
+
+static uint32_t postcopy_prefetch_stall(MigrationIncomingState *mis,
+                                        PostcopyPrefetch *pp, int cpu)
+{
+    PostcopyBlocktimeContext *dc = mis->blocktime_ctx;
+    uint32_t blocktime, stall;
+
+    if (!dc || cpu < 0) {
+        return 0;
+    }
+    blocktime = qatomic_read(&dc->vcpu_blocktime[cpu]);
+    stall = blocktime - pp->blocktime;
+    pp->blocktime = blocktime;
+    return stall;
+}
+
+static bool postcopy_prefetch_skip(RAMBlock *rb, ram_addr_t offset)
+{
+    return ramblock_recv_bitmap_test_byte_offset(rb, offset) ||
+           ramblock_page_is_discarded(rb, offset);
+}
+
+/*
+ * Request the pages that @pp predicts after a fault at @offset of @rb.
+ * Contiguous pages are requested with one message.
+ */
+static void postcopy_prefetch_pages(MigrationIncomingState *mis,
+                                    PostcopyPrefetch *pp, RAMBlock *rb,
+                                    ram_addr_t offset)
+{
+    size_t pagesize = qemu_ram_pagesize(rb);
+    int64_t step = pp->step * (int64_t)pagesize;
+    int64_t end = qemu_ram_get_used_length(rb);
+    int64_t dist = (int64_t)(pp->next_offset - offset);
+    int64_t pos, run = -1;
+    unsigned int i = 1, pages = 0;
+
+    /* Do not request again what the previous fault prefetched */
+    if (dist % step == 0 && dist / step > 1 && dist / step <= pp->window) {
+        i = dist / step;
+    }
+
+    for (; i <= pp->window; i++) {
+        pos = offset + step * i;
+        if (pos < 0 || pos >= end) {
+            break;
+        }
+        if (postcopy_prefetch_skip(rb, pos)) {
+            if (run >= 0) {
+                migrate_send_rp_message_req_pages(mis, rb, run, pos - run);
+                run = -1;
+            }
+            continue;
+        }
+        pages++;
+        if (pp->step != 1) {
+            migrate_send_rp_message_req_pages(mis, rb, pos, pagesize);
+        } else if (run < 0) {
+            run = pos;
+        }
+    }
+    if (run >= 0) {
+        migrate_send_rp_message_req_pages(mis, rb, run,
+                                          offset + step * i - run);
+    }
+    pp->next_offset = offset + step * i;
+    trace_postcopy_prefetch_pages(qemu_ram_get_idstr(rb), offset, pp->step,
+                                  pp->window, pages);
+}
+
+/* Called by the fault thread after requesting page @offset of @rb */
+static void postcopy_prefetch(MigrationIncomingState *mis,
+                              PostcopyPrefetch *prefetch, RAMBlock *rb,
+                              ram_addr_t offset, uint32_t ptid)
+{
+    MachineState *ms = MACHINE(qdev_get_machine());
+    int cpu = ptid ? get_mem_fault_cpu_index(ptid) : -1;
+    /* Faults of unknown vCPUs share the last slot */
+    PostcopyPrefetch *pp = &prefetch[cpu < 0 ? ms->smp.cpus : cpu];
+    size_t pagesize = qemu_ram_pagesize(rb);
+    unsigned int max_window = MAX(POSTCOPY_PREFETCH_MAX_SIZE / pagesize, 1);
+    unsigned int min_window = MIN(POSTCOPY_PREFETCH_MIN_PAGES, max_window);
+    uint32_t stall = postcopy_prefetch_stall(mis, pp, cpu);
+    int64_t delta;
+    bool hit;
+
+    if (pp->rb != rb) {
+        pp->rb = rb;
+        pp->last_offset = offset;
+        pp->stride = 0;
+        pp->stride_hits = 0;
+        pp->step = 1;
+        pp->window = min_window;
+        pp->next_offset = offset;
+        postcopy_prefetch_pages(mis, pp, rb, offset);
+        return;
+    }
+
+    delta = ((int64_t)offset - (int64_t)pp->last_offset) / (int64_t)pagesize;
+    hit = delta && delta % pp->step == 0 && delta / pp->step > 0 &&
+          delta / pp->step <= pp->window;
+    if (hit) {
+        pp->window = MIN(pp->window * 2, max_window);
+    } else if (stall < POSTCOPY_PREFETCH_STALL_MS) {
+        pp->window = MAX(pp->window / 2, min_window);
+    }
+
+    if (delta == pp->stride) {
+        pp->stride_hits++;
+    } else {
+        pp->stride = delta;
+        pp->stride_hits = 0;
+    }
+    if (pp->stride_hits >= POSTCOPY_PREFETCH_STRIDE_HITS && pp->stride &&
+        ABS(pp->stride) <= POSTCOPY_PREFETCH_MAX_STRIDE) {
+        pp->step = pp->stride;
+    } else if (!hit) {
+        pp->step = 1;
+    }
+    pp->last_offset = offset;
+    trace_postcopy_prefetch(qemu_ram_get_idstr(rb), offset, cpu, delta,
+                            hit, stall);
+    postcopy_prefetch_pages(mis, pp, rb, offset);
+}
+
 static void postcopy_pause_fault_thread(MigrationIncomingState *mis)
 {
     trace_postcopy_pause_fault_thread();
@@ -960,6 +1120,7 @@ static void *postcopy_ram_fault_thread(void *opaque)
     int ret;
     size_t index;
     RAMBlock *rb = NULL;
+    PostcopyPrefetch *prefetch = NULL;
 
     trace_postcopy_ram_fault_thread_entry();
     rcu_register_thread();
@@ -970,6 +1131,11 @@ static void *postcopy_ram_fault_thread(void *opaque)
     size_t pfd_len = 2 + mis->postcopy_remote_fds->len;
 
     pfd = g_new0(struct pollfd, pfd_len);
+    if (migrate_postcopy_prefetch()) {
+        MachineState *ms = MACHINE(qdev_get_machine());
+
+        prefetch = g_new0(PostcopyPrefetch, ms->smp.cpus + 1);
+    }
 
     pfd[0].fd = mis->userfault_fd;
     pfd[0].events = POLLIN;
@@ -1084,6 +1250,10 @@ retry:
                 postcopy_pause_fault_thread(mis);
                 goto retry;
             }
+            if (prefetch) {
+                postcopy_prefetch(mis, prefetch, rb, rb_offset,
+                                  msg.arg.pagefault.feat.ptid);
+            }
         }
 
         /* Now handle any requests from external processes on shared memory */
@@ -1145,6 +1315,7 @@ retry:
     rcu_unregister_thread();
     trace_postcopy_ram_fault_thread_exit();
     g_free(pfd);
+    g_free(prefetch);
     return NULL;
 }
 
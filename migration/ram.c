@@ -31,6 +31,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/madvise.h"
+#include "qemu/units.h"
 #include "qemu/main-loop.h"
 #include "xbzrle.h"
 #include "ram.h"
@@ -40,6 +41,7 @@
 #include "migration/misc.h"
 #include "qemu-file.h"
 #include "postcopy-ram.h"
+#include "lazy-restore.h"
 #include "page_cache.h"
 #include "qemu/error-report.h"
 #include "qapi/error.h"
@@ -56,11 +58,13 @@
 #include "savevm.h"
 #include "qemu/iov.h"
 #include "multifd.h"
+#include "file.h"
 #include "sysemu/runstate.h"
 #include "rdma.h"
 #include "options.h"
 #include "sysemu/dirtylimit.h"
 #include "sysemu/kvm.h"
+#include "sysemu/tcg.h"
 
 #include "hw/boards.h" /* for machine_dump_guest_core() */
 
@@ -110,6 +114,12 @@
  */
 #define MAPPED_RAM_LOAD_BUF_SIZE 0x100000
 
+/*
+ * When doing mapped-ram migration, this is the most we gather from
+ * contiguous pages before writing them to the pages region.
+ */
+#define MAPPED_RAM_WRITE_BUF_SIZE 0x100000
+
 XBZRLECacheStats xbzrle_counters;
 
 /* used by the search for pages to send */
@@ -126,6 +136,8 @@ struct PageSearchStatus {
     bool         complete_round;
     /* Whether we're sending a host page */
     bool          host_page_sending;
+    /* Whether a vCPU is blocked writing to the page */
+    bool          urgent;
     /* The start/end of current host page.  Invalid if host_page_sending==false */
     unsigned long host_page_start;
     unsigned long host_page_end;
@@ -352,6 +364,8 @@ struct RAMSrcPageRequest {
 };
 
 /* State of RAM for migration */
+typedef struct RAMSyncPool RAMSyncPool;
+
 struct RAMState {
     /*
      * PageSearchStatus structures for the channels when send pages.
@@ -414,6 +428,15 @@ struct RAMState {
      * RAM migration.
      */
     unsigned int postcopy_bmap_sync_requested;
+    /* Threads syncing dirty bitmaps, NULL if the migration thread does it */
+    RAMSyncPool *sync_pool;
+    /*
+     * Contiguous mapped-ram pages not written yet.  Protected by the
+     * bitmap_mutex.
+     */
+    RAMBlock *mapped_ram_block;
+    ram_addr_t mapped_ram_start;
+    size_t mapped_ram_len;
 };
 typedef struct RAMState RAMState;
 
@@ -482,6 +505,7 @@ static void pss_init(PageSearchStatus *pss, RAMBlock *rb, ram_addr_t page)
     pss->block = rb;
     pss->page = page;
     pss->complete_round = false;
+    pss->urgent = false;
 }
 
 /*
@@ -698,6 +722,36 @@ static int save_xbzrle_page(RAMState *rs, PageSearchStatus *pss,
     return 1;
 }
 
+/*
+ * With x-defer-hot-pages, pages that the guest dirtied during both of
+ * the last two sync periods are skipped until the migration completes,
+ * or until a sync finds them clean, instead of being resent on every
+ * pass over RAM.
+ */
+static bool ram_defer_hot_pages(RAMState *rs)
+{
+    return migrate_defer_hot_pages() && !rs->last_stage &&
+           !migration_in_postcopy();
+}
+
+/* Like find_next_bit() on @bmap, skipping the pages set in @hot */
+static unsigned long find_next_cold_bit(const unsigned long *bmap,
+                                        const unsigned long *hot,
+                                        unsigned long size,
+                                        unsigned long page)
+{
+    while (page < size) {
+        unsigned long i = BIT_WORD(page);
+        unsigned long bits = bmap[i] & ~hot[i] & BITMAP_FIRST_WORD_MASK(page);
+
+        if (bits) {
+            return MIN(i * BITS_PER_LONG + ctzl(bits), size);
+        }
+        page = (i + 1) * BITS_PER_LONG;
+    }
+    return size;
+}
+
 /**
  * pss_find_next_dirty: find the next dirty page of current ramblock
  *
@@ -728,6 +782,9 @@ static void pss_find_next_dirty(PageSearchStatus *pss)
     if (pss->host_page_sending) {
         assert(pss->host_page_end);
         size = MIN(size, pss->host_page_end);
+    } else if (rb->hot_bmap && ram_defer_hot_pages(ram_state)) {
+        pss->page = find_next_cold_bit(bitmap, rb->hot_bmap, size, pss->page);
+        return;
     }
 
     pss->page = find_next_bit(bitmap, size, pss->page);
@@ -922,6 +979,170 @@ static void ramblock_sync_dirty_bitmap(RAMState *rs, RAMBlock *rb)
     rs->num_dirty_pages_period += new_dirty_pages;
 }
 
+/*
+ * Syncing the dirty bitmaps of a large guest takes long enough to stall
+ * the migration thread, so a pool of threads shares the work.  RAMBlocks
+ * are split into chunks of RAM_SYNC_CHUNK_SIZE; chunks start at multiples
+ * of BITS_PER_LONG pages within their block, so two threads never update
+ * the same word of RAMBlock.bmap, and the clear_bmap is set atomically.
+ * The migration thread takes part and adds up the newly dirty pages.
+ */
+#define RAM_SYNC_CHUNK_SIZE     (1 * GiB)
+/* Below this, one thread walks the bitmaps faster than it wakes up others */
+#define RAM_SYNC_MIN_SIZE       (4 * GiB)
+
+typedef struct RAMSyncChunk {
+    RAMBlock *rb;
+    ram_addr_t start;
+    ram_addr_t length;
+    uint64_t num_dirty;
+} RAMSyncChunk;
+
+struct RAMSyncPool {
+    QemuThread *threads;
+    unsigned int nr_threads;
+    QemuSemaphore work_sem;     /* Posted once per thread for each sync */
+    QemuSemaphore done_sem;     /* Posted by each thread when it is done */
+    GArray *chunks;
+    unsigned int next;          /* Next chunk to claim, atomic */
+    bool exit;
+};
+
+static void ram_sync_pool_run(RAMSyncPool *pool)
+{
+    unsigned int i;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        while ((i = qatomic_fetch_inc(&pool->next)) < pool->chunks->len) {
+            RAMSyncChunk *c = &g_array_index(pool->chunks, RAMSyncChunk, i);
+
+            c->num_dirty = cpu_physical_memory_sync_dirty_bitmap(c->rb,
+                                                                 c->start,
+                                                                 c->length);
+        }
+    }
+}
+
+static void *ram_sync_pool_thread(void *opaque)
+{
+    RAMSyncPool *pool = opaque;
+
+    rcu_register_thread();
+    for (;;) {
+        qemu_sem_wait(&pool->work_sem);
+        if (pool->exit) {
+            break;
+        }
+        ram_sync_pool_run(pool);
+        qemu_sem_post(&pool->done_sem);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+/* Called with RCU critical section and bitmap_mutex held */
+static void ram_sync_pool_sync(RAMState *rs)
+{
+    RAMSyncPool *pool = rs->sync_pool;
+    RAMBlock *block;
+    unsigned int i;
+
+    g_array_set_size(pool->chunks, 0);
+    RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+        ram_addr_t start;
+
+        /* Without a clear_bmap, syncing calls into the memory listeners */
+        if (!block->clear_bmap) {
+            ramblock_sync_dirty_bitmap(rs, block);
+            continue;
+        }
+        for (start = 0; start < block->used_length;
+             start += RAM_SYNC_CHUNK_SIZE) {
+            RAMSyncChunk c = {
+                .rb = block,
+                .start = start,
+                .length = MIN(RAM_SYNC_CHUNK_SIZE,
+                              block->used_length - start),
+            };
+
+            g_array_append_val(pool->chunks, c);
+        }
+    }
+
+    pool->next = 0;
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+    ram_sync_pool_run(pool);
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_wait(&pool->done_sem);
+    }
+
+    for (i = 0; i < pool->chunks->len; i++) {
+        RAMSyncChunk *c = &g_array_index(pool->chunks, RAMSyncChunk, i);
+
+        rs->migration_dirty_pages += c->num_dirty;
+        rs->num_dirty_pages_period += c->num_dirty;
+    }
+    trace_ram_sync_pool_sync(pool->chunks->len);
+}
+
+static void ram_sync_pool_create(RAMState *rs)
+{
+    RAMSyncPool *pool;
+    unsigned int i, nr_threads;
+
+    /*
+     * With TCG, syncing also resets the dirty bits of the TLBs, which is
+     * left to the migration thread.
+     */
+    if (rs->sync_pool || tcg_enabled() ||
+        ram_bytes_total() < RAM_SYNC_MIN_SIZE) {
+        return;
+    }
+    /* The migration thread syncs as well. */
+    nr_threads = MIN(ram_bytes_total() / RAM_SYNC_CHUNK_SIZE,
+                     MAX(g_get_num_processors(), 1)) - 1;
+    if (!nr_threads) {
+        return;
+    }
+
+    pool = g_new0(RAMSyncPool, 1);
+    pool->nr_threads = nr_threads;
+    pool->threads = g_new(QemuThread, nr_threads);
+    pool->chunks = g_array_new(false, false, sizeof(RAMSyncChunk));
+    qemu_sem_init(&pool->work_sem, 0);
+    qemu_sem_init(&pool->done_sem, 0);
+    for (i = 0; i < nr_threads; i++) {
+        qemu_thread_create(&pool->threads[i], MIGRATION_THREAD_SRC_SYNC,
+                           ram_sync_pool_thread, pool, QEMU_THREAD_JOINABLE);
+    }
+    trace_ram_sync_pool_create(nr_threads);
+    rs->sync_pool = pool;
+}
+
+static void ram_sync_pool_destroy(RAMState *rs)
+{
+    RAMSyncPool *pool = g_steal_pointer(&rs->sync_pool);
+    unsigned int i;
+
+    if (!pool) {
+        return;
+    }
+    pool->exit = true;
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_sem_post(&pool->work_sem);
+    }
+    for (i = 0; i < pool->nr_threads; i++) {
+        qemu_thread_join(&pool->threads[i]);
+    }
+    qemu_sem_destroy(&pool->work_sem);
+    qemu_sem_destroy(&pool->done_sem);
+    g_array_free(pool->chunks, true);
+    g_free(pool->threads);
+    g_free(pool);
+}
+
 /**
  * ram_pagesize_summary: calculate all the pagesizes of a VM
  *
@@ -947,7 +1168,7 @@ uint64_t ram_get_total_transferred_pages(void)
 {
     return stat64_get(&mig_stats.normal_pages) +
         stat64_get(&mig_stats.zero_pages) +
-        xbzrle_counters.pages;
+        (migrate_xbzrle() ? xbzrle_counters.pages : 0);
 }
 
 static void migration_update_rates(RAMState *rs, int64_t end_time)
@@ -963,7 +1184,7 @@ static void migration_update_rates(RAMState *rs, int64_t end_time)
         return;
     }
 
-    if (migrate_xbzrle()) {
+    if (migrate_xbzrle_encoding()) {
         double encoded_size, unencoded_size;
 
         xbzrle_counters.cache_miss_rate = (double)(xbzrle_counters.cache_miss -
@@ -1044,8 +1265,9 @@ static void migration_trigger_throttle(RAMState *rs)
 static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 {
     RAMBlock *block;
-    int64_t end_time;
+    int64_t start_us, sync_us, end_time;
 
+    start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
     stat64_add(&mig_stats.dirty_sync_count, 1);
 
     if (!rs->time_last_bitmap_sync) {
@@ -1057,8 +1279,12 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     WITH_QEMU_LOCK_GUARD(&rs->bitmap_mutex) {
         WITH_RCU_READ_LOCK_GUARD() {
-            RAMBLOCK_FOREACH_NOT_IGNORED(block) {
-                ramblock_sync_dirty_bitmap(rs, block);
+            if (rs->sync_pool) {
+                ram_sync_pool_sync(rs);
+            } else {
+                RAMBLOCK_FOREACH_NOT_IGNORED(block) {
+                    ramblock_sync_dirty_bitmap(rs, block);
+                }
             }
             stat64_set(&mig_stats.dirty_bytes_last_sync, ram_bytes_remaining());
         }
@@ -1066,6 +1292,9 @@ static void migration_bitmap_sync(RAMState *rs, bool last_stage)
 
     memory_global_after_dirty_log_sync();
     trace_migration_bitmap_sync_end(rs->num_dirty_pages_period);
+    sync_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME) - start_us;
+    stat64_add(&mig_stats.dirty_sync_time, sync_us);
+    migration_histogram_add(&mig_stats.dirty_sync_time_hist, sync_us);
 
     end_time = qemu_clock_get_ms(QEMU_CLOCK_REALTIME);
 
@@ -1195,6 +1424,53 @@ static bool control_save_page(PageSearchStatus *pss,
     return true;
 }
 
+/*
+ * Write the pending run of contiguous mapped-ram pages.  Must be called
+ * within the RCU read section in which the pages were added.
+ */
+static void mapped_ram_write_flush(RAMState *rs, QEMUFile *file)
+{
+    RAMBlock *block = rs->mapped_ram_block;
+
+    if (!rs->mapped_ram_len) {
+        return;
+    }
+    qemu_put_buffer_at(file, block->host + rs->mapped_ram_start,
+                       rs->mapped_ram_len,
+                       block->pages_offset + rs->mapped_ram_start);
+    rs->mapped_ram_len = 0;
+}
+
+/*
+ * With mapped-ram, every page has a fixed place in the file, so
+ * contiguous guest pages are gathered and written with one request.
+ * Writes to the vmstate area of a block device, as done by savevm, are
+ * synchronous and would be dominated by their per-request cost.
+ */
+static void mapped_ram_write_page(RAMState *rs, QEMUFile *file,
+                                  RAMBlock *block, ram_addr_t offset,
+                                  uint8_t *buf)
+{
+    if (buf != block->host + offset) {
+        mapped_ram_write_flush(rs, file);
+        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
+                           block->pages_offset + offset);
+        return;
+    }
+
+    if (rs->mapped_ram_len &&
+        (rs->mapped_ram_block != block ||
+         rs->mapped_ram_start + rs->mapped_ram_len != offset ||
+         rs->mapped_ram_len >= MAPPED_RAM_WRITE_BUF_SIZE)) {
+        mapped_ram_write_flush(rs, file);
+    }
+    if (!rs->mapped_ram_len) {
+        rs->mapped_ram_block = block;
+        rs->mapped_ram_start = offset;
+    }
+    rs->mapped_ram_len += TARGET_PAGE_SIZE;
+}
+
 /*
  * directly send the page to the stream
  *
@@ -1212,8 +1488,7 @@ static int save_normal_page(PageSearchStatus *pss, RAMBlock *block,
     QEMUFile *file = pss->pss_channel;
 
     if (migrate_mapped_ram()) {
-        qemu_put_buffer_at(file, buf, TARGET_PAGE_SIZE,
-                           block->pages_offset + offset);
+        mapped_ram_write_page(ram_state, file, block, offset, buf);
         set_bit(offset >> TARGET_PAGE_BITS, block->file_bmap);
     } else {
         ram_transferred_add(save_page_header(pss, pss->pss_channel, block,
@@ -1452,8 +1727,27 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
         void *page_address = pss->block->host + (start_page << TARGET_PAGE_BITS);
         uint64_t run_length = (pss->page - start_page) << TARGET_PAGE_BITS;
 
-        /* Flush async buffers before un-protect. */
-        qemu_fflush(pss->pss_channel);
+        if (migrate_multifd()) {
+            if (qemu_ram_pagesize(pss->block) == TARGET_PAGE_SIZE) {
+                /*
+                 * The channels un-protect the pages once they wrote them,
+                 * see ram_write_tracking_release().  Don't let a page
+                 * that a vCPU waits for sit in a half-filled batch.
+                 */
+                return pss->urgent ? multifd_ram_flush() : 0;
+            }
+            /*
+             * A huge page may have been split across channels; wait for
+             * all of them.  With mapped-ram, this doesn't touch the
+             * stream.
+             */
+            if (multifd_ram_flush_and_sync() < 0) {
+                return -1;
+            }
+        } else {
+            /* Flush async buffers before un-protect. */
+            qemu_fflush(pss->pss_channel);
+        }
         /* Un-protect memory range. */
         res = uffd_change_protection(rs->uffdio_fd, page_address, run_length,
                 false, false);
@@ -1462,6 +1756,47 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
     return res;
 }
 
+/**
+ * ram_write_tracking_release: release UFFD write protection of pages
+ *   that a multifd channel has just saved
+ *
+ * Runs in the channel's thread, so that the pages are released as soon
+ *   as they are in the file and the migration thread can go on queueing.
+ *   Blocks backed by huge pages are left to ram_save_release_protection().
+ *
+ * Returns 0 on success, negative value in case of an error
+ *
+ * @block: RAM block of the pages
+ * @offset: offsets of the pages within @block
+ * @num: number of pages
+ */
+int ram_write_tracking_release(RAMBlock *block, const ram_addr_t *offset,
+                               uint32_t num)
+{
+    uint32_t i = 0;
+
+    if (!(block->flags & RAM_UF_WRITEPROTECT) ||
+        qemu_ram_pagesize(block) != TARGET_PAGE_SIZE) {
+        return 0;
+    }
+
+    while (i < num) {
+        ram_addr_t start = offset[i];
+        uint64_t length = TARGET_PAGE_SIZE;
+
+        /* One ioctl for each run of adjacent pages */
+        while (++i < num && offset[i] == start + length) {
+            length += TARGET_PAGE_SIZE;
+        }
+        if (uffd_change_protection(ram_state->uffdio_fd, block->host + start,
+                                   length, false, false)) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
 /* ram_write_tracking_available: check if kernel supports required UFFD features
  *
  * Returns true if supports, false otherwise
@@ -1759,6 +2094,12 @@ static int ram_save_release_protection(RAMState *rs, PageSearchStatus *pss,
     return 0;
 }
 
+int ram_write_tracking_release(RAMBlock *block, const ram_addr_t *offset,
+                               uint32_t num)
+{
+    g_assert_not_reached();
+}
+
 bool ram_write_tracking_available(void)
 {
     return false;
@@ -1825,6 +2166,7 @@ static bool get_queued_page(RAMState *rs, PageSearchStatus *pss)
          * when we have vcpus got blocked by the write protected pages.
          */
         block = poll_fault_page(rs, &offset);
+        pss->urgent = !!block;
     }
 
     if (block) {
@@ -1928,6 +2270,7 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
         ram_addr_t page_start = start >> TARGET_PAGE_BITS;
         size_t page_size = qemu_ram_pagesize(ramblock);
         PageSearchStatus *pss = &ram_state->pss[RAM_CHANNEL_POSTCOPY];
+        int64_t start_us = qemu_clock_get_us(QEMU_CLOCK_REALTIME);
         int ret = 0;
 
         qemu_mutex_lock(&rs->bitmap_mutex);
@@ -1966,6 +2309,9 @@ int ram_save_queue_pages(const char *rbname, ram_addr_t start, ram_addr_t len,
             len -= page_size;
         };
         qemu_mutex_unlock(&rs->bitmap_mutex);
+        migration_histogram_add(&mig_stats.postcopy_urgent_time,
+                                qemu_clock_get_us(QEMU_CLOCK_REALTIME) -
+                                start_us);
 
         return ret;
     }
@@ -2022,12 +2368,28 @@ static int ram_save_target_page_multifd(RAMState *rs, PageSearchStatus *pss)
     RAMBlock *block = pss->block;
     ram_addr_t offset = ((ram_addr_t)pss->page) << TARGET_PAGE_BITS;
 
+    /*
+     * During postcopy, urgent pages go out on the preempt channel.  Huge
+     * pages must be placed whole, while the destination places multifd
+     * pages one target page at a time.
+     */
+    if (migration_in_postcopy() &&
+        (pss == &rs->pss[RAM_CHANNEL_POSTCOPY] ||
+         qemu_ram_pagesize(block) != TARGET_PAGE_SIZE)) {
+        return ram_save_target_page_legacy(rs, pss);
+    }
+
     /*
      * While using multifd live migration, we still need to handle zero
      * page checking on the migration main thread.
      */
     if (migrate_zero_page_detection() == ZERO_PAGE_DETECTION_LEGACY) {
         if (save_zero_page(rs, pss, offset)) {
+            /* No channel will see this page, release it here. */
+            if (migrate_background_snapshot() &&
+                ram_write_tracking_release(block, &offset, 1)) {
+                return -1;
+            }
             return 1;
         }
     }
@@ -2326,6 +2688,7 @@ static void xbzrle_load_cleanup(void)
 static void ram_state_cleanup(RAMState **rsp)
 {
     if (*rsp) {
+        ram_sync_pool_destroy(*rsp);
         migration_page_queue_free(*rsp);
         qemu_mutex_destroy(&(*rsp)->bitmap_mutex);
         qemu_mutex_destroy(&(*rsp)->src_page_req_mutex);
@@ -2361,6 +2724,10 @@ static void ram_bitmaps_destroy(void)
         block->bmap = NULL;
         g_free(block->file_bmap);
         block->file_bmap = NULL;
+        g_free(block->dirty_prev);
+        block->dirty_prev = NULL;
+        g_free(block->hot_bmap);
+        block->hot_bmap = NULL;
     }
 }
 
@@ -2752,6 +3119,10 @@ static void ram_list_init_bitmaps(void)
             }
             block->clear_bmap_shift = shift;
             block->clear_bmap = bitmap_new(clear_bmap_size(pages, shift));
+            if (migrate_defer_hot_pages()) {
+                block->dirty_prev = bitmap_new(pages);
+                block->hot_bmap = bitmap_new(pages);
+            }
         }
     }
 }
@@ -3012,6 +3383,7 @@ static int ram_save_setup(QEMUFile *f, void *opaque, Error **errp)
         }
     }
     (*rsp)->pss[RAM_CHANNEL_PRECOPY].pss_channel = f;
+    ram_sync_pool_create(*rsp);
 
     /*
      * ??? Mirrors the previous value of qemu_host_page_size,
@@ -3195,9 +3567,23 @@ static int ram_save_iterate(QEMUFile *f, void *opaque)
                 }
                 i++;
             }
+            mapped_ram_write_flush(rs, f);
         }
     }
 
+    /*
+     * Only deferred hot pages are left: sync now so that those the guest
+     * stopped writing are sent, rather than waiting for the pending
+     * amount to drop below the threshold.
+     */
+    if (done && ram_defer_hot_pages(rs) && rs->migration_dirty_pages) {
+        bql_lock();
+        WITH_RCU_READ_LOCK_GUARD() {
+            migration_bitmap_sync_precopy(false);
+        }
+        bql_unlock();
+    }
+
     /*
      * Must occur before EOS (or any QEMUFile operation)
      * because of RDMA protocol.
@@ -3274,6 +3660,7 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
                 return pages;
             }
         }
+        mapped_ram_write_flush(rs, f);
         qemu_mutex_unlock(&rs->bitmap_mutex);
 
         ret = rdma_registration_stop(f, RAM_CONTROL_FINISH);
@@ -3298,6 +3685,9 @@ static int ram_save_complete(QEMUFile *f, void *opaque)
             error_reportf_err(local_err, "Failed to write bitmap to file: ");
             return -err;
         }
+        if (migrate_memory_map()) {
+            file_write_memory_map();
+        }
     }
 
     qemu_put_be64(f, RAM_SAVE_FLAG_EOS);
@@ -3635,6 +4025,7 @@ static int ram_load_cleanup(void *opaque)
     }
 
     xbzrle_load_cleanup();
+    lazy_restore_start();
 
     RAMBLOCK_FOREACH_NOT_IGNORED(rb) {
         g_free(rb->receivedmap);
@@ -3998,7 +4389,12 @@ static void parse_ramblock_mapped_ram(QEMUFile *f, RAMBlock *block,
         return;
     }
 
-    if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
+    if (migrate_lazy_restore()) {
+        if (!lazy_restore_add_block(f, block, bitmap, num_pages,
+                                    block->pages_offset, errp)) {
+            return;
+        }
+    } else if (!read_ramblock_mapped_ram(f, block, num_pages, bitmap, errp)) {
         return;
     }
 
@@ -93,5 +93,7 @@ bool ram_write_tracking_compatible(void);
 void ram_write_tracking_prepare(void);
 int ram_write_tracking_start(void);
 void ram_write_tracking_stop(void);
+int ram_write_tracking_release(RAMBlock *block, const ram_addr_t *offset,
+                               uint32_t num);
 
 #endif
@@ -66,6 +66,7 @@
 #include "net/announce.h"
 #include "qemu/yank.h"
 #include "yank_functions.h"
+#include "multifd.h"
 #include "sysemu/qtest.h"
 #include "options.h"
 
@@ -1693,6 +1694,15 @@ static int qemu_savevm_state(QEMUFile *f, Error **errp)
         return -EINVAL;
     }
 
+    /*
+     * The vmstate area of a block device can only be accessed from the
+     * main loop, not from multifd channels.
+     */
+    if (migrate_multifd()) {
+        error_setg(errp, "Snapshots do not support multifd, use mapped-ram");
+        return -EINVAL;
+    }
+
     ret = migrate_init(ms, errp);
     if (ret) {
         return ret;
@@ -2105,6 +2115,8 @@ static int loadvm_postcopy_handle_listen(MigrationIncomingState *mis)
 
     trace_loadvm_postcopy_handle_listen("after uffd");
 
+    multifd_recv_postcopy_listen();
+
     if (postcopy_notify(POSTCOPY_NOTIFY_INBOUND_LISTEN, &local_err)) {
         error_report_err(local_err);
         return -1;
@@ -2206,7 +2218,8 @@ static gboolean postcopy_sync_page_req(gpointer key, gpointer value,
         return FALSE;
     }
 
-    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset);
+    ret = migrate_send_rp_message_req_pages(mis, rb, rb_offset,
+                                            qemu_ram_pagesize(rb));
     if (ret) {
         /* Please refer to above comment. */
         error_report("%s: send rp message failed for addr %p",
@@ -3045,6 +3058,37 @@ int qemu_loadvm_approve_switchover(void)
     return migrate_send_rp_switchover_ack(mis);
 }
 
+int qemu_loadvm_load_state_buffer(const char *idstr, uint32_t instance_id,
+                                  uint32_t buf_idx, char *buf, size_t len,
+                                  Error **errp)
+{
+    SaveStateEntry *se = find_se(idstr, instance_id);
+
+    if (!se || !se->ops || !se->ops->load_state_buffer) {
+        error_setg(errp, "Unknown device state buffer for section %s "
+                   "instance %u", idstr, instance_id);
+        g_free(buf);
+        return -EINVAL;
+    }
+
+    return se->ops->load_state_buffer(se->opaque, buf_idx, buf, len, errp);
+}
+
+bool qemu_savevm_find_section(const SaveVMHandlers *ops, void *opaque,
+                              const char **idstr, uint32_t *instance_id)
+{
+    SaveStateEntry *se;
+
+    QTAILQ_FOREACH(se, &savevm_state.handlers, entry) {
+        if (se->ops == ops && se->opaque == opaque) {
+            *idstr = se->idstr;
+            *instance_id = se->instance_id;
+            return true;
+        }
+    }
+    return false;
+}
+
 bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
                   bool has_devices, strList *devices, Error **errp)
 {
@@ -3129,7 +3173,9 @@ bool save_snapshot(const char *name, bool overwrite, const char *vmstate,
         goto the_end;
     }
     ret = qemu_savevm_state(f, errp);
-    vm_state_size = qemu_file_transferred(f);
+    /* Pages of mapped-ram are written below the end of the stream */
+    vm_state_size = migrate_mapped_ram() ? qemu_get_offset(f)
+                                         : qemu_file_transferred(f);
     ret2 = qemu_fclose(f);
     if (ret < 0) {
         goto the_end;
@@ -28,6 +28,7 @@
 #include "qapi/qmp/qdict.h"
 #include "qemu/cutils.h"
 #include "qemu/log.h"
+#include "qemu/rcu.h"
 #include "sysemu/sysemu.h"
 
 bool hmp_handle_error(Monitor *mon, Error *err)
@@ -202,6 +203,13 @@ void hmp_info_iothreads(Monitor *mon, const QDict *qdict)
         monitor_printf(mon, "  poll-shrink=%" PRId64 "\n", value->poll_shrink);
         monitor_printf(mon, "  aio-max-batch=%" PRId64 "\n",
                        value->aio_max_batch);
+        for (IOThreadPollHandlerInfoList *h = value->poll_handlers; h;
+             h = h->next) {
+            monitor_printf(mon, "  fd %" PRId64 ": poll-ns=%" PRId64
+                           " poll-hits=%" PRIu64 " poll-misses=%" PRIu64 "\n",
+                           h->value->fd, h->value->poll_ns,
+                           h->value->poll_hits, h->value->poll_misses);
+        }
     }
 
     qapi_free_IOThreadInfoList(info_list);
@@ -228,6 +236,19 @@ void hmp_info_sync_profile(Monitor *mon, const QDict *qdict)
     qsp_report(max, sort_by, coalesce);
 }
 
+void hmp_info_rcu(Monitor *mon, const QDict *qdict)
+{
+    RCUStats stats;
+
+    rcu_get_stats(&stats);
+    monitor_printf(mon, "pending callbacks: %" PRIu64 "\n", stats.pending);
+    monitor_printf(mon, "largest batch: %" PRIu64 "\n", stats.max_pending);
+    monitor_printf(mon, "invoked callbacks: %" PRIu64 "\n", stats.invoked);
+    monitor_printf(mon, "grace periods: %" PRIu64 " (%" PRIu64
+                   " expedited)\n",
+                   stats.grace_periods, stats.expedited_grace_periods);
+}
+
 void hmp_info_history(Monitor *mon, const QDict *qdict)
 {
     MonitorHMP *hmp_mon = container_of(mon, MonitorHMP, common);
@@ -31,6 +31,7 @@
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qjson.h"
 #include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qstring.h"
 #include "trace.h"
 
 /*
@@ -144,6 +145,66 @@ void qmp_send_response(MonitorQMP *mon, const QDict *rsp)
     g_string_free(json, true);
 }
 
+/*
+ * Emit the response @rsp of a command with QCO_JSON_OUTPUT to @mon.
+ * Its "return" member is a QString holding the JSON text of the
+ * return value, which is copied to the output as is.
+ */
+static void qmp_send_json_response(MonitorQMP *mon, QDict *rsp)
+{
+    g_autoptr(QString) ret = qobject_ref(qobject_to(QString,
+                                                   qdict_get(rsp, "return")));
+    g_autoptr(GString) rest = NULL;
+    const char *sep;
+
+    if (mon->pretty) {
+        qdict_put_obj(rsp, "return",
+                      qobject_from_json(qstring_get_str(ret), &error_abort));
+        qmp_send_response(mon, rsp);
+        return;
+    }
+
+    /* What is left is either "{}" or has the "id" member */
+    qdict_del(rsp, "return");
+    rest = qobject_to_json(QOBJECT(rsp));
+    sep = rest->len > 2 ? ", " : "";
+
+    if (trace_event_get_state_backends(TRACE_MONITOR_QMP_RESPOND)) {
+        g_autofree char *json = g_strdup_printf("{\"return\": %s%s%s",
+                                                qstring_get_str(ret),
+                                                sep, rest->str + 1);
+
+        trace_monitor_qmp_respond(mon, json);
+    }
+
+    WITH_QEMU_LOCK_GUARD(&mon->common.mon_lock) {
+        monitor_puts_locked(&mon->common, "{\"return\": ");
+        monitor_puts_locked(&mon->common, qstring_get_str(ret));
+        monitor_puts_locked(&mon->common, sep);
+        g_string_append_c(rest, '\n');
+        monitor_puts_locked(&mon->common, rest->str + 1);
+    }
+}
+
+/*
+ * Does @req execute a command of @mon that was registered with
+ * QCO_JSON_OUTPUT?
+ */
+static bool qmp_is_json_output(MonitorQMP *mon, QObject *req)
+{
+    QDict *dict = qobject_to(QDict, req);
+    const char *command;
+    const QmpCommand *cmd;
+
+    if (!dict) {
+        return false;
+    }
+    command = qdict_get_try_str(dict, "execute")
+        ?: qdict_get_try_str(dict, "exec-oob");
+    cmd = command ? qmp_find_command(mon->commands, command) : NULL;
+    return cmd && (cmd->options & QCO_JSON_OUTPUT);
+}
+
 /*
  * Emit QMP response @rsp to @mon.
  * Null @rsp can only happen for commands with QCO_NO_SUCCESS_RESP.
@@ -180,7 +241,11 @@ static void monitor_qmp_dispatch(MonitorQMP *mon, QObject *req)
         }
     }
 
-    monitor_qmp_respond(mon, rsp);
+    if (rsp && qdict_haskey(rsp, "return") && qmp_is_json_output(mon, req)) {
+        qmp_send_json_response(mon, rsp);
+    } else {
+        monitor_qmp_respond(mon, rsp);
+    }
     qobject_unref(rsp);
 }
 
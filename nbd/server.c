@@ -28,6 +28,7 @@
 #include "nbd-internal.h"
 #include "qemu/units.h"
 #include "qemu/memalign.h"
+#include "sysemu/iothread.h"
 
 #define NBD_META_ID_BASE_ALLOCATION 0
 #define NBD_META_ID_ALLOCATION_DEPTH 1
@@ -42,6 +43,13 @@
  */
 #define NBD_MAX_BLOCK_STATUS_EXTENTS (1 * MiB / 8)
 
+/*
+ * NBD_ZERO_COPY_MIN: read payloads from this size on are sent with
+ * MSG_ZEROCOPY if the export enables it.  Below that, pinning the pages
+ * and reading the completion costs more than the copy.
+ */
+#define NBD_ZERO_COPY_MIN (64 * KiB)
+
 static int system_errno_to_nbd_errno(int err)
 {
     switch (err) {
@@ -78,11 +86,14 @@ static int system_errno_to_nbd_errno(int err)
 /* Definitions for opaque data types */
 
 typedef struct NBDRequestData NBDRequestData;
+typedef QSIMPLEQ_HEAD(, NBDRequestData) NBDZeroCopyReqs;
 
 struct NBDRequestData {
     NBDClient *client;
     uint8_t *data;
     bool complete;
+    bool zero_copy; /* data may still be referenced by the socket */
+    QSIMPLEQ_ENTRY(NBDRequestData) zero_copy_next;
 };
 
 struct NBDExport {
@@ -101,6 +112,11 @@ struct NBDExport {
     bool allocation_depth;
     BdrvDirtyBitmap **export_bitmaps;
     size_t nr_export_bitmaps;
+
+    bool zero_copy;
+    IOThread **iothreads;
+    size_t nr_iothreads;
+    size_t next_iothread;
 };
 
 static QTAILQ_HEAD(, NBDExport) exports = QTAILQ_HEAD_INITIALIZER(exports);
@@ -129,6 +145,7 @@ struct NBDClient {
     QemuMutex lock;
 
     NBDExport *exp;
+    AioContext *ctx; /* Where requests run, or NULL to follow the export */
     QCryptoTLSCreds *tlscreds;
     char *tlsauthz;
     uint32_t handshake_max_secs;
@@ -140,6 +157,14 @@ struct NBDClient {
     CoMutex send_lock;
     Coroutine *send_coroutine;
 
+    /*
+     * Requests whose data was sent with MSG_ZEROCOPY, freed once the
+     * kernel reported their transmission.  Protected by lock.
+     */
+    bool zero_copy;
+    NBDZeroCopyReqs zero_copy_reqs;
+    unsigned nr_zero_copy_reqs;
+
     bool read_yielding; /* protected by lock */
     bool quiescing; /* protected by lock */
 
@@ -159,6 +184,12 @@ struct NBDClient {
 
 static void nbd_client_receive_next_request(NBDClient *client);
 
+/* The AioContext that runs the requests of a negotiated @client */
+static AioContext *nbd_client_aio_context(NBDClient *client)
+{
+    return client->ctx ?: client->exp->common.ctx;
+}
+
 /* Basic flow for negotiation
 
    Server         Client
@@ -474,6 +505,26 @@ nbd_check_meta_export(NBDClient *client, NBDExport *exp)
     }
 }
 
+/* Make @client a user of @exp once negotiation has settled on it. */
+static void nbd_client_attach_export(NBDClient *client, NBDExport *exp)
+{
+    client->exp = exp;
+    QTAILQ_INSERT_TAIL(&exp->clients, client, next);
+    blk_exp_ref(&exp->common);
+
+    if (exp->nr_iothreads) {
+        size_t i = exp->next_iothread++ % exp->nr_iothreads;
+
+        client->ctx = iothread_get_aio_context(exp->iothreads[i]);
+    }
+
+    /* MSG_ZEROCOPY needs the plain socket, TLS encrypts into a copy */
+    if (exp->zero_copy && client->ioc == QIO_CHANNEL(client->sioc)) {
+        client->zero_copy = qio_channel_socket_enable_zero_copy(client->sioc);
+    }
+    trace_nbd_client_attach_export(exp->name, client->ctx, client->zero_copy);
+}
+
 /* Send a reply to NBD_OPT_EXPORT_NAME.
  * Return -errno on error, 0 on success. */
 static coroutine_fn int
@@ -536,8 +587,7 @@ nbd_negotiate_handle_export_name(NBDClient *client, bool no_zeroes,
         return ret;
     }
 
-    QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
-    blk_exp_ref(&client->exp->common);
+    nbd_client_attach_export(client, client->exp);
 
     return 0;
 }
@@ -750,10 +800,8 @@ nbd_negotiate_handle_info(NBDClient *client, Error **errp)
     }
 
     if (client->opt == NBD_OPT_GO) {
-        client->exp = exp;
         client->check_align = check_align;
-        QTAILQ_INSERT_TAIL(&client->exp->clients, client, next);
-        blk_exp_ref(&client->exp->common);
+        nbd_client_attach_export(client, exp);
         rc = 1;
     }
     return rc;
@@ -1554,6 +1602,17 @@ static int coroutine_fn nbd_receive_request(NBDClient *client, NBDRequest *reque
 
 #define MAX_NBD_REQUESTS 16
 
+static void nbd_free_zero_copy_reqs(NBDZeroCopyReqs *reqs)
+{
+    NBDRequestData *req;
+
+    while ((req = QSIMPLEQ_FIRST(reqs))) {
+        QSIMPLEQ_REMOVE_HEAD(reqs, zero_copy_next);
+        qemu_vfree(req->data);
+        g_free(req);
+    }
+}
+
 /* Runs in export AioContext and main loop thread */
 void nbd_client_get(NBDClient *client)
 {
@@ -1580,6 +1639,7 @@ void nbd_client_put(NBDClient *client)
             QTAILQ_REMOVE(&client->exp->clients, client, next);
             blk_exp_unref(&client->exp->common);
         }
+        nbd_free_zero_copy_reqs(&client->zero_copy_reqs);
         g_free(client->contexts.bitmaps);
         qemu_mutex_destroy(&client->lock);
         g_free(client);
@@ -1653,10 +1713,16 @@ static void nbd_request_put(NBDRequestData *req)
 {
     NBDClient *client = req->client;
 
-    if (req->data) {
-        qemu_vfree(req->data);
+    if (req->zero_copy) {
+        /* Freed by nbd_co_flush_zero_copy() */
+        QSIMPLEQ_INSERT_TAIL(&client->zero_copy_reqs, req, zero_copy_next);
+        client->nr_zero_copy_reqs++;
+    } else {
+        if (req->data) {
+            qemu_vfree(req->data);
+        }
+        g_free(req);
     }
-    g_free(req);
 
     client->nb_requests--;
 
@@ -1727,7 +1793,7 @@ static void nbd_drained_end(void *opaque)
     }
 }
 
-/* Runs in export AioContext */
+/* Runs in client AioContext */
 static void nbd_wake_read_bh(void *opaque)
 {
     NBDClient *client = opaque;
@@ -1753,7 +1819,7 @@ static bool nbd_drained_poll(void *opaque)
                  * qio_channel_yield().
                  */
                 if (client->recv_coroutine != NULL && client->read_yielding) {
-                    aio_bh_schedule_oneshot(nbd_export_aio_context(client->exp),
+                    aio_bh_schedule_oneshot(nbd_client_aio_context(client),
                                             nbd_wake_read_bh, client);
                 }
 
@@ -1792,6 +1858,18 @@ static const BlockDevOps nbd_block_ops = {
     .drained_poll = nbd_drained_poll,
 };
 
+static void nbd_export_put_iothreads(NBDExport *exp)
+{
+    size_t i;
+
+    for (i = 0; i < exp->nr_iothreads; i++) {
+        object_unref(OBJECT(exp->iothreads[i]));
+    }
+    g_free(exp->iothreads);
+    exp->iothreads = NULL;
+    exp->nr_iothreads = 0;
+}
+
 static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
                              Error **errp)
 {
@@ -1803,6 +1881,7 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     uint64_t perm, shared_perm;
     bool readonly = !exp_args->writable;
     BlockDirtyBitmapOrStrList *bitmaps;
+    strList *iothreads;
     size_t i;
     int ret;
 
@@ -1931,6 +2010,21 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
     }
 
     exp->allocation_depth = arg->allocation_depth;
+    exp->zero_copy = arg->zero_copy;
+
+    for (iothreads = arg->iothreads; iothreads; iothreads = iothreads->next) {
+        IOThread *iothread = iothread_by_id(iothreads->value);
+
+        if (!iothread) {
+            ret = -EINVAL;
+            error_setg(errp, "iothread \"%s\" not found", iothreads->value);
+            goto fail_iothreads;
+        }
+        exp->iothreads = g_renew(IOThread *, exp->iothreads,
+                                 exp->nr_iothreads + 1);
+        exp->iothreads[exp->nr_iothreads++] = iothread;
+        object_ref(OBJECT(iothread));
+    }
 
     /*
      * We need to inhibit request queuing in the block layer to ensure we can
@@ -1949,6 +2043,11 @@ static int nbd_export_create(BlockExport *blk_exp, BlockExportOptions *exp_args,
 
     return 0;
 
+fail_iothreads:
+    nbd_export_put_iothreads(exp);
+    for (i = 0; i < exp->nr_export_bitmaps; i++) {
+        bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
+    }
 fail:
     bdrv_graph_rdunlock_main_loop();
     g_free(exp->export_bitmaps);
@@ -2021,6 +2120,8 @@ static void nbd_export_delete(BlockExport *blk_exp)
     for (i = 0; i < exp->nr_export_bitmaps; i++) {
         bdrv_dirty_bitmap_set_busy(exp->export_bitmaps[i], false);
     }
+
+    nbd_export_put_iothreads(exp);
 }
 
 const BlockExportDriver blk_exp_nbd = {
@@ -2048,6 +2149,88 @@ static int coroutine_fn nbd_co_send_iov(NBDClient *client, struct iovec *iov,
     return ret;
 }
 
+/*
+ * Release the requests whose data went out with MSG_ZEROCOPY, waiting for
+ * the kernel to let go of it first.  Called with send_lock held.
+ */
+static int coroutine_fn nbd_co_flush_zero_copy(NBDClient *client,
+                                               Error **errp)
+{
+    NBDZeroCopyReqs reqs = QSIMPLEQ_HEAD_INITIALIZER(reqs);
+    unsigned nr_reqs;
+
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        QSIMPLEQ_CONCAT(&reqs, &client->zero_copy_reqs);
+        nr_reqs = client->nr_zero_copy_reqs;
+        client->nr_zero_copy_reqs = 0;
+    }
+    if (!nr_reqs) {
+        return 0;
+    }
+
+    trace_nbd_co_flush_zero_copy(nr_reqs);
+    if (qio_channel_flush(client->ioc, errp) < 0) {
+        /* Keep the buffers, in order, until the client goes away */
+        WITH_QEMU_LOCK_GUARD(&client->lock) {
+            QSIMPLEQ_CONCAT(&reqs, &client->zero_copy_reqs);
+            QSIMPLEQ_CONCAT(&client->zero_copy_reqs, &reqs);
+            client->nr_zero_copy_reqs += nr_reqs;
+        }
+        return -EIO;
+    }
+
+    nbd_free_zero_copy_reqs(&reqs);
+    return 0;
+}
+
+/*
+ * Like nbd_co_send_iov(), where the last element of @iov is the data of a
+ * read reply.  If the client uses zero copy, that data is transmitted from
+ * the request buffer itself, which nbd_request_put() then keeps around.
+ */
+static int coroutine_fn nbd_co_send_iov_data(NBDClient *client,
+                                             struct iovec *iov, unsigned niov,
+                                             Error **errp)
+{
+    struct iovec *data = &iov[niov - 1];
+    bool flush;
+    int ret = 0;
+
+    if (!client->zero_copy || data->iov_len < NBD_ZERO_COPY_MIN) {
+        return nbd_co_send_iov(client, iov, niov, errp);
+    }
+
+    g_assert(qemu_in_coroutine());
+    qemu_co_mutex_lock(&client->send_lock);
+    client->send_coroutine = qemu_coroutine_self();
+
+    /*
+     * Bound the memory held by the kernel.  The oldest replies have most
+     * likely been acknowledged by now, so this rarely has to wait.
+     */
+    WITH_QEMU_LOCK_GUARD(&client->lock) {
+        flush = client->nr_zero_copy_reqs >= MAX_NBD_REQUESTS;
+    }
+    if (flush) {
+        ret = nbd_co_flush_zero_copy(client, errp);
+    }
+
+    /* The headers live on the stack and must be copied */
+    if (!ret && qio_channel_writev_all(client->ioc, iov, niov - 1, errp) < 0) {
+        ret = -EIO;
+    }
+    if (!ret && qio_channel_writev_full_all(client->ioc, data, 1, NULL, 0,
+                                            QIO_CHANNEL_WRITE_FLAG_ZERO_COPY,
+                                            errp) < 0) {
+        ret = -EIO;
+    }
+
+    client->send_coroutine = NULL;
+    qemu_co_mutex_unlock(&client->send_lock);
+
+    return ret;
+}
+
 static inline void set_be_simple_reply(NBDSimpleReply *reply, uint64_t error,
                                        uint64_t cookie)
 {
@@ -2079,7 +2262,7 @@ static int coroutine_fn nbd_co_send_simple_reply(NBDClient *client,
                                    nbd_err_lookup(nbd_err), len);
     set_be_simple_reply(&reply, nbd_err, request->cookie);
 
-    return nbd_co_send_iov(client, iov, 2, errp);
+    return nbd_co_send_iov_data(client, iov, 2, errp);
 }
 
 /*
@@ -2160,7 +2343,7 @@ static int coroutine_fn nbd_co_send_chunk_read(NBDClient *client,
                  NBD_REPLY_TYPE_OFFSET_DATA, request);
     stq_be_p(&chunk.offset, offset);
 
-    return nbd_co_send_iov(client, iov, 3, errp);
+    return nbd_co_send_iov_data(client, iov, 3, errp);
 }
 
 static int coroutine_fn nbd_co_send_chunk_error(NBDClient *client,
@@ -2766,6 +2949,9 @@ static int coroutine_fn nbd_co_receive_request(NBDRequestData *req,
             error_setg(errp, "No memory");
             return -ENOMEM;
         }
+        req->zero_copy = client->zero_copy &&
+                         request->type == NBD_CMD_READ &&
+                         request->len >= NBD_ZERO_COPY_MIN;
     }
     if (payload_len) {
         if (payload_okay) {
@@ -3190,7 +3376,8 @@ static void nbd_client_receive_next_request(NBDClient *client)
         nbd_client_get(client);
         req = nbd_request_get(client);
         client->recv_coroutine = qemu_coroutine_create(nbd_trip, req);
-        aio_co_schedule(client->exp->common.ctx, client->recv_coroutine);
+        aio_co_schedule(nbd_client_aio_context(client),
+                        client->recv_coroutine);
     }
 }
 
@@ -3259,6 +3446,7 @@ void nbd_client_new(QIOChannelSocket *sioc,
 
     client = g_new0(NBDClient, 1);
     qemu_mutex_init(&client->lock);
+    QSIMPLEQ_INIT(&client->zero_copy_reqs);
     client->refcount = 1;
     client->tlscreds = tlscreds;
     if (tlscreds) {
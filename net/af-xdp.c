@@ -52,20 +52,58 @@ typedef struct AFXDPState {
     uint32_t             n_queues;
     uint32_t             xdp_flags;
     bool                 inhibit;
+    bool                 busy_poll;
+
+    AioContext           *ctx; /* NULL: main loop */
 } AFXDPState;
 
 #define AF_XDP_BATCH_SIZE 64
 
+/* How long a busy-polling syscall may spin in the kernel, in microseconds */
+#define AF_XDP_BUSY_POLL_USECS 20
+
 static void af_xdp_send(void *opaque);
 static void af_xdp_writable(void *opaque);
 
+static AioContext *af_xdp_get_aio_context(AFXDPState *s)
+{
+    return s->ctx ?: iohandler_get_aio_context();
+}
+
+/*
+ * The io_poll() callback: are there received packets?  With busy polling,
+ * an empty ring makes the kernel run the NAPI poll of the queue in this
+ * thread, so the AioContext polling loop drives the device directly.
+ */
+static bool af_xdp_rx_poll(void *opaque)
+{
+    AFXDPState *s = opaque;
+    uint32_t idx;
+
+    if (xsk_ring_cons__peek(&s->rx, 1, &idx)) {
+        xsk_ring_cons__cancel(&s->rx, 1);
+        return true;
+    }
+
+    if (s->busy_poll) {
+        recvfrom(xsk_socket__fd(s->xsk), NULL, 0, MSG_DONTWAIT, NULL, NULL);
+        if (xsk_ring_cons__peek(&s->rx, 1, &idx)) {
+            xsk_ring_cons__cancel(&s->rx, 1);
+            return true;
+        }
+    }
+    return false;
+}
+
 /* Set the event-loop handlers for the af-xdp backend. */
 static void af_xdp_update_fd_handler(AFXDPState *s)
 {
-    qemu_set_fd_handler(xsk_socket__fd(s->xsk),
-                        s->read_poll ? af_xdp_send : NULL,
-                        s->write_poll ? af_xdp_writable : NULL,
-                        s);
+    aio_set_fd_handler(af_xdp_get_aio_context(s), xsk_socket__fd(s->xsk),
+                       s->read_poll ? af_xdp_send : NULL,
+                       s->write_poll ? af_xdp_writable : NULL,
+                       s->read_poll ? af_xdp_rx_poll : NULL,
+                       s->read_poll ? af_xdp_send : NULL,
+                       s);
 }
 
 /* Update the read handler. */
@@ -257,6 +295,16 @@ static void af_xdp_send(void *opaque)
     af_xdp_fq_refill(s, AF_XDP_BATCH_SIZE);
 }
 
+static void af_xdp_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    AFXDPState *s = DO_UPCAST(AFXDPState, nc, nc);
+
+    aio_set_fd_handler(af_xdp_get_aio_context(s), xsk_socket__fd(s->xsk),
+                       NULL, NULL, NULL, NULL, NULL);
+    s->ctx = ctx;
+    af_xdp_update_fd_handler(s);
+}
+
 /* Flush and close. */
 static void af_xdp_cleanup(NetClientState *nc)
 {
@@ -393,6 +441,26 @@ static int af_xdp_socket_create(AFXDPState *s,
 
     s->xdp_flags = cfg.xdp_flags;
 
+    if (opts->has_busy_poll_budget && opts->busy_poll_budget) {
+        int fd = xsk_socket__fd(s->xsk);
+        int prefer = 1;
+        int usecs = AF_XDP_BUSY_POLL_USECS;
+        int budget = opts->busy_poll_budget;
+
+        if (setsockopt(fd, SOL_SOCKET, SO_PREFER_BUSY_POLL,
+                       &prefer, sizeof(prefer)) ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL,
+                       &usecs, sizeof(usecs)) ||
+            setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL_BUDGET,
+                       &budget, sizeof(budget))) {
+            error_setg_errno(errp, errno,
+                             "failed to enable busy polling for %s "
+                             "queue_id: %d", s->ifname, queue_id);
+            return -1;
+        }
+        s->busy_poll = true;
+    }
+
     return 0;
 }
 
@@ -403,6 +471,7 @@ static NetClientInfo net_af_xdp_info = {
     .receive = af_xdp_receive,
     .poll = af_xdp_poll,
     .cleanup = af_xdp_cleanup,
+    .set_aio_context = af_xdp_set_aio_context,
 };
 
 static int *parse_socket_fds(const char *sock_fds_str,
@@ -465,6 +534,13 @@ int net_init_af_xdp(const Netdev *netdev,
         return -1;
     }
 
+    if (opts->has_busy_poll_budget &&
+        (opts->busy_poll_budget < 0 || opts->busy_poll_budget > UINT16_MAX)) {
+        error_setg(errp, "invalid busy-poll-budget (%" PRIi64 ") for '%s'",
+                   opts->busy_poll_budget, opts->ifname);
+        return -1;
+    }
+
     if ((opts->has_inhibit && opts->inhibit) != !!opts->sock_fds) {
         error_setg(errp, "'inhibit=on' requires 'sock-fds' and vice versa");
         return -1;
@@ -589,6 +589,25 @@ int qemu_set_vnet_be(NetClientState *nc, bool is_be)
 #endif
 }
 
+bool qemu_can_set_aio_context(NetClientState *nc)
+{
+    return nc && nc->info->set_aio_context;
+}
+
+/*
+ * Move the handlers of @nc to @ctx, or back to the main loop if @ctx is
+ * NULL.  From then on, @nc sends packets to its peer from @ctx and the
+ * caller must make sure that the peer receives them there.
+ *
+ * Must be called either from the thread that currently runs the handlers
+ * of @nc or with them quiesced.
+ */
+void qemu_set_aio_context(NetClientState *nc, AioContext *ctx)
+{
+    assert(qemu_can_set_aio_context(nc));
+    nc->info->set_aio_context(nc, ctx);
+}
+
 int qemu_can_receive_packet(NetClientState *nc)
 {
     if (nc->receive_disabled) {
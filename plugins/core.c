@@ -22,6 +22,8 @@
 #include "qemu/rcu_queue.h"
 #include "qemu/xxhash.h"
 #include "qemu/rcu.h"
+#include "qemu/notify.h"
+#include "qemu/thread.h"
 #include "hw/core/cpu.h"
 
 #include "exec/exec-all.h"
@@ -80,6 +82,9 @@ void plugin_unregister_cb__locked(struct qemu_plugin_ctx *ctx,
     g_free(cb);
     ctx->callbacks[ev] = NULL;
     if (QLIST_EMPTY_RCU(&plugin.cb_lists[ev])) {
+        if (ev == QEMU_PLUGIN_EV_DMA) {
+            qatomic_set(&plugin_dma_enabled, false);
+        }
         clear_bit(ev, plugin.mask);
         g_hash_table_foreach(plugin.cpu_ht, plugin_cpu_update__locked, NULL);
     }
@@ -640,8 +645,167 @@ void qemu_plugin_vcpu_mem_cb(CPUState *cpu, uint64_t vaddr,
     }
 }
 
+/*
+ * DMA accesses are recorded in a ring of the issuing thread, which only
+ * that thread fills and only the drain thread empties, so recording
+ * takes no lock. The drain thread runs every PLUGIN_DMA_DRAIN_MS, or
+ * as soon as a ring is half full; when a ring is full, accesses are
+ * counted as dropped instead of stalling the device.
+ */
+#define PLUGIN_DMA_RING_SIZE 1024
+#define PLUGIN_DMA_DRAIN_MS 10
+
+typedef struct PluginDMARing {
+    struct qemu_plugin_dma_access accesses[PLUGIN_DMA_RING_SIZE];
+    uint32_t head;          /* written by the owning thread */
+    uint32_t tail;          /* written by the drain thread */
+    uint32_t dropped;       /* written by the owning thread */
+    uint32_t reported;      /* dropped accesses already passed on */
+    bool orphan;            /* the owning thread has exited */
+    Notifier exit;
+    QLIST_ENTRY(PluginDMARing) entry;
+} PluginDMARing;
+
+static struct {
+    /* Protects @rings and serializes draining */
+    QemuMutex lock;
+    QLIST_HEAD(, PluginDMARing) rings;
+    QemuSemaphore wake;
+    QemuThread thread;
+    bool started;
+} plugin_dma;
+
+bool plugin_dma_enabled;
+static __thread PluginDMARing *plugin_dma_ring;
+
+static void plugin_dma_thread_exit(Notifier *n, void *data)
+{
+    PluginDMARing *ring = container_of(n, PluginDMARing, exit);
+
+    /* The drain thread frees the ring once it is empty. */
+    WITH_QEMU_LOCK_GUARD(&plugin_dma.lock) {
+        ring->orphan = true;
+    }
+    plugin_dma_ring = NULL;
+}
+
+static PluginDMARing *plugin_dma_ring_new(void)
+{
+    PluginDMARing *ring = g_new0(PluginDMARing, 1);
+
+    ring->exit.notify = plugin_dma_thread_exit;
+    qemu_thread_atexit_add(&ring->exit);
+    WITH_QEMU_LOCK_GUARD(&plugin_dma.lock) {
+        QLIST_INSERT_HEAD(&plugin_dma.rings, ring, entry);
+    }
+    plugin_dma_ring = ring;
+    return ring;
+}
+
+void qemu_plugin_dma_cb(uint16_t requester_id, uint64_t addr, uint64_t len,
+                        bool is_write)
+{
+    PluginDMARing *ring = plugin_dma_ring ?: plugin_dma_ring_new();
+    uint32_t head = ring->head;
+    uint32_t used = head - qatomic_load_acquire(&ring->tail);
+
+    if (used == PLUGIN_DMA_RING_SIZE) {
+        qatomic_set(&ring->dropped, ring->dropped + 1);
+        return;
+    }
+    ring->accesses[head % PLUGIN_DMA_RING_SIZE] =
+        (struct qemu_plugin_dma_access) {
+            .addr = addr,
+            .len = len,
+            .requester_id = requester_id,
+            .is_write = is_write,
+        };
+    qatomic_store_release(&ring->head, head + 1);
+    if (used + 1 == PLUGIN_DMA_RING_SIZE / 2) {
+        qemu_sem_post(&plugin_dma.wake);
+    }
+}
+
+/*
+ * Disable CFI checks.
+ * The callback function has been loaded from an external library so we do not
+ * have type information
+ */
+QEMU_DISABLE_CFI
+static void plugin_dma_deliver(const struct qemu_plugin_dma_access *accesses,
+                               size_t n, uint64_t dropped)
+{
+    struct qemu_plugin_cb *cb, *next;
+
+    QLIST_FOREACH_SAFE_RCU(cb, &plugin.cb_lists[QEMU_PLUGIN_EV_DMA], entry,
+                           next) {
+        qemu_plugin_dma_cb_t func = cb->f.dma;
+
+        func(cb->ctx->id, accesses, n, dropped, cb->udata);
+    }
+}
+
+static void plugin_dma_drain(void)
+{
+    PluginDMARing *ring, *next;
+
+    QEMU_LOCK_GUARD(&plugin_dma.lock);
+    WITH_RCU_READ_LOCK_GUARD() {
+        QLIST_FOREACH_SAFE(ring, &plugin_dma.rings, entry, next) {
+            uint32_t head = qatomic_load_acquire(&ring->head);
+            uint32_t dropped = qatomic_read(&ring->dropped);
+            uint32_t tail = ring->tail;
+
+            while (tail != head || dropped != ring->reported) {
+                uint32_t start = tail % PLUGIN_DMA_RING_SIZE;
+                uint32_t n = MIN(head - tail, PLUGIN_DMA_RING_SIZE - start);
+
+                plugin_dma_deliver(&ring->accesses[start], n,
+                                   dropped - ring->reported);
+                ring->reported = dropped;
+                tail += n;
+            }
+            qatomic_store_release(&ring->tail, tail);
+            if (ring->orphan) {
+                QLIST_REMOVE(ring, entry);
+                g_free(ring);
+            }
+        }
+    }
+}
+
+static void *plugin_dma_thread(void *opaque)
+{
+    rcu_register_thread();
+    while (true) {
+        qemu_sem_timedwait(&plugin_dma.wake, PLUGIN_DMA_DRAIN_MS);
+        plugin_dma_drain();
+    }
+    return NULL;
+}
+
+void qemu_plugin_register_dma_cb(qemu_plugin_id_t id,
+                                 qemu_plugin_dma_cb_t cb, void *udata)
+{
+    plugin_register_cb_udata(id, QEMU_PLUGIN_EV_DMA, cb, udata);
+
+    QEMU_LOCK_GUARD(&plugin.lock);
+    if (!cb || QLIST_EMPTY_RCU(&plugin.cb_lists[QEMU_PLUGIN_EV_DMA])) {
+        return;
+    }
+    if (!plugin_dma.started) {
+        plugin_dma.started = true;
+        qemu_thread_create(&plugin_dma.thread, "plugin-dma",
+                           plugin_dma_thread, NULL, QEMU_THREAD_DETACHED);
+    }
+    qatomic_set(&plugin_dma_enabled, true);
+}
+
 void qemu_plugin_atexit_cb(void)
 {
+    if (plugin_dma.started) {
+        plugin_dma_drain();
+    }
     plugin_cb__udata(QEMU_PLUGIN_EV_ATEXIT);
 }
 
@@ -737,6 +901,9 @@ static void __attribute__((__constructor__)) plugin_init(void)
     QTAILQ_INIT(&plugin.ctxs);
     qht_init(&plugin.dyn_cb_arr_ht, plugin_dyn_cb_arr_cmp, 16,
              QHT_MODE_AUTO_RESIZE);
+    qemu_mutex_init(&plugin_dma.lock);
+    QLIST_INIT(&plugin_dma.rings);
+    qemu_sem_init(&plugin_dma.wake, 0);
     atexit(qemu_plugin_atexit_cb);
 }
 
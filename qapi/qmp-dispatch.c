@@ -16,6 +16,7 @@
 #include "block/aio.h"
 #include "qapi/compat-policy.h"
 #include "qapi/error.h"
+#include "qapi/json-output-visitor.h"
 #include "qapi/qmp/dispatch.h"
 #include "qapi/qmp/qdict.h"
 #include "qapi/qmp/qjson.h"
@@ -41,6 +42,14 @@ Visitor *qobject_output_visitor_new_qmp(QObject **result)
     return v;
 }
 
+Visitor *json_output_visitor_new_qmp(GString **result)
+{
+    Visitor *v = json_output_visitor_new(result);
+
+    visit_set_policy(v, &compat_policy);
+    return v;
+}
+
 static QDict *qmp_dispatch_check_obj(QDict *dict, bool allow_oob,
                                      Error **errp)
 {
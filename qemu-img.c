@@ -218,6 +218,8 @@ void help(void)
            "Parameters to compare subcommand:\n"
            "  '-f' first image format\n"
            "  '-F' second image format\n"
+           "  '-m' specifies how many coroutines work in parallel during the compare\n"
+           "       process (defaults to 8)\n"
            "  '-s' run in Strict mode - fail on different image size or sector allocation\n"
            "\n"
            "Parameters to dd subcommand:\n"
@@ -1309,43 +1311,229 @@ static int compare_buffers(const uint8_t *buf1, const uint8_t *buf2,
 }
 
 #define IO_BUF_SIZE (2 * MiB)
+#define MAX_COROUTINES 16
+
+typedef struct CompareState {
+    BlockBackend *blk[2];
+    const char *filename[2];
+    int64_t size[2];
+    int64_t total_size;         /* size of the smaller image */
+    int64_t progress_base;      /* size of the larger image */
+    bool strict;
+    long num_coroutines;
+    int running_coroutines;
+
+    /* protects the fields below */
+    CoMutex lock;
+    int64_t offset;             /* next offset to look at */
+    int64_t bytes_read;
+
+    /*
+     * Coroutines can find differences and errors in any order, only the
+     * one at the lowest offset is reported so that the output is the
+     * same as with a sequential comparison.
+     */
+    int64_t fail_offset;
+    int ret;
+    char *fail_msg;
+} CompareState;
+
+typedef struct CompareJob {
+    int64_t offset;
+    int64_t bytes;
+    /* image whose data must be zero, -1 to compare both, -2 to skip */
+    int image;
+} CompareJob;
+
+static void compare_fail(CompareState *s, int64_t offset, int ret, char *msg)
+{
+    if (offset < s->fail_offset) {
+        s->fail_offset = offset;
+        s->ret = ret;
+        g_free(s->fail_msg);
+        s->fail_msg = msg;
+    } else {
+        g_free(msg);
+    }
+}
+
+static void compare_progress(CompareState *s, int64_t bytes)
+{
+    qemu_progress_print(((float) bytes / s->progress_base) * 100, 100);
+}
 
 /*
- * Check if passed sectors are empty (not allocated or contain only 0 bytes)
- *
- * Intended for use by 'qemu-img compare': Returns 0 in case sectors are
- * filled with 0, 1 if sectors contain non-zero data (this is a comparison
- * failure), and 4 on error (the exit status for read errors), after emitting
- * an error message.
- *
- * @param blk:  BlockBackend for the image
- * @param offset: Starting offset to check
- * @param bytes: Number of bytes to check
- * @param filename: Name of disk file we are checking (logging purpose)
- * @param buffer: Allocated buffer for storing read data
- * @param quiet: Flag for quiet mode
+ * Find the next range whose data has to be read, skipping the extents that
+ * block status already shows to be equal.  Called with s->lock held.
+ * Returns false once the whole image has been handed out or a failure has
+ * been found before the current offset.
  */
-static int check_empty_sectors(BlockBackend *blk, int64_t offset,
-                               int64_t bytes, const char *filename,
-                               uint8_t *buffer, bool quiet)
+static bool coroutine_fn GRAPH_RDLOCK
+compare_next_job(CompareState *s, CompareJob *job)
+{
+    while (s->offset < s->fail_offset) {
+        int64_t offset = s->offset;
+        int64_t pnum[2], chunk;
+        int status[2];
+        int i;
+
+        if (offset < s->total_size) {
+            for (i = 0; i < 2; i++) {
+                status[i] = bdrv_co_block_status_above(
+                    blk_bs(s->blk[i]), NULL, offset,
+                    s->size[i] - offset, &pnum[i], NULL, NULL);
+                if (status[i] < 0) {
+                    compare_fail(s, offset, 3,
+                                 g_strdup_printf("Sector allocation test "
+                                                 "failed for %s",
+                                                 s->filename[i]));
+                    return false;
+                }
+            }
+            assert(pnum[0] && pnum[1]);
+            chunk = MIN(pnum[0], pnum[1]);
+
+            if (s->strict && status[0] != status[1]) {
+                compare_fail(s, offset, 1,
+                             g_strdup_printf("Strict mode: Offset %" PRId64
+                                             " block status mismatch!\n",
+                                             offset));
+                return false;
+            }
+
+            if ((status[0] & BDRV_BLOCK_ZERO) &&
+                (status[1] & BDRV_BLOCK_ZERO)) {
+                job->image = -2;
+            } else if ((status[0] & BDRV_BLOCK_ALLOCATED) ==
+                       (status[1] & BDRV_BLOCK_ALLOCATED)) {
+                job->image = status[0] & BDRV_BLOCK_ALLOCATED ? -1 : -2;
+            } else {
+                job->image = status[0] & BDRV_BLOCK_ALLOCATED ? 0 : 1;
+            }
+        } else if (offset < s->progress_base) {
+            /* Past the end of the smaller image, the rest must be zero */
+            i = s->size[0] > s->size[1] ? 0 : 1;
+            status[i] = bdrv_co_block_status_above(blk_bs(s->blk[i]), NULL,
+                                                   offset,
+                                                   s->progress_base - offset,
+                                                   &chunk, NULL, NULL);
+            if (status[i] < 0) {
+                compare_fail(s, offset, 3,
+                             g_strdup_printf("Sector allocation test "
+                                             "failed for %s", s->filename[i]));
+                return false;
+            }
+            if ((status[i] & BDRV_BLOCK_ALLOCATED) &&
+                !(status[i] & BDRV_BLOCK_ZERO)) {
+                job->image = i;
+            } else {
+                job->image = -2;
+            }
+        } else {
+            return false;
+        }
+
+        if (job->image == -2) {
+            /* Nothing to read */
+            s->offset += chunk;
+            compare_progress(s, chunk);
+            continue;
+        }
+
+        job->offset = offset;
+        job->bytes = MIN(chunk, IO_BUF_SIZE);
+        s->offset += job->bytes;
+        return true;
+    }
+
+    return false;
+}
+
+/* Returns 0 if the job's data is equal, 1 if it differs and 4 on error */
+static int coroutine_fn compare_co_job(CompareState *s, CompareJob *job,
+                                       uint8_t *buf[2], int64_t *fail_offset,
+                                       char **msg)
 {
-    int ret = 0;
     int64_t idx;
+    int ret, i;
 
-    ret = blk_pread(blk, offset, bytes, buffer, 0);
-    if (ret < 0) {
-        error_report("Error while reading offset %" PRId64 " of %s: %s",
-                     offset, filename, strerror(-ret));
-        return 4;
-    }
-    idx = find_nonzero(buffer, bytes);
-    if (idx >= 0) {
-        qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                offset + idx);
-        return 1;
+    for (i = 0; i < 2; i++) {
+        if (job->image >= 0 && job->image != i) {
+            continue;
+        }
+        ret = blk_co_pread(s->blk[i], job->offset, job->bytes, buf[i], 0);
+        if (ret < 0) {
+            *fail_offset = job->offset;
+            *msg = g_strdup_printf("Error while reading offset %" PRId64
+                                   " of %s: %s", job->offset,
+                                   s->filename[i], strerror(-ret));
+            return 4;
+        }
     }
 
-    return 0;
+    if (job->image >= 0) {
+        idx = find_nonzero(buf[job->image], job->bytes);
+        if (idx < 0) {
+            return 0;
+        }
+    } else {
+        ret = compare_buffers(buf[0], buf[1], job->bytes, 0, &idx);
+        if (!ret && idx == job->bytes) {
+            return 0;
+        }
+        if (ret) {
+            idx = 0;
+        }
+    }
+
+    *fail_offset = job->offset + idx;
+    *msg = g_strdup_printf("Content mismatch at offset %" PRId64 "!\n",
+                           *fail_offset);
+    return 1;
+}
+
+static void coroutine_fn compare_co_do_compare(void *opaque)
+{
+    CompareState *s = opaque;
+    uint8_t *buf[2];
+    CompareJob job;
+    int i;
+
+    s->running_coroutines++;
+    for (i = 0; i < 2; i++) {
+        buf[i] = blk_blockalign(s->blk[i], IO_BUF_SIZE);
+    }
+
+    while (1) {
+        int64_t fail_offset;
+        char *msg;
+        bool found;
+        int ret;
+
+        qemu_co_mutex_lock(&s->lock);
+        WITH_GRAPH_RDLOCK_GUARD() {
+            found = compare_next_job(s, &job);
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        if (!found) {
+            break;
+        }
+
+        ret = compare_co_job(s, &job, buf, &fail_offset, &msg);
+
+        qemu_co_mutex_lock(&s->lock);
+        s->bytes_read += job.image >= 0 ? job.bytes : 2 * job.bytes;
+        if (ret) {
+            compare_fail(s, fail_offset, ret, msg);
+        }
+        qemu_co_mutex_unlock(&s->lock);
+        compare_progress(s, job.bytes);
+    }
+
+    for (i = 0; i < 2; i++) {
+        qemu_vfree(buf[i]);
+    }
+    s->running_coroutines--;
 }
 
 /*
@@ -1359,20 +1547,16 @@ static int img_compare(int argc, char **argv)
 {
     const char *fmt1 = NULL, *fmt2 = NULL, *cache, *filename1, *filename2;
     BlockBackend *blk1, *blk2;
-    BlockDriverState *bs1, *bs2;
-    int64_t total_size1, total_size2;
-    uint8_t *buf1 = NULL, *buf2 = NULL;
-    int64_t pnum1, pnum2;
-    int allocated1, allocated2;
+    CompareState s = {
+        .num_coroutines = 8,
+        .fail_offset    = INT64_MAX,
+    };
     int ret = 0; /* return value - 0 Ident, 1 Different, >1 Error */
     bool progress = false, quiet = false, strict = false;
     int flags;
     bool writethrough;
-    int64_t total_size;
-    int64_t offset = 0;
-    int64_t chunk;
-    int c;
-    uint64_t progress_base;
+    int c, i;
+    int64_t start_time = 0, elapsed = 0;
     bool image_opts = false;
     bool force_share = false;
 
@@ -1385,7 +1569,7 @@ static int img_compare(int argc, char **argv)
             {"force-share", no_argument, 0, 'U'},
             {0, 0, 0, 0}
         };
-        c = getopt_long(argc, argv, ":hf:F:T:pqsU",
+        c = getopt_long(argc, argv, ":hf:F:T:m:pqsU",
                         long_options, NULL);
         if (c == -1) {
             break;
@@ -1409,6 +1593,14 @@ static int img_compare(int argc, char **argv)
         case 'T':
             cache = optarg;
             break;
+        case 'm':
+            if (qemu_strtol(optarg, NULL, 0, &s.num_coroutines) ||
+                s.num_coroutines < 1 || s.num_coroutines > MAX_COROUTINES) {
+                error_report("Invalid number of coroutines. Allowed number of"
+                             " coroutines is between 1 and %d", MAX_COROUTINES);
+                return 2;
+            }
+            break;
         case 'p':
             progress = true;
             break;
@@ -1478,166 +1670,78 @@ static int img_compare(int argc, char **argv)
         ret = 2;
         goto out2;
     }
-    bs1 = blk_bs(blk1);
-    bs2 = blk_bs(blk2);
 
-    buf1 = blk_blockalign(blk1, IO_BUF_SIZE);
-    buf2 = blk_blockalign(blk2, IO_BUF_SIZE);
-    total_size1 = blk_getlength(blk1);
-    if (total_size1 < 0) {
-        error_report("Can't get size of %s: %s",
-                     filename1, strerror(-total_size1));
-        ret = 4;
-        goto out;
-    }
-    total_size2 = blk_getlength(blk2);
-    if (total_size2 < 0) {
-        error_report("Can't get size of %s: %s",
-                     filename2, strerror(-total_size2));
-        ret = 4;
-        goto out;
+    s.blk[0] = blk1;
+    s.blk[1] = blk2;
+    s.filename[0] = filename1;
+    s.filename[1] = filename2;
+    s.strict = strict;
+    for (i = 0; i < 2; i++) {
+        s.size[i] = blk_getlength(s.blk[i]);
+        if (s.size[i] < 0) {
+            error_report("Can't get size of %s: %s",
+                         s.filename[i], strerror(-s.size[i]));
+            ret = 4;
+            goto out;
+        }
     }
-    total_size = MIN(total_size1, total_size2);
-    progress_base = MAX(total_size1, total_size2);
+    s.total_size = MIN(s.size[0], s.size[1]);
+    s.progress_base = MAX(s.size[0], s.size[1]);
 
     qemu_progress_print(0, 100);
 
-    if (strict && total_size1 != total_size2) {
+    if (strict && s.size[0] != s.size[1]) {
         ret = 1;
         qprintf(quiet, "Strict mode: Image size mismatch!\n");
         goto out;
     }
 
-    while (offset < total_size) {
-        int status1, status2;
-
-        status1 = bdrv_block_status_above(bs1, NULL, offset,
-                                          total_size1 - offset, &pnum1, NULL,
-                                          NULL);
-        if (status1 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename1);
-            goto out;
-        }
-        allocated1 = status1 & BDRV_BLOCK_ALLOCATED;
-
-        status2 = bdrv_block_status_above(bs2, NULL, offset,
-                                          total_size2 - offset, &pnum2, NULL,
-                                          NULL);
-        if (status2 < 0) {
-            ret = 3;
-            error_report("Sector allocation test failed for %s", filename2);
-            goto out;
-        }
-        allocated2 = status2 & BDRV_BLOCK_ALLOCATED;
-
-        assert(pnum1 && pnum2);
-        chunk = MIN(pnum1, pnum2);
-
-        if (strict) {
-            if (status1 != status2) {
-                ret = 1;
-                qprintf(quiet, "Strict mode: Offset %" PRId64
-                        " block status mismatch!\n", offset);
-                goto out;
-            }
-        }
-        if ((status1 & BDRV_BLOCK_ZERO) && (status2 & BDRV_BLOCK_ZERO)) {
-            /* nothing to do */
-        } else if (allocated1 == allocated2) {
-            if (allocated1) {
-                int64_t pnum;
-
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = blk_pread(blk1, offset, chunk, buf1, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename1, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = blk_pread(blk2, offset, chunk, buf2, 0);
-                if (ret < 0) {
-                    error_report("Error while reading offset %" PRId64
-                                 " of %s: %s",
-                                 offset, filename2, strerror(-ret));
-                    ret = 4;
-                    goto out;
-                }
-                ret = compare_buffers(buf1, buf2, chunk, 0, &pnum);
-                if (ret || pnum != chunk) {
-                    qprintf(quiet, "Content mismatch at offset %" PRId64 "!\n",
-                            offset + (ret ? 0 : pnum));
-                    ret = 1;
-                    goto out;
-                }
-            }
-        } else {
-            chunk = MIN(chunk, IO_BUF_SIZE);
-            if (allocated1) {
-                ret = check_empty_sectors(blk1, offset, chunk,
-                                          filename1, buf1, quiet);
-            } else {
-                ret = check_empty_sectors(blk2, offset, chunk,
-                                          filename2, buf1, quiet);
-            }
-            if (ret) {
-                goto out;
-            }
-        }
-        offset += chunk;
-        qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    start_time = g_get_monotonic_time();
+    qemu_co_mutex_init(&s.lock);
+    for (i = 0; i < s.num_coroutines; i++) {
+        Coroutine *co = qemu_coroutine_create(compare_co_do_compare, &s);
+        qemu_coroutine_enter(co);
     }
+    while (s.running_coroutines) {
+        main_loop_wait(false);
+    }
+    elapsed = g_get_monotonic_time() - start_time;
 
-    if (total_size1 != total_size2) {
-        BlockBackend *blk_over;
-        const char *filename_over;
-
+    if (s.size[0] != s.size[1] &&
+        s.fail_offset >= s.total_size) {
         qprintf(quiet, "Warning: Image size mismatch!\n");
-        if (total_size1 > total_size2) {
-            blk_over = blk1;
-            filename_over = filename1;
-        } else {
-            blk_over = blk2;
-            filename_over = filename2;
-        }
-
-        while (offset < progress_base) {
-            ret = bdrv_block_status_above(blk_bs(blk_over), NULL, offset,
-                                          progress_base - offset, &chunk,
-                                          NULL, NULL);
-            if (ret < 0) {
-                ret = 3;
-                error_report("Sector allocation test failed for %s",
-                             filename_over);
-                goto out;
+    }
 
-            }
-            if (ret & BDRV_BLOCK_ALLOCATED && !(ret & BDRV_BLOCK_ZERO)) {
-                chunk = MIN(chunk, IO_BUF_SIZE);
-                ret = check_empty_sectors(blk_over, offset, chunk,
-                                          filename_over, buf1, quiet);
-                if (ret) {
-                    goto out;
-                }
-            }
-            offset += chunk;
-            qemu_progress_print(((float) chunk / progress_base) * 100, 100);
+    if (s.fail_msg) {
+        ret = s.ret;
+        if (ret == 1) {
+            qprintf(quiet, "%s", s.fail_msg);
+        } else {
+            error_report("%s", s.fail_msg);
         }
+        goto out;
     }
 
     qprintf(quiet, "Images are identical.\n");
     ret = 0;
 
 out:
-    qemu_vfree(buf1);
-    qemu_vfree(buf2);
+    g_free(s.fail_msg);
     blk_unref(blk2);
 out2:
     blk_unref(blk1);
 out3:
     qemu_progress_end();
+    if (progress && elapsed > 0) {
+        g_autofree char *compared = size_to_str(MIN(s.offset,
+                                                    s.progress_base));
+        g_autofree char *read = size_to_str(s.bytes_read);
+
+        printf("Compared %s in %.2f seconds (%.1f MiB/s), read %s\n",
+               compared, (double)elapsed / G_USEC_PER_SEC,
+               (double)MIN(s.offset, s.progress_base) / MiB /
+               ((double)elapsed / G_USEC_PER_SEC), read);
+    }
     return ret;
 }
 
@@ -1664,7 +1768,6 @@ enum ImgConvertBlockStatus {
     BLK_BACKING_FILE,
 };
 
-#define MAX_COROUTINES 16
 #define CONVERT_THROTTLE_GROUP "img_convert"
 
 typedef struct ImgConvertState {
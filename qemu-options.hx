@@ -187,7 +187,11 @@ DEF("accel", HAS_ARG, QEMU_OPTION_accel,
     "                one-insn-per-tb=on|off (one guest instruction per TCG translation block)\n"
     "                split-wx=on|off (enable TCG split w^x mapping)\n"
     "                tb-size=n (TCG translation block cache size)\n"
+    "                tlb-prefetch=on|off (fill TCG TLB entries ahead of streaming loads, default off)\n"
+    "                jmp-cache-bits=n (log2 of TCG jump cache entries per vCPU, default 12)\n"
     "                dirty-ring-size=n (KVM dirty ring GFN count, default 0)\n"
+    "                dirty-ring-reapers=n (threads collecting the KVM dirty rings, default 0, one per 32 vCPUs)\n"
+    "                dirty-rate-estimate=on|off (keep dirty logging on to estimate dirty rates, default off)\n"
     "                eager-split-size=n (KVM Eager Page Split chunk size, default 0, disabled. ARM only)\n"
     "                notify-vmexit=run|internal-error|disable,notify-window=n (enable notify VM exit and set notify window, x86 only)\n"
     "                thread=single|multi (enable multi-threaded TCG)\n"
@@ -230,6 +234,21 @@ SRST
     ``tb-size=n``
         Controls the size (in MiB) of the TCG translation block cache.
 
+    ``jmp-cache-bits=n``
+        Controls the size of the per-vCPU cache that maps guest program
+        counters to translation blocks, as log2 of the number of
+        entries, between 8 and 20. The default is 12. Guests whose hot
+        code spans many pages may benefit from a larger cache; the hit
+        rate is reported by ``info jit``.
+
+    ``tlb-prefetch=on|off``
+        When guest loads miss the TCG softmmu TLB on consecutive pages,
+        also fill the TLB entry of the following page, so that streaming
+        code such as memory copies takes fewer TLB misses. This walks the
+        guest page tables ahead of the accesses, like the speculative
+        walks of real hardware. The default is off. The number of TLB
+        fills and prefetches is reported by ``info jit``.
+
     ``thread=single|multi``
         Controls number of TCG threads. When the TCG is multi-threaded
         there will be one thread per vCPU therefore taking advantage of
@@ -248,6 +267,24 @@ SRST
         is disabled (dirty-ring-size=0).  When enabled, KVM will instead
         record dirty pages in a bitmap.
 
+    ``dirty-ring-reapers=n``
+        Number of threads that collect the dirty rings, each of them
+        taking care of an equal share of the vCPUs.  Every thread polls
+        its rings more often while they fill up quickly, and reports how
+        long it takes with ``query-stats`` (provider ``dirty-ring``),
+        together with the number of times vCPUs stopped because their
+        ring was full.  The default, 0, starts one thread per 32 vCPUs.
+
+    ``dirty-rate-estimate=on|off``
+        With the KVM dirty ring, QEMU estimates how many pages each vCPU
+        and each RAM block dirty per second from the pages it collects,
+        and reports the rates with ``query-stats`` (provider
+        ``dirty-ring``).  Pages are only collected while dirty logging is
+        enabled, e.g. during migration.  Enabling this option keeps dirty
+        logging enabled all the time, so that the rates are always known,
+        at the price of the dirty logging overhead.  Requires
+        ``dirty-ring-size``.  By default, this option is disabled.
+
     ``eager-split-size=n``
         KVM implements dirty page logging at the PAGE_SIZE granularity and
         enabling dirty-logging on a huge-page requires breaking it into
@@ -2553,6 +2590,13 @@ SRST
         bandwidth when playing videos. Disabling adaptive encodings
         restores the original static behavior of encodings like Tight.
 
+    ``workers=n``
+        Encode framebuffer updates with n threads, so that several
+        clients are served in parallel; the updates of each client
+        are still encoded one at a time and sent in order. The
+        threads are shared by all VNC displays, which use as many as
+        the largest value asked for. The default is 1.
+
     ``share=[allow-exclusive|force-shared|ignore]``
         Set display sharing policy. 'allow-exclusive' allows clients to
         ask for exclusive access. As suggested by the rfb spec this is
@@ -2863,6 +2907,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
 #ifdef CONFIG_AF_XDP
     "-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off]\n"
     "         [,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]\n"
+    "         [,busy-poll-budget=b]\n"
     "                attach to the existing network interface 'name' with AF_XDP socket\n"
     "                use 'mode=MODE' to specify an XDP program attach mode\n"
     "                use 'force-copy=on|off' to force XDP copy mode even if device supports zero-copy (default: off)\n"
@@ -2872,6 +2917,7 @@ DEF("netdev", HAS_ARG, QEMU_OPTION_netdev,
     "                  added to a socket map in XDP program.  One socket per queue.\n"
     "                use 'queues=n' to specify how many queues of a multiqueue interface should be used\n"
     "                use 'start-queue=m' to specify the first queue that should be used\n"
+    "                use 'busy-poll-budget=b' to busy poll the sockets, b packets at a time\n"
 #endif
 #ifdef CONFIG_POSIX
     "-netdev vhost-user,id=str,chardev=dev[,vhostforce=on|off]\n"
@@ -3564,7 +3610,7 @@ SRST
         # launch QEMU instance
         |qemu_system| linux.img -nic vde,sock=/tmp/myswitch
 
-``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z]``
+``-netdev af-xdp,id=str,ifname=name[,mode=native|skb][,force-copy=on|off][,queues=n][,start-queue=m][,inhibit=on|off][,sock-fds=x:y:...:z][,busy-poll-budget=b]``
     Configure AF_XDP backend to connect to a network interface 'name'
     using AF_XDP socket.  A specific program attach mode for a default
     XDP program can be forced with 'mode', defaults to best-effort,
@@ -3613,6 +3659,22 @@ SRST
         |qemu_system| linux.img -device virtio-net-pci,netdev=n1 \\
             -netdev af-xdp,id=n1,ifname=eth0,queues=3,inhibit=on,sock-fds=15:16:17
 
+    With 'busy-poll-budget', the kernel processes the packets of a queue
+    when QEMU polls its socket rather than from device interrupts.  This
+    pays off when the queues run in IOThreads with polling enabled, which
+    then poll the device directly.
+
+    .. parsed-literal::
+
+        # defer device interrupts while busy polling
+        echo 2 > /sys/class/net/eth0/napi_defer_hard_irqs
+        echo 200000 > /sys/class/net/eth0/gro_flush_timeout
+        # launch QEMU instance
+        |qemu_system| linux.img -object iothread,id=io0,poll-max-ns=50000 \\
+            -device '{"driver":"virtio-net-pci","netdev":"n1",
+                      "iothread-vq-mapping":[{"iothread":"io0"}]}' \\
+            -netdev af-xdp,id=n1,ifname=eth0,busy-poll-budget=64
+
 ``-netdev vhost-user,chardev=id[,vhostforce=on|off][,queues=n]``
     Establish a vhost-user netdev, backed by a chardev id. The chardev
     should be a unix domain socket backed one. The vhost-user uses a
@@ -3680,9 +3742,12 @@ DEF("chardev", HAS_ARG, QEMU_OPTION_chardev,
     "-chardev null,id=id[,mux=on|off][,logfile=PATH][,logappend=on|off]\n"
     "-chardev socket,id=id[,host=host],port=port[,to=to][,ipv4=on|off][,ipv6=on|off][,nodelay=on|off]\n"
     "         [,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect-ms=milliseconds][,mux=on|off]\n"
-    "         [,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID] (tcp)\n"
+    "         [,recv-buffer=size][,logfile=PATH][,logappend=on|off][,tls-creds=ID][,tls-authz=ID] (tcp)\n"
     "-chardev socket,id=id,path=path[,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect-ms=milliseconds]\n"
-    "         [,mux=on|off][,logfile=PATH][,logappend=on|off][,abstract=on|off][,tight=on|off] (unix)\n"
+    "         [,recv-buffer=size][,mux=on|off][,logfile=PATH][,logappend=on|off][,abstract=on|off][,tight=on|off]\n"
+    "         [,seqpacket=on|off] (unix)\n"
+    "-chardev socket,id=id,cid=cid,port=port[,server=on|off][,wait=on|off][,reconnect-ms=milliseconds]\n"
+    "         [,recv-buffer=size][,seqpacket=on|off][,mux=on|off][,logfile=PATH][,logappend=on|off] (vsock)\n"
     "-chardev udp,id=id[,host=host],port=port[,localaddr=localaddr]\n"
     "         [,localport=localport][,ipv4=on|off][,ipv6=on|off][,mux=on|off]\n"
     "         [,logfile=PATH][,logappend=on|off]\n"
@@ -3786,13 +3851,18 @@ The general form of a character device option is:
     ``logappend`` option controls whether the log file will be truncated
     or appended to when opened.
 
+    Backends that can change their main loop context, such as socket,
+    file and pipe, also take an ``iothread`` option. It names an
+    IOThread that front ends able to run the chardev outside the main
+    loop use instead of the main loop. Other front ends ignore it.
+
 The available backends are:
 
 ``-chardev null,id=id``
     A void device. This device will not emit any data, and will drop any
     data it receives. The null backend does not take any options.
 
-``-chardev socket,id=id[,TCP options or unix options][,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect-ms=milliseconds][,tls-creds=id][,tls-authz=id]``
+``-chardev socket,id=id[,TCP options or unix options or vsock options][,server=on|off][,wait=on|off][,telnet=on|off][,websocket=on|off][,reconnect-ms=milliseconds][,recv-buffer=size][,tls-creds=id][,tls-authz=id]``
     Create a two-way stream socket, which can be either a TCP or a unix
     socket. A unix socket will be created if ``path`` is specified.
     Behaviour is undefined if TCP options are specified for a unix
@@ -3814,6 +3884,10 @@ The available backends are:
     milliseconds and then attempt to reconnect. Zero disables reconnecting,
     and is the default.
 
+    ``recv-buffer`` bounds the receive buffer. It starts at 4 KiB and
+    doubles whenever a read fills it, so bulk inbound traffic is taken
+    in fewer, larger reads. The default is 4 KiB.
+
     ``tls-creds`` requests enablement of the TLS protocol for
     encryption, and specifies the id of the TLS credentials to use for
     the handshake. The credentials must be previously created with the
@@ -3849,13 +3923,21 @@ The available backends are:
 
         ``nodelay=on|off`` disables the Nagle algorithm.
 
-    ``unix options: path=path[,abstract=on|off][,tight=on|off]``
+    ``unix options: path=path[,abstract=on|off][,tight=on|off][,seqpacket=on|off]``
         ``path`` specifies the local path of the unix socket. ``path``
         is required.
         ``abstract=on|off`` specifies the use of the abstract socket namespace,
         rather than the filesystem.  Optional, defaults to false.
         ``tight=on|off`` sets the socket length of abstract sockets to their minimum,
         rather than the full sun_path length.  Optional, defaults to true.
+        ``seqpacket=on|off`` uses a SOCK_SEQPACKET socket, which keeps
+        message boundaries. Front ends that support it receive each
+        message whole; messages larger than ``recv-buffer`` (64 KiB by
+        default) are truncated. Optional, defaults to false.
+
+    ``vsock options: cid=cid,port=port[,seqpacket=on|off]``
+        ``cid`` and ``port`` specify the vsock address to listen on or
+        connect to. ``seqpacket`` is as for unix sockets.
 
 ``-chardev udp,id=id[,host=host],port=port[,localaddr=localaddr][,localport=localport][,ipv4=on|off][,ipv6=on|off]``
     Sends all traffic from the guest to a remote host over UDP.
@@ -5239,6 +5321,18 @@ SRST
     Generate a dump file for Linux perf tools that maps basic blocks to symbol
     names, line numbers and JITted code.
 ERST
+
+DEF("perf-threshold", HAS_ARG, QEMU_OPTION_perf_threshold,
+    "-perf-threshold count\n"
+    "                add blocks to the perf files once executed count times\n",
+    QEMU_ARCH_ALL)
+SRST
+``-perf-threshold count``
+    With ``-perfmap`` or ``-jitdump``, leave out basic blocks until they
+    have been executed ``count`` times.  Every block then spends a few
+    host instructions counting its executions, in exchange cold code needs
+    no symbol lookups and takes no space in the files.
+ERST
 #endif
 
 DEFHEADING()
@@ -5298,6 +5392,14 @@ SRST
 
         The ``prealloc`` boolean option enables memory preallocation.
 
+        The ``prealloc-background`` boolean option lets the guest start
+        while memory is still being preallocated by ``prealloc-threads``
+        threads, created in ``prealloc-context`` if given.  Memory the
+        guest touches before its turn comes is allocated right away, so
+        startup time no longer grows with the size of the backend, but a
+        lack of memory may still crash the guest until preallocation is
+        complete.
+
         The ``host-nodes`` option binds the memory range to a list of
         NUMA host nodes.
 
@@ -5529,6 +5631,13 @@ SRST
         string as described at
         https://gnutls.org/manual/html_node/Priority-Strings.html.
 
+        With ``ktls=on``, available for all ``tls-creds`` objects, the
+        encryption of outgoing data is handed over to the Linux kernel
+        once the handshake is complete, if the connection is a TCP socket
+        and uses AES-GCM. This saves copies and CPU time on bulk
+        transfers like migration. QEMU keeps encrypting on its own if
+        the kernel or the session does not support it.
+
     ``-object tls-cipher-suites,id=id,priority=priority``
         Creates a TLS cipher suites object, which can be used to control
         the TLS cipher/protocol algorithms that applications are permitted
@@ -5991,7 +6100,7 @@ SRST
 
             CN=laptop.example.com,O=Example Home,L=London,ST=London,C=GB
 
-    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch``
+    ``-object iothread,id=id,poll-max-ns=poll-max-ns,poll-grow=poll-grow,poll-shrink=poll-shrink,aio-max-batch=aio-max-batch,coroutine-stack-size=size``
         Creates a dedicated event loop thread that devices can be
         assigned to. This is known as an IOThread. By default device
         emulation happens in vCPU threads or the main event loop thread.
@@ -6011,7 +6120,10 @@ SRST
         latency. Instead of entering a blocking system call to monitor
         file descriptors and then pay the cost of being woken up when an
         event occurs, the polling algorithm spins waiting for events for
-        a short time. The algorithm's default parameters are suitable
+        a short time. Each event source has its own polling time, so
+        that sources which polling rarely catches do not waste CPU time
+        or shorten the polling of busy ones; ``query-iothreads`` reports
+        them. The algorithm's default parameters are suitable
         for many cases but can be adjusted based on knowledge of the
         workload and/or host device latency.
 
@@ -6031,13 +6143,32 @@ SRST
         in a batch for the AIO engine, 0 means that the engine will use
         its default.
 
-        The IOThread parameters can be modified at run-time using the
+        The ``coroutine-stack-size`` parameter is the stack size of the
+        coroutines that the IOThread creates. The default of 1 MiB is
+        chosen for the deepest call chains; smaller stacks save memory
+        when many requests are in flight. It cannot be changed at
+        run-time.
+
+        The other IOThread parameters can be modified at run-time using the
         ``qom-set`` command (where ``iothread1`` is the IOThread's
         ``id``):
 
         ::
 
             (qemu) qom-set /objects/iothread1 poll-max-ns 100000
+
+    ``-object stats-shm,id=id,path=path[,size=size][,interval=ms]``
+        Publishes the statistics that the ``query-stats`` QMP command
+        returns in the file ``path``, usually in ``/dev/shm``, every
+        ``interval`` milliseconds (default 1000). Monitoring agents can
+        map the file and read the statistics without going through QMP.
+        The file begins with a header that includes a sequence counter,
+        which is odd while an update is in progress. The layout is
+        described in ``include/sysemu/stats-shm.h``.
+
+        ``size`` is the size of the file (default 1 MiB). Statistics that
+        do not fit are left out, and a flag in the header says so. The
+        ``interval`` can be changed at run-time with ``qom-set``.
 ERST
 
 
@@ -60,6 +60,16 @@ GuestFileHandle *guest_file_handle_find(int64_t id, Error **errp);
 GuestFileRead *guest_file_read_unsafe(GuestFileHandle *gfh,
                                       int64_t count, Error **errp);
 
+/*
+ * Read up to @count bytes into @buf, returning the number of bytes read,
+ * 0 at EOF, or -1 setting @errp on error.
+ */
+int64_t guest_file_read_raw(GuestFileHandle *gfh, void *buf, size_t count,
+                            Error **errp);
+/* Write @count bytes from @buf, returning 0, or -1 setting @errp on error */
+int guest_file_write_raw(GuestFileHandle *gfh, const void *buf, size_t count,
+                         Error **errp);
+
 /**
  * qga_get_host_name:
  * @errp: Error object
@@ -577,6 +577,55 @@ GuestFileRead *guest_file_read_unsafe(GuestFileHandle *gfh,
     return read_data;
 }
 
+int64_t guest_file_read_raw(GuestFileHandle *gfh, void *buf, size_t count,
+                            Error **errp)
+{
+    FILE *fh = gfh->fh;
+    size_t read_count;
+
+    /* explicitly flush when switching from writing to reading */
+    if (gfh->state == RW_STATE_WRITING) {
+        if (fflush(fh) == EOF) {
+            error_setg_errno(errp, errno, "failed to flush file");
+            return -1;
+        }
+        gfh->state = RW_STATE_NEW;
+    }
+
+    read_count = fread(buf, 1, count, fh);
+    if (ferror(fh)) {
+        error_setg_errno(errp, errno, "failed to read file");
+        clearerr(fh);
+        return -1;
+    }
+    clearerr(fh);
+    gfh->state = RW_STATE_READING;
+    return read_count;
+}
+
+int guest_file_write_raw(GuestFileHandle *gfh, const void *buf, size_t count,
+                         Error **errp)
+{
+    FILE *fh = gfh->fh;
+
+    if (gfh->state == RW_STATE_READING) {
+        if (fseek(fh, 0, SEEK_CUR) == -1) {
+            error_setg_errno(errp, errno, "failed to seek file");
+            return -1;
+        }
+        gfh->state = RW_STATE_NEW;
+    }
+
+    fwrite(buf, 1, count, fh);
+    if (ferror(fh)) {
+        error_setg_errno(errp, errno, "failed to write to file");
+        clearerr(fh);
+        return -1;
+    }
+    gfh->state = RW_STATE_WRITING;
+    return 0;
+}
+
 GuestFileWrite *qmp_guest_file_write(int64_t handle, const char *buf_b64,
                                      bool has_count, int64_t count,
                                      Error **errp)
@@ -371,6 +371,30 @@ GuestFileRead *guest_file_read_unsafe(GuestFileHandle *gfh,
     return read_data;
 }
 
+int64_t guest_file_read_raw(GuestFileHandle *gfh, void *buf, size_t count,
+                            Error **errp)
+{
+    DWORD read_count;
+
+    if (!ReadFile(gfh->fh, buf, count, &read_count, NULL)) {
+        error_setg_win32(errp, GetLastError(), "failed to read file");
+        return -1;
+    }
+    return read_count;
+}
+
+int guest_file_write_raw(GuestFileHandle *gfh, const void *buf, size_t count,
+                         Error **errp)
+{
+    DWORD write_count;
+
+    if (!WriteFile(gfh->fh, buf, count, &write_count, NULL)) {
+        error_setg_win32(errp, GetLastError(), "failed to write to file");
+        return -1;
+    }
+    return 0;
+}
+
 GuestFileWrite *qmp_guest_file_write(int64_t handle, const char *buf_b64,
                                      bool has_count, int64_t count,
                                      Error **errp)
@@ -15,7 +15,9 @@
 #include "guest-agent-core.h"
 #include "qga-qapi-commands.h"
 #include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
 #include "qemu/base64.h"
+#include "qemu/bswap.h"
 #include "qemu/cutils.h"
 #include "commands-common.h"
 
@@ -30,6 +32,11 @@
  */
 #define GUEST_FILE_READ_COUNT_MAX (48 * MiB)
 
+/* Chunks of guest-file-read-raw data, and their special lengths */
+#define GUEST_FILE_RAW_CHUNK_SIZE (64 * KiB)
+#define GUEST_FILE_RAW_END        0
+#define GUEST_FILE_RAW_ERROR      0xffffffff
+
 /* Note: in some situations, like with the fsfreeze, logging may be
  * temporarily disabled. if it is necessary that a command be able
  * to log for accounting purposes, check ga_logging_enabled() beforehand.
@@ -630,6 +637,172 @@ GuestFileRead *qmp_guest_file_read(int64_t handle, bool has_count,
     return read_data;
 }
 
+/*
+ * A guest-file-read-raw or guest-file-write-raw data phase.  No command
+ * runs until it is over, so @gfh can't go away meanwhile.
+ */
+struct GARawTransfer {
+    GuestFileHandle *gfh;
+    int64_t handle;
+    bool write;
+    int64_t left;           /* reads: bytes left to send, -1 for all */
+    uint8_t hdr[4];         /* writes: chunk length received so far */
+    size_t hdr_len;
+    uint32_t chunk_left;    /* writes: bytes left in the current chunk */
+    int64_t count;          /* writes: bytes written */
+    Error *err;             /* writes: first error */
+};
+
+void qmp_guest_file_read_raw(int64_t handle, bool has_count, int64_t count,
+                             Error **errp)
+{
+    GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
+    GARawTransfer *xfer;
+
+    if (!gfh) {
+        return;
+    }
+    if (has_count && count < 0) {
+        error_setg(errp, "value '%" PRId64 "' is invalid for argument count",
+                   count);
+        return;
+    }
+
+    xfer = g_new0(GARawTransfer, 1);
+    xfer->gfh = gfh;
+    xfer->handle = handle;
+    xfer->left = has_count ? count : -1;
+    ga_set_raw_transfer(ga_state, xfer);
+}
+
+void qmp_guest_file_write_raw(int64_t handle, Error **errp)
+{
+    GuestFileHandle *gfh = guest_file_handle_find(handle, errp);
+    GARawTransfer *xfer;
+
+    if (!gfh) {
+        return;
+    }
+
+    xfer = g_new0(GARawTransfer, 1);
+    xfer->gfh = gfh;
+    xfer->handle = handle;
+    xfer->write = true;
+    ga_set_raw_transfer(ga_state, xfer);
+}
+
+static void ga_raw_transfer_send_file(GAState *s, GARawTransfer *xfer)
+{
+    g_autofree uint8_t *buf = g_malloc(4 + GUEST_FILE_RAW_CHUNK_SIZE);
+    Error *err = NULL;
+    int64_t len;
+
+    while (xfer->left) {
+        len = GUEST_FILE_RAW_CHUNK_SIZE;
+        if (xfer->left > 0) {
+            len = MIN(len, xfer->left);
+        }
+        len = guest_file_read_raw(xfer->gfh, buf + 4, len, &err);
+        if (len <= 0) {
+            break;
+        }
+        stl_be_p(buf, len);
+        if (ga_send_raw(s, buf, 4 + len) != G_IO_STATUS_NORMAL) {
+            return;
+        }
+        if (xfer->left > 0) {
+            xfer->left -= len;
+        }
+    }
+
+    if (err) {
+        slog("guest-file-read-raw failed, handle: %" PRId64 ": %s",
+             xfer->handle, error_get_pretty(err));
+        error_free(err);
+        stl_be_p(buf, GUEST_FILE_RAW_ERROR);
+    } else {
+        stl_be_p(buf, GUEST_FILE_RAW_END);
+    }
+    ga_send_raw(s, buf, 4);
+}
+
+/*
+ * Start the data phase of @xfer once the command's response is sent.
+ * Return true if the agent must now feed the data it receives to
+ * ga_raw_transfer_feed(), else @xfer is done and freed.
+ */
+bool ga_raw_transfer_start(GAState *s, GARawTransfer *xfer)
+{
+    if (xfer->write) {
+        return true;
+    }
+    ga_raw_transfer_send_file(s, xfer);
+    ga_raw_transfer_free(xfer);
+    return false;
+}
+
+/*
+ * Write the data in @buf to the file, and return how much of @buf
+ * belonged to the data phase.  Set @done once the data phase is over.
+ */
+size_t ga_raw_transfer_feed(GARawTransfer *xfer, const uint8_t *buf,
+                            size_t len, bool *done)
+{
+    size_t used = 0, n;
+
+    *done = false;
+    while (used < len) {
+        if (xfer->chunk_left) {
+            n = MIN(xfer->chunk_left, len - used);
+            if (!xfer->err &&
+                !guest_file_write_raw(xfer->gfh, buf + used, n, &xfer->err)) {
+                xfer->count += n;
+            }
+            xfer->chunk_left -= n;
+            used += n;
+            continue;
+        }
+
+        xfer->hdr[xfer->hdr_len++] = buf[used++];
+        if (xfer->hdr_len < sizeof(xfer->hdr)) {
+            continue;
+        }
+        xfer->hdr_len = 0;
+        xfer->chunk_left = ldl_be_p(xfer->hdr);
+        if (xfer->chunk_left == GUEST_FILE_RAW_END) {
+            *done = true;
+            break;
+        }
+    }
+    return used;
+}
+
+/* Free @xfer, returning the response to send for it */
+QDict *ga_raw_transfer_finish(GARawTransfer *xfer)
+{
+    QDict *rsp, *ret;
+
+    if (xfer->err) {
+        slog("guest-file-write-raw failed, handle: %" PRId64, xfer->handle);
+        rsp = qmp_error_response(xfer->err);
+        xfer->err = NULL;
+    } else {
+        ret = qdict_new();
+        qdict_put_int(ret, "count", xfer->count);
+        qdict_put_bool(ret, "eof", false);
+        rsp = qdict_new();
+        qdict_put(rsp, "return", ret);
+    }
+    ga_raw_transfer_free(xfer);
+    return rsp;
+}
+
+void ga_raw_transfer_free(GARawTransfer *xfer)
+{
+    error_free(xfer->err);
+    g_free(xfer);
+}
+
 int64_t qmp_guest_get_time(Error **errp)
 {
     return g_get_real_time() * 1000;
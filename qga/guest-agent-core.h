@@ -20,6 +20,7 @@
 
 typedef struct GAState GAState;
 typedef struct GACommandState GACommandState;
+typedef struct GARawTransfer GARawTransfer;
 
 extern GAState *ga_state;
 extern QmpCommandList ga_commands;
@@ -38,6 +39,13 @@ void ga_disable_logging(GAState *s);
 void ga_enable_logging(GAState *s);
 void G_GNUC_PRINTF(1, 2) slog(const gchar *fmt, ...);
 void ga_set_response_delimited(GAState *s);
+void ga_set_raw_transfer(GAState *s, GARawTransfer *xfer);
+GIOStatus ga_send_raw(GAState *s, const void *buf, size_t len);
+bool ga_raw_transfer_start(GAState *s, GARawTransfer *xfer);
+size_t ga_raw_transfer_feed(GARawTransfer *xfer, const uint8_t *buf,
+                            size_t len, bool *done);
+QDict *ga_raw_transfer_finish(GARawTransfer *xfer);
+void ga_raw_transfer_free(GARawTransfer *xfer);
 bool ga_is_frozen(GAState *s);
 void ga_set_frozen(GAState *s);
 void ga_unset_frozen(GAState *s);
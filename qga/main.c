@@ -107,6 +107,7 @@ struct GAState {
     HANDLE event_log;
 #endif
     bool delimit_response;
+    GARawTransfer *raw_transfer;
     bool frozen;
     GList *blockedrpcs;
     GList *allowedrpcs;
@@ -405,6 +406,27 @@ void ga_set_response_delimited(GAState *s)
     s->delimit_response = true;
 }
 
+/* Set the data phase to run after the response of the current command */
+void ga_set_raw_transfer(GAState *s, GARawTransfer *xfer)
+{
+    g_assert(!s->raw_transfer);
+    s->raw_transfer = xfer;
+}
+
+GIOStatus ga_send_raw(GAState *s, const void *buf, size_t len)
+{
+    g_assert(s->channel);
+    return ga_channel_write_all(s->channel, buf, len);
+}
+
+static void ga_cancel_raw_transfer(GAState *s)
+{
+    if (s->raw_transfer) {
+        ga_raw_transfer_free(s->raw_transfer);
+        s->raw_transfer = NULL;
+    }
+}
+
 static FILE *ga_open_logfile(const char *logfile)
 {
     FILE *f;
@@ -680,9 +702,36 @@ end:
     ret = send_response(s, rsp);
     if (ret < 0) {
         g_warning("error sending error response: %s", strerror(-ret));
+        ga_cancel_raw_transfer(s);
     }
     qobject_unref(rsp);
     qobject_unref(obj);
+
+    if (s->raw_transfer && !ga_raw_transfer_start(s, s->raw_transfer)) {
+        s->raw_transfer = NULL;
+    }
+}
+
+/* feed data received during a guest-file-write-raw data phase */
+static gsize process_raw_data(GAState *s, const gchar *buf, gsize count)
+{
+    QDict *rsp;
+    gsize used;
+    bool done;
+    int ret;
+
+    used = ga_raw_transfer_feed(s->raw_transfer, (const uint8_t *)buf, count,
+                                &done);
+    if (done) {
+        rsp = ga_raw_transfer_finish(s->raw_transfer);
+        s->raw_transfer = NULL;
+        ret = send_response(s, rsp);
+        if (ret < 0) {
+            g_warning("error sending response: %s", strerror(-ret));
+        }
+        qobject_unref(rsp);
+    }
+    return used;
 }
 
 /* false return signals GAChannel to close the current client connection */
@@ -690,7 +739,7 @@ static gboolean channel_event_cb(GIOCondition condition, gpointer data)
 {
     GAState *s = data;
     gchar buf[QGA_READ_COUNT_DEFAULT + 1];
-    gsize count;
+    gsize count, used = 0;
     GIOStatus status = ga_channel_read(s->channel, buf, QGA_READ_COUNT_DEFAULT, &count);
     switch (status) {
     case G_IO_STATUS_ERROR:
@@ -698,12 +747,20 @@ static gboolean channel_event_cb(GIOCondition condition, gpointer data)
         stop_agent(s, false);
         return false;
     case G_IO_STATUS_NORMAL:
-        buf[count] = 0;
-        g_debug("read data, count: %d, data: %s", (int)count, buf);
-        json_message_parser_feed(&s->parser, (char *)buf, (int)count);
+        if (s->raw_transfer) {
+            used = process_raw_data(s, buf, count);
+        }
+        if (used < count) {
+            buf[count] = 0;
+            g_debug("read data, count: %d, data: %s", (int)(count - used),
+                    buf + used);
+            json_message_parser_feed(&s->parser, buf + used,
+                                     (int)(count - used));
+        }
         break;
     case G_IO_STATUS_EOF:
         g_debug("received EOF");
+        ga_cancel_raw_transfer(s);
         if (!s->virtio) {
             return false;
         }
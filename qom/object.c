@@ -339,6 +339,63 @@ static void object_property_free(gpointer data)
     g_free(prop);
 }
 
+/*
+ * Class properties are looked up a lot when creating objects, and walking
+ * the class hierarchy costs one hash lookup per level.  Once a class is
+ * initialized, collect the properties of its parents and its own in
+ * all_properties so that a single lookup is enough.  Its parents are
+ * always initialized before it.
+ */
+static void object_class_flatten_properties(ObjectClass *klass)
+{
+    ObjectClass *parent = object_class_get_parent(klass);
+    GHashTableIter iter;
+    gpointer key, value;
+
+    klass->all_properties = g_hash_table_new(g_str_hash, g_str_equal);
+    if (parent) {
+        g_hash_table_iter_init(&iter, parent->all_properties);
+        while (g_hash_table_iter_next(&iter, &key, &value)) {
+            g_hash_table_insert(klass->all_properties, key, value);
+        }
+    }
+    g_hash_table_iter_init(&iter, klass->properties);
+    while (g_hash_table_iter_next(&iter, &key, &value)) {
+        g_hash_table_insert(klass->all_properties, key, value);
+    }
+}
+
+static void object_class_add_flat_property(ObjectClass *klass,
+                                           ObjectClass *owner,
+                                           ObjectProperty *prop)
+{
+    if (klass->all_properties &&
+        type_is_ancestor(klass->type, owner->type)) {
+        g_hash_table_insert(klass->all_properties, prop->name, prop);
+    }
+}
+
+typedef struct FlatPropertyData {
+    ObjectClass *owner;
+    ObjectProperty *prop;
+} FlatPropertyData;
+
+static void object_class_add_flat_property_tramp(gpointer key, gpointer value,
+                                                 gpointer opaque)
+{
+    TypeImpl *ti = value;
+    FlatPropertyData *data = opaque;
+    GSList *e;
+
+    if (!ti->class) {
+        return;
+    }
+    object_class_add_flat_property(ti->class, data->owner, data->prop);
+    for (e = ti->class->interfaces; e; e = e->next) {
+        object_class_add_flat_property(e->data, data->owner, data->prop);
+    }
+}
+
 static void type_initialize(TypeImpl *ti)
 {
     TypeImpl *parent;
@@ -376,6 +433,7 @@ static void type_initialize(TypeImpl *ti)
         g_assert(parent->instance_size <= ti->instance_size);
         memcpy(ti->class, parent->class, parent->class_size);
         ti->class->interfaces = NULL;
+        ti->class->all_properties = NULL;
 
         for (e = parent->class->interfaces; e; e = e->next) {
             InterfaceClass *iface = e->data;
@@ -422,6 +480,8 @@ static void type_initialize(TypeImpl *ti)
     if (ti->class_init) {
         ti->class_init(ti->class, ti->class_data);
     }
+
+    object_class_flatten_properties(ti->class);
 }
 
 static void object_init_with_type(Object *obj, TypeImpl *ti)
@@ -1325,6 +1385,17 @@ object_class_property_add(ObjectClass *klass,
 
     g_hash_table_insert(klass->properties, prop->name, prop);
 
+    /*
+     * Properties are normally added by class_init, before the class is
+     * flattened.  If the class is in use already, so may be subclasses.
+     */
+    if (klass->all_properties) {
+        FlatPropertyData data = { klass, prop };
+
+        g_hash_table_foreach(type_table_get(),
+                             object_class_add_flat_property_tramp, &data);
+    }
+
     return prop;
 }
 
@@ -1383,6 +1454,10 @@ ObjectProperty *object_class_property_find(ObjectClass *klass, const char *name)
 {
     ObjectClass *parent_klass;
 
+    if (klass->all_properties) {
+        return g_hash_table_lookup(klass->all_properties, name);
+    }
+
     parent_klass = object_class_get_parent(klass);
     if (parent_klass) {
         ObjectProperty *prop =
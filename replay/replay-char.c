@@ -93,6 +93,115 @@ void *replay_event_char_read_load(void)
     return event;
 }
 
+/*
+ * Character frontends whose input should be saved into the log.
+ * Unlike the drivers above, their output is not synchronized.
+ */
+struct ReplayCharFe {
+    IOReadHandler *fd_read;
+    ReplayCharFeEventFunc *fd_event;
+    void *opaque;
+    int id;
+};
+
+static ReplayCharFe **char_frontends;
+static int frontends_count;
+
+/* Frontend input attributes, @event is -1 for data. */
+typedef struct CharFeEvent {
+    int id;
+    int event;
+    uint8_t *buf;
+    size_t len;
+} CharFeEvent;
+
+ReplayCharFe *replay_register_char_fe(IOReadHandler *fd_read,
+                                      ReplayCharFeEventFunc *fd_event,
+                                      void *opaque)
+{
+    ReplayCharFe *rcf = g_new0(ReplayCharFe, 1);
+
+    rcf->fd_read = fd_read;
+    rcf->fd_event = fd_event;
+    rcf->opaque = opaque;
+    rcf->id = frontends_count++;
+    char_frontends = g_renew(ReplayCharFe *, char_frontends, frontends_count);
+    char_frontends[rcf->id] = rcf;
+    return rcf;
+}
+
+void replay_unregister_char_fe(ReplayCharFe *rcf)
+{
+    char_frontends[rcf->id] = NULL;
+    g_free(rcf);
+}
+
+void replay_char_fe_read(ReplayCharFe *rcf, const uint8_t *buf, int len)
+{
+    CharFeEvent *event = g_new0(CharFeEvent, 1);
+
+    event->id = rcf->id;
+    event->event = -1;
+    event->buf = g_memdup2(buf, len);
+    event->len = len;
+
+    replay_add_event(REPLAY_ASYNC_EVENT_CHAR_FE, event, NULL, 0);
+}
+
+void replay_char_fe_event(ReplayCharFe *rcf, int chr_event)
+{
+    CharFeEvent *event = g_new0(CharFeEvent, 1);
+
+    assert(chr_event >= 0);
+    event->id = rcf->id;
+    event->event = chr_event;
+
+    replay_add_event(REPLAY_ASYNC_EVENT_CHAR_FE, event, NULL, 0);
+}
+
+void replay_event_char_fe_run(void *opaque)
+{
+    CharFeEvent *event = opaque;
+    ReplayCharFe *rcf;
+
+    assert(event->id < frontends_count);
+    rcf = char_frontends[event->id];
+    if (!rcf) {
+        /* The frontend went away, e.g. the device was unplugged */
+    } else if (event->event < 0) {
+        rcf->fd_read(rcf->opaque, event->buf, (int)event->len);
+    } else {
+        rcf->fd_event(rcf->opaque, event->event);
+    }
+
+    g_free(event->buf);
+    g_free(event);
+}
+
+void replay_event_char_fe_save(void *opaque)
+{
+    CharFeEvent *event = opaque;
+
+    replay_put_byte(event->id);
+    replay_put_dword(event->event);
+    if (event->event < 0) {
+        replay_put_array(event->buf, event->len);
+    }
+}
+
+void *replay_event_char_fe_load(void)
+{
+    CharFeEvent *event = g_new0(CharFeEvent, 1);
+
+    event->id = replay_get_byte();
+    event->event = (int32_t)replay_get_dword();
+    if (event->event < 0) {
+        replay_get_array_alloc(&event->buf, &event->len);
+    }
+
+    return event;
+}
+
 void replay_char_write_event_save(int res, int offset)
 {
     g_assert(replay_mutex_locked());
@@ -56,6 +56,9 @@ static void replay_run_event(Event *event)
     case REPLAY_ASYNC_EVENT_NET:
         replay_event_net_run(event->opaque);
         break;
+    case REPLAY_ASYNC_EVENT_CHAR_FE:
+        replay_event_char_fe_run(event->opaque);
+        break;
     default:
         error_report("Replay: invalid async event ID (%d) in the queue",
                     event->event_kind);
@@ -188,6 +191,9 @@ static void replay_save_event(Event *event)
         case REPLAY_ASYNC_EVENT_NET:
             replay_event_net_save(event->opaque);
             break;
+        case REPLAY_ASYNC_EVENT_CHAR_FE:
+            replay_event_char_fe_save(event->opaque);
+            break;
         default:
             error_report("Unknown ID %" PRId64 " of replay event", event->id);
             exit(1);
@@ -246,6 +252,11 @@ static Event *replay_read_event(void)
         event->event_kind = event_kind;
         event->opaque = replay_event_net_load();
         return event;
+    case REPLAY_ASYNC_EVENT_CHAR_FE:
+        event = g_new0(Event, 1);
+        event->event_kind = event_kind;
+        event->opaque = replay_event_char_fe_load();
+        return event;
     default:
         error_report("Unknown ID %d of replay event", event_kind);
         exit(1);
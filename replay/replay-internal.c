@@ -15,6 +15,9 @@
 #include "replay-internal.h"
 #include "qemu/error-report.h"
 #include "qemu/main-loop.h"
+#include "qemu/bswap.h"
+#include "qemu/units.h"
+#include <zlib.h>
 
 /* Mutex to protect reading and writing events to the log.
    data_kind and has_unread_data are also protected
@@ -30,6 +33,32 @@ static unsigned long mutex_head, mutex_tail;
 static bool write_error;
 FILE *replay_file;
 
+/*
+ * The events are not written to the file one by one, but collected in
+ * blocks of up to REPLAY_BLOCK_SIZE bytes that are compressed as a
+ * whole.  Offsets into the replay log, such as the ones kept in
+ * snapshots, count the uncompressed bytes.
+ */
+#define REPLAY_BLOCK_SIZE           (64 * KiB)
+/* Size of the raw and compressed length in front of each block */
+#define REPLAY_BLOCK_HEADER_SIZE    (2 * sizeof(uint32_t))
+
+typedef struct ReplayBlock {
+    uint64_t offset;        /* Offset of the block's first byte in the log */
+    uint64_t file_offset;   /* Offset of the block header in the file */
+} ReplayBlock;
+
+static struct {
+    uint8_t *buf;           /* Contents of the current block */
+    uint8_t *zbuf;          /* Compressed contents of the current block */
+    size_t len;             /* Size of the current block */
+    size_t pos;             /* Read position in the current block */
+    uint64_t offset;        /* Offset of the current block in the log */
+    unsigned block;         /* Index of the current block when replaying */
+    GArray *index;          /* ReplayBlock of every block in the file */
+    bool eof;
+} replay_log;
+
 static void replay_write_error(void)
 {
     if (!write_error) {
@@ -44,12 +73,260 @@ static void replay_read_error(void)
     exit(1);
 }
 
+static void replay_log_alloc(void)
+{
+    replay_log.buf = g_malloc(REPLAY_BLOCK_SIZE);
+    replay_log.zbuf = g_malloc(compressBound(REPLAY_BLOCK_SIZE));
+    replay_log.index = g_array_new(false, false, sizeof(ReplayBlock));
+    replay_log.len = replay_log.pos = 0;
+    replay_log.offset = 0;
+    replay_log.block = 0;
+    replay_log.eof = false;
+}
+
+static void replay_log_free(void)
+{
+    g_free(replay_log.buf);
+    g_free(replay_log.zbuf);
+    g_array_free(replay_log.index, true);
+    memset(&replay_log, 0, sizeof(replay_log));
+}
+
+static void replay_log_write(const void *buf, size_t size)
+{
+    if (fwrite(buf, 1, size, replay_file) != size) {
+        replay_write_error();
+    }
+}
+
+/* Compress the current block and write it out */
+static void replay_log_flush_block(void)
+{
+    ReplayBlock block;
+    uLongf zlen = compressBound(REPLAY_BLOCK_SIZE);
+    uint8_t header[REPLAY_BLOCK_HEADER_SIZE];
+    const uint8_t *data = replay_log.zbuf;
+
+    if (!replay_log.len) {
+        return;
+    }
+    block.offset = replay_log.offset;
+    block.file_offset = ftell(replay_file);
+
+    /* Keep the block as it is if it does not get any smaller */
+    if (compress2(replay_log.zbuf, &zlen, replay_log.buf, replay_log.len,
+                  Z_BEST_SPEED) != Z_OK || zlen >= replay_log.len) {
+        zlen = replay_log.len;
+        data = replay_log.buf;
+    }
+
+    stl_be_p(header, replay_log.len);
+    stl_be_p(header + sizeof(uint32_t), zlen);
+    replay_log_write(header, sizeof(header));
+    replay_log_write(data, zlen);
+
+    g_array_append_val(replay_log.index, block);
+    replay_log.offset += replay_log.len;
+    replay_log.len = 0;
+}
+
+/* Read block number @n of the index, false if there is none */
+static bool replay_log_load_block(unsigned n)
+{
+    ReplayBlock *block;
+    uint8_t header[REPLAY_BLOCK_HEADER_SIZE];
+    uint32_t len, zlen;
+    uLongf dlen;
+
+    if (n >= replay_log.index->len) {
+        return false;
+    }
+    block = &g_array_index(replay_log.index, ReplayBlock, n);
+
+    if (fseek(replay_file, block->file_offset, SEEK_SET) ||
+        fread(header, 1, sizeof(header), replay_file) != sizeof(header)) {
+        replay_read_error();
+    }
+    len = ldl_be_p(header);
+    zlen = ldl_be_p(header + sizeof(uint32_t));
+    if (len > REPLAY_BLOCK_SIZE || zlen > len) {
+        error_report("Replay: corrupted block at offset %" PRIu64,
+                     block->file_offset);
+        exit(1);
+    }
+
+    if (zlen == len) {
+        if (fread(replay_log.buf, 1, len, replay_file) != len) {
+            replay_read_error();
+        }
+    } else {
+        dlen = len;
+        if (fread(replay_log.zbuf, 1, zlen, replay_file) != zlen ||
+            uncompress(replay_log.buf, &dlen, replay_log.zbuf,
+                       zlen) != Z_OK || dlen != len) {
+            replay_read_error();
+        }
+    }
+
+    replay_log.block = n;
+    replay_log.offset = block->offset;
+    replay_log.len = len;
+    replay_log.pos = 0;
+    return true;
+}
+
+/* Make sure there is something left to read in the current block */
+static void replay_log_fill(void)
+{
+    while (replay_log.pos == replay_log.len) {
+        if (!replay_log_load_block(replay_log.block + 1)) {
+            replay_log.eof = true;
+            replay_read_error();
+        }
+    }
+}
+
+/* Rebuild the index of a log that was not closed properly */
+static void replay_log_scan(uint64_t file_offset)
+{
+    ReplayBlock block = { .offset = 0, .file_offset = file_offset };
+    uint8_t header[REPLAY_BLOCK_HEADER_SIZE];
+
+    while (!fseek(replay_file, block.file_offset, SEEK_SET) &&
+           fread(header, 1, sizeof(header), replay_file) == sizeof(header)) {
+        g_array_append_val(replay_log.index, block);
+        block.offset += ldl_be_p(header);
+        block.file_offset += sizeof(header) +
+                             ldl_be_p(header + sizeof(uint32_t));
+    }
+}
+
+static bool replay_log_read_index(uint64_t index_offset)
+{
+    uint8_t buf[2 * sizeof(uint64_t)];
+    uint32_t count;
+
+    if (fseek(replay_file, index_offset, SEEK_SET) ||
+        fread(buf, 1, sizeof(uint32_t), replay_file) != sizeof(uint32_t)) {
+        return false;
+    }
+    count = ldl_be_p(buf);
+    for (uint32_t i = 0; i < count; i++) {
+        ReplayBlock block;
+
+        if (fread(buf, 1, sizeof(buf), replay_file) != sizeof(buf)) {
+            return false;
+        }
+        block.offset = ldq_be_p(buf);
+        block.file_offset = ldq_be_p(buf + sizeof(uint64_t));
+        g_array_append_val(replay_log.index, block);
+    }
+    return true;
+}
+
+void replay_log_open_write(void)
+{
+    replay_log_alloc();
+    fseek(replay_file, REPLAY_HEADER_SIZE, SEEK_SET);
+}
+
+void replay_log_close_write(uint32_t version)
+{
+    uint8_t buf[REPLAY_HEADER_SIZE];
+    uint64_t index_offset;
+
+    replay_log_flush_block();
+
+    /* The index of the blocks follows the last one */
+    index_offset = ftell(replay_file);
+    stl_be_p(buf, replay_log.index->len);
+    replay_log_write(buf, sizeof(uint32_t));
+    for (unsigned i = 0; i < replay_log.index->len; i++) {
+        ReplayBlock *block = &g_array_index(replay_log.index, ReplayBlock, i);
+        uint8_t entry[2 * sizeof(uint64_t)];
+
+        stq_be_p(entry, block->offset);
+        stq_be_p(entry + sizeof(uint64_t), block->file_offset);
+        replay_log_write(entry, sizeof(entry));
+    }
+
+    fseek(replay_file, 0, SEEK_SET);
+    stl_be_p(buf, version);
+    stq_be_p(buf + sizeof(uint32_t), index_offset);
+    replay_log_write(buf, sizeof(buf));
+
+    replay_log_free();
+}
+
+bool replay_log_open_read(uint32_t *version)
+{
+    uint8_t buf[REPLAY_HEADER_SIZE];
+    uint64_t index_offset;
+
+    if (fread(buf, 1, sizeof(buf), replay_file) != sizeof(buf)) {
+        return false;
+    }
+    *version = ldl_be_p(buf);
+    index_offset = ldq_be_p(buf + sizeof(uint32_t));
+
+    replay_log_alloc();
+    if (!index_offset || !replay_log_read_index(index_offset)) {
+        g_array_set_size(replay_log.index, 0);
+        replay_log_scan(REPLAY_HEADER_SIZE);
+    }
+    /* If the log is empty, the first read fails */
+    replay_log_load_block(0);
+    return true;
+}
+
+void replay_log_close(void)
+{
+    if (replay_log.index) {
+        replay_log_free();
+    }
+}
+
+uint64_t replay_log_tell(void)
+{
+    if (replay_mode == REPLAY_MODE_RECORD) {
+        return replay_log.offset + replay_log.len;
+    }
+    return replay_log.offset + replay_log.pos;
+}
+
+void replay_log_seek(uint64_t offset)
+{
+    unsigned lo = 0, hi = replay_log.index->len;
+
+    /* Find the last block that starts at or before @offset */
+    while (hi - lo > 1) {
+        unsigned mid = (lo + hi) / 2;
+
+        ReplayBlock *block = &g_array_index(replay_log.index, ReplayBlock, mid);
+
+        if (block->offset <= offset) {
+            lo = mid;
+        } else {
+            hi = mid;
+        }
+    }
+
+    replay_log.eof = false;
+    if (!replay_log_load_block(lo) ||
+        offset > replay_log.offset + replay_log.len) {
+        error_report("Replay: offset %" PRIu64 " is beyond the log", offset);
+        exit(1);
+    }
+    replay_log.pos = offset - replay_log.offset;
+}
+
 void replay_put_byte(uint8_t byte)
 {
     if (replay_file) {
-        if (putc(byte, replay_file) == EOF) {
-            replay_write_error();
+        if (replay_log.len == REPLAY_BLOCK_SIZE) {
+            replay_log_flush_block();
         }
+        replay_log.buf[replay_log.len++] = byte;
     }
 }
 
@@ -82,21 +359,41 @@ void replay_put_array(const uint8_t *buf, size_t size)
 {
     if (replay_file) {
         replay_put_dword(size);
-        if (fwrite(buf, 1, size, replay_file) != size) {
-            replay_write_error();
+        while (size) {
+            size_t chunk;
+
+            if (replay_log.len == REPLAY_BLOCK_SIZE) {
+                replay_log_flush_block();
+            }
+            chunk = MIN(size, REPLAY_BLOCK_SIZE - replay_log.len);
+            memcpy(replay_log.buf + replay_log.len, buf, chunk);
+            replay_log.len += chunk;
+            buf += chunk;
+            size -= chunk;
         }
     }
 }
 
+static void replay_get_bytes(uint8_t *buf, size_t size)
+{
+    while (size) {
+        size_t chunk;
+
+        replay_log_fill();
+        chunk = MIN(size, replay_log.len - replay_log.pos);
+        memcpy(buf, replay_log.buf + replay_log.pos, chunk);
+        replay_log.pos += chunk;
+        buf += chunk;
+        size -= chunk;
+    }
+}
+
 uint8_t replay_get_byte(void)
 {
     uint8_t byte = 0;
     if (replay_file) {
-        int r = getc(replay_file);
-        if (r == EOF) {
-            replay_read_error();
-        }
-        byte = r;
+        replay_log_fill();
+        byte = replay_log.buf[replay_log.pos++];
     }
     return byte;
 }
@@ -138,9 +435,7 @@ void replay_get_array(uint8_t *buf, size_t *size)
 {
     if (replay_file) {
         *size = replay_get_dword();
-        if (fread(buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(buf, *size);
     }
 }
 
@@ -149,16 +444,14 @@ void replay_get_array_alloc(uint8_t **buf, size_t *size)
     if (replay_file) {
         *size = replay_get_dword();
         *buf = g_malloc(*size);
-        if (fread(*buf, 1, *size, replay_file) != *size) {
-            replay_read_error();
-        }
+        replay_get_bytes(*buf, *size);
     }
 }
 
 void replay_check_error(void)
 {
     if (replay_file) {
-        if (feof(replay_file)) {
+        if (replay_log.eof) {
             error_report("replay file is over");
             qemu_system_vmstop_request_prepare();
             qemu_system_vmstop_request(RUN_STATE_PAUSED);
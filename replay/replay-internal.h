@@ -22,6 +22,7 @@ typedef enum ReplayAsyncEventKind {
     REPLAY_ASYNC_EVENT_CHAR_READ,
     REPLAY_ASYNC_EVENT_BLOCK,
     REPLAY_ASYNC_EVENT_NET,
+    REPLAY_ASYNC_EVENT_CHAR_FE,
     REPLAY_ASYNC_COUNT
 } ReplayAsyncEventKind;
 
@@ -82,7 +83,7 @@ enum ReplayEvents {
  * @current_event: current event index
  * @data_kind: current event
  * @has_unread_data: true if event not yet processed
- * @file_offset: offset into replay log at replay snapshot
+ * @file_offset: offset into the uncompressed replay log at replay snapshot
  * @block_request_id: current serialised block request id
  * @read_event_id: current async read event id
  */
@@ -101,11 +102,26 @@ extern ReplayState replay_state;
 
 /* File for replay writing */
 extern FILE *replay_file;
+/* Size of replay log header: version and offset of the block index */
+#define REPLAY_HEADER_SIZE (sizeof(uint32_t) + sizeof(uint64_t))
 /* Instruction count of the replay breakpoint */
 extern uint64_t replay_break_icount;
 /* Timer for the replay breakpoint callback */
 extern QEMUTimer *replay_break_timer;
 
+/*! Starts writing the blocks of a new log after its header. */
+void replay_log_open_write(void);
+/*! Writes the last block, the block index and the header. */
+void replay_log_close_write(uint32_t version);
+/*! Reads the header of a log and its block index. */
+bool replay_log_open_read(uint32_t *version);
+/*! Frees the buffers of a log that was read. */
+void replay_log_close(void);
+/*! Returns the current offset into the uncompressed log. */
+uint64_t replay_log_tell(void);
+/*! Continues reading the log at @offset, from replay_log_tell(). */
+void replay_log_seek(uint64_t offset);
+
 void replay_put_byte(uint8_t byte);
 void replay_put_event(uint8_t event);
 void replay_put_word(uint16_t word);
@@ -185,6 +201,12 @@ void replay_event_char_read_run(void *opaque);
 void replay_event_char_read_save(void *opaque);
 /*! Reads char event read from the file. */
 void *replay_event_char_read_load(void);
+/*! Called to run char frontend input event. */
+void replay_event_char_fe_run(void *opaque);
+/*! Writes char frontend input event to the file. */
+void replay_event_char_fe_save(void *opaque);
+/*! Reads char frontend input event from the file. */
+void *replay_event_char_fe_load(void);
 
 /* Network devices */
 
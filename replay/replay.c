@@ -22,9 +22,7 @@
 
 /* Current version of the replay mechanism.
    Increase it when file format changes. */
-#define REPLAY_VERSION              0xe0200c
-/* Size of replay log header */
-#define HEADER_SIZE                 (sizeof(uint32_t) + sizeof(uint64_t))
+#define REPLAY_VERSION              0xe0200e
 
 ReplayMode replay_mode = REPLAY_MODE_NONE;
 char *replay_snapshot;
@@ -51,6 +49,7 @@ static const char *replay_async_event_name(ReplayAsyncEventKind event)
         ASYNC_EVENT(CHAR_READ);
         ASYNC_EVENT(BLOCK);
         ASYNC_EVENT(NET);
+        ASYNC_EVENT(CHAR_FE);
 #undef ASYNC_EVENT
     default:
         g_assert_not_reached();
@@ -373,15 +372,14 @@ static void replay_enable(const char *fname, int mode)
 
     /* skip file header for RECORD and check it for PLAY */
     if (replay_mode == REPLAY_MODE_RECORD) {
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
+        replay_log_open_write();
     } else if (replay_mode == REPLAY_MODE_PLAY) {
-        unsigned int version = replay_get_dword();
-        if (version != REPLAY_VERSION) {
+        uint32_t version;
+
+        if (!replay_log_open_read(&version) || version != REPLAY_VERSION) {
             fprintf(stderr, "Replay: invalid input log file version\n");
             exit(1);
         }
-        /* go to the beginning */
-        fseek(replay_file, HEADER_SIZE, SEEK_SET);
         replay_fetch_data_kind();
     }
 
@@ -470,9 +468,10 @@ void replay_finish(void)
             /* write end event */
             replay_put_event(EVENT_END);
 
-            /* write header */
-            fseek(replay_file, 0, SEEK_SET);
-            replay_put_dword(REPLAY_VERSION);
+            /* write the last block, the index and the header */
+            replay_log_close_write(REPLAY_VERSION);
+        } else {
+            replay_log_close();
         }
 
         fclose(replay_file);
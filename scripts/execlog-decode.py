@@ -0,0 +1,82 @@
+#!/usr/bin/env python3
+#
+# Decode a binary trace of the execlog TCG plugin into its text format
+#
+# This work is licensed under the terms of the GNU GPL, version 2 or later.
+# See the COPYING file in the top-level directory.
+#
+# Usage: execlog-decode.py TRACE [TABLE]
+#
+# TABLE defaults to TRACE.insns, the instruction table written next to
+# the trace.
+
+import struct
+import sys
+
+HEADER = struct.Struct('=8sII')
+RECORD = struct.Struct('=BBHIQQ')
+
+EXECLOG_MAGIC = b'EXECLOG\0'
+EXECLOG_VERSION = 1
+
+EXECLOG_INSN = 1
+EXECLOG_LOAD = 2
+EXECLOG_STORE = 3
+
+EXECLOG_PADDR = 1 << 0
+EXECLOG_IO = 1 << 1
+
+
+def read_table(path):
+    insns = {}
+    with open(path, encoding='utf-8', errors='replace') as f:
+        for line in f:
+            index, vaddr, opcode, disas = (line.rstrip('\n').split(' ', 3)
+                                           + [''])[:4]
+            insns[int(index)] = '%s, %s, "%s"' % (vaddr, opcode, disas)
+    return insns
+
+
+def decode(trace, insns, out):
+    lines = {}
+    header = trace.read(HEADER.size)
+    magic, version, record_size = HEADER.unpack(header)
+    if magic != EXECLOG_MAGIC or version != EXECLOG_VERSION:
+        raise ValueError('not an execlog binary trace')
+    if record_size != RECORD.size:
+        raise ValueError('unexpected record size %d' % record_size)
+
+    out.write('# vCPU, vAddr, opcode, disassembly'
+              '[, load/store, memory addr, device]...\n')
+    while True:
+        data = trace.read(record_size)
+        if len(data) < record_size:
+            break
+        kind, flags, vcpu, insn, vaddr, paddr = RECORD.unpack(data)
+        if kind == EXECLOG_INSN:
+            if vcpu in lines:
+                out.write(lines[vcpu] + '\n')
+            lines[vcpu] = '%d, %s' % (vcpu, insns.get(insn, '?'))
+            continue
+        access = 'store' if kind == EXECLOG_STORE else 'load'
+        if flags & EXECLOG_PADDR:
+            device = 'io' if flags & EXECLOG_IO else 'RAM'
+            access += ', 0x%08x, %s' % (paddr, device)
+        else:
+            access += ', 0x%08x' % vaddr
+        lines[vcpu] = lines.get(vcpu, '%d, ?' % vcpu) + ', ' + access
+    for vcpu in sorted(lines):
+        out.write(lines[vcpu] + '\n')
+
+
+def main():
+    if len(sys.argv) not in (2, 3):
+        sys.stderr.write('usage: %s TRACE [TABLE]\n' % sys.argv[0])
+        sys.exit(1)
+    table = sys.argv[2] if len(sys.argv) == 3 else sys.argv[1] + '.insns'
+    with open(sys.argv[1], 'rb') as trace:
+        decode(trace, read_table(table), sys.stdout)
+
+
+if __name__ == '__main__':
+    main()
@@ -18,6 +18,7 @@
     List,
     Optional,
     Set,
+    Tuple,
 )
 
 from .common import c_name, mcgen
@@ -56,7 +57,8 @@ def gen_call(name: str,
              arg_type: Optional[QAPISchemaObjectType],
              boxed: bool,
              ret_type: Optional[QAPISchemaType],
-             gen_tracing: bool) -> str:
+             gen_tracing: bool,
+             json_output: bool) -> str:
     ret = ''
 
     argstr = ''
@@ -114,12 +116,19 @@ def gen_call(name: str,
     if ret_type:
         ret += mcgen('''
 
-    qmp_marshal_output_%(c_name)s(retval, ret, errp);
+    qmp_marshal_output_%(json)s%(c_name)s(retval, ret, errp);
 ''',
+                     json='json_' if json_output else '',
                      c_name=ret_type.c_name())
 
     if gen_tracing:
-        if ret_type:
+        if ret_type and json_output:
+            ret += mcgen('''
+
+    trace_qmp_exit_%(name)s(qstring_get_str(qobject_to(QString, *ret)), true);
+''',
+                         name=name)
+        elif ret_type:
             ret += mcgen('''
 
     if (trace_event_get_state_backends(TRACE_QMP_EXIT_%(upper)s)) {
@@ -160,6 +169,29 @@ def gen_marshal_output(ret_type: QAPISchemaType) -> str:
                  c_type=ret_type.c_type(), c_name=ret_type.c_name())
 
 
+def gen_marshal_output_json(ret_type: QAPISchemaType) -> str:
+    return mcgen('''
+
+static void qmp_marshal_output_json_%(c_name)s(%(c_type)s ret_in,
+                                QObject **ret_out, Error **errp)
+{
+    GString *json;
+    Visitor *v;
+
+    v = json_output_visitor_new_qmp(&json);
+    if (visit_type_%(c_name)s(v, "unused", &ret_in, errp)) {
+        visit_complete(v, &json);
+        *ret_out = QOBJECT(qstring_from_gstring(json));
+    }
+    visit_free(v);
+    v = qapi_dealloc_visitor_new();
+    visit_type_%(c_name)s(v, "unused", &ret_in, NULL);
+    visit_free(v);
+}
+''',
+                 c_type=ret_type.c_type(), c_name=ret_type.c_name())
+
+
 def build_marshal_proto(name: str,
                         coroutine: bool) -> str:
     return ('void %(coroutine_fn)sqmp_marshal_%(c_name)s(%(params)s)' % {
@@ -190,7 +222,8 @@ def gen_marshal(name: str,
                 boxed: bool,
                 ret_type: Optional[QAPISchemaType],
                 gen_tracing: bool,
-                coroutine: bool) -> str:
+                coroutine: bool,
+                json_output: bool) -> str:
     have_args = boxed or (arg_type and not arg_type.is_empty())
     if have_args:
         assert arg_type is not None
@@ -245,7 +278,8 @@ def gen_marshal(name: str,
     }
 ''')
 
-    ret += gen_call(name, arg_type, boxed, ret_type, gen_tracing)
+    ret += gen_call(name, arg_type, boxed, ret_type, gen_tracing,
+                    json_output)
 
     ret += mcgen('''
 
@@ -280,7 +314,8 @@ def gen_register_command(name: str,
                          success_response: bool,
                          allow_oob: bool,
                          allow_preconfig: bool,
-                         coroutine: bool) -> str:
+                         coroutine: bool,
+                         json_output: bool) -> str:
     options = []
 
     if not success_response:
@@ -291,6 +326,8 @@ def gen_register_command(name: str,
         options += ['QCO_ALLOW_PRECONFIG']
     if coroutine:
         options += ['QCO_COROUTINE']
+    if json_output:
+        options += ['QCO_JSON_OUTPUT']
 
     ret = mcgen('''
     qmp_register_command(cmds, "%(name)s",
@@ -308,7 +345,8 @@ def __init__(self, prefix: str, gen_tracing: bool):
             prefix, 'qapi-commands',
             ' * Schema-defined QAPI/QMP commands', None, __doc__,
             gen_tracing=gen_tracing)
-        self._visited_ret_types: Dict[QAPIGenC, Set[QAPISchemaType]] = {}
+        self._visited_ret_types: Dict[QAPIGenC,
+                                      Set[Tuple[QAPISchemaType, bool]]] = {}
         self._gen_tracing = gen_tracing
 
     def _begin_user_module(self, name: str) -> None:
@@ -323,6 +361,7 @@ def _begin_user_module(self, name: str) -> None:
 #include "qapi/qmp/qdict.h"
 #include "qapi/dealloc-visitor.h"
 #include "qapi/error.h"
+#include "qapi/qmp/qstring.h"
 #include "%(visit)s.h"
 #include "%(commands)s.h"
 ''',
@@ -382,7 +421,8 @@ def visit_command(self,
                       boxed: bool,
                       allow_oob: bool,
                       allow_preconfig: bool,
-                      coroutine: bool) -> None:
+                      coroutine: bool,
+                      json_output: bool) -> None:
         if not gen:
             return
         # FIXME: If T is a user-defined type, the user is responsible
@@ -390,24 +430,29 @@ def visit_command(self,
         # conjunction of the T-returning commands' conditions.  If T
         # is a built-in type, this isn't possible: the
         # qmp_marshal_output_T() will be generated unconditionally.
-        if ret_type and ret_type not in self._visited_ret_types[self._genc]:
-            self._visited_ret_types[self._genc].add(ret_type)
+        visited = self._visited_ret_types[self._genc]
+        if ret_type and (ret_type, json_output) not in visited:
+            visited.add((ret_type, json_output))
             with ifcontext(ret_type.ifcond,
                            self._genh, self._genc):
-                self._genc.add(gen_marshal_output(ret_type))
+                if json_output:
+                    self._genc.add(gen_marshal_output_json(ret_type))
+                else:
+                    self._genc.add(gen_marshal_output(ret_type))
         with ifcontext(ifcond, self._genh, self._genc):
             self._genh.add(gen_command_decl(name, arg_type, boxed,
                                             ret_type, coroutine))
             self._genh.add(gen_marshal_decl(name, coroutine))
             self._genc.add(gen_marshal(name, arg_type, boxed, ret_type,
-                                       self._gen_tracing, coroutine))
+                                       self._gen_tracing, coroutine,
+                                       json_output))
             if self._gen_tracing:
                 self._gen_trace_events.add(gen_trace(name))
         with self._temp_module('./init'):
             with ifcontext(ifcond, self._genh, self._genc):
                 self._genc.add(gen_register_command(
                     name, features, success_response, allow_oob,
-                    allow_preconfig, coroutine))
+                    allow_preconfig, coroutine, json_output))
 
 
 def gen_commands(schema: QAPISchema,
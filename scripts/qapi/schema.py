@@ -254,6 +254,7 @@ def visit_command(
         allow_oob: bool,
         allow_preconfig: bool,
         coroutine: bool,
+        json_output: bool,
     ) -> None:
         pass
 
@@ -1004,6 +1005,7 @@ def __init__(
         allow_oob: bool,
         allow_preconfig: bool,
         coroutine: bool,
+        json_output: bool,
     ):
         super().__init__(name, info, doc, ifcond, features)
         self._arg_type_name = arg_type
@@ -1016,6 +1018,7 @@ def __init__(
         self.allow_oob = allow_oob
         self.allow_preconfig = allow_preconfig
         self.coroutine = coroutine
+        self.json_output = json_output
 
     def check(self, schema: QAPISchema) -> None:
         assert self.info is not None
@@ -1065,7 +1068,7 @@ def visit(self, visitor: QAPISchemaVisitor) -> None:
             self.name, self.info, self.ifcond, self.features,
             self.arg_type, self.ret_type, self.gen, self.success_response,
             self.boxed, self.allow_oob, self.allow_preconfig,
-            self.coroutine)
+            self.coroutine, self.json_output)
 
 
 class QAPISchemaEvent(QAPISchemaDefinition):
@@ -1428,6 +1431,7 @@ def _def_command(self, expr: QAPIExpression) -> None:
         allow_oob = expr.get('allow-oob', False)
         allow_preconfig = expr.get('allow-preconfig', False)
         coroutine = expr.get('coroutine', False)
+        json_output = expr.get('json-output', False)
         ifcond = QAPISchemaIfCond(expr.get('if'))
         info = expr.info
         features = self._make_features(expr.get('features'), info)
@@ -1441,7 +1445,7 @@ def _def_command(self, expr: QAPIExpression) -> None:
         self._def_definition(
             QAPISchemaCommand(name, info, expr.doc, ifcond, features, data,
                               rets, gen, success_response, boxed, allow_oob,
-                              allow_preconfig, coroutine))
+                              allow_preconfig, coroutine, json_output))
 
     def _def_event(self, expr: QAPIExpression) -> None:
         name = expr['event']
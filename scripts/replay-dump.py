@@ -22,6 +22,7 @@
 import struct
 import os
 import sys
+import zlib
 from collections import namedtuple
 from os import path
 
@@ -58,6 +59,41 @@ def get_checkpoint(self):
 
 replay_state = ReplayState()
 
+# Since version 0xe0200d the events are stored in blocks, most of
+# them compressed.  This reads the sequence of events out of them.
+
+class BlockReader(object):
+    def __init__(self, fin):
+        self.fin = fin
+        self.data = b''
+        self.pos = 0
+
+    def next_block(self):
+        header = self.fin.read(8)
+        if len(header) < 8:
+            return False
+        size, stored = struct.unpack('>II', header)
+        data = self.fin.read(stored)
+        self.data = data if size == stored else zlib.decompress(data)
+        self.pos = 0
+        return True
+
+    def read(self, size):
+        data = b''
+        while len(data) < size:
+            if self.pos == len(self.data) and not self.next_block():
+                break
+            chunk = self.data[self.pos:self.pos + size - len(data)]
+            self.pos += len(chunk)
+            data += chunk
+        return data
+
+    def tell(self):
+        return self.fin.tell()
+
+    def close(self):
+        self.fin.close()
+
 # Simple read functions that mirror replay-internal.c
 # The file-stream is big-endian and manually written out a byte at a time.
 
@@ -138,7 +174,7 @@ def swallow_async_qword(eid, name, dumpfile):
 
 def swallow_bytes(eid, name, dumpfile, nr):
     """Swallow nr bytes of data without looking at it"""
-    dumpfile.seek(nr, os.SEEK_CUR)
+    dumpfile.read(nr)
 
 total_insns = 0
 
@@ -212,6 +248,17 @@ def decode_async_net(eid, name, dumpfile):
     print_event(eid, name, "net:%x flags:%x bytes:%d" % (net_id, flags, size))
     return True
 
+def decode_async_char_fe(eid, name, dumpfile):
+    fe_id = read_byte(dumpfile)
+    event = read_dword(dumpfile)
+    if event == 0xffffffff:
+        size = read_dword(dumpfile)
+        swallow_bytes(eid, name, dumpfile, size)
+        print_event(eid, name, "frontend:%x bytes:%d" % (fe_id, size))
+    else:
+        print_event(eid, name, "frontend:%x event:%d" % (fe_id, event))
+    return True
+
 def decode_shutdown(eid, name, dumpfile):
     print_event(eid, name)
     return True
@@ -396,6 +443,50 @@ def decode_end(eid, name, dumpfile):
                   Decoder(39, "EVENT_END", decode_end),
 ]
 
+# v14 adds EVENT_ASYNC_CHAR_FE after EVENT_ASYNC_NET
+v14_event_table = [Decoder(0, "EVENT_INSTRUCTION", decode_instruction),
+                  Decoder(1, "EVENT_INTERRUPT", decode_interrupt),
+                  Decoder(2, "EVENT_EXCEPTION", decode_exception),
+                  Decoder(3, "EVENT_ASYNC_BH", decode_async_bh),
+                  Decoder(4, "EVENT_ASYNC_BH_ONESHOT", decode_async_bh_oneshot),
+                  Decoder(5, "EVENT_ASYNC_INPUT", decode_unimp),
+                  Decoder(6, "EVENT_ASYNC_INPUT_SYNC", decode_unimp),
+                  Decoder(7, "EVENT_ASYNC_CHAR_READ", decode_async_char_read),
+                  Decoder(8, "EVENT_ASYNC_BLOCK", decode_async_block),
+                  Decoder(9, "EVENT_ASYNC_NET", decode_async_net),
+                  Decoder(10, "EVENT_ASYNC_CHAR_FE", decode_async_char_fe),
+                  Decoder(11, "EVENT_SHUTDOWN", decode_shutdown),
+                  Decoder(12, "EVENT_SHUTDOWN_HOST_ERR", decode_shutdown),
+                  Decoder(13, "EVENT_SHUTDOWN_HOST_QMP_QUIT", decode_shutdown),
+                  Decoder(14, "EVENT_SHUTDOWN_HOST_QMP_RESET", decode_shutdown),
+                  Decoder(15, "EVENT_SHUTDOWN_HOST_SIGNAL", decode_shutdown),
+                  Decoder(16, "EVENT_SHUTDOWN_HOST_UI", decode_shutdown),
+                  Decoder(17, "EVENT_SHUTDOWN_GUEST_SHUTDOWN", decode_shutdown),
+                  Decoder(18, "EVENT_SHUTDOWN_GUEST_RESET", decode_shutdown),
+                  Decoder(19, "EVENT_SHUTDOWN_GUEST_PANIC", decode_shutdown),
+                  Decoder(20, "EVENT_SHUTDOWN_SUBSYS_RESET", decode_shutdown),
+                  Decoder(21, "EVENT_SHUTDOWN_SNAPSHOT_LOAD", decode_shutdown),
+                  Decoder(22, "EVENT_SHUTDOWN___MAX", decode_shutdown),
+                  Decoder(23, "EVENT_CHAR_WRITE", decode_char_write),
+                  Decoder(24, "EVENT_CHAR_READ_ALL", decode_unimp),
+                  Decoder(25, "EVENT_CHAR_READ_ALL_ERROR", decode_unimp),
+                  Decoder(26, "EVENT_AUDIO_OUT", decode_audio_out),
+                  Decoder(27, "EVENT_AUDIO_IN", decode_unimp),
+                  Decoder(28, "EVENT_RANDOM", decode_random),
+                  Decoder(29, "EVENT_CLOCK_HOST", decode_clock),
+                  Decoder(30, "EVENT_CLOCK_VIRTUAL_RT", decode_clock),
+                  Decoder(31, "EVENT_CP_CLOCK_WARP_START", decode_checkpoint),
+                  Decoder(32, "EVENT_CP_CLOCK_WARP_ACCOUNT", decode_checkpoint),
+                  Decoder(33, "EVENT_CP_RESET_REQUESTED", decode_checkpoint),
+                  Decoder(34, "EVENT_CP_SUSPEND_REQUESTED", decode_checkpoint),
+                  Decoder(35, "EVENT_CP_CLOCK_VIRTUAL", decode_checkpoint),
+                  Decoder(36, "EVENT_CP_CLOCK_HOST", decode_checkpoint),
+                  Decoder(37, "EVENT_CP_CLOCK_VIRTUAL_RT", decode_checkpoint),
+                  Decoder(38, "EVENT_CP_INIT", decode_checkpoint_init),
+                  Decoder(39, "EVENT_CP_RESET", decode_checkpoint),
+                  Decoder(40, "EVENT_END", decode_end),
+]
+
 def parse_arguments():
     "Grab arguments for script"
     parser = argparse.ArgumentParser()
@@ -407,14 +498,22 @@ def decode_file(filename):
     "Decode a record/replay dump"
     dumpfile = open(filename, "rb")
     dumpsize = path.getsize(filename)
-    # read and throwaway the header
+    # read and throwaway the header, the block index is not needed
     version = read_dword(dumpfile)
     junk = read_qword(dumpfile)
 
     # see REPLAY_VERSION
     print("HEADER: version 0x%x" % (version))
 
-    if version == 0xe0200c:
+    if version == 0xe0200e:
+        event_decode_table = v14_event_table
+        replay_state.checkpoint_start = 31
+        dumpfile = BlockReader(dumpfile)
+    elif version == 0xe0200d:
+        event_decode_table = v12_event_table
+        replay_state.checkpoint_start = 30
+        dumpfile = BlockReader(dumpfile)
+    elif version == 0xe0200c:
         event_decode_table = v12_event_table
         replay_state.checkpoint_start = 30
     elif version == 0xe02007:
@@ -156,6 +156,9 @@ static StatsFilter *stats_filter(StatsTarget target, const char *names,
         break;
     }
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_PCILEECH:
+    case STATS_TARGET_IOMMU:
+    case STATS_TARGET_RAM_BLOCK:
         break;
     default:
         break;
@@ -229,6 +232,9 @@ void hmp_info_stats(Monitor *mon, const QDict *qdict)
         filter = stats_filter(target, names, cpu_index, provider);
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_PCILEECH:
+    case STATS_TARGET_IOMMU:
+    case STATS_TARGET_RAM_BLOCK:
         filter = stats_filter(target, names, -1, provider);
         break;
     default:
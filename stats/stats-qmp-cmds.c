@@ -65,6 +65,9 @@ static bool invoke_stats_cb(StatsCallbacks *entry,
         }
         break;
     case STATS_TARGET_CRYPTODEV:
+    case STATS_TARGET_PCILEECH:
+    case STATS_TARGET_IOMMU:
+    case STATS_TARGET_RAM_BLOCK:
         break;
     default:
         abort();
@@ -0,0 +1,368 @@
+/*
+ * Publish statistics in shared memory
+ *
+ * Collecting statistics over QMP means a round trip through the monitor
+ * and JSON serialization for every poll.  A stats-shm object instead
+ * gathers them from the main loop at a fixed interval and copies them
+ * into a file that collectors map, see sysemu/stats-shm.h for the
+ * layout.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.
+ */
+
+#include "qemu/osdep.h"
+#include "sysemu/stats.h"
+#include "sysemu/stats-shm.h"
+#include "qapi/error.h"
+#include "qapi/qapi-commands-stats.h"
+#include "qapi/visitor.h"
+#include "qemu/error-report.h"
+#include "qemu/module.h"
+#include "qemu/timer.h"
+#include "qemu/units.h"
+#include "qom/object_interfaces.h"
+
+#define TYPE_STATS_SHM "stats-shm"
+OBJECT_DECLARE_SIMPLE_TYPE(StatsShm, STATS_SHM)
+
+#define STATS_SHM_DEFAULT_SIZE      (1 * MiB)
+#define STATS_SHM_DEFAULT_INTERVAL  1000
+
+struct StatsShm {
+    Object parent_obj;
+
+    char *path;
+    uint64_t size;
+    uint32_t interval;
+
+    int fd;
+    StatsShmHeader *map;
+    uint8_t *buf;       /* entries are built here before being published */
+    QEMUTimer *timer;
+    bool warned;
+};
+
+/* Append one statistic to s->buf, return false if it does not fit */
+static bool stats_shm_add_entry(StatsShm *s, size_t *pos, uint32_t *n,
+                                StatsProvider provider, const char *path,
+                                Stats *stat)
+{
+    const char *strings[] = { StatsProvider_str(provider), path, stat->name };
+    StatsValue *value = stat->value;
+    uint64List *list;
+    StatsShmEntry *entry;
+    size_t strings_len = 0, entry_size;
+    uint64_t *values;
+    uint32_t count;
+    char *p;
+
+    for (int i = 0; i < ARRAY_SIZE(strings); i++) {
+        strings_len += strlen(strings[i]) + 1;
+    }
+    if (strings_len > UINT16_MAX) {
+        /* can't be described, leave it out */
+        return true;
+    }
+
+    if (value->type == QTYPE_QLIST) {
+        count = 0;
+        for (list = value->u.list; list; list = list->next) {
+            count++;
+        }
+    } else {
+        count = 1;
+    }
+
+    entry_size = ROUND_UP(sizeof(*entry) + strings_len, sizeof(uint64_t)) +
+                 count * sizeof(uint64_t);
+    if (entry_size > s->size - *pos) {
+        return false;
+    }
+
+    entry = (StatsShmEntry *)(s->buf + *pos);
+    memset(entry, 0, entry_size);
+    entry->entry_size = entry_size;
+    entry->strings_len = strings_len;
+    entry->count = count;
+
+    p = (char *)(entry + 1);
+    for (int i = 0; i < ARRAY_SIZE(strings); i++) {
+        p = stpcpy(p, strings[i]) + 1;
+    }
+
+    values = (uint64_t *)(s->buf + *pos + entry_size) - count;
+    switch (value->type) {
+    case QTYPE_QNUM:
+        entry->type = STATS_SHM_VALUE_SCALAR;
+        values[0] = value->u.scalar;
+        break;
+    case QTYPE_QBOOL:
+        entry->type = STATS_SHM_VALUE_BOOL;
+        values[0] = value->u.boolean;
+        break;
+    case QTYPE_QLIST:
+        entry->type = STATS_SHM_VALUE_LIST;
+        for (list = value->u.list; list; list = list->next) {
+            *values++ = list->value;
+        }
+        break;
+    default:
+        abort();
+    }
+
+    *pos += entry_size;
+    (*n)++;
+    return true;
+}
+
+/* Copy the @n entries built in s->buf, up to @pos, to the shared region */
+static void stats_shm_publish(StatsShm *s, size_t pos, uint32_t n,
+                              uint32_t flags)
+{
+    StatsShmHeader *hdr = s->map;
+    uint32_t seq = hdr->sequence;
+
+    qatomic_set(&hdr->sequence, seq + 1);
+    smp_wmb();
+
+    memcpy((uint8_t *)hdr + sizeof(*hdr), s->buf + sizeof(*hdr),
+           pos - sizeof(*hdr));
+    hdr->generation++;
+    hdr->timestamp_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
+    hdr->num_entries = n;
+    hdr->flags = flags;
+
+    smp_wmb();
+    qatomic_set(&hdr->sequence, seq + 2);
+}
+
+static void stats_shm_update(void *opaque)
+{
+    StatsShm *s = opaque;
+    size_t pos = sizeof(StatsShmHeader);
+    uint32_t n = 0, flags = 0;
+
+    for (StatsTarget target = 0; target < STATS_TARGET__MAX; target++) {
+        StatsFilter filter = { .target = target };
+        StatsResultList *results, *r;
+        StatsList *stats;
+        Error *err = NULL;
+
+        if (flags & STATS_SHM_F_TRUNCATED) {
+            break;
+        }
+        results = qmp_query_stats(&filter, &err);
+        if (err) {
+            warn_report_once_cond(&s->warned, "stats-shm: %s",
+                                  error_get_pretty(err));
+            error_free(err);
+            continue;
+        }
+
+        for (r = results; r && !flags; r = r->next) {
+            for (stats = r->value->stats; stats; stats = stats->next) {
+                if (!stats_shm_add_entry(s, &pos, &n, r->value->provider,
+                                         r->value->qom_path ?: "",
+                                         stats->value)) {
+                    flags |= STATS_SHM_F_TRUNCATED;
+                    break;
+                }
+            }
+        }
+        qapi_free_StatsResultList(results);
+    }
+
+    stats_shm_publish(s, pos, n, flags);
+    timer_mod(s->timer,
+              qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + s->interval);
+}
+
+static void stats_shm_complete(UserCreatable *uc, Error **errp)
+{
+    StatsShm *s = STATS_SHM(uc);
+    void *map;
+
+    if (!s->path) {
+        error_setg(errp, "'path' property is not set");
+        return;
+    }
+    if (s->size < sizeof(StatsShmHeader) || s->size > SIZE_MAX) {
+        error_setg(errp, "'size' must be at least %zu bytes",
+                   sizeof(StatsShmHeader));
+        return;
+    }
+    if (!s->interval) {
+        error_setg(errp, "'interval' must not be zero");
+        return;
+    }
+
+    s->fd = qemu_create(s->path, O_RDWR, 0644, errp);
+    if (s->fd < 0) {
+        return;
+    }
+    if (ftruncate(s->fd, s->size) < 0) {
+        error_setg_errno(errp, errno, "failed to resize '%s'", s->path);
+        goto fail;
+    }
+    map = mmap(NULL, s->size, PROT_READ | PROT_WRITE, MAP_SHARED, s->fd, 0);
+    if (map == MAP_FAILED) {
+        error_setg_errno(errp, errno, "failed to map '%s'", s->path);
+        goto fail;
+    }
+
+    s->map = map;
+    memset(s->map, 0, sizeof(*s->map));
+    s->map->magic = STATS_SHM_MAGIC;
+    s->map->version = STATS_SHM_VERSION;
+    s->map->header_size = sizeof(*s->map);
+    s->map->size = s->size;
+
+    s->buf = g_malloc(s->size);
+    s->timer = timer_new_ms(QEMU_CLOCK_REALTIME, stats_shm_update, s);
+    stats_shm_update(s);
+    return;
+
+fail:
+    close(s->fd);
+    s->fd = -1;
+    unlink(s->path);
+}
+
+static bool stats_shm_check_unset(StatsShm *s, const char *name, Error **errp)
+{
+    if (s->map) {
+        error_setg(errp, "cannot change property '%s' of %s", name,
+                   object_get_typename(OBJECT(s)));
+        return false;
+    }
+    return true;
+}
+
+static char *stats_shm_get_path(Object *obj, Error **errp)
+{
+    return g_strdup(STATS_SHM(obj)->path);
+}
+
+static void stats_shm_set_path(Object *obj, const char *value, Error **errp)
+{
+    StatsShm *s = STATS_SHM(obj);
+
+    if (!stats_shm_check_unset(s, "path", errp)) {
+        return;
+    }
+    g_free(s->path);
+    s->path = g_strdup(value);
+}
+
+static void stats_shm_get_size(Object *obj, Visitor *v, const char *name,
+                               void *opaque, Error **errp)
+{
+    visit_type_size(v, name, &STATS_SHM(obj)->size, errp);
+}
+
+static void stats_shm_set_size(Object *obj, Visitor *v, const char *name,
+                               void *opaque, Error **errp)
+{
+    StatsShm *s = STATS_SHM(obj);
+    uint64_t value;
+
+    if (!stats_shm_check_unset(s, name, errp) ||
+        !visit_type_size(v, name, &value, errp)) {
+        return;
+    }
+    s->size = value;
+}
+
+static void stats_shm_get_interval(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    visit_type_uint32(v, name, &STATS_SHM(obj)->interval, errp);
+}
+
+static void stats_shm_set_interval(Object *obj, Visitor *v, const char *name,
+                                   void *opaque, Error **errp)
+{
+    StatsShm *s = STATS_SHM(obj);
+    uint32_t value;
+
+    if (!visit_type_uint32(v, name, &value, errp)) {
+        return;
+    }
+    if (!value) {
+        error_setg(errp, "'%s' must not be zero", name);
+        return;
+    }
+    s->interval = value;
+    if (s->timer) {
+        timer_mod(s->timer, qemu_clock_get_ms(QEMU_CLOCK_REALTIME) + value);
+    }
+}
+
+static void stats_shm_init(Object *obj)
+{
+    StatsShm *s = STATS_SHM(obj);
+
+    s->fd = -1;
+    s->size = STATS_SHM_DEFAULT_SIZE;
+    s->interval = STATS_SHM_DEFAULT_INTERVAL;
+}
+
+static void stats_shm_finalize(Object *obj)
+{
+    StatsShm *s = STATS_SHM(obj);
+
+    if (s->timer) {
+        timer_free(s->timer);
+    }
+    if (s->map) {
+        munmap(s->map, s->size);
+    }
+    if (s->fd >= 0) {
+        close(s->fd);
+        unlink(s->path);
+    }
+    g_free(s->buf);
+    g_free(s->path);
+}
+
+static void stats_shm_class_init(ObjectClass *oc, void *data)
+{
+    UserCreatableClass *ucc = USER_CREATABLE_CLASS(oc);
+
+    ucc->complete = stats_shm_complete;
+
+    object_class_property_add_str(oc, "path", stats_shm_get_path,
+                                  stats_shm_set_path);
+    object_class_property_set_description(oc, "path",
+        "File to publish the statistics in, e.g. in /dev/shm");
+    object_class_property_add(oc, "size", "size", stats_shm_get_size,
+                              stats_shm_set_size, NULL, NULL);
+    object_class_property_set_description(oc, "size",
+        "Size of the file");
+    object_class_property_add(oc, "interval", "uint32",
+                              stats_shm_get_interval,
+                              stats_shm_set_interval, NULL, NULL);
+    object_class_property_set_description(oc, "interval",
+        "Update interval in milliseconds");
+}
+
+static const TypeInfo stats_shm_info = {
+    .name = TYPE_STATS_SHM,
+    .parent = TYPE_OBJECT,
+    .instance_size = sizeof(StatsShm),
+    .instance_init = stats_shm_init,
+    .instance_finalize = stats_shm_finalize,
+    .class_init = stats_shm_class_init,
+    .interfaces = (InterfaceInfo[]) {
+        { TYPE_USER_CREATABLE },
+        { }
+    }
+};
+
+static void stats_shm_register_types(void)
+{
+    type_register_static(&stats_shm_info);
+}
+
+type_init(stats_shm_register_types);
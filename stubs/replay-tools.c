@@ -82,3 +82,25 @@ void replay_char_read_all_save_buf(uint8_t *buf, int offset)
 {
     abort();
 }
+
+ReplayCharFe *replay_register_char_fe(IOReadHandler *fd_read,
+                                      ReplayCharFeEventFunc *fd_event,
+                                      void *opaque)
+{
+    abort();
+}
+
+void replay_unregister_char_fe(ReplayCharFe *rcf)
+{
+    abort();
+}
+
+void replay_char_fe_read(ReplayCharFe *rcf, const uint8_t *buf, int len)
+{
+    abort();
+}
+
+void replay_char_fe_event(ReplayCharFe *rcf, int event)
+{
+    abort();
+}
@@ -26,6 +26,30 @@ MemTxResult dma_memory_set(AddressSpace *as, dma_addr_t addr,
     return address_space_set(as, addr, c, len, attrs);
 }
 
+void *dma_memory_map_direct(AddressSpace *as, dma_addr_t addr,
+                            dma_addr_t *len, DMADirection dir,
+                            MemTxAttrs attrs)
+{
+    bool is_write = dir == DMA_DIRECTION_FROM_DEVICE;
+
+    WITH_RCU_READ_LOCK_GUARD() {
+        hwaddr xlat, l = *len;
+        MemoryRegion *mr = address_space_translate(as, addr, &xlat, &l,
+                                                   is_write, attrs);
+
+        if (!memory_access_is_direct(mr, is_write)) {
+            *len = 0;
+            return NULL;
+        }
+    }
+
+    /*
+     * If the memory map changed under our feet, this may still return
+     * a bounce buffer; that is slower but just as correct.
+     */
+    return dma_memory_map(as, addr, len, dir, attrs);
+}
+
 void qemu_sglist_init(QEMUSGList *qsg, DeviceState *dev, int alloc_hint,
                       AddressSpace *as)
 {
@@ -749,8 +749,26 @@ static MemoryRegion *memory_region_get_flatview_root(MemoryRegion *mr)
     return NULL;
 }
 
-/* Render a memory topology into a list of disjoint absolute ranges. */
-static FlatView *generate_memory_topology(MemoryRegion *mr)
+static bool flatview_equal(FlatView *a, FlatView *b)
+{
+    if (a->nr != b->nr) {
+        return false;
+    }
+    for (unsigned i = 0; i < a->nr; i++) {
+        if (!flatrange_equal(&a->ranges[i], &b->ranges[i]) ||
+            a->ranges[i].dirty_log_mask != b->ranges[i].dirty_log_mask) {
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+ * Render a memory topology into a list of disjoint absolute ranges.
+ * If it renders the same as @old, @old is reused with its dispatch, and
+ * the address spaces using it see no change at all.
+ */
+static FlatView *generate_memory_topology(MemoryRegion *mr, FlatView *old)
 {
     int i;
     FlatView *view;
@@ -764,6 +782,13 @@ static FlatView *generate_memory_topology(MemoryRegion *mr)
     }
     flatview_simplify(view);
 
+    if (old && flatview_equal(old, view)) {
+        flatview_unref(view);
+        flatview_ref(old);
+        g_hash_table_replace(flat_views, mr, old);
+        return old;
+    }
+
     view->dispatch = address_space_dispatch_new(view);
     for (i = 0; i < view->nr; i++) {
         MemoryRegionSection mrs =
@@ -1053,7 +1078,7 @@ static void flatviews_init(void)
     flat_views = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL,
                                        (GDestroyNotify) flatview_unref);
     if (!empty_view) {
-        empty_view = generate_memory_topology(NULL);
+        empty_view = generate_memory_topology(NULL, NULL);
         /* We keep it alive forever in the global variable.  */
         flatview_ref(empty_view);
     } else {
@@ -1064,15 +1089,13 @@ static void flatviews_init(void)
 
 static void flatviews_reset(void)
 {
+    GHashTable *old_views = flat_views;
     AddressSpace *as;
 
-    if (flat_views) {
-        g_hash_table_unref(flat_views);
-        flat_views = NULL;
-    }
+    flat_views = NULL;
     flatviews_init();
 
-    /* Render unique FVs */
+    /* Render unique FVs, keeping those that did not change */
     QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
         MemoryRegion *physmr = memory_region_get_flatview_root(as->root);
 
@@ -1080,7 +1103,13 @@ static void flatviews_reset(void)
             continue;
         }
 
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, old_views ?
+                                 g_hash_table_lookup(old_views, physmr) :
+                                 NULL);
+    }
+
+    if (old_views) {
+        g_hash_table_unref(old_views);
     }
 }
 
@@ -1135,7 +1164,7 @@ static void address_space_update_topology(AddressSpace *as)
 
     flatviews_init();
     if (!g_hash_table_lookup(flat_views, physmr)) {
-        generate_memory_topology(physmr);
+        generate_memory_topology(physmr, NULL);
     }
     address_space_set_flatview(as);
 }
@@ -1161,8 +1190,18 @@ void memory_region_transaction_commit(void)
             MEMORY_LISTENER_CALL_GLOBAL(begin, Forward);
 
             QTAILQ_FOREACH(as, &address_spaces, address_spaces_link) {
+                FlatView *old_view = as->current_map;
+
                 address_space_set_flatview(as);
-                address_space_update_ioeventfds(as);
+                /*
+                 * An unchanged FlatView has the same ioeventfds, unless
+                 * some were added or removed.  With many DMA-capable
+                 * devices most address spaces take this shortcut.
+                 */
+                if (ioeventfd_update_pending ||
+                    as->current_map != old_view) {
+                    address_space_update_ioeventfds(as);
+                }
             }
             memory_region_update_pending = false;
             ioeventfd_update_pending = false;
@@ -2084,6 +2123,52 @@ int memory_region_iommu_get_attr(IOMMUMemoryRegion *iommu_mr,
     return imrc->get_attr(iommu_mr, attr, data);
 }
 
+hwaddr memory_region_iommu_translate_range(IOMMUMemoryRegion *iommu_mr,
+                                           hwaddr addr, hwaddr len,
+                                           IOMMUAccessFlags flag,
+                                           int iommu_idx, IOMMUTLBRun *runs,
+                                           int max_runs, int *nr_runs)
+{
+    IOMMUMemoryRegionClass *imrc = IOMMU_MEMORY_REGION_GET_CLASS(iommu_mr);
+    hwaddr done = 0;
+    int n = 0;
+
+    while (done < len) {
+        hwaddr iova = addr + done;
+        IOMMUTLBEntry entry = imrc->translate(iommu_mr, iova, flag, iommu_idx);
+        hwaddr offset = iova & entry.addr_mask;
+        hwaddr translated = (entry.translated_addr & ~entry.addr_mask) | offset;
+        hwaddr size;
+        IOMMUTLBRun *run = n ? &runs[n - 1] : NULL;
+
+        if ((entry.perm & flag) != flag) {
+            break;
+        }
+        /* Written this way so that a full 64-bit mask doesn't overflow. */
+        size = MIN(entry.addr_mask - offset, len - done - 1) + 1;
+
+        if (run && run->target_as == entry.target_as &&
+            run->perm == entry.perm &&
+            run->translated_addr + run->len == translated) {
+            run->len += size;
+        } else if (n < max_runs) {
+            runs[n++] = (IOMMUTLBRun) {
+                .target_as = entry.target_as,
+                .iova = iova,
+                .translated_addr = translated,
+                .len = size,
+                .perm = entry.perm,
+            };
+        } else {
+            break;
+        }
+        done += size;
+    }
+
+    *nr_runs = n;
+    return done;
+}
+
 int memory_region_iommu_attrs_to_index(IOMMUMemoryRegion *iommu_mr,
                                        MemTxAttrs attrs)
 {
@@ -131,6 +131,8 @@ typedef struct PhysPageMap {
 
 struct AddressSpaceDispatch {
     MemoryRegionSection *mru_section;
+    /* Unique per dispatch, even when one is freed and another allocated */
+    uint64_t generation;
     /* This is a multi-level map on the physical address space.
      * The bottom level has pointers to MemoryRegionSections.
      */
@@ -335,17 +337,44 @@ static MemoryRegionSection *phys_page_find(AddressSpaceDispatch *d, hwaddr addr)
 }
 
 /* Called from RCU critical section */
+/*
+ * The last section this thread found. Unlike mru_section, other threads
+ * never overwrite it, so DMA from one thread keeps hitting its section
+ * while vCPUs and other devices look up theirs.
+ */
+typedef struct DispatchCache {
+    const AddressSpaceDispatch *d;
+    uint64_t generation;
+    MemoryRegionSection *section;
+} DispatchCache;
+
+static __thread DispatchCache dispatch_cache;
+static uint64_t dispatch_generation;
+
 static MemoryRegionSection *address_space_lookup_region(AddressSpaceDispatch *d,
                                                         hwaddr addr,
                                                         bool resolve_subpage)
 {
-    MemoryRegionSection *section = qatomic_read(&d->mru_section);
+    DispatchCache *cache = &dispatch_cache;
+    MemoryRegionSection *section;
     subpage_t *subpage;
 
-    if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
-        !section_covers_addr(section, addr)) {
-        section = phys_page_find(d, addr);
-        qatomic_set(&d->mru_section, section);
+    if (cache->d == d && cache->generation == d->generation &&
+        section_covers_addr(cache->section, addr)) {
+        section = cache->section;
+    } else {
+        section = qatomic_read(&d->mru_section);
+        if (!section || section == &d->map.sections[PHYS_SECTION_UNASSIGNED] ||
+            !section_covers_addr(section, addr)) {
+            section = phys_page_find(d, addr);
+            qatomic_set(&d->mru_section, section);
+        }
+        /* The unassigned section covers everything; never cache it. */
+        if (section != &d->map.sections[PHYS_SECTION_UNASSIGNED]) {
+            cache->d = d;
+            cache->generation = d->generation;
+            cache->section = section;
+        }
     }
     if (resolve_subpage && section->mr->subpage) {
         subpage = container_of(section->mr, subpage_t, iomem);
@@ -1885,6 +1914,11 @@ static void ram_block_add(RAMBlock *new_block, Error **errp)
             qemu_mutex_unlock_ramlist();
             goto out_free;
         }
+        /* Memory slots start out private, see kvm_set_phys_mem(). */
+        new_block->private_bmap =
+            bitmap_new(new_block->max_length / qemu_real_host_page_size());
+        bitmap_fill(new_block->private_bmap,
+                    new_block->max_length / qemu_real_host_page_size());
     }
 
     ram_size = (new_block->offset + new_block->max_length) >> TARGET_PAGE_BITS;
@@ -2144,6 +2178,7 @@ static void reclaim_ramblock(RAMBlock *block)
         ram_block_discard_require(false);
     }
 
+    g_free(block->private_bmap);
     g_free(block);
 }
 
@@ -2537,6 +2572,8 @@ AddressSpaceDispatch *address_space_dispatch_new(FlatView *fv)
     assert(n == PHYS_SECTION_UNASSIGNED);
 
     d->phys_map  = (PhysPageEntry) { .ptr = PHYS_MAP_NODE_NIL, .skip = 1 };
+    /* Topology updates run under the BQL, so this needs no atomics. */
+    d->generation = ++dispatch_generation;
 
     return d;
 }
@@ -2972,6 +3009,51 @@ MemTxResult address_space_write(AddressSpace *as, hwaddr addr,
     return result;
 }
 
+MemTxResult address_space_memcpy(AddressSpace *as, hwaddr dest, hwaddr src,
+                                 MemTxAttrs attrs, hwaddr len, hwaddr burst)
+{
+    g_autofree uint8_t *bounce = NULL;
+    MemTxResult result = MEMTX_OK;
+    FlatView *fv;
+
+    assert(burst);
+    RCU_READ_LOCK_GUARD();
+    fv = address_space_to_flatview(as);
+    while (len) {
+        hwaddr l = len, dest_l = len, mr_addr, dest_addr;
+        MemoryRegion *mr = flatview_translate(fv, src, &mr_addr, &l, false,
+                                              attrs);
+        MemoryRegion *dest_mr = flatview_translate(fv, dest, &dest_addr,
+                                                   &dest_l, true, attrs);
+
+        if (!memory_access_is_direct(dest_mr, true)) {
+            l = MIN(l, burst);
+        }
+        if (!flatview_access_allowed(mr, attrs, mr_addr, l)) {
+            result |= MEMTX_ACCESS_ERROR;
+        } else if (memory_access_is_direct(mr, false)) {
+            /* Write straight from the source RAM */
+            uint8_t *ram_ptr = qemu_ram_ptr_length(mr->ram_block, mr_addr, &l,
+                                                   false, false);
+
+            fuzz_dma_read_cb(src, l, mr);
+            result |= flatview_write(fv, dest, attrs, ram_ptr, l);
+        } else {
+            l = MIN(l, burst);
+            if (!bounce) {
+                bounce = g_malloc(MIN(burst, len));
+            }
+            result |= flatview_read(fv, src, attrs, bounce, l);
+            result |= flatview_write(fv, dest, attrs, bounce, l);
+        }
+        len -= l;
+        src += l;
+        dest += l;
+    }
+
+    return result;
+}
+
 MemTxResult address_space_rw(AddressSpace *as, hwaddr addr, MemTxAttrs attrs,
                              void *buf, hwaddr len, bool is_write)
 {
@@ -3766,6 +3848,34 @@ int ram_block_discard_guest_memfd_range(RAMBlock *rb, uint64_t start,
     return ret;
 }
 
+/* Track a conversion of guest_memfd pages, aligned to host pages. */
+void ram_block_set_private(RAMBlock *rb, uint64_t start, size_t length,
+                           bool to_private)
+{
+    const size_t page_size = qemu_real_host_page_size();
+
+    if (!rb->private_bmap) {
+        return;
+    }
+    if (to_private) {
+        bitmap_set_atomic(rb->private_bmap, start / page_size,
+                          length / page_size);
+    } else {
+        bitmap_test_and_clear_atomic(rb->private_bmap, start / page_size,
+                                     length / page_size);
+    }
+}
+
+/*
+ * Whether the page at @offset is private to the guest, so that it
+ * cannot be read through the host mapping of @rb.
+ */
+bool ram_block_is_private(RAMBlock *rb, uint64_t offset)
+{
+    return rb->private_bmap &&
+           test_bit(offset / qemu_real_host_page_size(), rb->private_bmap);
+}
+
 bool ramblock_is_pmem(RAMBlock *rb)
 {
     return rb->flags & RAM_PMEM;
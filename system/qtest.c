@@ -17,7 +17,9 @@
 #include "sysemu/runstate.h"
 #include "chardev/char-fe.h"
 #include "exec/ioport.h"
+#include "exec/address-spaces.h"
 #include "exec/memory.h"
+#include "exec/ramblock.h"
 #include "exec/tswap.h"
 #include "hw/qdev-core.h"
 #include "hw/irq.h"
@@ -198,6 +200,11 @@ static void *qtest_server_send_opaque;
  *  > memset ADDR SIZE VALUE
  *  < OK
  *
+ * .. code-block:: none
+ *
+ *  > memmap ADDR SIZE
+ *  < OK PATH OFFSET
+ *
  * ADDR, SIZE, VALUE are all integers parsed with strtoul() with a base of 0.
  * For 'memset' a zero size is permitted and does nothing.
  *
@@ -208,6 +215,14 @@ static void *qtest_server_send_opaque;
  * B64_DATA is an arbitrarily long base64 encoded string.
  * If the sizes do not match, the data will be truncated.
  *
+ * 'memmap' lets the client access guest RAM directly rather than through
+ * 'read' and 'write'.  It succeeds only if the whole range is backed by a
+ * single shared RAM block with a file descriptor, e.g. a memory-backend-memfd
+ * with share=on, and replies with a path the client can open and the offset
+ * of ADDR within that file.  Stores through such a mapping do not go through
+ * the memory API, so they neither update the dirty bitmaps nor invalidate
+ * translated code.
+ *
  * IRQ management:
  * """""""""""""""
  *
@@ -702,6 +717,44 @@ static void qtest_process_command(CharBackend *chr, gchar **words)
 
         qtest_send_prefix(chr);
         qtest_send(chr, "OK\n");
+    } else if (strcmp(words[0], "memmap") == 0) {
+        uint64_t addr, len;
+        MemoryRegionSection section;
+        RAMBlock *rb;
+        uint8_t *host;
+        int fd, ret;
+
+        g_assert(words[1] && words[2]);
+        ret = qemu_strtou64(words[1], NULL, 0, &addr);
+        g_assert(ret == 0);
+        ret = qemu_strtou64(words[2], NULL, 0, &len);
+        g_assert(ret == 0);
+
+        section = memory_region_find(get_system_memory(), addr, len);
+        if (!section.mr) {
+            qtest_send_prefix(chr);
+            qtest_send(chr, "FAIL No memory at address\n");
+            return;
+        }
+
+        rb = section.mr->ram_block;
+        fd = memory_region_is_ram(section.mr) ?
+             memory_region_get_fd(section.mr) : -1;
+        if (fd < 0 || !qemu_ram_is_shared(rb) ||
+            int128_get64(section.size) != len) {
+            memory_region_unref(section.mr);
+            qtest_send_prefix(chr);
+            qtest_send(chr, "FAIL Range is not backed by shared memory\n");
+            return;
+        }
+
+        host = (uint8_t *)memory_region_get_ram_ptr(section.mr) +
+               section.offset_within_region;
+        qtest_send_prefix(chr);
+        qtest_sendf(chr, "OK /proc/%d/fd/%d 0x%" PRIx64 "\n",
+                    (int)getpid(), fd,
+                    (uint64_t)(rb->fd_offset + (host - rb->host)));
+        memory_region_unref(section.mr);
     } else if (strcmp(words[0], "endianness") == 0) {
         qtest_send_prefix(chr);
         if (target_words_bigendian()) {
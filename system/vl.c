@@ -68,6 +68,7 @@
 #include "sysemu/numa.h"
 #include "sysemu/hostmem.h"
 #include "exec/gdbstub.h"
+#include "exec/memory.h"
 #include "gdbstub/enums.h"
 #include "qemu/timer.h"
 #include "chardev/char.h"
@@ -2651,8 +2652,12 @@ static void qemu_create_cli_devices(void)
             exit(1);
     }
 
-    /* init generic devices */
+    /*
+     * init generic devices; every PCI device adds a bus master address
+     * space and maps regions, so render the topology once at the end
+     */
     rom_set_order_override(FW_CFG_ORDER_OVERRIDE_DEVICE);
+    memory_region_transaction_begin();
     qemu_opts_foreach(qemu_find_opts("device"),
                       device_init_func, NULL, &error_fatal);
     QTAILQ_FOREACH(opt, &device_opts, next) {
@@ -2663,6 +2668,7 @@ static void qemu_create_cli_devices(void)
         assert(ret_data == NULL); /* error_fatal aborts */
         loc_pop(&opt->loc);
     }
+    memory_region_transaction_commit();
     rom_reset_order_override();
 }
 
@@ -3041,6 +3047,17 @@ void qemu_init(int argc, char **argv)
             case QEMU_OPTION_jitdump:
                 perf_enable_jitdump();
                 break;
+            case QEMU_OPTION_perf_threshold:
+                {
+                    unsigned int count;
+
+                    if (qemu_strtoui(optarg, NULL, 0, &count) < 0) {
+                        error_report("invalid perf threshold: %s", optarg);
+                        exit(1);
+                    }
+                    perf_set_threshold(count);
+                    break;
+                }
 #endif
             case QEMU_OPTION_seed:
                 qemu_guest_random_seed_main(optarg, &error_fatal);
@@ -12,63 +12,176 @@
 #include "elf.h"
 #include "exec/target_page.h"
 #include "exec/translation-block.h"
+#include "qemu/atomic.h"
+#include "qemu/notify.h"
+#include "qemu/queue.h"
+#include "qemu/thread.h"
 #include "qemu/timer.h"
+#include "qemu/units.h"
 #include "tcg/debuginfo.h"
 #include "tcg/perf.h"
 #include "tcg/tcg.h"
 
-static FILE *safe_fopen_w(const char *path)
+static int safe_open_w(const char *path)
 {
-    int saved_errno;
-    FILE *f;
-    int fd;
-
     /* Delete the old file, if any. */
     unlink(path);
 
-    /* Avoid symlink attacks by using O_CREAT | O_EXCL. */
-    fd = open(path, O_RDWR | O_CREAT | O_EXCL, S_IRUSR | S_IWUSR);
-    if (fd == -1) {
-        return NULL;
+    /*
+     * Avoid symlink attacks by using O_CREAT | O_EXCL.  O_APPEND keeps
+     * the chunks written by different threads apart.
+     */
+    return open(path, O_RDWR | O_CREAT | O_EXCL | O_APPEND,
+                S_IRUSR | S_IWUSR);
+}
+
+static int perfmap = -1;
+static int jitdump = -1;
+static uint32_t perf_threshold;
+
+/*
+ * Records are collected in a buffer per thread and appended to the files
+ * with a single write(2) once enough of them are pending, or when they
+ * have been waiting for a while.  This keeps the translating threads from
+ * serializing on the files for every TB.
+ */
+#define PERF_BUFFER_SIZE        (64 * KiB)
+#define PERF_FLUSH_INTERVAL_NS  NANOSECONDS_PER_SECOND
+
+typedef struct PerfBuffer {
+    QemuMutex lock;             /* against perf_exit() in another thread */
+    GString *perfmap;
+    GByteArray *jitdump;
+    int64_t flush_time;
+    Notifier exit_notifier;
+    QSLIST_ENTRY(PerfBuffer) next;
+} PerfBuffer;
+
+static QemuMutex perf_buffers_lock;
+static QSLIST_HEAD(, PerfBuffer) perf_buffers =
+    QSLIST_HEAD_INITIALIZER(perf_buffers);
+static __thread PerfBuffer *perf_buffer;
+
+static void perf_init(void)
+{
+    static bool initialized;
+
+    if (!initialized) {
+        qemu_mutex_init(&perf_buffers_lock);
+        atexit(perf_exit);
+        initialized = true;
     }
+}
 
-    /* Convert fd to FILE*. */
-    f = fdopen(fd, "w");
-    if (f == NULL) {
-        saved_errno = errno;
-        close(fd);
-        errno = saved_errno;
-        return NULL;
+/* Called with b->lock held, or b no longer on perf_buffers */
+static void perf_buffer_flush(PerfBuffer *b)
+{
+    int fd;
+
+    fd = qatomic_read(&perfmap);
+    if (fd >= 0 && b->perfmap->len) {
+        qemu_write_full(fd, b->perfmap->str, b->perfmap->len);
+    }
+    g_string_truncate(b->perfmap, 0);
+
+    fd = qatomic_read(&jitdump);
+    if (fd >= 0 && b->jitdump->len) {
+        qemu_write_full(fd, b->jitdump->data, b->jitdump->len);
     }
+    g_byte_array_set_size(b->jitdump, 0);
+
+    b->flush_time = get_clock();
+}
+
+static void perf_buffer_free(PerfBuffer *b)
+{
+    qemu_mutex_destroy(&b->lock);
+    g_string_free(b->perfmap, true);
+    g_byte_array_unref(b->jitdump);
+    g_free(b);
+}
+
+static void perf_buffer_thread_exit(Notifier *n, void *data)
+{
+    PerfBuffer *b = container_of(n, PerfBuffer, exit_notifier);
+
+    qemu_mutex_lock(&perf_buffers_lock);
+    QSLIST_REMOVE(&perf_buffers, b, PerfBuffer, next);
+    qemu_mutex_unlock(&perf_buffers_lock);
 
-    return f;
+    perf_buffer_flush(b);
+    perf_buffer_free(b);
+    perf_buffer = NULL;
 }
 
-static FILE *perfmap;
+/* Return the buffer of the current thread, locked */
+static PerfBuffer *perf_buffer_lock(void)
+{
+    PerfBuffer *b = perf_buffer;
+
+    if (!b) {
+        b = g_new0(PerfBuffer, 1);
+        qemu_mutex_init(&b->lock);
+        b->perfmap = g_string_new(NULL);
+        b->jitdump = g_byte_array_new();
+        b->flush_time = get_clock();
+        b->exit_notifier.notify = perf_buffer_thread_exit;
+        qemu_thread_atexit_add(&b->exit_notifier);
+
+        qemu_mutex_lock(&perf_buffers_lock);
+        QSLIST_INSERT_HEAD(&perf_buffers, b, next);
+        qemu_mutex_unlock(&perf_buffers_lock);
+        perf_buffer = b;
+    }
+
+    qemu_mutex_lock(&b->lock);
+    return b;
+}
+
+static void perf_buffer_unlock(PerfBuffer *b)
+{
+    if (b->perfmap->len + b->jitdump->len >= PERF_BUFFER_SIZE ||
+        get_clock() - b->flush_time >= PERF_FLUSH_INTERVAL_NS) {
+        perf_buffer_flush(b);
+    }
+    qemu_mutex_unlock(&b->lock);
+}
 
 void perf_enable_perfmap(void)
 {
     char map_file[32];
 
+    perf_init();
     snprintf(map_file, sizeof(map_file), "/tmp/perf-%d.map", getpid());
-    perfmap = safe_fopen_w(map_file);
-    if (perfmap == NULL) {
+    perfmap = safe_open_w(map_file);
+    if (perfmap < 0) {
         warn_report("Could not open %s: %s, proceeding without perfmap",
                     map_file, strerror(errno));
     }
 }
 
+void perf_set_threshold(uint32_t count)
+{
+    perf_threshold = count;
+}
+
+uint32_t perf_get_threshold(void)
+{
+    return perfmap >= 0 || jitdump >= 0 ? perf_threshold : 0;
+}
+
 /* Get PC and size of code JITed for guest instruction #INSN. */
 static void get_host_pc_size(uintptr_t *host_pc, uint16_t *host_size,
-                             const void *start, size_t insn)
+                             const void *start, const uint16_t *insn_end_off,
+                             size_t insn)
 {
-    uint16_t start_off = insn ? tcg_ctx->gen_insn_end_off[insn - 1] : 0;
+    uint16_t start_off = insn ? insn_end_off[insn - 1] : 0;
 
     if (host_pc) {
         *host_pc = (uintptr_t)start + start_off;
     }
     if (host_size) {
-        *host_size = tcg_ctx->gen_insn_end_off[insn] - start_off;
+        *host_size = insn_end_off[insn] - start_off;
     }
 }
 
@@ -99,18 +212,18 @@ static const char *pretty_symbol(const struct debuginfo_query *q, size_t *len)
     return buf;
 }
 
-static void write_perfmap_entry(const void *start, size_t insn,
+static void write_perfmap_entry(PerfBuffer *b, const void *start,
+                                const uint16_t *insn_end_off, size_t insn,
                                 const struct debuginfo_query *q)
 {
     uint16_t host_size;
     uintptr_t host_pc;
 
-    get_host_pc_size(&host_pc, &host_size, start, insn);
-    fprintf(perfmap, "%"PRIxPTR" %"PRIx16" %s\n",
-            host_pc, host_size, pretty_symbol(q, NULL));
+    get_host_pc_size(&host_pc, &host_size, start, insn_end_off, insn);
+    g_string_append_printf(b->perfmap, "%"PRIxPTR" %"PRIx16" %s\n",
+                           host_pc, host_size, pretty_symbol(q, NULL));
 }
 
-static FILE *jitdump;
 static size_t perf_marker_size;
 static void *perf_marker = MAP_FAILED;
 
@@ -198,9 +311,10 @@ void perf_enable_jitdump(void)
         return;
     }
 
+    perf_init();
     snprintf(jitdump_file, sizeof(jitdump_file), "jit-%d.dump", getpid());
-    jitdump = safe_fopen_w(jitdump_file);
-    if (jitdump == NULL) {
+    jitdump = safe_open_w(jitdump_file);
+    if (jitdump < 0) {
         warn_report("Could not open %s: %s, proceeding without jitdump",
                     jitdump_file, strerror(errno));
         return;
@@ -213,12 +327,12 @@ void perf_enable_jitdump(void)
      */
     perf_marker_size = qemu_real_host_page_size();
     perf_marker = mmap(NULL, perf_marker_size, PROT_READ | PROT_EXEC,
-                       MAP_PRIVATE, fileno(jitdump), 0);
+                       MAP_PRIVATE, jitdump, 0);
     if (perf_marker == MAP_FAILED) {
         warn_report("Could not map %s: %s, proceeding without jitdump",
                     jitdump_file, strerror(errno));
-        fclose(jitdump);
-        jitdump = NULL;
+        close(jitdump);
+        jitdump = -1;
         return;
     }
 
@@ -230,19 +344,30 @@ void perf_enable_jitdump(void)
     header.pid = getpid();
     header.timestamp = get_clock();
     header.flags = 0;
-    fwrite(&header, sizeof(header), 1, jitdump);
+    qemu_write_full(jitdump, &header, sizeof(header));
 }
 
 void perf_report_prologue(const void *start, size_t size)
 {
-    if (perfmap) {
-        fprintf(perfmap, "%"PRIxPTR" %zx tcg-prologue-buffer\n",
-                (uintptr_t)start, size);
+    PerfBuffer *b;
+
+    if (perfmap >= 0) {
+        b = perf_buffer_lock();
+        g_string_append_printf(b->perfmap,
+                               "%"PRIxPTR" %zx tcg-prologue-buffer\n",
+                               (uintptr_t)start, size);
+        perf_buffer_unlock(b);
     }
 }
 
+static void jitdump_append(PerfBuffer *b, const void *data, size_t size)
+{
+    g_byte_array_append(b->jitdump, data, size);
+}
+
 /* Write a JIT_CODE_DEBUG_INFO jitdump entry. */
-static void write_jr_code_debug_info(const void *start,
+static void write_jr_code_debug_info(PerfBuffer *b, const void *start,
+                                     const uint16_t *insn_end_off,
                                      const struct debuginfo_query *q,
                                      size_t icount)
 {
@@ -263,33 +388,34 @@ static void write_jr_code_debug_info(const void *start,
             rec.nr_entry++;
         }
     }
-    fwrite(&rec, sizeof(rec), 1, jitdump);
+    jitdump_append(b, &rec, sizeof(rec));
 
     /* Write the main debug entries. */
     for (insn = 0; insn < icount; insn++) {
         if (q[insn].file) {
-            get_host_pc_size(&host_pc, NULL, start, insn);
+            get_host_pc_size(&host_pc, NULL, start, insn_end_off, insn);
             ent.addr = host_pc;
             ent.lineno = q[insn].line;
             ent.discrim = 0;
-            fwrite(&ent, sizeof(ent), 1, jitdump);
-            fwrite(q[insn].file, strlen(q[insn].file) + 1, 1, jitdump);
+            jitdump_append(b, &ent, sizeof(ent));
+            jitdump_append(b, q[insn].file, strlen(q[insn].file) + 1);
         }
     }
 
     /* Write the trailing debug_entry. */
-    ent.addr = (uintptr_t)start + tcg_ctx->gen_insn_end_off[icount - 1];
+    ent.addr = (uintptr_t)start + insn_end_off[icount - 1];
     ent.lineno = 0;
     ent.discrim = 0;
-    fwrite(&ent, sizeof(ent), 1, jitdump);
-    fwrite("", 1, 1, jitdump);
+    jitdump_append(b, &ent, sizeof(ent));
+    jitdump_append(b, "", 1);
 }
 
 /* Write a JIT_CODE_LOAD jitdump entry. */
-static void write_jr_code_load(const void *start, uint16_t host_size,
+static void write_jr_code_load(PerfBuffer *b, const void *start,
+                               uint16_t host_size,
                                const struct debuginfo_query *q)
 {
-    static uint64_t code_index;
+    static uint32_t code_index;
     struct jr_code_load rec;
     const char *symbol;
     size_t symbol_size;
@@ -303,20 +429,21 @@ static void write_jr_code_load(const void *start, uint16_t host_size,
     rec.vma = (uintptr_t)start;
     rec.code_addr = (uintptr_t)start;
     rec.code_size = host_size;
-    rec.code_index = code_index++;
-    fwrite(&rec, sizeof(rec), 1, jitdump);
-    fwrite(symbol, symbol_size, 1, jitdump);
-    fwrite(start, host_size, 1, jitdump);
+    rec.code_index = qatomic_fetch_inc(&code_index);
+    jitdump_append(b, &rec, sizeof(rec));
+    jitdump_append(b, symbol, symbol_size);
+    jitdump_append(b, start, host_size);
 }
 
-void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
-                      const void *start)
+static void perf_report_insns(uint64_t guest_pc, TranslationBlock *tb,
+                              const void *start, const uint64_t *insn_data,
+                              const uint16_t *insn_end_off, int start_words)
 {
     struct debuginfo_query *q;
-    size_t insn, start_words;
-    uint64_t *gen_insn_data;
+    PerfBuffer *b;
+    size_t insn;
 
-    if (!perfmap && !jitdump) {
+    if (perfmap < 0 && jitdump < 0) {
         return;
     }
 
@@ -328,46 +455,78 @@ void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
     debuginfo_lock();
 
     /* Query debuginfo for each guest instruction. */
-    gen_insn_data = tcg_ctx->gen_insn_data;
-    start_words = tcg_ctx->insn_start_words;
-
     for (insn = 0; insn < tb->icount; insn++) {
         /* FIXME: This replicates the restore_state_to_opc() logic. */
-        q[insn].address = gen_insn_data[insn * start_words + 0];
+        q[insn].address = insn_data[insn * start_words + 0];
         if (tb_cflags(tb) & CF_PCREL) {
             q[insn].address |= (guest_pc & qemu_target_page_mask());
         }
-        q[insn].flags = DEBUGINFO_SYMBOL | (jitdump ? DEBUGINFO_LINE : 0);
+        q[insn].flags = DEBUGINFO_SYMBOL | (jitdump >= 0 ? DEBUGINFO_LINE : 0);
     }
     debuginfo_query(q, tb->icount);
 
+    b = perf_buffer_lock();
+
     /* Emit perfmap entries if needed. */
-    if (perfmap) {
-        flockfile(perfmap);
+    if (perfmap >= 0) {
         for (insn = 0; insn < tb->icount; insn++) {
-            write_perfmap_entry(start, insn, &q[insn]);
+            write_perfmap_entry(b, start, insn_end_off, insn, &q[insn]);
         }
-        funlockfile(perfmap);
     }
 
     /* Emit jitdump entries if needed. */
-    if (jitdump) {
-        flockfile(jitdump);
-        write_jr_code_debug_info(start, q, tb->icount);
-        write_jr_code_load(start, tcg_ctx->gen_insn_end_off[tb->icount - 1],
-                           q);
-        funlockfile(jitdump);
+    if (jitdump >= 0) {
+        write_jr_code_debug_info(b, start, insn_end_off, q, tb->icount);
+        write_jr_code_load(b, start, insn_end_off[tb->icount - 1], q);
     }
 
+    perf_buffer_unlock(b);
+
     debuginfo_unlock();
     g_free(q);
 }
 
+void perf_report_code(uint64_t guest_pc, TranslationBlock *tb,
+                      const void *start)
+{
+    /* With a threshold, the TB is reported once it gets hot. */
+    if (perf_threshold) {
+        return;
+    }
+
+    perf_report_insns(guest_pc, tb, start, tcg_ctx->gen_insn_data,
+                      tcg_ctx->gen_insn_end_off, tcg_ctx->insn_start_words);
+}
+
+void perf_report_hot_code(uint64_t guest_pc, TranslationBlock *tb,
+                          const uint64_t *insn_data,
+                          const uint16_t *insn_end_off, int start_words)
+{
+    perf_report_insns(guest_pc, tb, tb->tc.ptr, insn_data, insn_end_off,
+                      start_words);
+}
+
 void perf_exit(void)
 {
-    if (perfmap) {
-        fclose(perfmap);
-        perfmap = NULL;
+    PerfBuffer *b;
+    int fd;
+
+    if (perfmap < 0 && jitdump < 0) {
+        return;
+    }
+
+    qemu_mutex_lock(&perf_buffers_lock);
+    QSLIST_FOREACH(b, &perf_buffers, next) {
+        qemu_mutex_lock(&b->lock);
+        perf_buffer_flush(b);
+        qemu_mutex_unlock(&b->lock);
+    }
+    qemu_mutex_unlock(&perf_buffers_lock);
+
+    if (perfmap >= 0) {
+        fd = perfmap;
+        qatomic_set(&perfmap, -1);
+        close(fd);
     }
 
     if (perf_marker != MAP_FAILED) {
@@ -375,8 +534,9 @@ void perf_exit(void)
         perf_marker = MAP_FAILED;
     }
 
-    if (jitdump) {
-        fclose(jitdump);
-        jitdump = NULL;
+    if (jitdump >= 0) {
+        fd = jitdump;
+        qatomic_set(&jitdump, -1);
+        close(fd);
     }
 }
@@ -29,11 +29,15 @@
 #include "qemu/memalign.h"
 #include "qemu/cacheinfo.h"
 #include "qemu/qtree.h"
+#include "qemu/bitmap.h"
 #include "qapi/error.h"
 #include "tcg/tcg.h"
 #include "exec/translation-block.h"
 #include "tcg-internal.h"
 #include "host/cpuinfo.h"
+#ifdef CONFIG_LINUX
+#include <sys/syscall.h>
+#endif
 
 
 /*
@@ -70,7 +74,9 @@ struct tcg_region_state {
     size_t total_size; /* size of entire buffer, >= n * stride */
 
     /* fields protected by the lock */
-    size_t current; /* current region index */
+    size_t current; /* number of regions in use */
+    unsigned long *used; /* bitmap of the regions in use */
+    int *nodes; /* host NUMA node of the pages of each region, or -1 */
     size_t agg_size_full; /* aggregate size of full regions */
 };
 
@@ -357,12 +363,63 @@ static void tcg_region_assign(TCGContext *s, size_t curr_region)
     s->code_gen_highwater = end - TCG_HIGHWATER;
 }
 
+/*
+ * Return the host NUMA node the calling thread runs on, or -1.
+ */
+static int tcg_region_host_node(void)
+{
+#if defined(CONFIG_LINUX) && defined(SYS_getcpu)
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+        return node;
+    }
+#endif
+    return -1;
+}
+
+/*
+ * The pages of a region are placed on a host NUMA node by the first
+ * thread that generates code into it, and stay there across flushes.
+ * Hand out regions whose pages are on the node of the context's thread
+ * if there are any, then regions that were never used, and only then
+ * the remaining ones.  Without NUMA information, this is the order of
+ * the regions in the buffer.
+ */
+static size_t tcg_region_pick__locked(int node)
+{
+    size_t fallback = region.n;
+
+    for (size_t i = 0; i < region.n; i++) {
+        if (test_bit(i, region.used)) {
+            continue;
+        }
+        if (node < 0 || region.nodes[i] == node) {
+            return i;
+        }
+        if (fallback == region.n && region.nodes[i] < 0) {
+            fallback = i;
+        }
+    }
+    if (fallback == region.n) {
+        fallback = find_first_zero_bit(region.used, region.n);
+    }
+    return fallback;
+}
+
 static bool tcg_region_alloc__locked(TCGContext *s)
 {
+    size_t curr_region;
+
     if (region.current == region.n) {
         return true;
     }
-    tcg_region_assign(s, region.current);
+    curr_region = tcg_region_pick__locked(s->code_gen_node);
+    set_bit(curr_region, region.used);
+    if (region.nodes[curr_region] < 0) {
+        region.nodes[curr_region] = s->code_gen_node;
+    }
+    tcg_region_assign(s, curr_region);
     region.current++;
     return false;
 }
@@ -377,6 +434,7 @@ bool tcg_region_alloc(TCGContext *s)
     /* read the region size now; alloc__locked will overwrite it on success */
     size_t size_full = s->code_gen_buffer_size;
 
+    s->code_gen_node = tcg_region_host_node();
     qemu_mutex_lock(&region.lock);
     err = tcg_region_alloc__locked(s);
     if (!err) {
@@ -398,6 +456,7 @@ static void tcg_region_initial_alloc__locked(TCGContext *s)
 
 void tcg_region_initial_alloc(TCGContext *s)
 {
+    s->code_gen_node = tcg_region_host_node();
     qemu_mutex_lock(&region.lock);
     tcg_region_initial_alloc__locked(s);
     qemu_mutex_unlock(&region.lock);
@@ -411,6 +470,7 @@ void tcg_region_reset_all(void)
 
     qemu_mutex_lock(&region.lock);
     region.current = 0;
+    bitmap_zero(region.used, region.n);
     region.agg_size_full = 0;
 
     for (i = 0; i < n_ctxs; i++) {
@@ -808,6 +868,11 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
 
     /* init the region struct */
     qemu_mutex_init(&region.lock);
+    region.used = bitmap_new(region.n);
+    region.nodes = g_new(int, region.n);
+    for (size_t i = 0; i < region.n; i++) {
+        region.nodes[i] = -1;
+    }
 
     /*
      * Set guard pages in the rw buffer, as that's the one into which
@@ -857,6 +922,7 @@ void tcg_region_init(size_t tb_size, int splitwx, unsigned max_cpus)
      * This will be the context into which we generate the prologue.
      * It is also the only context for CONFIG_USER_ONLY.
      */
+    tcg_init_ctx.code_gen_node = -1;
     tcg_region_initial_alloc__locked(&tcg_init_ctx);
 }
 
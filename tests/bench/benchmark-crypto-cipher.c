@@ -11,9 +11,11 @@
  * top-level directory.
  */
 #include "qemu/osdep.h"
+#include "qemu/bswap.h"
 #include "qemu/units.h"
 #include "crypto/init.h"
 #include "crypto/cipher.h"
+#include "qapi/error.h"
 
 static void test_cipher_speed(size_t chunk_size,
                               QCryptoCipherMode mode,
@@ -164,6 +166,68 @@ static void test_cipher_speed_xts_aes_256(const void *opaque)
                       QCRYPTO_CIPHER_ALGO_AES_256);
 }
 
+/*
+ * Encrypt @chunk_size bytes as 512 byte sectors, each with its own IV,
+ * the way the LUKS and qcow2 encryption layers do.
+ */
+static void test_cipher_speed_xts_sectors(size_t chunk_size,
+                                          QCryptoCipherAlgo alg)
+{
+    const size_t sector_size = 512;
+    const size_t total = 2 * GiB;
+    QCryptoCipher *cipher;
+    uint8_t *key, *buf;
+    uint8_t iv[16];
+    uint64_t sector = 0;
+    size_t nkey, remain;
+
+    if (!qcrypto_cipher_supports(alg, QCRYPTO_CIPHER_MODE_XTS)) {
+        return;
+    }
+
+    nkey = qcrypto_cipher_get_key_len(alg) * 2;
+    key = g_new0(uint8_t, nkey);
+    memset(key, g_test_rand_int(), nkey);
+    buf = g_new0(uint8_t, chunk_size);
+    memset(buf, g_test_rand_int(), chunk_size);
+
+    cipher = qcrypto_cipher_new(alg, QCRYPTO_CIPHER_MODE_XTS,
+                                key, nkey, &error_abort);
+
+    g_test_timer_start();
+    for (remain = total; remain; remain -= chunk_size) {
+        for (size_t off = 0; off < chunk_size; off += sector_size) {
+            memset(iv, 0, sizeof(iv));
+            stq_le_p(iv, sector++);
+            g_assert(qcrypto_cipher_setiv(cipher, iv, sizeof(iv),
+                                          &error_abort) == 0);
+            g_assert(qcrypto_cipher_encrypt(cipher, buf + off, buf + off,
+                                            sector_size, &error_abort) == 0);
+        }
+    }
+    g_test_timer_elapsed();
+
+    g_test_message("enc(%s-xts) %zu byte sectors, chunk %zu bytes "
+                   "%.2f MB/sec ", QCryptoCipherAlgo_str(alg), sector_size,
+                   chunk_size, (double)total / MiB / g_test_timer_last());
+
+    qcrypto_cipher_free(cipher);
+    g_free(buf);
+    g_free(key);
+}
+
+static void test_cipher_speed_xts_sectors_aes_128(const void *opaque)
+{
+    test_cipher_speed_xts_sectors((size_t)opaque,
+                                  QCRYPTO_CIPHER_ALGO_AES_128);
+}
+
+static void test_cipher_speed_xts_sectors_aes_256(const void *opaque)
+{
+    test_cipher_speed_xts_sectors((size_t)opaque,
+                                  QCRYPTO_CIPHER_ALGO_AES_256);
+}
+
 
 int main(int argc, char **argv)
 {
@@ -204,5 +268,8 @@ int main(int argc, char **argv)
     ADD_TESTS(16384);
     ADD_TESTS(65536);
 
+    ADD_TEST(xts_sectors, aes, 128, 65536);
+    ADD_TEST(xts_sectors, aes, 256, 65536);
+
     return g_test_run();
 }
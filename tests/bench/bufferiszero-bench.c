@@ -39,9 +39,63 @@ static void test(const void *opaque)
     g_free(buf);
 }
 
+/*
+ * Zero page detection as multifd does it: 4 KiB pages scattered over a
+ * buffer larger than the caches, one in sixteen of them not zero.
+ */
+#define BENCH_PAGE_SIZE       (4 * KiB)
+#define BENCH_NR_PAGES        (64 * MiB / BENCH_PAGE_SIZE)
+
+static void test_pages(const void *opaque)
+{
+    char *buf = g_malloc0(BENCH_NR_PAGES * BENCH_PAGE_SIZE);
+    const void **pages = g_new(const void *, BENCH_NR_PAGES);
+    int accel_index = 0;
+    size_t i;
+
+    for (i = 0; i < BENCH_NR_PAGES; i++) {
+        pages[i] = buf + ((i * 7919) % BENCH_NR_PAGES) * BENCH_PAGE_SIZE;
+        if (!(i % 16)) {
+            buf[i * BENCH_PAGE_SIZE + BENCH_PAGE_SIZE / 3] = 1;
+        }
+    }
+
+    do {
+        for (int batch = 0; batch < 2; batch++) {
+            double total = 0.0;
+
+            g_test_timer_start();
+            do {
+                for (i = 0; i < BENCH_NR_PAGES; i += BUFFER_IS_ZERO_BATCH_MAX) {
+                    if (batch) {
+                        buffer_is_zero_batch(pages + i,
+                                             BUFFER_IS_ZERO_BATCH_MAX,
+                                             BENCH_PAGE_SIZE);
+                        continue;
+                    }
+                    for (int k = 0; k < BUFFER_IS_ZERO_BATCH_MAX; k++) {
+                        buffer_is_zero(pages[i + k], BENCH_PAGE_SIZE);
+                    }
+                }
+                total += BENCH_NR_PAGES * BENCH_PAGE_SIZE;
+            } while (g_test_timer_elapsed() < 0.5);
+
+            total /= MiB;
+            g_test_message("%s #%d: %8.0f MB/sec",
+                           batch ? "buffer_is_zero_batch" : "buffer_is_zero",
+                           accel_index, total / g_test_timer_last());
+        }
+        accel_index++;
+    } while (test_buffer_is_zero_next_accel());
+
+    g_free(pages);
+    g_free(buf);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
     g_test_add_data_func("/cutils/bufferiszero/speed", NULL, test);
+    g_test_add_data_func("/cutils/bufferiszero/pages", NULL, test_pages);
     return g_test_run();
 }
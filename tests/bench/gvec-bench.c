@@ -0,0 +1,147 @@
+/*
+ * Speed of the host acceleration of the out-of-line gvec helpers
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ *
+ * Each operation is run as the helper in accel/tcg/tcg-runtime-gvec.c
+ * does, once with the host vector code and once with the C loop only,
+ * over the vector sizes that guests use.
+ */
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "host/gvec-accel.h"
+
+#define BENCH_MAX_OPRSZ 256
+
+typedef void GVecBenchFn(void *d, void *a, void *b, void *c,
+                         intptr_t oprsz, bool accel);
+
+static void bench_ssadd8(void *d, void *a, void *b, void *c,
+                         intptr_t oprsz, bool accel)
+{
+    intptr_t i = accel ? gvec_ssadd8_accel(d, a, b, oprsz) : 0;
+
+    for (; i < oprsz; i++) {
+        int r = *(int8_t *)(a + i) + *(int8_t *)(b + i);
+        *(int8_t *)(d + i) = MIN(MAX(r, INT8_MIN), INT8_MAX);
+    }
+}
+
+static void bench_ussub16(void *d, void *a, void *b, void *c,
+                          intptr_t oprsz, bool accel)
+{
+    intptr_t i = accel ? gvec_ussub16_accel(d, a, b, oprsz) : 0;
+
+    for (; i < oprsz; i += sizeof(uint16_t)) {
+        int r = *(uint16_t *)(a + i) - *(uint16_t *)(b + i);
+        *(uint16_t *)(d + i) = MAX(r, 0);
+    }
+}
+
+static void bench_lt32(void *d, void *a, void *b, void *c,
+                       intptr_t oprsz, bool accel)
+{
+    intptr_t i = accel ? gvec_lt32_accel(d, a, b, oprsz) : 0;
+
+    for (; i < oprsz; i += sizeof(int32_t)) {
+        *(int32_t *)(d + i) = -(*(int32_t *)(a + i) < *(int32_t *)(b + i));
+    }
+}
+
+static void bench_sar16(void *d, void *a, void *b, void *c,
+                        intptr_t oprsz, bool accel)
+{
+    intptr_t i = accel ? gvec_sar16_accel(d, a, 5, oprsz) : 0;
+
+    for (; i < oprsz; i += sizeof(int16_t)) {
+        *(int16_t *)(d + i) = *(int16_t *)(a + i) >> 5;
+    }
+}
+
+static void bench_bitsel(void *d, void *a, void *b, void *c,
+                         intptr_t oprsz, bool accel)
+{
+    intptr_t i = accel ? gvec_bitsel_accel(d, a, b, c, oprsz) : 0;
+
+    for (; i < oprsz; i += sizeof(uint64_t)) {
+        uint64_t aa = *(uint64_t *)(a + i);
+        *(uint64_t *)(d + i) = (*(uint64_t *)(b + i) & aa) |
+                               (*(uint64_t *)(c + i) & ~aa);
+    }
+}
+
+static void bench_dup64(void *d, void *a, void *b, void *c,
+                        intptr_t oprsz, bool accel)
+{
+    uint64_t v = *(uint64_t *)a;
+    intptr_t i = accel ? gvec_dup64_accel(d, v, oprsz) : 0;
+
+    for (; i < oprsz; i += sizeof(uint64_t)) {
+        *(uint64_t *)(d + i) = v;
+    }
+}
+
+typedef struct GVecBench {
+    const char *name;
+    GVecBenchFn *fn;
+} GVecBench;
+
+static const GVecBench benches[] = {
+    { "ssadd8", bench_ssadd8 },
+    { "ussub16", bench_ussub16 },
+    { "lt32", bench_lt32 },
+    { "sar16i", bench_sar16 },
+    { "bitsel", bench_bitsel },
+    { "dup64", bench_dup64 },
+};
+
+static void test(const void *opaque)
+{
+    const GVecBench *bench = opaque;
+    uint8_t a[BENCH_MAX_OPRSZ], b[BENCH_MAX_OPRSZ], c[BENCH_MAX_OPRSZ];
+    uint8_t d[BENCH_MAX_OPRSZ], ref[BENCH_MAX_OPRSZ];
+
+    for (int i = 0; i < BENCH_MAX_OPRSZ; i++) {
+        a[i] = i * 37;
+        b[i] = i * 101 + 7;
+        c[i] = ~i;
+    }
+
+    for (intptr_t oprsz = 8; oprsz <= BENCH_MAX_OPRSZ; oprsz *= 2) {
+        for (int accel = 0; accel < 2; accel++) {
+            double total = 0.0;
+
+            g_test_timer_start();
+            do {
+                for (int k = 0; k < 1024; k++) {
+                    bench->fn(d, a, b, c, oprsz, accel);
+                }
+                total += 1024 * oprsz;
+            } while (g_test_timer_elapsed() < 0.2);
+
+            g_test_message("%-8s %3" PRIdPTR " bytes %-5s %8.0f MB/sec",
+                           bench->name, oprsz, accel ? "accel" : "C",
+                           total / MiB / g_test_timer_last());
+
+            /* The host vector code must not change the result.  */
+            if (!accel) {
+                memcpy(ref, d, oprsz);
+            } else {
+                g_assert_cmpmem(d, oprsz, ref, oprsz);
+            }
+        }
+    }
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    for (int i = 0; i < ARRAY_SIZE(benches); i++) {
+        g_autofree char *path = g_strdup_printf("/tcg/gvec/%s",
+                                                benches[i].name);
+        g_test_add_data_func(path, &benches[i], test);
+    }
+    return g_test_run();
+}
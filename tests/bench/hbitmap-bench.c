@@ -0,0 +1,113 @@
+/*
+ * Hierarchical bitmap speed benchmark
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+#include "qemu/osdep.h"
+#include "qemu/hbitmap.h"
+#include "qemu/units.h"
+
+/* A dirty bitmap of a 1 TiB disk with 64 KiB clusters */
+#define BENCH_BITS      (16 * MiB)
+
+static void test_set_reset(const void *opaque)
+{
+    HBitmap *hb = hbitmap_alloc(BENCH_BITS, 0);
+
+    for (uint64_t len = 64; len <= BENCH_BITS; len *= 16) {
+        double total = 0.0;
+
+        g_test_timer_start();
+        do {
+            for (uint64_t start = 0; start < BENCH_BITS; start += len) {
+                hbitmap_set(hb, start, len);
+            }
+            for (uint64_t start = 0; start < BENCH_BITS; start += len) {
+                hbitmap_reset(hb, start, len);
+            }
+            total += 2 * BENCH_BITS;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        g_test_message("set+reset %8" PRIu64 " bits: %8.0f Mbit/sec",
+                       len, total / MiB / g_test_timer_last());
+    }
+
+    hbitmap_free(hb);
+}
+
+/* Walk the dirty areas of a bitmap with one run of @len bits every @stride */
+static void test_dirty_area(const void *opaque)
+{
+    HBitmap *hb = hbitmap_alloc(BENCH_BITS, 0);
+
+    for (uint64_t stride = 256; stride <= 64 * KiB; stride *= 16) {
+        double total = 0.0;
+        uint64_t areas = 0;
+
+        hbitmap_reset_all(hb);
+        for (uint64_t start = 0; start < BENCH_BITS; start += stride) {
+            hbitmap_set(hb, start, 16);
+        }
+
+        g_test_timer_start();
+        do {
+            int64_t pos = 0, count;
+
+            while (hbitmap_next_dirty_area(hb, pos, BENCH_BITS, INT64_MAX,
+                                           &pos, &count)) {
+                pos += count;
+                areas++;
+            }
+            total += BENCH_BITS;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        g_test_message("next_dirty_area stride %6" PRIu64
+                       ": %8.0f Mbit/sec %10.0f areas/sec",
+                       stride, total / MiB / g_test_timer_last(),
+                       areas / g_test_timer_last());
+    }
+
+    hbitmap_free(hb);
+}
+
+/* Look for the clean clusters of an almost entirely dirty bitmap */
+static void test_next_zero(const void *opaque)
+{
+    HBitmap *hb = hbitmap_alloc(BENCH_BITS, 0);
+
+    for (uint64_t stride = 4 * KiB; stride <= BENCH_BITS; stride *= 16) {
+        double total = 0.0;
+
+        hbitmap_set(hb, 0, BENCH_BITS);
+        for (uint64_t start = stride - 1; start < BENCH_BITS; start += stride) {
+            hbitmap_reset(hb, start, 1);
+        }
+
+        g_test_timer_start();
+        do {
+            int64_t pos = 0;
+
+            while (pos < BENCH_BITS &&
+                   (pos = hbitmap_next_zero(hb, pos, BENCH_BITS - pos)) >= 0) {
+                pos++;
+            }
+            total += BENCH_BITS;
+        } while (g_test_timer_elapsed() < 0.5);
+
+        g_test_message("next_zero stride %8" PRIu64 ": %8.0f Mbit/sec",
+                       stride, total / MiB / g_test_timer_last());
+    }
+
+    hbitmap_free(hb);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    g_test_add_data_func("/hbitmap/set-reset", NULL, test_set_reset);
+    g_test_add_data_func("/hbitmap/next-dirty-area", NULL, test_dirty_area);
+    g_test_add_data_func("/hbitmap/next-zero", NULL, test_next_zero);
+    return g_test_run();
+}
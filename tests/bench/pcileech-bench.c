@@ -0,0 +1,923 @@
+/*
+ * pcileech throughput and latency benchmark
+ *
+ * Boots a qtest machine with a pcileech device and drives its socket
+ * protocol directly, reporting GiB/s and p50/p99 request latency for
+ * plain, scatter, small scatter and pipelined transfers. The scale cases
+ * boot a second machine with several devices, each with its own
+ * IOThread, and read from all of them at once to show how throughput
+ * grows with devices. The intel-iommu and virtio-iommu cases do the same
+ * behind an IOMMU that identity maps guest memory, so that every device
+ * translates its DMA. The config case polls the config header and walks
+ * the capability list of the device the way DMA detection agents do.
+ * The iommu-matrix cases read through intel-iommu with each combination
+ * of caching-mode, dma-drain, device-iotlb and strict or lazy guest
+ * invalidation, with some reads aimed at unmapped IOVAs, and report the
+ * throughput together with the translation faults and IOTLB hits.
+ *
+ * Run it against a QEMU binary, e.g.:
+ *   QTEST_QEMU_BINARY=./qemu-system-x86_64 ./tests/qtest/pcileech-bench
+ *
+ * With PCILEECH_BENCH_REPLAY set to a memory dump of at least 80 MiB, the
+ * device serves the dump instead of guest memory; writes then fail.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/sockets.h"
+#include "qemu/timer.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
+#include "hw/pci/pci_regs.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+#include "libqos/malloc-pc.h"
+#include "libqos/virtio.h"
+#include "libqos/virtio-pci.h"
+#include "standard-headers/linux/virtio_iommu.h"
+
+#define LEECH_REQUEST_READ          0
+#define LEECH_REQUEST_WRITE         1
+#define LEECH_REQUEST_NEGOTIATE     2
+#define LEECH_REQUEST_READ_SCATTER  3
+
+#define LEECH_FEATURE_OUT_OF_ORDER  (1ULL << 1)
+
+/* Guest memory touched by the benchmark. */
+#define BENCH_BASE          (16 * MiB)
+#define BENCH_SPAN          (64 * MiB)
+#define BENCH_SCATTER_SIZE  (4 * KiB)
+#define BENCH_SMALL_SIZE    64
+#define BENCH_DEPTH         16
+#define BENCH_TIME          0.5
+#define BENCH_MAX_DEVICES   8
+
+/*
+ * Guest RAM is shared with the benchmark, so that the IOMMU tables are
+ * written through qtest_memmap() instead of being hex encoded.
+ */
+#define BENCH_RAM_SIZE      (256 * MiB)
+#define BENCH_MAP_BASE      (1 * MiB)       /* Above the legacy holes */
+
+/* Identity mapped by the IOMMU cases. */
+#define BENCH_IOMMU_SPAN    (128 * MiB)
+#define BENCH_VIOMMU_MAP    (64 * KiB)      /* Size of each mapping */
+#define BENCH_VIOMMU_TIMEOUT_US (30 * 1000 * 1000)
+
+/* intel-iommu registers, and the guest memory its tables are put in. */
+#define VTD_BASE            0xfed90000ULL
+#define VTD_GCMD            0x18
+#define VTD_GSTS            0x1c
+#define VTD_RTADDR          0x20
+#define VTD_IOTLB           0xf8
+#define VTD_GCMD_TE         (1U << 31)
+#define VTD_GCMD_SRTP       (1U << 30)
+#define VTD_CONTEXT_DEV_IOTLB   (1ULL << 2)
+#define VTD_IOTLB_IVT       (1ULL << 63)
+#define VTD_IOTLB_DSI       (2ULL << 60)    /* Domain-selective */
+#define VTD_IOTLB_DR        (1ULL << 49)
+#define VTD_IOTLB_DW        (1ULL << 48)
+#define VTD_TABLES          (4 * MiB)
+#define VTD_PT_ENTRIES      512
+
+typedef struct LeechRequestHeader {
+    uint8_t command;
+    uint8_t reserved[3];
+    uint32_t tag;
+    uint64_t address;
+    uint64_t length;
+} LeechRequestHeader;
+
+typedef struct LeechResponseHeader {
+    uint32_t result;
+    uint32_t tag;
+    uint64_t length;
+} LeechResponseHeader;
+
+typedef struct LeechScatterEntry {
+    uint64_t address;
+    uint32_t length;
+    uint8_t reserved[4];
+} LeechScatterEntry;
+
+typedef struct LeechScatterResult {
+    uint32_t result;
+    uint32_t length;
+} LeechScatterResult;
+
+typedef enum BenchMode {
+    BENCH_READ,
+    BENCH_WRITE,
+    BENCH_SCATTER,
+    BENCH_PIPELINED,
+    BENCH_SCATTER_SMALL,
+} BenchMode;
+
+static const char *const bench_mode_names[] = {
+    [BENCH_READ] = "read",
+    [BENCH_WRITE] = "write",
+    [BENCH_SCATTER] = "scatter",
+    [BENCH_PIPELINED] = "pipelined",
+    [BENCH_SCATTER_SMALL] = "scatter-small",
+};
+
+typedef struct BenchCase {
+    BenchMode mode;
+    uint32_t chunk_size;
+    uint32_t request_size;
+} BenchCase;
+
+static const uint32_t chunk_sizes[] = { 4 * KiB, 64 * KiB, 1 * MiB };
+static const uint32_t request_sizes[] = { 4 * KiB, 64 * KiB, 1 * MiB };
+static const uint32_t scale_devices[] = { 1, 2, 4, BENCH_MAX_DEVICES };
+
+typedef enum ScaleIOMMU {
+    SCALE_NO_IOMMU,
+    SCALE_INTEL_IOMMU,
+    SCALE_VIRTIO_IOMMU,
+    SCALE_IOMMU__MAX,
+} ScaleIOMMU;
+
+static const char *const scale_iommu_names[] = {
+    [SCALE_NO_IOMMU] = "scale",
+    [SCALE_INTEL_IOMMU] = "intel-iommu",
+    [SCALE_VIRTIO_IOMMU] = "virtio-iommu",
+};
+
+typedef struct ScaleCase {
+    uint32_t devices;
+    ScaleIOMMU iommu;
+} ScaleCase;
+
+/*
+ * Settings of the iommu-matrix cases. Strict invalidation flushes the
+ * IOTLB after every request, like a guest that unmaps its DMA buffers
+ * at once; lazy invalidation batches MATRIX_LAZY_BATCH of them, like the
+ * flush queue of Linux. One request in MATRIX_FAULT_INTERVAL reads
+ * beyond the identity map, where translation fails.
+ */
+#define MATRIX_CACHING_MODE     (1U << 0)
+#define MATRIX_DMA_DRAIN        (1U << 1)
+#define MATRIX_DEVICE_IOTLB     (1U << 2)
+#define MATRIX_STRICT           (1U << 3)
+#define MATRIX__ALL             (1U << 4)
+#define MATRIX_LAZY_BATCH       256
+#define MATRIX_FAULT_INTERVAL   16
+#define MATRIX_REQUEST_SIZE     (64 * KiB)
+
+/* One client connection; the scale cases drive one per thread. */
+typedef struct BenchConn {
+    int fd;
+    uint8_t *buf;
+    uint64_t address;
+    uint64_t bytes;             /* Read by the scale thread */
+} BenchConn;
+
+static BenchConn bench_conn = { .fd = -1 };
+static QPCIDevice *bench_dev;
+static const char *bench_tmpdir;
+static const char *bench_replay_opt = "";
+/* GiB/sec of one device, for scaling */
+static double scale_single[SCALE_IOMMU__MAX];
+
+static void bench_send(BenchConn *conn, const void *buf, size_t len)
+{
+    g_assert_cmpint(qemu_write_full(conn->fd, buf, len), ==, len);
+}
+
+static void bench_recv(BenchConn *conn, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len) {
+        ssize_t ret = read(conn->fd, p, len);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(ret, >, 0);
+        p += ret;
+        len -= ret;
+    }
+}
+
+static void bench_request(BenchConn *conn, uint8_t command, uint32_t tag,
+                          uint64_t address, uint64_t length)
+{
+    LeechRequestHeader req = {
+        .command = command,
+        .tag = cpu_to_le32(tag),
+        .address = cpu_to_le64(address),
+        .length = cpu_to_le64(length),
+    };
+
+    bench_send(conn, &req, sizeof(req));
+}
+
+static void bench_response(BenchConn *conn, LeechResponseHeader *resp)
+{
+    bench_recv(conn, resp, sizeof(*resp));
+    resp->result = le32_to_cpu(resp->result);
+    resp->tag = le32_to_cpu(resp->tag);
+    resp->length = le64_to_cpu(resp->length);
+    g_assert_cmpuint(resp->result, ==, 0);
+}
+
+static void bench_negotiate(BenchConn *conn, uint32_t chunk_size,
+                            uint64_t features)
+{
+    LeechResponseHeader resp;
+
+    bench_request(conn, LEECH_REQUEST_NEGOTIATE, 0, features, chunk_size);
+    bench_response(conn, &resp);
+    bench_recv(conn, conn->buf, resp.length);
+}
+
+/* Spread the requests over guest memory so that caches don't lie. */
+static uint64_t bench_next_address(BenchConn *conn, uint64_t length)
+{
+    uint64_t address;
+
+    if (conn->address + length > BENCH_SPAN) {
+        conn->address = 0;
+    }
+    address = BENCH_BASE + conn->address;
+    conn->address += length;
+    return address;
+}
+
+static void bench_read(BenchConn *conn, const BenchCase *c)
+{
+    uint64_t remaining = c->request_size;
+    LeechResponseHeader resp;
+
+    bench_request(conn, LEECH_REQUEST_READ, 1,
+                  bench_next_address(conn, c->request_size),
+                  c->request_size);
+    while (remaining) {
+        bench_response(conn, &resp);
+        g_assert_cmpuint(resp.tag, ==, 1);
+        g_assert_cmpuint(resp.length, <=, remaining);
+        bench_recv(conn, conn->buf, resp.length);
+        remaining -= resp.length;
+    }
+}
+
+static void bench_write(BenchConn *conn, const BenchCase *c)
+{
+    uint32_t frames = DIV_ROUND_UP(c->request_size, c->chunk_size);
+    LeechResponseHeader resp;
+
+    bench_request(conn, LEECH_REQUEST_WRITE, 1,
+                  bench_next_address(conn, c->request_size),
+                  c->request_size);
+    bench_send(conn, conn->buf, c->request_size);
+    while (frames--) {
+        bench_response(conn, &resp);
+        g_assert_cmpuint(resp.tag, ==, 1);
+    }
+}
+
+/*
+ * Sends one scatter entry per page of the request. Plain entries read
+ * every other page, like a sparse page table walk. Small entries read
+ * BENCH_SMALL_SIZE bytes back to back, so address translation dominates.
+ * Returns the number of bytes read.
+ */
+static uint64_t bench_scatter(BenchConn *conn, const BenchCase *c)
+{
+    uint32_t count = c->request_size / BENCH_SCATTER_SIZE;
+    uint32_t size = c->mode == BENCH_SCATTER_SMALL ? BENCH_SMALL_SIZE
+                                                   : BENCH_SCATTER_SIZE;
+    uint32_t stride = c->mode == BENCH_SCATTER_SMALL ? size : 2 * size;
+    g_autofree LeechScatterEntry *entries = g_new0(LeechScatterEntry, count);
+    LeechResponseHeader resp;
+
+    for (uint32_t i = 0; i < count; i++) {
+        entries[i].address = cpu_to_le64(bench_next_address(conn, stride));
+        entries[i].length = cpu_to_le32(size);
+    }
+    bench_request(conn, LEECH_REQUEST_READ_SCATTER, 1, 0, count);
+    bench_send(conn, entries, count * sizeof(*entries));
+    bench_response(conn, &resp);
+    for (uint32_t i = 0; i < count; i++) {
+        LeechScatterResult result;
+        bench_recv(conn, &result, sizeof(result));
+        g_assert_cmpuint(le32_to_cpu(result.result), ==, 0);
+        bench_recv(conn, conn->buf, le32_to_cpu(result.length));
+    }
+    return (uint64_t)count * size;
+}
+
+/* Keeps BENCH_DEPTH reads in flight; returns when all of them are done. */
+static void bench_pipelined(BenchConn *conn, const BenchCase *c,
+                            GArray *latencies)
+{
+    uint64_t remaining[BENCH_DEPTH];
+    int64_t start = get_clock();
+    int pending = BENCH_DEPTH;
+    LeechResponseHeader resp;
+
+    for (uint32_t tag = 0; tag < BENCH_DEPTH; tag++) {
+        remaining[tag] = c->request_size;
+        bench_request(conn, LEECH_REQUEST_READ, tag,
+                      bench_next_address(conn, c->request_size),
+                      c->request_size);
+    }
+    while (pending) {
+        bench_response(conn, &resp);
+        g_assert_cmpuint(resp.tag, <, BENCH_DEPTH);
+        g_assert_cmpuint(resp.length, <=, remaining[resp.tag]);
+        bench_recv(conn, conn->buf, resp.length);
+        remaining[resp.tag] -= resp.length;
+        if (!remaining[resp.tag]) {
+            double ns = get_clock() - start;
+            g_array_append_val(latencies, ns);
+            pending--;
+        }
+    }
+}
+
+static int bench_compare(const void *a, const void *b)
+{
+    const double *x = a, *y = b;
+
+    return *x < *y ? -1 : *x > *y;
+}
+
+static double bench_percentile(GArray *latencies, unsigned percent)
+{
+    return g_array_index(latencies, double,
+                         (latencies->len - 1) * percent / 100) / 1000.0;
+}
+
+static void test_bench(const void *opaque)
+{
+    const BenchCase *c = opaque;
+    g_autoptr(GArray) latencies = g_array_new(false, false, sizeof(double));
+    uint64_t bytes = 0;
+
+    BenchConn *conn = &bench_conn;
+
+    bench_negotiate(conn, c->chunk_size, c->mode == BENCH_PIPELINED ?
+                                         LEECH_FEATURE_OUT_OF_ORDER : 0);
+    g_test_timer_start();
+    do {
+        int64_t start = get_clock();
+        uint64_t done = c->request_size;
+        double ns;
+
+        switch (c->mode) {
+        case BENCH_READ:
+            bench_read(conn, c);
+            break;
+        case BENCH_WRITE:
+            bench_write(conn, c);
+            break;
+        case BENCH_SCATTER:
+        case BENCH_SCATTER_SMALL:
+            done = bench_scatter(conn, c);
+            break;
+        case BENCH_PIPELINED:
+            bench_pipelined(conn, c, latencies);
+            bytes += (uint64_t)c->request_size * BENCH_DEPTH;
+            continue;
+        }
+        ns = get_clock() - start;
+        g_array_append_val(latencies, ns);
+        bytes += done;
+    } while (g_test_timer_elapsed() < BENCH_TIME);
+
+    g_array_sort(latencies, bench_compare);
+    g_test_message("%-9s chunk %5uKB request %5uKB: %6.3f GiB/sec, "
+                   "p50 %9.1f us, p99 %9.1f us",
+                   bench_mode_names[c->mode], c->chunk_size / (unsigned)KiB,
+                   c->request_size / (unsigned)KiB,
+                   bytes / g_test_timer_last() / GiB,
+                   bench_percentile(latencies, 50),
+                   bench_percentile(latencies, 99));
+}
+
+static void bench_add(BenchMode mode, uint32_t chunk_size,
+                      uint32_t request_size)
+{
+    BenchCase *c = g_new(BenchCase, 1);
+    g_autofree char *path = NULL;
+
+    c->mode = mode;
+    c->chunk_size = chunk_size;
+    c->request_size = request_size;
+    path = g_strdup_printf("/pcileech/%s/chunk-%uK/request-%uK",
+                           bench_mode_names[mode], chunk_size / (unsigned)KiB,
+                           request_size / (unsigned)KiB);
+    g_test_add_data_func_full(path, c, test_bench, g_free);
+}
+
+static void test_config(const void *opaque)
+{
+    QPCIDevice *dev = bench_dev;
+    uint64_t accesses = 0;
+
+    g_test_timer_start();
+    do {
+        uint8_t pos;
+
+        qpci_config_readl(dev, PCI_VENDOR_ID);
+        qpci_config_readw(dev, PCI_STATUS);
+        pos = qpci_config_readb(dev, PCI_CAPABILITY_LIST);
+        accesses += 3;
+        while (pos) {
+            qpci_config_readb(dev, pos + PCI_CAP_LIST_ID);
+            pos = qpci_config_readb(dev, pos + PCI_CAP_LIST_NEXT);
+            accesses += 2;
+        }
+    } while (g_test_timer_elapsed() < BENCH_TIME);
+
+    g_test_message("config    %" PRIu64 " accesses: %8.1f ns per access",
+                   accesses,
+                   g_test_timer_last() * NANOSECONDS_PER_SECOND / accesses);
+}
+
+/* Reads 1 MiB requests in 1 MiB frames for BENCH_TIME seconds. */
+static gpointer scale_thread(gpointer opaque)
+{
+    const BenchCase c = {
+        .mode = BENCH_READ,
+        .chunk_size = 1 * MiB,
+        .request_size = 1 * MiB,
+    };
+    const int64_t end = get_clock() + BENCH_TIME * NANOSECONDS_PER_SECOND;
+    BenchConn *conn = opaque;
+
+    bench_negotiate(conn, c.chunk_size, 0);
+    while (get_clock() < end) {
+        bench_read(conn, &c);
+        conn->bytes += c.request_size;
+    }
+    return NULL;
+}
+
+/*
+ * Point the context entries of all devfns on bus 0 at page tables that
+ * identity map BENCH_IOMMU_SPAN bytes of guest memory with 4K pages, then
+ * enable DMA remapping. With @device_iotlb, the context entries allow
+ * ATS translation requests too.
+ */
+static void bench_enable_iommu(QTestState *qts, bool device_iotlb)
+{
+    const uint64_t root = VTD_TABLES;
+    const uint64_t context = root + 4 * KiB;
+    const uint64_t l3 = context + 4 * KiB;
+    const uint64_t l2 = l3 + 4 * KiB;
+    const uint64_t l1 = l2 + 4 * KiB;
+    const uint32_t tables = BENCH_IOMMU_SPAN / (VTD_PT_ENTRIES * 4 * KiB);
+    g_autofree uint64_t *ptes = g_new0(uint64_t, VTD_PT_ENTRIES);
+
+    qtest_writeq(qts, root, context | 1);
+    for (uint32_t devfn = 0; devfn < 256; devfn++) {
+        /* Present, multi-level translation of domain 1 with 3 levels */
+        qtest_writeq(qts, context + devfn * 16,
+                     l3 | (device_iotlb ? VTD_CONTEXT_DEV_IOTLB : 0) | 1);
+        qtest_writeq(qts, context + devfn * 16 + 8, 1 << 8 | 1);
+    }
+    qtest_writeq(qts, l3, l2 | 3);
+    for (uint32_t i = 0; i < tables; i++) {
+        ptes[i] = cpu_to_le64((l1 + i * 4 * KiB) | 3);
+    }
+    qtest_memwrite(qts, l2, ptes, tables * sizeof(ptes[0]));
+    for (uint32_t i = 0; i < tables; i++) {
+        for (uint32_t j = 0; j < VTD_PT_ENTRIES; j++) {
+            ptes[j] = cpu_to_le64(((uint64_t)i * VTD_PT_ENTRIES + j) *
+                                  4 * KiB | 3);
+        }
+        qtest_memwrite(qts, l1 + i * 4 * KiB, ptes,
+                       VTD_PT_ENTRIES * sizeof(ptes[0]));
+    }
+
+    qtest_writeq(qts, VTD_BASE + VTD_RTADDR, root);
+    qtest_writel(qts, VTD_BASE + VTD_GCMD, VTD_GCMD_SRTP);
+    qtest_writel(qts, VTD_BASE + VTD_GCMD, VTD_GCMD_TE);
+    g_assert(qtest_readl(qts, VTD_BASE + VTD_GSTS) & VTD_GCMD_TE);
+}
+
+/* Sends one request to virtio-iommu and returns the status of its tail. */
+static uint8_t bench_viommu_request(QTestState *qts, QVirtioDevice *vdev,
+                                    QVirtQueue *vq, QGuestAllocator *alloc,
+                                    const void *req, size_t size)
+{
+    size_t ro_size = size - sizeof(struct virtio_iommu_req_tail);
+    uint64_t ro_addr = guest_alloc(alloc, ro_size);
+    uint64_t wr_addr = guest_alloc(alloc,
+                                   sizeof(struct virtio_iommu_req_tail));
+    struct virtio_iommu_req_tail tail;
+    uint32_t head;
+
+    qtest_memwrite(qts, ro_addr, req, ro_size);
+    head = qvirtqueue_add(qts, vq, ro_addr, ro_size, false, true);
+    qvirtqueue_add(qts, vq, wr_addr, sizeof(tail), true, false);
+    qvirtqueue_kick(qts, vdev, vq, head);
+    qvirtio_wait_used_elem(qts, vdev, vq, head, NULL,
+                           BENCH_VIOMMU_TIMEOUT_US);
+    qtest_memread(qts, wr_addr, &tail, sizeof(tail));
+    guest_free(alloc, ro_addr);
+    guest_free(alloc, wr_addr);
+    return tail.status;
+}
+
+/*
+ * Attach the pcileech devices to one domain of the virtio-iommu at
+ * 03.0, which identity maps BENCH_IOMMU_SPAN bytes of guest memory in
+ * BENCH_VIOMMU_MAP mappings.
+ */
+static void bench_enable_viommu(QTestState *qts, QPCIBus *bus,
+                                uint32_t devices)
+{
+    QPCIAddress addr = { .devfn = QPCI_DEVFN(3, 0) };
+    QVirtioPCIDevice vpci = {};
+    QVirtioDevice *vdev = &vpci.vdev;
+    QGuestAllocator alloc;
+    QVirtQueue *vq;
+    uint64_t features;
+
+    pc_alloc_init(&alloc, qts, 0);
+    virtio_pci_init(&vpci, bus, &addr);
+    qvirtio_pci_start_hw(&vpci.obj);
+    features = qvirtio_get_features(vdev);
+    features &= ~(QVIRTIO_F_BAD_FEATURE |
+                  (1ull << VIRTIO_RING_F_INDIRECT_DESC) |
+                  (1ull << VIRTIO_RING_F_EVENT_IDX));
+    qvirtio_set_features(vdev, features);
+    vq = qvirtqueue_setup(vdev, &alloc, 0);
+    qvirtio_set_driver_ok(vdev);
+
+    for (uint32_t i = 0; i < devices; i++) {
+        struct virtio_iommu_req_attach req = {
+            .head.type = VIRTIO_IOMMU_T_ATTACH,
+            .domain = cpu_to_le32(1),
+            .endpoint = cpu_to_le32(QPCI_DEVFN(4 + i, 0)),
+        };
+
+        g_assert_cmpint(bench_viommu_request(qts, vdev, vq, &alloc, &req,
+                                             sizeof(req)), ==,
+                        VIRTIO_IOMMU_S_OK);
+    }
+    for (uint64_t iova = 0; iova < BENCH_IOMMU_SPAN;
+         iova += BENCH_VIOMMU_MAP) {
+        struct virtio_iommu_req_map req = {
+            .head.type = VIRTIO_IOMMU_T_MAP,
+            .domain = cpu_to_le32(1),
+            .virt_start = cpu_to_le64(iova),
+            .virt_end = cpu_to_le64(iova + BENCH_VIOMMU_MAP - 1),
+            .phys_start = cpu_to_le64(iova),
+            .flags = cpu_to_le32(VIRTIO_IOMMU_MAP_F_READ |
+                                 VIRTIO_IOMMU_MAP_F_WRITE),
+        };
+
+        g_assert_cmpint(bench_viommu_request(qts, vdev, vq, &alloc, &req,
+                                             sizeof(req)), ==,
+                        VIRTIO_IOMMU_S_OK);
+    }
+
+    /* The mappings stay when the driver goes away */
+    qvirtqueue_cleanup(vdev->bus, vq, &alloc);
+    qvirtio_pci_destructor(&vpci.obj);
+    alloc_destroy(&alloc);
+}
+
+/*
+ * Each device has its own IOThread, chardev and DMA address space, so
+ * nothing but the host's memory bandwidth and cores should be shared;
+ * behind the IOMMU, they also share its IOTLB.
+ */
+static void test_scale(const void *opaque)
+{
+    const ScaleCase *sc = opaque;
+    const uint32_t devices = sc->devices;
+    g_autoptr(GString) args = g_string_new("-m 256M");
+    BenchConn conns[BENCH_MAX_DEVICES];
+    GThread *threads[BENCH_MAX_DEVICES];
+    QPCIDevice *devs[BENCH_MAX_DEVICES];
+    char *socks[BENCH_MAX_DEVICES];
+    uint64_t bytes = 0;
+    QTestState *qts;
+    QPCIBus *bus;
+    int64_t start;
+    double total;
+
+#ifdef CONFIG_LINUX
+    g_string_append(args, " -object memory-backend-memfd,id=ram,size=256M,"
+                    "share=on -machine memory-backend=ram");
+#endif
+    /* The IOMMU must exist before the devices behind it */
+    if (sc->iommu == SCALE_INTEL_IOMMU) {
+        g_string_append(args, " -machine q35"
+                        " -device intel-iommu,intremap=off,aw-bits=39");
+    } else if (sc->iommu == SCALE_VIRTIO_IOMMU) {
+        g_string_append(args, " -machine q35"
+                        " -device virtio-iommu-pci,addr=03.0");
+    }
+    for (uint32_t i = 0; i < devices; i++) {
+        socks[i] = g_strdup_printf("%s/scale%u.sock", bench_tmpdir, i);
+        g_string_append_printf(args,
+                               " -object iothread,id=io%u"
+                               " -chardev socket,id=leech%u,path=%s,"
+                               "server=on,wait=off"
+                               " -device pcileech,addr=%02x.0,"
+                               "chardev=leech%u,iothread=io%u,"
+                               "chunk-size=1M%s",
+                               i, i, socks[i], 4 + i, i, i,
+                               bench_replay_opt);
+    }
+    qts = qtest_init(args->str);
+    qtest_memmap(qts, BENCH_MAP_BASE, BENCH_RAM_SIZE - BENCH_MAP_BASE);
+    if (sc->iommu == SCALE_INTEL_IOMMU) {
+        bench_enable_iommu(qts, false);
+    }
+    bus = qpci_new_pc(qts, NULL);
+    if (sc->iommu == SCALE_VIRTIO_IOMMU) {
+        bench_enable_viommu(qts, bus, devices);
+    }
+    for (uint32_t i = 0; i < devices; i++) {
+        devs[i] = qpci_device_find(bus, QPCI_DEVFN(4 + i, 0));
+        g_assert(devs[i]);
+        qpci_device_enable(devs[i]);
+        conns[i] = (BenchConn) {
+            .fd = unix_connect(socks[i], &error_abort),
+            .buf = g_malloc0(1 * MiB),
+        };
+    }
+
+    start = get_clock();
+    for (uint32_t i = 0; i < devices; i++) {
+        threads[i] = g_thread_new("pcileech-scale", scale_thread, &conns[i]);
+    }
+    for (uint32_t i = 0; i < devices; i++) {
+        g_thread_join(threads[i]);
+        bytes += conns[i].bytes;
+    }
+    total = bytes / ((get_clock() - start) / (double)NANOSECONDS_PER_SECOND) /
+            GiB;
+    if (devices == 1) {
+        scale_single[sc->iommu] = total;
+    }
+    g_test_message("%-9s %u devices: %6.3f GiB/sec, %6.3f GiB/sec per "
+                   "device, %3.0f%% of linear",
+                   scale_iommu_names[sc->iommu], devices, total,
+                   total / devices,
+                   scale_single[sc->iommu] ?
+                   100 * total / (devices * scale_single[sc->iommu]) : 100.0);
+
+    for (uint32_t i = 0; i < devices; i++) {
+        close(conns[i].fd);
+        g_free(conns[i].buf);
+        g_free(devs[i]);
+        unlink(socks[i]);
+        g_free(socks[i]);
+    }
+    qpci_free_pc(bus);
+    qtest_quit(qts);
+}
+
+/* Invalidate the IOTLB entries of domain 1, as a guest does on unmap. */
+static void bench_iommu_invalidate(QTestState *qts, bool drain)
+{
+    uint64_t cmd = VTD_IOTLB_IVT | VTD_IOTLB_DSI | 1ULL << 32;
+
+    if (drain) {
+        cmd |= VTD_IOTLB_DR | VTD_IOTLB_DW;
+    }
+    qtest_writeq(qts, VTD_BASE + VTD_IOTLB, cmd);
+    g_assert(!(qtest_readq(qts, VTD_BASE + VTD_IOTLB) & VTD_IOTLB_IVT));
+}
+
+/* Statistic @name of the intel-iommu at @path, over all devices. */
+static uint64_t bench_iommu_stat(QTestState *qts, const char *path,
+                                 const char *name)
+{
+    QDict *rsp = qtest_qmp(qts,
+        "{ 'execute': 'query-stats',"
+        "  'arguments': { 'target': 'iommu',"
+        "                 'providers': [ { 'provider': 'iommu',"
+        "                                  'names': [ %s ] } ] } }", name);
+    QListEntry *entry;
+    uint64_t value = 0;
+
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(rsp, "return"), entry) {
+        QDict *result = qobject_to(QDict, qlist_entry_obj(entry));
+        QDict *stat;
+
+        if (strcmp(qdict_get_str(result, "qom-path"), path)) {
+            continue;
+        }
+        stat = qobject_to(QDict, qlist_peek(qdict_get_qlist(result,
+                                                            "stats")));
+        value = qnum_get_uint(qobject_to(QNum, qdict_get(stat, "value")));
+    }
+    qobject_unref(rsp);
+    return value;
+}
+
+/*
+ * Like bench_read(), but counts the frames that fail instead of
+ * asserting; their data is garbage. Returns the bytes read fine.
+ */
+static uint64_t bench_read_faulting(BenchConn *conn, uint64_t address,
+                                    uint64_t length, uint64_t *faults)
+{
+    uint64_t remaining = length, good = 0;
+    LeechResponseHeader resp;
+
+    bench_request(conn, LEECH_REQUEST_READ, 1, address, length);
+    while (remaining) {
+        bench_recv(conn, &resp, sizeof(resp));
+        resp.length = le64_to_cpu(resp.length);
+        g_assert_cmpuint(le32_to_cpu(resp.tag), ==, 1);
+        g_assert_cmpuint(resp.length, <=, remaining);
+        bench_recv(conn, conn->buf, resp.length);
+        if (resp.result) {
+            (*faults)++;
+        } else {
+            good += resp.length;
+        }
+        remaining -= resp.length;
+    }
+    return good;
+}
+
+static void test_iommu_matrix(const void *opaque)
+{
+    const uint32_t flags = GPOINTER_TO_UINT(opaque);
+    const BenchCase c = {
+        .mode = BENCH_READ,
+        .chunk_size = MATRIX_REQUEST_SIZE,
+        .request_size = MATRIX_REQUEST_SIZE,
+    };
+    g_autofree char *sock = g_strdup_printf("%s/matrix.sock", bench_tmpdir);
+    g_autoptr(GString) args = g_string_new("-m 256M -machine q35");
+    const char *vtd = "/machine/peripheral/vtd";
+    BenchConn conn = { .buf = g_malloc0(MATRIX_REQUEST_SIZE) };
+    uint64_t bytes = 0, faults = 0, requests = 0;
+    uint64_t translations, iotlb_hits;
+    QTestState *qts;
+    QPCIBus *bus;
+    QPCIDevice *dev;
+
+#ifdef CONFIG_LINUX
+    g_string_append(args, " -object memory-backend-memfd,id=ram,size=256M,"
+                    "share=on -machine memory-backend=ram");
+#endif
+    g_string_append_printf(args,
+                           " -device intel-iommu,id=vtd,intremap=off,"
+                           "aw-bits=39,caching-mode=%s,dma-drain=%s,"
+                           "device-iotlb=%s"
+                           " -object iothread,id=io0"
+                           " -chardev socket,id=leech,path=%s,server=on,"
+                           "wait=off"
+                           " -device pcileech,addr=04.0,chardev=leech,"
+                           "iothread=io0,chunk-size=1M",
+                           flags & MATRIX_CACHING_MODE ? "on" : "off",
+                           flags & MATRIX_DMA_DRAIN ? "on" : "off",
+                           flags & MATRIX_DEVICE_IOTLB ? "on" : "off", sock);
+    qts = qtest_init(args->str);
+    qtest_memmap(qts, BENCH_MAP_BASE, BENCH_RAM_SIZE - BENCH_MAP_BASE);
+    bench_enable_iommu(qts, flags & MATRIX_DEVICE_IOTLB);
+    bus = qpci_new_pc(qts, NULL);
+    dev = qpci_device_find(bus, QPCI_DEVFN(4, 0));
+    g_assert(dev);
+    qpci_device_enable(dev);
+    conn.fd = unix_connect(sock, &error_abort);
+    bench_negotiate(&conn, c.chunk_size, 0);
+
+    g_test_timer_start();
+    do {
+        uint64_t address = bench_next_address(&conn, c.request_size);
+
+        if (++requests % MATRIX_FAULT_INTERVAL == 0) {
+            /* Same offset, but outside of the identity map */
+            address += BENCH_IOMMU_SPAN;
+        }
+        bytes += bench_read_faulting(&conn, address, c.request_size,
+                                     &faults);
+        if ((flags & MATRIX_STRICT) || requests % MATRIX_LAZY_BATCH == 0) {
+            bench_iommu_invalidate(qts, flags & MATRIX_DMA_DRAIN);
+        }
+    } while (g_test_timer_elapsed() < BENCH_TIME);
+
+    translations = bench_iommu_stat(qts, vtd, "translations");
+    iotlb_hits = bench_iommu_stat(qts, vtd, "iotlb-hits");
+    g_test_message("caching-mode %-3s dma-drain %-3s device-iotlb %-3s %-6s: "
+                   "%6.3f GiB/sec, %" PRIu64 " faulted frames, "
+                   "%" PRIu64 " translation faults, %3.0f%% IOTLB hits",
+                   flags & MATRIX_CACHING_MODE ? "on" : "off",
+                   flags & MATRIX_DMA_DRAIN ? "on" : "off",
+                   flags & MATRIX_DEVICE_IOTLB ? "on" : "off",
+                   flags & MATRIX_STRICT ? "strict" : "lazy",
+                   bytes / g_test_timer_last() / GiB, faults,
+                   bench_iommu_stat(qts, vtd, "faults"),
+                   translations ? 100.0 * iotlb_hits / translations : 0.0);
+
+    close(conn.fd);
+    g_free(conn.buf);
+    g_free(dev);
+    qpci_free_pc(bus);
+    qtest_quit(qts);
+    unlink(sock);
+}
+
+int main(int argc, char **argv)
+{
+    g_autofree char *tmpdir = g_dir_make_tmp("pcileech-bench-XXXXXX", NULL);
+    g_autofree char *sock = g_build_filename(tmpdir, "leech.sock", NULL);
+    const char *replay = g_getenv("PCILEECH_BENCH_REPLAY");
+    g_autofree char *replay_opt = NULL;
+    BenchConn *conn = &bench_conn;
+    QTestState *qts;
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    int ret;
+
+    g_test_init(&argc, &argv, NULL);
+    if (!qtest_has_device("pcileech")) {
+        g_test_skip("pcileech device not available");
+        return g_test_run();
+    }
+
+    for (int m = BENCH_READ; m <= BENCH_SCATTER_SMALL; m++) {
+        if (replay && m == BENCH_WRITE) {
+            continue;
+        }
+        for (int i = 0; i < ARRAY_SIZE(chunk_sizes); i++) {
+            for (int j = 0; j < ARRAY_SIZE(request_sizes); j++) {
+                bench_add(m, chunk_sizes[i], request_sizes[j]);
+            }
+        }
+    }
+    g_test_add_data_func("/pcileech/config", NULL, test_config);
+    for (int iommu = 0; iommu < SCALE_IOMMU__MAX; iommu++) {
+        if (iommu != SCALE_NO_IOMMU &&
+            !qtest_has_device(iommu == SCALE_INTEL_IOMMU ?
+                              "intel-iommu" : "virtio-iommu-pci")) {
+            continue;
+        }
+        for (int i = 0; i < ARRAY_SIZE(scale_devices); i++) {
+            ScaleCase *sc = g_new(ScaleCase, 1);
+            g_autofree char *path =
+                g_strdup_printf("/pcileech/%s/devices-%u",
+                                scale_iommu_names[iommu], scale_devices[i]);
+
+            sc->devices = scale_devices[i];
+            sc->iommu = iommu;
+            g_test_add_data_func_full(path, sc, test_scale, g_free);
+        }
+    }
+    if (qtest_has_device("intel-iommu")) {
+        for (uint32_t flags = 0; flags < MATRIX__ALL; flags++) {
+            g_autofree char *path =
+                g_strdup_printf("/pcileech/iommu-matrix/caching-mode-%s/"
+                                "dma-drain-%s/device-iotlb-%s/%s",
+                                flags & MATRIX_CACHING_MODE ? "on" : "off",
+                                flags & MATRIX_DMA_DRAIN ? "on" : "off",
+                                flags & MATRIX_DEVICE_IOTLB ? "on" : "off",
+                                flags & MATRIX_STRICT ? "strict" : "lazy");
+
+            g_test_add_data_func(path, GUINT_TO_POINTER(flags),
+                                 test_iommu_matrix);
+        }
+    }
+
+    replay_opt = replay ? g_strdup_printf(",replay=%s", replay) : g_strdup("");
+    bench_tmpdir = tmpdir;
+    bench_replay_opt = replay_opt;
+    qts = qtest_initf("-m 256M "
+                      "-chardev socket,id=leech,path=%s,server=on,wait=off "
+                      "-device pcileech,addr=04.0,chardev=leech,"
+                      "chunk-size=1M,queue-depth=%d%s", sock, BENCH_DEPTH,
+                      replay_opt);
+    /* DMA goes nowhere until the device is a bus master. */
+    bus = qpci_new_pc(qts, NULL);
+    dev = qpci_device_find(bus, QPCI_DEVFN(0x4, 0x0));
+    g_assert(dev);
+    qpci_device_enable(dev);
+    bench_dev = dev;
+
+    conn->fd = unix_connect(sock, &error_abort);
+    conn->buf = g_malloc0(MAX(chunk_sizes[ARRAY_SIZE(chunk_sizes) - 1],
+                              request_sizes[ARRAY_SIZE(request_sizes) - 1]));
+
+    ret = g_test_run();
+
+    close(conn->fd);
+    g_free(conn->buf);
+    g_free(dev);
+    qpci_free_pc(bus);
+    qtest_quit(qts);
+    unlink(sock);
+    rmdir(tmpdir);
+    return ret;
+}
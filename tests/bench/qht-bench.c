@@ -11,6 +11,7 @@
 #include "qemu/rcu.h"
 #include "qemu/xxhash.h"
 #include "qemu/memalign.h"
+#include "qemu/timer.h"
 
 struct thread_stats {
     size_t rd;
@@ -21,6 +22,9 @@ struct thread_stats {
     size_t not_rm;
     size_t rz;
     size_t not_rz;
+    int64_t rz_ns;
+    int64_t rz_max_ns;
+    int64_t update_max_ns;
 };
 
 struct thread_info {
@@ -61,6 +65,7 @@ static double resize_rate; /* 0.0 to 1.0 */
 static unsigned int n_rz_threads = 1;
 static QemuThread *rz_threads;
 static bool precompute_hash;
+static bool measure_latency;
 
 static double update_rate; /* 0.0 to 1.0 */
 static uint64_t update_threshold;
@@ -93,7 +98,9 @@ static const char commands_string[] =
     " -R = enable auto-resize\n"
     " -S = resize rate (0.0 to 100.0)\n"
     " -D = delay (in us) between potential resizes\n"
-    " -N = number of resize threads";
+    " -N = number of resize threads\n"
+    "\n"
+    " -L = measure the latency of updates, e.g. while resizing";
 
 static void usage_complete(int argc, char *argv[])
 {
@@ -142,13 +149,17 @@ static void do_rz(struct thread_info *info)
 
     if (r < resize_threshold) {
         size_t size = info->resize_down ? resize_min : resize_max;
+        int64_t t = get_clock();
         bool resized;
 
         resized = qht_resize(&ht, size);
         info->resize_down = !info->resize_down;
 
         if (resized) {
+            t = get_clock() - t;
             stats->rz++;
+            stats->rz_ns += t;
+            stats->rz_max_ns = MAX(stats->rz_max_ns, t);
         } else {
             stats->not_rz++;
         }
@@ -175,6 +186,8 @@ static void do_rw(struct thread_info *info)
             stats->not_rd++;
         }
     } else {
+        int64_t t = measure_latency ? get_clock() : 0;
+
         p = &keys[r & (update_range - 1)];
         hash = hfunc(*p);
         if (info->write_op) {
@@ -201,6 +214,9 @@ static void do_rw(struct thread_info *info)
             }
         }
         info->write_op = !info->write_op;
+        if (measure_latency) {
+            stats->update_max_ns = MAX(stats->update_max_ns, get_clock() - t);
+        }
     }
 }
 
@@ -282,6 +298,7 @@ static void pr_params(void)
         printf(" # resize threads   %u\n", n_rz_threads);
     }
     printf(" update rate:       %f%%\n", update_rate * 100.0);
+    printf(" update latency:    %s\n", measure_latency ? "on" : "off");
     printf(" offset:            %ld\n", populate_offset);
     printf(" initial key range: %zu\n", init_range);
     printf(" lookup range:      %lu\n", lookup_range);
@@ -384,6 +401,9 @@ static void add_stats(struct thread_stats *s, struct thread_info *info, int n)
 
         s->rz += stats->rz;
         s->not_rz += stats->not_rz;
+        s->rz_ns += stats->rz_ns;
+        s->rz_max_ns = MAX(s->rz_max_ns, stats->rz_max_ns);
+        s->update_max_ns = MAX(s->update_max_ns, stats->update_max_ns);
     }
 }
 
@@ -400,6 +420,9 @@ static void pr_stats(void)
     if (resize_rate) {
         printf(" Resizes:           %zu (%.2f%% of %zu)\n",
                s.rz, (double)s.rz / (s.rz + s.not_rz) * 100, s.rz + s.not_rz);
+        printf(" Resize time:       %.3f ms avg, %.3f ms max\n",
+               s.rz ? (double)s.rz_ns / s.rz / 1e6 : 0,
+               (double)s.rz_max_ns / 1e6);
     }
 
     printf(" Read:              %.2f M (%.2f%% of %.2fM)\n",
@@ -418,6 +441,9 @@ static void pr_stats(void)
     tx = (s.rd + s.not_rd + s.in + s.not_in + s.rm + s.not_rm) / 1e6 / duration;
     printf(" Throughput:        %.2f MT/s\n", tx);
     printf(" Throughput/thread: %.2f MT/s/thread\n", tx / n_rw_threads);
+    if (measure_latency) {
+        printf(" Max update time:   %.2f us\n", (double)s.update_max_ns / 1e3);
+    }
 }
 
 static void run_test(void)
@@ -445,7 +471,7 @@ static void parse_args(int argc, char *argv[])
     int c;
 
     for (;;) {
-        c = getopt(argc, argv, "d:D:g:k:K:l:hn:N:o:pr:Rs:S:u:");
+        c = getopt(argc, argv, "d:D:g:k:K:l:Lhn:N:o:pr:Rs:S:u:");
         if (c < 0) {
             break;
         }
@@ -475,6 +501,9 @@ static void parse_args(int argc, char *argv[])
         case 'l':
             lookup_range = pow2ceil(atol(optarg));
             break;
+        case 'L':
+            measure_latency = true;
+            break;
         case 'n':
             n_rw_threads = atoi(optarg);
             break;
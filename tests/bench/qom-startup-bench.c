@@ -0,0 +1,91 @@
+/*
+ * Startup time with many -device options
+ *
+ * Boots a qtest machine with a given number of PCI devices on the command
+ * line, half a dozen times, and reports how long it takes from spawning
+ * QEMU until the machine answers its first guest memory access.  This
+ * covers option parsing, QOM object creation and property setting, and
+ * realize of every device, which is what grows with the device count.
+ *
+ * The devices are pci-testdev functions behind pci-bridges, 31 per
+ * bridge, the bridges counting as devices too.
+ *
+ * Run it against a QEMU binary, e.g.:
+ *   QTEST_QEMU_BINARY=./qemu-system-x86_64 ./tests/qtest/qom-startup-bench
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/timer.h"
+#include "libqtest.h"
+
+#define BENCH_RUNS              6
+#define BENCH_DEVS_PER_BRIDGE   31
+#define BENCH_FIRST_BRIDGE_SLOT 0x08
+
+static const unsigned bench_devices[] = { 1, 64, 256 };
+
+static char *bench_args(unsigned devices)
+{
+    unsigned bridges = DIV_ROUND_UP(devices, BENCH_DEVS_PER_BRIDGE + 1);
+    GString *args = g_string_new("-machine pc -nodefaults");
+
+    for (unsigned i = 0; i < bridges; i++) {
+        g_string_append_printf(args,
+                               " -device pci-bridge,id=br%u,chassis_nr=%u,"
+                               "bus=pci.0,addr=%02x.0",
+                               i, i + 1, BENCH_FIRST_BRIDGE_SLOT + i);
+    }
+    for (unsigned i = 0; i < devices - bridges; i++) {
+        g_string_append_printf(args,
+                               " -device pci-testdev,bus=br%u,addr=%02x.0",
+                               i / BENCH_DEVS_PER_BRIDGE,
+                               i % BENCH_DEVS_PER_BRIDGE);
+    }
+    return g_string_free(args, false);
+}
+
+static void test_startup(const void *opaque)
+{
+    unsigned devices = GPOINTER_TO_UINT(opaque);
+    g_autofree char *args = bench_args(devices);
+    int64_t best = INT64_MAX, total = 0;
+
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        int64_t start = get_clock();
+        QTestState *qts = qtest_init(args);
+        int64_t ns;
+
+        qtest_readb(qts, 0);
+        ns = get_clock() - start;
+        qtest_quit(qts);
+
+        best = MIN(best, ns);
+        total += ns;
+    }
+
+    g_test_message("%3u devices: %8.1f ms (best %8.1f ms), %6.1f us per "
+                   "device", devices, total / BENCH_RUNS / (double)SCALE_MS,
+                   best / (double)SCALE_MS,
+                   best / (double)SCALE_US / devices);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+    if (!qtest_has_device("pci-bridge") || !qtest_has_device("pci-testdev")) {
+        g_test_skip("pci-bridge or pci-testdev not available");
+        return g_test_run();
+    }
+
+    for (int i = 0; i < ARRAY_SIZE(bench_devices); i++) {
+        g_autofree char *path = g_strdup_printf("/qom/startup/devices-%u",
+                                                bench_devices[i]);
+
+        g_test_add_data_func(path, GUINT_TO_POINTER(bench_devices[i]),
+                             test_startup);
+    }
+    return g_test_run();
+}
@@ -0,0 +1,131 @@
+/*
+ * Submit-to-complete latency of the thread pool
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ *
+ * Each of N IOThreads keeps a few requests in flight on its own thread
+ * pool, the way the file-posix driver of a disk in that IOThread does.
+ * The requests do no work, so the latency from thread_pool_submit_aio()
+ * to the completion callback is the overhead of the pool itself.
+ */
+#include "qemu/osdep.h"
+#include "block/aio.h"
+#include "block/thread-pool.h"
+#include "qemu/thread.h"
+#include "qemu/timer.h"
+#include "../unit/iothread.h"
+
+#define BENCH_DEPTH 4   /* requests each submitter keeps in flight */
+#define BENCH_MAX_SUBMITTERS 8
+#define BENCH_TIME_NS NANOSECONDS_PER_SECOND
+
+typedef struct Submitter Submitter;
+
+typedef struct BenchReq {
+    Submitter *s;
+    int64_t start_ns;
+} BenchReq;
+
+struct Submitter {
+    IOThread *iothread;
+    int64_t deadline_ns;
+    BenchReq reqs[BENCH_DEPTH];
+    int inflight;
+    QemuEvent done;
+
+    uint64_t ops;
+    int64_t latency_ns;
+    int64_t max_latency_ns;
+};
+
+static int bench_work(void *opaque)
+{
+    return 0;
+}
+
+static void bench_done(void *opaque, int ret);
+
+static void bench_submit(BenchReq *req)
+{
+    req->start_ns = get_clock();
+    thread_pool_submit_aio(bench_work, req, bench_done, req);
+}
+
+static void bench_done(void *opaque, int ret)
+{
+    BenchReq *req = opaque;
+    Submitter *s = req->s;
+    int64_t now = get_clock();
+    int64_t latency = now - req->start_ns;
+
+    s->ops++;
+    s->latency_ns += latency;
+    s->max_latency_ns = MAX(s->max_latency_ns, latency);
+
+    if (now < s->deadline_ns) {
+        bench_submit(req);
+    } else if (--s->inflight == 0) {
+        qemu_event_set(&s->done);
+    }
+}
+
+static void bench_start_bh(void *opaque)
+{
+    Submitter *s = opaque;
+
+    s->inflight = BENCH_DEPTH;
+    for (int i = 0; i < BENCH_DEPTH; i++) {
+        s->reqs[i].s = s;
+        bench_submit(&s->reqs[i]);
+    }
+}
+
+static void test_latency(const void *opaque)
+{
+    int n = GPOINTER_TO_INT(opaque);
+    g_autofree Submitter *s = g_new0(Submitter, n);
+    uint64_t ops = 0;
+    int64_t latency_ns = 0, max_latency_ns = 0;
+    int64_t deadline_ns;
+
+    for (int i = 0; i < n; i++) {
+        s[i].iothread = iothread_new();
+        qemu_event_init(&s[i].done, false);
+    }
+
+    deadline_ns = get_clock() + BENCH_TIME_NS;
+    for (int i = 0; i < n; i++) {
+        s[i].deadline_ns = deadline_ns;
+        aio_bh_schedule_oneshot(iothread_get_aio_context(s[i].iothread),
+                                bench_start_bh, &s[i]);
+    }
+
+    for (int i = 0; i < n; i++) {
+        qemu_event_wait(&s[i].done);
+        ops += s[i].ops;
+        latency_ns += s[i].latency_ns;
+        max_latency_ns = MAX(max_latency_ns, s[i].max_latency_ns);
+        iothread_join(s[i].iothread);
+        qemu_event_destroy(&s[i].done);
+    }
+
+    g_test_message("%d submitters: %" PRIu64 " requests, "
+                   "latency %.1f us avg, %.1f us max", n, ops,
+                   (double)latency_ns / ops / SCALE_US,
+                   (double)max_latency_ns / SCALE_US);
+}
+
+int main(int argc, char **argv)
+{
+    init_clocks(NULL);
+
+    g_test_init(&argc, &argv, NULL);
+    for (int n = 1; n <= BENCH_MAX_SUBMITTERS; n *= 2) {
+        g_autofree char *path =
+            g_strdup_printf("/thread-pool/latency/submitters-%d", n);
+        g_test_add_data_func(path, GINT_TO_POINTER(n), test_latency);
+    }
+    return g_test_run();
+}
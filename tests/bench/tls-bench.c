@@ -0,0 +1,179 @@
+/*
+ * TLS channel throughput benchmark
+ *
+ * Streams data over a TLS session on a TCP loopback connection, with
+ * the sender encrypting in userspace through GnuTLS and, if the host
+ * supports it, with the kernel encrypting (kTLS).  The receiver always
+ * decrypts in userspace, so the difference is the sending side.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or
+ * (at your option) any later version.  See the COPYING file in the
+ * top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "crypto/init.h"
+#include "crypto/tlscredspsk.h"
+#include "io/channel-socket.h"
+#include "io/channel-tls.h"
+#include "qapi/error.h"
+#include "qemu/module.h"
+#include "qemu/sockets.h"
+#include "qemu/thread.h"
+#include "qemu/units.h"
+#include "../unit/crypto-tls-psk-helpers.h"
+
+#define WORKDIR "tests/bench-tls-work/"
+#define PSKFILE WORKDIR "keys.psk"
+
+#define BENCH_CHUNK     (64 * KiB)
+#define BENCH_BYTES     (1 * GiB)
+
+static QCryptoTLSCreds *bench_creds_create(QCryptoTLSCredsEndpoint endpoint,
+                                           bool ktls)
+{
+    bool server = endpoint == QCRYPTO_TLS_CREDS_ENDPOINT_SERVER;
+    Object *creds = object_new_with_props(
+        TYPE_QCRYPTO_TLS_CREDS_PSK,
+        object_get_objects_root(),
+        server ? "benchtlsserver" : "benchtlsclient",
+        &error_abort,
+        "endpoint", server ? "server" : "client",
+        "dir", WORKDIR,
+        "priority", "NORMAL",
+        "ktls", ktls ? "on" : "off",
+        NULL);
+
+    return QCRYPTO_TLS_CREDS(creds);
+}
+
+/* A connected pair of TCP sockets, kTLS does not work on AF_UNIX */
+static void bench_tcp_pair(int fds[2])
+{
+    struct sockaddr_in addr = {
+        .sin_family = AF_INET,
+        .sin_addr.s_addr = htonl(INADDR_LOOPBACK),
+    };
+    socklen_t len = sizeof(addr);
+    int lfd = qemu_socket(AF_INET, SOCK_STREAM, 0);
+
+    g_assert(lfd >= 0);
+    g_assert(bind(lfd, (struct sockaddr *)&addr, len) == 0);
+    g_assert(listen(lfd, 1) == 0);
+    g_assert(getsockname(lfd, (struct sockaddr *)&addr, &len) == 0);
+
+    fds[0] = qemu_socket(AF_INET, SOCK_STREAM, 0);
+    g_assert(fds[0] >= 0);
+    g_assert(connect(fds[0], (struct sockaddr *)&addr, len) == 0);
+    fds[1] = qemu_accept(lfd, NULL, NULL);
+    g_assert(fds[1] >= 0);
+    close(lfd);
+}
+
+static void bench_handshake_done(QIOTask *task, gpointer opaque)
+{
+    bool *finished = opaque;
+
+    qio_task_propagate_error(task, &error_abort);
+    *finished = true;
+}
+
+static void *bench_receive(void *opaque)
+{
+    QIOChannel *ioc = opaque;
+    g_autofree char *buf = g_malloc(BENCH_CHUNK);
+    uint64_t got = 0;
+
+    while (got < BENCH_BYTES) {
+        ssize_t ret = qio_channel_read(ioc, buf, BENCH_CHUNK, &error_abort);
+
+        g_assert(ret > 0);
+        got += ret;
+    }
+    return NULL;
+}
+
+static void test_throughput(const void *opaque)
+{
+    bool ktls = GPOINTER_TO_INT(opaque);
+    QCryptoTLSCreds *client_creds, *server_creds;
+    QIOChannelSocket *client_sock, *server_sock;
+    QIOChannelTLS *client, *server;
+    bool client_done = false, server_done = false;
+    g_autofree char *buf = g_malloc0(BENCH_CHUNK);
+    QemuThread thread;
+    int fds[2];
+
+    client_creds = bench_creds_create(QCRYPTO_TLS_CREDS_ENDPOINT_CLIENT, ktls);
+    server_creds = bench_creds_create(QCRYPTO_TLS_CREDS_ENDPOINT_SERVER,
+                                      false);
+
+    bench_tcp_pair(fds);
+    client_sock = qio_channel_socket_new_fd(fds[0], &error_abort);
+    server_sock = qio_channel_socket_new_fd(fds[1], &error_abort);
+    qio_channel_set_blocking(QIO_CHANNEL(client_sock), false, NULL);
+    qio_channel_set_blocking(QIO_CHANNEL(server_sock), false, NULL);
+
+    client = qio_channel_tls_new_client(QIO_CHANNEL(client_sock),
+                                        client_creds, NULL, &error_abort);
+    server = qio_channel_tls_new_server(QIO_CHANNEL(server_sock),
+                                        server_creds, NULL, &error_abort);
+    qio_channel_tls_handshake(client, bench_handshake_done, &client_done,
+                              NULL, NULL);
+    qio_channel_tls_handshake(server, bench_handshake_done, &server_done,
+                              NULL, NULL);
+    while (!client_done || !server_done) {
+        g_main_context_iteration(NULL, TRUE);
+    }
+
+    if (ktls && !client->ktls_tx) {
+        g_test_skip("kernel TLS is not available");
+        goto out;
+    }
+
+    qio_channel_set_blocking(QIO_CHANNEL(client), true, NULL);
+    qio_channel_set_blocking(QIO_CHANNEL(server), true, NULL);
+
+    g_test_timer_start();
+    qemu_thread_create(&thread, "tls-bench-recv", bench_receive, server,
+                       QEMU_THREAD_JOINABLE);
+    for (uint64_t sent = 0; sent < BENCH_BYTES; sent += BENCH_CHUNK) {
+        qio_channel_write_all(QIO_CHANNEL(client), buf, BENCH_CHUNK,
+                              &error_abort);
+    }
+    qemu_thread_join(&thread);
+    g_test_timer_elapsed();
+
+    g_test_message("%s: %8.1f MiB/sec", ktls ? "kernel" : "userspace",
+                   (double)BENCH_BYTES / MiB / g_test_timer_last());
+
+out:
+    object_unref(OBJECT(client));
+    object_unref(OBJECT(server));
+    object_unref(OBJECT(client_sock));
+    object_unref(OBJECT(server_sock));
+    object_unparent(OBJECT(client_creds));
+    object_unparent(OBJECT(server_creds));
+}
+
+int main(int argc, char **argv)
+{
+    int ret;
+
+    g_assert(qcrypto_init(NULL) == 0);
+    module_call_init(MODULE_INIT_QOM);
+    g_test_init(&argc, &argv, NULL);
+
+    g_mkdir_with_parents(WORKDIR, 0700);
+    test_tls_psk_init(PSKFILE);
+
+    g_test_add_data_func("/tls/throughput/userspace", GINT_TO_POINTER(false),
+                         test_throughput);
+    g_test_add_data_func("/tls/throughput/ktls", GINT_TO_POINTER(true),
+                         test_throughput);
+    ret = g_test_run();
+
+    test_tls_psk_cleanup(PSKFILE);
+    rmdir(WORKDIR);
+    return ret;
+}
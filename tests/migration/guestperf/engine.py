@@ -94,7 +94,8 @@ def _migrate_progress(self, vm):
                 info["ram"].get("normal-bytes", 0),
                 info["ram"].get("dirty-pages-rate", 0),
                 info["ram"].get("mbps", 0),
-                info["ram"].get("dirty-sync-count", 0)
+                info["ram"].get("dirty-sync-count", 0),
+                info["ram"].get("dirty-sync-time", 0)
             ),
             time.time(),
             info.get("total-time", 0),
@@ -262,12 +263,13 @@ def _migrate(self, hardware, scenario, src, dst, connect_uri):
                 return [progress_history, src_qemu_time, src_vcpu_time]
 
             if self._verbose and (loop % 20) == 0:
-                print("Iter %d: remain %5dMB of %5dMB (total %5dMB @ %5dMb/sec)" % (
+                print("Iter %d: remain %5dMB of %5dMB (total %5dMB @ %5dMb/sec, sync %dms)" % (
                     progress._ram._iterations,
                     progress._ram._remaining_bytes / (1024 * 1024),
                     progress._ram._total_bytes / (1024 * 1024),
                     progress._ram._transferred_bytes / (1024 * 1024),
                     progress._ram._transfer_rate_mbs,
+                    progress._ram._dirty_sync_time_us / 1000,
                 ))
 
             if progress._ram._iterations > scenario._max_iters:
@@ -88,8 +88,18 @@ struct QTestState
     GList *pending_events;
     QTestQMPEventCallback eventCB;
     void *eventData;
+    GList *memmaps;
 };
 
+/* Guest RAM mapped by qtest_memmap() */
+typedef struct QTestMemMap {
+    uint64_t addr;
+    size_t size;
+    uint8_t *host;
+    void *map;
+    size_t map_size;
+} QTestMemMap;
+
 static GHookList abrt_hooks;
 static void (*sighandler_old)(int);
 static bool silence_spawn_log;
@@ -609,6 +619,15 @@ void qtest_quit(QTestState *s)
 
     g_list_free(s->pending_events);
 
+#ifndef _WIN32
+    for (GList *it = s->memmaps; it != NULL; it = it->next) {
+        QTestMemMap *m = it->data;
+
+        munmap(m->map, m->map_size);
+    }
+#endif
+    g_list_free_full(s->memmaps, g_free);
+
     g_free(s);
 }
 
@@ -666,11 +685,11 @@ static GString *qtest_client_socket_recv_line(QTestState *s)
     return line;
 }
 
-static gchar **qtest_rsp_args(QTestState *s, int expected_args)
+/* Like qtest_rsp_args(), but the response need not be "OK" */
+static gchar **qtest_rsp_words(QTestState *s)
 {
     GString *line;
     gchar **words;
-    int i;
 
 redo:
     line = s->ops.recv_line(s);
@@ -700,6 +719,14 @@ redo:
     }
 
     g_assert(words[0] != NULL);
+    return words;
+}
+
+static gchar **qtest_rsp_args(QTestState *s, int expected_args)
+{
+    gchar **words = qtest_rsp_words(s);
+    int i;
+
     g_assert_cmpstr(words[0], ==, "OK");
 
     for (i = 0; i < expected_args; i++) {
@@ -1171,9 +1198,74 @@ static int hex2nib(char ch)
     }
 }
 
+void *qtest_memmap(QTestState *s, uint64_t addr, size_t size)
+{
+#ifndef _WIN32
+    QTestMemMap *m;
+    gchar **args;
+    uint64_t offset;
+    size_t page_size = qemu_real_host_page_size();
+    void *map;
+    int fd, ret;
+
+    g_assert(size);
+
+    qtest_sendf(s, "memmap 0x%" PRIx64 " 0x%zx\n", addr, size);
+    args = qtest_rsp_words(s);
+    if (strcmp(args[0], "OK") != 0) {
+        g_strfreev(args);
+        return NULL;
+    }
+
+    g_assert(args[1] && args[2]);
+    ret = qemu_strtou64(args[2], NULL, 0, &offset);
+    g_assert(!ret);
+
+    fd = open(args[1], O_RDWR);
+    g_strfreev(args);
+    if (fd < 0) {
+        return NULL;
+    }
+
+    m = g_new0(QTestMemMap, 1);
+    m->addr = addr;
+    m->size = size;
+    m->map_size = ROUND_UP(size + offset % page_size, page_size);
+    map = mmap(NULL, m->map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd,
+               QEMU_ALIGN_DOWN(offset, page_size));
+    close(fd);
+    if (map == MAP_FAILED) {
+        g_free(m);
+        return NULL;
+    }
+
+    m->map = map;
+    m->host = (uint8_t *)map + offset % page_size;
+    s->memmaps = g_list_prepend(s->memmaps, m);
+    return m->host;
+#else
+    return NULL;
+#endif
+}
+
+/* The host address of [@addr, @addr + @size) if qtest_memmap() covers it */
+static uint8_t *qtest_memmap_find(QTestState *s, uint64_t addr, size_t size)
+{
+    for (GList *it = s->memmaps; it != NULL; it = it->next) {
+        QTestMemMap *m = it->data;
+
+        if (addr >= m->addr && size <= m->size &&
+            addr - m->addr <= m->size - size) {
+            return m->host + (addr - m->addr);
+        }
+    }
+    return NULL;
+}
+
 void qtest_memread(QTestState *s, uint64_t addr, void *data, size_t size)
 {
     uint8_t *ptr = data;
+    uint8_t *host;
     gchar **args;
     size_t i;
 
@@ -1181,6 +1273,12 @@ void qtest_memread(QTestState *s, uint64_t addr, void *data, size_t size)
         return;
     }
 
+    host = qtest_memmap_find(s, addr, size);
+    if (host) {
+        memcpy(data, host, size);
+        return;
+    }
+
     qtest_sendf(s, "read 0x%" PRIx64 " 0x%zx\n", addr, size);
     args = qtest_rsp_args(s, 2);
 
@@ -1228,8 +1326,14 @@ void qtest_add_data_func(const char *str, const void *data,
 
 void qtest_bufwrite(QTestState *s, uint64_t addr, const void *data, size_t size)
 {
+    uint8_t *host = qtest_memmap_find(s, addr, size);
     gchar *bdata;
 
+    if (host) {
+        memcpy(host, data, size);
+        return;
+    }
+
     bdata = g_base64_encode(data, size);
     qtest_sendf(s, "b64write 0x%" PRIx64 " 0x%zx ", addr, size);
     s->ops.send(s, bdata);
@@ -1240,9 +1344,15 @@ void qtest_bufwrite(QTestState *s, uint64_t addr, const void *data, size_t size)
 
 void qtest_bufread(QTestState *s, uint64_t addr, void *data, size_t size)
 {
+    uint8_t *host = qtest_memmap_find(s, addr, size);
     gchar **args;
     size_t len;
 
+    if (host) {
+        memcpy(data, host, size);
+        return;
+    }
+
     qtest_sendf(s, "b64read 0x%" PRIx64 " 0x%zx\n", addr, size);
     args = qtest_rsp_args(s, 2);
 
@@ -1260,6 +1370,7 @@ void qtest_bufread(QTestState *s, uint64_t addr, void *data, size_t size)
 void qtest_memwrite(QTestState *s, uint64_t addr, const void *data, size_t size)
 {
     const uint8_t *ptr = data;
+    uint8_t *host;
     size_t i;
     char *enc;
 
@@ -1267,6 +1378,12 @@ void qtest_memwrite(QTestState *s, uint64_t addr, const void *data, size_t size)
         return;
     }
 
+    host = qtest_memmap_find(s, addr, size);
+    if (host) {
+        memcpy(host, data, size);
+        return;
+    }
+
     enc = g_malloc(2 * size + 1);
 
     for (i = 0; i < size; i++) {
@@ -1280,6 +1397,12 @@ void qtest_memwrite(QTestState *s, uint64_t addr, const void *data, size_t size)
 
 void qtest_memset(QTestState *s, uint64_t addr, uint8_t pattern, size_t size)
 {
+    uint8_t *host = qtest_memmap_find(s, addr, size);
+
+    if (host && size) {
+        memset(host, pattern, size);
+        return;
+    }
     qtest_sendf(s, "memset 0x%" PRIx64 " 0x%zx 0x%02x\n", addr, size, pattern);
     qtest_rsp(s);
 }
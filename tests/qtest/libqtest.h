@@ -620,6 +620,25 @@ void qtest_bufwrite(QTestState *s, uint64_t addr,
  */
 void qtest_memset(QTestState *s, uint64_t addr, uint8_t patt, size_t size);
 
+/**
+ * qtest_memmap:
+ * @s: #QTestState instance to operate on.
+ * @addr: Guest address to map.
+ * @size: Number of bytes to map.
+ *
+ * Map guest memory into the test process, so that qtest_memread(),
+ * qtest_memwrite(), qtest_bufread(), qtest_bufwrite() and qtest_memset()
+ * access it directly instead of encoding it on the qtest socket.  This
+ * only works if the range is backed by a single shared RAM block with a
+ * file descriptor, such as ``-object memory-backend-memfd,share=on``.
+ * Writes through the mapping do not mark guest memory dirty.  The mapping
+ * lasts until qtest_quit().
+ *
+ * Returns: The host address of @addr, or %NULL if the range cannot be
+ * mapped; the accessors then keep using the socket.
+ */
+void *qtest_memmap(QTestState *s, uint64_t addr, size_t size);
+
 /**
  * qtest_clock_step_next:
  * @s: #QTestState instance to operate on.
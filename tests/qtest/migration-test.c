@@ -21,6 +21,7 @@
 #include "chardev/char.h"
 #include "crypto/tlscredspsk.h"
 #include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
 #include "ppc-util.h"
 
 #include "migration-helpers.h"
@@ -1358,6 +1359,33 @@ static void test_postcopy_preempt(void)
     test_postcopy_common(&args);
 }
 
+static void *migrate_postcopy_multifd_start(QTestState *from, QTestState *to)
+{
+    migrate_set_parameter_int(from, "multifd-channels", 4);
+    migrate_set_parameter_int(to, "multifd-channels", 4);
+
+    /* Multifd is only accepted once postcopy-preempt is set */
+    migrate_set_capability(from, "postcopy-ram", true);
+    migrate_set_capability(to, "postcopy-ram", true);
+    migrate_set_capability(from, "postcopy-preempt", true);
+    migrate_set_capability(to, "postcopy-preempt", true);
+
+    migrate_set_capability(from, "multifd", true);
+    migrate_set_capability(to, "multifd", true);
+
+    return NULL;
+}
+
+static void test_postcopy_preempt_multifd(void)
+{
+    MigrateCommon args = {
+        .postcopy_preempt = true,
+        .start_hook = migrate_postcopy_multifd_start,
+    };
+
+    test_postcopy_common(&args);
+}
+
 #ifdef CONFIG_GNUTLS
 static void test_postcopy_tls_psk(void)
 {
@@ -2944,6 +2972,15 @@ test_migrate_precopy_tcp_multifd_zlib_start(QTestState *from,
     return test_migrate_precopy_tcp_multifd_start_common(from, to, "zlib");
 }
 
+static void *
+test_migrate_precopy_tcp_multifd_xbzrle_start(QTestState *from,
+                                              QTestState *to)
+{
+    migrate_set_parameter_int(from, "xbzrle-cache-size", 33554432);
+
+    return test_migrate_precopy_tcp_multifd_start_common(from, to, "xbzrle");
+}
+
 #ifdef CONFIG_ZSTD
 static void *
 test_migrate_precopy_tcp_multifd_zstd_start(QTestState *from,
@@ -3045,11 +3082,58 @@ static void test_multifd_tcp_channels_none(void)
     test_precopy_common(&args);
 }
 
+static uint64_t migrate_histogram_count(QTestState *who, const char *name)
+{
+    QDict *rsp = qtest_qmp(who,
+        "{ 'execute': 'query-stats',"
+        "  'arguments': { 'target': 'vm',"
+        "                 'providers': [ { 'provider': 'migration',"
+        "                                  'names': [ %s ] } ] } }", name);
+    QList *results = qdict_get_qlist(rsp, "return");
+    QDict *result = qobject_to(QDict, qlist_peek(results));
+    QDict *stat = qobject_to(QDict, qlist_peek(qdict_get_qlist(result,
+                                                               "stats")));
+    QListEntry *entry;
+    uint64_t count = 0;
+
+    g_assert_cmpstr(qdict_get_str(stat, "name"), ==, name);
+    QLIST_FOREACH_ENTRY(qdict_get_qlist(stat, "value"), entry) {
+        count += qnum_get_uint(qobject_to(QNum, qlist_entry_obj(entry)));
+    }
+    qobject_unref(rsp);
+    return count;
+}
+
+static void test_migrate_multifd_histograms(QTestState *from, QTestState *to,
+                                            void *opaque)
+{
+    g_assert_cmpint(migrate_histogram_count(from, "multifd-send-time"), >, 0);
+    g_assert_cmpint(migrate_histogram_count(from, "multifd-compress-time"),
+                    >, 0);
+    g_assert_cmpint(migrate_histogram_count(from, "dirty-sync-time"), >, 0);
+}
+
 static void test_multifd_tcp_zlib(void)
 {
     MigrateCommon args = {
         .listen_uri = "defer",
         .start_hook = test_migrate_precopy_tcp_multifd_zlib_start,
+        .finish_hook = test_migrate_multifd_histograms,
+    };
+    test_precopy_common(&args);
+}
+
+static void test_multifd_tcp_xbzrle(void)
+{
+    MigrateCommon args = {
+        .listen_uri = "defer",
+        .start_hook = test_migrate_precopy_tcp_multifd_xbzrle_start,
+        .iterations = 2,
+        /*
+         * XBZRLE needs pages to be modified when doing the 2nd+ round
+         * iteration to have real data pushed to the stream.
+         */
+        .live = true,
     };
     test_precopy_common(&args);
 }
@@ -3836,6 +3920,8 @@ int main(int argc, char **argv)
                            test_postcopy_recovery);
         migration_test_add("/migration/postcopy/preempt/plain",
                            test_postcopy_preempt);
+        migration_test_add("/migration/postcopy/preempt/multifd",
+                           test_postcopy_preempt_multifd);
         migration_test_add("/migration/postcopy/preempt/recovery/plain",
                            test_postcopy_preempt_recovery);
         migration_test_add("/migration/postcopy/recovery/double-failures/handshake",
@@ -3990,6 +4076,8 @@ int main(int argc, char **argv)
                        test_multifd_tcp_cancel);
     migration_test_add("/migration/multifd/tcp/plain/zlib",
                        test_multifd_tcp_zlib);
+    migration_test_add("/migration/multifd/tcp/plain/xbzrle",
+                       test_multifd_tcp_xbzrle);
 #ifdef CONFIG_ZSTD
     migration_test_add("/migration/multifd/tcp/plain/zstd",
                        test_multifd_tcp_zstd);
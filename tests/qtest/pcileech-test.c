@@ -0,0 +1,638 @@
+/*
+ * QTest testcase for the pcileech device
+ *
+ * Drives the socket protocol of the device against guest memory that
+ * the test fills through qtest: requests split at every byte, several
+ * requests sent at once, zero and oversized lengths, unmapped addresses
+ * and unknown commands, which must all leave the stream in sync. The
+ * throughput cases read with each transfer style and fail if the data
+ * are wrong or arrive below a floor, so that the fast paths of the
+ * device cannot silently break or slow down. PCILEECH_TEST_MIN_MIBS
+ * overrides the floor, in MiB/s; 0 only checks the data. Behind an
+ * identity-mapped VT-d, a client's write must not leave stale data in
+ * the read-ahead windows.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+#include "qemu/units.h"
+#include "qemu/bswap.h"
+#include "qemu/sockets.h"
+#include "qapi/error.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
+#include "libqtest.h"
+#include "libqos/pci.h"
+#include "libqos/pci-pc.h"
+
+#define LEECH_REQUEST_READ          0
+#define LEECH_REQUEST_WRITE         1
+#define LEECH_REQUEST_NEGOTIATE     2
+#define LEECH_REQUEST_READ_SCATTER  3
+
+#define LEECH_FEATURE_OUT_OF_ORDER  (1ULL << 1)
+
+#define LEECH_RESULT_OK     0
+#define LEECH_DEVICE_ERROR  (1U << 0)
+
+/* Frame length of clients that never negotiate */
+#define LEECH_BUFFER_SIZE   1024
+
+#define TEST_BASE           (16 * MiB)
+#define TEST_UNMAPPED       (64 * GiB)
+#define TEST_CHUNK          (64 * KiB)
+#define TEST_MAX_CHUNK      (1 * MiB)
+#define TEST_DEPTH          16
+
+/* Throughput cases read this much of TEST_SPAN at TEST_BASE */
+#define TEST_SPAN           (8 * MiB)
+#define TEST_BYTES          (128 * MiB)
+#define TEST_MIN_MIBS       64
+
+/* VT-d registers and table entries, and where the tables go */
+#define VTD_BASE            0xfed90000ULL
+#define VTD_GCMD            0x18
+#define VTD_GSTS            0x1c
+#define VTD_RTADDR          0x20
+#define VTD_GCMD_TE         (1U << 31)
+#define VTD_GCMD_SRTP       (1U << 30)
+#define VTD_PRESENT         1ULL
+#define VTD_AW_39BIT        1ULL
+#define VTD_SL_RW           3ULL
+#define VTD_SL_PS           (1ULL << 7)
+#define VTD_TABLES          (1 * MiB)
+
+/* read-ahead window, and the strided reads that trigger it */
+#define TEST_RA_WINDOW      (64 * KiB)
+#define TEST_RA_READ        (8 * KiB)
+
+typedef struct LeechRequestHeader {
+    uint8_t command;
+    uint8_t flags;
+    uint8_t reserved[2];
+    uint32_t tag;
+    uint64_t address;
+    uint64_t length;
+} LeechRequestHeader;
+
+typedef struct LeechResponseHeader {
+    uint32_t result;
+    uint32_t tag;
+    uint64_t length;
+} LeechResponseHeader;
+
+typedef struct LeechScatterEntry {
+    uint64_t address;
+    uint32_t length;
+    uint8_t reserved[4];
+} LeechScatterEntry;
+
+typedef struct LeechScatterResult {
+    uint32_t result;
+    uint32_t length;
+} LeechScatterResult;
+
+typedef struct TestLeech {
+    QTestState *qts;
+    QPCIBus *bus;
+    QPCIDevice *dev;
+    char *tmpdir;
+    char *sock;
+    int fd;
+} TestLeech;
+
+typedef enum TestMode {
+    TEST_READ,
+    TEST_PIPELINED,
+    TEST_SCATTER,
+} TestMode;
+
+/* Start the device, with @args before it and @props added to it. */
+static void leech_start_args(TestLeech *t, const char *args,
+                             const char *props)
+{
+    t->tmpdir = g_dir_make_tmp("pcileech-test-XXXXXX", NULL);
+    g_assert(t->tmpdir);
+    t->sock = g_strdup_printf("%s/sock", t->tmpdir);
+    t->qts = qtest_initf("-m 256M %s "
+                         "-chardev socket,id=leech,path=%s,server=on,wait=off "
+                         "-device pcileech,addr=04.0,chardev=leech,"
+                         "chunk-size=%u,queue-depth=%u%s",
+                         args, t->sock, (unsigned)TEST_MAX_CHUNK, TEST_DEPTH,
+                         props);
+    /* DMA goes nowhere until the device is a bus master. */
+    t->bus = qpci_new_pc(t->qts, NULL);
+    t->dev = qpci_device_find(t->bus, QPCI_DEVFN(0x4, 0x0));
+    g_assert(t->dev);
+    qpci_device_enable(t->dev);
+    t->fd = unix_connect(t->sock, &error_abort);
+}
+
+static void leech_start(TestLeech *t)
+{
+    leech_start_args(t, "", "");
+}
+
+static void leech_stop(TestLeech *t)
+{
+    close(t->fd);
+    g_free(t->dev);
+    qpci_free_pc(t->bus);
+    qtest_quit(t->qts);
+    unlink(t->sock);
+    rmdir(t->tmpdir);
+    g_free(t->sock);
+    g_free(t->tmpdir);
+}
+
+static void leech_send(TestLeech *t, const void *buf, size_t len)
+{
+    g_assert_cmpint(qemu_write_full(t->fd, buf, len), ==, len);
+}
+
+static void leech_recv(TestLeech *t, void *buf, size_t len)
+{
+    uint8_t *p = buf;
+
+    while (len) {
+        ssize_t ret = read(t->fd, p, len);
+        if (ret < 0 && errno == EINTR) {
+            continue;
+        }
+        g_assert_cmpint(ret, >, 0);
+        p += ret;
+        len -= ret;
+    }
+}
+
+static LeechRequestHeader leech_header(uint8_t command, uint32_t tag,
+                                       uint64_t address, uint64_t length)
+{
+    return (LeechRequestHeader) {
+        .command = command,
+        .tag = cpu_to_le32(tag),
+        .address = cpu_to_le64(address),
+        .length = cpu_to_le64(length),
+    };
+}
+
+static void leech_request(TestLeech *t, uint8_t command, uint32_t tag,
+                          uint64_t address, uint64_t length)
+{
+    LeechRequestHeader req = leech_header(command, tag, address, length);
+
+    leech_send(t, &req, sizeof(req));
+}
+
+/* Receive a response header for @tag and return its result. */
+static uint32_t leech_response(TestLeech *t, uint32_t tag, uint64_t *length)
+{
+    LeechResponseHeader resp;
+
+    leech_recv(t, &resp, sizeof(resp));
+    g_assert_cmpuint(le32_to_cpu(resp.tag), ==, tag);
+    *length = le64_to_cpu(resp.length);
+    return le32_to_cpu(resp.result);
+}
+
+static void leech_negotiate(TestLeech *t, uint32_t chunk_size,
+                            uint64_t features)
+{
+    uint8_t caps[24];
+    uint64_t length;
+
+    leech_request(t, LEECH_REQUEST_NEGOTIATE, 0, features, chunk_size);
+    g_assert_cmpuint(leech_response(t, 0, &length), ==, LEECH_RESULT_OK);
+    g_assert_cmpuint(length, ==, sizeof(caps));
+    leech_recv(t, caps, sizeof(caps));
+    g_assert_cmpuint(ldl_le_p(caps + 4), ==, chunk_size);
+}
+
+/* Fill guest memory with a pattern that differs for every 64-bit word. */
+static void leech_fill(TestLeech *t, uint64_t address, uint64_t length)
+{
+    g_autofree uint64_t *buf = g_new(uint64_t, length / sizeof(uint64_t));
+
+    for (uint64_t i = 0; i < length / sizeof(uint64_t); i++) {
+        buf[i] = cpu_to_le64((address + i * sizeof(uint64_t)) ^
+                             0x5a5a5a5a5a5a5a5aULL);
+    }
+    qtest_bufwrite(t->qts, address, buf, length);
+}
+
+static void leech_check(const uint8_t *buf, uint64_t address,
+                        uint64_t length)
+{
+    for (uint64_t off = 0; off < length; off += sizeof(uint64_t)) {
+        g_assert_cmphex(ldq_le_p(buf + off), ==,
+                        (address + off) ^ 0x5a5a5a5a5a5a5a5aULL);
+    }
+}
+
+/* Receive the frames of a read; returns the OR of their results. */
+static uint32_t leech_read_frames(TestLeech *t, uint32_t tag,
+                                  uint8_t *buf, uint64_t length,
+                                  uint32_t frame_size)
+{
+    uint32_t result = 0;
+    uint64_t done = 0;
+
+    while (done < length) {
+        uint64_t frame;
+
+        result |= leech_response(t, tag, &frame);
+        g_assert_cmpuint(frame, ==, MIN(length - done, frame_size));
+        leech_recv(t, buf + done, frame);
+        done += frame;
+    }
+    return result;
+}
+
+static void test_split_header(void)
+{
+    TestLeech t;
+    LeechRequestHeader req = leech_header(LEECH_REQUEST_READ, 7,
+                                          TEST_BASE, 4 * KiB);
+    const uint8_t *p = (const uint8_t *)&req;
+    uint8_t buf[4 * KiB];
+
+    leech_start(&t);
+    leech_fill(&t, TEST_BASE, sizeof(buf));
+    /* The device must put the header together from single bytes. */
+    for (int i = 0; i < sizeof(req); i++) {
+        leech_send(&t, p + i, 1);
+        g_usleep(1000);
+    }
+    g_assert_cmpuint(leech_read_frames(&t, 7, buf, sizeof(buf),
+                                       LEECH_BUFFER_SIZE), ==, 0);
+    leech_check(buf, TEST_BASE, sizeof(buf));
+    leech_stop(&t);
+}
+
+static void test_coalesced(void)
+{
+    TestLeech t;
+    g_autoptr(GByteArray) out = g_byte_array_new();
+    LeechRequestHeader req;
+    uint8_t data[256], buf[4 * KiB];
+    uint64_t length;
+
+    leech_start(&t);
+    leech_fill(&t, TEST_BASE, sizeof(buf));
+    for (int i = 0; i < sizeof(data); i++) {
+        data[i] = i;
+    }
+    /* A read, a write and a read of the written data in one go */
+    req = leech_header(LEECH_REQUEST_READ, 1, TEST_BASE, sizeof(buf));
+    g_byte_array_append(out, (uint8_t *)&req, sizeof(req));
+    req = leech_header(LEECH_REQUEST_WRITE, 2, TEST_BASE + 8 * KiB,
+                       sizeof(data));
+    g_byte_array_append(out, (uint8_t *)&req, sizeof(req));
+    g_byte_array_append(out, data, sizeof(data));
+    req = leech_header(LEECH_REQUEST_READ, 3, TEST_BASE + 8 * KiB,
+                       sizeof(data));
+    g_byte_array_append(out, (uint8_t *)&req, sizeof(req));
+    leech_send(&t, out->data, out->len);
+
+    g_assert_cmpuint(leech_read_frames(&t, 1, buf, sizeof(buf),
+                                       LEECH_BUFFER_SIZE), ==, 0);
+    leech_check(buf, TEST_BASE, sizeof(buf));
+    g_assert_cmpuint(leech_response(&t, 2, &length), ==, LEECH_RESULT_OK);
+    g_assert_cmpuint(length, ==, 0);
+    g_assert_cmpuint(leech_read_frames(&t, 3, buf, sizeof(data),
+                                       LEECH_BUFFER_SIZE), ==, 0);
+    g_assert(memcmp(buf, data, sizeof(data)) == 0);
+    qtest_memread(t.qts, TEST_BASE + 8 * KiB, buf, sizeof(data));
+    g_assert(memcmp(buf, data, sizeof(data)) == 0);
+    leech_stop(&t);
+}
+
+static void test_zero_length(void)
+{
+    TestLeech t;
+    uint8_t buf[64];
+    uint64_t length;
+
+    leech_start(&t);
+    leech_fill(&t, TEST_BASE, sizeof(buf));
+    /* Neither is answered; the scatter request has nothing to say. */
+    leech_request(&t, LEECH_REQUEST_READ, 1, TEST_BASE, 0);
+    leech_request(&t, LEECH_REQUEST_WRITE, 2, TEST_BASE, 0);
+    leech_request(&t, LEECH_REQUEST_READ_SCATTER, 3, 0, 0);
+    leech_request(&t, LEECH_REQUEST_READ, 4, TEST_BASE, sizeof(buf));
+    g_assert_cmpuint(leech_response(&t, 3, &length), ==, LEECH_RESULT_OK);
+    g_assert_cmpuint(length, ==, 0);
+    g_assert_cmpuint(leech_read_frames(&t, 4, buf, sizeof(buf),
+                                       LEECH_BUFFER_SIZE), ==, 0);
+    leech_check(buf, TEST_BASE, sizeof(buf));
+    leech_stop(&t);
+}
+
+static void test_huge_length(void)
+{
+    const uint32_t refused = TEST_CHUNK / sizeof(LeechScatterEntry) + 1;
+    g_autofree uint8_t *buf = g_malloc(4 * MiB);
+    g_autofree LeechScatterEntry *entries = g_new0(LeechScatterEntry,
+                                                   refused);
+    TestLeech t;
+    uint64_t length;
+
+    leech_start(&t);
+    leech_negotiate(&t, TEST_CHUNK, 0);
+    leech_fill(&t, TEST_BASE, 4 * MiB);
+    /* A read many times the frame length comes in frames */
+    leech_request(&t, LEECH_REQUEST_READ, 1, TEST_BASE, 4 * MiB);
+    g_assert_cmpuint(leech_read_frames(&t, 1, buf, 4 * MiB, TEST_CHUNK),
+                     ==, 0);
+    leech_check(buf, TEST_BASE, 4 * MiB);
+    /* The entry vector of a scatter read must fit in a frame. */
+    leech_request(&t, LEECH_REQUEST_READ_SCATTER, 2, 0, refused);
+    leech_send(&t, entries, refused * sizeof(*entries));
+    g_assert_cmpuint(leech_response(&t, 2, &length), ==, LEECH_DEVICE_ERROR);
+    g_assert_cmpuint(length, ==, 0);
+    /* The refused entries were skipped. */
+    leech_request(&t, LEECH_REQUEST_READ, 3, TEST_BASE, 64);
+    g_assert_cmpuint(leech_read_frames(&t, 3, buf, 64, TEST_CHUNK), ==, 0);
+    leech_check(buf, TEST_BASE, 64);
+    leech_stop(&t);
+}
+
+static void test_unmapped(void)
+{
+    LeechScatterEntry entries[2] = {
+        { .address = cpu_to_le64(TEST_UNMAPPED),
+          .length = cpu_to_le32(4 * KiB) },
+        { .address = cpu_to_le64(TEST_BASE),
+          .length = cpu_to_le32(4 * KiB) },
+    };
+    LeechScatterResult result;
+    uint8_t buf[4 * KiB];
+    TestLeech t;
+    uint64_t length;
+
+    leech_start(&t);
+    leech_negotiate(&t, TEST_CHUNK, 0);
+    leech_fill(&t, TEST_BASE, sizeof(buf));
+    /* The frame fails, but is still sent in full. */
+    leech_request(&t, LEECH_REQUEST_READ, 1, TEST_UNMAPPED, sizeof(buf));
+    g_assert_cmpuint(leech_read_frames(&t, 1, buf, sizeof(buf), TEST_CHUNK),
+                     !=, 0);
+    /* Only the failing entry fails. */
+    leech_request(&t, LEECH_REQUEST_READ_SCATTER, 2, 0, ARRAY_SIZE(entries));
+    leech_send(&t, entries, sizeof(entries));
+    leech_response(&t, 2, &length);
+    leech_recv(&t, &result, sizeof(result));
+    g_assert_cmpuint(le32_to_cpu(result.result), !=, 0);
+    leech_recv(&t, buf, le32_to_cpu(result.length));
+    leech_recv(&t, &result, sizeof(result));
+    g_assert_cmpuint(le32_to_cpu(result.result), ==, 0);
+    g_assert_cmpuint(le32_to_cpu(result.length), ==, sizeof(buf));
+    leech_recv(&t, buf, sizeof(buf));
+    leech_check(buf, TEST_BASE, sizeof(buf));
+    /* Writes there fail too, and are acknowledged anyway. */
+    leech_request(&t, LEECH_REQUEST_WRITE, 3, TEST_UNMAPPED, sizeof(buf));
+    leech_send(&t, buf, sizeof(buf));
+    g_assert_cmpuint(leech_response(&t, 3, &length), !=, 0);
+    g_assert_cmpuint(length, ==, 0);
+    leech_stop(&t);
+}
+
+static void test_unknown_command(void)
+{
+    TestLeech t;
+    uint8_t buf[64];
+    uint64_t length;
+
+    leech_start(&t);
+    leech_fill(&t, TEST_BASE, sizeof(buf));
+    leech_request(&t, 0xff, 1, TEST_BASE, sizeof(buf));
+    g_assert_cmpuint(leech_response(&t, 1, &length), ==, LEECH_DEVICE_ERROR);
+    g_assert_cmpuint(length, ==, 0);
+    leech_request(&t, LEECH_REQUEST_READ, 2, TEST_BASE, sizeof(buf));
+    g_assert_cmpuint(leech_read_frames(&t, 2, buf, sizeof(buf),
+                                       LEECH_BUFFER_SIZE), ==, 0);
+    leech_check(buf, TEST_BASE, sizeof(buf));
+    leech_stop(&t);
+}
+
+/* Read TEST_BYTES with @mode, checking every byte; returns MiB/s. */
+static double leech_throughput(TestLeech *t, TestMode mode)
+{
+    const uint32_t pages = TEST_CHUNK / sizeof(LeechScatterEntry) / 2;
+    g_autofree uint8_t *buf = g_malloc(TEST_MAX_CHUNK * TEST_DEPTH);
+    g_autofree LeechScatterEntry *entries = g_new0(LeechScatterEntry,
+                                                   pages);
+    uint64_t address = 0, length;
+
+    g_test_timer_start();
+    for (uint64_t done = 0; done < TEST_BYTES;) {
+        switch (mode) {
+        case TEST_READ:
+            leech_request(t, LEECH_REQUEST_READ, 0, TEST_BASE + address,
+                          TEST_MAX_CHUNK);
+            leech_read_frames(t, 0, buf, TEST_MAX_CHUNK, TEST_MAX_CHUNK);
+            leech_check(buf, TEST_BASE + address, TEST_MAX_CHUNK);
+            address = (address + TEST_MAX_CHUNK) % TEST_SPAN;
+            done += TEST_MAX_CHUNK;
+            break;
+        case TEST_PIPELINED:
+            /*
+             * Out of order, frames of all requests interleave, so each
+             * request reads into its own part of the buffer.
+             */
+            for (uint32_t tag = 0; tag < TEST_DEPTH; tag++) {
+                leech_request(t, LEECH_REQUEST_READ, tag,
+                              TEST_BASE + address + tag * TEST_CHUNK,
+                              TEST_CHUNK);
+            }
+            for (uint32_t i = 0; i < TEST_DEPTH; i++) {
+                LeechResponseHeader resp;
+                uint32_t tag;
+
+                leech_recv(t, &resp, sizeof(resp));
+                tag = le32_to_cpu(resp.tag);
+                g_assert_cmpuint(tag, <, TEST_DEPTH);
+                g_assert_cmpuint(le32_to_cpu(resp.result), ==, 0);
+                g_assert_cmpuint(le64_to_cpu(resp.length), ==, TEST_CHUNK);
+                leech_recv(t, buf + tag * TEST_CHUNK, TEST_CHUNK);
+            }
+            leech_check(buf, TEST_BASE + address, TEST_DEPTH * TEST_CHUNK);
+            address = (address + TEST_DEPTH * TEST_CHUNK) % TEST_SPAN;
+            done += TEST_DEPTH * TEST_CHUNK;
+            break;
+        case TEST_SCATTER:
+            /* Every other 4 KiB page, as a page table walk would */
+            for (uint32_t i = 0; i < pages; i++) {
+                entries[i].address = cpu_to_le64(TEST_BASE + address +
+                                                 i * 8 * KiB);
+                entries[i].length = cpu_to_le32(4 * KiB);
+            }
+            leech_request(t, LEECH_REQUEST_READ_SCATTER, 0, 0, pages);
+            leech_send(t, entries, pages * sizeof(*entries));
+            leech_response(t, 0, &length);
+            g_assert_cmpuint(length, ==, pages * (sizeof(LeechScatterResult) +
+                                                  4 * KiB));
+            for (uint32_t i = 0; i < pages; i++) {
+                LeechScatterResult result;
+
+                leech_recv(t, &result, sizeof(result));
+                g_assert_cmpuint(le32_to_cpu(result.result), ==, 0);
+                g_assert_cmpuint(le32_to_cpu(result.length), ==, 4 * KiB);
+                leech_recv(t, buf, 4 * KiB);
+                leech_check(buf, TEST_BASE + address + i * 8 * KiB, 4 * KiB);
+            }
+            address = (address + pages * 8 * KiB) % TEST_SPAN;
+            done += pages * 4 * KiB;
+            break;
+        }
+    }
+    return TEST_BYTES / MiB / g_test_timer_elapsed();
+}
+
+static void test_throughput(const void *opaque)
+{
+    TestMode mode = GPOINTER_TO_INT(opaque);
+    const char *env = g_getenv("PCILEECH_TEST_MIN_MIBS");
+    double floor = env ? g_ascii_strtod(env, NULL) : TEST_MIN_MIBS;
+    TestLeech t;
+    double mibs;
+
+    leech_start(&t);
+    if (mode == TEST_READ) {
+        leech_negotiate(&t, TEST_MAX_CHUNK, 0);
+    } else {
+        leech_negotiate(&t, TEST_CHUNK, mode == TEST_PIPELINED ?
+                                        LEECH_FEATURE_OUT_OF_ORDER : 0);
+    }
+    for (uint64_t off = 0; off < TEST_SPAN; off += 4 * MiB) {
+        leech_fill(&t, TEST_BASE + off, 4 * MiB);
+    }
+    mibs = leech_throughput(&t, mode);
+    g_test_message("%.1f MiB/s, at least %.1f MiB/s expected", mibs, floor);
+    g_assert_cmpfloat(mibs, >=, floor);
+    leech_stop(&t);
+}
+
+/*
+ * Turn on VT-d translation with every device of bus 0 mapped 1:1 in 2 MiB
+ * pages over the first GiB, so that the device sees an IOMMU.
+ */
+static void leech_vtd_identity(TestLeech *t)
+{
+    const uint64_t root = VTD_TABLES, context = root + 4 * KiB;
+    const uint64_t l3 = context + 4 * KiB, l2 = l3 + 4 * KiB;
+    const uint8_t devfn = QPCI_DEVFN(0x4, 0x0);
+
+    for (uint64_t i = 0; i < 512; i++) {
+        qtest_writeq(t->qts, l2 + i * 8, (i * 2 * MiB) | VTD_SL_PS |
+                     VTD_SL_RW);
+    }
+    qtest_writeq(t->qts, l3, l2 | VTD_SL_RW);
+    qtest_writeq(t->qts, context + devfn * 16, l3 | VTD_PRESENT);
+    qtest_writeq(t->qts, context + devfn * 16 + 8, (1 << 8) | VTD_AW_39BIT);
+    qtest_writeq(t->qts, root, context | VTD_PRESENT);
+
+    qtest_writeq(t->qts, VTD_BASE + VTD_RTADDR, root);
+    qtest_writel(t->qts, VTD_BASE + VTD_GCMD, VTD_GCMD_SRTP);
+    qtest_writel(t->qts, VTD_BASE + VTD_GCMD, VTD_GCMD_TE);
+    g_assert(qtest_readl(t->qts, VTD_BASE + VTD_GSTS) & VTD_GCMD_TE);
+}
+
+static uint64_t leech_stat(TestLeech *t, const char *name)
+{
+    QDict *rsp = qtest_qmp(t->qts,
+        "{ 'execute': 'query-stats',"
+        "  'arguments': { 'target': 'pcileech',"
+        "                 'providers': [ { 'provider': 'pcileech',"
+        "                                  'names': [ %s ] } ] } }", name);
+    QList *results = qdict_get_qlist(rsp, "return");
+    QDict *result = qobject_to(QDict, qlist_peek(results));
+    QDict *stat = qobject_to(QDict, qlist_peek(qdict_get_qlist(result,
+                                                               "stats")));
+    uint64_t value;
+
+    g_assert_cmpstr(qdict_get_str(stat, "name"), ==, name);
+    value = qnum_get_uint(qobject_to(QNum, qdict_get(stat, "value")));
+    qobject_unref(rsp);
+    return value;
+}
+
+/* A client's write must drop the read-ahead windows it overwrites. */
+static void test_read_ahead_write(void)
+{
+    g_autofree uint8_t *buf = g_malloc(TEST_RA_READ);
+    g_autofree uint8_t *data = g_malloc(TEST_RA_READ);
+    uint64_t address = TEST_BASE, length;
+    TestLeech t;
+    uint32_t tag = 1;
+
+    leech_start_args(&t, "-machine q35 -device intel-iommu,intremap=off",
+                     ",read-ahead=64K,read-ahead-ttl=60000000");
+    leech_vtd_identity(&t);
+    leech_negotiate(&t, TEST_MAX_CHUNK, 0);
+    leech_fill(&t, TEST_BASE, TEST_RA_WINDOW * 2);
+
+    /* The fourth read at the same stride reads a window ahead... */
+    for (int i = 0; i < 4; i++, tag++, address += TEST_RA_READ) {
+        leech_request(&t, LEECH_REQUEST_READ, tag, address, TEST_RA_READ);
+        g_assert_cmpuint(leech_read_frames(&t, tag, buf, TEST_RA_READ,
+                                           TEST_MAX_CHUNK), ==, 0);
+        leech_check(buf, address, TEST_RA_READ);
+    }
+    /* ... that serves the next one. */
+    leech_request(&t, LEECH_REQUEST_READ, tag, address, TEST_RA_READ);
+    g_assert_cmpuint(leech_read_frames(&t, tag, buf, TEST_RA_READ,
+                                       TEST_MAX_CHUNK), ==, 0);
+    leech_check(buf, address, TEST_RA_READ);
+    g_assert_cmpuint(leech_stat(&t, "read-ahead-hits"), ==, 1);
+    tag++;
+    address += TEST_RA_READ;
+
+    /*
+     * Overwrite the window. The frame arrives in several pieces, so it
+     * is received straight into the mapped guest RAM.
+     */
+    memset(data, 0xa5, TEST_RA_READ);
+    leech_request(&t, LEECH_REQUEST_WRITE, tag, address, TEST_RA_READ);
+    leech_send(&t, data, TEST_RA_READ);
+    g_assert_cmpuint(leech_response(&t, tag, &length), ==, 0);
+    g_assert_cmpuint(length, ==, 0);
+    tag++;
+
+    leech_request(&t, LEECH_REQUEST_READ, tag, address, TEST_RA_READ);
+    g_assert_cmpuint(leech_read_frames(&t, tag, buf, TEST_RA_READ,
+                                       TEST_MAX_CHUNK), ==, 0);
+    g_assert(memcmp(buf, data, TEST_RA_READ) == 0);
+    g_assert_cmpuint(leech_stat(&t, "read-ahead-hits"), ==, 1);
+    leech_stop(&t);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    if (!qtest_has_device("pcileech")) {
+        return 0;
+    }
+    qtest_add_func("/pcileech/framing/split-header", test_split_header);
+    qtest_add_func("/pcileech/framing/coalesced", test_coalesced);
+    qtest_add_func("/pcileech/framing/zero-length", test_zero_length);
+    qtest_add_func("/pcileech/framing/huge-length", test_huge_length);
+    qtest_add_func("/pcileech/framing/unmapped", test_unmapped);
+    qtest_add_func("/pcileech/framing/unknown-command",
+                   test_unknown_command);
+    if (qtest_has_machine("q35") && qtest_has_device("intel-iommu")) {
+        qtest_add_func("/pcileech/read-ahead/write", test_read_ahead_write);
+    }
+    qtest_add_data_func("/pcileech/throughput/read",
+                        GINT_TO_POINTER(TEST_READ), test_throughput);
+    qtest_add_data_func("/pcileech/throughput/pipelined",
+                        GINT_TO_POINTER(TEST_PIPELINED), test_throughput);
+    qtest_add_data_func("/pcileech/throughput/scatter",
+                        GINT_TO_POINTER(TEST_SCATTER), test_throughput);
+
+    return g_test_run();
+}
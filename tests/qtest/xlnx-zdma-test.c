@@ -0,0 +1,140 @@
+/*
+ * QTests for the Xilinx ZynqMP ZDMA controller.
+ *
+ * SPDX-License-Identifier: GPL-2.0-or-later
+ */
+
+#include "qemu/osdep.h"
+#include "libqtest.h"
+
+/* GDMA channels of the ZynqMP. */
+#define GDMA_CH0_BASE           0xFD500000
+#define GDMA_CH1_BASE           0xFD510000
+
+/* Register addresses. */
+#define R_ZDMA_CH_ISR           0x100
+#define R_ZDMA_CH_SRC_DSCR_WORD0 0x128
+#define R_ZDMA_CH_DST_DSCR_WORD0 0x138
+#define R_ZDMA_CH_TOTAL_BYTE    0x188
+#define R_ZDMA_CH_CTRL2         0x200
+
+#define ZDMA_CH_ISR_DMA_DONE    (1 << 10)
+#define ZDMA_CH_CTRL2_EN        (1 << 0)
+
+/*
+ * Channel 1 is left idle, so that its descriptor registers can stand in
+ * for a device FIFO as MMIO source or destination of channel 0.
+ */
+#define MMIO_ADDR               (GDMA_CH1_BASE + R_ZDMA_CH_SRC_DSCR_WORD0)
+#define MMIO_ADDR2              (GDMA_CH1_BASE + R_ZDMA_CH_DST_DSCR_WORD0)
+#define MMIO_LEN                8
+
+#define RAM_SRC                 0x100000
+#define RAM_DST                 0x200000
+
+/* Larger than the 2 KiB internal buffer of the channel. */
+#define RAM_LEN                 0x3000
+
+static void zdma_set_descr(QTestState *qts, uint64_t reg, uint64_t addr,
+                           uint32_t size)
+{
+    qtest_writel(qts, GDMA_CH0_BASE + reg, addr);
+    qtest_writel(qts, GDMA_CH0_BASE + reg + 4, addr >> 32);
+    qtest_writel(qts, GDMA_CH0_BASE + reg + 8, size);
+    qtest_writel(qts, GDMA_CH0_BASE + reg + 12, 0);
+}
+
+/* Run a simple mode read/write transfer on channel 0. */
+static void zdma_copy(QTestState *qts, uint64_t dst, uint64_t src,
+                      uint32_t len)
+{
+    zdma_set_descr(qts, R_ZDMA_CH_SRC_DSCR_WORD0, src, len);
+    zdma_set_descr(qts, R_ZDMA_CH_DST_DSCR_WORD0, dst, len);
+    qtest_writel(qts, GDMA_CH0_BASE + R_ZDMA_CH_TOTAL_BYTE, ~0);
+    qtest_writel(qts, GDMA_CH0_BASE + R_ZDMA_CH_ISR, ~0);
+    qtest_writel(qts, GDMA_CH0_BASE + R_ZDMA_CH_CTRL2, ZDMA_CH_CTRL2_EN);
+
+    g_assert_cmphex(qtest_readl(qts, GDMA_CH0_BASE + R_ZDMA_CH_ISR) &
+                    ZDMA_CH_ISR_DMA_DONE, ==, ZDMA_CH_ISR_DMA_DONE);
+    g_assert_cmpuint(qtest_readl(qts, GDMA_CH0_BASE + R_ZDMA_CH_CTRL2) &
+                     ZDMA_CH_CTRL2_EN, ==, 0);
+    g_assert_cmpuint(qtest_readl(qts, GDMA_CH0_BASE + R_ZDMA_CH_TOTAL_BYTE),
+                     ==, len);
+}
+
+static void test_ram_to_ram(void)
+{
+    QTestState *qts = qtest_init("-machine xlnx-zcu102");
+    g_autofree uint8_t *src = g_malloc(RAM_LEN);
+    g_autofree uint8_t *dst = g_malloc0(RAM_LEN);
+    int i;
+
+    for (i = 0; i < RAM_LEN; i++) {
+        src[i] = i * 7 + 1;
+    }
+    qtest_memwrite(qts, RAM_SRC, src, RAM_LEN);
+
+    zdma_copy(qts, RAM_DST, RAM_SRC, RAM_LEN);
+
+    qtest_memread(qts, RAM_DST, dst, RAM_LEN);
+    g_assert(memcmp(src, dst, RAM_LEN) == 0);
+
+    qtest_quit(qts);
+}
+
+static void test_ram_to_mmio(void)
+{
+    QTestState *qts = qtest_init("-machine xlnx-zcu102");
+
+    qtest_writel(qts, RAM_SRC, 0x12345678);
+    qtest_writel(qts, RAM_SRC + 4, 0x1abcd);
+
+    zdma_copy(qts, MMIO_ADDR, RAM_SRC, MMIO_LEN);
+
+    g_assert_cmphex(qtest_readl(qts, MMIO_ADDR), ==, 0x12345678);
+    g_assert_cmphex(qtest_readl(qts, MMIO_ADDR + 4), ==, 0x1abcd);
+
+    qtest_quit(qts);
+}
+
+static void test_mmio_to_ram(void)
+{
+    QTestState *qts = qtest_init("-machine xlnx-zcu102");
+
+    qtest_writel(qts, MMIO_ADDR, 0x87654321);
+    qtest_writel(qts, MMIO_ADDR + 4, 0x10fed);
+
+    zdma_copy(qts, RAM_DST, MMIO_ADDR, MMIO_LEN);
+
+    g_assert_cmphex(qtest_readl(qts, RAM_DST), ==, 0x87654321);
+    g_assert_cmphex(qtest_readl(qts, RAM_DST + 4), ==, 0x10fed);
+
+    qtest_quit(qts);
+}
+
+static void test_mmio_to_mmio(void)
+{
+    QTestState *qts = qtest_init("-machine xlnx-zcu102");
+
+    qtest_writel(qts, MMIO_ADDR, 0xcafef00d);
+    qtest_writel(qts, MMIO_ADDR + 4, 0x1beef);
+
+    zdma_copy(qts, MMIO_ADDR2, MMIO_ADDR, MMIO_LEN);
+
+    g_assert_cmphex(qtest_readl(qts, MMIO_ADDR2), ==, 0xcafef00d);
+    g_assert_cmphex(qtest_readl(qts, MMIO_ADDR2 + 4), ==, 0x1beef);
+
+    qtest_quit(qts);
+}
+
+int main(int argc, char **argv)
+{
+    g_test_init(&argc, &argv, NULL);
+
+    qtest_add_func("/xlnx-zdma/ram-to-ram", test_ram_to_ram);
+    qtest_add_func("/xlnx-zdma/ram-to-mmio", test_ram_to_mmio);
+    qtest_add_func("/xlnx-zdma/mmio-to-ram", test_mmio_to_ram);
+    qtest_add_func("/xlnx-zdma/mmio-to-mmio", test_mmio_to_mmio);
+
+    return g_test_run();
+}
@@ -0,0 +1,33 @@
+"""Test large memory transfers, which use the binary x/X packets.
+
+This runs as a sourced script (via -x, via run-test.py).
+
+SPDX-License-Identifier: GPL-2.0-or-later
+"""
+import gdb
+from test_gdbstub import main, report
+
+
+# Larger than a packet, so that the transfer is split
+TRANSFER_SIZE = 512 * 1024
+
+
+def run_test():
+    """Run through the tests one by one"""
+    gdb.Breakpoint("SHA1Init")
+    gdb.execute("continue")
+
+    inferior = gdb.selected_inferior()
+    # The stack below the current frame is mapped but unused
+    addr = int(gdb.parse_and_eval("$sp")) - TRANSFER_SIZE - 4096
+
+    # Include the characters that binary packets must escape
+    pattern = bytes(((i * 7) ^ (i >> 8)) & 0xff for i in range(TRANSFER_SIZE))
+    pattern = b"\0#$}*" + pattern[5:]
+    inferior.write_memory(addr, pattern)
+    data = inferior.read_memory(addr, TRANSFER_SIZE).tobytes()
+    report(data == pattern,
+           "read back {} bytes at 0x{:x}".format(TRANSFER_SIZE, addr))
+
+
+main(run_test)
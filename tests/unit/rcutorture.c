@@ -433,6 +433,71 @@ static void gtest_stress_10_5(void)
     gtest_stress(10, 5);
 }
 
+/*
+ * call_rcu() test: check that the callbacks of registered and unregistered
+ * threads all run, and that a large backlog expedites the grace period.
+ */
+
+#define RCU_CALL_PER_THREAD 2000
+
+struct rcu_call_test {
+    struct rcu_head rcu;
+};
+
+static int rcu_call_done;
+
+static void rcu_call_test_cb(struct rcu_call_test *t)
+{
+    qatomic_inc(&rcu_call_done);
+    g_free(t);
+}
+
+static void *rcu_call_test_thread(void *arg)
+{
+    bool registered = *(bool *)arg;
+    int i;
+
+    if (registered) {
+        rcu_register_thread();
+    }
+    for (i = 0; i < RCU_CALL_PER_THREAD; i++) {
+        struct rcu_call_test *t = g_new0(struct rcu_call_test, 1);
+
+        call_rcu(t, rcu_call_test_cb, rcu);
+    }
+    drain_call_rcu();
+    if (registered) {
+        rcu_unregister_thread();
+    }
+    return NULL;
+}
+
+static void gtest_call_rcu(void)
+{
+    QemuThread thread[4];
+    bool registered[4] = { true, true, false, false };
+    RCUStats before, after;
+    int i;
+
+    rcu_get_stats(&before);
+    for (i = 0; i < ARRAY_SIZE(thread); i++) {
+        qemu_thread_create(&thread[i], "test", rcu_call_test_thread,
+                           &registered[i], QEMU_THREAD_JOINABLE);
+    }
+    for (i = 0; i < ARRAY_SIZE(thread); i++) {
+        qemu_thread_join(&thread[i]);
+    }
+    drain_call_rcu();
+    rcu_get_stats(&after);
+
+    g_assert_cmpint(qatomic_read(&rcu_call_done), ==,
+                    ARRAY_SIZE(thread) * RCU_CALL_PER_THREAD);
+    g_assert_cmpuint(after.invoked - before.invoked, >=,
+                     ARRAY_SIZE(thread) * RCU_CALL_PER_THREAD);
+    g_assert_cmpuint(after.expedited_grace_periods, >,
+                     before.expedited_grace_periods);
+}
+
 /*
  * Mainprogram.
  */
@@ -459,6 +524,7 @@ int main(int argc, char *argv[])
             g_test_add_func("/rcu/torture/1reader", gtest_stress_1_5);
             g_test_add_func("/rcu/torture/10readers", gtest_stress_10_5);
         }
+        g_test_add_func("/rcu/call", gtest_call_rcu);
         return g_test_run();
     }
 
@@ -437,6 +437,68 @@ static void test_multi_mutex_10(void)
     test_multi_mutex(NUM_CONTEXTS, 10);
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+/* aio_add_sqe() test.  */
+
+typedef struct {
+    CqeHandler cqe_handler;
+    int fd;
+    char buf[16];
+    bool has_io_uring;
+    QemuEvent done;
+} SqeTestData;
+
+static void sqe_read_prep(struct io_uring_sqe *sqe, void *opaque)
+{
+    SqeTestData *data = opaque;
+
+    io_uring_prep_read(sqe, data->fd, data->buf, sizeof(data->buf), -1);
+}
+
+static void sqe_read_done(CqeHandler *cqe_handler)
+{
+    SqeTestData *data = container_of(cqe_handler, SqeTestData, cqe_handler);
+
+    qemu_event_set(&data->done);
+}
+
+static void sqe_read_submit(void *opaque)
+{
+    SqeTestData *data = opaque;
+
+    data->has_io_uring = aio_has_io_uring(qemu_get_current_aio_context());
+    if (data->has_io_uring) {
+        aio_add_sqe(sqe_read_prep, data, &data->cqe_handler);
+    }
+}
+
+static void test_add_sqe(void)
+{
+    SqeTestData data = { .cqe_handler.cb = sqe_read_done };
+    int fds[2];
+
+    g_assert(g_unix_open_pipe(fds, FD_CLOEXEC, NULL));
+    data.fd = fds[0];
+    qemu_event_init(&data.done, false);
+
+    create_aio_contexts();
+    ctx_run(0, sqe_read_submit, &data);
+    if (data.has_io_uring) {
+        g_assert_cmpint(write(fds[1], "hello", 5), ==, 5);
+        qemu_event_wait(&data.done);
+        g_assert_cmpint(data.cqe_handler.cqe.res, ==, 5);
+        g_assert_cmpmem(data.buf, 5, "hello", 5);
+    } else {
+        g_test_skip("io_uring is not available");
+    }
+    join_aio_contexts();
+
+    qemu_event_destroy(&data.done);
+    close(fds[0]);
+    close(fds[1]);
+}
+#endif
+
 /* End of tests.  */
 
 int main(int argc, char **argv)
@@ -445,6 +507,9 @@ int main(int argc, char **argv)
 
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/aio/multi/lifecycle", test_lifecycle);
+#ifdef CONFIG_LINUX_IO_URING
+    g_test_add_func("/aio/multi/add-sqe", test_add_sqe);
+#endif
     if (g_test_quick()) {
         g_test_add_func("/aio/multi/schedule", test_multi_co_schedule_1);
         g_test_add_func("/aio/multi/mutex/contended", test_multi_co_mutex_1);
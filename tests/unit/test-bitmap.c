@@ -123,6 +123,31 @@ static void check_bitmap_set(void)
     bitmap_set_case(bitmap_set_atomic);
 }
 
+static void check_bitmap_copy_and_clear_atomic(void)
+{
+    /* Some clean runs, some dirty ones, and a tail shorter than a run */
+    long nbits = BITMAP_ZERO_RUN_LONGS * BITS_PER_LONG * 8 + 3 * BITS_PER_LONG;
+    unsigned long *src = bitmap_new(nbits);
+    unsigned long *dst = bitmap_new(nbits);
+    unsigned long *ref = bitmap_new(nbits);
+    long i;
+
+    bitmap_fill(dst, nbits);
+    for (i = 0; i < nbits; i += g_test_rand_int_range(1, 4096)) {
+        set_bit(i, src);
+    }
+    set_bit(nbits - 1, src);
+    bitmap_copy(ref, src, nbits);
+
+    bitmap_copy_and_clear_atomic(dst, src, nbits);
+    g_assert(bitmap_equal(dst, ref, nbits));
+    g_assert(bitmap_empty(src, nbits));
+
+    g_free(src);
+    g_free(dst);
+    g_free(ref);
+}
+
 int main(int argc, char **argv)
 {
     g_test_init(&argc, &argv, NULL);
@@ -131,6 +156,8 @@ int main(int argc, char **argv)
                     check_bitmap_copy_with_offset);
     g_test_add_func("/bitmap/bitmap_set",
                     check_bitmap_set);
+    g_test_add_func("/bitmap/bitmap_copy_and_clear_atomic",
+                    check_bitmap_copy_and_clear_atomic);
 
     g_test_run();
 
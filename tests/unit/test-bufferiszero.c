@@ -19,6 +19,7 @@
  */
 
 #include "qemu/osdep.h"
+#include "qemu/bitops.h"
 #include "qemu/cutils.h"
 
 static char buffer[8 * 1024 * 1024];
@@ -58,13 +59,44 @@ static void test_1(void)
     }
 }
 
+static void test_batch_1(void)
+{
+    const void *bufs[BUFFER_IS_ZERO_BATCH_MAX];
+    size_t len, n;
+
+    for (len = 1; len <= 8192; len = len * 3 + 1) {
+        for (n = 0; n < BUFFER_IS_ZERO_BATCH_MAX; n++) {
+            bufs[n] = buffer + n * (len + 8) + n % 7;
+        }
+
+        for (n = 0; n <= BUFFER_IS_ZERO_BATCH_MAX; n++) {
+            uint64_t all = n ? MAKE_64BIT_MASK(0, n) : 0;
+
+            g_assert_cmphex(buffer_is_zero_batch(bufs, n, len), ==, all);
+        }
+
+        /* Mark a byte in every third buffer, away from the samples.  */
+        for (n = 0; n < BUFFER_IS_ZERO_BATCH_MAX; n += 3) {
+            ((char *)bufs[n])[len * 2 / 3] = 1;
+        }
+        g_assert_cmphex(buffer_is_zero_batch(bufs, BUFFER_IS_ZERO_BATCH_MAX,
+                                             len),
+                        ==, ~0x9249249249249249ull);
+        for (n = 0; n < BUFFER_IS_ZERO_BATCH_MAX; n += 3) {
+            ((char *)bufs[n])[len * 2 / 3] = 0;
+        }
+    }
+}
+
 static void test_2(void)
 {
     if (g_test_perf()) {
         test_1();
+        test_batch_1();
     } else {
         do {
             test_1();
+            test_batch_1();
         } while (test_buffer_is_zero_next_accel());
     }
 }
@@ -178,6 +178,47 @@ static void char_ringbuf_test(void)
     qemu_opts_del(opts);
 }
 
+static void char_ringbuf_writev_test(void)
+{
+    QemuOpts *opts;
+    Chardev *chr;
+    CharBackend be;
+    char *data;
+    int ret;
+    const struct iovec iov[] = {
+        { .iov_base = (void *)"he", .iov_len = 2 },
+        { .iov_base = NULL, .iov_len = 0 },
+        { .iov_base = (void *)"llo", .iov_len = 3 },
+    };
+
+    opts = qemu_opts_create(qemu_find_opts("chardev"), "ringbuf-label",
+                            1, &error_abort);
+    qemu_opt_set(opts, "backend", "ringbuf", &error_abort);
+    qemu_opt_set(opts, "size", "8", &error_abort);
+    chr = qemu_chr_new_from_opts(opts, NULL, &error_abort);
+    g_assert_nonnull(chr);
+    qemu_opts_del(opts);
+
+    qemu_chr_fe_init(&be, chr, &error_abort);
+    ret = qemu_chr_fe_writev_all(&be, iov, ARRAY_SIZE(iov));
+    g_assert_cmpint(ret, ==, 5);
+
+    data = qmp_ringbuf_read("ringbuf-label", 8, false, 0, &error_abort);
+    g_assert_cmpstr(data, ==, "hello");
+    g_free(data);
+
+    /* The ring buffer never pushes back, so nothing is queued. */
+    ret = qemu_chr_fe_write_async(&be, iov, ARRAY_SIZE(iov), NULL, NULL);
+    g_assert_cmpint(ret, ==, 1);
+    g_assert_cmpint(qemu_chr_fe_write_pending(&be), ==, 0);
+
+    data = qmp_ringbuf_read("ringbuf-label", 8, false, 0, &error_abort);
+    g_assert_cmpstr(data, ==, "hello");
+    g_free(data);
+
+    qemu_chr_fe_deinit(&be, true);
+}
+
 static void char_mux_test(void)
 {
     QemuOpts *opts;
@@ -548,6 +589,94 @@ static void char_pipe_test(void)
     g_free(tmp_path);
     g_free(pipe);
 }
+
+typedef struct WriteAsyncData {
+    int count;
+    int ret;
+} WriteAsyncData;
+
+static void char_write_async_done(void *opaque, int ret)
+{
+    WriteAsyncData *d = opaque;
+
+    d->count++;
+    d->ret = ret;
+}
+
+static void char_write_async_test(void)
+{
+    const size_t len = 64 * KiB;
+    g_autofree uint8_t *data = g_malloc(len);
+    g_autofree uint8_t *peer = g_malloc(len);
+    struct iovec iov = { .iov_base = data, .iov_len = len };
+    WriteAsyncData d1 = { 0 }, d2 = { 0 }, d3 = { 0 };
+    int sndbuf = 4096;
+    size_t received = 0;
+    CharBackend be;
+    Chardev *chr;
+    char *optstr;
+    int sv[2];
+    int ret;
+
+    for (size_t i = 0; i < len; i++) {
+        data[i] = i * 7;
+    }
+
+    g_assert(qemu_socketpair(AF_UNIX, SOCK_STREAM, 0, sv) == 0);
+    g_assert(setsockopt(sv[0], SOL_SOCKET, SO_SNDBUF,
+                        &sndbuf, sizeof(sndbuf)) == 0);
+    qemu_socket_set_nonblock(sv[1]);
+
+    optstr = g_strdup_printf("socket,id=async,fd=%d", sv[0]);
+    chr = qemu_chr_new("async", optstr, NULL);
+    g_assert_nonnull(chr);
+    g_free(optstr);
+    qemu_chr_fe_init(&be, chr, &error_abort);
+    qemu_chr_fe_set_write_limit(&be, len);
+
+    /* The socket takes a few KiB at most, the rest is queued. */
+    ret = qemu_chr_fe_write_async(&be, &iov, 1, char_write_async_done, &d1);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpint(qemu_chr_fe_write_pending(&be), >, 0);
+    g_assert_cmpint(qemu_chr_fe_write_pending(&be), <, len);
+
+    /* A second write would go past the limit and is refused whole. */
+    ret = qemu_chr_fe_write_async(&be, &iov, 1, char_write_async_done, &d2);
+    g_assert_cmpint(ret, ==, -EAGAIN);
+
+    /* Drain the peer; the watch flushes the queue and runs the callback. */
+    while (!d1.count) {
+        ssize_t n = read(sv[1], peer + received, len - received);
+
+        if (n > 0) {
+            received += n;
+        } else {
+            g_assert(n < 0 && errno == EAGAIN);
+        }
+        main_loop_wait(true);
+    }
+    g_assert_cmpint(d1.ret, ==, 0);
+    g_assert_cmpint(qemu_chr_fe_write_pending(&be), ==, 0);
+    g_assert_cmpint(d2.count, ==, 0);
+
+    while (received < len) {
+        ssize_t n = read(sv[1], peer + received, len - received);
+
+        g_assert(n > 0);
+        received += n;
+    }
+    g_assert(memcmp(peer, data, len) == 0);
+
+    /* Data still queued when the front end goes away is cancelled. */
+    ret = qemu_chr_fe_write_async(&be, &iov, 1, char_write_async_done, &d3);
+    g_assert_cmpint(ret, ==, 0);
+    g_assert_cmpint(d3.count, ==, 0);
+    qemu_chr_fe_deinit(&be, true);
+    g_assert_cmpint(d3.count, ==, 1);
+    g_assert_cmpint(d3.ret, ==, -ECANCELED);
+
+    close(sv[1]);
+}
 #endif
 
 typedef struct SocketIdleData {
@@ -1506,6 +1635,7 @@ int main(int argc, char **argv)
     g_test_add_func("/char/null", char_null_test);
     g_test_add_func("/char/invalid", char_invalid_test);
     g_test_add_func("/char/ringbuf", char_ringbuf_test);
+    g_test_add_func("/char/ringbuf-writev", char_ringbuf_writev_test);
     g_test_add_func("/char/mux", char_mux_test);
 #ifdef _WIN32
     g_test_add_func("/char/console/subprocess", char_console_test_subprocess);
@@ -1515,6 +1645,7 @@ int main(int argc, char **argv)
     g_test_add_func("/char/stdio", char_stdio_test);
 #ifndef _WIN32
     g_test_add_func("/char/pipe", char_pipe_test);
+    g_test_add_func("/char/write-async", char_write_async_test);
 #endif
     g_test_add_func("/char/file", char_file_test);
 #ifndef _WIN32
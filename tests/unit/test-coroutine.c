@@ -101,6 +101,11 @@ typedef struct {
     unsigned int max;       /* maximum level of nesting */
 } NestData;
 
+static void coroutine_fn empty_coroutine(void *opaque)
+{
+    /* Do nothing */
+}
+
 static void coroutine_fn nest(void *opaque)
 {
     NestData *nd = opaque;
@@ -134,6 +139,30 @@ static void test_nesting(void)
     g_assert_cmpint(nd.n_return, ==, nd.max);
 }
 
+/*
+ * Check that coroutines run on small stacks and that the pool does not
+ * hand out a coroutine with the wrong stack size
+ */
+
+static void test_stack_size(void)
+{
+    NestData nd = {
+        .max = 16,
+    };
+    Coroutine *co;
+
+    qemu_coroutine_set_stack_size(COROUTINE_STACK_SIZE_MIN);
+    co = qemu_coroutine_create(nest, &nd);
+    g_assert_cmpuint(co->stack_size, ==, COROUTINE_STACK_SIZE_MIN);
+    qemu_coroutine_enter(co);
+    g_assert_cmpint(nd.n_return, ==, nd.max);
+
+    qemu_coroutine_set_stack_size(0);
+    co = qemu_coroutine_create(empty_coroutine, NULL);
+    g_assert_cmpuint(co->stack_size, >, COROUTINE_STACK_SIZE_MIN);
+    qemu_coroutine_enter(co);
+}
+
 /*
  * Check that yield/enter transfer control correctly
  */
@@ -506,11 +535,6 @@ static void test_order(void)
  * Lifecycle benchmark
  */
 
-static void coroutine_fn empty_coroutine(void *opaque)
-{
-    /* Do nothing */
-}
-
 static void perf_lifecycle(void)
 {
     Coroutine *coroutine;
@@ -586,6 +610,58 @@ static void perf_yield(void)
     g_test_message("Yield %u iterations: %f s", maxcycles, duration);
 }
 
+static __attribute__((noinline)) void coroutine_fn perf_cost_func(void *opaque)
+{
+    qemu_coroutine_yield();
+}
+
+/*
+ * Queue depth benchmark: keep @depth coroutines suspended at once, as a
+ * busy IOThread does, so that the pool and the stacks are both exercised
+ */
+
+static void perf_depth_one(unsigned int depth, size_t stack_size)
+{
+    const unsigned int maxcycles = 4000000 / depth;
+    g_autofree Coroutine **co = g_new(Coroutine *, depth);
+    unsigned int i, j;
+    double duration;
+
+    qemu_coroutine_set_stack_size(stack_size);
+
+    g_test_timer_start();
+    for (i = 0; i < maxcycles; i++) {
+        for (j = 0; j < depth; j++) {
+            co[j] = qemu_coroutine_create(perf_cost_func, NULL);
+            qemu_coroutine_enter(co[j]);
+        }
+        for (j = 0; j < depth; j++) {
+            qemu_coroutine_enter(co[j]);
+        }
+    }
+    duration = g_test_timer_elapsed();
+
+    g_test_message("Depth %u, %zu KiB stacks: %u coroutines %f s, "
+                   "%luns per coroutine",
+                   depth, stack_size ? stack_size / 1024 : 0,
+                   maxcycles * depth, duration,
+                   (unsigned long)(1000000000.0 * duration /
+                                   (maxcycles * depth)));
+
+    qemu_coroutine_set_stack_size(0);
+}
+
+static void perf_depth(void)
+{
+    static const unsigned int depths[] = { 1, 64, 1024 };
+    int i;
+
+    for (i = 0; i < ARRAY_SIZE(depths); i++) {
+        perf_depth_one(depths[i], 0);
+        perf_depth_one(depths[i], 64 * 1024);
+    }
+}
+
 static __attribute__((noinline)) void dummy(unsigned *i)
 {
     (*i)--;
@@ -608,11 +684,6 @@ static void perf_baseline(void)
     g_test_message("Function call %u iterations: %f s", maxcycles, duration);
 }
 
-static __attribute__((noinline)) void coroutine_fn perf_cost_func(void *opaque)
-{
-    qemu_coroutine_yield();
-}
-
 static void perf_cost(void)
 {
     const unsigned long maxcycles = 40000000;
@@ -652,6 +723,7 @@ int main(int argc, char **argv)
     g_test_add_func("/basic/lifecycle", test_lifecycle);
     g_test_add_func("/basic/yield", test_yield);
     g_test_add_func("/basic/nesting", test_nesting);
+    g_test_add_func("/basic/stack-size", test_stack_size);
     g_test_add_func("/basic/self", test_self);
     g_test_add_func("/basic/entered", test_entered);
     g_test_add_func("/basic/in_coroutine", test_in_coroutine);
@@ -666,6 +738,7 @@ int main(int argc, char **argv)
         g_test_add_func("/perf/yield", perf_yield);
         g_test_add_func("/perf/function-call", perf_baseline);
         g_test_add_func("/perf/cost", perf_cost);
+        g_test_add_func("/perf/depth", perf_depth);
     }
     return g_test_run();
 }
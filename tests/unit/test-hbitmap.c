@@ -793,6 +793,44 @@ static void test_hbitmap_serialize_zeroes(TestHBitmapData *data,
     }
 }
 
+static void test_hbitmap_meta(TestHBitmapData *data, const void *unused)
+{
+    HBitmap *meta, *other;
+    uint64_t min_l1 = MAX(L1, 64);
+
+    hbitmap_test_init(data, L3, 0);
+    meta = hbitmap_create_meta(data->hb, L1);
+    g_assert(hbitmap_empty(meta));
+
+    hbitmap_set(data->hb, L1 + 1, 1);
+    g_assert_cmpint(hbitmap_next_dirty(meta, 0, INT64_MAX), ==, L1);
+    g_assert_cmpint(hbitmap_count(meta), ==, L1);
+    hbitmap_reset_all(meta);
+
+    /* Setting bits that are set, or resetting clear bits, changes nothing */
+    hbitmap_set(data->hb, L1 + 1, 1);
+    hbitmap_reset(data->hb, 0, L1);
+    g_assert(hbitmap_empty(meta));
+
+    hbitmap_reset(data->hb, L1, L1);
+    g_assert_cmpint(hbitmap_next_dirty(meta, 0, INT64_MAX), ==, L1);
+    hbitmap_reset_all(meta);
+
+    /* Bits that are overwritten are considered changed */
+    hbitmap_deserialize_zeroes(data->hb, L2, min_l1, true);
+    g_assert_cmpint(hbitmap_next_dirty(meta, 0, INT64_MAX), ==, L2);
+    g_assert_cmpint(hbitmap_count(meta), ==, min_l1);
+    hbitmap_reset_all(meta);
+
+    other = hbitmap_alloc(L3, 0);
+    hbitmap_set(other, 0, 1);
+    hbitmap_merge(data->hb, other, data->hb);
+    g_assert_cmpint(hbitmap_count(meta), ==, L3);
+    hbitmap_free(other);
+
+    hbitmap_free_meta(data->hb);
+}
+
 static void hbitmap_test_add(const char *testpath,
                                    void (*test_func)(TestHBitmapData *data, const void *user_data))
 {
@@ -1097,6 +1135,8 @@ int main(int argc, char **argv)
     hbitmap_test_add("/hbitmap/iter/iter_and_reset",
                      test_hbitmap_iter_and_reset);
 
+    hbitmap_test_add("/hbitmap/meta", test_hbitmap_meta);
+
     hbitmap_test_add("/hbitmap/next_zero/next_x_0",
                      test_hbitmap_next_x_0);
     hbitmap_test_add("/hbitmap/next_zero/next_x_4",
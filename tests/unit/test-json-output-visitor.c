@@ -0,0 +1,269 @@
+/*
+ * JSON Output Visitor unit-tests.
+ *
+ * Every test visits the same value with the JSON output visitor and
+ * with the QObject output visitor, and checks that the JSON text
+ * parses to what the latter built.
+ *
+ * This work is licensed under the terms of the GNU GPL, version 2 or later.
+ * See the COPYING file in the top-level directory.
+ */
+
+#include "qemu/osdep.h"
+
+#include "qapi/error.h"
+#include "qapi/json-output-visitor.h"
+#include "qapi/qobject-output-visitor.h"
+#include "test-qapi-visit.h"
+#include "qapi/qmp/qdict.h"
+#include "qapi/qmp/qjson.h"
+#include "qapi/qmp/qlist.h"
+#include "qapi/qmp/qnum.h"
+
+typedef struct TestOutputVisitorData {
+    Visitor *jov;
+    Visitor *qov;
+    GString *json;
+    QObject *obj;
+} TestOutputVisitorData;
+
+static void visitor_output_setup(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    data->jov = json_output_visitor_new(&data->json);
+    data->qov = qobject_output_visitor_new(&data->obj);
+}
+
+static void visitor_output_teardown(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    visit_free(data->jov);
+    visit_free(data->qov);
+    if (data->json) {
+        g_string_free(data->json, true);
+    }
+    qobject_unref(data->obj);
+    memset(data, 0, sizeof(*data));
+}
+
+/* Check that both visits produced the same value, return the JSON text */
+static const char *visitor_check(TestOutputVisitorData *data)
+{
+    QObject *parsed;
+
+    visit_complete(data->jov, &data->json);
+    visit_complete(data->qov, &data->obj);
+    g_assert(data->json);
+
+    parsed = qobject_from_json(data->json->str, &error_abort);
+    g_assert(qobject_is_equal(parsed, data->obj));
+    qobject_unref(parsed);
+    return data->json->str;
+}
+
+static void test_visitor_out_scalars(TestOutputVisitorData *data,
+                                     const void *unused)
+{
+    int64_t i = -42;
+    uint64_t u = UINT64_MAX;
+    double d = 3.14;
+    bool b = true;
+    char *s = (char *)"\"quoted\"\n\ttext \xc3\xa4";
+    char *none = NULL;
+    EnumOne e = ENUM_ONE_VALUE2;
+    QNull *null = NULL;
+    Visitor *v[] = { data->jov, data->qov };
+
+    for (int n = 0; n < ARRAY_SIZE(v); n++) {
+        visit_start_list(v[n], NULL, NULL, 0, &error_abort);
+        visit_type_int(v[n], NULL, &i, &error_abort);
+        visit_type_uint64(v[n], NULL, &u, &error_abort);
+        visit_type_number(v[n], NULL, &d, &error_abort);
+        visit_type_bool(v[n], NULL, &b, &error_abort);
+        visit_type_str(v[n], NULL, &s, &error_abort);
+        visit_type_str(v[n], NULL, &none, &error_abort);
+        visit_type_EnumOne(v[n], NULL, &e, &error_abort);
+        visit_type_null(v[n], NULL, &null, &error_abort);
+        visit_end_list(v[n], NULL);
+    }
+
+    g_assert_cmpstr(visitor_check(data), ==,
+                    "[-42, 18446744073709551615, 3.1400000000000001, true, "
+                    "\"\\\"quoted\\\"\\n\\ttext \\u00E4\", \"\", "
+                    "\"value2\", null]");
+}
+
+static void test_visitor_out_struct(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    TestStruct test_struct = { .integer = 42,
+                               .boolean = false,
+                               .string = (char *) "foo"};
+    TestStruct *p = &test_struct;
+
+    visit_type_TestStruct(data->jov, NULL, &p, &error_abort);
+    visit_type_TestStruct(data->qov, NULL, &p, &error_abort);
+
+    /* Members come in schema order */
+    g_assert_cmpstr(visitor_check(data), ==,
+                    "{\"integer\": 42, \"boolean\": false, \"string\": "
+                    "\"foo\"}");
+}
+
+static void test_visitor_out_struct_nested(TestOutputVisitorData *data,
+                                           const void *unused)
+{
+    UserDefTwo *ud2 = g_new0(UserDefTwo, 1);
+
+    ud2->string0 = g_strdup("forty two");
+    ud2->dict1 = g_new0(UserDefTwoDict, 1);
+    ud2->dict1->string1 = g_strdup("forty three");
+    ud2->dict1->dict2 = g_new0(UserDefTwoDictDict, 1);
+    ud2->dict1->dict2->userdef = g_new0(UserDefOne, 1);
+    ud2->dict1->dict2->userdef->string = g_strdup("forty four");
+    ud2->dict1->dict2->userdef->integer = 44;
+    ud2->dict1->dict2->string = g_strdup("forty five");
+    ud2->dict1->dict3 = g_new0(UserDefTwoDictDict, 1);
+    ud2->dict1->dict3->userdef = g_new0(UserDefOne, 1);
+    ud2->dict1->dict3->userdef->string = g_strdup("forty six");
+    ud2->dict1->dict3->userdef->integer = 46;
+    ud2->dict1->dict3->string = g_strdup("forty seven");
+
+    visit_type_UserDefTwo(data->jov, "unused", &ud2, &error_abort);
+    visit_type_UserDefTwo(data->qov, "unused", &ud2, &error_abort);
+    visitor_check(data);
+
+    qapi_free_UserDefTwo(ud2);
+}
+
+static void test_visitor_out_list(TestOutputVisitorData *data,
+                                  const void *unused)
+{
+    TestStructList *head = NULL;
+
+    for (int i = 0; i < 10; i++) {
+        TestStruct *value = g_new0(TestStruct, 1);
+
+        value->integer = i;
+        value->boolean = i & 1;
+        value->string = g_strdup_printf("item %d", i);
+        QAPI_LIST_PREPEND(head, value);
+    }
+
+    visit_type_TestStructList(data->jov, NULL, &head, &error_abort);
+    visit_type_TestStructList(data->qov, NULL, &head, &error_abort);
+    visitor_check(data);
+
+    qapi_free_TestStructList(head);
+}
+
+static void test_visitor_out_empty_list(TestOutputVisitorData *data,
+                                        const void *unused)
+{
+    TestStructList *head = NULL;
+
+    visit_type_TestStructList(data->jov, NULL, &head, &error_abort);
+    visit_type_TestStructList(data->qov, NULL, &head, &error_abort);
+    g_assert_cmpstr(visitor_check(data), ==, "[]");
+}
+
+static void test_visitor_out_any(TestOutputVisitorData *data,
+                                 const void *unused)
+{
+    QObject *qobj = qobject_from_json("{ 'integer': -42, 'boolean': true,"
+                                      " 'list': [ 1, 'two', null, {} ] }",
+                                      &error_abort);
+
+    visit_type_any(data->jov, NULL, &qobj, &error_abort);
+    visit_type_any(data->qov, NULL, &qobj, &error_abort);
+    visitor_check(data);
+
+    qobject_unref(qobj);
+}
+
+static void test_visitor_out_union_flat(TestOutputVisitorData *data,
+                                        const void *unused)
+{
+    UserDefFlatUnion *tmp = g_new0(UserDefFlatUnion, 1);
+
+    tmp->enum1 = ENUM_ONE_VALUE1;
+    tmp->string = g_strdup("str");
+    tmp->integer = 41;
+    tmp->u.value1.boolean = true;
+
+    visit_type_UserDefFlatUnion(data->jov, NULL, &tmp, &error_abort);
+    visit_type_UserDefFlatUnion(data->qov, NULL, &tmp, &error_abort);
+    visitor_check(data);
+
+    qapi_free_UserDefFlatUnion(tmp);
+}
+
+static void test_visitor_out_alternate(TestOutputVisitorData *data,
+                                       const void *unused)
+{
+    UserDefAlternate *tmp = g_new0(UserDefAlternate, 1);
+
+    tmp->type = QTYPE_QNUM;
+    tmp->u.i = 42;
+
+    visit_type_UserDefAlternate(data->jov, NULL, &tmp, &error_abort);
+    visit_type_UserDefAlternate(data->qov, NULL, &tmp, &error_abort);
+    g_assert_cmpstr(visitor_check(data), ==, "42");
+
+    qapi_free_UserDefAlternate(tmp);
+}
+
+static void test_visitor_out_policy(TestOutputVisitorData *data,
+                                    const void *unused)
+{
+    CompatPolicy policy = {
+        .has_deprecated_output = true,
+        .deprecated_output = COMPAT_POLICY_OUTPUT_HIDE,
+    };
+    FeatureStruct1 fs = { .foo = 42 };
+    FeatureStruct1 *p = &fs;
+
+    visit_set_policy(data->jov, &policy);
+    visit_set_policy(data->qov, &policy);
+    visit_type_FeatureStruct1(data->jov, NULL, &p, &error_abort);
+    visit_type_FeatureStruct1(data->qov, NULL, &p, &error_abort);
+    g_assert_cmpstr(visitor_check(data), ==, "{}");
+}
+
+static void output_visitor_test_add(const char *testpath,
+                                    TestOutputVisitorData *data,
+                                    void (*test_func)(TestOutputVisitorData *data, const void *user_data))
+{
+    g_test_add(testpath, TestOutputVisitorData, data, visitor_output_setup,
+               test_func, visitor_output_teardown);
+}
+
+int main(int argc, char **argv)
+{
+    TestOutputVisitorData out_visitor_data;
+
+    g_test_init(&argc, &argv, NULL);
+
+    output_visitor_test_add("/visitor/json-output/scalars",
+                            &out_visitor_data, test_visitor_out_scalars);
+    output_visitor_test_add("/visitor/json-output/struct",
+                            &out_visitor_data, test_visitor_out_struct);
+    output_visitor_test_add("/visitor/json-output/struct-nested",
+                            &out_visitor_data, test_visitor_out_struct_nested);
+    output_visitor_test_add("/visitor/json-output/list",
+                            &out_visitor_data, test_visitor_out_list);
+    output_visitor_test_add("/visitor/json-output/empty-list",
+                            &out_visitor_data, test_visitor_out_empty_list);
+    output_visitor_test_add("/visitor/json-output/any",
+                            &out_visitor_data, test_visitor_out_any);
+    output_visitor_test_add("/visitor/json-output/union-flat",
+                            &out_visitor_data, test_visitor_out_union_flat);
+    output_visitor_test_add("/visitor/json-output/alternate",
+                            &out_visitor_data, test_visitor_out_alternate);
+    output_visitor_test_add("/visitor/json-output/policy",
+                            &out_visitor_data, test_visitor_out_policy);
+
+    g_test_run();
+
+    return 0;
+}
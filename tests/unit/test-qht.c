@@ -251,10 +251,58 @@ static void test_resize(void)
     qht_test(QHT_MODE_AUTO_RESIZE);
 }
 
+/*
+ * Resize back and forth while another thread inserts, looks up and removes
+ * entries; none of its operations may observe the resize.
+ */
+
+static bool resize_stop;
+
+static void *resize_worker(void *opaque)
+{
+    rcu_register_thread();
+    while (!qatomic_read(&resize_stop)) {
+        insert(N, N * 2);
+        check(0, N * 2, true);
+        rm(N, N * 2);
+        check(N, N * 2, false);
+    }
+    rcu_unregister_thread();
+    return NULL;
+}
+
+static void test_resize_concurrent(void)
+{
+    struct qht_stats stats;
+    QemuThread thread;
+    int i;
+
+    qht_init(&ht, is_equal, N, 0);
+    insert(0, N);
+
+    qemu_thread_create(&thread, "resize-worker", resize_worker, NULL,
+                       QEMU_THREAD_JOINABLE);
+    for (i = 0; i < 100; i++) {
+        g_assert_true(qht_resize(&ht, i % 2 ? N : N * 8));
+    }
+    qatomic_set(&resize_stop, true);
+    qemu_thread_join(&thread);
+
+    check(0, N, true);
+    check_n(N);
+    qht_statistics_init(&ht, &stats);
+    g_assert_cmpuint(stats.resizes, ==, 100);
+    g_assert_cmpuint(qdist_sample_count(&stats.chain_entries), ==,
+                     stats.used_head_buckets);
+    qht_statistics_destroy(&stats);
+    qht_destroy(&ht);
+}
+
 int main(int argc, char *argv[])
 {
     g_test_init(&argc, &argv, NULL);
     g_test_add_func("/qht/mode/default", test_default);
     g_test_add_func("/qht/mode/resize", test_resize);
+    g_test_add_func("/qht/resize/concurrent", test_resize_concurrent);
     return g_test_run();
 }
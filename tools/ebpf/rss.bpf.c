@@ -34,6 +34,7 @@
 #include <linux/virtio_net.h>
 
 #define INDIRECTION_TABLE_SIZE 128
+#define FLOW_TABLE_SIZE 4096
 #define HASH_CALCULATION_BUFFER_SIZE 36
 
 struct rss_config_t {
@@ -42,6 +43,7 @@ struct rss_config_t {
     __u32 hash_types;
     __u16 indirections_len;
     __u16 default_queue;
+    __u8 flow_steering;
 } __attribute__((packed));
 
 struct toeplitz_key_data_t {
@@ -76,6 +78,26 @@ struct packet_hash_info_t {
     };
 };
 
+/*
+ * A TCP or UDP flow in the receive direction, IPv4 addresses are in the
+ * first 4 bytes of the fields
+ */
+struct flow_key_t {
+    __u8 is_ipv6;
+    __u8 is_tcp;
+    __be16 src_port;
+    __be16 dst_port;
+    __u16 reserved;
+    union {
+        __be32 in_src;
+        struct in6_addr in6_src;
+    };
+    union {
+        __be32 in_dst;
+        struct in6_addr in6_dst;
+    };
+};
+
 struct {
     __uint(type, BPF_MAP_TYPE_ARRAY);
     __uint(key_size, sizeof(__u32));
@@ -100,6 +122,14 @@ struct {
     __uint(map_flags, BPF_F_MMAPABLE);
 } tap_rss_map_indirection_table SEC(".maps");
 
+/* Filled by QEMU with the queue that each flow is transmitted from */
+struct {
+    __uint(type, BPF_MAP_TYPE_LRU_HASH);
+    __uint(key_size, sizeof(struct flow_key_t));
+    __uint(value_size, sizeof(__u16));
+    __uint(max_entries, FLOW_TABLE_SIZE);
+} tap_rss_map_flow_table SEC(".maps");
+
 static inline void net_rx_rss_add_chunk(__u8 *rss_input, size_t *bytes_written,
                                         const void *ptr, size_t size) {
     __builtin_memcpy(&rss_input[*bytes_written], ptr, size);
@@ -380,147 +410,163 @@ error:
     return err;
 }
 
-static inline bool calculate_rss_hash(struct __sk_buff *skb,
+static inline __u16 *lookup_flow_queue(struct packet_hash_info_t *info)
+{
+    struct flow_key_t key = {};
+
+    if (!info->is_tcp && !info->is_udp) {
+        return 0;
+    }
+
+    key.is_ipv6 = info->is_ipv6;
+    key.is_tcp = info->is_tcp;
+    key.src_port = info->src_port;
+    key.dst_port = info->dst_port;
+    if (info->is_ipv6) {
+        key.in6_src = info->in6_src;
+        key.in6_dst = info->in6_dst;
+    } else {
+        key.in_src = info->in_src;
+        key.in_dst = info->in_dst;
+    }
+
+    return bpf_map_lookup_elem(&tap_rss_map_flow_table, &key);
+}
+
+static inline bool calculate_rss_hash(struct packet_hash_info_t *info,
                                       struct rss_config_t *config,
                                       struct toeplitz_key_data_t *toe,
                                       __u32 *result)
 {
     __u8 rss_input[HASH_CALCULATION_BUFFER_SIZE] = {};
     size_t bytes_written = 0;
-    int err = 0;
-    struct packet_hash_info_t packet_info = {};
 
-    err = parse_packet(skb, &packet_info);
-    if (err) {
-        return false;
-    }
-
-    if (packet_info.is_ipv4) {
-        if (packet_info.is_tcp &&
+    if (info->is_ipv4) {
+        if (info->is_tcp &&
             config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_TCPv4) {
 
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.in_src,
-                                 sizeof(packet_info.in_src));
+                                 &info->in_src,
+                                 sizeof(info->in_src));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.in_dst,
-                                 sizeof(packet_info.in_dst));
+                                 &info->in_dst,
+                                 sizeof(info->in_dst));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.src_port,
-                                 sizeof(packet_info.src_port));
+                                 &info->src_port,
+                                 sizeof(info->src_port));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.dst_port,
-                                 sizeof(packet_info.dst_port));
-        } else if (packet_info.is_udp &&
+                                 &info->dst_port,
+                                 sizeof(info->dst_port));
+        } else if (info->is_udp &&
                    config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_UDPv4) {
 
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.in_src,
-                                 sizeof(packet_info.in_src));
+                                 &info->in_src,
+                                 sizeof(info->in_src));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.in_dst,
-                                 sizeof(packet_info.in_dst));
+                                 &info->in_dst,
+                                 sizeof(info->in_dst));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.src_port,
-                                 sizeof(packet_info.src_port));
+                                 &info->src_port,
+                                 sizeof(info->src_port));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.dst_port,
-                                 sizeof(packet_info.dst_port));
+                                 &info->dst_port,
+                                 sizeof(info->dst_port));
         } else if (config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_IPv4) {
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.in_src,
-                                 sizeof(packet_info.in_src));
+                                 &info->in_src,
+                                 sizeof(info->in_src));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.in_dst,
-                                 sizeof(packet_info.in_dst));
+                                 &info->in_dst,
+                                 sizeof(info->in_dst));
         }
-    } else if (packet_info.is_ipv6) {
-        if (packet_info.is_tcp &&
+    } else if (info->is_ipv6) {
+        if (info->is_tcp &&
             config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_TCPv6) {
 
-            if (packet_info.is_ipv6_ext_src &&
+            if (info->is_ipv6_ext_src &&
                 config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_TCP_EX) {
 
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_ext_src,
-                                     sizeof(packet_info.in6_ext_src));
+                                     &info->in6_ext_src,
+                                     sizeof(info->in6_ext_src));
             } else {
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_src,
-                                     sizeof(packet_info.in6_src));
+                                     &info->in6_src,
+                                     sizeof(info->in6_src));
             }
-            if (packet_info.is_ipv6_ext_dst &&
+            if (info->is_ipv6_ext_dst &&
                 config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_TCP_EX) {
 
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_ext_dst,
-                                     sizeof(packet_info.in6_ext_dst));
+                                     &info->in6_ext_dst,
+                                     sizeof(info->in6_ext_dst));
             } else {
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_dst,
-                                     sizeof(packet_info.in6_dst));
+                                     &info->in6_dst,
+                                     sizeof(info->in6_dst));
             }
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.src_port,
-                                 sizeof(packet_info.src_port));
+                                 &info->src_port,
+                                 sizeof(info->src_port));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.dst_port,
-                                 sizeof(packet_info.dst_port));
-        } else if (packet_info.is_udp &&
+                                 &info->dst_port,
+                                 sizeof(info->dst_port));
+        } else if (info->is_udp &&
                    config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_UDPv6) {
 
-            if (packet_info.is_ipv6_ext_src &&
+            if (info->is_ipv6_ext_src &&
                config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_UDP_EX) {
 
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_ext_src,
-                                     sizeof(packet_info.in6_ext_src));
+                                     &info->in6_ext_src,
+                                     sizeof(info->in6_ext_src));
             } else {
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_src,
-                                     sizeof(packet_info.in6_src));
+                                     &info->in6_src,
+                                     sizeof(info->in6_src));
             }
-            if (packet_info.is_ipv6_ext_dst &&
+            if (info->is_ipv6_ext_dst &&
                config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_UDP_EX) {
 
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_ext_dst,
-                                     sizeof(packet_info.in6_ext_dst));
+                                     &info->in6_ext_dst,
+                                     sizeof(info->in6_ext_dst));
             } else {
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_dst,
-                                     sizeof(packet_info.in6_dst));
+                                     &info->in6_dst,
+                                     sizeof(info->in6_dst));
             }
 
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.src_port,
-                                 sizeof(packet_info.src_port));
+                                 &info->src_port,
+                                 sizeof(info->src_port));
             net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                 &packet_info.dst_port,
-                                 sizeof(packet_info.dst_port));
+                                 &info->dst_port,
+                                 sizeof(info->dst_port));
 
         } else if (config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_IPv6) {
-            if (packet_info.is_ipv6_ext_src &&
+            if (info->is_ipv6_ext_src &&
                config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_IP_EX) {
 
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_ext_src,
-                                     sizeof(packet_info.in6_ext_src));
+                                     &info->in6_ext_src,
+                                     sizeof(info->in6_ext_src));
             } else {
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_src,
-                                     sizeof(packet_info.in6_src));
+                                     &info->in6_src,
+                                     sizeof(info->in6_src));
             }
-            if (packet_info.is_ipv6_ext_dst &&
+            if (info->is_ipv6_ext_dst &&
                 config->hash_types & VIRTIO_NET_RSS_HASH_TYPE_IP_EX) {
 
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_ext_dst,
-                                     sizeof(packet_info.in6_ext_dst));
+                                     &info->in6_ext_dst,
+                                     sizeof(info->in6_ext_dst));
             } else {
                 net_rx_rss_add_chunk(rss_input, &bytes_written,
-                                     &packet_info.in6_dst,
-                                     sizeof(packet_info.in6_dst));
+                                     &info->in6_dst,
+                                     sizeof(info->in6_dst));
             }
         }
     }
@@ -540,6 +586,7 @@ int tun_rss_steering_prog(struct __sk_buff *skb)
 
     struct rss_config_t *config;
     struct toeplitz_key_data_t *toe;
+    struct packet_hash_info_t packet_info = {};
 
     __u32 key = 0;
     __u32 hash = 0;
@@ -551,15 +598,25 @@ int tun_rss_steering_prog(struct __sk_buff *skb)
         return 0;
     }
 
-    if (config->redirect && calculate_rss_hash(skb, config, toe, &hash)) {
-        __u32 table_idx = hash % config->indirections_len;
+    if (config->redirect && !parse_packet(skb, &packet_info)) {
         __u16 *queue = 0;
 
-        queue = bpf_map_lookup_elem(&tap_rss_map_indirection_table,
-                                    &table_idx);
+        if (config->flow_steering) {
+            queue = lookup_flow_queue(&packet_info);
+            if (queue) {
+                return *queue;
+            }
+        }
+
+        if (calculate_rss_hash(&packet_info, config, toe, &hash)) {
+            __u32 table_idx = hash % config->indirections_len;
 
-        if (queue) {
-            return *queue;
+            queue = bpf_map_lookup_elem(&tap_rss_map_indirection_table,
+                                        &table_idx);
+
+            if (queue) {
+                return *queue;
+            }
         }
     }
 
@@ -45,14 +45,33 @@ static bool trace_available;
 static bool trace_writeout_enabled;
 
 enum {
-    TRACE_BUF_LEN = 4096 * 64,
+    TRACE_BUF_LEN = 4096 * 16,
     TRACE_BUF_FLUSH_THRESHOLD = TRACE_BUF_LEN / 4,
 };
 
-uint8_t trace_buf[TRACE_BUF_LEN];
-static volatile gint trace_idx;
-static unsigned int writeout_idx;
-static volatile gint dropped_events;
+/*
+ * Each thread records into a ring buffer of its own, so that threads
+ * tracing at a high rate don't fight over the same cache lines, and
+ * the writeout thread merges the rings in timestamp order.
+ *
+ * Only the owning thread reserves space in a ring; the index is still
+ * updated atomically because a signal handler may trace in between.
+ * Rings are never freed: when a thread exits, its ring goes to the next
+ * thread that starts tracing, behind the records still waiting there.
+ */
+typedef struct TraceRing {
+    uint8_t buf[TRACE_BUF_LEN];
+    volatile gint idx;
+    unsigned int writeout_idx;
+    volatile gint dropped_events;
+    volatile gint in_use;
+    struct TraceRing *next;
+} TraceRing;
+
+static TraceRing *trace_rings;
+static __thread TraceRing *trace_ring;
+static void trace_ring_release(gpointer data);
+static GPrivate trace_ring_key = G_PRIVATE_INIT(trace_ring_release);
 static uint32_t trace_pid;
 static FILE *trace_fp;
 static char *trace_file_name;
@@ -76,53 +95,110 @@ typedef struct {
 } TraceLogHeader;
 
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size);
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size);
+static void read_from_buffer(TraceRing *ring, unsigned int idx,
+                             void *dataptr, size_t size);
+static unsigned int write_to_buffer(TraceRing *ring, unsigned int idx,
+                                    void *dataptr, size_t size);
+
+static void trace_ring_release(gpointer data)
+{
+    TraceRing *ring = data;
+
+    g_atomic_int_set(&ring->in_use, 0);
+}
+
+/* Get the ring of the calling thread, or NULL if out of memory */
+static TraceRing *get_trace_ring(void)
+{
+    TraceRing *ring = trace_ring;
+
+    if (likely(ring)) {
+        return ring;
+    }
+
+    for (ring = g_atomic_pointer_get(&trace_rings); ring; ring = ring->next) {
+        if (g_atomic_int_compare_and_exchange(&ring->in_use, 0, 1)) {
+            break;
+        }
+    }
+    if (!ring) {
+        /* don't use g_malloc, can deadlock when traced */
+        ring = calloc(1, sizeof(*ring));
+        if (!ring) {
+            return NULL;
+        }
+        ring->in_use = 1;
+        do {
+            ring->next = g_atomic_pointer_get(&trace_rings);
+        } while (!g_atomic_pointer_compare_and_exchange(&trace_rings,
+                                                         ring->next, ring));
+    }
+    trace_ring = ring;
+    g_private_set(&trace_ring_key, ring);
+    return ring;
+}
 
-static void clear_buffer_range(unsigned int idx, size_t len)
+static void clear_buffer_range(TraceRing *ring, unsigned int idx, size_t len)
 {
     uint32_t num = 0;
     while (num < len) {
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = 0;
+        ring->buf[idx++] = 0;
         num++;
     }
 }
+
 /**
- * Read a trace record from the trace buffer
+ * Look at the next trace record of a ring without consuming it
  *
- * @idx         Trace buffer index
- * @record      Trace record to fill
+ * @ring        Trace ring
+ * @timestamp   Filled with the timestamp of the record
  *
- * Returns false if the record is not valid.
+ * Returns false if there is no valid record yet.
  */
-static bool get_trace_record(unsigned int idx, TraceRecord **recordptr)
+static bool peek_trace_record(TraceRing *ring, uint64_t *timestamp)
 {
-    uint64_t event_flag = 0;
+    unsigned int idx = ring->writeout_idx % TRACE_BUF_LEN;
     TraceRecord record;
-    /* read the event flag to see if its a valid record */
-    read_from_buffer(idx, &record, sizeof(event_flag));
 
+    read_from_buffer(ring, idx, &record, sizeof(record.event));
     if (!(record.event & TRACE_RECORD_VALID)) {
         return false;
     }
 
     smp_rmb(); /* read memory barrier before accessing record */
+    read_from_buffer(ring, idx, &record, sizeof(TraceRecord));
+    *timestamp = record.timestamp_ns;
+    return true;
+}
+
+/**
+ * Read the next trace record from a ring, which must be valid
+ *
+ * @ring        Trace ring
+ * @record      Trace record to fill
+ */
+static void get_trace_record(TraceRing *ring, TraceRecord **recordptr)
+{
+    unsigned int idx = ring->writeout_idx % TRACE_BUF_LEN;
+    TraceRecord record;
+
     /* read the record header to know record length */
-    read_from_buffer(idx, &record, sizeof(TraceRecord));
+    read_from_buffer(ring, idx, &record, sizeof(TraceRecord));
     *recordptr = malloc(record.length); /* don't use g_malloc, can deadlock when traced */
     /* make a copy of record to avoid being overwritten */
-    read_from_buffer(idx, *recordptr, record.length);
+    read_from_buffer(ring, idx, *recordptr, record.length);
     smp_rmb(); /* memory barrier before clearing valid flag */
     (*recordptr)->event &= ~TRACE_RECORD_VALID;
     /* clear the trace buffer range for consumed record otherwise any byte
      * with its MSB set may be considered as a valid event id when the writer
      * thread crosses this range of buffer again.
      */
-    clear_buffer_range(idx, record.length);
-    return true;
+    clear_buffer_range(ring, idx, record.length);
+    smp_wmb(); /* clear the range before handing it back */
+    ring->writeout_idx += record.length;
 }
 
 /**
@@ -161,7 +237,8 @@ static gpointer writeout_thread(gpointer opaque)
         TraceRecord rec;
         uint8_t bytes[sizeof(TraceRecord) + sizeof(uint64_t)];
     } dropped;
-    unsigned int idx = 0;
+    TraceRing *ring, *oldest;
+    uint64_t timestamp, oldest_timestamp;
     int dropped_count;
     size_t unused __attribute__ ((unused));
     uint64_t type = TRACE_RECORD_TYPE_EVENT;
@@ -169,26 +246,40 @@ static gpointer writeout_thread(gpointer opaque)
     for (;;) {
         wait_for_trace_records_available();
 
-        if (g_atomic_int_get(&dropped_events)) {
+        dropped_count = 0;
+        for (ring = g_atomic_pointer_get(&trace_rings); ring;
+             ring = ring->next) {
+            dropped_count += g_atomic_int_exchange(&ring->dropped_events, 0);
+        }
+        if (dropped_count) {
             dropped.rec.event = DROPPED_EVENT_ID;
             dropped.rec.timestamp_ns = get_clock();
             dropped.rec.length = sizeof(TraceRecord) + sizeof(uint64_t);
             dropped.rec.pid = trace_pid;
-            do {
-                dropped_count = g_atomic_int_get(&dropped_events);
-            } while (!g_atomic_int_compare_and_exchange(&dropped_events,
-                                                        dropped_count, 0));
             dropped.rec.arguments[0] = dropped_count;
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(&dropped.rec, dropped.rec.length, 1, trace_fp);
         }
 
-        while (get_trace_record(idx, &recordptr)) {
+        /* Merge the rings, always taking the oldest record available */
+        for (;;) {
+            oldest = NULL;
+            oldest_timestamp = 0;
+            for (ring = g_atomic_pointer_get(&trace_rings); ring;
+                 ring = ring->next) {
+                if (peek_trace_record(ring, &timestamp) &&
+                    (!oldest || timestamp < oldest_timestamp)) {
+                    oldest = ring;
+                    oldest_timestamp = timestamp;
+                }
+            }
+            if (!oldest) {
+                break;
+            }
+            get_trace_record(oldest, &recordptr);
             unused = fwrite(&type, sizeof(type), 1, trace_fp);
             unused = fwrite(recordptr, recordptr->length, 1, trace_fp);
-            writeout_idx += recordptr->length;
             free(recordptr); /* don't use g_free, can deadlock when traced */
-            idx = writeout_idx % TRACE_BUF_LEN;
         }
 
         fflush(trace_fp);
@@ -198,15 +289,17 @@ static gpointer writeout_thread(gpointer opaque)
 
 void trace_record_write_u64(TraceBufferRecord *rec, uint64_t val)
 {
-    rec->rec_off = write_to_buffer(rec->rec_off, &val, sizeof(uint64_t));
+    rec->rec_off = write_to_buffer(rec->ring, rec->rec_off, &val,
+                                   sizeof(uint64_t));
 }
 
 void trace_record_write_str(TraceBufferRecord *rec, const char *s, uint32_t slen)
 {
     /* Write string length first */
-    rec->rec_off = write_to_buffer(rec->rec_off, &slen, sizeof(slen));
+    rec->rec_off = write_to_buffer(rec->ring, rec->rec_off, &slen,
+                                   sizeof(slen));
     /* Write actual string now */
-    rec->rec_off = write_to_buffer(rec->rec_off, (void*)s, slen);
+    rec->rec_off = write_to_buffer(rec->ring, rec->rec_off, (void*)s, slen);
 }
 
 int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
@@ -215,33 +308,41 @@ int trace_record_start(TraceBufferRecord *rec, uint32_t event, size_t datasize)
     uint32_t rec_len = sizeof(TraceRecord) + datasize;
     uint64_t event_u64 = event;
     uint64_t timestamp_ns = get_clock();
+    TraceRing *ring = get_trace_ring();
+
+    if (!ring) {
+        return -ENOMEM;
+    }
 
     do {
-        old_idx = g_atomic_int_get(&trace_idx);
+        old_idx = g_atomic_int_get(&ring->idx);
         smp_rmb();
         new_idx = old_idx + rec_len;
 
-        if (new_idx - writeout_idx > TRACE_BUF_LEN) {
+        if (new_idx - ring->writeout_idx > TRACE_BUF_LEN) {
             /* Trace Buffer Full, Event dropped ! */
-            g_atomic_int_inc(&dropped_events);
+            g_atomic_int_inc(&ring->dropped_events);
             return -ENOSPC;
         }
-    } while (!g_atomic_int_compare_and_exchange(&trace_idx, old_idx, new_idx));
+    } while (!g_atomic_int_compare_and_exchange(&ring->idx, old_idx, new_idx));
 
     idx = old_idx % TRACE_BUF_LEN;
 
     rec_off = idx;
-    rec_off = write_to_buffer(rec_off, &event_u64, sizeof(event_u64));
-    rec_off = write_to_buffer(rec_off, &timestamp_ns, sizeof(timestamp_ns));
-    rec_off = write_to_buffer(rec_off, &rec_len, sizeof(rec_len));
-    rec_off = write_to_buffer(rec_off, &trace_pid, sizeof(trace_pid));
+    rec_off = write_to_buffer(ring, rec_off, &event_u64, sizeof(event_u64));
+    rec_off = write_to_buffer(ring, rec_off, &timestamp_ns,
+                              sizeof(timestamp_ns));
+    rec_off = write_to_buffer(ring, rec_off, &rec_len, sizeof(rec_len));
+    rec_off = write_to_buffer(ring, rec_off, &trace_pid, sizeof(trace_pid));
 
+    rec->ring = ring;
     rec->tbuf_idx = idx;
     rec->rec_off  = (idx + sizeof(TraceRecord)) % TRACE_BUF_LEN;
     return 0;
 }
 
-static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
+static void read_from_buffer(TraceRing *ring, unsigned int idx,
+                             void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -249,11 +350,12 @@ static void read_from_buffer(unsigned int idx, void *dataptr, size_t size)
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        data_ptr[x++] = trace_buf[idx++];
+        data_ptr[x++] = ring->buf[idx++];
     }
 }
 
-static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size)
+static unsigned int write_to_buffer(TraceRing *ring, unsigned int idx,
+                                    void *dataptr, size_t size)
 {
     uint8_t *data_ptr = dataptr;
     uint32_t x = 0;
@@ -261,20 +363,21 @@ static unsigned int write_to_buffer(unsigned int idx, void *dataptr, size_t size
         if (idx >= TRACE_BUF_LEN) {
             idx = idx % TRACE_BUF_LEN;
         }
-        trace_buf[idx++] = data_ptr[x++];
+        ring->buf[idx++] = data_ptr[x++];
     }
     return idx; /* most callers wants to know where to write next */
 }
 
 void trace_record_finish(TraceBufferRecord *rec)
 {
+    TraceRing *ring = rec->ring;
     TraceRecord record;
-    read_from_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    read_from_buffer(ring, rec->tbuf_idx, &record, sizeof(TraceRecord));
     smp_wmb(); /* write barrier before marking as valid */
     record.event |= TRACE_RECORD_VALID;
-    write_to_buffer(rec->tbuf_idx, &record, sizeof(TraceRecord));
+    write_to_buffer(ring, rec->tbuf_idx, &record, sizeof(TraceRecord));
 
-    if (((unsigned int)g_atomic_int_get(&trace_idx) - writeout_idx)
+    if (((unsigned int)g_atomic_int_get(&ring->idx) - ring->writeout_idx)
         > TRACE_BUF_FLUSH_THRESHOLD) {
         flush_trace_file(false);
     }
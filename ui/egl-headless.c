@@ -162,7 +162,15 @@ static void egl_scanout_flush(DisplayChangeListener *dcl,
         egl_fb_blit(&edpy->blit_fb, &edpy->guest_fb, edpy->y_0_top);
     }
 
-    egl_fb_read(edpy->ds, &edpy->blit_fb);
+    /* Only the damaged rectangle has to come back from the GPU. */
+    if ((x || y || w != surface_width(edpy->ds) ||
+         h != surface_height(edpy->ds)) &&
+        edpy->blit_fb.width == surface_width(edpy->ds) &&
+        edpy->blit_fb.height == surface_height(edpy->ds)) {
+        egl_fb_read_rect(edpy->ds, &edpy->blit_fb, x, y, w, h);
+    } else {
+        egl_fb_read(edpy->ds, &edpy->blit_fb);
+    }
     dpy_gfx_update(edpy->dcl.con, x, y, w, h);
 }
 
@@ -130,6 +130,13 @@ static void hmp_info_vnc_clients(Monitor *mon, VncClientInfoList *client)
                        cinfo->x509_dname ?: "none");
         monitor_printf(mon, "    sasl_username: %s\n",
                        cinfo->sasl_username ?: "none");
+        if (cinfo->has_encoded_updates) {
+            monitor_printf(mon, "    encoded updates: %" PRIu64
+                           " (%" PRIu64 " us, max %" PRIu64 " us)\n",
+                           cinfo->encoded_updates,
+                           cinfo->encode_time / 1000,
+                           cinfo->encode_time_max / 1000);
+        }
 
         client = client->next;
     }
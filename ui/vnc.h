@@ -33,6 +33,7 @@
 #include "ui/console.h"
 #include "audio/audio.h"
 #include "qemu/bitmap.h"
+#include "qemu/stats64.h"
 #include "crypto/tlssession.h"
 #include "qemu/buffer.h"
 #include "io/channel-socket.h"
@@ -91,6 +92,9 @@ typedef void VncSendHextileTile(VncState *vs,
  * VNC_DIRTY_BITS due to alignment */
 #define VNC_DIRTY_BPL(x) (sizeof((x)->dirty) / VNC_MAX_HEIGHT * BITS_PER_BYTE)
 
+/* Encoding worker threads, shared by all displays */
+#define VNC_MAX_WORKERS 64
+
 #define VNC_STAT_RECT  64
 #define VNC_STAT_COLS (VNC_MAX_WIDTH / VNC_STAT_RECT)
 #define VNC_STAT_ROWS (VNC_MAX_HEIGHT / VNC_STAT_RECT)
@@ -158,6 +162,7 @@ struct VncDisplay
     int ledstate;
     QKbdState *kbd;
     QemuMutex mutex;
+    int display_readers;        /* Protected by mutex */
 
     int cursor_msize;
     uint8_t *cursor_mask;
@@ -251,6 +256,7 @@ struct VncJob
 
     QLIST_HEAD(, VncRectEntry) rectangles;
     QTAILQ_ENTRY(VncJob) next;
+    bool running;               /* Protected by the job queue lock */
 };
 
 typedef enum {
@@ -336,6 +342,11 @@ struct VncState
     QEMUBH *bh;
     Buffer jobs_buffer;
 
+    /* Updated by the worker threads */
+    Stat64 encode_updates;
+    Stat64 encode_ns;
+    Stat64 encode_max_ns;
+
     /* Encoding specific, if you add something here, don't forget to
      *  update vnc_async_encoding_start()
      */
@@ -149,6 +149,12 @@ void aio_set_fd_handler(AioContext *ctx,
             new_node->pfd.fd = fd;
         } else {
             new_node->pfd = node->pfd;
+
+            /* The handler is only being updated, keep its polling state */
+            new_node->poll_ns = node->poll_ns;
+            stat64_init(&new_node->poll_hits, stat64_get(&node->poll_hits));
+            stat64_init(&new_node->poll_misses,
+                        stat64_get(&node->poll_misses));
         }
         g_source_add_poll(&ctx->source, &new_node->pfd);
 
@@ -432,6 +438,7 @@ void aio_dispatch(AioContext *ctx)
 static bool run_poll_handlers_once(AioContext *ctx,
                                    AioHandlerList *ready_list,
                                    int64_t now,
+                                   int64_t elapsed_time,
                                    int64_t *timeout)
 {
     bool progress = false;
@@ -439,6 +446,14 @@ static bool run_poll_handlers_once(AioContext *ctx,
     AioHandler *tmp;
 
     QLIST_FOREACH_SAFE(node, &ctx->poll_aio_handlers, node_poll, tmp) {
+        /*
+         * Stop polling handlers whose own polling time is over.  Events
+         * are still picked up when polling ends, see poll_set_started().
+         */
+        if (elapsed_time > node->poll_ns) {
+            continue;
+        }
+
         if (node->io_poll(node->opaque)) {
             aio_add_poll_ready_handler(ready_list, node);
 
@@ -524,7 +539,7 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
                               int64_t max_ns, int64_t *timeout)
 {
     bool progress;
-    int64_t start_time, elapsed_time;
+    int64_t start_time, elapsed_time = 0;
 
     assert(qemu_lockcnt_count(&ctx->list_lock) > 0);
 
@@ -543,7 +558,7 @@ static bool run_poll_handlers(AioContext *ctx, AioHandlerList *ready_list,
     start_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME);
     do {
         progress = run_poll_handlers_once(ctx, ready_list,
-                                          start_time, timeout);
+                                          start_time, elapsed_time, timeout);
         elapsed_time = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start_time;
         max_ns = qemu_soonest_timeout(*timeout, max_ns);
         assert(!(max_ns && progress));
@@ -600,6 +615,82 @@ static bool try_poll_mode(AioContext *ctx, AioHandlerList *ready_list,
     return false;
 }
 
+static void poll_shrink(AioContext *ctx, AioHandler *node)
+{
+    int64_t old = node->poll_ns;
+
+    if (ctx->poll_shrink) {
+        node->poll_ns /= ctx->poll_shrink;
+    } else {
+        node->poll_ns = 0;
+    }
+
+    trace_poll_shrink(ctx, node, old, node->poll_ns);
+}
+
+static void poll_grow(AioContext *ctx, AioHandler *node)
+{
+    int64_t old = node->poll_ns;
+    int64_t grow = ctx->poll_grow;
+
+    if (grow == 0) {
+        grow = 2;
+    }
+
+    if (node->poll_ns) {
+        node->poll_ns *= grow;
+    } else {
+        node->poll_ns = 4000; /* start polling at 4 microseconds */
+    }
+
+    if (node->poll_ns > ctx->poll_max_ns) {
+        node->poll_ns = ctx->poll_max_ns;
+    }
+
+    trace_poll_grow(ctx, node, old, node->poll_ns);
+}
+
+/*
+ * Adjust the polling time of each handler after aio_poll() blocked for
+ * @block_ns, before the handlers on @ready_list are dispatched.
+ *
+ * Handlers are tuned separately, so that one that is rarely ready does not
+ * keep the others from polling, and does not waste time polling itself.
+ * The context polls for as long as the most demanding handler.
+ */
+static void adjust_polling_time(AioContext *ctx, int64_t block_ns)
+{
+    AioHandler *node;
+    int64_t poll_ns = 0;
+
+    QLIST_FOREACH(node, &ctx->poll_aio_handlers, node_poll) {
+        if (!QLIST_IS_INSERTED(node, node_ready)) {
+            if (block_ns > ctx->poll_max_ns) {
+                /* We'd have to poll for too long, poll less */
+                poll_shrink(ctx, node);
+            }
+        } else if (node->poll_ready) {
+            /* This is the sweet spot, no adjustment needed */
+            stat64_add(&node->poll_hits, 1);
+        } else {
+            stat64_add(&node->poll_misses, 1);
+
+            if (block_ns > ctx->poll_max_ns) {
+                poll_shrink(ctx, node);
+            } else if (node->poll_ns < ctx->poll_max_ns &&
+                       block_ns > node->poll_ns) {
+                /* There is room to grow, poll longer */
+                poll_grow(ctx, node);
+            }
+        }
+
+        node->poll_ns = MIN(node->poll_ns, ctx->poll_max_ns);
+        poll_ns = MAX(poll_ns, node->poll_ns);
+    }
+
+    ctx->poll_ns = poll_ns;
+}
+
 bool aio_poll(AioContext *ctx, bool blocking)
 {
     AioHandlerList ready_list = QLIST_HEAD_INITIALIZER(ready_list);
@@ -683,45 +774,14 @@ bool aio_poll(AioContext *ctx, bool blocking)
     if (ctx->poll_max_ns) {
         int64_t block_ns = qemu_clock_get_ns(QEMU_CLOCK_REALTIME) - start;
 
-        if (block_ns <= ctx->poll_ns) {
-            /* This is the sweet spot, no adjustment needed */
-        } else if (block_ns > ctx->poll_max_ns) {
-            /* We'd have to poll for too long, poll less */
-            int64_t old = ctx->poll_ns;
-
-            if (ctx->poll_shrink) {
-                ctx->poll_ns /= ctx->poll_shrink;
-            } else {
-                ctx->poll_ns = 0;
-            }
-
-            trace_poll_shrink(ctx, old, ctx->poll_ns);
-        } else if (ctx->poll_ns < ctx->poll_max_ns &&
-                   block_ns < ctx->poll_max_ns) {
-            /* There is room to grow, poll longer */
-            int64_t old = ctx->poll_ns;
-            int64_t grow = ctx->poll_grow;
-
-            if (grow == 0) {
-                grow = 2;
-            }
-
-            if (ctx->poll_ns) {
-                ctx->poll_ns *= grow;
-            } else {
-                ctx->poll_ns = 4000; /* start polling at 4 microseconds */
-            }
-
-            if (ctx->poll_ns > ctx->poll_max_ns) {
-                ctx->poll_ns = ctx->poll_max_ns;
-            }
-
-            trace_poll_grow(ctx, old, ctx->poll_ns);
-        }
+        adjust_polling_time(ctx, block_ns);
     }
 
     progress |= aio_bh_poll(ctx);
     progress |= aio_dispatch_ready_handlers(ctx, &ready_list);
+    if (ctx->fdmon_ops->dispatch) {
+        progress |= ctx->fdmon_ops->dispatch(ctx);
+    }
 
     aio_free_deleted_handlers(ctx);
 
@@ -732,6 +792,22 @@ bool aio_poll(AioContext *ctx, bool blocking)
     return progress;
 }
 
+#ifdef CONFIG_LINUX_IO_URING
+bool aio_has_io_uring(AioContext *ctx)
+{
+    return ctx->fdmon_ops->add_sqe != NULL;
+}
+
+void aio_add_sqe(AioPrepSqeFunc *prep_sqe, void *opaque,
+                 CqeHandler *cqe_handler)
+{
+    AioContext *ctx = qemu_get_current_aio_context();
+
+    assert(aio_has_io_uring(ctx));
+    ctx->fdmon_ops->add_sqe(ctx, prep_sqe, opaque, cqe_handler);
+}
+#endif
+
 void aio_context_setup(AioContext *ctx)
 {
     ctx->fdmon_ops = &fdmon_poll_ops;
@@ -778,6 +854,38 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     aio_notify(ctx);
 }
 
+AioPollStats *aio_context_get_poll_stats(AioContext *ctx, size_t *n)
+{
+    GArray *stats = g_array_new(false, false, sizeof(AioPollStats));
+    AioHandler *node;
+
+    /* Keep handlers from being freed while we walk the list */
+    qemu_lockcnt_inc(&ctx->list_lock);
+    WITH_RCU_READ_LOCK_GUARD() {
+        QLIST_FOREACH_RCU(node, &ctx->aio_handlers, node) {
+            AioPollStats s;
+
+            /* The notifier is an internal detail of the AioContext */
+            if (!node->io_poll || node->opaque == &ctx->notifier ||
+                QLIST_IS_INSERTED(node, node_deleted)) {
+                continue;
+            }
+
+            s = (AioPollStats) {
+                .fd = node->pfd.fd,
+                .poll_ns = node->poll_ns,
+                .hits = stat64_get(&node->poll_hits),
+                .misses = stat64_get(&node->poll_misses),
+            };
+            g_array_append_val(stats, s);
+        }
+    }
+    qemu_lockcnt_dec(&ctx->list_lock);
+
+    *n = stats->len;
+    return (AioPollStats *)g_array_free(stats, false);
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
     /*
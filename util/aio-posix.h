@@ -18,6 +18,7 @@
 #define AIO_POSIX_H
 
 #include "block/aio.h"
+#include "qemu/stats64.h"
 
 struct AioHandler {
     GPollFD pfd;
@@ -37,6 +38,9 @@ struct AioHandler {
     unsigned flags; /* see fdmon-io_uring.c */
 #endif
     int64_t poll_idle_timeout; /* when to stop userspace polling */
+    int64_t poll_ns; /* polling time in nanoseconds, see aio_poll() */
+    Stat64 poll_hits; /* events detected by polling */
+    Stat64 poll_misses; /* events detected by fd monitoring instead */
     bool poll_ready; /* has polling detected an event? */
 };
 
@@ -439,6 +439,12 @@ void aio_context_set_poll_params(AioContext *ctx, int64_t max_ns,
     }
 }
 
+AioPollStats *aio_context_get_poll_stats(AioContext *ctx, size_t *n)
+{
+    *n = 0;
+    return NULL;
+}
+
 void aio_context_set_aio_params(AioContext *ctx, int64_t max_batch)
 {
 }
@@ -13,6 +13,7 @@
 #include "qemu/bitops.h"
 #include "qemu/bitmap.h"
 #include "qemu/atomic.h"
+#include "qemu/cutils.h"
 
 /*
  * bitmaps provide an array of bits, implemented using an
@@ -335,6 +336,23 @@ bool bitmap_test_and_clear_atomic(unsigned long *map, long start, long nr)
 void bitmap_copy_and_clear_atomic(unsigned long *dst, unsigned long *src,
                                   long nr)
 {
+    const long run = BITMAP_ZERO_RUN_LONGS;
+    long i;
+
+    /* Skip the atomic exchange, and its cache line ownership, if clean */
+    while (nr >= run * BITS_PER_LONG) {
+        if (buffer_is_zero_ge256(src, run * sizeof(unsigned long))) {
+            memset(dst, 0, run * sizeof(unsigned long));
+        } else {
+            for (i = 0; i < run; i++) {
+                dst[i] = qatomic_read(&src[i]) ? qatomic_xchg(&src[i], 0) : 0;
+            }
+        }
+        dst += run;
+        src += run;
+        nr -= run * BITS_PER_LONG;
+    }
+
     while (nr > 0) {
         *dst = qatomic_xchg(src, 0);
         dst++;
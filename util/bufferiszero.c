@@ -24,6 +24,7 @@
 #include "qemu/osdep.h"
 #include "qemu/cutils.h"
 #include "qemu/bswap.h"
+#include "qemu/bitops.h"
 #include "host/cpuinfo.h"
 
 typedef bool (*biz_accel_fn)(const void *, size_t);
@@ -110,6 +111,59 @@ bool buffer_is_zero_ge256(const void *buf, size_t len)
     return buffer_is_zero_accel(buf, len);
 }
 
+/* Cache lines of the next candidate fetched while testing the current one */
+#define BATCH_PREFETCH_LINES 4
+
+uint64_t buffer_is_zero_batch(const void * const *bufs, unsigned n,
+                              size_t len)
+{
+    uint64_t zero = 0, todo;
+    unsigned i;
+
+    assert(n <= BUFFER_IS_ZERO_BATCH_MAX);
+    if (unlikely(len == 0)) {
+        return n ? MAKE_64BIT_MASK(0, n) : 0;
+    }
+
+    /*
+     * Sample all buffers first: the loads of a whole batch are in flight
+     * together, and most non-zero buffers drop out having touched only
+     * three cache lines.
+     */
+    for (i = 0; i < n; i++) {
+        if (buffer_is_zero_sample3(bufs[i], len)) {
+            zero |= 1ull << i;
+        }
+    }
+    /* All bytes are covered for any len <= 3.  */
+    if (unlikely(len <= 3)) {
+        return zero;
+    }
+
+    for (todo = zero; todo; todo &= todo - 1) {
+        uint64_t next = todo & (todo - 1);
+        const void *buf = bufs[ctz64(todo)];
+        bool is_zero;
+
+        if (next) {
+            const char *p = bufs[ctz64(next)];
+
+            for (i = 0; i < BATCH_PREFETCH_LINES && i * 64 < len; i++) {
+                __builtin_prefetch(p + i * 64);
+            }
+        }
+        if (likely(len >= 256)) {
+            is_zero = buffer_is_zero_accel(buf, len);
+        } else {
+            is_zero = buffer_is_zero_int_lt256(buf, len);
+        }
+        if (!is_zero) {
+            zero &= ~(todo & -todo);
+        }
+    }
+    return zero;
+}
+
 bool test_buffer_is_zero_next_accel(void)
 {
     if (accel_index != 0) {
@@ -19,9 +19,11 @@
  * 4. Nanosecond timeouts are supported so it requires fewer syscalls than
  *    epoll(7).
  *
- * This code only monitors file descriptors and does not do asynchronous disk
- * I/O.  Implementing disk I/O efficiently has other requirements and should
- * use a separate io_uring so it does not make sense to unify the code.
+ * Besides monitoring file descriptors, aio_add_sqe() lets users of the
+ * AioContext submit their own requests, e.g. reads and writes on sockets, to
+ * the same ring.  Their completions are collected together with fd readiness
+ * and handed to CqeHandlers from fdmon_io_uring_dispatch().  Disk I/O has its
+ * own requirements and uses separate rings, see block/io_uring.c.
  *
  * File descriptor monitoring is implemented using the following operations:
  *
@@ -38,9 +40,10 @@
  * the "cq ring".  Ring entries are called "sqe" and "cqe", respectively.
  *
  * The code is structured so that sq/cq rings are only modified within
- * fdmon_io_uring_wait().  Changes to AioHandlers are made by enqueuing them on
- * ctx->submit_list so that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD
- * and/or IORING_OP_POLL_REMOVE sqes for them.
+ * fdmon_io_uring_wait() and, from the AioContext's thread, aio_add_sqe().
+ * Changes to AioHandlers are made by enqueuing them on ctx->submit_list so
+ * that fdmon_io_uring_wait() can submit IORING_OP_POLL_ADD and/or
+ * IORING_OP_POLL_REMOVE sqes for them.
  */
 
 #include "qemu/osdep.h"
@@ -55,6 +58,9 @@ enum {
     FDMON_IO_URING_PENDING  = (1 << 0),
     FDMON_IO_URING_ADD      = (1 << 1),
     FDMON_IO_URING_REMOVE   = (1 << 2),
+
+    /* Tag of the user_data of aio_add_sqe() requests, AioHandlers have none */
+    FDMON_IO_URING_CQE_HANDLER = 1,
 };
 
 static inline int poll_events_from_pfd(int pfd_events)
@@ -75,7 +81,7 @@ static inline int pfd_events_from_poll(int poll_events)
 
 /*
  * Returns an sqe for submitting a request.  Only be called within
- * fdmon_io_uring_wait().
+ * fdmon_io_uring_wait() or fdmon_io_uring_add_sqe().
  */
 static struct io_uring_sqe *get_sqe(AioContext *ctx)
 {
@@ -221,6 +227,17 @@ static void fill_sq_ring(AioContext *ctx)
     }
 }
 
+static void fdmon_io_uring_add_sqe(AioContext *ctx,
+                                   AioPrepSqeFunc *prep_sqe, void *opaque,
+                                   CqeHandler *cqe_handler)
+{
+    struct io_uring_sqe *sqe = get_sqe(ctx);
+
+    prep_sqe(sqe, opaque);
+    io_uring_sqe_set_data(sqe, (void *)((uintptr_t)cqe_handler |
+                                        FDMON_IO_URING_CQE_HANDLER));
+}
+
 /* Returns true if a handler became ready */
 static bool process_cqe(AioContext *ctx,
                         AioHandlerList *ready_list,
@@ -234,6 +251,15 @@ static bool process_cqe(AioContext *ctx,
         return false;
     }
 
+    if ((uintptr_t)node & FDMON_IO_URING_CQE_HANDLER) {
+        CqeHandler *cqe_handler = (CqeHandler *)((uintptr_t)node &
+                                                 ~FDMON_IO_URING_CQE_HANDLER);
+
+        cqe_handler->cqe = *cqe;
+        QSIMPLEQ_INSERT_TAIL(&ctx->cqe_handler_ready_list, cqe_handler, next);
+        return true;
+    }
+
     /*
      * Deletion can only happen when IORING_OP_POLL_ADD completes.  If we race
      * with enqueue() here then we can safely clear the FDMON_IO_URING_REMOVE
@@ -315,10 +341,28 @@ static bool fdmon_io_uring_need_wait(AioContext *ctx)
     return false;
 }
 
+static bool fdmon_io_uring_dispatch(AioContext *ctx)
+{
+    CqeHandlerSimpleQ *ready_list = &ctx->cqe_handler_ready_list;
+    CqeHandler *cqe_handler;
+    bool progress = false;
+
+    /* cb() may submit new requests or call aio_poll() */
+    while ((cqe_handler = QSIMPLEQ_FIRST(ready_list))) {
+        QSIMPLEQ_REMOVE_HEAD(ready_list, next);
+        cqe_handler->cb(cqe_handler);
+        progress = true;
+    }
+
+    return progress;
+}
+
 static const FDMonOps fdmon_io_uring_ops = {
     .update = fdmon_io_uring_update,
     .wait = fdmon_io_uring_wait,
     .need_wait = fdmon_io_uring_need_wait,
+    .dispatch = fdmon_io_uring_dispatch,
+    .add_sqe = fdmon_io_uring_add_sqe,
 };
 
 bool fdmon_io_uring_setup(AioContext *ctx)
@@ -331,6 +375,7 @@ bool fdmon_io_uring_setup(AioContext *ctx)
     }
 
     QSLIST_INIT(&ctx->submit_list);
+    QSIMPLEQ_INIT(&ctx->cqe_handler_ready_list);
     ctx->fdmon_ops = &fdmon_io_uring_ops;
     return true;
 }
@@ -101,6 +101,31 @@ struct HBitmap {
     uint64_t sizes[HBITMAP_LEVELS];
 };
 
+/* Words per cache line, the unit of the vectorized scans.  */
+#define HB_SCAN_WORDS (64 / sizeof(unsigned long))
+
+static size_t hb_find_not_ones_int(const unsigned long *words, size_t pos,
+                                   size_t end)
+{
+    for (; pos + HB_SCAN_WORDS <= end; pos += HB_SCAN_WORDS) {
+        unsigned long t = ~0UL;
+        size_t i;
+
+        for (i = 0; i < HB_SCAN_WORDS; i++) {
+            t &= words[pos + i];
+        }
+        if (t != ~0UL) {
+            break;
+        }
+    }
+    while (pos < end && words[pos] == ~0UL) {
+        pos++;
+    }
+    return pos;
+}
+
+#include "host/hbitmap-scan.c.inc"
+
 /* Advance hbi to the next nonzero word and return it.  hbi->pos
  * is updated.  Returns zero if we reach the end of the bitmap.
  */
@@ -245,10 +270,11 @@ int64_t hbitmap_next_zero(const HBitmap *hb, int64_t start, int64_t count)
     assert((start >> hb->granularity) < hb->size);
 
     if (cur == (unsigned long)-1) {
-        do {
-            pos++;
-        } while (pos < sz && last_lev[pos] == (unsigned long)-1);
-
+        /*
+         * Only the bottom level can tell zero bits apart, so long runs
+         * of set bits are scanned a cache line at a time.
+         */
+        pos = hb_find_not_ones(last_lev, pos + 1, sz);
         if (pos >= sz) {
             return -1;
         }
@@ -409,9 +435,10 @@ static uint64_t hb_count_between(HBitmap *hb, uint64_t start, uint64_t last)
 }
 
 /* Setting starts at the last layer and propagates up if an element
- * changes.
+ * changes.  Returns the number of bits that were set.
  */
-static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t last)
+static inline unsigned hb_set_elem(unsigned long *elem, uint64_t start,
+                                   uint64_t last)
 {
     unsigned long mask;
     unsigned long old;
@@ -423,48 +450,50 @@ static inline bool hb_set_elem(unsigned long *elem, uint64_t start, uint64_t las
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     old = *elem;
     *elem |= mask;
-    return old != *elem;
+    return ctpopl(mask & ~old);
 }
 
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
-static bool hb_set_between(HBitmap *hb, int level, uint64_t start,
-                           uint64_t last)
+ * Returns the number of bits that were set in @level; the levels above
+ * are updated once for the whole range.
+ */
+static uint64_t hb_set_between(HBitmap *hb, int level, uint64_t start,
+                               uint64_t last)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
-    bool changed = false;
+    uint64_t set = 0;
     size_t i;
 
     i = pos;
     if (i < lastpos) {
         uint64_t next = (start | (BITS_PER_LONG - 1)) + 1;
-        changed |= hb_set_elem(&hb->levels[level][i], start, next - 1);
+        set += hb_set_elem(&hb->levels[level][i], start, next - 1);
         for (;;) {
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] == 0);
+            set += BITS_PER_LONG - ctpopl(hb->levels[level][i]);
             hb->levels[level][i] = ~0UL;
         }
     }
-    changed |= hb_set_elem(&hb->levels[level][i], start, last);
+    set += hb_set_elem(&hb->levels[level][i], start, last);
 
     /* If there was any change in this layer, we may have to update
      * the one above.
      */
-    if (level > 0 && changed) {
+    if (level > 0 && set) {
         hb_set_between(hb, level - 1, pos, lastpos);
     }
-    return changed;
+    return set;
 }
 
 void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
 {
     /* Compute range in the last layer.  */
-    uint64_t first, n;
+    uint64_t first, set;
     uint64_t last = start + count - 1;
 
     if (count == 0) {
@@ -477,19 +506,20 @@ void hbitmap_set(HBitmap *hb, uint64_t start, uint64_t count)
     first = start >> hb->granularity;
     last >>= hb->granularity;
     assert(last < hb->size);
-    n = last - first + 1;
 
-    hb->count += n - hb_count_between(hb, first, last);
-    if (hb_set_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
+    set = hb_set_between(hb, HBITMAP_LEVELS - 1, first, last);
+    hb->count += set;
+    if (set && hb->meta) {
         hbitmap_set(hb->meta, start, count);
     }
 }
 
 /* Resetting works the other way round: propagate up if the new
- * value is zero.
+ * value is zero.  *@cleared is increased by the number of bits that
+ * were reset.
  */
-static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t last)
+static inline bool hb_reset_elem(unsigned long *elem, uint64_t start,
+                                 uint64_t last, uint64_t *cleared)
 {
     unsigned long mask;
     bool blanked;
@@ -500,18 +530,22 @@ static inline bool hb_reset_elem(unsigned long *elem, uint64_t start, uint64_t l
     mask = 2UL << (last & (BITS_PER_LONG - 1));
     mask -= 1UL << (start & (BITS_PER_LONG - 1));
     blanked = *elem != 0 && ((*elem & ~mask) == 0);
+    *cleared += ctpopl(*elem & mask);
     *elem &= ~mask;
     return blanked;
 }
 
 /* The recursive workhorse (the depth is limited to HBITMAP_LEVELS)...
- * Returns true if at least one bit is changed. */
-static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
-                             uint64_t last)
+ * Returns the number of bits that were reset in @level; the levels above
+ * are updated once for the whole range.
+ */
+static uint64_t hb_reset_between(HBitmap *hb, int level, uint64_t start,
+                                 uint64_t last)
 {
     size_t pos = start >> BITS_PER_LEVEL;
     size_t lastpos = last >> BITS_PER_LEVEL;
     bool changed = false;
+    uint64_t cleared = 0;
     size_t i;
 
     i = pos;
@@ -523,25 +557,30 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
          * unless the lower-level word became entirely zero.  So, remove pos
          * from the upper-level range if bits remain set.
          */
-        if (hb_reset_elem(&hb->levels[level][i], start, next - 1)) {
+        if (hb_reset_elem(&hb->levels[level][i], start, next - 1,
+                          &cleared)) {
             changed = true;
         } else {
             pos++;
         }
 
         for (;;) {
+            unsigned long old;
+
             start = next;
             next += BITS_PER_LONG;
             if (++i == lastpos) {
                 break;
             }
-            changed |= (hb->levels[level][i] != 0);
+            old = hb->levels[level][i];
+            changed |= (old != 0);
+            cleared += ctpopl(old);
             hb->levels[level][i] = 0UL;
         }
     }
 
     /* Same as above, this time for lastpos.  */
-    if (hb_reset_elem(&hb->levels[level][i], start, last)) {
+    if (hb_reset_elem(&hb->levels[level][i], start, last, &cleared)) {
         changed = true;
     } else {
         lastpos--;
@@ -551,14 +590,13 @@ static bool hb_reset_between(HBitmap *hb, int level, uint64_t start,
         hb_reset_between(hb, level - 1, pos, lastpos);
     }
 
-    return changed;
-
+    return cleared;
 }
 
 void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
 {
     /* Compute range in the last layer.  */
-    uint64_t first;
+    uint64_t first, cleared;
     uint64_t last = start + count - 1;
     uint64_t gran = 1ULL << hb->granularity;
 
@@ -576,9 +614,9 @@ void hbitmap_reset(HBitmap *hb, uint64_t start, uint64_t count)
     last >>= hb->granularity;
     assert(last < hb->size);
 
-    hb->count -= hb_count_between(hb, first, last);
-    if (hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last) &&
-        hb->meta) {
+    cleared = hb_reset_between(hb, HBITMAP_LEVELS - 1, first, last);
+    hb->count -= cleared;
+    if (cleared && hb->meta) {
         hbitmap_set(hb->meta, start, count);
     }
 }
@@ -593,6 +631,9 @@ void hbitmap_reset_all(HBitmap *hb)
     }
 
     hb->levels[0][0] = 1UL << (BITS_PER_LONG - 1);
+    if (hb->count && hb->meta) {
+        hbitmap_set(hb->meta, 0, hb->orig_size);
+    }
     hb->count = 0;
 }
 
@@ -717,6 +758,9 @@ void hbitmap_deserialize_part(HBitmap *hb, uint8_t *buf,
         buf += sizeof(unsigned long);
         cur++;
     }
+    if (hb->meta) {
+        hbitmap_set(hb->meta, start, count);
+    }
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -734,6 +778,9 @@ void hbitmap_deserialize_zeroes(HBitmap *hb, uint64_t start, uint64_t count,
     serialization_chunk(hb, start, count, &first, &el_count);
 
     memset(first, 0, el_count * sizeof(unsigned long));
+    if (hb->meta) {
+        hbitmap_set(hb->meta, start, count);
+    }
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -751,6 +798,9 @@ void hbitmap_deserialize_ones(HBitmap *hb, uint64_t start, uint64_t count,
     serialization_chunk(hb, start, count, &first, &el_count);
 
     memset(first, 0xff, el_count * sizeof(unsigned long));
+    if (hb->meta) {
+        hbitmap_set(hb->meta, start, count);
+    }
     if (finish) {
         hbitmap_deserialize_finish(hb);
     }
@@ -820,6 +870,22 @@ HBitmap *hbitmap_alloc(uint64_t size, int granularity)
     return hb;
 }
 
+HBitmap *hbitmap_create_meta(HBitmap *hb, int chunk_size)
+{
+    assert(chunk_size > 0 && !(chunk_size & (chunk_size - 1)));
+    assert(!hb->meta);
+    hb->meta = hbitmap_alloc(hb->size << hb->granularity,
+                             hb->granularity + ctz32(chunk_size));
+    return hb->meta;
+}
+
+void hbitmap_free_meta(HBitmap *hb)
+{
+    assert(hb->meta);
+    hbitmap_free(hb->meta);
+    hb->meta = NULL;
+}
+
 void hbitmap_truncate(HBitmap *hb, uint64_t size)
 {
     bool shrink;
@@ -942,6 +1008,9 @@ void hbitmap_merge(const HBitmap *a, const HBitmap *b, HBitmap *result)
 
     /* Recompute the dirty count */
     result->count = hb_count_between(result, 0, result->size - 1);
+    if (result->meta) {
+        hbitmap_set(result->meta, 0, result->orig_size);
+    }
 }
 
 char *hbitmap_sha256(const HBitmap *bitmap, Error **errp)
@@ -61,19 +61,29 @@
 #include "qemu/mmap-alloc.h"
 
 #define MAX_MEM_PREALLOC_THREAD_COUNT 16
+/* Unit of work, and of cancellation latency, of background preallocation */
+#define MEM_PREALLOC_BACKGROUND_CHUNK (64 * MiB)
 
 struct MemsetThread;
 
 static QLIST_HEAD(, MemsetContext) memset_contexts =
     QLIST_HEAD_INITIALIZER(memset_contexts);
 
-typedef struct MemsetContext {
+struct MemsetContext {
     bool all_threads_created;
     bool any_thread_failed;
     struct MemsetThread *threads;
     int num_threads;
     QLIST_ENTRY(MemsetContext) next;
-} MemsetContext;
+
+    /* Only used for background preallocation */
+    char *area;
+    size_t size;
+    size_t chunk_size;
+    size_t next_offset;
+    bool stop;
+    int ret;
+};
 
 struct MemsetThread {
     char *addr;
@@ -398,6 +408,45 @@ static void *do_madv_populate_write_pages(void *arg)
     return (void *)(uintptr_t)ret;
 }
 
+/*
+ * Populate the area chunk by chunk, each thread taking the next chunk that
+ * nobody claimed yet.  vCPUs touching memory meanwhile fault it in on their
+ * own, so the pages the guest uses first never wait for these threads.
+ */
+static void *do_madv_populate_write_background(void *arg)
+{
+    MemsetThread *memset_args = (MemsetThread *)arg;
+    MemsetContext *context = memset_args->context;
+    size_t offset, len;
+    int ret;
+
+    /* See do_touch_pages(). */
+    qemu_mutex_lock(&page_mutex);
+    while (!context->all_threads_created) {
+        qemu_cond_wait(&page_cond, &page_mutex);
+    }
+    qemu_mutex_unlock(&page_mutex);
+
+    while (!qatomic_read(&context->stop)) {
+        offset = qatomic_fetch_add(&context->next_offset, context->chunk_size);
+        if (offset >= context->size) {
+            break;
+        }
+        len = MIN(context->chunk_size, context->size - offset);
+        if (qemu_madvise(context->area + offset, len,
+                         QEMU_MADV_POPULATE_WRITE)) {
+            ret = -errno;
+            qatomic_set(&context->stop, true);
+            if (!qatomic_cmpxchg(&context->ret, 0, ret)) {
+                warn_report("qemu_prealloc_mem: preallocating memory in the "
+                            "background failed: %s", strerror(-ret));
+            }
+            break;
+        }
+    }
+    return NULL;
+}
+
 static inline int get_memset_num_threads(size_t hpagesize, size_t numpages,
                                          int max_threads)
 {
@@ -433,11 +482,21 @@ static int wait_and_free_mem_prealloc_context(MemsetContext *context)
     return ret;
 }
 
+static void page_mutex_init(void)
+{
+    static gsize initialized;
+
+    if (g_once_init_enter(&initialized)) {
+        qemu_mutex_init(&page_mutex);
+        qemu_cond_init(&page_cond);
+        g_once_init_leave(&initialized, 1);
+    }
+}
+
 static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
                            int max_threads, ThreadContext *tc, bool async,
                            bool use_madv_populate_write)
 {
-    static gsize initialized = 0;
     MemsetContext *context = g_malloc0(sizeof(MemsetContext));
     size_t numpages_per_thread, leftover;
     void *(*touch_fn)(void *);
@@ -455,11 +514,7 @@ static int touch_all_pages(char *area, size_t hpagesize, size_t numpages,
     context->num_threads =
         get_memset_num_threads(hpagesize, numpages, max_threads);
 
-    if (g_once_init_enter(&initialized)) {
-        qemu_mutex_init(&page_mutex);
-        qemu_cond_init(&page_cond);
-        g_once_init_leave(&initialized, 1);
-    }
+    page_mutex_init();
 
     if (use_madv_populate_write) {
         /*
@@ -631,6 +686,62 @@ bool qemu_prealloc_mem(int fd, char *area, size_t sz, int max_threads,
     return rv;
 }
 
+MemsetContext *qemu_prealloc_mem_background(int fd, char *area, size_t sz,
+                                            int max_threads, ThreadContext *tc,
+                                            Error **errp)
+{
+    size_t hpagesize = qemu_fd_getpagesize(fd);
+    size_t numpages = DIV_ROUND_UP(sz, hpagesize);
+    MemsetContext *context;
+    int i;
+
+    /*
+     * Touching pages relies on catching SIGBUS in the touching thread,
+     * which does not work while the guest runs and may fault as well.
+     */
+    if (!madv_populate_write_possible(area, hpagesize)) {
+        error_setg(errp, "qemu_prealloc_mem: background preallocation "
+                   "requires MADV_POPULATE_WRITE");
+        return NULL;
+    }
+
+    page_mutex_init();
+
+    context = g_new0(MemsetContext, 1);
+    context->area = area;
+    context->size = numpages * hpagesize;
+    context->chunk_size = ROUND_UP(MEM_PREALLOC_BACKGROUND_CHUNK, hpagesize);
+    context->num_threads =
+        get_memset_num_threads(hpagesize, numpages, max_threads);
+    context->threads = g_new0(MemsetThread, context->num_threads);
+    for (i = 0; i < context->num_threads; i++) {
+        context->threads[i].context = context;
+        if (tc) {
+            thread_context_create_thread(tc, &context->threads[i].pgthread,
+                                         "prealloc_bg",
+                                         do_madv_populate_write_background,
+                                         &context->threads[i],
+                                         QEMU_THREAD_JOINABLE);
+        } else {
+            qemu_thread_create(&context->threads[i].pgthread, "prealloc_bg",
+                               do_madv_populate_write_background,
+                               &context->threads[i], QEMU_THREAD_JOINABLE);
+        }
+    }
+
+    qemu_mutex_lock(&page_mutex);
+    context->all_threads_created = true;
+    qemu_cond_broadcast(&page_cond);
+    qemu_mutex_unlock(&page_mutex);
+    return context;
+}
+
+void qemu_prealloc_mem_background_stop(MemsetContext *context)
+{
+    qatomic_set(&context->stop, true);
+    wait_and_free_mem_prealloc_context(context);
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     char *name = NULL;
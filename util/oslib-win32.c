@@ -284,6 +284,20 @@ bool qemu_finish_async_prealloc_mem(Error **errp)
     return true;
 }
 
+MemsetContext *qemu_prealloc_mem_background(int fd, char *area, size_t sz,
+                                            int max_threads, ThreadContext *tc,
+                                            Error **errp)
+{
+    error_setg(errp, "background preallocation is not supported");
+    return NULL;
+}
+
+void qemu_prealloc_mem_background_stop(MemsetContext *context)
+{
+    /* qemu_prealloc_mem_background() never succeeds */
+    g_assert_not_reached();
+}
+
 char *qemu_get_pid_name(pid_t pid)
 {
     /* XXX Implement me */
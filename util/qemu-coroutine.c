@@ -21,8 +21,15 @@
 #include "qemu/cutils.h"
 #include "block/aio.h"
 
+#ifdef CONFIG_LINUX
+#include <sys/syscall.h>
+#endif
+
 enum {
     COROUTINE_POOL_BATCH_MAX_SIZE = 128,
+
+    /* Hosts with more NUMA nodes share global pools between nodes */
+    COROUTINE_POOL_MAX_NODES = 16,
 };
 
 /*
@@ -37,8 +44,13 @@ enum {
  * batches whereas the maximum size of the global pool is controlled by the
  * qemu_coroutine_inc_pool_size() API.
  *
+ * The global pool is split by the NUMA node that threads run on, so that
+ * stacks, whose memory is allocated on the node that first touches it, are
+ * recycled on the same node if possible.  All coroutines in a batch have the
+ * same stack size, that of the thread that filled it.
+ *
  * .-----------------------------------.
- * | Batch 1 | Batch 2 | Batch 3 | ... | global_pool
+ * | Batch 1 | Batch 2 | Batch 3 | ... | global_pools[node]
  * `-----------------------------------'
  *
  * .-------------------.
@@ -52,20 +64,49 @@ typedef struct CoroutinePoolBatch {
     /* This batch holds up to @COROUTINE_POOL_BATCH_MAX_SIZE coroutines */
     QSLIST_HEAD(, Coroutine) list;
     unsigned int size;
+
+    /* Stack size of the coroutines in the batch */
+    size_t stack_size;
 } CoroutinePoolBatch;
 
 typedef QSLIST_HEAD(, CoroutinePoolBatch) CoroutinePool;
 
+typedef struct CoroutineGlobalPool {
+    QemuMutex lock; /* protects batches */
+    CoroutinePool batches;
+} CoroutineGlobalPool;
+
 /* Host operating system limit on number of pooled coroutines */
 static unsigned int global_pool_hard_max_size;
 
-static QemuMutex global_pool_lock; /* protects the following variables */
-static CoroutinePool global_pool = QSLIST_HEAD_INITIALIZER(global_pool);
+static CoroutineGlobalPool global_pools[COROUTINE_POOL_MAX_NODES];
+
+/* Coroutines in all of global_pools, and the limit; accessed atomically */
 static unsigned int global_pool_size;
 static unsigned int global_pool_max_size = COROUTINE_POOL_BATCH_MAX_SIZE;
 
 QEMU_DEFINE_STATIC_CO_TLS(CoroutinePool, local_pool);
 QEMU_DEFINE_STATIC_CO_TLS(Notifier, local_pool_cleanup_notifier);
+QEMU_DEFINE_STATIC_CO_TLS(size_t, local_stack_size);
+
+/* Stack size of the coroutines that the current thread creates */
+static size_t coroutine_stack_size(void)
+{
+    return get_local_stack_size() ?: COROUTINE_STACK_SIZE;
+}
+
+/* The global pool of the NUMA node the current thread runs on */
+static CoroutineGlobalPool *coroutine_global_pool(void)
+{
+#ifdef CONFIG_LINUX
+    unsigned int cpu, node;
+
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) == 0) {
+        return &global_pools[node % COROUTINE_POOL_MAX_NODES];
+    }
+#endif
+    return &global_pools[0];
+}
 
 static CoroutinePoolBatch *coroutine_pool_batch_new(void)
 {
@@ -73,6 +114,7 @@ static CoroutinePoolBatch *coroutine_pool_batch_new(void)
 
     QSLIST_INIT(&batch->list);
     batch->size = 0;
+    batch->stack_size = coroutine_stack_size();
     return batch;
 }
 
@@ -132,18 +174,42 @@ static Coroutine *coroutine_pool_get_local(void)
     return co;
 }
 
-/* Get the next batch from the global pool */
+/* Take a batch of coroutines with @stack_size from @pool, if any */
+static CoroutinePoolBatch *coroutine_pool_take_global(CoroutineGlobalPool *pool,
+                                                      size_t stack_size)
+{
+    CoroutinePoolBatch *batch;
+
+    QEMU_LOCK_GUARD(&pool->lock);
+    QSLIST_FOREACH(batch, &pool->batches, next) {
+        if (batch->stack_size == stack_size) {
+            QSLIST_REMOVE(&pool->batches, batch, CoroutinePoolBatch, next);
+            qatomic_sub(&global_pool_size, batch->size);
+            return batch;
+        }
+    }
+    return NULL;
+}
+
+/*
+ * Get the next batch from the global pool, preferring the local NUMA node
+ * but using other nodes' stacks rather than allocating new ones
+ */
 static void coroutine_pool_refill_local(void)
 {
     CoroutinePool *local_pool = get_ptr_local_pool();
+    CoroutineGlobalPool *pool = coroutine_global_pool();
+    size_t stack_size = coroutine_stack_size();
     CoroutinePoolBatch *batch = NULL;
 
-    WITH_QEMU_LOCK_GUARD(&global_pool_lock) {
-        batch = QSLIST_FIRST(&global_pool);
+    if (!qatomic_read(&global_pool_size)) {
+        return;
+    }
 
-        if (batch) {
-            QSLIST_REMOVE_HEAD(&global_pool, next);
-            global_pool_size -= batch->size;
+    for (int i = 0; i < COROUTINE_POOL_MAX_NODES && !batch; i++) {
+        batch = coroutine_pool_take_global(pool, stack_size);
+        if (++pool == &global_pools[COROUTINE_POOL_MAX_NODES]) {
+            pool = &global_pools[0];
         }
     }
 
@@ -156,17 +222,18 @@ static void coroutine_pool_refill_local(void)
 /* Add a batch of coroutines to the global pool */
 static void coroutine_pool_put_global(CoroutinePoolBatch *batch)
 {
-    WITH_QEMU_LOCK_GUARD(&global_pool_lock) {
-        unsigned int max = MIN(global_pool_max_size,
-                               global_pool_hard_max_size);
+    unsigned int max = MIN(qatomic_read(&global_pool_max_size),
+                           global_pool_hard_max_size);
 
-        if (global_pool_size < max) {
-            QSLIST_INSERT_HEAD(&global_pool, batch, next);
+    /* Overshooting the max pool size is allowed */
+    if (qatomic_read(&global_pool_size) < max) {
+        CoroutineGlobalPool *pool = coroutine_global_pool();
 
-            /* Overshooting the max pool size is allowed */
-            global_pool_size += batch->size;
-            return;
+        WITH_QEMU_LOCK_GUARD(&pool->lock) {
+            QSLIST_INSERT_HEAD(&pool->batches, batch, next);
+            qatomic_add(&global_pool_size, batch->size);
         }
+        return;
     }
 
     /* The global pool was full, so throw away this batch */
@@ -191,6 +258,12 @@ static void coroutine_pool_put(Coroutine *co)
     CoroutinePool *local_pool = get_ptr_local_pool();
     CoroutinePoolBatch *batch = QSLIST_FIRST(local_pool);
 
+    /* Created by a thread with another stack size, keep the pool uniform */
+    if (unlikely(co->stack_size != coroutine_stack_size())) {
+        qemu_coroutine_delete(co);
+        return;
+    }
+
     if (unlikely(!batch)) {
         batch = coroutine_pool_batch_new();
         QSLIST_INSERT_HEAD(local_pool, batch, next);
@@ -214,6 +287,17 @@ static void coroutine_pool_put(Coroutine *co)
     batch->size++;
 }
 
+void qemu_coroutine_set_stack_size(size_t size)
+{
+    assert(size == 0 || size >= COROUTINE_STACK_SIZE_MIN);
+
+    /* The local pool only holds coroutines with the current stack size */
+    if ((size ?: COROUTINE_STACK_SIZE) != coroutine_stack_size()) {
+        local_pool_cleanup(NULL, NULL);
+    }
+    set_local_stack_size(size);
+}
+
 Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
 {
     Coroutine *co = NULL;
@@ -223,7 +307,10 @@ Coroutine *qemu_coroutine_create(CoroutineEntry *entry, void *opaque)
     }
 
     if (!co) {
-        co = qemu_coroutine_new();
+        size_t stack_size = coroutine_stack_size();
+
+        co = qemu_coroutine_new(stack_size);
+        co->stack_size = stack_size;
     }
 
     co->entry = entry;
@@ -351,14 +438,12 @@ AioContext *qemu_coroutine_get_aio_context(Coroutine *co)
 
 void qemu_coroutine_inc_pool_size(unsigned int additional_pool_size)
 {
-    QEMU_LOCK_GUARD(&global_pool_lock);
-    global_pool_max_size += additional_pool_size;
+    qatomic_add(&global_pool_max_size, additional_pool_size);
 }
 
 void qemu_coroutine_dec_pool_size(unsigned int removing_pool_size)
 {
-    QEMU_LOCK_GUARD(&global_pool_lock);
-    global_pool_max_size -= removing_pool_size;
+    qatomic_sub(&global_pool_max_size, removing_pool_size);
 }
 
 static unsigned int get_global_pool_hard_max_size(void)
@@ -396,6 +481,8 @@ static unsigned int get_global_pool_hard_max_size(void)
 
 static void __attribute__((constructor)) qemu_coroutine_init(void)
 {
-    qemu_mutex_init(&global_pool_lock);
+    for (int i = 0; i < COROUTINE_POOL_MAX_NODES; i++) {
+        qemu_mutex_init(&global_pools[i].lock);
+    }
     global_pool_hard_max_size = get_global_pool_hard_max_size();
 }
@@ -733,12 +733,18 @@ static bool vsock_parse_vaddr_to_sockaddr(const VsockSocketAddress *vaddr,
     return true;
 }
 
+static int vsock_socktype(const VsockSocketAddress *vaddr)
+{
+    return vaddr->has_seqpacket && vaddr->seqpacket ? SOCK_SEQPACKET
+                                                     : SOCK_STREAM;
+}
+
 static int vsock_connect_addr(const VsockSocketAddress *vaddr,
                               const struct sockaddr_vm *svm, Error **errp)
 {
     int sock, rc;
 
-    sock = qemu_socket(AF_VSOCK, SOCK_STREAM, 0);
+    sock = qemu_socket(AF_VSOCK, vsock_socktype(vaddr), 0);
     if (sock < 0) {
         error_setg_errno(errp, errno, "Failed to create socket family %d",
                          AF_VSOCK);
@@ -785,7 +791,7 @@ static int vsock_listen_saddr(VsockSocketAddress *vaddr,
         return -1;
     }
 
-    slisten = qemu_socket(AF_VSOCK, SOCK_STREAM, 0);
+    slisten = qemu_socket(AF_VSOCK, vsock_socktype(vaddr), 0);
     if (slisten < 0) {
         error_setg_errno(errp, errno, "Failed to create socket");
         return -1;
@@ -871,6 +877,12 @@ static bool saddr_is_tight(UnixSocketAddress *saddr)
 #endif
 }
 
+static int unix_socktype(UnixSocketAddress *saddr)
+{
+    return saddr->has_seqpacket && saddr->seqpacket ? SOCK_SEQPACKET
+                                                     : SOCK_STREAM;
+}
+
 static int unix_listen_saddr(UnixSocketAddress *saddr,
                              int num,
                              Error **errp)
@@ -883,7 +895,7 @@ static int unix_listen_saddr(UnixSocketAddress *saddr,
     size_t pathlen;
     size_t addrlen;
 
-    sock = qemu_socket(PF_UNIX, SOCK_STREAM, 0);
+    sock = qemu_socket(PF_UNIX, unix_socktype(saddr), 0);
     if (sock < 0) {
         error_setg_errno(errp, errno, "Failed to create Unix socket");
         return -1;
@@ -974,7 +986,7 @@ static int unix_connect_saddr(UnixSocketAddress *saddr, Error **errp)
         return -1;
     }
 
-    sock = qemu_socket(PF_UNIX, SOCK_STREAM, 0);
+    sock = qemu_socket(PF_UNIX, unix_socktype(saddr), 0);
     if (sock < 0) {
         error_setg_errno(errp, errno, "Failed to create socket");
         return -1;
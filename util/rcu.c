@@ -32,6 +32,8 @@
 #include "qemu/thread.h"
 #include "qemu/main-loop.h"
 #include "qemu/lockable.h"
+#include "qemu/stats64.h"
+#include "trace.h"
 #if defined(CONFIG_MALLOC_TRIM)
 #include <malloc.h>
 #endif
@@ -46,10 +48,23 @@
 unsigned long rcu_gp_ctr = RCU_GP_LOCKED;
 
 QemuEvent rcu_gp_event;
-static int in_drain_call_rcu;
+static QemuEvent rcu_call_ready_event;
 static QemuMutex rcu_registry_lock;
 static QemuMutex rcu_sync_lock;
 
+/*
+ * Nonzero while someone wants the current grace period to end as soon as
+ * possible: drain_call_rcu(), synchronize_rcu_expedited() or the call_rcu
+ * thread when the backlog is large.
+ */
+static int rcu_expedite;
+
+static struct {
+    Stat64 max_pending;
+    Stat64 invoked;
+    Stat64 grace_periods;
+    Stat64 expedited_grace_periods;
+} rcu_stats;
 /*
  * Check whether a quiescent state was crossed between the beginning of
  * update_counter_and_wait and now.
@@ -76,6 +91,7 @@ static void wait_for_readers(void)
 {
     ThreadList qsreaders = QLIST_HEAD_INITIALIZER(qsreaders);
     struct rcu_reader_data *index, *tmp;
+    bool waited = false;
 
     for (;;) {
         /* We want to be notified of changes made to rcu_gp_ongoing
@@ -106,7 +122,7 @@ static void wait_for_readers(void)
                  * get some extra futex wakeups.
                  */
                 qatomic_set(&index->waiting, false);
-            } else if (qatomic_read(&in_drain_call_rcu)) {
+            } else if (qatomic_read(&rcu_expedite)) {
                 notifier_list_notify(&index->force_rcu, NULL);
             }
         }
@@ -135,10 +151,20 @@ static void wait_for_readers(void)
         qemu_mutex_unlock(&rcu_registry_lock);
         qemu_event_wait(&rcu_gp_event);
         qemu_mutex_lock(&rcu_registry_lock);
+        waited = true;
     }
 
     /* put back the reader list in the registry */
     QLIST_SWAP(&registry, &qsreaders, node);
+
+    /*
+     * The call_rcu thread could not see the callbacks queued by the
+     * readers in qsreaders while rcu_registry_lock was released; make
+     * it look again.
+     */
+    if (waited) {
+        qemu_event_set(&rcu_call_ready_event);
+    }
 }
 
 void synchronize_rcu(void)
@@ -155,6 +181,11 @@ void synchronize_rcu(void)
 
     QEMU_LOCK_GUARD(&rcu_registry_lock);
     if (!QLIST_EMPTY(&registry)) {
+        stat64_add(&rcu_stats.grace_periods, 1);
+        if (qatomic_read(&rcu_expedite)) {
+            stat64_add(&rcu_stats.expedited_grace_periods, 1);
+        }
+
         if (sizeof(rcu_gp_ctr) < 8) {
             /* For architectures with 32-bit longs, a two-subphases algorithm
              * ensures we do not encounter overflow bugs.
@@ -173,16 +204,35 @@ void synchronize_rcu(void)
     }
 }
 
+void synchronize_rcu_expedited(void)
+{
+    qatomic_inc(&rcu_expedite);
+    synchronize_rcu();
+    qatomic_dec(&rcu_expedite);
+}
+
 
 #define RCU_CALL_MIN_SIZE        30
 
-/* Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
+/*
+ * With this many callbacks pending the call_rcu thread does not wait for
+ * more to pile up, and expedites the grace period: the memory they hold
+ * is worth more than the readers that get kicked.
+ */
+#define RCU_CALL_EXPEDITE_SIZE   1000
+
+/*
+ * Callbacks of registered threads are batched in their rcu_reader_data,
+ * so that they do not bounce a shared cache line; the call_rcu thread
+ * collects them all at once.  Threads that are not registered use the
+ * global queue below.
+ *
+ * Multi-producer, single-consumer queue based on urcu/static/wfqueue.h
  * from liburcu.  Note that head is only used by the consumer.
  */
 static struct rcu_head dummy;
 static struct rcu_head *head = &dummy, **tail = &dummy.next;
 static int rcu_call_count;
-static QemuEvent rcu_call_ready_event;
 
 static void enqueue(struct rcu_head *node)
 {
@@ -252,6 +302,71 @@ retry:
     return node;
 }
 
+/*
+ * Append the callbacks queued by @reader to the list that ends at *@tail,
+ * oldest first, and return how many there were.  Called with
+ * rcu_registry_lock held.
+ */
+static unsigned long take_reader_callbacks(struct rcu_reader_data *reader,
+                                           struct rcu_head ***tail)
+{
+    struct rcu_head *node = qatomic_xchg(&reader->cb_head, NULL);
+    struct rcu_head *list = NULL, *last = node;
+    unsigned long n = 0;
+
+    if (!node) {
+        return 0;
+    }
+
+    while (node) {
+        struct rcu_head *next = node->next;
+
+        node->next = list;
+        list = node;
+        node = next;
+        n++;
+    }
+    qatomic_sub(&reader->cb_count, n);
+
+    **tail = list;
+    *tail = &last->next;
+    return n;
+}
+
+/*
+ * Move the callbacks queued by @reader to the global queue, for a thread
+ * that is going away from the registry.  Called with rcu_registry_lock held.
+ */
+static void flush_reader_callbacks(struct rcu_reader_data *reader)
+{
+    struct rcu_head *list = NULL, **tail = &list;
+    unsigned long n = take_reader_callbacks(reader, &tail);
+
+    while (list) {
+        struct rcu_head *next = list->next;
+
+        enqueue(list);
+        list = next;
+    }
+    if (n) {
+        qatomic_add(&rcu_call_count, n);
+        qemu_event_set(&rcu_call_ready_event);
+    }
+}
+
+static unsigned long rcu_call_pending(void)
+{
+    struct rcu_reader_data *index;
+    unsigned long n;
+
+    QEMU_LOCK_GUARD(&rcu_registry_lock);
+    n = qatomic_read(&rcu_call_count);
+    QLIST_FOREACH(index, &registry, node) {
+        n += qatomic_read(&index->cb_count);
+    }
+    return n;
+}
+
 static void *call_rcu_thread(void *opaque)
 {
     struct rcu_head *node;
@@ -259,18 +374,24 @@ static void *call_rcu_thread(void *opaque)
     rcu_register_thread();
 
     for (;;) {
+        struct rcu_head *batch = NULL, **batch_tail = &batch;
+        struct rcu_reader_data *index;
         int tries = 0;
-        int n = qatomic_read(&rcu_call_count);
+        unsigned long n = rcu_call_pending();
+        unsigned long total;
+        bool expedite;
+        int global;
 
-        /* Heuristically wait for a decent number of callbacks to pile up.
-         * Fetch rcu_call_count now, we only must process elements that were
-         * added before synchronize_rcu() starts.
+        /* Heuristically wait for a decent number of callbacks to pile up,
+         * unless someone is waiting for them.
          */
-        while (n == 0 || (n < RCU_CALL_MIN_SIZE && ++tries <= 5)) {
+        while (n == 0 ||
+               (n < RCU_CALL_MIN_SIZE && ++tries <= 5 &&
+                !qatomic_read(&rcu_expedite))) {
             g_usleep(10000);
             if (n == 0) {
                 qemu_event_reset(&rcu_call_ready_event);
-                n = qatomic_read(&rcu_call_count);
+                n = rcu_call_pending();
                 if (n == 0) {
 #if defined(CONFIG_MALLOC_TRIM)
                     malloc_trim(4 * 1024 * 1024);
@@ -278,12 +399,36 @@ static void *call_rcu_thread(void *opaque)
                     qemu_event_wait(&rcu_call_ready_event);
                 }
             }
-            n = qatomic_read(&rcu_call_count);
+            n = rcu_call_pending();
+        }
+
+        /*
+         * Collect the callbacks now, we only must process elements that
+         * were added before synchronize_rcu() starts.  rcu_registry_lock
+         * orders this against threads that enter or leave the registry,
+         * so that each thread's callbacks still run in the order they
+         * were queued: those in the global queue first.
+         */
+        WITH_QEMU_LOCK_GUARD(&rcu_registry_lock) {
+            global = qatomic_read(&rcu_call_count);
+            total = global;
+            QLIST_FOREACH(index, &registry, node) {
+                total += take_reader_callbacks(index, &batch_tail);
+            }
+        }
+        qatomic_sub(&rcu_call_count, global);
+
+        stat64_max(&rcu_stats.max_pending, total);
+        expedite = total >= RCU_CALL_EXPEDITE_SIZE;
+        trace_call_rcu_batch(total, expedite);
+        if (expedite) {
+            synchronize_rcu_expedited();
+        } else {
+            synchronize_rcu();
         }
 
-        qatomic_sub(&rcu_call_count, n);
-        synchronize_rcu();
         bql_lock();
+        n = global;
         while (n > 0) {
             node = try_dequeue();
             while (!node) {
@@ -300,6 +445,12 @@ static void *call_rcu_thread(void *opaque)
             n--;
             node->func(node);
         }
+        while (batch) {
+            node = batch;
+            batch = node->next;
+            node->func(node);
+        }
+        stat64_add(&rcu_stats.invoked, total);
         bql_unlock();
     }
     abort();
@@ -307,12 +458,36 @@ static void *call_rcu_thread(void *opaque)
 
 void call_rcu1(struct rcu_head *node, void (*func)(struct rcu_head *node))
 {
+    struct rcu_reader_data *reader = get_ptr_rcu_reader();
+
     node->func = func;
-    enqueue(node);
-    qatomic_inc(&rcu_call_count);
+    if (reader->registered) {
+        struct rcu_head *old;
+
+        qatomic_inc(&reader->cb_count);
+        do {
+            old = qatomic_read(&reader->cb_head);
+            node->next = old;
+        } while (qatomic_cmpxchg(&reader->cb_head, old, node) != old);
+    } else {
+        enqueue(node);
+        qatomic_inc(&rcu_call_count);
+    }
     qemu_event_set(&rcu_call_ready_event);
 }
 
+void rcu_get_stats(RCUStats *stats)
+{
+    *stats = (RCUStats) {
+        .pending = rcu_call_pending(),
+        .max_pending = stat64_get(&rcu_stats.max_pending),
+        .invoked = stat64_get(&rcu_stats.invoked),
+        .grace_periods = stat64_get(&rcu_stats.grace_periods),
+        .expedited_grace_periods =
+            stat64_get(&rcu_stats.expedited_grace_periods),
+    };
+}
+
 
 struct rcu_drain {
     struct rcu_head rcu;
@@ -353,16 +528,16 @@ void drain_call_rcu(void)
      * is called, all RCU callbacks that were registered on this thread
      * prior to calling this function are completed.
      *
-     * Note that since we have only one global queue of the RCU callbacks,
-     * we also end up waiting for most of RCU callbacks that were registered
-     * on the other threads, but this is a side effect that shouldn't be
-     * assumed.
+     * Note that since the call_rcu thread collects the callbacks of all
+     * threads at once, we also end up waiting for most of RCU callbacks
+     * that were registered on the other threads, but this is a side effect
+     * that shouldn't be assumed.
      */
 
-    qatomic_inc(&in_drain_call_rcu);
+    qatomic_inc(&rcu_expedite);
     call_rcu1(&rcu_drain.rcu, drain_rcu_callback);
     qemu_event_wait(&rcu_drain.drain_complete_event);
-    qatomic_dec(&in_drain_call_rcu);
+    qatomic_dec(&rcu_expedite);
 
     if (locked) {
         bql_lock();
@@ -375,13 +550,18 @@ void rcu_register_thread(void)
     assert(get_ptr_rcu_reader()->ctr == 0);
     qemu_mutex_lock(&rcu_registry_lock);
     QLIST_INSERT_HEAD(&registry, get_ptr_rcu_reader(), node);
+    get_ptr_rcu_reader()->registered = true;
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
 void rcu_unregister_thread(void)
 {
+    struct rcu_reader_data *reader = get_ptr_rcu_reader();
+
     qemu_mutex_lock(&rcu_registry_lock);
-    QLIST_REMOVE(get_ptr_rcu_reader(), node);
+    QLIST_REMOVE(reader, node);
+    reader->registered = false;
+    flush_reader_callbacks(reader);
     qemu_mutex_unlock(&rcu_registry_lock);
 }
 
@@ -453,10 +633,17 @@ static void rcu_init_unlock(void)
 
 static void rcu_init_child(void)
 {
+    struct rcu_reader_data *index;
+
     if (atfork_depth < 1) {
         return;
     }
 
+    /* Keep the callbacks of the threads that the child does not have */
+    QLIST_FOREACH(index, &registry, node) {
+        index->registered = false;
+        flush_reader_callbacks(index);
+    }
     memset(&registry, 0, sizeof(registry));
     rcu_init_complete();
 }
@@ -16,16 +16,34 @@
  */
 #include "qemu/osdep.h"
 #include "qemu/defer-call.h"
+#include "qemu/processor.h"
 #include "qemu/queue.h"
 #include "qemu/thread.h"
 #include "qemu/coroutine.h"
+#include "qemu/timer.h"
 #include "trace.h"
 #include "block/thread-pool.h"
 #include "qemu/main-loop.h"
 
 static void do_spawn_thread(ThreadPool *pool);
 
+/*
+ * Requests are spread over several queues, so that workers and the
+ * submitting thread rarely compete for the same lock.  Each worker takes
+ * requests from its own queue and steals from the others when it is empty.
+ */
+#define THREAD_POOL_NR_QUEUES 8
+
+/*
+ * A worker that runs out of requests polls the queues for a while before
+ * going to sleep.  The polling time adapts between 0 and the maximum
+ * depending on how long the worker then sleeps.
+ */
+#define THREAD_POOL_SPIN_INIT_NS (2 * SCALE_US)
+#define THREAD_POOL_SPIN_MAX_NS (32 * SCALE_US)
+
 typedef struct ThreadPoolElement ThreadPoolElement;
+typedef struct ThreadPoolQueue ThreadPoolQueue;
 
 enum ThreadState {
     THREAD_QUEUED,
@@ -39,20 +57,26 @@ struct ThreadPoolElement {
     ThreadPoolFunc *func;
     void *arg;
 
-    /* Moving state out of THREAD_QUEUED is protected by lock.  After
-     * that, only the worker thread can write to it.  Reads and writes
-     * of state and ret are ordered with memory barriers.
+    /* Moving state out of THREAD_QUEUED is protected by queue->lock.
+     * After that, only the worker thread can write to it.  Reads and
+     * writes of state and ret are ordered with memory barriers.
      */
     enum ThreadState state;
     int ret;
 
-    /* Access to this list is protected by lock.  */
+    /* Access to this list is protected by queue->lock.  */
+    ThreadPoolQueue *queue;
     QTAILQ_ENTRY(ThreadPoolElement) reqs;
 
     /* This list is only written by the thread pool's mother thread.  */
     QLIST_ENTRY(ThreadPoolElement) all;
 };
 
+struct ThreadPoolQueue {
+    QemuMutex lock;
+    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+};
+
 struct ThreadPool {
     AioContext *ctx;
     QEMUBH *completion_bh;
@@ -63,39 +87,163 @@ struct ThreadPool {
 
     /* The following variables are only accessed from one AioContext. */
     QLIST_HEAD(, ThreadPoolElement) head;
+    unsigned next_queue;
 
-    /* The following variables are protected by lock.  */
-    QTAILQ_HEAD(, ThreadPoolElement) request_list;
+    ThreadPoolQueue queues[THREAD_POOL_NR_QUEUES];
+
+    /* Requests in the queues, changed with a queue lock taken.  */
+    int nr_queued;
+
+    /* Workers polling the queues before going to sleep.  */
+    int spinning_threads;
+
+    /* The following variables are protected by lock.  cur_threads,
+     * idle_threads and max_threads are also read without it, and so
+     * are written with atomic operations.
+     */
     int cur_threads;
-    int idle_threads;
+    int idle_threads;    /* threads waiting on request_cond */
     int new_threads;     /* backlog of threads we need to create */
     int pending_threads; /* threads created but not running yet */
     int min_threads;
     int max_threads;
+    unsigned next_home;  /* queue of the next worker */
 };
 
+/* Take a request from queue @home, or steal one from the other queues */
+static ThreadPoolElement *thread_pool_pop(ThreadPool *pool, unsigned home)
+{
+    for (unsigned i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        ThreadPoolQueue *q = &pool->queues[(home + i) % THREAD_POOL_NR_QUEUES];
+        ThreadPoolElement *req;
+
+        if (!qatomic_read(&pool->nr_queued)) {
+            return NULL;
+        }
+
+        /* Skip the other queues while someone else is using them */
+        if (i == 0) {
+            qemu_mutex_lock(&q->lock);
+        } else if (qemu_mutex_trylock(&q->lock)) {
+            continue;
+        }
+
+        req = QTAILQ_FIRST(&q->request_list);
+        if (req) {
+            QTAILQ_REMOVE(&q->request_list, req, reqs);
+            qatomic_dec(&pool->nr_queued);
+            req->state = THREAD_ACTIVE;
+        }
+        qemu_mutex_unlock(&q->lock);
+
+        if (req) {
+            return req;
+        }
+    }
+    return NULL;
+}
+
+/* Poll the queues for up to @spin_ns, waking up a sleeping worker costs more */
+static ThreadPoolElement *thread_pool_spin(ThreadPool *pool, unsigned home,
+                                           int64_t spin_ns)
+{
+    ThreadPoolElement *req = NULL;
+    int64_t deadline;
+
+    if (!spin_ns) {
+        return NULL;
+    }
+
+    qatomic_inc(&pool->spinning_threads);
+    deadline = get_clock() + spin_ns;
+    do {
+        if (qatomic_read(&pool->nr_queued)) {
+            req = thread_pool_pop(pool, home);
+            if (req) {
+                break;
+            }
+        }
+        cpu_relax();
+    } while (get_clock() < deadline);
+    qatomic_dec(&pool->spinning_threads);
+
+    return req;
+}
+
+/*
+ * Poll for longer if work arrived soon after the worker went to sleep,
+ * and for shorter (down to not at all) if it did not.
+ */
+static int64_t thread_pool_adjust_spin(int64_t spin_ns, int64_t slept_ns)
+{
+    if (slept_ns > THREAD_POOL_SPIN_MAX_NS) {
+        spin_ns /= 2;
+        return spin_ns < THREAD_POOL_SPIN_INIT_NS ? 0 : spin_ns;
+    }
+    if (slept_ns > spin_ns) {
+        spin_ns = MAX(spin_ns * 2, THREAD_POOL_SPIN_INIT_NS);
+        return MIN(spin_ns, THREAD_POOL_SPIN_MAX_NS);
+    }
+    return spin_ns;
+}
+
 static void *worker_thread(void *opaque)
 {
     ThreadPool *pool = opaque;
+    int64_t spin_ns = THREAD_POOL_SPIN_INIT_NS;
+    unsigned home;
 
     qemu_mutex_lock(&pool->lock);
     pool->pending_threads--;
+    home = pool->next_home++ % THREAD_POOL_NR_QUEUES;
     do_spawn_thread(pool);
+    qemu_mutex_unlock(&pool->lock);
 
-    while (pool->cur_threads <= pool->max_threads) {
+    for (;;) {
         ThreadPoolElement *req;
         int ret;
 
-        if (QTAILQ_EMPTY(&pool->request_list)) {
-            pool->idle_threads++;
-            ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock, 10000);
-            pool->idle_threads--;
-            if (ret == 0 &&
-                QTAILQ_EMPTY(&pool->request_list) &&
-                pool->cur_threads > pool->min_threads) {
-                /* Timed out + no work to do + no need for warm threads = exit.  */
+        if (qatomic_read(&pool->cur_threads) >
+            qatomic_read(&pool->max_threads)) {
+            qemu_mutex_lock(&pool->lock);
+            if (pool->cur_threads > pool->max_threads) {
                 break;
             }
+            qemu_mutex_unlock(&pool->lock);
+        }
+
+        req = thread_pool_pop(pool, home);
+        if (!req) {
+            req = thread_pool_spin(pool, home, spin_ns);
+        }
+
+        if (!req) {
+            qemu_mutex_lock(&pool->lock);
+            if (pool->cur_threads > pool->max_threads) {
+                break;
+            }
+
+            qatomic_inc(&pool->idle_threads);
+            /* Read nr_queued after idle_threads, pairs with submit_aio.  */
+            smp_mb__after_rmw();
+            if (!qatomic_read(&pool->nr_queued)) {
+                int64_t start = get_clock();
+
+                ret = qemu_cond_timedwait(&pool->request_cond, &pool->lock,
+                                          10000);
+                spin_ns = thread_pool_adjust_spin(spin_ns,
+                                                  get_clock() - start);
+                if (ret == 0 &&
+                    !qatomic_read(&pool->nr_queued) &&
+                    pool->cur_threads > pool->min_threads) {
+                    /* Timed out + no work + no need for warm threads = exit */
+                    qatomic_dec(&pool->idle_threads);
+                    break;
+                }
+            }
+            qatomic_dec(&pool->idle_threads);
+            qemu_mutex_unlock(&pool->lock);
+
             /*
              * Even if there was some work to do, check if there aren't
              * too many worker threads before picking it up.
@@ -103,11 +251,6 @@ static void *worker_thread(void *opaque)
             continue;
         }
 
-        req = QTAILQ_FIRST(&pool->request_list);
-        QTAILQ_REMOVE(&pool->request_list, req, reqs);
-        req->state = THREAD_ACTIVE;
-        qemu_mutex_unlock(&pool->lock);
-
         ret = req->func(req->arg);
 
         req->ret = ret;
@@ -116,10 +259,10 @@ static void *worker_thread(void *opaque)
         req->state = THREAD_DONE;
 
         qemu_bh_schedule(pool->completion_bh);
-        qemu_mutex_lock(&pool->lock);
     }
 
-    pool->cur_threads--;
+    /* pool->lock is taken here */
+    qatomic_dec(&pool->cur_threads);
     qemu_cond_signal(&pool->worker_stopped);
 
     /*
@@ -157,7 +300,7 @@ static void spawn_thread_bh_fn(void *opaque)
 
 static void spawn_thread(ThreadPool *pool)
 {
-    pool->cur_threads++;
+    qatomic_inc(&pool->cur_threads);
     pool->new_threads++;
     /* If there are threads being created, they will spawn new workers, so
      * we don't spend time creating many threads in a loop holding a mutex or
@@ -222,9 +365,10 @@ static void thread_pool_cancel(BlockAIOCB *acb)
 
     trace_thread_pool_cancel(elem, elem->common.opaque);
 
-    QEMU_LOCK_GUARD(&pool->lock);
+    QEMU_LOCK_GUARD(&elem->queue->lock);
     if (elem->state == THREAD_QUEUED) {
-        QTAILQ_REMOVE(&pool->request_list, elem, reqs);
+        QTAILQ_REMOVE(&elem->queue->request_list, elem, reqs);
+        qatomic_dec(&pool->nr_queued);
         qemu_bh_schedule(pool->completion_bh);
 
         elem->state = THREAD_DONE;
@@ -242,6 +386,7 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
                                    BlockCompletionFunc *cb, void *opaque)
 {
     ThreadPoolElement *req;
+    ThreadPoolQueue *q;
     AioContext *ctx = qemu_get_current_aio_context();
     ThreadPool *pool = aio_get_thread_pool(ctx);
 
@@ -258,13 +403,32 @@ BlockAIOCB *thread_pool_submit_aio(ThreadPoolFunc *func, void *arg,
 
     trace_thread_pool_submit(pool, req, arg);
 
-    qemu_mutex_lock(&pool->lock);
-    if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
-        spawn_thread(pool);
+    q = &pool->queues[pool->next_queue++ % THREAD_POOL_NR_QUEUES];
+    req->queue = q;
+    qemu_mutex_lock(&q->lock);
+    qatomic_inc(&pool->nr_queued);
+    QTAILQ_INSERT_TAIL(&q->request_list, req, reqs);
+    qemu_mutex_unlock(&q->lock);
+
+    /*
+     * Read idle_threads after nr_queued, pairs with worker_thread().  Busy
+     * and polling workers pick the request up without any help; a sleeping
+     * one is woken up under the lock so that the wakeup is not lost.
+     */
+    smp_mb();
+    if (qatomic_read(&pool->idle_threads)) {
+        qemu_mutex_lock(&pool->lock);
+        qemu_cond_signal(&pool->request_cond);
+        qemu_mutex_unlock(&pool->lock);
+    } else if (!qatomic_read(&pool->spinning_threads) &&
+               qatomic_read(&pool->cur_threads) <
+               qatomic_read(&pool->max_threads)) {
+        qemu_mutex_lock(&pool->lock);
+        if (pool->idle_threads == 0 && pool->cur_threads < pool->max_threads) {
+            spawn_thread(pool);
+        }
+        qemu_mutex_unlock(&pool->lock);
     }
-    QTAILQ_INSERT_TAIL(&pool->request_list, req, reqs);
-    qemu_mutex_unlock(&pool->lock);
-    qemu_cond_signal(&pool->request_cond);
     return &req->common;
 }
 
@@ -300,7 +464,7 @@ void thread_pool_update_params(ThreadPool *pool, AioContext *ctx)
     qemu_mutex_lock(&pool->lock);
 
     pool->min_threads = ctx->thread_pool_min;
-    pool->max_threads = ctx->thread_pool_max;
+    qatomic_set(&pool->max_threads, ctx->thread_pool_max);
 
     /*
      * We either have to:
@@ -337,7 +501,10 @@ static void thread_pool_init_one(ThreadPool *pool, AioContext *ctx)
     pool->new_thread_bh = aio_bh_new(ctx, spawn_thread_bh_fn, pool);
 
     QLIST_INIT(&pool->head);
-    QTAILQ_INIT(&pool->request_list);
+    for (int i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        qemu_mutex_init(&pool->queues[i].lock);
+        QTAILQ_INIT(&pool->queues[i].request_list);
+    }
 
     thread_pool_update_params(pool, ctx);
 }
@@ -361,11 +528,11 @@ void thread_pool_free(ThreadPool *pool)
 
     /* Stop new threads from spawning */
     qemu_bh_delete(pool->new_thread_bh);
-    pool->cur_threads -= pool->new_threads;
+    qatomic_sub(&pool->cur_threads, pool->new_threads);
     pool->new_threads = 0;
 
     /* Wait for worker threads to terminate */
-    pool->max_threads = 0;
+    qatomic_set(&pool->max_threads, 0);
     qemu_cond_broadcast(&pool->request_cond);
     while (pool->cur_threads > 0) {
         qemu_cond_wait(&pool->worker_stopped, &pool->lock);
@@ -376,6 +543,9 @@ void thread_pool_free(ThreadPool *pool)
     qemu_bh_delete(pool->completion_bh);
     qemu_cond_destroy(&pool->request_cond);
     qemu_cond_destroy(&pool->worker_stopped);
+    for (int i = 0; i < THREAD_POOL_NR_QUEUES; i++) {
+        qemu_mutex_destroy(&pool->queues[i].lock);
+    }
     qemu_mutex_destroy(&pool->lock);
     g_free(pool);
 }